@@ -53,18 +53,31 @@
 /*
   包括该系统所能支持的最出色的多路复用层。以下各项应按照性能由高到低的顺序排列。
 */
+/* Perform a socket I/O of aeSubmitIO() with a plain system call. */
+static void aePerformIO(aeIO *io) {
+    if (io->op == AE_IO_READ)
+        io->res = read(io->fd,io->buf,io->len);
+    else
+        io->res = writev(io->fd,io->iov,io->iovcnt);
+    io->err = (io->res == -1) ? errno : 0;
+}
+
 /* Include the best multiplexing layer supported by this system.
  * The following should be ordered by performances, descending. */
 #ifdef HAVE_EVPORT
 #include "ae_evport.c"
 #else
-    #ifdef HAVE_EPOLL
-    #include "ae_epoll.c"
+    #ifdef HAVE_IOURING
+    #include "ae_iouring.c"
     #else
-        #ifdef HAVE_KQUEUE
-        #include "ae_kqueue.c"
+        #ifdef HAVE_EPOLL
+        #include "ae_epoll.c"
         #else
-        #include "ae_select.c"
+            #ifdef HAVE_KQUEUE
+            #include "ae_kqueue.c"
+            #else
+            #include "ae_select.c"
+            #endif
         #endif
     #endif
 #endif
@@ -80,7 +93,13 @@ aeEventLoop *aeCreateEventLoop(int setsize) {
     if (eventLoop->events == NULL || eventLoop->fired == NULL) goto err;
     eventLoop->setsize = setsize;
     eventLoop->lastTime = time(NULL);
-    eventLoop->timeEventHead = NULL;
+    eventLoop->timeEventHeap = NULL;
+    eventLoop->timeEventHeapLen = 0;
+    eventLoop->timeEventHeapSize = 0;
+    eventLoop->timeEventTable = NULL;
+    eventLoop->timeEventTableSize = 0;
+    eventLoop->timeEventCount = 0;
+    eventLoop->timeEventDeleted = NULL;
     eventLoop->timeEventNextId = 0; //默认是0
     eventLoop->stop = 0;
     //最大文件描述符初始化为-1
@@ -151,7 +170,18 @@ int aeResizeSetSize(aeEventLoop *eventLoop, int setsize) {
 }
 
 void aeDeleteEventLoop(aeEventLoop *eventLoop) {
+    aeTimeEvent *te;
+    int j;
+
     aeApiFree(eventLoop);
+    for (j = 0; j < eventLoop->timeEventHeapLen; j++)
+        zfree(eventLoop->timeEventHeap[j]);
+    while((te = eventLoop->timeEventDeleted) != NULL) {
+        eventLoop->timeEventDeleted = te->next;
+        zfree(te);
+    }
+    zfree(eventLoop->timeEventHeap);
+    zfree(eventLoop->timeEventTable);
     zfree(eventLoop->events);
     zfree(eventLoop->fired);
     zfree(eventLoop);
@@ -246,6 +276,144 @@ static void aeAddMillisecondsToNow(long long milliseconds, long *sec, long *ms)
     *ms = when_ms;
 }
 
+/* ----------------------------- Time events -------------------------------
+ *
+ * 时间事件保存在一个按触发时间排序的二叉最小堆中，最近的事件在堆顶，
+ * 所以查找最近的事件是O(1)，插入和删除是O(log(N))。
+ * 删除时需要通过id找到事件，所以另外有一个按id索引的哈希表。
+ *
+ * Time events are kept in a binary min-heap ordered by fire time, so that
+ * the nearest event is always the root: finding it is O(1), inserting or
+ * removing an event is O(log(N)). Since events are deleted by id, there is
+ * also a table mapping ids to events. */
+
+#define AE_TIME_TABLE_INITIAL_SIZE 16
+
+/* Return non-zero if 'a' fires before 'b'. */
+static int aeTimeEventBefore(aeTimeEvent *a, aeTimeEvent *b) {
+    return a->when_sec < b->when_sec ||
+           (a->when_sec == b->when_sec && a->when_ms < b->when_ms);
+}
+
+static void aeTimeHeapSet(aeEventLoop *eventLoop, int idx, aeTimeEvent *te) {
+    eventLoop->timeEventHeap[idx] = te;
+    te->heapidx = idx;
+}
+
+static void aeTimeHeapUp(aeEventLoop *eventLoop, int idx) {
+    aeTimeEvent **heap = eventLoop->timeEventHeap;
+    aeTimeEvent *te = heap[idx];
+
+    while (idx > 0) {
+        int parent = (idx-1)/2;
+
+        if (!aeTimeEventBefore(te,heap[parent])) break;
+        aeTimeHeapSet(eventLoop,idx,heap[parent]);
+        idx = parent;
+    }
+    aeTimeHeapSet(eventLoop,idx,te);
+}
+
+static void aeTimeHeapDown(aeEventLoop *eventLoop, int idx) {
+    aeTimeEvent **heap = eventLoop->timeEventHeap;
+    aeTimeEvent *te = heap[idx];
+    int len = eventLoop->timeEventHeapLen;
+
+    while (1) {
+        int child = idx*2+1;
+
+        if (child >= len) break;
+        if (child+1 < len && aeTimeEventBefore(heap[child+1],heap[child]))
+            child++;
+        if (!aeTimeEventBefore(heap[child],te)) break;
+        aeTimeHeapSet(eventLoop,idx,heap[child]);
+        idx = child;
+    }
+    aeTimeHeapSet(eventLoop,idx,te);
+}
+
+static void aeTimeHeapInsert(aeEventLoop *eventLoop, aeTimeEvent *te) {
+    if (eventLoop->timeEventHeapLen == eventLoop->timeEventHeapSize) {
+        eventLoop->timeEventHeapSize = eventLoop->timeEventHeapSize ?
+                                       eventLoop->timeEventHeapSize*2 : 16;
+        eventLoop->timeEventHeap = zrealloc(eventLoop->timeEventHeap,
+            sizeof(aeTimeEvent*)*eventLoop->timeEventHeapSize);
+    }
+    aeTimeHeapSet(eventLoop,eventLoop->timeEventHeapLen++,te);
+    aeTimeHeapUp(eventLoop,te->heapidx);
+}
+
+static void aeTimeHeapRemove(aeEventLoop *eventLoop, aeTimeEvent *te) {
+    int idx = te->heapidx;
+    aeTimeEvent *last = eventLoop->timeEventHeap[--eventLoop->timeEventHeapLen];
+
+    te->heapidx = -1;
+    if (last == te) return;
+    /* Move the last event in the hole, then restore the heap property
+     * in the direction needed. */
+    aeTimeHeapSet(eventLoop,idx,last);
+    if (idx > 0 && aeTimeEventBefore(last,
+                   eventLoop->timeEventHeap[(idx-1)/2]))
+        aeTimeHeapUp(eventLoop,idx);
+    else
+        aeTimeHeapDown(eventLoop,idx);
+}
+
+static aeTimeEvent **aeTimeTableBucket(aeEventLoop *eventLoop, long long id) {
+    return &eventLoop->timeEventTable[(unsigned long)id &
+                                      (eventLoop->timeEventTableSize-1)];
+}
+
+/* Add the event to the id table, doubling it when it gets full. Ids are
+ * sequential so they are evenly spread among the buckets. */
+static void aeTimeTableAdd(aeEventLoop *eventLoop, aeTimeEvent *te) {
+    aeTimeEvent **bucket;
+
+    if (eventLoop->timeEventCount >= eventLoop->timeEventTableSize) {
+        aeTimeEvent **old = eventLoop->timeEventTable;
+        unsigned long oldsize = eventLoop->timeEventTableSize, j;
+
+        eventLoop->timeEventTableSize = oldsize ? oldsize*2 :
+                                        AE_TIME_TABLE_INITIAL_SIZE;
+        eventLoop->timeEventTable = zcalloc(sizeof(aeTimeEvent*)*
+                                            eventLoop->timeEventTableSize);
+        for (j = 0; j < oldsize; j++) {
+            aeTimeEvent *e = old[j], *next;
+
+            while(e) {
+                next = e->hnext;
+                bucket = aeTimeTableBucket(eventLoop,e->id);
+                e->hnext = *bucket;
+                *bucket = e;
+                e = next;
+            }
+        }
+        zfree(old);
+    }
+    bucket = aeTimeTableBucket(eventLoop,te->id);
+    te->hnext = *bucket;
+    *bucket = te;
+    eventLoop->timeEventCount++;
+}
+
+/* Unlink from the id table the event with the specified id and return it,
+ * or NULL if there is no such event. */
+static aeTimeEvent *aeTimeTableRemove(aeEventLoop *eventLoop, long long id) {
+    aeTimeEvent **ref, *te;
+
+    if (eventLoop->timeEventTableSize == 0) return NULL;
+    ref = aeTimeTableBucket(eventLoop,id);
+    while((te = *ref) != NULL) {
+        if (te->id == id) {
+            *ref = te->hnext;
+            eventLoop->timeEventCount--;
+            return te;
+        }
+        ref = &te->hnext;
+    }
+    return NULL;
+}
+
 long long aeCreateTimeEvent(aeEventLoop *eventLoop, long long milliseconds,
         aeTimeProc *proc, void *clientData,
         aeEventFinalizerProc *finalizerProc)
@@ -261,25 +429,31 @@ long long aeCreateTimeEvent(aeEventLoop *eventLoop, long long milliseconds,
     te->timeProc = proc;
     te->finalizerProc = finalizerProc;
     te->clientData = clientData;
-    te->next = eventLoop->timeEventHead;
+    te->next = NULL;
 
-    //把当前时间事件放入 链表头部
-    eventLoop->timeEventHead = te;
+    //放入id哈希表和最小堆
+    aeTimeTableAdd(eventLoop,te);
+    aeTimeHeapInsert(eventLoop,te);
     return id;
 }
 
 int aeDeleteTimeEvent(aeEventLoop *eventLoop, long long id)
 {
-    aeTimeEvent *te = eventLoop->timeEventHead;
-    //从header开始循环
-    while(te) {
-        if (te->id == id) {
-            te->id = AE_DELETED_EVENT_ID; //变为-1
-            return AE_OK; //直接返回了
-        }
-        te = te->next;
+    aeTimeEvent *te = aeTimeTableRemove(eventLoop,id);
+
+    if (te == NULL) return AE_ERR; /* NO event with the specified ID found */
+    te->id = AE_DELETED_EVENT_ID; //变为-1
+
+    /* An event not in the heap is being processed by processTimeEvents(),
+     * that will free it. The other ones are finalized by the next call of
+     * processTimeEvents(), like it always happened, so that the finalizer
+     * is never called from inside aeDeleteTimeEvent(). */
+    if (te->heapidx != -1) {
+        aeTimeHeapRemove(eventLoop,te);
+        te->next = eventLoop->timeEventDeleted;
+        eventLoop->timeEventDeleted = te;
     }
-    return AE_ERR; /* NO event with the specified ID found */
+    return AE_OK;
 }
 
 //此操作有助于知道select可以在不延迟任何事件的情况下处于睡眠状态的时间
@@ -288,49 +462,36 @@ int aeDeleteTimeEvent(aeEventLoop *eventLoop, long long id)
  * put in sleep without to delay any event.
  * If there are no timers NULL is returned.
  *
- * 注意，时间复杂度是O(N) 因为时间事件是无序的。
- * Note that's O(N) since time events are unsorted.
- * Possible optimizations (not needed by Redis so far, but...):
- * 1）插入有序，这样最近的就在头部，但是插入和删除的时间复杂度就是O(N)了
- * 2）使用跳跃表
- * 1) Insert the event in order, so that the nearest is just the head.
- *    Much better but still insertion or deletion of timers is O(N).
- * 2) Use a skiplist to have this operation as O(1) and insertion as O(log(N)).
- */
+ * 最近的事件就是最小堆的堆顶 O(1)
+ * That's O(1) since the nearest event is the root of the heap. */
 static aeTimeEvent *aeSearchNearestTimer(aeEventLoop *eventLoop)
 {
-    aeTimeEvent *te = eventLoop->timeEventHead;
-    aeTimeEvent *nearest = NULL;
-
-    /* 循环te链表 */
-    while(te) {
-
-        /*如果nearest不存在 
-        或者 当前事件的 发生时间(秒) 在 最近事件的发生时间前面 
-        或者 当前事件的 发生时间(秒) 和 最近事件的发生时间相同
-        但是 当前事件的 发生时间(毫秒级别) 在 最近事件的发生时间 前面
+    return eventLoop->timeEventHeapLen ? eventLoop->timeEventHeap[0] : NULL;
+}
 
-        那么当前事件就是最近的时间事件
-        */
-        if (!nearest || te->when_sec < nearest->when_sec ||
-                (te->when_sec == nearest->when_sec &&
-                 te->when_ms < nearest->when_ms))
-            nearest = te;
-        te = te->next;
-    }
-    return nearest;
+static void aeFreeTimeEvent(aeEventLoop *eventLoop, aeTimeEvent *te) {
+    if (te->finalizerProc)
+        te->finalizerProc(eventLoop, te->clientData);
+    zfree(te);
 }
 
 /* 处理时间事件 */
 /* Process time events */
 static int processTimeEvents(aeEventLoop *eventLoop) {
     /* 处理的数量 */
-    int processed = 0;
-    aeTimeEvent *te, *prev;
-    long long maxId;
+    int processed = 0, j;
+    aeTimeEvent *te, *fired = NULL, **tail = &fired;
+    long now_sec, now_ms;
     /* 获取当前时间 */
     time_t now = time(NULL);
 
+    /*删除计划删除的事件*/
+    /* Remove events scheduled for deletion. */
+    while((te = eventLoop->timeEventDeleted) != NULL) {
+        eventLoop->timeEventDeleted = te->next;
+        aeFreeTimeEvent(eventLoop,te);
+    }
+
     /*
         如果将系统时钟移到未来，然后再设置回正确的值，可能会导致时间事件以随机方式延迟。
         这通常意味着计划的操作不会很快执行
@@ -349,73 +510,59 @@ static int processTimeEvents(aeEventLoop *eventLoop) {
      * processing events earlier is less dangerous than delaying them
      * indefinitely, and practice suggests it is. */
     if (now < eventLoop->lastTime) {
-        te = eventLoop->timeEventHead;
-        while(te) {
-            te->when_sec = 0;
-            te = te->next;
-        }
+        for (j = 0; j < eventLoop->timeEventHeapLen; j++)
+            eventLoop->timeEventHeap[j]->when_sec = 0;
+        /* Only the milliseconds order the events now: rebuild the heap. */
+        for (j = eventLoop->timeEventHeapLen/2-1; j >= 0; j--)
+            aeTimeHeapDown(eventLoop,j);
     }
     /*设置当前时间*/
     eventLoop->lastTime = now;
 
-    prev = NULL;
-    te = eventLoop->timeEventHead;
-    maxId = eventLoop->timeEventNextId-1;
-    while(te) {
-        long now_sec, now_ms;
-        long long id;
-
-        /*删除计划删除的事件*/
-        /* Remove events scheduled for deletion. */
-        if (te->id == AE_DELETED_EVENT_ID) {
-            aeTimeEvent *next = te->next;
-            if (prev == NULL)
-                eventLoop->timeEventHead = te->next;
-            else
-                prev->next = te->next;
-            if (te->finalizerProc)
-                te->finalizerProc(eventLoop, te->clientData);
-            zfree(te);
-            te = next;
-            continue;
-        }
+    /*
+      先把所有到期的事件从堆中取出 回调中创建或者重新调度的事件会放回堆中
+      所以不会在这次调用中处理
+    */
+    /* Detach the events to fire, nearest first. The events created or
+     * rescheduled by the callbacks go in the heap, so they are not processed
+     * in this iteration. */
+    aeGetTime(&now_sec, &now_ms);
+    while(eventLoop->timeEventHeapLen) {
+        te = eventLoop->timeEventHeap[0];
+        if (now_sec < te->when_sec ||
+            (now_sec == te->when_sec && now_ms < te->when_ms)) break;
+        aeTimeHeapRemove(eventLoop,te);
+        te->next = NULL;
+        *tail = te;
+        tail = &te->next;
+    }
 
-        /*确保我们在此迭代中不处理由时间事件创建的时间事件。注意，这个检查目前是无用的*/
-        /* Make sure we don't process time events created by time events in
-         * this iteration. Note that this check is currently useless: we always
-         * add new timers on the head, however if we change the implementation
-         * detail, this check may be useful again: we keep it here for future
-         * defense. */
-        if (te->id > maxId) {
-            te = te->next;
-            continue;
-        }
-        aeGetTime(&now_sec, &now_ms);
-        if (now_sec > te->when_sec ||
-            (now_sec == te->when_sec && now_ms >= te->when_ms))
-        {
+    while((te = fired) != NULL) {
+        fired = te->next;
+
+        /* Deleted by a callback of an event fired before this one? */
+        if (te->id != AE_DELETED_EVENT_ID) {
             int retval;
 
-            id = te->id;
             /* 执行完serverCron后会返回1000/server.hz */
             /* 因为server.hz默认位10，那么返回就是100 */
-            retval = te->timeProc(eventLoop, id, te->clientData);
+            retval = te->timeProc(eventLoop, te->id, te->clientData);
             processed++;
 
             //修改当前时间事件的执行时间并重复利用当前的时间事件；
             //返回不等于-1的 那么就不会删除这个事件
             //https://draveness.me/redis-eventloop/
-            if (retval != AE_NOMORE) {//一次性事件
-                //serverLog(LL_WARNING,"serverCron返回%d",retval);
-                //printf("serverCron返回%d",retval);
-                //这里加上返回默认的100
-                aeAddMillisecondsToNow(retval,&te->when_sec,&te->when_ms);
-            } else {
-                te->id = AE_DELETED_EVENT_ID;
+            if (te->id != AE_DELETED_EVENT_ID) {
+                if (retval != AE_NOMORE) {
+                    aeAddMillisecondsToNow(retval,&te->when_sec,&te->when_ms);
+                    aeTimeHeapInsert(eventLoop,te);
+                    continue;
+                }
+                //一次性事件
+                aeTimeTableRemove(eventLoop,te->id);
             }
         }
-        prev = te;
-        te = te->next;
+        aeFreeTimeEvent(eventLoop,te);
     }
     return processed;
 }
@@ -622,6 +769,280 @@ char *aeGetApiName(void) {
     return aeApiName();
 }
 
+/* Return true if the multiplexing layer performs the I/O of aeSubmitIO()
+ * in batch, so that it is worth collecting the reads and the writes of
+ * many sockets before calling it. */
+int aeCanBatchIO(aeEventLoop *eventLoop) {
+    AE_NOTUSED(eventLoop);
+#ifdef AE_API_SUBMIT_IO
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+/* Perform the socket reads and writes in 'ios', returning once all of them
+ * are done, with their results in the 'res' and 'err' fields. The io_uring
+ * layer submits them to the kernel with a single system call, the others
+ * just perform them one after the other. The sockets are expected to be non
+ * blocking: a read or write that would block fails with EAGAIN. */
+void aeSubmitIO(aeEventLoop *eventLoop, aeIO *ios, int numios) {
+#ifdef AE_API_SUBMIT_IO
+    aeApiSubmitIO(eventLoop,ios,numios);
+#else
+    int j;
+
+    AE_NOTUSED(eventLoop);
+    for (j = 0; j < numios; j++) aePerformIO(&ios[j]);
+#endif
+}
+
 void aeSetBeforeSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *beforesleep) {
     eventLoop->beforesleep = beforesleep;
 }
+
+#ifdef REDIS_TEST
+#include <fcntl.h>
+#include <sys/socket.h>
+
+static long long aeTestUsec(void) {
+    struct timeval tv;
+    gettimeofday(&tv,NULL);
+    return (((long long)tv.tv_sec)*1000000)+tv.tv_usec;
+}
+
+static void aeTestAssert(int cond, char *what) {
+    if (!cond) {
+        printf("ERROR: %s\n", what);
+        exit(1);
+    }
+}
+
+/* State shared by the callbacks of the functional tests. */
+static struct {
+    long long last;         /* Fire time of the last event, in ms. */
+    int ordered;            /* Events fired in fire time order so far. */
+    int fired;              /* Number of callbacks called. */
+    int finalized;          /* Number of finalizers called. */
+    long long victim;       /* Event deleted by aeTestDeleteProc(). */
+} aetest;
+
+static int aeTestOrderProc(aeEventLoop *eventLoop, long long id, void *data) {
+    long long when = (long long)(long)data;
+
+    AE_NOTUSED(eventLoop);
+    AE_NOTUSED(id);
+    if (when < aetest.last-1) aetest.ordered = 0;
+    aetest.last = when;
+    aetest.fired++;
+    return AE_NOMORE;
+}
+
+static int aeTestRepeatProc(aeEventLoop *eventLoop, long long id, void *data) {
+    int *count = data;
+
+    AE_NOTUSED(eventLoop);
+    AE_NOTUSED(id);
+    aetest.fired++;
+    return --(*count) ? 1 : AE_NOMORE;
+}
+
+static int aeTestDeleteProc(aeEventLoop *eventLoop, long long id, void *data) {
+    AE_NOTUSED(data);
+    aetest.fired++;
+    /* Delete another event, then this one while it is being processed. */
+    aeTestAssert(aeDeleteTimeEvent(eventLoop,aetest.victim) == AE_OK,
+                 "delete from a callback");
+    aeTestAssert(aeDeleteTimeEvent(eventLoop,id) == AE_OK,
+                 "delete itself from its callback");
+    return 1000;
+}
+
+static int aeTestNeverProc(aeEventLoop *eventLoop, long long id, void *data) {
+    AE_NOTUSED(eventLoop);
+    AE_NOTUSED(id);
+    AE_NOTUSED(data);
+    aeTestAssert(0, "deleted event fired");
+    return AE_NOMORE;
+}
+
+static void aeTestFinalizer(aeEventLoop *eventLoop, void *data) {
+    AE_NOTUSED(eventLoop);
+    AE_NOTUSED(data);
+    aetest.finalized++;
+}
+
+static void aeTestReadProc(aeEventLoop *eventLoop, int fd, void *data,
+                           int mask)
+{
+    char *buf = data;
+
+    AE_NOTUSED(mask);
+    aeTestAssert(read(fd,buf,16) == 11, "read of the readable event");
+    aeDeleteFileEvent(eventLoop,fd,AE_READABLE);
+    aetest.fired++;
+}
+
+static void aeTestFunctional(void) {
+    aeEventLoop *el = aeCreateEventLoop(64);
+    long long ids[1000];
+    int j, count = 3;
+
+    printf("Time events fire in order: ");
+    memset(&aetest,0,sizeof(aetest));
+    aetest.ordered = 1;
+    for (j = 0; j < 1000; j++) {
+        long long ms = rand() % 50;
+        long sec, msec;
+
+        /* This fire time may be a millisecond before the one computed by
+         * aeCreateTimeEvent(): aeTestOrderProc() allows for that. */
+        aeAddMillisecondsToNow(ms,&sec,&msec);
+        ids[j] = aeCreateTimeEvent(el,ms,aeTestOrderProc,
+            (void*)(long)((long long)sec*1000+msec),aeTestFinalizer);
+    }
+    for (j = 0; j < 1000; j += 2)
+        aeTestAssert(aeDeleteTimeEvent(el,ids[j]) == AE_OK, "delete");
+    aeTestAssert(aeDeleteTimeEvent(el,ids[0]) == AE_ERR, "delete twice");
+    while(el->timeEventHeapLen) aeProcessEvents(el,AE_TIME_EVENTS);
+    aeProcessEvents(el,AE_TIME_EVENTS|AE_DONT_WAIT);
+    aeTestAssert(aetest.ordered, "fire order");
+    aeTestAssert(aetest.fired == 500, "fired events");
+    aeTestAssert(aetest.finalized == 1000, "finalized events");
+    aeTestAssert(el->timeEventCount == 0, "id table empty");
+    printf("OK\n");
+
+    printf("Rescheduled and deleted from callbacks: ");
+    memset(&aetest,0,sizeof(aetest));
+    aeCreateTimeEvent(el,0,aeTestRepeatProc,&count,aeTestFinalizer);
+    aeCreateTimeEvent(el,0,aeTestDeleteProc,NULL,aeTestFinalizer);
+    aetest.victim = aeCreateTimeEvent(el,10,aeTestNeverProc,NULL,
+                                      aeTestFinalizer);
+    /* Make the victim due as well: it is deleted after being detached. */
+    usleep(20000);
+    while(el->timeEventHeapLen) aeProcessEvents(el,AE_TIME_EVENTS);
+    aeProcessEvents(el,AE_TIME_EVENTS|AE_DONT_WAIT);
+    aeTestAssert(count == 0, "repeated event");
+    aeTestAssert(aetest.fired == 4, "fired events");
+    aeTestAssert(aetest.finalized == 3, "finalized events");
+    printf("OK\n");
+
+    printf("Batched socket I/O (%s): ", aeCanBatchIO(el) ? "batched" :
+                                                           "one by one");
+    {
+        char hello[] = "hello ", world[] = "world", buf[16], empty[16];
+        struct iovec iov[2];
+        aeIO ios[2];
+        int sv[2];
+
+        memset(&aetest,0,sizeof(aetest));
+        memset(buf,0,sizeof(buf));
+        aeTestAssert(socketpair(AF_UNIX,SOCK_STREAM,0,sv) == 0, "socketpair");
+        for (j = 0; j < 2; j++)
+            fcntl(sv[j],F_SETFL,fcntl(sv[j],F_GETFL)|O_NONBLOCK);
+        aeCreateFileEvent(el,sv[1],AE_READABLE,aeTestReadProc,buf);
+        aeProcessEvents(el,AE_FILE_EVENTS|AE_DONT_WAIT);
+
+        iov[0].iov_base = hello;
+        iov[0].iov_len = 6;
+        iov[1].iov_base = world;
+        iov[1].iov_len = 5;
+        memset(ios,0,sizeof(ios));
+        ios[0].op = AE_IO_WRITEV;
+        ios[0].fd = sv[0];
+        ios[0].iov = iov;
+        ios[0].iovcnt = 2;
+        ios[1].op = AE_IO_READ;
+        ios[1].fd = sv[0];
+        ios[1].buf = empty;
+        ios[1].len = sizeof(empty);
+        aeSubmitIO(el,ios,2);
+        aeTestAssert(ios[0].res == 11, "writev result");
+        aeTestAssert(ios[1].res == -1 && ios[1].err == EAGAIN,
+                     "read without data");
+
+        /* The readable event fires even if its poll completed while
+         * waiting for the I/O. */
+        for (j = 0; j < 100 && aetest.fired == 0; j++)
+            aeProcessEvents(el,AE_FILE_EVENTS|AE_DONT_WAIT);
+        aeTestAssert(aetest.fired == 1, "readable event");
+        aeTestAssert(memcmp(buf,"hello world",11) == 0, "data read");
+        close(sv[0]);
+        close(sv[1]);
+    }
+    printf("OK\n");
+    aeDeleteEventLoop(el);
+}
+
+static int aeTestNopProc(aeEventLoop *eventLoop, long long id, void *data) {
+    AE_NOTUSED(eventLoop);
+    AE_NOTUSED(id);
+    AE_NOTUSED(data);
+    return AE_NOMORE;
+}
+
+/* Cost of an event loop iteration and of the timers operations with
+ * 'count' timers, compared with the linear scan of the same timers that
+ * aeSearchNearestTimer() used to do at every iteration. */
+static void aeTestBenchmark(long count) {
+    aeEventLoop *el = aeCreateEventLoop(64);
+    long long *ids = zmalloc(sizeof(long long)*count), start, elapsed;
+    aeTimeEvent *nearest = NULL;
+    long j, iterations = 10000;
+
+    start = aeTestUsec();
+    for (j = 0; j < count; j++)
+        ids[j] = aeCreateTimeEvent(el,3600000+rand()%3600000,aeTestNopProc,
+                                   NULL,NULL);
+    elapsed = aeTestUsec()-start;
+    printf("Create %ld timers: %lld usec (%.3f usec per timer)\n",
+        count, elapsed, (double)elapsed/count);
+
+    start = aeTestUsec();
+    for (j = 0; j < iterations; j++)
+        aeProcessEvents(el,AE_TIME_EVENTS|AE_DONT_WAIT);
+    elapsed = aeTestUsec()-start;
+    printf("Event loop iteration with %ld timers: %.3f usec\n",
+        count, (double)elapsed/iterations);
+
+    start = aeTestUsec();
+    for (j = 0; j < 100; j++) {
+        int k;
+
+        nearest = NULL;
+        for (k = 0; k < el->timeEventHeapLen; k++) {
+            aeTimeEvent *te = el->timeEventHeap[k];
+            if (!nearest || aeTimeEventBefore(te,nearest)) nearest = te;
+        }
+    }
+    elapsed = aeTestUsec()-start;
+    aeTestAssert(nearest == aeSearchNearestTimer(el), "nearest timer");
+    printf("Linear scan of %ld timers (old nearest timer search): "
+           "%.3f usec\n", count, (double)elapsed/100);
+
+    start = aeTestUsec();
+    for (j = 0; j < count; j++) {
+        long k = rand() % count;
+        long long tmp = ids[k];
+        ids[k] = ids[j];
+        ids[j] = tmp;
+    }
+    for (j = 0; j < count; j++)
+        aeTestAssert(aeDeleteTimeEvent(el,ids[j]) == AE_OK, "delete");
+    aeProcessEvents(el,AE_TIME_EVENTS|AE_DONT_WAIT);
+    elapsed = aeTestUsec()-start;
+    printf("Delete %ld timers in random order: %lld usec\n", count, elapsed);
+    zfree(ids);
+    aeDeleteEventLoop(el);
+}
+
+int aeTest(int argc, char *argv[]) {
+    long count = 100000;
+
+    if (argc >= 4) count = strtol(argv[3],NULL,10);
+    srand(time(NULL));
+    aeTestFunctional();
+    aeTestBenchmark(count);
+    return 0;
+}
+#endif
@@ -34,6 +34,8 @@
 #define __AE_H__
 
 #include <time.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 
 #define AE_OK 0
 #define AE_ERR -1
@@ -58,6 +60,9 @@
 #define AE_NOMORE -1 
 #define AE_DELETED_EVENT_ID -1
 
+#define AE_IO_READ 1   /* read(2) of aeSubmitIO() */
+#define AE_IO_WRITEV 2 /* writev(2) of aeSubmitIO() */
+
 /* Macros */
 #define AE_NOTUSED(V) ((void) V)
 
@@ -91,7 +96,9 @@ typedef struct aeTimeEvent {
     aeTimeProc *timeProc; /*时间处理器*/
     aeEventFinalizerProc *finalizerProc;
     void *clientData;
-    struct aeTimeEvent *next; /*存储下一个时间事件*/
+    int heapidx; /* 在最小堆中的位置 Position in the timers heap, -1 if not there. */
+    struct aeTimeEvent *hnext; /* 同一个id哈希桶中的下一个 Next in the id table bucket. */
+    struct aeTimeEvent *next; /* 待处理或待释放列表中的下一个 Next fired or deleted event. */
 } aeTimeEvent;
 
 /*
@@ -103,6 +110,18 @@ typedef struct aeFiredEvent {
     int mask; /*掩码*/
 } aeFiredEvent;
 
+/* A socket read or write performed by aeSubmitIO() */
+typedef struct aeIO {
+    int op;             /* AE_IO_READ or AE_IO_WRITEV. */
+    int fd;
+    void *buf;          /* AE_IO_READ: read up to 'len' bytes into 'buf'. */
+    size_t len;
+    struct iovec *iov;  /* AE_IO_WRITEV: write the 'iovcnt' buffers. */
+    int iovcnt;
+    ssize_t res;        /* What read(2) or writev(2) would return, */
+    int err;            /* and the errno when 'res' is -1. */
+} aeIO;
+
 /* 一个事件基础程序的状态*/
 /* State of an event based program */
 typedef struct aeEventLoop {
@@ -119,7 +138,17 @@ typedef struct aeEventLoop {
     */
     aeFileEvent *events; /* Registered events */ /*存储监听的文件事件*/
     aeFiredEvent *fired; /* Fired events */ /*存储待处理的文件事件*/
-    aeTimeEvent *timeEventHead; /*存储监听的时间事件 头部指针*/
+    /*
+      时间事件保存在按触发时间排序的最小堆中 最近的在堆顶
+      另外用一个按id索引的哈希表 使删除也是O(log(N))
+    */
+    aeTimeEvent **timeEventHeap; /* Min-heap of the time events, nearest first. */
+    int timeEventHeapLen;
+    int timeEventHeapSize;
+    aeTimeEvent **timeEventTable; /* Time events by id, chained with 'hnext'. */
+    unsigned long timeEventTableSize; /* Power of two. */
+    unsigned long timeEventCount; /* Events in the id table. */
+    aeTimeEvent *timeEventDeleted; /* To finalize in processTimeEvents(). */
     int stop;
     void *apidata; /* void指针 This is used for polling API specific data */ /*针对每个多路复用api不一样*/
     aeBeforeSleepProc *beforesleep;
@@ -144,5 +173,11 @@ char *aeGetApiName(void);
 void aeSetBeforeSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *beforesleep);
 int aeGetSetSize(aeEventLoop *eventLoop);
 int aeResizeSetSize(aeEventLoop *eventLoop, int setsize);
+int aeCanBatchIO(aeEventLoop *eventLoop);
+void aeSubmitIO(aeEventLoop *eventLoop, aeIO *ios, int numios);
+
+#ifdef REDIS_TEST
+int aeTest(int argc, char *argv[]);
+#endif
 
 #endif
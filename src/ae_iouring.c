@@ -0,0 +1,509 @@
+/* Linux io_uring(7) based ae.c module
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* The ae API is readiness based, so file events are one-shot
+ * IORING_OP_POLL_ADD requests: a poll on a file descriptor that is already
+ * ready completes at once, which gives the same level triggered semantics
+ * of epoll. A fired poll is armed again, with the mask the file event has
+ * at that time, before the next wait.
+ *
+ * Instead of calling epoll_ctl(2) for every change of the registered
+ * events, the polls to arm and cancel are queued in the submission ring
+ * and sent to the kernel together with the wait for new events, with a
+ * single io_uring_enter(2) call per event loop iteration. When the ring is
+ * full the fds are left queued, and armed or cancelled after the next
+ * submission.
+ *
+ * The socket reads and writes collected by the caller are submitted in
+ * batch as well, see aeApiSubmitIO(): networking.c uses it for the replies
+ * written before sleeping and for the reads of the readable clients, so
+ * that many clients cost a single system call instead of one per client.
+ * The I/O is still started once the fd is ready: the ae API stays readiness
+ * based, and the AOF is still written with write(2).
+ *
+ * 要求内核 >= 5.11 (IORING_FEAT_EXT_ARG 用于带超时的等待) */
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <stdint.h>
+#include <poll.h>
+
+#ifndef RWF_NOWAIT
+#define RWF_NOWAIT 0x00000008 /* From linux/fs.h, Linux 4.14. */
+#endif
+
+#define AE_IOURING_SQ_ENTRIES 1024
+#define AE_IOURING_REMOVE_DATA UINT64_MAX /* user_data of POLL_REMOVE. */
+#define AE_IOURING_IO_DATA (1ULL<<63)    /* user_data flag of the I/O. */
+/* The user_data of a poll is the fd and the generation, without the bit
+ * of AE_IOURING_IO_DATA. */
+#define AE_IOURING_GEN(gen) ((gen) & 0x7fffffff)
+#define AE_API_SUBMIT_IO                  /* See aeSubmitIO(). */
+
+typedef struct aeApiState {
+    int ringfd;
+    /* Submission ring. */
+    unsigned *sq_head, *sq_tail, *sq_mask;
+    unsigned sq_entries;
+    unsigned sq_local_tail;     /* Tail including the not yet published SQEs. */
+    struct io_uring_sqe *sqes;
+    /* Completion ring. */
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    /* Mapped memory. */
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+    /* Per file descriptor state. */
+    int *armed;         /* Mask of the poll in flight, AE_NONE if none. */
+    uint32_t *gen;      /* Generation of the poll, to skip stale completions. */
+    char *queued;       /* True if the fd is in the 'toarm' array. */
+    int *toarm;         /* Fds to arm again before the next wait. */
+    int numtoarm;
+    /* Events reaped while waiting for the I/O of aeApiSubmitIO(), returned
+     * by the next aeApiPoll(). */
+    aeFiredEvent *ready;
+    int numready;
+} aeApiState;
+
+static int aeIouringSetup(unsigned entries, struct io_uring_params *p) {
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int aeIouringEnter(int ringfd, unsigned to_submit,
+                          unsigned min_complete, unsigned flags,
+                          void *arg, size_t argsz)
+{
+    return (int) syscall(__NR_io_uring_enter, ringfd, to_submit,
+                         min_complete, flags, arg, argsz);
+}
+
+/* Publish the queued SQEs and submit them, optionally waiting for
+ * 'min_complete' completions when IORING_ENTER_GETEVENTS is in 'flags'. */
+static int aeIouringSubmit(aeApiState *state, unsigned min_complete,
+                           unsigned flags, void *arg, size_t argsz)
+{
+    unsigned to_submit;
+
+    __atomic_store_n(state->sq_tail,state->sq_local_tail,__ATOMIC_RELEASE);
+    to_submit = state->sq_local_tail -
+                __atomic_load_n(state->sq_head,__ATOMIC_ACQUIRE);
+    if (to_submit == 0 && !(flags & IORING_ENTER_GETEVENTS)) return 0;
+    return aeIouringEnter(state->ringfd,to_submit,min_complete,flags,
+                          arg,argsz);
+}
+
+/* Return a zeroed SQE, submitting the queued ones if the ring is full. */
+static struct io_uring_sqe *aeIouringGetSqe(aeApiState *state) {
+    struct io_uring_sqe *sqe;
+    unsigned head = __atomic_load_n(state->sq_head,__ATOMIC_ACQUIRE);
+
+    if (state->sq_local_tail - head == state->sq_entries) {
+        aeIouringSubmit(state,0,0,NULL,0);
+        head = __atomic_load_n(state->sq_head,__ATOMIC_ACQUIRE);
+        if (state->sq_local_tail - head == state->sq_entries) return NULL;
+    }
+    sqe = &state->sqes[state->sq_local_tail & *state->sq_mask];
+    memset(sqe,0,sizeof(*sqe));
+    state->sq_local_tail++;
+    return sqe;
+}
+
+static uint64_t aeIouringUserData(aeApiState *state, int fd) {
+    return ((uint64_t)AE_IOURING_GEN(state->gen[fd]) << 32) | (uint32_t)fd;
+}
+
+/* Queue a poll for the events in 'mask'. Returns -1 if the ring is full. */
+static int aeIouringArm(aeApiState *state, int fd, int mask) {
+    struct io_uring_sqe *sqe = aeIouringGetSqe(state);
+    uint32_t events = 0;
+
+    if (sqe == NULL) return -1;
+    if (mask & AE_READABLE) events |= POLLIN;
+    if (mask & AE_WRITABLE) events |= POLLOUT;
+#if __BYTE_ORDER == __BIG_ENDIAN
+    events = (events << 16) | (events >> 16);
+#endif
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = events;
+    sqe->user_data = aeIouringUserData(state,fd);
+    state->armed[fd] = mask;
+    return 0;
+}
+
+/* Queue the removal of the poll in flight for 'fd', if any. Its completion,
+ * if already posted, is skipped since the generation changes. Returns -1 if
+ * the ring is full: the poll is then still in flight. */
+static int aeIouringDisarm(aeApiState *state, int fd) {
+    struct io_uring_sqe *sqe;
+
+    if (state->armed[fd] == AE_NONE) return 0;
+    sqe = aeIouringGetSqe(state);
+    if (sqe == NULL) return -1;
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = aeIouringUserData(state,fd);
+    sqe->user_data = AE_IOURING_REMOVE_DATA;
+    state->armed[fd] = AE_NONE;
+    state->gen[fd]++;
+    return 0;
+}
+
+/* Remember to arm a poll for 'fd' before the next wait, or to replace the
+ * poll in flight if it doesn't match the events of the fd any longer. */
+static void aeIouringQueue(aeApiState *state, int fd) {
+    if (state->queued[fd]) return;
+    state->queued[fd] = 1;
+    state->toarm[state->numtoarm++] = fd;
+}
+
+static void aeIouringUnmap(aeApiState *state) {
+    if (state->sqes && state->sqes != MAP_FAILED)
+        munmap(state->sqes,state->sqes_size);
+    if (state->cq_ring && state->cq_ring != MAP_FAILED &&
+        state->cq_ring != state->sq_ring)
+        munmap(state->cq_ring,state->cq_ring_size);
+    if (state->sq_ring && state->sq_ring != MAP_FAILED)
+        munmap(state->sq_ring,state->sq_ring_size);
+}
+
+static int aeApiCreate(aeEventLoop *eventLoop) {
+    aeApiState *state = zcalloc(sizeof(aeApiState));
+    struct io_uring_params p;
+    unsigned *sq_array, j;
+    unsigned cq_entries = AE_IOURING_SQ_ENTRIES*2;
+
+    if (!state) return -1;
+
+    /* Every registered fd has at most a poll in flight. */
+    while (cq_entries < (unsigned)eventLoop->setsize) cq_entries <<= 1;
+    memset(&p,0,sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE|IORING_SETUP_CLAMP;
+    p.cq_entries = cq_entries;
+    state->ringfd = aeIouringSetup(AE_IOURING_SQ_ENTRIES,&p);
+    if (state->ringfd == -1) {
+        zfree(state);
+        return -1;
+    }
+    if (!(p.features & IORING_FEAT_EXT_ARG) ||
+        !(p.features & IORING_FEAT_NODROP))
+    {
+        close(state->ringfd);
+        zfree(state);
+        return -1;
+    }
+
+    state->sq_ring_size = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+    state->cq_ring_size = p.cq_off.cqes +
+                          p.cq_entries*sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (state->cq_ring_size > state->sq_ring_size)
+            state->sq_ring_size = state->cq_ring_size;
+        state->cq_ring_size = state->sq_ring_size;
+    }
+    state->sq_ring = mmap(NULL,state->sq_ring_size,PROT_READ|PROT_WRITE,
+                          MAP_SHARED|MAP_POPULATE,state->ringfd,
+                          IORING_OFF_SQ_RING);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        state->cq_ring = state->sq_ring;
+    } else {
+        state->cq_ring = mmap(NULL,state->cq_ring_size,PROT_READ|PROT_WRITE,
+                              MAP_SHARED|MAP_POPULATE,state->ringfd,
+                              IORING_OFF_CQ_RING);
+    }
+    state->sqes_size = p.sq_entries*sizeof(struct io_uring_sqe);
+    state->sqes = mmap(NULL,state->sqes_size,PROT_READ|PROT_WRITE,
+                       MAP_SHARED|MAP_POPULATE,state->ringfd,
+                       IORING_OFF_SQES);
+    if (state->sq_ring == MAP_FAILED || state->cq_ring == MAP_FAILED ||
+        state->sqes == MAP_FAILED)
+    {
+        aeIouringUnmap(state);
+        close(state->ringfd);
+        zfree(state);
+        return -1;
+    }
+
+    state->sq_head = (unsigned*)((char*)state->sq_ring + p.sq_off.head);
+    state->sq_tail = (unsigned*)((char*)state->sq_ring + p.sq_off.tail);
+    state->sq_mask = (unsigned*)((char*)state->sq_ring + p.sq_off.ring_mask);
+    state->sq_entries = p.sq_entries;
+    state->sq_local_tail = *state->sq_tail;
+    /* The SQEs are always used in ring order. */
+    sq_array = (unsigned*)((char*)state->sq_ring + p.sq_off.array);
+    for (j = 0; j < p.sq_entries; j++) sq_array[j] = j;
+
+    state->cq_head = (unsigned*)((char*)state->cq_ring + p.cq_off.head);
+    state->cq_tail = (unsigned*)((char*)state->cq_ring + p.cq_off.tail);
+    state->cq_mask = (unsigned*)((char*)state->cq_ring + p.cq_off.ring_mask);
+    state->cqes = (struct io_uring_cqe*)((char*)state->cq_ring +
+                                         p.cq_off.cqes);
+
+    state->armed = zcalloc(sizeof(int)*eventLoop->setsize);
+    state->gen = zcalloc(sizeof(uint32_t)*eventLoop->setsize);
+    state->queued = zcalloc(eventLoop->setsize);
+    state->toarm = zmalloc(sizeof(int)*eventLoop->setsize);
+    state->numtoarm = 0;
+    state->ready = zmalloc(sizeof(aeFiredEvent)*eventLoop->setsize);
+    state->numready = 0;
+    eventLoop->apidata = state;
+    return 0;
+}
+
+static int aeApiResize(aeEventLoop *eventLoop, int setsize) {
+    aeApiState *state = eventLoop->apidata;
+    int oldsize = eventLoop->setsize, j, k;
+
+    state->armed = zrealloc(state->armed,sizeof(int)*setsize);
+    state->gen = zrealloc(state->gen,sizeof(uint32_t)*setsize);
+    state->queued = zrealloc(state->queued,setsize);
+    if (setsize > oldsize) {
+        memset(state->armed+oldsize,0,sizeof(int)*(setsize-oldsize));
+        memset(state->gen+oldsize,0,sizeof(uint32_t)*(setsize-oldsize));
+        memset(state->queued+oldsize,0,setsize-oldsize);
+    } else {
+        /* Fds out of the new set have no events, so there is nothing to
+         * arm for them. */
+        for (j = 0, k = 0; j < state->numtoarm; j++)
+            if (state->toarm[j] < setsize) state->toarm[k++] = state->toarm[j];
+        state->numtoarm = k;
+        for (j = 0, k = 0; j < state->numready; j++)
+            if (state->ready[j].fd < setsize) state->ready[k++] = state->ready[j];
+        state->numready = k;
+    }
+    state->toarm = zrealloc(state->toarm,sizeof(int)*setsize);
+    state->ready = zrealloc(state->ready,sizeof(aeFiredEvent)*setsize);
+    return 0;
+}
+
+static void aeApiFree(aeEventLoop *eventLoop) {
+    aeApiState *state = eventLoop->apidata;
+
+    aeIouringUnmap(state);
+    close(state->ringfd);
+    zfree(state->armed);
+    zfree(state->gen);
+    zfree(state->queued);
+    zfree(state->toarm);
+    zfree(state->ready);
+    zfree(state);
+}
+
+static int aeApiAddEvent(aeEventLoop *eventLoop, int fd, int mask) {
+    aeApiState *state = eventLoop->apidata;
+
+    mask |= eventLoop->events[fd].mask; /* Merge old events */
+    mask &= AE_READABLE|AE_WRITABLE;
+    if (state->armed[fd] == mask) return 0;
+
+    /* The poll in flight misses some of the events: replace it. If the ring
+     * is full the removal is retried by aeApiPoll(). */
+    aeIouringDisarm(state,fd);
+    aeIouringQueue(state,fd);
+    return 0;
+}
+
+static void aeApiDelEvent(aeEventLoop *eventLoop, int fd, int delmask) {
+    aeApiState *state = eventLoop->apidata;
+    int mask = eventLoop->events[fd].mask & (~delmask);
+
+    mask &= AE_READABLE|AE_WRITABLE;
+    /* Without a poll in flight, the one armed before the next wait will
+     * use the updated mask of the file event. */
+    if (state->armed[fd] == AE_NONE || state->armed[fd] == mask) return;
+
+    if (aeIouringDisarm(state,fd) == -1 || mask != AE_NONE) {
+        aeIouringQueue(state,fd);
+    } else {
+        /* The poll holds a reference to the file: submit the removal now
+         * since the caller is likely going to close the fd. */
+        aeIouringSubmit(state,0,0,NULL,0);
+    }
+}
+
+/* Consume the completions posted so far. The polls that fired are added to
+ * the 'ready' events, the results of the I/O are stored in 'ios'. Returns
+ * the number of I/O completions found. */
+static int aeIouringReap(aeEventLoop *eventLoop, aeIO *ios) {
+    aeApiState *state = eventLoop->apidata;
+    unsigned head, tail;
+    int done = 0;
+
+    head = *state->cq_head;
+    tail = __atomic_load_n(state->cq_tail,__ATOMIC_ACQUIRE);
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &state->cqes[head & *state->cq_mask];
+        uint64_t ud = cqe->user_data;
+        int fd = (int)(uint32_t)ud, mask = 0;
+
+        head++;
+        if (ud == AE_IOURING_REMOVE_DATA) continue;
+        if (ud & AE_IOURING_IO_DATA) {
+            aeIO *io = &ios[(uint32_t)ud];
+
+            io->res = (cqe->res < 0) ? -1 : cqe->res;
+            io->err = (cqe->res < 0) ? -cqe->res : 0;
+            done++;
+            continue;
+        }
+        if (fd >= eventLoop->setsize ||
+            (uint32_t)(ud >> 32) != AE_IOURING_GEN(state->gen[fd])) continue;
+
+        /* One-shot poll: arm it again before the next wait. */
+        state->armed[fd] = AE_NONE;
+        aeIouringQueue(state,fd);
+
+        if (cqe->res < 0) {
+            /* Let the handlers find the error. */
+            mask = AE_READABLE|AE_WRITABLE;
+        } else {
+            if (cqe->res & POLLIN) mask |= AE_READABLE;
+            if (cqe->res & POLLOUT) mask |= AE_WRITABLE;
+            if (cqe->res & POLLERR) mask |= AE_WRITABLE;
+            if (cqe->res & POLLHUP) mask |= AE_WRITABLE;
+        }
+        /* Every fd has at most a poll in flight, so it is not already in
+         * the ready events. */
+        state->ready[state->numready].fd = fd;
+        state->ready[state->numready].mask = mask;
+        state->numready++;
+    }
+    __atomic_store_n(state->cq_head,head,__ATOMIC_RELEASE);
+    return done;
+}
+
+static int aeApiPoll(aeEventLoop *eventLoop, struct timeval *tvp) {
+    aeApiState *state = eventLoop->apidata;
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    unsigned min_complete = 1;
+    int j, k, numevents;
+
+    /* Return the events reaped by aeApiSubmitIO() first. Their fds are
+     * armed in the next call, so an fd is never twice in the ready events. */
+    if (state->numready) {
+        numevents = state->numready;
+        memcpy(eventLoop->fired,state->ready,sizeof(aeFiredEvent)*numevents);
+        state->numready = 0;
+        return numevents;
+    }
+
+    /* Arm the polls of the fds that fired or changed their events. The
+     * fds the ring has no room for stay queued for the next iteration. */
+    for (j = 0, k = 0; j < state->numtoarm; j++) {
+        int fd = state->toarm[j];
+        int mask = eventLoop->events[fd].mask & (AE_READABLE|AE_WRITABLE);
+
+        if ((state->armed[fd] != AE_NONE && state->armed[fd] != mask &&
+             aeIouringDisarm(state,fd) == -1) ||
+            (mask != AE_NONE && state->armed[fd] == AE_NONE &&
+             aeIouringArm(state,fd,mask) == -1))
+        {
+            state->toarm[k++] = fd;
+            continue;
+        }
+        state->queued[fd] = 0;
+    }
+    state->numtoarm = k;
+
+    /* Submit them and wait for events in a single call. Don't wait if there
+     * are events already, or fds left to arm after this submission. */
+    memset(&arg,0,sizeof(arg));
+    if (tvp) {
+        ts.tv_sec = tvp->tv_sec;
+        ts.tv_nsec = tvp->tv_usec*1000;
+        arg.ts = (uint64_t)(uintptr_t)&ts;
+        if (tvp->tv_sec == 0 && tvp->tv_usec == 0) min_complete = 0;
+    }
+    if (state->numtoarm ||
+        *state->cq_head != __atomic_load_n(state->cq_tail,__ATOMIC_ACQUIRE))
+        min_complete = 0;
+    aeIouringSubmit(state,min_complete,
+                    IORING_ENTER_GETEVENTS|IORING_ENTER_EXT_ARG,
+                    &arg,sizeof(arg));
+
+    /* No I/O is in flight outside aeApiSubmitIO(). */
+    aeIouringReap(eventLoop,NULL);
+    numevents = state->numready;
+    memcpy(eventLoop->fired,state->ready,sizeof(aeFiredEvent)*numevents);
+    state->numready = 0;
+    return numevents;
+}
+
+/* Submit the I/O in 'ios' with the queued polls, and wait for it. */
+static void aeApiSubmitIO(aeEventLoop *eventLoop, aeIO *ios, int numios) {
+    aeApiState *state = eventLoop->apidata;
+    int j, pending = 0;
+
+    for (j = 0; j < numios; j++) {
+        aeIO *io = &ios[j];
+        struct io_uring_sqe *sqe = aeIouringGetSqe(state);
+
+        if (sqe == NULL) {
+            /* Ring full: wait for the I/O submitted so far to make room,
+             * or just perform it if there is nothing to wait for. */
+            if (pending == 0) {
+                aePerformIO(io);
+                continue;
+            }
+            aeIouringSubmit(state,pending,IORING_ENTER_GETEVENTS,NULL,0);
+            pending -= aeIouringReap(eventLoop,ios);
+            j--;
+            continue;
+        }
+        if (io->op == AE_IO_READ) {
+            sqe->opcode = IORING_OP_READ;
+            sqe->addr = (uint64_t)(uintptr_t)io->buf;
+            sqe->len = io->len;
+        } else {
+            sqe->opcode = IORING_OP_WRITEV;
+            sqe->addr = (uint64_t)(uintptr_t)io->iov;
+            sqe->len = io->iovcnt;
+        }
+        sqe->fd = io->fd;
+        /* Like with a plain read(2) or writev(2) on a non blocking socket,
+         * fail with EAGAIN instead of waiting for the socket to be ready:
+         * io_uring would wait even if the socket is non blocking. */
+        sqe->rw_flags = RWF_NOWAIT;
+        sqe->user_data = AE_IOURING_IO_DATA | (uint32_t)j;
+        pending++;
+    }
+
+    /* With RWF_NOWAIT this doesn't wait for the peers. */
+    while (pending) {
+        aeIouringSubmit(state,pending,IORING_ENTER_GETEVENTS,NULL,0);
+        pending -= aeIouringReap(eventLoop,ios);
+    }
+}
+
+static char *aeApiName(void) {
+    return "io_uring";
+}
@@ -1,16 +1,16 @@
 /* Background I/O service for Redis.
  *
  * This file implements operations that we need to perform in the background.
- * Currently there is only a single operation, that is a background close(2)
- * system call. This is needed as when the process is the last owner of a
+ * Currently there are three operations: a background close(2) system call,
+ * a background AOF fsync, and the lazy freeing of objects and databases.
+ * The close(2) is needed as when the process is the last owner of a
  * reference to a file closing it means unlinking it, and the deletion of the
- * file is slow, blocking the server.
+ * file is slow, blocking the server. Lazy freeing is used by UNLINK and
+ * FLUSHDB / FLUSHALL ASYNC in order to reclaim big values without blocking,
+ * see lazyfree.c.
  *
  * In the future we'll either continue implementing new things we need or
- * we'll switch to libeio. However there are probably long term uses for this
- * file as we may want to put here Redis specific background tasks (for instance
- * it is not impossible that we'll need a non blocking FLUSHDB/FLUSHALL
- * implementation).
+ * we'll switch to libeio.
  *
  * DESIGN
  * ------
@@ -239,6 +239,20 @@ void *bioProcessBackgroundJobs(void *arg) {
             close((long)job->arg1);
         } else if (type == BIO_AOF_FSYNC) {
             aof_fsync((long)job->arg1);
+        } else if (type == BIO_LAZY_FREE) {
+            /* What we free changes depending on what arguments are set:
+             * arg1 -> free the object at pointer.
+             * arg2 & arg3 -> free two dictionaries (a Redis DB).
+             * only arg2 -> free the cluster slots to keys map.
+             * only arg3 -> free the skiplist (expire index of a DB). */
+            if (job->arg1)
+                lazyfreeFreeObjectFromBioThread(job->arg1);
+            else if (job->arg2 && job->arg3)
+                lazyfreeFreeDatabaseFromBioThread(job->arg2,job->arg3);
+            else if (job->arg2)
+                lazyfreeFreeSlotsMapFromBioThread(job->arg2);
+            else if (job->arg3)
+                lazyfreeFreeSkiplistFromBioThread(job->arg3);
         } else {
             serverPanic("Wrong job type in bioProcessBackgroundJobs().");
         }
@@ -41,4 +41,7 @@ void bioKillThreads(void);
 
 /*AOF日志的异步刷盘（ appendfsync everysec 配置下， 由后台线程周期性刷盘）*/
 #define BIO_AOF_FSYNC     1 /* Deferred AOF fsync. */
-#define BIO_NUM_OPS       2
+
+/*异步释放对象、数据库字典（UNLINK, FLUSHALL ASYNC 等）*/
+#define BIO_LAZY_FREE     2 /* Deferred objects freeing. */
+#define BIO_NUM_OPS       3
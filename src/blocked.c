@@ -124,8 +124,10 @@ void processUnblockedClients(void) {
          * client is not blocked before to proceed, but things may change and
          * the code is conceptually more correct this way. */
         if (!(c->flags & CLIENT_BLOCKED)) {
-            if (c->querybuf && sdslen(c->querybuf) > 0) {
-                processInputBuffer(c);
+            if ((c->querybuf && sdslen(c->querybuf) > 0) ||
+                (c->flags & CLIENT_PENDING_COMMAND))
+            {
+                processInputBufferAndReplicate(c);
             }
         }
     }
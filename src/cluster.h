@@ -142,14 +142,12 @@ typedef struct clusterState {
       通过这些属性，可以快速知道某个槽位由哪个节点负责，以及它的迁入迁出对象节点，
       以及某个键会落在哪个槽位上。
 
-      skiplist实现的 slots_to_keys:
-      在dbAdd中，如果是集群模式会调用slotToKeyAdd往跳表中添加节点：计算出哈希槽，然后把它作为分数，
-       把键作为成员，插入到跳表中。
-
-       在dbDelete中，如果是集群模式会调用slotToKeyDel从跳表中删除节点：一样计算出哈希槽，用分数和成员去匹配跳表
-       节点进行删除。
+      在dbAdd中，如果是集群模式会调用slotToKeyAdd把键加入到对应槽位的字典中，
+      在dbDelete中会调用slotToKeyDel从槽位的字典中删除。
     */
-    zskiplist *slots_to_keys;
+    /* One dictionary per slot (NULL if the slot never had keys) referencing
+     * the keys of the main dictionary of the DB. */
+    dict **slots_to_keys;
     /*以下字段用于在选举中获取从属状态*/
     /* The following fields are used to take the slave state on elections. */
     mstime_t failover_auth_time; /* Time of previous or next election. */
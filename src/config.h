@@ -76,6 +76,12 @@
 #define HAVE_EPOLL 1
 #endif
 
+/* io_uring is only used when asked at build time (make USE_IOURING=yes)
+ * since it needs a recent kernel. */
+#if defined(__linux__) && defined(USE_IOURING)
+#define HAVE_IOURING 1
+#endif
+
 #if (defined(__APPLE__) && defined(MAC_OS_X_VERSION_10_6)) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined (__NetBSD__)
 #define HAVE_KQUEUE 1
 #endif
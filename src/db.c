@@ -33,8 +33,8 @@
 #include <signal.h>
 #include <ctype.h>
 
-void slotToKeyAdd(robj *key);
-void slotToKeyDel(robj *key);
+void slotToKeyAdd(sds key);
+void slotToKeyDel(sds key);
 void slotToKeyFlush(void);
 
 /*-----------------------------------------------------------------------------
@@ -49,8 +49,11 @@ void slotToKeyFlush(void);
  * 
  * */
 robj *lookupKey(redisDb *db, robj *key, int flags) {
+    dictEntry *de;
+
+    snapshotBeforeRead(db,key);
     /*key->ptr代表实际值*/
-    dictEntry *de = dictFind(db->dict,key->ptr);
+    de = dictFind(db->dict,key->ptr);
     if (de) {
         robj *val = dictGetVal(de);
 
@@ -67,7 +70,10 @@ robj *lookupKey(redisDb *db, robj *key, int flags) {
             /*LRU算法广泛应用在诸多系统内，例如Linux内核页表交换，MySQL Buffer Pool缓存页替换，以及Redis数据淘汰策略*/
             /*The Least Recently Used*/
             /*成员变量lru字段用于记录了此key最近一次被访问的LRU时钟(server.lruclock)*/
-            val->lru = LRU_CLOCK();
+            if (MAXMEMORY_POLICY_IS_LFU(server.maxmemory_policy))
+                updateLFU(val);
+            else
+                val->lru = LRU_CLOCK();
         }
         return val;
     } else {
@@ -172,6 +178,7 @@ robj *lookupKeyRead(redisDb *db, robj *key) {
  * Returns the linked value object if the key exists or NULL if the key
  * does not exist in the specified DB. */
 robj *lookupKeyWrite(redisDb *db, robj *key) {
+    snapshotBeforeWrite(db,key);
     expireIfNeeded(db,key);
     return lookupKey(db,key,LOOKUP_NONE);
 }
@@ -193,16 +200,19 @@ robj *lookupKeyWriteOrReply(client *c, robj *key, robj *reply) {
  *
  * The program is aborted if the key already exists. */
 void dbAdd(redisDb *db, robj *key, robj *val) {
+    snapshotBeforeWrite(db,key);
 
     /* 这里如果是小于32字节的字符串的时候 会编码为sdshdr5 类型的  */
     //这里会啥要复制一个字符串呢 我的理解是因为在 freeClientArgv 的时候 因为key这个对象的引用计数为1 所以会释放
     //但是 这边的key字符串不能释放，所以要复制下
-    sds copy = sdsdup(key->ptr); 
+    /* With embedded keys the dict copies the key inside the new entry. */
+    sds copy = db->dict->type->keyEmbed ? key->ptr : sdsdup(key->ptr);
 
 
-    int retval = dictAdd(db->dict, copy, val);
+    dictEntry *de = dictAddRaw(db->dict, copy);
 
-    serverAssertWithInfo(NULL,key,retval == DICT_OK);
+    serverAssertWithInfo(NULL,key,de != NULL);
+    dictSetVal(db->dict, de, val);
 
     /*这个很关键*/
     /*值类型为list*/
@@ -211,7 +221,8 @@ void dbAdd(redisDb *db, robj *key, robj *val) {
 
     /*集群模式*/
     /*计算出key对应所属的槽位*/
-    if (server.cluster_enabled) slotToKeyAdd(key);
+    /* The slot index references the key stored in the dictionary. */
+    if (server.cluster_enabled) slotToKeyAdd(dictGetKey(de));
  }
 
 /* Overwrite an existing key with a new value. Incrementing the reference
@@ -220,9 +231,11 @@ void dbAdd(redisDb *db, robj *key, robj *val) {
  *
  * The program is aborted if the key was not already present. */
 void dbOverwrite(redisDb *db, robj *key, robj *val) {
+    dictEntry *de;
 
+    snapshotBeforeWrite(db,key);
     /*查找 */
-    dictEntry *de = dictFind(db->dict,key->ptr);
+    de = dictFind(db->dict,key->ptr);
 
     serverAssertWithInfo(NULL,key,de != NULL);
     dictReplace(db->dict, key->ptr, val);
@@ -286,13 +299,19 @@ robj *dbRandomKey(redisDb *db) {
 /*删除一个key,value和相关联的过期条目 */
 /* Delete a key, value, and associated expiration entry if any, from the DB */
 int dbDelete(redisDb *db, robj *key) {
+    snapshotBeforeWrite(db,key);
     /* Deleting an entry from the expires dict will not free the sds of
      * the key, because it is shared with the main dictionary. */
 
     /*因为 expires 字典是 keyptrDictType 这个类型的字典的key和value的 析构函数为空，所以不会释放key */
-    if (dictSize(db->expires) > 0) dictDelete(db->expires,key->ptr);
+    if (dictSize(db->expires) > 0) {
+        if (db->expires_index) expireIndexDelete(db,key);
+        dictDelete(db->expires,key->ptr);
+    }
+    /* The slot index references the key of the main dictionary, so it is
+     * updated first. */
+    if (server.cluster_enabled) slotToKeyDel(key->ptr);
     if (dictDelete(db->dict,key->ptr) == DICT_OK) {
-        if (server.cluster_enabled) slotToKeyDel(key);
         return 1;
     } else {
         return 0;
@@ -360,17 +379,47 @@ robj *dbUnshareStringValue(redisDb *db, robj *key, robj *o) {
     return o;
 }
 
-long long emptyDb(void(callback)(void*)) {
-    int j;
+/* Remove all keys from all the databases in a Redis server, or only the
+ * database 'dbnum' if it is not -1. If callback is given the function is
+ * called from time to time to signal that work is in progress.
+ *
+ * If the EMPTYDB_ASYNC flag is given, the old hash tables are released in
+ * a background thread (see lazyfree.c), and the callback is not used.
+ *
+ * The function returns the number of keys removed from the database(s),
+ * or -1 (with errno set to EINVAL) if the database number is out of range. */
+long long emptyDb(int dbnum, int flags, void(callback)(void*)) {
+    int j, async = (flags & EMPTYDB_ASYNC);
     long long removed = 0;
 
+    if (dbnum < -1 || dbnum >= server.dbnum) {
+        errno = EINVAL;
+        return -1;
+    }
+    snapshotBeforeEmptyDb(dbnum);
+
     for (j = 0; j < server.dbnum; j++) {
+        if (dbnum != -1 && dbnum != j) continue;
         /* 字典的大小 */
         removed += dictSize(server.db[j].dict);
-        dictEmpty(server.db[j].dict,callback);
-        dictEmpty(server.db[j].expires,callback);
+        if (async) {
+            emptyDbAsync(&server.db[j]);
+        } else {
+            dictEmpty(server.db[j].dict,callback);
+            dictEmpty(server.db[j].expires,callback);
+            if (server.db[j].expires_index) {
+                zslFree(server.db[j].expires_index);
+                server.db[j].expires_index = zslCreate();
+            }
+        }
+    }
+    if (server.cluster_enabled) {
+        if (async) {
+            slotToKeyFlushAsync();
+        } else {
+            slotToKeyFlush();
+        }
     }
-    if (server.cluster_enabled) slotToKeyFlush();
     return removed;
 }
 
@@ -410,18 +459,49 @@ void signalFlushedDb(int dbid) {
  * Type agnostic commands operating on the key space
  *----------------------------------------------------------------------------*/
 
+/* Return the set of flags to use for the emptyDb() call for FLUSHALL
+ * and FLUSHDB commands.
+ *
+ * Currently the command just attempts to parse the "ASYNC" option. It
+ * also checks if the command arity is wrong.
+ *
+ * On success C_OK is returned and the flags are stored in *flags, otherwise
+ * C_ERR is returned and the function sends an error to the client. */
+int getFlushCommandFlags(client *c, int *flags) {
+    /* Parse the optional ASYNC option. */
+    if (c->argc > 1) {
+        if (c->argc > 2 || strcasecmp(c->argv[1]->ptr,"async")) {
+            addReply(c,shared.syntaxerr);
+            return C_ERR;
+        }
+        *flags = EMPTYDB_ASYNC;
+    } else {
+        *flags = EMPTYDB_NO_FLAGS;
+    }
+    return C_OK;
+}
+
+/* FLUSHDB [ASYNC]
+ *
+ * Flushes the currently SELECTed Redis DB. */
 void flushdbCommand(client *c) {
-    server.dirty += dictSize(c->db->dict);
+    int flags;
+
+    if (getFlushCommandFlags(c,&flags) == C_ERR) return;
     signalFlushedDb(c->db->id);
-    dictEmpty(c->db->dict,NULL);
-    dictEmpty(c->db->expires,NULL);
-    if (server.cluster_enabled) slotToKeyFlush();
+    server.dirty += emptyDb(c->db->id,flags,NULL);
     addReply(c,shared.ok);
 }
 
+/* FLUSHALL [ASYNC]
+ *
+ * Flushes the whole server data set. */
 void flushallCommand(client *c) {
+    int flags;
+
+    if (getFlushCommandFlags(c,&flags) == C_ERR) return;
     signalFlushedDb(-1);
-    server.dirty += emptyDb(NULL);
+    server.dirty += emptyDb(-1,flags,NULL);
     addReply(c,shared.ok);
     if (server.rdb_child_pid != -1) {
         kill(server.rdb_child_pid,SIGUSR1);
@@ -437,13 +517,17 @@ void flushallCommand(client *c) {
     server.dirty++;
 }
 
-void delCommand(client *c) {
+/* This command implements DEL and UNLINK. */
+void delGenericCommand(client *c, int lazy) {
     int deleted = 0, j;
 
     for (j = 1; j < c->argc; j++) {
         expireIfNeeded(c->db,c->argv[j]);
         //内部也会删除expire字典中的对应key value 
-        if (dbDelete(c->db,c->argv[j])) {
+        //UNLINK 会把大的值交给后台线程释放
+        int deleted_key = lazy ? dbAsyncDelete(c->db,c->argv[j]) :
+                                 dbDelete(c->db,c->argv[j]);
+        if (deleted_key) {
             signalModifiedKey(c->db,c->argv[j]);
             notifyKeyspaceEvent(NOTIFY_GENERIC,
                 "del",c->argv[j],c->db->id);
@@ -454,6 +538,14 @@ void delCommand(client *c) {
     addReplyLongLong(c,deleted);
 }
 
+void delCommand(client *c) {
+    delGenericCommand(c,0);
+}
+
+void unlinkCommand(client *c) {
+    delGenericCommand(c,1);
+}
+
 /* EXISTS key1 key2 ... key_N.
  * Return value is the number of keys existing. */
 /*
@@ -559,7 +651,7 @@ void scanCallback(void *privdata, const dictEntry *de) {
     } else if (o->type == OBJ_ZSET) {
         key = dictGetKey(de);
         incrRefCount(key);
-        val = createStringObjectFromLongDouble(*(double*)dictGetVal(de),0);
+        val = createStringObjectFromLongDouble(zsetDictScore(o->ptr,de),0);
     } else {
         serverPanic("Type not handled in SCAN callback.");
     }
@@ -608,6 +700,7 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
     long count = 10; //count - 可选，用于指定每次迭代返回的 key 的数量，默认值为 10 
     sds pat = NULL;
     int patlen = 0, use_pattern = 0;
+    long long slot = -1;
     dict *ht;
 
     /* Object must be NULL (to iterate keys names), or the type of the object
@@ -657,6 +750,25 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
             /* 如果只是*的话 use_pattern就为false  */
             use_pattern = !(pat[0] == '*' && patlen == 1);
 
+            i += 2;
+        } else if (!strcasecmp(c->argv[i]->ptr, "slot") && o == NULL &&
+                   j >= 2)
+        {
+            /* SCAN <cursor> SLOT <slot>: only iterate the keys of a hash
+             * slot, using the dictionary of the slot. */
+            if (!server.cluster_enabled) {
+                addReplyError(c,"The SLOT option requires cluster mode");
+                goto cleanup;
+            }
+            if (getLongLongFromObjectOrReply(c,c->argv[i+1],&slot,NULL)
+                != C_OK)
+            {
+                goto cleanup;
+            }
+            if (slot < 0 || slot >= CLUSTER_SLOTS) {
+                addReplyError(c,"Invalid slot");
+                goto cleanup;
+            }
             i += 2;
         } else {
             addReply(c,shared.syntaxerr);
@@ -678,12 +790,14 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
     ht = NULL;
     if (o == NULL) {
         ht = c->db->dict; //数据库
+        if (slot != -1) ht = server.cluster->slots_to_keys[slot];
     } else if (o->type == OBJ_SET && o->encoding == OBJ_ENCODING_HT) {
         ht = o->ptr;
     } else if (o->type == OBJ_HASH && o->encoding == OBJ_ENCODING_HT) {
         ht = o->ptr;
         count *= 2; /* We return key / value for this type. */
-    } else if (o->type == OBJ_ZSET && o->encoding == OBJ_ENCODING_SKIPLIST) {
+    } else if (o->type == OBJ_ZSET && (o->encoding == OBJ_ENCODING_SKIPLIST ||
+                                       o->encoding == OBJ_ENCODING_BTREE)) {
         zset *zs = o->ptr;
         ht = zs->dict;
 
@@ -714,6 +828,26 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
         } while (cursor &&
               maxiterations-- &&
               listLength(keys) < (unsigned long)count);
+    } else if (o == NULL) {
+        cursor = 0; /* No keys in the requested slot. */
+    } else if (o->type == OBJ_SET && o->encoding == OBJ_ENCODING_ROARING) {
+        /* Roaring sets can be huge, so they are returned COUNT members at a
+         * time, in ascending order. The cursor is the next member to return
+         * with the sign bit flipped, so that zero, the first cursor, stands
+         * for the smallest possible member. */
+        roaringIterator ri;
+        int64_t ll;
+
+        roaringInitIterator(&ri,o->ptr);
+        roaringIteratorSeek(&ri,(int64_t)(cursor ^ (1ULL<<63)));
+        cursor = 0;
+        while(roaringNext(&ri,&ll)) {
+            if (listLength(keys) == (unsigned long)count) {
+                cursor = (uint64_t)ll ^ (1ULL<<63);
+                break;
+            }
+            listAddNodeTail(keys,createStringObjectFromLongLong(ll));
+        }
     } else if (o->type == OBJ_SET) {
 
         //哦 因为 底层编码不一定是 OBJ_ENCODING_HT
@@ -725,17 +859,17 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
             listAddNodeTail(keys,createStringObjectFromLongLong(ll));
         cursor = 0;
     } else if (o->type == OBJ_HASH || o->type == OBJ_ZSET) {
-        unsigned char *p = ziplistIndex(o->ptr,0);
+        unsigned char *p = lpFirst(o->ptr);
         unsigned char *vstr;
         unsigned int vlen;
         long long vll;
 
         while(p) {
-            ziplistGet(p,&vstr,&vlen,&vll);
+            vstr = lpGetValue(p,&vlen,&vll);
             listAddNodeTail(keys,
                 (vstr != NULL) ? createStringObject((char*)vstr,vlen) :
                                  createStringObjectFromLongLong(vll));
-            p = ziplistNext(o->ptr,p);
+            p = lpNext(o->ptr,p);
         }
         cursor = 0;
     } else {
@@ -982,25 +1116,73 @@ void moveCommand(client *c) {
  *----------------------------------------------------------------------------*/
 
 int removeExpire(redisDb *db, robj *key) {
+    snapshotBeforeWrite(db,key);
     /* An expire may only be removed if there is a corresponding entry in the
      * main dict. Otherwise, the key will never be freed. */
     serverAssertWithInfo(NULL,key,dictFind(db->dict,key->ptr) != NULL);
+    if (db->expires_index) expireIndexDelete(db,key);
     return dictDelete(db->expires,key->ptr) == DICT_OK;
 }
 
 void setExpire(redisDb *db, robj *key, long long when) {
     dictEntry *kde, *de;
 
+    snapshotBeforeWrite(db,key);
     /* Reuse the sds from the main dict in the expire dict */
     /*在expire字典中 重用 主字典中的sds */
     kde = dictFind(db->dict,key->ptr);
     serverAssertWithInfo(NULL,key,kde != NULL);
+    if (db->expires_index) {
+        sds k = dictGetKey(kde);
+
+        expireIndexDelete(db,key);
+        zslInsert(db->expires_index,when,createStringObject(k,sdslen(k)));
+    }
     //查找原来的或者添加
     de = dictReplaceRaw(db->expires,dictGetKey(kde));
     //设置到s64 联合体上
     dictSetSignedIntegerVal(de,when);
+}
 
-
+/* -----------------------------------------------------------------------------
+ * Expire index
+ *
+ * When "expire-index" is enabled every DB has, next to db->expires, a
+ * skiplist of the keys with an expire ordered by expire time. The active
+ * expire cycle can then remove exactly the keys that are due instead of
+ * sampling db->expires at random, and the number of keys expiring before a
+ * given time is computed in O(log(N)) using the skiplist spans.
+ *
+ * The skiplist elements are copies of the key names (the keys of db->expires
+ * are shared with the main dictionary), and the score is the expire time
+ * in milliseconds, that a double represents exactly.
+ * -------------------------------------------------------------------------- */
+
+/* Remove 'key' from the expire index of 'db', if it has an expire. Must be
+ * called before the key is removed from db->expires. */
+void expireIndexDelete(redisDb *db, robj *key) {
+    dictEntry *de = dictFind(db->expires,key->ptr);
+
+    if (de) zslDelete(db->expires_index,dictGetSignedIntegerVal(de),key);
+}
+
+/* Return the number of keys of 'db' that are expired at the unix time 'when'
+ * in milliseconds, using the expire index. As everywhere else a key is
+ * expired only when the time is greater than its expire time, so a key
+ * expiring exactly at 'when' is not counted. */
+unsigned long expireIndexCount(redisDb *db, long long when) {
+    zskiplist *zsl = db->expires_index;
+    zskiplistNode *x = zsl->header;
+    unsigned long rank = 0;
+    int i;
+
+    for (i = zsl->level-1; i >= 0; i--) {
+        while (x->level[i].forward && x->level[i].forward->score < when) {
+            rank += x->level[i].span;
+            x = x->level[i].forward;
+        }
+    }
+    return rank;
 }
 
 /* Return the expire time of the specified key, or -1 if no expire
@@ -1237,6 +1419,64 @@ void persistCommand(client *c) {
     }
 }
 
+/* EXPIRING <seconds> [LIMIT <count>]
+ *
+ * Without LIMIT reply with the number of keys of the current DB that will
+ * expire within the specified number of seconds (keys already logically
+ * expired included), otherwise with up to 'count' of such keys, in expire
+ * order. Requires the expire index. */
+void expiringCommand(client *c) {
+    long long seconds, now, when, count = -1;
+
+    if (c->argc != 2 && c->argc != 4) {
+        addReply(c,shared.syntaxerr);
+        return;
+    }
+    if (getLongLongFromObjectOrReply(c,c->argv[1],&seconds,NULL) != C_OK)
+        return;
+    if (c->argc == 4) {
+        if (strcasecmp(c->argv[2]->ptr,"limit")) {
+            addReply(c,shared.syntaxerr);
+            return;
+        }
+        if (getLongLongFromObjectOrReply(c,c->argv[3],&count,NULL) != C_OK)
+            return;
+        if (count < 0) {
+            addReplyError(c,"LIMIT can't be negative");
+            return;
+        }
+    }
+    if (c->db->expires_index == NULL) {
+        addReplyError(c,"The expire index is disabled, see the expire-index "
+                        "configuration option");
+        return;
+    }
+
+    /* Clamp the time instead of overflowing with huge values: every key
+     * or none of them is reported anyway. */
+    now = mstime();
+    if (seconds > (LLONG_MAX-now)/1000)
+        when = LLONG_MAX;
+    else if (seconds < LLONG_MIN/1000)
+        when = LLONG_MIN;
+    else
+        when = now+seconds*1000;
+    if (count == -1) {
+        addReplyLongLong(c,expireIndexCount(c->db,when));
+    } else {
+        zskiplistNode *zn = c->db->expires_index->header->level[0].forward;
+        void *replylen = addDeferredMultiBulkLength(c);
+        long long added = 0;
+
+        while (zn && zn->score < when && added < count) {
+            addReplyBulk(c,zn->obj);
+            zn = zn->level[0].forward;
+            added++;
+        }
+        setDeferredMultiBulkLength(c,replylen,added);
+    }
+}
+
 /* 探测命令 */
 /* TOUCH key1 [key2 key3 ... keyN] */
 void touchCommand(client *c) {
@@ -1326,6 +1566,26 @@ int *zunionInterGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *nu
     return keys;
 }
 
+/* Helper function to extract keys from the following command:
+ * SINTERCARD <num-keys> <key> <key> ... <key> [LIMIT <limit>] */
+int *sintercardGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys) {
+    int i, num, *keys;
+    UNUSED(cmd);
+
+    num = atoi(argv[1]->ptr);
+    /* Sanity check. Don't return any key if the command is going to
+     * reply with syntax error. */
+    if (num <= 0 || num > (argc-2)) {
+        *numkeys = 0;
+        return NULL;
+    }
+
+    keys = zmalloc(sizeof(int)*num);
+    for (i = 0; i < num; i++) keys[i] = 2+i;
+    *numkeys = num;
+    return keys;
+}
+
 /* Helper function to extract keys from the following commands:
  * EVAL <script> <num-keys> <key> <key> ... <key> [more stuff]
  * EVALSHA <script> <num-keys> <key> <key> ... <key> [more stuff] */
@@ -1468,96 +1728,87 @@ int *georadiusGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numk
 
 /* Slot to Key API. This is used by Redis Cluster in order to obtain in
  * a fast way a key that belongs to a specified hash slot. This is useful
- * while rehashing the cluster. */
-void slotToKeyAdd(robj *key) {
+ * while rehashing the cluster.
+ *
+ * Every slot has its own dictionary, created when the first key of the slot
+ * is added. Like the expires dictionary it references the sds keys stored in
+ * the main dictionary of the DB, so a key must be removed from its slot
+ * before being deleted from the DB. */
+void slotToKeyAdd(sds key) {
 
     /*槽位的hash值*/
-    unsigned int hashslot = keyHashSlot(key->ptr,sdslen(key->ptr));
+    unsigned int hashslot = keyHashSlot(key,sdslen(key));
+    dict **slot = server.cluster->slots_to_keys+hashslot;
 
-    /*插入节点*/
-    /*key的hash值当做分数*/
-    zslInsert(server.cluster->slots_to_keys,hashslot,key);
-    incrRefCount(key);/*增加引用计数*/
+    if (*slot == NULL) *slot = dictCreate(&keyptrDictType,NULL);
+    serverAssert(dictAdd(*slot,key,NULL) == DICT_OK);
 }
 
-void slotToKeyDel(robj *key) {
+void slotToKeyDel(sds key) {
 
     /*算出key对应的hash值*/
-    unsigned int hashslot = keyHashSlot(key->ptr,sdslen(key->ptr));
+    unsigned int hashslot = keyHashSlot(key,sdslen(key));
+    dict *slot = server.cluster->slots_to_keys[hashslot];
 
-    zslDelete(server.cluster->slots_to_keys,hashslot,key);
+    if (slot && dictDelete(slot,key) == DICT_OK && htNeedsResize(slot))
+        dictResize(slot);
 }
 
+/* Release the dictionaries of all the slots. */
 void slotToKeyFlush(void) {
-    /*释放 再分配*/
-    zslFree(server.cluster->slots_to_keys);
-    server.cluster->slots_to_keys = zslCreate();
+    int j;
+
+    for (j = 0; j < CLUSTER_SLOTS; j++) {
+        if (server.cluster->slots_to_keys[j]) {
+            dictRelease(server.cluster->slots_to_keys[j]);
+            server.cluster->slots_to_keys[j] = NULL;
+        }
+    }
 }
 
+/* Store up to 'count' keys of the specified hash slot in 'keys'. The
+ * keys are new objects that the caller should release. */
 unsigned int getKeysInSlot(unsigned int hashslot, robj **keys, unsigned int count) {
-    zskiplistNode *n;
-    zrangespec range;
-    int j = 0;
-
-    range.min = range.max = hashslot;
-    range.minex = range.maxex = 0;
+    dict *slot = server.cluster->slots_to_keys[hashslot];
+    dictIterator *di;
+    dictEntry *de;
+    unsigned int j = 0;
 
-    n = zslFirstInRange(server.cluster->slots_to_keys, &range);
-    while(n && n->score == hashslot && count--) {
-        keys[j++] = n->obj;
-        n = n->level[0].forward;
+    if (slot == NULL) return 0;
+    di = dictGetIterator(slot);
+    while(j < count && (de = dictNext(di)) != NULL) {
+        sds key = dictGetKey(de);
+        keys[j++] = createStringObject(key,sdslen(key));
     }
+    dictReleaseIterator(di);
     return j;
 }
 
 /* Remove all the keys in the specified hash slot.
  * The number of removed items is returned. */
 unsigned int delKeysInSlot(unsigned int hashslot) {
-    zskiplistNode *n;
-    zrangespec range;
+    dict *slot = server.cluster->slots_to_keys[hashslot];
+    dictIterator *di;
+    dictEntry *de;
     int j = 0;
 
-    range.min = range.max = hashslot;
-    range.minex = range.maxex = 0;
-
-    n = zslFirstInRange(server.cluster->slots_to_keys, &range);
-    while(n && n->score == hashslot) {
-        robj *key = n->obj;
-        n = n->level[0].forward; /* Go to the next item before freeing it. */
-        incrRefCount(key); /* Protect the object while freeing it. */
-        dbDelete(&server.db[0],key);
-        decrRefCount(key);
+    if (slot == NULL) return 0;
+    /* A safe iterator, since dbDelete() removes the key from the slot. */
+    di = dictGetSafeIterator(slot);
+    while((de = dictNext(di)) != NULL) {
+        sds key = dictGetKey(de);
+        robj *keyobj = createStringObject(key,sdslen(key));
+        dbDelete(&server.db[0],keyobj);
+        decrRefCount(keyobj);
         j++;
     }
+    dictReleaseIterator(di);
     return j;
 }
 
+/* Number of keys in the specified hash slot, in constant time. */
 unsigned int countKeysInSlot(unsigned int hashslot) {
-    zskiplist *zsl = server.cluster->slots_to_keys;
-    zskiplistNode *zn;
-    zrangespec range;
-    int rank, count = 0;
-
-    range.min = range.max = hashslot;
-    range.minex = range.maxex = 0;
-
-    /*数组中的第一个元素*/
-    /* Find first element in range */
-    zn = zslFirstInRange(zsl, &range);
-
-    /* Use rank of first element, if any, to determine preliminary count */
-    if (zn != NULL) {
-        rank = zslGetRank(zsl, zn->score, zn->obj);
-        count = (zsl->length - (rank - 1));
-
-        /* Find last element in range */
-        zn = zslLastInRange(zsl, &range);
-
-        /* Use rank of last element, if any, to determine the actual count */
-        if (zn != NULL) {
-            rank = zslGetRank(zsl, zn->score, zn->obj);
-            count -= (zsl->length - rank);
-        }
-    }
-    return count;
+    dict *slot = server.cluster->slots_to_keys[hashslot];
+
+    return slot ? dictSize(slot) : 0;
 }
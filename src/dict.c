@@ -44,6 +44,7 @@
 #include <ctype.h>
 
 #include "dict.h"
+#include "fdict.h"
 #include "zmalloc.h"
 #include "redisassert.h"
 
@@ -62,8 +63,8 @@
  * Note that even when dict_can_resize is set to 0, not all resizes are
  * prevented: a hash table is still allowed to grow if the ratio between
  * the number of elements and the buckets > dict_force_resize_ratio. */
-static int dict_can_resize = 1;//默认是1
-static unsigned int dict_force_resize_ratio = 5; // force强迫 ratio是比例的意思
+int dict_can_resize = 1;//默认是1
+unsigned int dict_force_resize_ratio = 5; // force强迫 ratio是比例的意思
 
 /* --------------------------私有原型 private prototypes ---------------------------- */
 
@@ -75,7 +76,7 @@ static int _dictExpandIfNeeded(dict *ht);
 static unsigned long _dictNextPower(unsigned long size);
 
 /*字典键索引*/
-static int _dictKeyIndex(dict *ht, const void *key);
+static int _dictKeyIndex(dict *d, const void *key, dictht **ht);
 /*字典初始化*/
 static int _dictInit(dict *ht, dictType *type, void *privDataPtr);
 
@@ -244,6 +245,77 @@ static void _dictReset(dictht *ht)
     ht->used = 0;
 }
 
+/* ------------------------- bucket table access ----------------------------
+ * Small tables are a flat array of buckets. Tables with more than
+ * DICT_TABLE_CHUNK_SIZE buckets are an array of pointers to chunks of
+ * buckets, allocated only when the first entry is stored in them. A missing
+ * chunk is the same as a chunk of empty buckets. */
+/* 大表的桶数组按块分配，不存在的块相当于全部为空桶 */
+
+#define dictTableChunks(ht) ((dictEntry***)(ht)->table)
+
+/* Allocate the bucket table for a table of the given size. */
+static dictEntry **_dictAllocTable(unsigned long size) {
+    if (size <= DICT_TABLE_CHUNK_SIZE)
+        return zcalloc(size*sizeof(dictEntry*));
+    return zcalloc((size >> DICT_TABLE_CHUNK_BITS)*sizeof(dictEntry**));
+}
+
+/* Release the bucket table, and all the chunks if it is chunked. */
+static void _dictFreeTable(dictht *ht) {
+    if (ht->table && dictIsChunkedTable(ht)) {
+        unsigned long j, nchunks = ht->size >> DICT_TABLE_CHUNK_BITS;
+        dictEntry ***chunks = dictTableChunks(ht);
+
+        for (j = 0; j < nchunks; j++) zfree(chunks[j]);
+    }
+    zfree(ht->table);
+}
+
+/* Return the head of the chain at bucket 'idx'. */
+static inline dictEntry *_dictBucket(dictht *ht, unsigned long idx) {
+    dictEntry **chunk;
+
+    if (!dictIsChunkedTable(ht)) return ht->table[idx];
+    chunk = dictTableChunks(ht)[idx >> DICT_TABLE_CHUNK_BITS];
+    return chunk ? chunk[idx & DICT_TABLE_CHUNK_MASK] : NULL;
+}
+
+/* Return a reference to the bucket 'idx' in order to modify it, allocating
+ * the chunk containing it if needed. */
+static inline dictEntry **_dictBucketRef(dictht *ht, unsigned long idx) {
+    dictEntry ***chunk;
+
+    if (!dictIsChunkedTable(ht)) return &ht->table[idx];
+    chunk = &dictTableChunks(ht)[idx >> DICT_TABLE_CHUNK_BITS];
+    if (*chunk == NULL)
+        *chunk = zcalloc(DICT_TABLE_CHUNK_SIZE*sizeof(dictEntry*));
+    return &(*chunk)[idx & DICT_TABLE_CHUNK_MASK];
+}
+
+/* Return the amount of memory used by the bucket tables of the dictionary,
+ * not counting the entries. For chunked tables only the allocated chunks
+ * are accounted. */
+static size_t _dictTableMemory(dictht *ht) {
+    unsigned long j, nchunks;
+    size_t mem;
+
+    if (ht->table == NULL) return 0;
+    if (!dictIsChunkedTable(ht)) return ht->size*sizeof(dictEntry*);
+    nchunks = ht->size >> DICT_TABLE_CHUNK_BITS;
+    mem = nchunks*sizeof(dictEntry**);
+    for (j = 0; j < nchunks; j++) {
+        if (dictTableChunks(ht)[j])
+            mem += DICT_TABLE_CHUNK_SIZE*sizeof(dictEntry*);
+    }
+    return mem;
+}
+
+size_t dictTableMemory(dict *d) {
+    if (dictIsFlat(d)) return fdictTableMemory(d);
+    return _dictTableMemory(&d->ht[0]) + _dictTableMemory(&d->ht[1]);
+}
+
 /*创建一个新的hash表*/
 /* Create a new hash table */
 dict *dictCreate(dictType *type,
@@ -256,6 +328,18 @@ dict *dictCreate(dictType *type,
     return d;
 }
 
+/* Create a new hash table storing the elements in flat bucketed tables
+ * (see fdict.c) instead of chaining a dictEntry for every element. */
+dict *dictCreateFlat(dictType *type,
+        void *privDataPtr)
+{
+    dict *d = dictCreate(type,privDataPtr);
+
+    assert(type->keyEmbed == NULL); /* Flat tables just store pointers. */
+    d->flat = 1;
+    return d;
+}
+
 /* 初始化hash表*/
 /* Initialize the hash table */
 int _dictInit(dict *d, dictType *type,
@@ -268,6 +352,7 @@ int _dictInit(dict *d, dictType *type,
     d->privdata = privDataPtr;
     d->rehashidx = -1; // -1 表示没有在进行 rehash
     d->iterators = 0;  // 0 表示没有迭代器在进行迭代
+    d->flat = 0;
     return DICT_OK; //返回成功 0
 }
 
@@ -306,6 +391,8 @@ int dictExpand(dict *d, unsigned long size)
     //// 计算哈希表的(真正)大小
     unsigned long realsize = _dictNextPower(size);
 
+    if (dictIsFlat(d)) return fdictExpand(d,size);
+
     /*
      如果正在rehash或者
      如果其大小小于哈希表中已存在的元素数量，则该尺寸无效
@@ -320,10 +407,11 @@ int dictExpand(dict *d, unsigned long size)
     if (realsize == d->ht[0].size) return DICT_ERR;
 
     /*分配新的hash表 初始化所有指针为NULL*/
-    /* Allocate the new hash table and initialize all pointers to NULL */
+    /* Allocate the new hash table and initialize all pointers to NULL.
+     * Big tables only allocate the array of chunk pointers here. */
     n.size = realsize;
     n.sizemask = realsize-1;
-    n.table = zcalloc(realsize*sizeof(dictEntry*));
+    n.table = _dictAllocTable(realsize);
     n.used = 0;
 
     //判断是否是第一次初始化，如果不是真正的rehash 那就只设置第一个hash表，
@@ -355,6 +443,22 @@ int dictExpand(dict *d, unsigned long size)
   不能保证此函数会重新对哪怕一个桶进行哈希处理，
   因为它最多只会遍历总共 N*10 个空桶，否则其执行的工作量将是无限的，而且该函数可能会长时间阻塞。
 */
+/* Move the rehashing index to the next bucket of the old table. When the
+ * old table is chunked and the index leaves a chunk, all the buckets of the
+ * chunk were already migrated, so the chunk is released ASAP: this way the
+ * old table shrinks while the new one grows. */
+static void _dictRehashAdvance(dict *d) {
+    dictht *ht = &d->ht[0];
+
+    d->rehashidx++;
+    if (dictIsChunkedTable(ht) && (d->rehashidx & DICT_TABLE_CHUNK_MASK) == 0) {
+        dictEntry ***chunk =
+            &dictTableChunks(ht)[(d->rehashidx-1) >> DICT_TABLE_CHUNK_BITS];
+        zfree(*chunk);
+        *chunk = NULL;
+    }
+}
+
 /* Performs N steps of incremental rehashing. Returns 1 if there are still
  * keys to move from the old to the new hash table, otherwise 0 is returned.
  *
@@ -369,6 +473,8 @@ int dictRehash(dict *d, int n) {
     /*访问空桶的最大数量*/
     int empty_visits = n*10; /* Max number of empty buckets to visit. */
 
+    if (dictIsFlat(d)) return fdictRehash(d,n);
+
     /*如果不是在rehash 直接返回0*/
     /* 比如 rehashidx 等于0 就代表正在rehash*/
     if (!dictIsRehashing(d)) return 0;
@@ -390,8 +496,13 @@ int dictRehash(dict *d, int n) {
 
           除非empty_visits 为0 了 那就直接返回了
         */
-        while(d->ht[0].table[d->rehashidx] == NULL) {
-            d->rehashidx++;
+        while(_dictBucket(&d->ht[0],d->rehashidx) == NULL) {
+            /* A missing chunk is skipped at once, it has no entries. */
+            if (dictIsChunkedTable(&d->ht[0]) &&
+                dictTableChunks(&d->ht[0])[d->rehashidx >> DICT_TABLE_CHUNK_BITS] == NULL)
+                d->rehashidx = (d->rehashidx | DICT_TABLE_CHUNK_MASK) + 1;
+            else
+                _dictRehashAdvance(d);
             //由于每一步间隙可能存在空 bucket，所以有设置最多会处理 N * 10个空桶，当检查一定数量空桶后就停止，
             //转而可以去执行请求，避免对性能造成太大的影响（不会在所有都是空桶的情况下一直循环下去）
             if (--empty_visits == 0) return 1;
@@ -399,7 +510,7 @@ int dictRehash(dict *d, int n) {
         //n为1的时候 就是把一个bucket的放到ht[1]中。
 
         /*取第一个表的rehashidx处的指针*/
-        de = d->ht[0].table[d->rehashidx];
+        de = _dictBucket(&d->ht[0],d->rehashidx);
 
         /* 转移旧桶的所有key到新的hash表中*/
         /* Move all the keys in this bucket from the old to the new hash HT */
@@ -419,10 +530,9 @@ int dictRehash(dict *d, int n) {
             //搬迁过程简单理解就是遍历链表，将里面的元素用 头插法 插入新哈希表新链表中，不过这里直接头插法，
             //假设它新索引的位置也刚好冲突的话，一个链表 1->2->3 经过搬迁后，会变成 3 -> 2 -> 1，不过一般没啥问题
             //1 先插  然后 2插入 变成 2->1,然后3插入，就变成3->2->1
-            de->next = d->ht[1].table[h];
-           
-
-            d->ht[1].table[h] = de;
+            dictEntry **bucket = _dictBucketRef(&d->ht[1],h);
+            de->next = *bucket;
+            *bucket = de;
             //ht[0] used  减 1 
             d->ht[0].used--;
             //ht[1] 加1
@@ -432,10 +542,10 @@ int dictRehash(dict *d, int n) {
         }
 
         //当前旧表的rehashidx处设置为空
-        d->ht[0].table[d->rehashidx] = NULL;
+        *_dictBucketRef(&d->ht[0],d->rehashidx) = NULL;
 
         //rehashidx 增加
-        d->rehashidx++;
+        _dictRehashAdvance(d);
     }
 
     //最后如果 ht[0].used == 0，即整个重哈希完成，会将 ht[0] 置为 ht[1]，ht[1] 置空，rehashidx 置为-1
@@ -444,7 +554,7 @@ int dictRehash(dict *d, int n) {
     if (d->ht[0].used == 0) {
 
         //释放旧表的 table指针指向的内存
-        zfree(d->ht[0].table);
+        _dictFreeTable(&d->ht[0]);
         //重新把d->ht[1] 赋值给 ht[0]
         d->ht[0] = d->ht[1];
         //重置新的表
@@ -563,6 +673,8 @@ dictEntry *dictAddRaw(dict *d, void *key)
     dictEntry *entry;
     dictht *ht;
 
+    if (dictIsFlat(d)) return fdictAddRaw(d,key);
+
     /**
      *  如果正在rehash
      *  那就执行_dictRehashStep操作
@@ -580,7 +692,7 @@ dictEntry *dictAddRaw(dict *d, void *key)
     */
     /* Get the index of the new element, or -1 if
      * the element already exists. */
-    if ((index = _dictKeyIndex(d, key)) == -1)
+    if ((index = _dictKeyIndex(d, key, &ht)) == -1)
         return NULL;
 
     //在顶部插入元素，假设在数据库系统中，最近添加的条目更有可能被更频繁地访问。
@@ -588,22 +700,28 @@ dictEntry *dictAddRaw(dict *d, void *key)
      * Insert the element in top, with the assumption that in a database
      * system it is more likely that recently added entries are accessed
      * more frequently. */
-    //如果是正在rehash 那么就直接添加到ht[1]中
-    //对于新增元素，都只会保存到 ht[1] 上，在 ht[0] 上则不会进行任何添加操作，
-    //保证了 ht[0] 里面的键值对数量只减少不增加，并随着重哈希过程，而最终变成空哈希表
-    ht = dictIsRehashing(d) ? &d->ht[1] : &d->ht[0];
+    //如果是正在rehash 新元素添加到ht[1]中，除非它在ht[0]中的桶还没有被迁移
+    //（见_dictKeyIndex），这样rehash期间新表的块是按顺序分配的
     //分配空间
-    entry = zmalloc(sizeof(*entry));
+    //如果键是内嵌的 键和节点在同一块内存中
+    if (d->type->keyEmbed)
+        entry = zmalloc(sizeof(*entry)+d->type->keyEmbedSize(key));
+    else
+        entry = zmalloc(sizeof(*entry));
     //链表 原来的值变为链表桶的第一个
-    entry->next = ht->table[index];
-    ht->table[index] = entry;
+    dictEntry **bucket = _dictBucketRef(ht,index);
+    entry->next = *bucket;
+    *bucket = entry;
     //used加1
     ht->used++;
 
     //设置hash表节点的key变量/成员
     //如果有拷贝方法 就调用拷贝方法
     /* Set the hash entry fields. */
-    dictSetKey(d, entry, key);
+    if (d->type->keyEmbed)
+        entry->key = d->type->keyEmbed(entry+1,key);
+    else
+        dictSetKey(d, entry, key);
     return entry;
 }
 
@@ -655,8 +773,12 @@ int dictReplace(dict *d, void *key, void *val)
      * to do that in this order, as the value may just be exactly the same
      * as the previous one. In this context, think to reference counting,
      * you want to increment (set), and then decrement (free), and not the
-     * reverse. */
-    auxentry = *entry; //这里是复制操作 
+     * reverse.
+     *
+     * Only the key and the value are copied: in a flat dict 'entry' points
+     * to a fdictSlot, that has no 'next' field. */
+    auxentry.key = entry->key; //这里是复制操作
+    auxentry.v = entry->v;
     dictSetVal(d, entry, val);
     dictFreeVal(d, &auxentry);
     return 0;
@@ -693,6 +815,8 @@ static int dictGenericDelete(dict *d, const void *key, int nofree)
     dictEntry *he, *prevHe;
     int table;
 
+    if (dictIsFlat(d)) return fdictGenericDelete(d,key,nofree);
+
     /*
       4.0变成
       if (d->ht[0].used == 0 && d->ht[1].used == 0) return NULL;
@@ -709,7 +833,7 @@ static int dictGenericDelete(dict *d, const void *key, int nofree)
     for (table = 0; table <= 1; table++) {
         /*根据hash值获取在表中的索引*/
         idx = h & d->ht[table].sizemask;
-        he = d->ht[table].table[idx];
+        he = _dictBucket(&d->ht[table],idx);
         prevHe = NULL;
         while(he) {
             /* 当前key相等 或者 比较相等 */
@@ -719,7 +843,7 @@ static int dictGenericDelete(dict *d, const void *key, int nofree)
                 if (prevHe)
                     prevHe->next = he->next;
                 else
-                    d->ht[table].table[idx] = he->next;
+                    *_dictBucketRef(&d->ht[table],idx) = he->next;
                 
                 //nofree 为0  代表就是free
                 if (!nofree) {
@@ -799,6 +923,8 @@ int dictDeleteNoFree(dict *ht, const void *key) {
 int _dictClear(dict *d, dictht *ht, void(callback)(void *)) {
     unsigned long i;
 
+    if (dictIsFlat(d)) return fdictClear(d,ht,callback);
+
     /*   */
     /* 释放所有元素 遍历ht的size数量 且ht的used要大于0 */
     /* Free all the elements */
@@ -812,7 +938,7 @@ int _dictClear(dict *d, dictht *ht, void(callback)(void *)) {
         */
         if (callback && (i & 65535) == 0) callback(d->privdata);
 
-        if ((he = ht->table[i]) == NULL) continue;
+        if ((he = _dictBucket(ht,i)) == NULL) continue;
 
         //遍历 每个entry
         while(he) {
@@ -829,7 +955,7 @@ int _dictClear(dict *d, dictht *ht, void(callback)(void *)) {
     }
     /*释放列表 和分配的缓存空间*/
     /* Free the table and the allocated cache structure */
-    zfree(ht->table);
+    _dictFreeTable(ht);
     /* Re-initialize the table */
     _dictReset(ht);
     return DICT_OK; /* never fails */
@@ -849,6 +975,7 @@ dictEntry *dictFind(dict *d, const void *key)
     dictEntry *he;
     unsigned int h, idx, table;
 
+    if (dictIsFlat(d)) return fdictFind(d,key);
     //两字典的used数量加起来都是0 那么返回
     if (d->ht[0].used + d->ht[1].used == 0) return NULL; /* dict is empty */
     //如果正在rehash 那就开始rehash
@@ -860,7 +987,7 @@ dictEntry *dictFind(dict *d, const void *key)
     /**/
     for (table = 0; table <= 1; table++) {
         idx = h & d->ht[table].sizemask;
-        he = d->ht[table].table[idx];
+        he = _dictBucket(&d->ht[table],idx);
         //循环单向链表
         while(he) {
             if (key==he->key || dictCompareKeys(d, key, he->key))
@@ -955,6 +1082,8 @@ dictIterator *dictGetSafeIterator(dict *d) {
 
 dictEntry *dictNext(dictIterator *iter)
 {
+    if (dictIsFlat(iter->d)) return fdictNext(iter);
+
     /*还能这样*/
     while (1) {
         if (iter->entry == NULL) {
@@ -979,7 +1108,7 @@ dictEntry *dictNext(dictIterator *iter)
                     break;
                 }
             }
-            iter->entry = ht->table[iter->index];
+            iter->entry = _dictBucket(ht,iter->index);
         } else {
             //entry标记为下一个
             iter->entry = iter->nextEntry;
@@ -1016,6 +1145,8 @@ dictEntry *dictGetRandomKey(dict *d)
     unsigned int h;
     int listlen, listele;
 
+    if (dictIsFlat(d)) return fdictGetRandomKey(d);
+
      /*两个表的used和为0 */
     if (dictSize(d) == 0) return NULL;
 
@@ -1034,8 +1165,9 @@ dictEntry *dictGetRandomKey(dict *d)
             h = d->rehashidx + (random() % (d->ht[0].size +
                                             d->ht[1].size -
                                             d->rehashidx));
-            he = (h >= d->ht[0].size) ? d->ht[1].table[h - d->ht[0].size] :
-                                      d->ht[0].table[h];
+            he = (h >= d->ht[0].size) ?
+                 _dictBucket(&d->ht[1],h - d->ht[0].size) :
+                 _dictBucket(&d->ht[0],h);
         } while(he == NULL);
     } else {
         do {
@@ -1044,7 +1176,7 @@ dictEntry *dictGetRandomKey(dict *d)
               无论 random() 返回多大的数，按位与后只会保留低 3 位，高位全部清零：
             */
             h = random() & d->ht[0].sizemask;
-            he = d->ht[0].table[h];
+            he = _dictBucket(&d->ht[0],h);
         } while(he == NULL);
     }
 
@@ -1116,6 +1248,8 @@ unsigned int dictGetSomeKeys(dict *d, dictEntry **des, unsigned int count) {
     unsigned long stored = 0, maxsizemask;
     unsigned long maxsteps;
 
+    if (dictIsFlat(d)) return fdictGetSomeKeys(d,des,count);
+
     /*如果当前两个表加起来数量小于count参数 那就把count参数置为两表的和*/
     if (dictSize(d) < count) count = dictSize(d);
 
@@ -1188,7 +1322,7 @@ unsigned int dictGetSomeKeys(dict *d, dictEntry **des, unsigned int count) {
 
             //
             if (i >= d->ht[j].size) continue; /* Out of range for this table. */
-            dictEntry *he = d->ht[j].table[i];
+            dictEntry *he = _dictBucket(&d->ht[j],i);
 
             /* Count contiguous empty buckets, and jump to other
              * locations if they reach 'count' (with a minimum of 5). */
@@ -1528,6 +1662,7 @@ unsigned long dictScan(dict *d,
     const dictEntry *de;
     unsigned long m0, m1;
 
+    if (dictIsFlat(d)) return fdictScan(d,v,fn,privdata);
     if (dictSize(d) == 0) return 0;
 
     /*不在rehash的时候*/
@@ -1541,7 +1676,7 @@ unsigned long dictScan(dict *d,
 
         /* Emit entries at cursor */
         /*在光标处输出条目*/
-        de = t0->table[v & m0];
+        de = _dictBucket(t0,v & m0);
         while (de) {
             //回调函数
             fn(privdata, de);
@@ -1645,7 +1780,7 @@ unsigned long dictScan(dict *d,
 
         /* Emit entries at cursor */
               /*第一个hash表*/
-        de = t0->table[v & m0];
+        de = _dictBucket(t0,v & m0);
         while (de) {
             fn(privdata, de);
             de = de->next;
@@ -1664,7 +1799,7 @@ unsigned long dictScan(dict *d,
             /* Emit entries at cursor */
        
             /*第二个hash表*/
-            de = t1->table[v & m1];
+            de = _dictBucket(t1,v & m1);
             while (de) {
                 fn(privdata, de);
                 de = de->next;
@@ -1766,14 +1901,18 @@ static unsigned long _dictNextPower(unsigned long size)
 }
 
 /* Returns the index of a free slot that can be populated with
- * a hash entry for the given 'key'.
- * If the key already exists, -1 is returned.
+ * a hash entry for the given 'key', and sets '*ht' to the hash table the
+ * index refers to. If the key already exists, -1 is returned.
  *
  * Note that if we are in the process of rehashing the hash table, the
- * index is always returned in the context of the second (new) hash table. */
-static int _dictKeyIndex(dict *d, const void *key)
+ * index is returned in the context of the second (new) hash table, unless
+ * the bucket of the old table was not yet migrated: in that case the entry
+ * is added to the old table, and will be moved with the rest of the bucket.
+ * This way the chunks of the new table are populated in the same order the
+ * rehashing progresses, instead of being all allocated by random inserts. */
+static int _dictKeyIndex(dict *d, const void *key, dictht **ht)
 {
-    unsigned int h, idx, table;
+    unsigned int h, idx, idx0 = 0, table;
     dictEntry *he;
 
     //先调用 _dictExpandIfNeeded ，检查两个哈希表是否有足够的空间容纳新元素：
@@ -1790,7 +1929,7 @@ static int _dictKeyIndex(dict *d, const void *key)
     for (table = 0; table <= 1; table++) {
         idx = h & d->ht[table].sizemask;
         /* Search if this slot does not already contain the given key */
-        he = d->ht[table].table[idx];
+        he = _dictBucket(&d->ht[table],idx);
         while(he) {
             if (key==he->key || dictCompareKeys(d, key, he->key))
                 return -1;
@@ -1798,7 +1937,13 @@ static int _dictKeyIndex(dict *d, const void *key)
         }
         /**/
         if (!dictIsRehashing(d)) break;
+        if (table == 0) idx0 = idx;
+    }
+    if (dictIsRehashing(d) && idx0 >= (unsigned long) d->rehashidx) {
+        *ht = &d->ht[0];
+        return idx0;
     }
+    *ht = dictIsRehashing(d) ? &d->ht[1] : &d->ht[0];
     return idx;
 }
 
@@ -1841,14 +1986,14 @@ size_t _dictGetStatsHt(char *buf, size_t bufsize, dictht *ht, int tableid) {
         dictEntry *he;
 
         /*  */
-        if (ht->table[i] == NULL) {
+        if (_dictBucket(ht,i) == NULL) {
             clvector[0]++;
             continue;
         }
         slots++;
         /* For each hash entry on this slot... */
         chainlen = 0;
-        he = ht->table[i];
+        he = _dictBucket(ht,i);
         /**/
         while(he) {
             /* 长度 */
@@ -1894,6 +2039,11 @@ void dictGetStats(char *buf, size_t bufsize, dict *d) {
     char *orig_buf = buf;
     size_t orig_bufsize = bufsize;
 
+    if (dictIsFlat(d)) {
+        fdictGetStats(buf,bufsize,d);
+        return;
+    }
+
     l = _dictGetStatsHt(buf,bufsize,&d->ht[0],0);
     buf += l;
     bufsize -= l;
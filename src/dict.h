@@ -81,6 +81,13 @@ typedef struct dictType {
     int (*keyCompare)(void *privdata, const void *key1, const void *key2);
     void (*keyDestructor)(void *privdata, void *key);
     void (*valDestructor)(void *privdata, void *obj);
+    /* If set, keys are not referenced but copied inside the allocation of
+     * their dictEntry: keyEmbedSize() returns the bytes needed to store the
+     * key, and keyEmbed() copies it into 'buf' returning the embedded key.
+     * In this case the dictionary doesn't take ownership of the keys passed
+     * to dictAdd(), and the key destructor should be NULL. */
+    size_t (*keyEmbedSize)(const void *key);
+    void *(*keyEmbed)(void *buf, const void *key);
 } dictType;
 
 /**
@@ -95,9 +102,20 @@ typedef struct dictType {
  在我们采用增量rehash技术时，每部词典都会包含这两部分内容，即旧表和新表之间的映射关系。
 */
 /* This is our hash table structure. Every dictionary has two of this as we
- * implement incremental rehashing, for the old to the new table. */
+ * implement incremental rehashing, for the old to the new table.
+ *
+ * Tables with more than DICT_TABLE_CHUNK_SIZE buckets are not allocated in
+ * a single block: 'table' is instead an array of pointers to chunks of
+ * DICT_TABLE_CHUNK_SIZE buckets, and every chunk is only allocated when the
+ * first entry is stored into it. While rehashing, the chunks of the old
+ * table are released as soon as they are fully migrated, so the memory
+ * used by a growing dictionary never doubles all at once.
+ *
+ * For flat dictionaries (see fdict.c) 'table' is instead an array of
+ * buckets holding several elements each, and 'size' the number of buckets. */
+/* 大表按块（chunk）分配桶数组：块在第一次写入时才分配，rehash时旧表的块迁移完就释放 */
 typedef struct dictht {
-    dictEntry **table; /** 哈希表 对应了多个哈希桶 */ // 节点指针数组
+    dictEntry **table; /** 哈希表 对应了多个哈希桶 */ // 节点指针数组（大表时为块指针数组）
     unsigned long size; // 桶的大小（最多可容纳多少节点）
     unsigned long sizemask; // mask 码，用于地址索引计算
     unsigned long used; // 已有节点数量
@@ -119,6 +137,7 @@ typedef struct dict {
     long rehashidx; /* rehashing not in progress if rehashidx == -1 */ // 指示 rehash 是否正在进行，如果不是则为 -1
      // 正在运行的安全迭代器数量，这个在 6.2 (#8515) 中被修改为 pauserehash
     int iterators; /* number of iterators currently running */ // 当前正在使用的 iterator 的数量
+    int flat; /* elements are stored in flat bucketed tables, see fdict.c */
 } dict;
 
 /* If safe is set to 1 this is a safe iterator, that means, you can call
@@ -139,6 +158,11 @@ typedef void (dictScanFunction)(void *privdata, const dictEntry *de);
 /* This is the initial size of every hash table */
 #define DICT_HT_INITIAL_SIZE     4
 
+/* Tables bigger than this number of buckets are allocated in chunks. */
+#define DICT_TABLE_CHUNK_BITS    16
+#define DICT_TABLE_CHUNK_SIZE    (1UL<<DICT_TABLE_CHUNK_BITS)
+#define DICT_TABLE_CHUNK_MASK    (DICT_TABLE_CHUNK_SIZE-1)
+
 /* ------------------------------- Macros ------------------------------------*/
 #define dictFreeVal(d, entry) \
     if ((d)->type->valDestructor) \
@@ -185,9 +209,12 @@ typedef void (dictScanFunction)(void *privdata, const dictEntry *de);
 #define dictSlots(d) ((d)->ht[0].size+(d)->ht[1].size)
 #define dictSize(d) ((d)->ht[0].used+(d)->ht[1].used)
 #define dictIsRehashing(d) ((d)->rehashidx != -1)
+#define dictIsChunkedTable(ht) ((ht)->size > DICT_TABLE_CHUNK_SIZE)
+#define dictIsFlat(d) ((d)->flat)
 
 /* API */
 dict *dictCreate(dictType *type, void *privDataPtr);
+dict *dictCreateFlat(dictType *type, void *privDataPtr);
 int dictExpand(dict *d, unsigned long size);
 int dictAdd(dict *d, void *key, void *val);
 dictEntry *dictAddRaw(dict *d, void *key);
@@ -213,9 +240,11 @@ void dictEnableResize(void);
 void dictDisableResize(void);
 int dictRehash(dict *d, int n);
 int dictRehashMilliseconds(dict *d, int ms);
+size_t dictTableMemory(dict *d);
 void dictSetHashFunctionSeed(unsigned int initval);
 unsigned int dictGetHashFunctionSeed(void);
 unsigned long dictScan(dict *d, unsigned long v, dictScanFunction *fn, void *privdata);
+long long dictFingerprint(dict *d);
 
 /* Hash table types */
 extern dictType dictTypeHeapStringCopyKey;
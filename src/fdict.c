@@ -0,0 +1,929 @@
+/* Flat bucketed hash tables, an alternative representation of dict.c tables.
+ *
+ * With the classic dict.c tables a lookup reads the bucket array, then the
+ * dictEntry, then the key, and for every collision one more dictEntry and
+ * key: every step is a likely cache miss. Flat tables store the key and
+ * value pointers directly inside the buckets, seven elements per bucket,
+ * together with a one byte fingerprint (tag) of the hash of every element.
+ * A lookup reads the bucket, compares the seven tags at once, and only
+ * dereferences the keys whose tag matches, that is almost always just the
+ * key we are looking for.
+ *
+ * The tags are compared in the style of Swiss tables, but since a bucket
+ * only has seven of them they fit in a single 64 bit word together with the
+ * presence bitmap, so the comparison is performed with plain 64 bit
+ * arithmetic (SIMD within a register) without requiring SSE or NEON.
+ *
+ * Collisions are not resolved by probing other buckets: when a bucket is
+ * full an overflow bucket is chained to it. This way every element is
+ * always stored in the bucket selected by the low bits of its hash, exactly
+ * like in dict.c, so the incremental rehashing and the reverse binary
+ * cursor of dictScan() work the same way and provide the same guarantees.
+ *
+ * Flat tables are used by dictionaries created with dictCreateFlat(), the
+ * dict.c API functions dispatch here, so users of the dictionary don't
+ * need to know how it is represented. The dictht structures are used as
+ * they are, but 'table' points to an array of fdictBucket, 'size' is the
+ * number of buckets and 'used' the number of elements. The rehashing is
+ * done when all the buckets of the old table were visited.
+ *
+ * The dictEntry pointers returned are pointers to the slots inside the
+ * buckets, so they are only valid until the next operation that may modify
+ * the dictionary: adding or deleting elements may move other elements
+ * around. Deleting the entry returned by a safe iterator is still fine,
+ * since while safe iterators exist elements are never moved.
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "fmacros.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "config.h"
+#include "fdict.h"
+#include "zmalloc.h"
+#include "redisassert.h"
+
+/* Resize policy, shared with dict.c. */
+extern int dict_can_resize;
+extern unsigned int dict_force_resize_ratio;
+
+#define FDICT_FULL_BUCKET ((1<<FDICT_BUCKET_SLOTS)-1)
+
+#define fdictBuckets(ht) ((fdictBucket*)(ht)->table)
+#define fdictHashTag(h) ((uint8_t)((h) >> 24))
+
+/* ------------------------- private functions ------------------------------ */
+
+/* Return the bitmap of the used slots of the bucket 'b' having the
+ * fingerprint 'tag'. The presence byte and the seven tags are loaded as a
+ * single word, xored with the tag repeated in every byte, so that matching
+ * tags become zero bytes, that are then found with the usual bit twiddling
+ * trick. The trick may report a false match in the byte after a zero byte,
+ * this is not a problem since the keys of the matching slots are compared
+ * anyway. */
+static inline unsigned int _fdictMatchTag(const fdictBucket *b, uint8_t tag) {
+#if (BYTE_ORDER == LITTLE_ENDIAN)
+    uint64_t word, x, zero;
+
+    memcpy(&word,b,sizeof(word));
+    x = word ^ (0x0101010101010101ULL * tag);
+    zero = ((x - 0x0101010101010101ULL) & ~x & 0x8080808080808080ULL) >> 7;
+    /* Gather the lowest bit of every byte into the top byte, skipping the
+     * byte of the presence bitmap. */
+    return ((zero * 0x0102040810204080ULL) >> 57) & b->presence;
+#else
+    unsigned int j, mask = 0;
+
+    for (j = 0; j < FDICT_BUCKET_SLOTS; j++)
+        if (b->tags[j] == tag) mask |= 1<<j;
+    return mask & b->presence;
+#endif
+}
+
+/* Return the slot holding 'key' in the table 'ht', or NULL. */
+static fdictSlot *_fdictLookup(dict *d, dictht *ht, unsigned int h,
+                               const void *key)
+{
+    fdictBucket *b = &fdictBuckets(ht)[h & ht->sizemask];
+    uint8_t tag = fdictHashTag(h);
+
+    do {
+        unsigned int match = _fdictMatchTag(b,tag);
+
+        while(match) {
+            fdictSlot *s = &b->slots[__builtin_ctz(match)];
+
+            if (key == s->key || dictCompareKeys(d, key, s->key)) return s;
+            match &= match-1;
+        }
+        b = b->child;
+    } while(b);
+    return NULL;
+}
+
+/* Reserve a free slot for an element with hash 'h' in the table 'ht',
+ * chaining a new overflow bucket if all the buckets are full. The caller
+ * should set the key and the value of the returned slot. */
+static fdictSlot *_fdictReserveSlot(dictht *ht, unsigned int h) {
+    fdictBucket *b = &fdictBuckets(ht)[h & ht->sizemask];
+    int j;
+
+    while(b->presence == FDICT_FULL_BUCKET) {
+        if (b->child == NULL) b->child = zcalloc(sizeof(fdictBucket));
+        b = b->child;
+    }
+    j = __builtin_ctz(~b->presence);
+    b->presence |= 1<<j;
+    b->tags[j] = fdictHashTag(h);
+    ht->used++;
+    return &b->slots[j];
+}
+
+/* The bucket 'b', chained after 'prev' (NULL if 'b' is the bucket inside the
+ * table) just became empty: release it if it is an overflow bucket, or move
+ * its first overflow bucket inside the table. This must never be called
+ * while safe iterators are running, since it moves elements. */
+static void _fdictCompact(fdictBucket *prev, fdictBucket *b) {
+    fdictBucket *child = b->child;
+
+    if (prev) {
+        prev->child = child;
+        zfree(b);
+    } else if (child) {
+        *b = *child;
+        zfree(child);
+    }
+}
+
+static int _fdictBucketIsEmpty(fdictBucket *b) {
+    return b->presence == 0 && b->child == NULL;
+}
+
+static void _fdictReset(dictht *ht) {
+    ht->table = NULL;
+    ht->size = 0;
+    ht->sizemask = 0;
+    ht->used = 0;
+}
+
+static unsigned long _fdictNextPower(unsigned long size) {
+    unsigned long i = 1;
+
+    if (size >= LONG_MAX) return LONG_MAX + 1LU;
+    while(i < size) i *= 2;
+    return i;
+}
+
+static void _fdictRehashStep(dict *d) {
+    if (d->iterators == 0) fdictRehash(d,1);
+}
+
+static int _fdictExpandIfNeeded(dict *d) {
+    dictht *ht = &d->ht[0];
+
+    if (dictIsRehashing(d)) return DICT_OK;
+    if (ht->size == 0) return fdictExpand(d, DICT_HT_INITIAL_SIZE);
+
+    /* Grow when the buckets have FDICT_BUCKET_FILL elements on average, or,
+     * if resizing is not allowed, when the overflow chains are way too
+     * long. */
+    if (ht->used >= ht->size*FDICT_BUCKET_FILL &&
+        (dict_can_resize ||
+         ht->used/ht->size > FDICT_BUCKET_FILL*dict_force_resize_ratio))
+    {
+        return fdictExpand(d, ht->used*2);
+    }
+    return DICT_OK;
+}
+
+/* ------------------------------- API -------------------------------------- */
+
+/* Expand or create the table so that it can hold 'size' elements with
+ * about FDICT_BUCKET_FILL elements per bucket. The table is allocated with
+ * zcalloc(), so for big tables the zeroed pages are provided lazily by the
+ * kernel and the allocation does not stall the server. */
+int fdictExpand(dict *d, unsigned long size) {
+    dictht n;
+    unsigned long realsize =
+        _fdictNextPower((size+FDICT_BUCKET_FILL-1)/FDICT_BUCKET_FILL);
+
+    if (dictIsRehashing(d) || d->ht[0].used > size)
+        return DICT_ERR;
+    if (realsize == d->ht[0].size) return DICT_ERR;
+
+    n.size = realsize;
+    n.sizemask = realsize-1;
+    n.table = zcalloc(realsize*sizeof(fdictBucket));
+    n.used = 0;
+
+    if (d->ht[0].table == NULL) {
+        d->ht[0] = n;
+        return DICT_OK;
+    }
+    d->ht[1] = n;
+    d->rehashidx = 0;
+    return DICT_OK;
+}
+
+/* Performs N steps of incremental rehashing, every step moves a bucket and
+ * its overflow buckets to the new table. Like in dictRehash() at max N*10
+ * empty buckets are visited. Returns 1 if there are still buckets to move,
+ * otherwise 0 is returned. */
+int fdictRehash(dict *d, int n) {
+    int empty_visits = n*10;
+    dictht *t0 = &d->ht[0], *t1 = &d->ht[1];
+
+    if (!dictIsRehashing(d)) return 0;
+
+    while(n-- && (unsigned long)d->rehashidx < t0->size) {
+        fdictBucket *head, *b, *next;
+
+        head = &fdictBuckets(t0)[d->rehashidx];
+        if (_fdictBucketIsEmpty(head)) {
+            d->rehashidx++;
+            if (--empty_visits == 0) break;
+            n++; /* Empty buckets are not a rehashing step. */
+            continue;
+        }
+
+        /* Move all the elements of the chain to the new table. */
+        b = head;
+        do {
+            unsigned int used = b->presence;
+
+            while(used) {
+                fdictSlot *src = &b->slots[__builtin_ctz(used)];
+
+                *_fdictReserveSlot(t1,dictHashKey(d,src->key)) = *src;
+                t0->used--;
+                used &= used-1;
+            }
+            next = b->child;
+            if (b != head) zfree(b);
+            b = next;
+        } while(b);
+        memset(head,0,sizeof(*head));
+        d->rehashidx++;
+    }
+
+    /* Check if we already rehashed the whole table... */
+    if ((unsigned long)d->rehashidx == t0->size) {
+        zfree(t0->table);
+        *t0 = *t1;
+        _fdictReset(t1);
+        d->rehashidx = -1;
+        return 0;
+    }
+    return 1;
+}
+
+/* Low level add, see dictAddRaw(). */
+dictEntry *fdictAddRaw(dict *d, void *key) {
+    fdictSlot *s;
+    unsigned int h;
+    int table;
+
+    if (dictIsRehashing(d)) _fdictRehashStep(d);
+    if (_fdictExpandIfNeeded(d) == DICT_ERR) return NULL;
+
+    h = dictHashKey(d, key);
+    for (table = 0; table <= 1; table++) {
+        if (_fdictLookup(d,&d->ht[table],h,key)) return NULL;
+        if (!dictIsRehashing(d)) break;
+    }
+
+    /* New elements are always added to the new table while rehashing. */
+    s = _fdictReserveSlot(&d->ht[dictIsRehashing(d) ? 1 : 0],h);
+    dictSetKey(d, s, key);
+    return (dictEntry*)s;
+}
+
+/* Search and remove an element, see dictGenericDelete(). */
+int fdictGenericDelete(dict *d, const void *key, int nofree) {
+    unsigned int h;
+    int table;
+
+    if (d->ht[0].size == 0) return DICT_ERR;
+    if (dictIsRehashing(d)) _fdictRehashStep(d);
+
+    h = dictHashKey(d, key);
+    for (table = 0; table <= 1; table++) {
+        dictht *ht = &d->ht[table];
+        fdictBucket *b = &fdictBuckets(ht)[h & ht->sizemask], *prev = NULL;
+        uint8_t tag = fdictHashTag(h);
+
+        do {
+            unsigned int match = _fdictMatchTag(b,tag);
+
+            while(match) {
+                int j = __builtin_ctz(match);
+                fdictSlot *s = &b->slots[j];
+
+                if (key == s->key || dictCompareKeys(d, key, s->key)) {
+                    if (!nofree) {
+                        dictFreeKey(d, s);
+                        dictFreeVal(d, s);
+                    }
+                    b->presence &= ~(1<<j);
+                    ht->used--;
+                    if (b->presence == 0 && d->iterators == 0)
+                        _fdictCompact(prev,b);
+                    return DICT_OK;
+                }
+                match &= match-1;
+            }
+            prev = b;
+            b = b->child;
+        } while(b);
+        if (!dictIsRehashing(d)) break;
+    }
+    return DICT_ERR; /* not found */
+}
+
+/* Release all the elements of the table 'ht' and the table itself. */
+int fdictClear(dict *d, dictht *ht, void(callback)(void *)) {
+    unsigned long i;
+
+    for (i = 0; i < ht->size; i++) {
+        fdictBucket *head = &fdictBuckets(ht)[i], *b = head, *next;
+
+        if (callback && (i & 65535) == 0) callback(d->privdata);
+        do {
+            unsigned int used = b->presence;
+
+            while(used) {
+                fdictSlot *s = &b->slots[__builtin_ctz(used)];
+
+                dictFreeKey(d, s);
+                dictFreeVal(d, s);
+                ht->used--;
+                used &= used-1;
+            }
+            next = b->child;
+            if (b != head) zfree(b);
+            b = next;
+        } while(b);
+    }
+    zfree(ht->table);
+    _fdictReset(ht);
+    return DICT_OK; /* never fails */
+}
+
+dictEntry *fdictFind(dict *d, const void *key) {
+    fdictSlot *s;
+    unsigned int h;
+    int table;
+
+    if (dictSize(d) == 0) return NULL;
+    if (dictIsRehashing(d)) _fdictRehashStep(d);
+
+    h = dictHashKey(d, key);
+    for (table = 0; table <= 1; table++) {
+        if ((s = _fdictLookup(d,&d->ht[table],h,key)) != NULL)
+            return (dictEntry*)s;
+        if (!dictIsRehashing(d)) return NULL;
+    }
+    return NULL;
+}
+
+/* Iterators over flat tables use 'index' and 'table' like dictNext(), but
+ * 'nextEntry' is the bucket currently visited, and 'entry' the slot
+ * returned by the previous call, or NULL. */
+dictEntry *fdictNext(dictIterator *iter) {
+    dict *d = iter->d;
+    fdictBucket *b = (fdictBucket*)iter->nextEntry;
+    int j = 0;
+
+    if (b && iter->entry) j = ((fdictSlot*)iter->entry - b->slots) + 1;
+    while(1) {
+        unsigned int used;
+
+        if (b == NULL) {
+            dictht *ht = &d->ht[iter->table];
+
+            if (iter->index == -1 && iter->table == 0) {
+                if (iter->safe)
+                    d->iterators++;
+                else
+                    iter->fingerprint = dictFingerprint(d);
+            }
+            iter->index++;
+            if (iter->index >= (long) ht->size) {
+                if (dictIsRehashing(d) && iter->table == 0) {
+                    iter->table++;
+                    iter->index = 0;
+                    ht = &d->ht[1];
+                } else {
+                    break;
+                }
+            }
+            b = &fdictBuckets(ht)[iter->index];
+            j = 0;
+        }
+        used = (j < FDICT_BUCKET_SLOTS) ? (unsigned int)b->presence >> j : 0;
+        if (used) {
+            j += __builtin_ctz(used);
+            iter->nextEntry = (dictEntry*)b;
+            iter->entry = (dictEntry*)&b->slots[j];
+            return iter->entry;
+        }
+        b = b->child;
+        j = 0;
+    }
+    iter->entry = iter->nextEntry = NULL;
+    return NULL;
+}
+
+/* Count the elements of the bucket 'b' and its overflow buckets. */
+static unsigned int _fdictChainLength(fdictBucket *b) {
+    unsigned int count = 0;
+
+    for (; b; b = b->child) count += __builtin_popcount(b->presence);
+    return count;
+}
+
+dictEntry *fdictGetRandomKey(dict *d) {
+    fdictBucket *head, *b;
+    unsigned long h;
+    unsigned int count, used;
+
+    if (dictSize(d) == 0) return NULL;
+    if (dictIsRehashing(d)) _fdictRehashStep(d);
+    do {
+        if (dictIsRehashing(d)) {
+            /* There are no elements in the buckets of the old table from 0
+             * to rehashidx-1. */
+            h = d->rehashidx + (random() % (d->ht[0].size +
+                                            d->ht[1].size -
+                                            d->rehashidx));
+            head = (h >= d->ht[0].size) ?
+                   &fdictBuckets(&d->ht[1])[h - d->ht[0].size] :
+                   &fdictBuckets(&d->ht[0])[h];
+        } else {
+            head = &fdictBuckets(&d->ht[0])[random() & d->ht[0].sizemask];
+        }
+        count = _fdictChainLength(head);
+    } while(count == 0);
+
+    /* Select a random element of the chain. */
+    count = random() % count;
+    for (b = head; ; b = b->child) {
+        unsigned int n = __builtin_popcount(b->presence);
+
+        if (count < n) break;
+        count -= n;
+    }
+    used = b->presence;
+    while(count--) used &= used-1;
+    return (dictEntry*)&b->slots[__builtin_ctz(used)];
+}
+
+/* See dictGetSomeKeys(), buckets are sampled exactly in the same way. */
+unsigned int fdictGetSomeKeys(dict *d, dictEntry **des, unsigned int count) {
+    unsigned long j;
+    unsigned long tables;
+    unsigned long stored = 0, maxsizemask;
+    unsigned long maxsteps;
+
+    if (dictSize(d) < count) count = dictSize(d);
+    maxsteps = count*10;
+
+    /* Try to do a rehashing work proportional to 'count'. */
+    for (j = 0; j < count; j++) {
+        if (dictIsRehashing(d))
+            _fdictRehashStep(d);
+        else
+            break;
+    }
+
+    tables = dictIsRehashing(d) ? 2 : 1;
+    maxsizemask = d->ht[0].sizemask;
+    if (tables > 1 && maxsizemask < d->ht[1].sizemask)
+        maxsizemask = d->ht[1].sizemask;
+
+    /* Pick a random point inside the larger table. */
+    unsigned long i = random() & maxsizemask;
+    unsigned long emptylen = 0; /* Continuous empty entries so far. */
+    while(stored < count && maxsteps--) {
+        for (j = 0; j < tables; j++) {
+            fdictBucket *b;
+
+            /* Invariant of the rehashing: up to the buckets already
+             * visited in ht[0] there are no elements. */
+            if (tables == 2 && j == 0 && i < (unsigned long) d->rehashidx) {
+                if (i >= d->ht[1].size) i = d->rehashidx;
+                continue;
+            }
+            if (i >= d->ht[j].size) continue; /* Out of range for this table. */
+            b = &fdictBuckets(&d->ht[j])[i];
+
+            /* Count contiguous empty buckets, and jump to other
+             * locations if they reach 'count' (with a minimum of 5). */
+            if (_fdictBucketIsEmpty(b)) {
+                emptylen++;
+                if (emptylen >= 5 && emptylen > count) {
+                    i = random() & maxsizemask;
+                    emptylen = 0;
+                }
+            } else {
+                emptylen = 0;
+                for (; b; b = b->child) {
+                    unsigned int used = b->presence;
+
+                    while(used) {
+                        *des = (dictEntry*)&b->slots[__builtin_ctz(used)];
+                        des++;
+                        stored++;
+                        if (stored == count) return stored;
+                        used &= used-1;
+                    }
+                }
+            }
+        }
+        i = (i+1) & maxsizemask;
+    }
+    return stored;
+}
+
+/* Emit all the elements of the bucket 'idx' of the table 'ht'. */
+static void _fdictScanBucket(dictht *ht, unsigned long idx,
+                             dictScanFunction *fn, void *privdata)
+{
+    fdictBucket *b = &fdictBuckets(ht)[idx];
+
+    do {
+        unsigned int used = b->presence;
+
+        while(used) {
+            fn(privdata, (dictEntry*)&b->slots[__builtin_ctz(used)]);
+            used &= used-1;
+        }
+        b = b->child;
+    } while(b);
+}
+
+/* Function to reverse bits, see dict.c. */
+static unsigned long rev(unsigned long v) {
+    unsigned long s = 8 * sizeof(v);
+    unsigned long mask = ~0;
+    while ((s >>= 1) > 0) {
+        mask ^= (mask << s);
+        v = ((v >> s) & mask) | ((v << s) & ~mask);
+    }
+    return v;
+}
+
+/* Exactly the same algorithm of dictScan(), but every bucket of the tables
+ * is a chain of flat buckets. Since elements are only stored in the bucket
+ * selected by their hash, the same guarantees are provided. */
+unsigned long fdictScan(dict *d, unsigned long v, dictScanFunction *fn,
+                        void *privdata)
+{
+    dictht *t0, *t1;
+    unsigned long m0, m1;
+
+    if (dictSize(d) == 0) return 0;
+
+    if (!dictIsRehashing(d)) {
+        t0 = &(d->ht[0]);
+        m0 = t0->sizemask;
+
+        /* Emit entries at cursor */
+        _fdictScanBucket(t0,v & m0,fn,privdata);
+
+        /* Set unmasked bits so incrementing the reversed cursor
+         * operates on the masked bits */
+        v |= ~m0;
+
+        /* Increment the reverse cursor */
+        v = rev(v);
+        v++;
+        v = rev(v);
+    } else {
+        t0 = &d->ht[0];
+        t1 = &d->ht[1];
+
+        /* Make sure t0 is the smaller and t1 is the bigger table */
+        if (t0->size > t1->size) {
+            t0 = &d->ht[1];
+            t1 = &d->ht[0];
+        }
+        m0 = t0->sizemask;
+        m1 = t1->sizemask;
+
+        /* Emit entries at cursor */
+        _fdictScanBucket(t0,v & m0,fn,privdata);
+
+        /* Iterate over indices in larger table that are the expansion
+         * of the index pointed to by the cursor in the smaller table */
+        do {
+            /* Emit entries at cursor */
+            _fdictScanBucket(t1,v & m1,fn,privdata);
+
+            /* Increment the reverse cursor not covered by the smaller mask.*/
+            v |= ~m1;
+            v = rev(v);
+            v++;
+            v = rev(v);
+
+            /* Continue while bits covered by mask difference is non-zero */
+        } while (v & (m0 ^ m1));
+    }
+    return v;
+}
+
+/* Return the memory used by the bucket arrays, overflow buckets are not
+ * accounted since it would require to visit the whole table. */
+size_t fdictTableMemory(dict *d) {
+    return (d->ht[0].size + d->ht[1].size)*sizeof(fdictBucket);
+}
+
+/* ------------------------------- Debugging ---------------------------------*/
+
+static size_t _fdictGetStatsHt(char *buf, size_t bufsize, dictht *ht,
+                               int tableid)
+{
+    unsigned long i, empty = 0, overflow = 0, maxchain = 0;
+
+    if (ht->used == 0) {
+        return snprintf(buf,bufsize,
+            "No stats available for empty dictionaries\n");
+    }
+
+    for (i = 0; i < ht->size; i++) {
+        fdictBucket *b = &fdictBuckets(ht)[i];
+        unsigned long chain = 0;
+
+        if (_fdictBucketIsEmpty(b)) empty++;
+        for (b = b->child; b; b = b->child) chain++;
+        overflow += chain;
+        if (chain > maxchain) maxchain = chain;
+    }
+
+    snprintf(buf,bufsize,
+        "Hash table %d stats (%s, flat):\n"
+        " table size: %ld buckets of %d slots\n"
+        " number of elements: %ld\n"
+        " empty buckets: %ld\n"
+        " overflow buckets: %ld\n"
+        " max overflow chain length: %ld\n"
+        " avg elements per bucket: %.02f\n",
+        tableid, (tableid == 0) ? "main hash table" : "rehashing target",
+        ht->size, FDICT_BUCKET_SLOTS, ht->used, empty, overflow, maxchain,
+        (float)ht->used/ht->size);
+
+    /* Unlike snprintf(), return the number of characters actually written. */
+    if (bufsize) buf[bufsize-1] = '\0';
+    return strlen(buf);
+}
+
+void fdictGetStats(char *buf, size_t bufsize, dict *d) {
+    size_t l;
+    char *orig_buf = buf;
+    size_t orig_bufsize = bufsize;
+
+    l = _fdictGetStatsHt(buf,bufsize,&d->ht[0],0);
+    buf += l;
+    bufsize -= l;
+    if (dictIsRehashing(d) && bufsize > 0)
+        _fdictGetStatsHt(buf,bufsize,&d->ht[1],1);
+    /* Make sure there is a NULL term at the end. */
+    if (orig_bufsize) orig_buf[orig_bufsize-1] = '\0';
+}
+
+/* ------------------------------- Test --------------------------------------
+ * "redis-server test fdict" checks the flat tables and compares them with
+ * the dict.c tables storing a million of string keys. */
+
+#ifdef REDIS_TEST
+#include <sys/time.h>
+
+static unsigned int _fdictTestHash(const void *key) {
+    return dictGenHashFunction(key,strlen(key));
+}
+
+static int _fdictTestCompare(void *privdata, const void *key1,
+                             const void *key2)
+{
+    DICT_NOTUSED(privdata);
+    return strcmp(key1,key2) == 0;
+}
+
+static dictType fdictTestType = {
+    _fdictTestHash,             /* hash function */
+    NULL,                       /* key dup */
+    NULL,                       /* val dup */
+    _fdictTestCompare,          /* key compare */
+    NULL,                       /* key destructor */
+    NULL,                       /* val destructor */
+    NULL,                       /* key embed size */
+    NULL                        /* key embed */
+};
+
+static long long usec(void) {
+    struct timeval tv;
+    gettimeofday(&tv,NULL);
+    return (((long long)tv.tv_sec)*1000000)+tv.tv_usec;
+}
+
+static void _fdictTestScanCallback(void *privdata, const dictEntry *de) {
+    unsigned char *seen = privdata;
+    seen[strtol((char*)dictGetKey(de)+4,NULL,10)] = 1;
+}
+
+static void _fdictTestAssert(int cond, char *what) {
+    if (!cond) {
+        printf("ERROR: %s\n", what);
+        exit(1);
+    }
+}
+
+/* Check that 'd' holds the keys from 'keys[from]' to 'keys[to-1]'. */
+static void _fdictTestContent(dict *d, char **keys, long from, long to) {
+    dictIterator *di;
+    dictEntry *de;
+    long j, count = 0;
+
+    _fdictTestAssert(dictSize(d) == (unsigned long)(to-from), "dictSize");
+    for (j = from; j < to; j++) {
+        de = dictFind(d,keys[j]);
+        _fdictTestAssert(de && dictGetVal(de) == keys[j], "dictFind");
+    }
+    di = dictGetIterator(d);
+    while((de = dictNext(di)) != NULL) count++;
+    dictReleaseIterator(di);
+    _fdictTestAssert(count == to-from, "dictNext");
+}
+
+static void _fdictTestFunctional(char **keys, long count) {
+    dict *d = dictCreateFlat(&fdictTestType,NULL);
+    unsigned char *seen = zcalloc(count);
+    dictIterator *di;
+    dictEntry *de;
+    unsigned long cursor;
+    long j, added;
+
+    printf("Add, find and delete: ");
+    for (j = 0; j < count; j++)
+        _fdictTestAssert(dictAdd(d,keys[j],keys[j]) == DICT_OK, "dictAdd");
+    _fdictTestAssert(dictAdd(d,keys[0],keys[0]) == DICT_ERR, "dictAdd dup");
+    _fdictTestContent(d,keys,0,count);
+    _fdictTestAssert(dictFind(d,"nokey") == NULL, "dictFind missing");
+    for (j = 0; j < count/2; j++)
+        _fdictTestAssert(dictDelete(d,keys[j]) == DICT_OK, "dictDelete");
+    _fdictTestAssert(dictDelete(d,keys[0]) == DICT_ERR, "dictDelete twice");
+    _fdictTestContent(d,keys,count/2,count);
+    printf("OK\n");
+
+    printf("Delete while iterating with a safe iterator: ");
+    di = dictGetSafeIterator(d);
+    while((de = dictNext(di)) != NULL)
+        _fdictTestAssert(dictDelete(d,dictGetKey(de)) == DICT_OK, "delete");
+    dictReleaseIterator(di);
+    _fdictTestAssert(dictSize(d) == 0, "empty after delete");
+    printf("OK\n");
+
+    /* Every element present for the whole scan must be reported, even
+     * if the table is rehashed while scanning. */
+    printf("Scan while the table grows: ");
+    for (j = 0; j < count/10; j++) dictAdd(d,keys[j],keys[j]);
+    cursor = 0;
+    added = count/10;
+    do {
+        cursor = dictScan(d,cursor,_fdictTestScanCallback,seen);
+        for (j = 0; j < 10 && added < count; j++, added++)
+            dictAdd(d,keys[added],keys[added]);
+    } while(cursor);
+    for (j = 0; j < count/10; j++) _fdictTestAssert(seen[j], "dictScan");
+    _fdictTestContent(d,keys,0,added);
+    printf("OK\n");
+
+    printf("Shrink and random keys: ");
+    for (j = 100; j < added; j++) dictDelete(d,keys[j]);
+    _fdictTestAssert(dictResize(d) == DICT_OK, "dictResize");
+    while(dictIsRehashing(d)) dictRehash(d,100);
+    _fdictTestContent(d,keys,0,100);
+    for (j = 0; j < 1000; j++) {
+        dictEntry *samples[16];
+        unsigned int k, n = dictGetSomeKeys(d,samples,16);
+
+        de = dictGetRandomKey(d);
+        _fdictTestAssert(dictFind(d,dictGetKey(de)) == de, "random key");
+        for (k = 0; k < n; k++)
+            _fdictTestAssert(dictFind(d,dictGetKey(samples[k])) == samples[k],
+                "dictGetSomeKeys");
+    }
+    printf("OK\n");
+
+    zfree(seen);
+    dictRelease(d);
+}
+
+static void _fdictTestBenchmark(dict *d, char **keys, char **missing,
+                                long count)
+{
+    dictIterator *di;
+    dictEntry *de;
+    long long start, elapsed;
+    long j;
+
+#define fdict_bench_start() start = usec()
+#define fdict_bench_end(op) do { \
+    elapsed = usec()-start; \
+    printf("  %-20s %lld usec (%.1f ns/op)\n", op, elapsed, \
+        (double)elapsed*1000/count); \
+} while(0)
+
+    fdict_bench_start();
+    for (j = 0; j < count; j++) dictAdd(d,keys[j],keys[j]);
+    fdict_bench_end("add");
+
+    while(dictIsRehashing(d)) dictRehash(d,1000);
+
+    fdict_bench_start();
+    for (j = 0; j < count; j++) {
+        /* Access the keys in an order unrelated to the insertion one. */
+        long idx = (j * 7919) % count;
+        de = dictFind(d,keys[idx]);
+        _fdictTestAssert(de != NULL, "lookup");
+    }
+    fdict_bench_end("find existing");
+
+    fdict_bench_start();
+    for (j = 0; j < count; j++) {
+        de = dictFind(d,missing[j]);
+        _fdictTestAssert(de == NULL, "lookup missing");
+    }
+    fdict_bench_end("find missing");
+
+    fdict_bench_start();
+    di = dictGetIterator(d);
+    while((de = dictNext(di)) != NULL) j++;
+    dictReleaseIterator(di);
+    fdict_bench_end("iterate");
+
+    fdict_bench_start();
+    for (j = 0; j < count; j++) dictDelete(d,keys[j]);
+    fdict_bench_end("delete");
+}
+
+int fdictTest(int argc, char *argv[]) {
+    long j, count = 1000000;
+    char **keys, **missing;
+    dict *d;
+    size_t mem;
+
+    DICT_NOTUSED(argc);
+    DICT_NOTUSED(argv);
+
+    keys = zmalloc(sizeof(char*)*count);
+    missing = zmalloc(sizeof(char*)*count);
+    for (j = 0; j < count; j++) {
+        char buf[32];
+
+        snprintf(buf,sizeof(buf),"key:%ld",j);
+        keys[j] = zstrdup(buf);
+        snprintf(buf,sizeof(buf),"nokey:%ld",j);
+        missing[j] = zstrdup(buf);
+    }
+
+    _fdictTestFunctional(keys,100000);
+
+    /* Memory is measured with the keys already allocated. */
+    printf("Benchmark, %ld keys, dict.c chained tables:\n", count);
+    mem = zmalloc_used_memory();
+    d = dictCreate(&fdictTestType,NULL);
+    for (j = 0; j < count; j++) dictAdd(d,keys[j],keys[j]);
+    printf("  %-20s %zu bytes\n", "memory", zmalloc_used_memory()-mem);
+    dictEmpty(d,NULL);
+    _fdictTestBenchmark(d,keys,missing,count);
+    dictRelease(d);
+
+    printf("Benchmark, %ld keys, fdict.c flat tables:\n", count);
+    mem = zmalloc_used_memory();
+    d = dictCreateFlat(&fdictTestType,NULL);
+    for (j = 0; j < count; j++) dictAdd(d,keys[j],keys[j]);
+    printf("  %-20s %zu bytes\n", "memory", zmalloc_used_memory()-mem);
+    dictEmpty(d,NULL);
+    _fdictTestBenchmark(d,keys,missing,count);
+    dictRelease(d);
+
+    for (j = 0; j < count; j++) {
+        zfree(keys[j]);
+        zfree(missing[j]);
+    }
+    zfree(keys);
+    zfree(missing);
+    return 0;
+}
+#endif
@@ -0,0 +1,91 @@
+/* Flat bucketed hash tables, an alternative representation of dict.c tables.
+ *
+ * A dictionary created with dictCreateFlat() does not allocate a dictEntry
+ * for every element: the key and value pointers are stored
+ * inline, together with a one byte fingerprint of the hash, in buckets
+ * holding up to FDICT_BUCKET_SLOTS elements. Only when a bucket is full an
+ * overflow bucket is chained to it. See fdict.c for more information.
+ *
+ * The rest of the code doesn't need this header and just uses the dict.h
+ * API, flat dictionaries are handled transparently.
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __FDICT_H
+#define __FDICT_H
+
+#include "dict.h"
+
+#define FDICT_BUCKET_SLOTS 7
+
+/* Every slot has the same layout of the 'key' and 'v' fields of dictEntry,
+ * so that a pointer to a slot can be returned by the dict API functions as
+ * a dictEntry pointer. The 'next' field must never be accessed. */
+typedef struct fdictSlot {
+    void *key;
+    union {
+        void *val;
+        uint64_t u64;
+        int64_t s64;
+        double d;
+    } v;
+} fdictSlot;
+
+/* A bucket is 128 bytes: the presence bitmap, the fingerprints and the first
+ * slots are in the first cache line, so a lookup reads a single line of the
+ * table to know which slots, if any, may hold the key. */
+typedef struct fdictBucket {
+    uint8_t presence;                   /* Bit N is set if slot N is used. */
+    uint8_t tags[FDICT_BUCKET_SLOTS];   /* Hash fingerprint of every slot. */
+    fdictSlot slots[FDICT_BUCKET_SLOTS];
+    struct fdictBucket *child;          /* Overflow bucket or NULL. */
+} fdictBucket;
+
+/* Average number of elements per bucket we resize to. */
+#define FDICT_BUCKET_FILL 5
+
+/* API used by dict.c for flat dictionaries. */
+int fdictExpand(dict *d, unsigned long size);
+int fdictRehash(dict *d, int n);
+dictEntry *fdictAddRaw(dict *d, void *key);
+int fdictGenericDelete(dict *d, const void *key, int nofree);
+int fdictClear(dict *d, dictht *ht, void(callback)(void *));
+dictEntry *fdictFind(dict *d, const void *key);
+dictEntry *fdictNext(dictIterator *iter);
+dictEntry *fdictGetRandomKey(dict *d);
+unsigned int fdictGetSomeKeys(dict *d, dictEntry **des, unsigned int count);
+unsigned long fdictScan(dict *d, unsigned long v, dictScanFunction *fn, void *privdata);
+size_t fdictTableMemory(dict *d);
+void fdictGetStats(char *buf, size_t bufsize, dict *d);
+
+#ifdef REDIS_TEST
+int fdictTest(int argc, char *argv[]);
+#endif
+
+#endif /* __FDICT_H */
@@ -34,7 +34,7 @@
 
 /* Things exported from t_zset.c only for geo.c, since it is the only other
  * part of Redis that requires close zset introspection. */
-unsigned char *zzlFirstInRange(unsigned char *zl, zrangespec *range);
+unsigned char *zzlFirstInRange(unsigned char *lp, zrangespec *range);
 int zslValueLteMax(double value, zrangespec *spec);
 
 /* ====================================================================
@@ -229,20 +229,20 @@ int geoGetPointsInRange(robj *zobj, double min, double max, double lon, double l
     size_t origincount = ga->used;
     sds member;
 
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
-        unsigned char *zl = zobj->ptr;
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
+        unsigned char *lp = zobj->ptr;
         unsigned char *eptr, *sptr;
         unsigned char *vstr = NULL;
         unsigned int vlen = 0;
         long long vlong = 0;
         double score = 0;
 
-        if ((eptr = zzlFirstInRange(zl, &range)) == NULL) {
+        if ((eptr = zzlFirstInRange(lp, &range)) == NULL) {
             /* Nothing exists starting at our min.  No results. */
             return 0;
         }
 
-        sptr = ziplistNext(zl, eptr);
+        sptr = lpNext(lp, eptr);
         while (eptr) {
             score = zzlGetScore(sptr);
 
@@ -250,13 +250,12 @@ int geoGetPointsInRange(robj *zobj, double min, double max, double lon, double l
             if (!zslValueLteMax(score, &range))
                 break;
 
-            /* We know the element exists. ziplistGet should always succeed */
-            ziplistGet(eptr, &vstr, &vlen, &vlong);
+            vstr = lpGetValue(eptr, &vlen, &vlong);
             member = (vstr == NULL) ? sdsfromlonglong(vlong) :
                                       sdsnewlen(vstr,vlen);
             if (geoAppendIfWithinRadius(ga,lon,lat,radius,score,member)
                 == C_ERR) sdsfree(member);
-            zzlNext(zl, &eptr, &sptr);
+            zzlNext(lp, &eptr, &sptr);
         }
     } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
         zset *zs = zobj->ptr;
@@ -281,6 +280,27 @@ int geoGetPointsInRange(robj *zobj, double min, double max, double lon, double l
                 == C_ERR) sdsfree(member);
             ln = ln->level[0].forward;
         }
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        zset *zs = zobj->ptr;
+        zbtreePos pos;
+        int valid;
+
+        /* Nothing exists starting at our min: no results. */
+        valid = zbtFirstInRange(zs->zbt, &range, &pos);
+        while (valid) {
+            robj *o = zbtPosObj(&pos);
+            double score = zbtPosScore(&pos);
+            /* Abort when the element is no longer in range. */
+            if (!zslValueLteMax(score, &range))
+                break;
+
+            member = (o->encoding == OBJ_ENCODING_INT) ?
+                        sdsfromlonglong((long)o->ptr) :
+                        sdsdup(o->ptr);
+            if (geoAppendIfWithinRadius(ga,lon,lat,radius,score,member)
+                == C_ERR) sdsfree(member);
+            valid = zbtNext(&pos);
+        }
     }
     return ga->used - origincount;
 }
@@ -650,7 +670,6 @@ void georadiusGeneric(client *c, int flags) {
         }
 
         for (i = 0; i < returned_items; i++) {
-            zskiplistNode *znode;
             geoPoint *gp = ga->array+i;
             gp->dist /= conversion; /* Fix according to unit. */
             double score = storedist ? gp->dist : gp->score;
@@ -658,15 +677,13 @@ void georadiusGeneric(client *c, int flags) {
             robj *ele = createObject(OBJ_STRING,gp->member);
 
             if (maxelelen < elelen) maxelelen = elelen;
-            incrRefCount(ele); /* Set refcount to 2 since we reference the
-                                  object both in the skiplist and dict. */
-            znode = zslInsert(zs->zsl,score,ele);
-            serverAssert(dictAdd(zs->dict,ele,&znode->score) == DICT_OK);
+            zsetAddNewElement(zs,score,ele);
+            decrRefCount(ele);
             gp->member = NULL;
         }
 
         if (returned_items) {
-            zsetConvertToZiplistIfNeeded(zobj,maxelelen);
+            zsetConvertToListpackIfNeeded(zobj,maxelelen);
             setKey(c->db,storekey,zobj);
             decrRefCount(zobj);
             notifyKeyspaceEvent(NOTIFY_LIST,"georadiusstore",storekey,
@@ -301,6 +301,168 @@ size_t intsetBlobLen(intset *is) {
     return sizeof(intset)+intrev32ifbe(is->length)*intrev32ifbe(is->encoding);
 }
 
+/* Create an intset holding the 'len' values of the array, that must be
+ * sorted and without duplicates, without searching for the position of
+ * every value as intsetAdd() does. */
+intset *intsetNewFromSorted(const int64_t *values, uint32_t len) {
+    intset *is = intsetNew();
+    uint8_t enc, lastenc;
+    uint32_t j;
+
+    if (len == 0) return is;
+    /* The smallest and the greatest values need the largest encoding. */
+    enc = _intsetValueEncoding(values[0]);
+    lastenc = _intsetValueEncoding(values[len-1]);
+    if (lastenc > enc) enc = lastenc;
+    is->encoding = intrev32ifbe(enc);
+    is = intsetResize(is,len);
+    for (j = 0; j < len; j++) _intsetSet(is,j,values[j]);
+    is->length = intrev32ifbe(len);
+    return is;
+}
+
+/* Return the position of the first element >= 'value' at or after 'pos',
+ * or the length of the intset if there is none. The gap is probed with
+ * steps of 1, 2, 4, ... and then narrowed with a binary search, so the
+ * cost is logarithmic in the distance from 'pos': close to a merge step
+ * when the element is near, and much less than a scan when it is far. */
+static uint32_t intsetGallop(intset *is, uint32_t pos, int64_t value) {
+    uint8_t enc = intrev32ifbe(is->encoding);
+    uint64_t len = intrev32ifbe(is->length), lo, hi, step = 1;
+
+    if (pos >= len || _intsetGetEncoded(is,pos,enc) >= value) return pos;
+
+    /* The element at 'lo' is always smaller than 'value'. */
+    lo = pos;
+    while (1) {
+        hi = lo+step;
+        if (hi >= len) {
+            hi = len;
+            break;
+        }
+        if (_intsetGetEncoded(is,hi,enc) >= value) break;
+        lo = hi;
+        step <<= 1;
+    }
+    while (hi-lo > 1) {
+        uint64_t mid = lo+(hi-lo)/2;
+        if (_intsetGetEncoded(is,mid,enc) < value)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return hi;
+}
+
+#if defined(__SSE2__) && (BYTE_ORDER == LITTLE_ENDIAN)
+#include <emmintrin.h>
+#define INTSET_INTER_SIMD 1
+
+/* Intersection of two int32 encoded intsets as a merge of blocks of four
+ * elements: each element of the block of 'a' is compared with the four
+ * rotations of the block of 'b' at once, then the block ending with the
+ * smaller element is skipped (both if they end with the same one). The
+ * elements left after the last whole blocks are merged one by one. */
+static uint32_t intsetInterInt32Simd(intset *a, intset *b, int64_t *result,
+                                     uint32_t limit)
+{
+    const int32_t *va = (const int32_t*)a->contents;
+    const int32_t *vb = (const int32_t*)b->contents;
+    uint32_t la = a->length, lb = b->length, i = 0, j = 0, count = 0;
+
+    while (i+4 <= la && j+4 <= lb) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(va+i));
+        __m128i y = _mm_loadu_si128((const __m128i*)(vb+j));
+        __m128i eq = _mm_or_si128(
+            _mm_or_si128(
+                _mm_cmpeq_epi32(x,y),
+                _mm_cmpeq_epi32(x,_mm_shuffle_epi32(y,_MM_SHUFFLE(0,3,2,1)))),
+            _mm_or_si128(
+                _mm_cmpeq_epi32(x,_mm_shuffle_epi32(y,_MM_SHUFFLE(1,0,3,2))),
+                _mm_cmpeq_epi32(x,_mm_shuffle_epi32(y,_MM_SHUFFLE(2,1,0,3)))));
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(eq));
+        int32_t amax = va[i+3], bmax = vb[j+3];
+
+        while (mask) {
+            if (result) result[count] = va[i+__builtin_ctz(mask)];
+            if (++count == limit) return count;
+            mask &= mask-1;
+        }
+        if (amax <= bmax) i += 4;
+        if (bmax <= amax) j += 4;
+    }
+
+    while (i < la && j < lb) {
+        if (va[i] < vb[j]) {
+            i++;
+        } else if (va[i] > vb[j]) {
+            j++;
+        } else {
+            if (result) result[count] = va[i];
+            if (++count == limit) return count;
+            i++;
+            j++;
+        }
+    }
+    return count;
+}
+#endif
+
+/* Compute the intersection of the 'num' intsets, that should be sorted from
+ * the smallest to the largest. The elements are stored in 'result', sorted,
+ * unless it is NULL: it must have room for the elements of the smallest
+ * set. When 'limit' is not zero the search stops after 'limit' elements.
+ * Returns the number of elements of the intersection (up to 'limit').
+ *
+ * Every other set keeps a cursor, that only moves forward: a candidate of
+ * the smallest set is looked up galloping from the cursor, and when it is
+ * missing the smallest set gallops in turn to the element found instead.
+ * With sets of similar density this is a merge, with very different sizes
+ * each lookup is O(log(n/m)) instead of the O(log n) of intsetFind().
+ * Two int32 sets of similar length are intersected with SSE2 when the CPU
+ * has it. */
+uint32_t intsetInter(intset **sets, uint32_t num, int64_t *result, uint32_t limit) {
+    intset *small = sets[0];
+    uint8_t enc = intrev32ifbe(small->encoding);
+    uint32_t len = intrev32ifbe(small->length), i = 0, count = 0, j;
+    uint32_t *pos;
+    int64_t value, found = 0;
+
+#ifdef INTSET_INTER_SIMD
+    if (num == 2 &&
+        intrev32ifbe(sets[0]->encoding) == INTSET_ENC_INT32 &&
+        intrev32ifbe(sets[1]->encoding) == INTSET_ENC_INT32 &&
+        (uint64_t)intrev32ifbe(sets[1]->length) <
+            (uint64_t)len*INTSET_INTER_GALLOP_RATIO)
+    {
+        return intsetInterInt32Simd(sets[0],sets[1],result,limit);
+    }
+#endif
+
+    pos = zcalloc(sizeof(uint32_t)*num);
+    while (i < len) {
+        value = _intsetGetEncoded(small,i,enc);
+        for (j = 1; j < num; j++) {
+            pos[j] = intsetGallop(sets[j],pos[j],value);
+            if (pos[j] == intrev32ifbe(sets[j]->length)) goto done;
+            found = _intsetGet(sets[j],pos[j]);
+            if (found != value) break;
+        }
+
+        if (j == num) {
+            if (result) result[count] = value;
+            if (++count == limit) break;
+            i++;
+        } else {
+            i = intsetGallop(small,i+1,found);
+        }
+    }
+
+done:
+    zfree(pos);
+    return count;
+}
+
 #ifdef REDIS_TEST
 #include <sys/time.h>
 #include <time.h>
@@ -491,6 +653,124 @@ int intsetTest(int argc, char **argv) {
                num,size,usec()-start);
     }
 
+    printf("Intersection against intsetFind(): "); {
+        int bits[] = {14,20}, b, n, iter;
+
+        for (iter = 0; iter < 1000; iter++) {
+            intset *sets[4];
+            int64_t res[1024], v;
+            uint32_t count, naive = 0, limit, j;
+            int k;
+
+            b = bits[rand()%2];
+            n = 2+rand()%3;
+            for (k = 0; k < n; k++) {
+                /* A small first set and often much larger ones, with all
+                 * the encodings mixed. */
+                sets[k] = createSet(b,k == 0 ? 1+rand()%64 : rand()%1024);
+                if (rand()%2) sets[k] = intsetAdd(sets[k],5000000000LL,NULL);
+                if (rand()%2) sets[k] = intsetAdd(sets[k],-70000,NULL);
+            }
+            count = intsetInter(sets,n,res,0);
+            for (j = 0; j < intsetLen(sets[0]); j++) {
+                intsetGet(sets[0],j,&v);
+                for (k = 1; k < n; k++)
+                    if (!intsetFind(sets[k],v)) break;
+                if (k == n) assert(res[naive++] == v);
+            }
+            assert(count == naive);
+
+            limit = 1+rand()%3;
+            assert(intsetInter(sets,n,NULL,limit) ==
+                   (count < limit ? count : limit));
+            for (k = 0; k < n; k++) zfree(sets[k]);
+        }
+        ok();
+    }
+
+    printf("Intersection of two int32 sets of similar size: "); {
+        int64_t res[4096], v;
+        intset *sets[2];
+        uint32_t count, naive = 0, j;
+
+        sets[0] = createSet(16,4096);
+        sets[1] = createSet(16,4096);
+        /* Make sure both are int32 encoded. */
+        sets[0] = intsetAdd(sets[0],70000,NULL);
+        sets[1] = intsetAdd(sets[1],70000,NULL);
+        count = intsetInter(sets,2,res,0);
+        for (j = 0; j < intsetLen(sets[0]); j++) {
+            intsetGet(sets[0],j,&v);
+            if (intsetFind(sets[1],v)) assert(res[naive++] == v);
+        }
+        assert(count == naive);
+        assert(intsetInter(sets,2,NULL,10) == 10);
+        zfree(sets[0]);
+        zfree(sets[1]);
+        ok();
+    }
+
+    printf("Create from a sorted array: "); {
+        int64_t values[] = {-4294967296LL,-5,0,7,70000,4294967296LL};
+        int64_t v;
+
+        /* {first,len} sub arrays needing every encoding. */
+        int ranges[][2] = {{3,0},{2,2},{1,3},{2,3},{3,3},{0,6}};
+
+        for (i = 0; i < 6; i++) {
+            int first = ranges[i][0], len = ranges[i][1];
+            is = intsetNewFromSorted(values+first,len);
+            assert(intsetLen(is) == (uint32_t)len);
+            for (int j = 0; j < len; j++) {
+                assert(intsetGet(is,j,&v) && v == values[first+j]);
+                assert(intsetFind(is,values[first+j]));
+            }
+            if (len) checkConsistency(is);
+            zfree(is);
+        }
+        ok();
+    }
+
+    printf("Intersection benchmark:\n"); {
+        uint32_t sizes[][2] = {{100000,100000},{1000,100000},{100,100000}};
+        long long start, find, inter;
+        int64_t *res, *values, v;
+        uint32_t count, j, k, n;
+        intset *sets[2];
+
+        values = zmalloc(sizeof(int64_t)*1000000);
+        res = zmalloc(sizeof(int64_t)*100000);
+        for (k = 0; k < 3; k++) {
+            /* Random subsets of [0,1000000): int32 encoded. */
+            for (j = 0; j < 2; j++) {
+                int64_t x;
+                uint32_t want = sizes[k][j];
+                for (n = 0, x = 0; x < 1000000; x++) {
+                    if ((uint32_t)(rand()%1000000) < want) values[n++] = x;
+                }
+                sets[j] = intsetNewFromSorted(values,n);
+            }
+
+            start = usec();
+            for (count = 0, j = 0; j < intsetLen(sets[0]); j++) {
+                intsetGet(sets[0],j,&v);
+                if (intsetFind(sets[1],v)) res[count++] = v;
+            }
+            find = usec()-start;
+
+            start = usec();
+            assert(intsetInter(sets,2,res,0) == count);
+            inter = usec()-start;
+            printf("  %u x %u elements: intsetFind() %lld usec, "
+                   "intsetInter() %lld usec\n",
+                   intsetLen(sets[0]),intsetLen(sets[1]),find,inter);
+            zfree(sets[0]);
+            zfree(sets[1]);
+        }
+        zfree(values);
+        zfree(res);
+    }
+
     printf("Stress add+delete: "); {
         int i, v1, v2;
         is = intsetNew();
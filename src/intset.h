@@ -38,6 +38,10 @@ typedef struct intset {
     int8_t contents[];
 } intset;
 
+/* Two int32 intsets are intersected with SIMD when the larger is less than
+ * this many times larger than the smaller, otherwise with galloping. */
+#define INTSET_INTER_GALLOP_RATIO 16
+
 intset *intsetNew(void);
 intset *intsetAdd(intset *is, int64_t value, uint8_t *success);
 intset *intsetRemove(intset *is, int64_t value, int *success);
@@ -46,6 +50,8 @@ int64_t intsetRandom(intset *is);
 uint8_t intsetGet(intset *is, uint32_t pos, int64_t *value);
 uint32_t intsetLen(intset *is);
 size_t intsetBlobLen(intset *is);
+intset *intsetNewFromSorted(const int64_t *values, uint32_t len);
+uint32_t intsetInter(intset **sets, uint32_t num, int64_t *result, uint32_t limit);
 
 #ifdef REDIS_TEST
 int intsetTest(int argc, char *argv[]);
@@ -53,7 +53,9 @@ dictType latencyTimeSeriesDictType = {
     NULL,                       /* val dup */
     dictStringKeyCompare,       /* key compare */
     dictVanillaFree,            /* key destructor */
-    dictVanillaFree             /* val destructor */
+    dictVanillaFree,            /* val destructor */
+    NULL,                       /* key embed size */
+    NULL                        /* key embed */
 };
 
 /* ------------------------- Utility functions ------------------------------ */
@@ -0,0 +1,219 @@
+/* Lazy freeing of keys and databases.
+ *
+ * Deleting a key holding a big aggregate value (a list, set, sorted set or
+ * hash with millions of elements), or flushing a big database, can block
+ * the server for seconds, since all the memory is reclaimed synchronously.
+ * The functions in this file unlink the value from the keyspace ASAP in the
+ * main thread, and then hand the actual reclaiming of the memory to the
+ * BIO_LAZY_FREE background thread (see bio.c).
+ *
+ * Small values are still freed synchronously, since for them creating a
+ * background job is more expensive than just freeing the object.
+ *
+ * ----------------------------------------------------------------------------
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "server.h"
+#include "bio.h"
+#include "cluster.h"
+
+/* 等待后台线程释放的对象数量，在INFO中展示 */
+static size_t lazyfree_objects = 0;
+
+/* Return the number of currently pending objects to free. */
+size_t lazyfreeGetPendingObjectsCount(void) {
+    size_t aux;
+    atomicGet(lazyfree_objects,aux);
+    return aux;
+}
+
+/* Return the amount of work needed in order to free an object.
+ * The return value is not always the actual number of allocations the
+ * object is composed of, but a number proportional to it.
+ *
+ * For strings the function always returns 1.
+ *
+ * For aggregated objects represented by hash tables or other data structures
+ * the function just returns the number of elements the object is composed of.
+ *
+ * Objects composed of single allocations are always reported as having a
+ * single item even if they are actually logical composed of multiple
+ * elements.
+ *
+ * For lists the function returns the number of elements in the quicklist
+ * representing the list. */
+size_t lazyfreeGetFreeEffort(robj *obj) {
+    if (obj->type == OBJ_LIST) {
+        quicklist *ql = obj->ptr;
+        return ql->len;
+    } else if (obj->type == OBJ_SET && obj->encoding == OBJ_ENCODING_HT) {
+        dict *ht = obj->ptr;
+        return dictSize(ht);
+    } else if (obj->type == OBJ_SET && obj->encoding == OBJ_ENCODING_ROARING) {
+        roaring *r = obj->ptr;
+        return r->len; /* One allocation per container. */
+    } else if (obj->type == OBJ_ZSET && obj->encoding == OBJ_ENCODING_SKIPLIST){
+        zset *zs = obj->ptr;
+        return zs->zsl->length;
+    } else if (obj->type == OBJ_ZSET && obj->encoding == OBJ_ENCODING_BTREE){
+        zset *zs = obj->ptr;
+        return zs->zbt->length;
+    } else if (obj->type == OBJ_HASH && obj->encoding == OBJ_ENCODING_HT) {
+        dict *ht = obj->ptr;
+        return dictSize(ht);
+    } else {
+        return 1; /* Everything else is a single allocation. */
+    }
+}
+
+/* Delete a key, value, and associated expiration entry if any, from the DB.
+ * If there are enough allocations to free the value object may be put into
+ * a lazy free list instead of being freed synchronously. The lazy free list
+ * will be reclaimed in a different bio.c thread. */
+#define LAZYFREE_THRESHOLD 64
+int dbAsyncDelete(redisDb *db, robj *key) {
+    snapshotBeforeWrite(db,key);
+    /* Deleting an entry from the expires dict will not free the sds of
+     * the key, because it is shared with the main dictionary. */
+    if (dictSize(db->expires) > 0) {
+        if (db->expires_index) expireIndexDelete(db,key);
+        dictDelete(db->expires,key->ptr);
+    }
+
+    /* If the value is composed of a few allocations, to free in a lazy way
+     * is actually just slower... So under a certain limit we just free
+     * the object synchronously. */
+    dictEntry *de = dictFind(db->dict,key->ptr);
+    if (de) {
+        robj *val = dictGetVal(de);
+        size_t free_effort = lazyfreeGetFreeEffort(val);
+
+        /* If releasing the object is too much work, let's put it into the
+         * lazy free list. Shared values are left alone: other references
+         * exist, so there is nothing to reclaim. */
+        if (free_effort > LAZYFREE_THRESHOLD && val->refcount == 1) {
+            atomicIncr(lazyfree_objects,1);
+            bioCreateBackgroundJob(BIO_LAZY_FREE,val,NULL,NULL);
+            /* The value destructor of the DB dictionary ignores NULL. */
+            dictSetVal(db->dict,de,NULL);
+        }
+    }
+
+    /* Release the key-val pair, or just the key if we set the val
+     * field to NULL in order to lazy free it later. */
+    if (server.cluster_enabled) slotToKeyDel(key->ptr);
+    if (dictDelete(db->dict,key->ptr) == DICT_OK) {
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+/* Schedule for lazy freeing the key space of a database that is no longer
+ * referenced by the server: its hash tables and expires index, if any. */
+void freeDbKeyspaceAsync(redisDb *db) {
+    atomicIncr(lazyfree_objects,dictSize(db->dict));
+    bioCreateBackgroundJob(BIO_LAZY_FREE,NULL,db->dict,db->expires);
+    if (db->expires_index) {
+        atomicIncr(lazyfree_objects,db->expires_index->length);
+        bioCreateBackgroundJob(BIO_LAZY_FREE,NULL,NULL,db->expires_index);
+    }
+}
+
+/* Empty a Redis DB asynchronously. What the function does actually is to
+ * create a new empty set of hash tables and scheduling the old ones for
+ * lazy freeing. */
+void emptyDbAsync(redisDb *db) {
+    redisDb old = *db;
+    db->dict = keyspaceDictCreate(keyspaceMainDictType());
+    db->expires = keyspaceDictCreate(&keyptrDictType);
+    if (db->expires_index) db->expires_index = zslCreate();
+    freeDbKeyspaceAsync(&old);
+}
+
+/* Schedule for lazy freeing a slots-keys map of Redis Cluster that is no
+ * longer referenced by the server. */
+void freeSlotToKeyAsync(dict **slots) {
+    size_t numkeys = 0;
+    int j;
+
+    for (j = 0; j < CLUSTER_SLOTS; j++)
+        if (slots[j]) numkeys += dictSize(slots[j]);
+    atomicIncr(lazyfree_objects,numkeys);
+    bioCreateBackgroundJob(BIO_LAZY_FREE,NULL,slots,NULL);
+}
+
+/* Empty the slots-keys map of Redis Cluster by creating a new empty one
+ * and scheduling the old for lazy freeing. */
+void slotToKeyFlushAsync(void) {
+    dict **oldslots = server.cluster->slots_to_keys;
+
+    server.cluster->slots_to_keys = zcalloc(sizeof(dict*)*CLUSTER_SLOTS);
+    freeSlotToKeyAsync(oldslots);
+}
+
+/* Release objects from the lazyfree thread. It's just decrRefCount()
+ * updating the count of objects to release. */
+void lazyfreeFreeObjectFromBioThread(robj *o) {
+    decrRefCount(o);
+    atomicDecr(lazyfree_objects,1);
+}
+
+/* Release a database from the lazyfree thread. The two dictionaries are
+ * the main and expires tables of a database, that were substituted with
+ * fresh ones in the main thread when the database was logically deleted. */
+void lazyfreeFreeDatabaseFromBioThread(dict *ht1, dict *ht2) {
+    size_t numkeys = dictSize(ht1);
+    dictRelease(ht1);
+    dictRelease(ht2);
+    atomicDecr(lazyfree_objects,numkeys);
+}
+
+/* Release the expire index of a database in the lazyfree thread. */
+void lazyfreeFreeSkiplistFromBioThread(zskiplist *sl) {
+    size_t len = sl->length;
+    zslFree(sl);
+    atomicDecr(lazyfree_objects,len);
+}
+
+/* Release the per slot dictionaries mapping Redis Cluster keys to slots in
+ * the lazyfree thread. The keys are owned by the main dictionary. */
+void lazyfreeFreeSlotsMapFromBioThread(dict **slots) {
+    size_t numkeys = 0;
+    int j;
+
+    for (j = 0; j < CLUSTER_SLOTS; j++) {
+        if (slots[j] == NULL) continue;
+        numkeys += dictSize(slots[j]);
+        dictRelease(slots[j]);
+    }
+    zfree(slots);
+    atomicDecr(lazyfree_objects,numkeys);
+}
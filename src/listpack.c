@@ -0,0 +1,994 @@
+/* Listpack -- A lists of strings serialization format.
+ *
+ * The listpack is a compact list of strings and integers stored in a single
+ * allocation, like the ziplist. The difference is in how backward traversal
+ * works: a ziplist entry stores the length of the *previous* entry, so when
+ * an entry grows or shrinks the length field of the next entry may have to
+ * grow as well, and so forth (the "cascade update" of ziplist.c, that makes
+ * inserts and deletes O(N^2) in the worst case). A listpack entry instead
+ * stores its *own* length at its end, so modifying an entry never touches
+ * the others.
+ * 和ziplist不同 每个entry在末尾记录自己的长度 修改一个entry不会影响其他entry
+ * 所以没有ziplist的连锁更新问题
+ *
+ * ----------------------------------------------------------------------------
+ *
+ * LISTPACK OVERALL LAYOUT:
+ *
+ * <total-bytes> <num-elements> <entry> <entry> ... <entry> <end-byte>
+ *
+ * <total-bytes> is a 32 bit unsigned integer with the size in bytes of the
+ * whole listpack, header and end byte included.
+ *
+ * <num-elements> is a 16 bit unsigned integer with the number of entries.
+ * When the entries are 65535 or more the field is set to 65535, and the
+ * only way to know the number of entries is to scan the listpack.
+ * 元素数量大于等于65535时需要遍历才能知道长度
+ *
+ * <end-byte> is a single byte set to 255 (0xFF), like the ziplist one.
+ *
+ * Both the header fields are stored in little endian byte order.
+ *
+ * LISTPACK ENTRIES:
+ *
+ * <encoding-type><element-data><element-tot-len>
+ *
+ * The encoding is the first byte, or bytes, of the entry:
+ *
+ * |0xxxxxxx| 7 bit unsigned integer, from 0 to 127.
+ * |10xxxxxx| <string> string up to 63 bytes.
+ * |110xxxxx|yyyyyyyy| 13 bit signed integer.
+ * |1110xxxx|yyyyyyyy| <string> string up to 4095 bytes.
+ * |11110000|<4 bytes len>| <string> large string.
+ * |11110001| <2 bytes> 16 bit signed integer.
+ * |11110010| <3 bytes> 24 bit signed integer.
+ * |11110011| <4 bytes> 32 bit signed integer.
+ * |11110100| <8 bytes> 64 bit signed integer.
+ * |11111111| end of listpack.
+ *
+ * Multi byte lengths and integers are stored in little endian byte order,
+ * but the 13 bit integer and the 12 bit string length, whose most
+ * significant bits are in the first byte.
+ *
+ * <element-tot-len> is the size of the encoding plus the element data,
+ * stored from right to left in 1 to 5 bytes: every byte holds 7 bits of
+ * the length, and the most significant bit is set when more bytes follow on
+ * the left. Reading it from the last byte of an entry gives the start of
+ * the entry, that's how the list is traversed backward.
+ * 从entry最后一个字节向左读出entry的长度 以此反向遍历
+ *
+ * ----------------------------------------------------------------------------
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include "zmalloc.h"
+#include "util.h"
+#include "listpack.h"
+#include "redisassert.h"
+
+#define LP_HDR_SIZE 6       /* 32 bit total len + 16 bit number of elements. */
+#define LP_HDR_NUMELE_UNKNOWN UINT16_MAX
+#define LP_MAX_INT_ENCODING_LEN 9
+#define LP_MAX_BACKLEN_SIZE 5
+#define LP_EOF 0xFF
+
+/* Strings longer than this are never tried as integers, like in the
+ * ziplist. */
+#define LP_MAX_INT_STRING_LEN 32
+
+#define LP_ENCODING_7BIT_UINT 0
+#define LP_ENCODING_7BIT_UINT_MASK 0x80
+#define LP_ENCODING_IS_7BIT_UINT(byte) (((byte)&LP_ENCODING_7BIT_UINT_MASK)==LP_ENCODING_7BIT_UINT)
+
+#define LP_ENCODING_6BIT_STR 0x80
+#define LP_ENCODING_6BIT_STR_MASK 0xC0
+#define LP_ENCODING_IS_6BIT_STR(byte) (((byte)&LP_ENCODING_6BIT_STR_MASK)==LP_ENCODING_6BIT_STR)
+
+#define LP_ENCODING_13BIT_INT 0xC0
+#define LP_ENCODING_13BIT_INT_MASK 0xE0
+#define LP_ENCODING_IS_13BIT_INT(byte) (((byte)&LP_ENCODING_13BIT_INT_MASK)==LP_ENCODING_13BIT_INT)
+
+#define LP_ENCODING_12BIT_STR 0xE0
+#define LP_ENCODING_12BIT_STR_MASK 0xF0
+#define LP_ENCODING_IS_12BIT_STR(byte) (((byte)&LP_ENCODING_12BIT_STR_MASK)==LP_ENCODING_12BIT_STR)
+
+#define LP_ENCODING_32BIT_STR 0xF0
+#define LP_ENCODING_16BIT_INT 0xF1
+#define LP_ENCODING_24BIT_INT 0xF2
+#define LP_ENCODING_32BIT_INT 0xF3
+#define LP_ENCODING_64BIT_INT 0xF4
+
+#define LP_ENCODING_6BIT_STR_LEN(p) ((p)[0] & 0x3F)
+#define LP_ENCODING_12BIT_STR_LEN(p) ((((uint32_t)(p)[0]&0xF) << 8) | (p)[1])
+#define LP_ENCODING_32BIT_STR_LEN(p) (((uint32_t)(p)[1]<<0) | \
+                                      ((uint32_t)(p)[2]<<8) | \
+                                      ((uint32_t)(p)[3]<<16) | \
+                                      ((uint32_t)(p)[4]<<24))
+
+#define lpGetTotalBytes(p)           (((uint32_t)(p)[0]<<0) | \
+                                      ((uint32_t)(p)[1]<<8) | \
+                                      ((uint32_t)(p)[2]<<16) | \
+                                      ((uint32_t)(p)[3]<<24))
+
+#define lpGetNumElements(p)          (((uint32_t)(p)[4]<<0) | \
+                                      ((uint32_t)(p)[5]<<8))
+#define lpSetTotalBytes(p,v) do { \
+    (p)[0] = (v)&0xff; \
+    (p)[1] = ((v)>>8)&0xff; \
+    (p)[2] = ((v)>>16)&0xff; \
+    (p)[3] = ((v)>>24)&0xff; \
+} while(0)
+
+#define lpSetNumElements(p,v) do { \
+    (p)[4] = (v)&0xff; \
+    (p)[5] = ((v)>>8)&0xff; \
+} while(0)
+
+/* Create a new, empty listpack. */
+unsigned char *lpNew(void) {
+    unsigned char *lp = zmalloc(LP_HDR_SIZE+1);
+
+    lpSetTotalBytes(lp,LP_HDR_SIZE+1);
+    lpSetNumElements(lp,0);
+    lp[LP_HDR_SIZE] = LP_EOF;
+    return lp;
+}
+
+/* Free the specified listpack. */
+void lpFree(unsigned char *lp) {
+    zfree(lp);
+}
+
+/* Store in 'buf' the smallest encoding of the integer 'v', and set
+ * '*enclen' to its size. */
+static void lpEncodeInteger(long long v, unsigned char *buf, uint64_t *enclen) {
+    if (v >= 0 && v <= 127) {
+        buf[0] = v;
+        *enclen = 1;
+    } else if (v >= -4096 && v <= 4095) {
+        if (v < 0) v = ((int64_t)1<<13)+v;
+        buf[0] = (v>>8)|LP_ENCODING_13BIT_INT;
+        buf[1] = v&0xff;
+        *enclen = 2;
+    } else if (v >= -32768 && v <= 32767) {
+        if (v < 0) v = ((int64_t)1<<16)+v;
+        buf[0] = LP_ENCODING_16BIT_INT;
+        buf[1] = v&0xff;
+        buf[2] = v>>8;
+        *enclen = 3;
+    } else if (v >= -8388608 && v <= 8388607) {
+        if (v < 0) v = ((int64_t)1<<24)+v;
+        buf[0] = LP_ENCODING_24BIT_INT;
+        buf[1] = v&0xff;
+        buf[2] = (v>>8)&0xff;
+        buf[3] = v>>16;
+        *enclen = 4;
+    } else if (v >= INT32_MIN && v <= INT32_MAX) {
+        if (v < 0) v = ((int64_t)1<<32)+v;
+        buf[0] = LP_ENCODING_32BIT_INT;
+        buf[1] = v&0xff;
+        buf[2] = (v>>8)&0xff;
+        buf[3] = (v>>16)&0xff;
+        buf[4] = v>>24;
+        *enclen = 5;
+    } else {
+        uint64_t uv = v;
+        int j;
+
+        buf[0] = LP_ENCODING_64BIT_INT;
+        for (j = 1; j <= 8; j++) {
+            buf[j] = uv&0xff;
+            uv >>= 8;
+        }
+        *enclen = 9;
+    }
+}
+
+/* Size of the encoding byte(s) of a string of 'len' bytes. */
+static uint32_t lpEncodeStringHeaderSize(uint32_t len) {
+    if (len < 64) return 1;
+    else if (len < 4096) return 2;
+    else return 5;
+}
+
+/* Write the string 's' of 'len' bytes, encoding included, at 'buf'. */
+static void lpEncodeString(unsigned char *buf, unsigned char *s, uint32_t len) {
+    if (len < 64) {
+        buf[0] = len | LP_ENCODING_6BIT_STR;
+        memcpy(buf+1,s,len);
+    } else if (len < 4096) {
+        buf[0] = (len >> 8) | LP_ENCODING_12BIT_STR;
+        buf[1] = len & 0xff;
+        memcpy(buf+2,s,len);
+    } else {
+        buf[0] = LP_ENCODING_32BIT_STR;
+        buf[1] = len & 0xff;
+        buf[2] = (len >> 8) & 0xff;
+        buf[3] = (len >> 16) & 0xff;
+        buf[4] = (len >> 24) & 0xff;
+        memcpy(buf+5,s,len);
+    }
+}
+
+/* Choose the encoding of the entry holding the string 's' of 'slen' bytes,
+ * or the integer 'lval' when 's' is NULL. Strings that look like integers
+ * are stored as integers, whose encoding is written in 'intenc'. The size
+ * of the encoding plus the data is stored in '*enclen'. Returns 1 if the
+ * entry is an integer, 0 if it is a string. */
+static int lpEncodeEntry(unsigned char *s, uint32_t slen, long long lval, unsigned char *intenc, uint64_t *enclen) {
+    if (s == NULL ||
+        (slen <= LP_MAX_INT_STRING_LEN && string2ll((char*)s,slen,&lval)))
+    {
+        lpEncodeInteger(lval,intenc,enclen);
+        return 1;
+    }
+    *enclen = lpEncodeStringHeaderSize(slen)+slen;
+    return 0;
+}
+
+/* Number of bytes needed to store the entry length 'l'. */
+static unsigned long lpBacklenSize(uint64_t l) {
+    if (l <= 127) return 1;
+    else if (l < 16383) return 2;
+    else if (l < 2097151) return 3;
+    else if (l < 268435455) return 4;
+    else return 5;
+}
+
+/* Store the entry length 'l' in 'buf', in the format described at the top
+ * of this file, returning the number of bytes used. */
+static unsigned long lpEncodeBacklen(unsigned char *buf, uint64_t l) {
+    unsigned long size = lpBacklenSize(l), j;
+
+    /* The last byte has the 7 less significant bits, the first one the
+     * most significant bits, and only the first one has no continuation
+     * flag. */
+    for (j = size; j > 0; j--) {
+        buf[j-1] = (l & 127) | (j == 1 ? 0 : 128);
+        l >>= 7;
+    }
+    return size;
+}
+
+/* Decode the entry length stored backward from 'p', that points to the
+ * last byte of an entry. Returns UINT64_MAX on a malformed length. */
+static uint64_t lpDecodeBacklen(unsigned char *p) {
+    uint64_t val = 0;
+    uint64_t shift = 0;
+
+    do {
+        val |= (uint64_t)(p[0] & 127) << shift;
+        if (!(p[0] & 128)) break;
+        shift += 7;
+        p--;
+        if (shift > 28) return UINT64_MAX;
+    } while(1);
+    return val;
+}
+
+/* Size of the encoding and data of the entry at 'p', without the entry
+ * length. Returns 0 on an unknown encoding. */
+static uint32_t lpCurrentEncodedSize(unsigned char *p) {
+    if (LP_ENCODING_IS_7BIT_UINT(p[0])) return 1;
+    if (LP_ENCODING_IS_6BIT_STR(p[0])) return 1+LP_ENCODING_6BIT_STR_LEN(p);
+    if (LP_ENCODING_IS_13BIT_INT(p[0])) return 2;
+    if (LP_ENCODING_IS_12BIT_STR(p[0])) return 2+LP_ENCODING_12BIT_STR_LEN(p);
+    if (p[0] == LP_ENCODING_16BIT_INT) return 3;
+    if (p[0] == LP_ENCODING_24BIT_INT) return 4;
+    if (p[0] == LP_ENCODING_32BIT_INT) return 5;
+    if (p[0] == LP_ENCODING_64BIT_INT) return 9;
+    if (p[0] == LP_ENCODING_32BIT_STR) return 5+LP_ENCODING_32BIT_STR_LEN(p);
+    if (p[0] == LP_EOF) return 1;
+    return 0;
+}
+
+/* Return the entry after 'p', or the end byte if 'p' is the last entry. */
+static unsigned char *lpSkip(unsigned char *p) {
+    uint32_t entrylen = lpCurrentEncodedSize(p);
+    return p+entrylen+lpBacklenSize(entrylen);
+}
+
+/* Return the first entry of the listpack, or NULL if it is empty. */
+unsigned char *lpFirst(unsigned char *lp) {
+    unsigned char *p = lp+LP_HDR_SIZE;
+
+    if (p[0] == LP_EOF) return NULL;
+    return p;
+}
+
+/* Return the entry after 'p', or NULL if 'p' is the last one. */
+unsigned char *lpNext(unsigned char *lp, unsigned char *p) {
+    ((void) lp);
+    assert(p);
+    p = lpSkip(p);
+    if (p[0] == LP_EOF) return NULL;
+    return p;
+}
+
+/* Return the entry before 'p', or NULL if 'p' is the first one. 'p' can
+ * also be the end byte: then the last entry is returned. */
+unsigned char *lpPrev(unsigned char *lp, unsigned char *p) {
+    uint64_t prevlen;
+
+    assert(p);
+    if (p-lp == LP_HDR_SIZE) return NULL;
+    p--; /* Seek the last byte of the previous entry length. */
+    prevlen = lpDecodeBacklen(p);
+    prevlen += lpBacklenSize(prevlen);
+    return p-prevlen+1;
+}
+
+/* Return the last entry of the listpack, or NULL if it is empty. */
+unsigned char *lpLast(unsigned char *lp) {
+    return lpPrev(lp,lp+lpGetTotalBytes(lp)-1);
+}
+
+/* Return the number of entries of the listpack. Only when there are more
+ * than 65534 entries the listpack is scanned. */
+unsigned long lpLength(unsigned char *lp) {
+    uint32_t numele = lpGetNumElements(lp);
+    unsigned long count = 0;
+    unsigned char *p;
+
+    if (numele != LP_HDR_NUMELE_UNKNOWN) return numele;
+
+    p = lpFirst(lp);
+    while(p) {
+        count++;
+        p = lpNext(lp,p);
+    }
+    /* Cache the length again if it fits the header. */
+    if (count < LP_HDR_NUMELE_UNKNOWN) lpSetNumElements(lp,count);
+    return count;
+}
+
+/* Return the total size in bytes of the listpack. */
+size_t lpBytes(unsigned char *lp) {
+    return lpGetTotalBytes(lp);
+}
+
+/* Get the value of the entry at 'p'. Like ziplistGet(), strings are
+ * returned as a pointer inside the listpack, with the length stored in
+ * '*slen'; for integers NULL is returned and the value is stored in
+ * '*lval'. */
+unsigned char *lpGetValue(unsigned char *p, unsigned int *slen, long long *lval) {
+    uint64_t uval, negstart, negmax;
+
+    if (LP_ENCODING_IS_7BIT_UINT(p[0])) {
+        *lval = p[0] & 0x7f;
+        return NULL;
+    } else if (LP_ENCODING_IS_6BIT_STR(p[0])) {
+        *slen = LP_ENCODING_6BIT_STR_LEN(p);
+        return p+1;
+    } else if (LP_ENCODING_IS_13BIT_INT(p[0])) {
+        uval = ((uint64_t)(p[0]&0x1f)<<8) | p[1];
+        negstart = (uint64_t)1<<12;
+        negmax = 8191;
+    } else if (LP_ENCODING_IS_12BIT_STR(p[0])) {
+        *slen = LP_ENCODING_12BIT_STR_LEN(p);
+        return p+2;
+    } else if (p[0] == LP_ENCODING_16BIT_INT) {
+        uval = (uint64_t)p[1] | (uint64_t)p[2]<<8;
+        negstart = (uint64_t)1<<15;
+        negmax = UINT16_MAX;
+    } else if (p[0] == LP_ENCODING_24BIT_INT) {
+        uval = (uint64_t)p[1] | (uint64_t)p[2]<<8 | (uint64_t)p[3]<<16;
+        negstart = (uint64_t)1<<23;
+        negmax = UINT32_MAX>>8;
+    } else if (p[0] == LP_ENCODING_32BIT_INT) {
+        uval = (uint64_t)p[1] | (uint64_t)p[2]<<8 | (uint64_t)p[3]<<16 |
+               (uint64_t)p[4]<<24;
+        negstart = (uint64_t)1<<31;
+        negmax = UINT32_MAX;
+    } else if (p[0] == LP_ENCODING_64BIT_INT) {
+        int j;
+
+        uval = 0;
+        for (j = 8; j >= 1; j--) uval = (uval<<8) | p[j];
+        negstart = (uint64_t)1<<63;
+        negmax = UINT64_MAX;
+    } else if (p[0] == LP_ENCODING_32BIT_STR) {
+        *slen = LP_ENCODING_32BIT_STR_LEN(p);
+        return p+5;
+    } else {
+        /* Not reached on valid listpacks. */
+        *lval = 0;
+        return NULL;
+    }
+
+    /* Two's complement of the encoding width. */
+    if (uval >= negstart) {
+        uval = negmax-uval;
+        *lval = -(int64_t)uval-1;
+    } else {
+        *lval = uval;
+    }
+    return NULL;
+}
+
+/* Insert, delete or replace the specified string element 's' of 'slen'
+ * bytes at the position 'p', where 'where' is LP_BEFORE, LP_AFTER or
+ * LP_REPLACE. When 's' is NULL the element at 'p' is deleted.
+ *
+ * Strings that represent integers are stored as integers, like in the
+ * ziplist.
+ *
+ * When 'newp' is not NULL, '*newp' is set to the address of the inserted
+ * or replaced element, or, on deletion, of the element after the deleted
+ * one (NULL if the deleted element was the last one).
+ *
+ * Returns the listpack, that may have been reallocated, or NULL if the
+ * listpack would exceed 4GB. Only the modified entry is written: no other
+ * entry has to be updated. */
+unsigned char *lpInsert(unsigned char *lp, unsigned char *s, uint32_t slen, unsigned char *p, int where, unsigned char **newp) {
+    unsigned char intenc[LP_MAX_INT_ENCODING_LEN];
+    unsigned char backlen[LP_MAX_BACKLEN_SIZE];
+    uint64_t enclen = 0;            /* Encoding and data of the new entry. */
+    unsigned long backlen_size = 0; /* Size of its entry length. */
+    uint64_t old_bytes, new_bytes;
+    uint32_t replaced_len = 0;
+    unsigned long poff;
+    unsigned char *dst;
+    int isint = 0;
+
+    if (s == NULL) where = LP_REPLACE; /* Deletion. */
+
+    /* Inserting after 'p' is inserting before the next entry (or the end
+     * byte). */
+    if (where == LP_AFTER) {
+        p = lpSkip(p);
+        where = LP_BEFORE;
+    }
+    poff = p-lp;
+
+    if (s) {
+        isint = lpEncodeEntry(s,slen,0,intenc,&enclen);
+        backlen_size = lpEncodeBacklen(backlen,enclen);
+    }
+
+    old_bytes = lpGetTotalBytes(lp);
+    if (where == LP_REPLACE) {
+        replaced_len = lpCurrentEncodedSize(p);
+        replaced_len += lpBacklenSize(replaced_len);
+    }
+    new_bytes = old_bytes+enclen+backlen_size-replaced_len;
+    if (new_bytes > UINT32_MAX) return NULL;
+
+    /* Make room for the new entry, or close the gap of the removed one. */
+    dst = lp+poff;
+    if (new_bytes > old_bytes) {
+        lp = zrealloc(lp,new_bytes);
+        dst = lp+poff;
+    }
+    if (where == LP_BEFORE) {
+        memmove(dst+enclen+backlen_size,dst,old_bytes-poff);
+    } else {
+        memmove(dst+enclen+backlen_size,dst+replaced_len,
+                old_bytes-poff-replaced_len);
+    }
+    if (new_bytes < old_bytes) {
+        lp = zrealloc(lp,new_bytes);
+        dst = lp+poff;
+    }
+
+    if (newp) {
+        *newp = dst;
+        if (!s && dst[0] == LP_EOF) *newp = NULL;
+    }
+    if (s) {
+        if (isint)
+            memcpy(dst,intenc,enclen);
+        else
+            lpEncodeString(dst,s,slen);
+        memcpy(dst+enclen,backlen,backlen_size);
+    }
+
+    /* Update the header. */
+    if (where != LP_REPLACE || s == NULL) {
+        uint32_t numele = lpGetNumElements(lp);
+        if (numele != LP_HDR_NUMELE_UNKNOWN) {
+            if (s) numele++; else numele--;
+            lpSetNumElements(lp,numele);
+        }
+    }
+    lpSetTotalBytes(lp,new_bytes);
+    return lp;
+}
+
+/* Append the string 's' at the end of the listpack. */
+unsigned char *lpAppend(unsigned char *lp, unsigned char *s, uint32_t slen) {
+    unsigned char *eof = lp+lpGetTotalBytes(lp)-1;
+    return lpInsert(lp,s,slen,eof,LP_BEFORE,NULL);
+}
+
+/* Append the 'len' entries of the array at the end of the listpack with a
+ * single reallocation, instead of one per entry as lpAppend() does. Like
+ * in lpGetValue(), an entry with a NULL 'sval' is the integer 'lval'.
+ * Returns NULL if the listpack would exceed 4GB. */
+unsigned char *lpBatchAppend(unsigned char *lp, listpackEntry *entries, unsigned long len) {
+    unsigned char intenc[LP_MAX_INT_ENCODING_LEN];
+    uint64_t old_bytes = lpGetTotalBytes(lp), new_bytes = old_bytes, enclen;
+    uint32_t numele = lpGetNumElements(lp);
+    unsigned char *dst;
+    unsigned long j;
+
+    for (j = 0; j < len; j++) {
+        lpEncodeEntry(entries[j].sval,entries[j].slen,entries[j].lval,
+                      intenc,&enclen);
+        new_bytes += enclen+lpBacklenSize(enclen);
+    }
+    if (new_bytes > UINT32_MAX) return NULL;
+
+    lp = zrealloc(lp,new_bytes);
+    dst = lp+old_bytes-1; /* Overwrite the end byte. */
+    for (j = 0; j < len; j++) {
+        if (lpEncodeEntry(entries[j].sval,entries[j].slen,entries[j].lval,
+                          intenc,&enclen))
+            memcpy(dst,intenc,enclen);
+        else
+            lpEncodeString(dst,entries[j].sval,entries[j].slen);
+        dst += enclen;
+        dst += lpEncodeBacklen(dst,enclen);
+    }
+    dst[0] = LP_EOF;
+
+    if (numele != LP_HDR_NUMELE_UNKNOWN) {
+        if (numele+len < LP_HDR_NUMELE_UNKNOWN)
+            lpSetNumElements(lp,numele+len);
+        else
+            lpSetNumElements(lp,LP_HDR_NUMELE_UNKNOWN);
+    }
+    lpSetTotalBytes(lp,new_bytes);
+    return lp;
+}
+
+/* Replace the entry at '*p' with the string 's'. '*p' is updated to the
+ * new entry. */
+unsigned char *lpReplace(unsigned char *lp, unsigned char **p, unsigned char *s, uint32_t slen) {
+    return lpInsert(lp,s,slen,*p,LP_REPLACE,p);
+}
+
+/* Remove the entry at 'p'. See lpInsert() for the meaning of 'newp'. */
+unsigned char *lpDelete(unsigned char *lp, unsigned char *p, unsigned char **newp) {
+    return lpInsert(lp,NULL,0,p,LP_REPLACE,newp);
+}
+
+/* Delete 'num' entries starting at the zero based 'index' (negative
+ * indexes count from the tail), with a single memmove(). */
+unsigned char *lpDeleteRange(unsigned char *lp, long index, unsigned long num) {
+    unsigned char *first, *last;
+    unsigned long deleted = 0;
+    uint32_t bytes, numele;
+
+    if (num == 0 || (first = lpSeek(lp,index)) == NULL) return lp;
+
+    last = first;
+    while(deleted < num && last[0] != LP_EOF) {
+        last = lpSkip(last);
+        deleted++;
+    }
+
+    bytes = lpGetTotalBytes(lp);
+    memmove(first,last,bytes-(last-lp));
+    bytes -= last-first;
+    lpSetTotalBytes(lp,bytes);
+    numele = lpGetNumElements(lp);
+    if (numele != LP_HDR_NUMELE_UNKNOWN)
+        lpSetNumElements(lp,numele-deleted);
+    return zrealloc(lp,bytes);
+}
+
+/* Return the entry at the zero based 'index', negative indexes counting
+ * from the tail, or NULL if out of range. The listpack is walked from the
+ * nearest end. */
+unsigned char *lpSeek(unsigned char *lp, long index) {
+    unsigned long numele = lpLength(lp);
+    unsigned char *p;
+
+    if (index < 0) index = (long)numele+index;
+    if (index < 0 || (unsigned long)index >= numele) return NULL;
+
+    if ((unsigned long)index > numele/2) {
+        unsigned long j = numele-1;
+
+        p = lpLast(lp);
+        while(j-- > (unsigned long)index) p = lpPrev(lp,p);
+    } else {
+        p = lpFirst(lp);
+        while(index--) p = lpNext(lp,p);
+    }
+    return p;
+}
+
+/* Return 1 if the entry at 'p' is equal to the string 's', 0 otherwise. */
+unsigned int lpCompare(unsigned char *p, unsigned char *s, uint32_t slen) {
+    unsigned char *vstr;
+    unsigned int vlen;
+    long long vll, sll;
+
+    vstr = lpGetValue(p,&vlen,&vll);
+    if (vstr) return vlen == slen && memcmp(vstr,s,slen) == 0;
+
+    /* Integer entries are created only from strings string2ll() accepts,
+     * so comparing the integers is enough. */
+    if (slen > LP_MAX_INT_STRING_LEN || !string2ll((char*)s,slen,&sll))
+        return 0;
+    return vll == sll;
+}
+
+/* Find the entry equal to 's' starting at 'p', comparing one entry and
+ * skipping the next 'skip' ones, like ziplistFind(). Returns NULL if not
+ * found. */
+unsigned char *lpFind(unsigned char *lp, unsigned char *p, unsigned char *s, uint32_t slen, unsigned int skip) {
+    unsigned int skipcnt = 0, vlen;
+    unsigned char *vstr;
+    long long vll, sll = 0;
+    int sisint = -1; /* Computed the first time an integer is compared. */
+
+    while(p) {
+        if (skipcnt == 0) {
+            vstr = lpGetValue(p,&vlen,&vll);
+            if (vstr) {
+                if (vlen == slen && memcmp(vstr,s,slen) == 0) return p;
+            } else {
+                if (sisint == -1)
+                    sisint = slen <= LP_MAX_INT_STRING_LEN &&
+                             string2ll((char*)s,slen,&sll);
+                if (sisint && vll == sll) return p;
+            }
+            skipcnt = skip;
+        } else {
+            skipcnt--;
+        }
+        p = lpNext(lp,p);
+    }
+    return NULL;
+}
+
+/* Check that the 'size' bytes at 'lp' are a well formed listpack: the
+ * header, every entry and its length, and the end byte. Used when loading
+ * listpacks from RDB files. */
+int lpValidateIntegrity(unsigned char *lp, size_t size) {
+    unsigned char *p, *end;
+    unsigned long count = 0;
+    uint32_t numele;
+
+    if (size < LP_HDR_SIZE+1 || lpGetTotalBytes(lp) != size ||
+        lp[size-1] != LP_EOF) return 0;
+
+    p = lp+LP_HDR_SIZE;
+    end = lp+size-1;
+    while(p < end) {
+        size_t avail = end-p, hdrlen = 1;
+        uint64_t enclen, entrylen;
+
+        if (LP_ENCODING_IS_12BIT_STR(p[0]) || LP_ENCODING_IS_13BIT_INT(p[0]))
+            hdrlen = 2;
+        else if (p[0] == LP_ENCODING_32BIT_STR)
+            hdrlen = 5;
+        if (hdrlen > avail) return 0;
+
+        enclen = lpCurrentEncodedSize(p);
+        if (enclen == 0 || p[0] == LP_EOF) return 0;
+        entrylen = enclen+lpBacklenSize(enclen);
+        if (entrylen > avail) return 0;
+        if (lpDecodeBacklen(p+entrylen-1) != enclen) return 0;
+        p += entrylen;
+        count++;
+    }
+
+    numele = lpGetNumElements(lp);
+    if (numele != LP_HDR_NUMELE_UNKNOWN && numele != count) return 0;
+    return 1;
+}
+
+#ifdef REDIS_TEST
+#include <sys/time.h>
+#include <time.h>
+
+static long long lpTestUsec(void) {
+    struct timeval tv;
+    gettimeofday(&tv,NULL);
+    return (((long long)tv.tv_sec)*1000000)+tv.tv_usec;
+}
+
+static void lpTestAssert(int cond, char *what) {
+    if (!cond) {
+        printf("ERROR: %s\n", what);
+        exit(1);
+    }
+}
+
+/* Check that the entry at 'p' is equal to the 'len' bytes at 's'. */
+static void lpTestAssertEntry(unsigned char *p, char *s, unsigned int len) {
+    lpTestAssert(p != NULL, "entry exists");
+    lpTestAssert(lpCompare(p,(unsigned char*)s,len), "entry value");
+}
+
+/* Random element: a small or large integer, or a string of random length
+ * up to 'maxlen' bytes. */
+static unsigned int lpTestRandomElement(char *buf, unsigned int maxlen) {
+    unsigned int len, j;
+
+    switch(rand() % 4) {
+    case 0: return snprintf(buf,32,"%d",rand() % 200 - 100);
+    case 1: return snprintf(buf,32,"%lld",
+                    ((long long)rand() << 32) ^ rand() ^ (rand() % 2 ? 0 :
+                    (long long)0x8000000000000000ULL));
+    default:
+        len = rand() % maxlen;
+        for (j = 0; j < len; j++) buf[j] = 'a' + rand() % 26;
+        return len;
+    }
+}
+
+int listpackTest(int argc, char *argv[]) {
+    unsigned char *lp, *p;
+    unsigned int vlen;
+    long long vll;
+    int j;
+
+    ((void) argc);
+    ((void) argv);
+    srand(time(NULL));
+
+    printf("Create, append and iterate: ");
+    {
+        char *elements[] = {"hello","0","127","128","-1","4095","-4096",
+                            "32767","-32768","8388607","-8388608",
+                            "2147483647","-2147483648","9223372036854775807",
+                            "-9223372036854775808","0127","+1","1.5",""};
+        int count = sizeof(elements)/sizeof(char*);
+
+        lp = lpNew();
+        lpTestAssert(lpLength(lp) == 0 && lpFirst(lp) == NULL, "empty");
+        for (j = 0; j < count; j++)
+            lp = lpAppend(lp,(unsigned char*)elements[j],strlen(elements[j]));
+        lpTestAssert(lpLength(lp) == (unsigned long)count, "length");
+        lpTestAssert(lpValidateIntegrity(lp,lpBytes(lp)), "integrity");
+
+        p = lpFirst(lp);
+        for (j = 0; j < count; j++) {
+            lpTestAssertEntry(p,elements[j],strlen(elements[j]));
+            p = lpNext(lp,p);
+        }
+        lpTestAssert(p == NULL, "forward iteration end");
+
+        p = lpLast(lp);
+        for (j = count-1; j >= 0; j--) {
+            lpTestAssertEntry(p,elements[j],strlen(elements[j]));
+            p = lpPrev(lp,p);
+        }
+        lpTestAssert(p == NULL, "backward iteration end");
+
+        /* Integers are stored as such, the rest as strings. */
+        lpTestAssert(lpGetValue(lpSeek(lp,14),&vlen,&vll) == NULL &&
+                     vll == LLONG_MIN, "64 bit integer");
+        lpTestAssert(lpGetValue(lpSeek(lp,6),&vlen,&vll) == NULL &&
+                     vll == -4096, "13 bit integer");
+        lpTestAssert(lpGetValue(lpSeek(lp,15),&vlen,&vll) != NULL &&
+                     vlen == 4, "integer-like string");
+        lpTestAssert(lpSeek(lp,count) == NULL, "seek out of range");
+        lpTestAssertEntry(lpSeek(lp,-1),"",0);
+        lpTestAssertEntry(lpSeek(lp,-count),"hello",5);
+        lpFree(lp);
+        printf("OK\n");
+    }
+
+    printf("Insert, replace, delete: ");
+    {
+        char big[5000];
+        memset(big,'x',sizeof(big));
+
+        lp = lpNew();
+        lp = lpAppend(lp,(unsigned char*)"b",1);
+        p = lpFirst(lp);
+        lp = lpInsert(lp,(unsigned char*)"a",1,p,LP_BEFORE,&p);
+        lpTestAssertEntry(p,"a",1);
+        lp = lpInsert(lp,(unsigned char*)"c",1,lpLast(lp),LP_AFTER,&p);
+        lpTestAssertEntry(p,"c",1);
+        lpTestAssertEntry(lpPrev(lp,p),"b",1);
+
+        /* Growing an entry a lot only moves the following ones. */
+        p = lpSeek(lp,1);
+        lp = lpReplace(lp,&p,(unsigned char*)big,sizeof(big));
+        lpTestAssertEntry(p,big,sizeof(big));
+        lpTestAssertEntry(lpPrev(lp,lpLast(lp)),big,sizeof(big));
+        lpTestAssertEntry(lpPrev(lp,p),"a",1);
+        lp = lpReplace(lp,&p,(unsigned char*)"100",3);
+        lpTestAssertEntry(lpNext(lp,p),"c",1);
+        lpTestAssert(lpLength(lp) == 3, "length after replace");
+
+        lp = lpDelete(lp,p,&p);
+        lpTestAssertEntry(p,"c",1);
+        lp = lpDelete(lp,p,&p);
+        lpTestAssert(p == NULL, "delete the last entry");
+        lpTestAssert(lpLength(lp) == 1, "length after delete");
+        lpTestAssert(lpValidateIntegrity(lp,lpBytes(lp)), "integrity");
+
+        lp = lpDeleteRange(lp,0,10);
+        lpTestAssert(lpLength(lp) == 0 && lpBytes(lp) == LP_HDR_SIZE+1,
+                     "delete range");
+        lpFree(lp);
+        printf("OK\n");
+    }
+
+    printf("Batch append: ");
+    {
+        listpackEntry entries[4] = {
+            {(unsigned char*)"hello",5,0},
+            {NULL,0,-4096},
+            {(unsigned char*)"127",3,0},
+            {(unsigned char*)"1.5",3,0}
+        };
+        unsigned char *ref = lpNew();
+
+        lp = lpAppend(lpNew(),(unsigned char*)"first",5);
+        ref = lpAppend(ref,(unsigned char*)"first",5);
+        lp = lpBatchAppend(lp,entries,4);
+        ref = lpAppend(ref,(unsigned char*)"hello",5);
+        ref = lpAppend(ref,(unsigned char*)"-4096",5);
+        ref = lpAppend(ref,(unsigned char*)"127",3);
+        ref = lpAppend(ref,(unsigned char*)"1.5",3);
+        lpTestAssert(lpBytes(lp) == lpBytes(ref) &&
+                     memcmp(lp,ref,lpBytes(lp)) == 0, "same as lpAppend()");
+        lpTestAssert(lpLength(lp) == 5, "length");
+        lpFree(ref);
+        lpFree(lp);
+        printf("OK\n");
+    }
+
+    printf("Find with skip: ");
+    {
+        lp = lpNew();
+        for (j = 0; j < 100; j++) {
+            char buf[32];
+            int len = snprintf(buf,sizeof(buf),"%d",j);
+            lp = lpAppend(lp,(unsigned char*)buf,len);
+            lp = lpAppend(lp,(unsigned char*)"value",5);
+        }
+        p = lpFind(lp,lpFirst(lp),(unsigned char*)"42",2,1);
+        lpTestAssert(p == lpSeek(lp,84), "find integer");
+        p = lpFind(lp,lpFirst(lp),(unsigned char*)"value",5,1);
+        lpTestAssert(p == NULL, "values skipped");
+        p = lpFind(lp,lpSeek(lp,1),(unsigned char*)"value",5,1);
+        lpTestAssert(p == lpSeek(lp,1), "find string");
+        lpFree(lp);
+        printf("OK\n");
+    }
+
+    printf("More than 65535 entries: ");
+    {
+        lp = lpNew();
+        for (j = 0; j < 70000; j++)
+            lp = lpAppend(lp,(unsigned char*)"1",1);
+        lpTestAssert(lpLength(lp) == 70000, "length");
+        lp = lpDeleteRange(lp,-10000,10000);
+        lpTestAssert(lpLength(lp) == 60000, "length after delete range");
+        lpTestAssert(lpGetNumElements(lp) == 60000, "length cached again");
+        lpFree(lp);
+        printf("OK\n");
+    }
+
+    printf("Random operations against a reference array: ");
+    {
+        char *ref[512], buf[512];
+        unsigned int reflen[512], len;
+        int count = 0, iter, k;
+
+        lp = lpNew();
+        for (iter = 0; iter < 20000; iter++) {
+            int op = rand() % 3, idx;
+
+            if (op == 0 || count == 0) {
+                if (count == 512) continue;
+                len = lpTestRandomElement(buf,300);
+                idx = rand() % (count+1);
+                if (idx == count) {
+                    lp = lpAppend(lp,(unsigned char*)buf,len);
+                } else {
+                    lp = lpInsert(lp,(unsigned char*)buf,len,lpSeek(lp,idx),
+                                  LP_BEFORE,NULL);
+                }
+                memmove(ref+idx+1,ref+idx,sizeof(char*)*(count-idx));
+                memmove(reflen+idx+1,reflen+idx,
+                        sizeof(unsigned int)*(count-idx));
+                ref[idx] = zmalloc(len+1);
+                memcpy(ref[idx],buf,len);
+                reflen[idx] = len;
+                count++;
+            } else if (op == 1) {
+                idx = rand() % count;
+                len = lpTestRandomElement(buf,300);
+                p = lpSeek(lp,idx);
+                lp = lpReplace(lp,&p,(unsigned char*)buf,len);
+                zfree(ref[idx]);
+                ref[idx] = zmalloc(len+1);
+                memcpy(ref[idx],buf,len);
+                reflen[idx] = len;
+            } else {
+                idx = rand() % count;
+                lp = lpDelete(lp,lpSeek(lp,idx),NULL);
+                zfree(ref[idx]);
+                memmove(ref+idx,ref+idx+1,sizeof(char*)*(count-idx-1));
+                memmove(reflen+idx,reflen+idx+1,
+                        sizeof(unsigned int)*(count-idx-1));
+                count--;
+            }
+        }
+        lpTestAssert(lpLength(lp) == (unsigned long)count, "length");
+        lpTestAssert(lpValidateIntegrity(lp,lpBytes(lp)), "integrity");
+        p = lpFirst(lp);
+        for (k = 0; k < count; k++) {
+            lpTestAssertEntry(p,ref[k],reflen[k]);
+            p = lpNext(lp,p);
+        }
+        p = lpLast(lp);
+        for (k = count-1; k >= 0; k--) {
+            lpTestAssertEntry(p,ref[k],reflen[k]);
+            p = lpPrev(lp,p);
+            zfree(ref[k]);
+        }
+        lpFree(lp);
+        printf("OK\n");
+    }
+
+    /* Entries of 250 bytes have a 1 byte previous entry length in the
+     * ziplist: inserting a 300 bytes entry at the head makes every one of
+     * them grow to 5 bytes, one after the other. */
+    printf("Insert at the head of 2000 entries of 250 bytes: ");
+    {
+        /* With a ziplist this insert makes every entry grow its prevlen
+         * field from 1 to 5 bytes, a cascade update touching the whole
+         * list. The listpack must only grow by the size of the new entry. */
+        char val[300];
+        size_t before;
+        long long start, elapsed;
+
+        memset(val,'x',sizeof(val));
+        lp = lpNew();
+        for (j = 0; j < 2000; j++)
+            lp = lpAppend(lp,(unsigned char*)val,250);
+        before = lpBytes(lp);
+        start = lpTestUsec();
+        lp = lpInsert(lp,(unsigned char*)val,300,lpFirst(lp),LP_BEFORE,NULL);
+        elapsed = lpTestUsec()-start;
+        lpTestAssert(lpBytes(lp) == before+2+300+2, "no cascade");
+        lpTestAssert(lpValidateIntegrity(lp,lpBytes(lp)), "integrity");
+        lpFree(lp);
+        printf("OK (%lld usec)\n", elapsed);
+    }
+    return 0;
+}
+#endif
@@ -30,12 +30,47 @@
 #include "server.h"
 #include <sys/uio.h>
 #include <math.h>
+#include <limits.h>
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
 
 /*
 在 ‌Linux/Unix 系统‌中，属于系统级头文件（位于 sys/uio.h），用于系统调用如 readv() 和 writev()
 */
 
-static void setProtocolError(client *c, int pos);
+static void setProtocolError(client *c);
+
+/* Threaded I/O state, see the "Threaded I/O" section at the end of the file.
+ * It is declared here since the read, write and free paths need to know if
+ * they are running inside an I/O thread: in that case the global client
+ * lists must not be touched, and clients are freed asynchronously. */
+#define IO_THREADS_OP_IDLE 0
+#define IO_THREADS_OP_READ 1
+#define IO_THREADS_OP_WRITE 2
+static int io_threads_op = IO_THREADS_OP_IDLE;
+static int ProcessingEventsWhileBlocked = 0;
+
+/* Return true if we are currently inside the parallel phase of the threaded
+ * I/O, executing in an I/O thread or in the main thread serving its share
+ * of the clients. */
+#define inThreadedIOContext() (io_threads_op != IO_THREADS_OP_IDLE)
+
+static int postponeClientRead(client *c);
+static void processClientsWithPendingReads(void);
+static int handleClientsWithPendingReads(void);
+static int _writeToClientDone(client *c, ssize_t nwritten, ssize_t totwritten,
+                              int handler_installed);
+
+/* Free the client synchronously when we are single threaded, otherwise
+ * just schedule it for asynchronous freeing. */
+static void freeClientFromIO(client *c) {
+    if (inThreadedIOContext())
+        freeClientAsync(c);
+    else
+        freeClient(c);
+}
 
 //为特定sds字符串返回分配器消费的大小
 
@@ -71,6 +106,103 @@ int listMatchObjects(void *a, void *b) {
     return equalStringObjects(a,b);
 }
 
+/* -----------------------------------------------------------------------------
+ * Client buffers pool
+ * -------------------------------------------------------------------------- */
+
+/*
+  客户端的回复缓冲区和查询缓冲区只在需要的时候分配，空闲的客户端会在clientsCron中
+  把缓冲区还给这里的池，这样大量空闲连接不会各自占着16kb的缓冲区
+*/
+/* The reply buffer and the query buffer of a client are only allocated when
+ * needed, and clients that are idle give them back to this pool from
+ * clientsCron(), so that a lot of idle connections don't hold 16k buffers
+ * each. The pool is only touched by the main thread: I/O threads needing a
+ * buffer just allocate a new one.
+ *
+ * The pooled buffers count as used memory for maxmemory, so the pool is
+ * small, and the buffers nobody took for a while are freed, see
+ * trimClientBuffersPool(). */
+static struct {
+    char *reply[CLIENT_BUFFERS_POOL_LEN];
+    sds query[CLIENT_BUFFERS_POOL_LEN];
+    int reply_len, query_len;
+    int reply_low, query_low;   /* Min length since the last trim. */
+} bufpool;
+
+/* Get a PROTO_REPLY_CHUNK_BYTES bytes reply buffer for the client. */
+static void getClientReplyBuffer(client *c) {
+    if (!inThreadedIOContext() && bufpool.reply_len) {
+        c->buf = bufpool.reply[--bufpool.reply_len];
+        if (bufpool.reply_len < bufpool.reply_low)
+            bufpool.reply_low = bufpool.reply_len;
+    } else
+        c->buf = zmalloc(PROTO_REPLY_CHUNK_BYTES);
+}
+
+/* Get an empty query buffer with room for PROTO_IOBUF_LEN bytes. */
+static void getClientQueryBuffer(client *c) {
+    if (!inThreadedIOContext() && bufpool.query_len) {
+        c->querybuf = bufpool.query[--bufpool.query_len];
+        if (bufpool.query_len < bufpool.query_low)
+            bufpool.query_low = bufpool.query_len;
+    } else
+        c->querybuf = sdsMakeRoomFor(sdsempty(),PROTO_IOBUF_LEN);
+}
+
+/* Give back the reply buffer of the client, that must be empty, to the
+ * pool. Only called by the main thread. */
+void releaseClientReplyBuffer(client *c) {
+    if (c->buf == NULL) return;
+    serverAssert(c->bufpos == 0);
+    if (bufpool.reply_len < CLIENT_BUFFERS_POOL_LEN)
+        bufpool.reply[bufpool.reply_len++] = c->buf;
+    else
+        zfree(c->buf);
+    c->buf = NULL;
+}
+
+/* Give back the query buffer of the client to the pool. Buffers that grew
+ * more than what getClientQueryBuffer() allocates are just freed. Only
+ * called by the main thread. */
+void releaseClientQueryBuffer(client *c) {
+    if (c->querybuf == NULL) return;
+    if (bufpool.query_len < CLIENT_BUFFERS_POOL_LEN &&
+        sdsalloc(c->querybuf) >= PROTO_IOBUF_LEN &&
+        sdsalloc(c->querybuf) <= PROTO_IOBUF_LEN*2)
+    {
+        sdsclear(c->querybuf);
+        bufpool.query[bufpool.query_len++] = c->querybuf;
+    } else {
+        sdsfree(c->querybuf);
+    }
+    c->querybuf = NULL;
+    c->qb_pos = 0;
+}
+
+/* Free the buffers that stayed in the pool since the previous call, that is
+ * as many as the lowest length the pool had meanwhile: they were not needed,
+ * so there is no point in keeping that memory busy. Called once per second
+ * by serverCron(). */
+void trimClientBuffersPool(void) {
+    while (bufpool.reply_low-- > 0)
+        zfree(bufpool.reply[--bufpool.reply_len]);
+    while (bufpool.query_low-- > 0)
+        sdsfree(bufpool.query[--bufpool.query_len]);
+    bufpool.reply_low = bufpool.reply_len;
+    bufpool.query_low = bufpool.query_len;
+}
+
+/* Return the memory used by the buffers sitting in the pool. */
+size_t getClientBuffersPoolMemory(void) {
+    size_t mem = (size_t)bufpool.reply_len*PROTO_REPLY_CHUNK_BYTES;
+    int j;
+
+    for (j = 0; j < bufpool.query_len; j++)
+        mem += sdsAllocSize(bufpool.query[j]);
+    return mem;
+}
+
 client *createClient(int fd) {
     client *c = zmalloc(sizeof(client));
 
@@ -108,13 +240,15 @@ client *createClient(int fd) {
     c->id = server.next_client_id++;
     c->fd = fd;
     c->name = NULL;
+    c->buf = NULL; //回复缓冲区在第一次回复时才分配
     c->bufpos = 0;
     /*
       客户端查询缓冲区相关 
       
       clientCron中 会有 clientsCronResizeQueryBuffer 的操作
     */
-    c->querybuf = sdsempty();//创建了sds字符串 initLen等于0
+    c->querybuf = NULL; //第一次读取时从池中获取
+    c->qb_pos = 0; //querybuf中已经解析到的位置
     c->querybuf_peak = 0; //最近（100ms或以上）查询大小的峰值
     /* 客户端查询缓冲区相关 */
 
@@ -131,11 +265,13 @@ client *createClient(int fd) {
     c->replstate = REPL_STATE_NONE;
     c->repl_put_online_on_ack = 0;
     c->reploff = 0;
+    c->read_reploff = 0;
     c->repl_ack_off = 0;
     c->repl_ack_time = 0;
     c->slave_listening_port = 0;
     c->slave_ip[0] = '\0';
     c->slave_capa = SLAVE_CAPA_NONE;
+    c->pending_querybuf = sdsempty();
     c->reply = listCreate();
     c->reply_bytes = 0;
     c->obuf_soft_limit_reached_time = 0;
@@ -237,6 +373,7 @@ int prepareClientToWrite(client *c) {
      * receive writes at this stage. */
     if (!clientHasPendingReplies(c) &&
         !(c->flags & CLIENT_PENDING_WRITE) &&
+        !(c->flags & CLIENT_PENDING_READ) &&
         (c->replstate == REPL_STATE_NONE ||
          (c->replstate == SLAVE_STATE_ONLINE && !c->repl_put_online_on_ack)))
     {
@@ -261,22 +398,6 @@ int prepareClientToWrite(client *c) {
     return C_OK;
 }
 
-/* Create a duplicate of the last object in the reply list when
- * it is not exclusively owned by the reply list. */
-robj *dupLastObjectIfNeeded(list *reply) {
-    robj *new, *cur;
-    listNode *ln;
-    serverAssert(listLength(reply) > 0);
-    ln = listLast(reply);
-    cur = listNodeValue(ln);
-    if (cur->refcount > 1) {
-        new = dupStringObject(cur);
-        decrRefCount(cur);
-        listNodeValue(ln) = new;
-    }
-    return listNodeValue(ln);
-}
-
 /* -----------------------------------------------------------------------------
  * Low level functions to add more data to output buffers.
  * -------------------------------------------------------------------------- */
@@ -285,7 +406,7 @@ int _addReplyToBuffer(client *c, const char *s, size_t len) {
 
 
     //哦 因为buf只有16kb的容量
-    size_t available = sizeof(c->buf)-c->bufpos;
+    size_t available = PROTO_REPLY_CHUNK_BYTES-c->bufpos;
 
     //如果标记了CLIENT_CLOSE_AFTER_REPLY 就直接返回
     if (c->flags & CLIENT_CLOSE_AFTER_REPLY) return C_OK;
@@ -300,6 +421,9 @@ int _addReplyToBuffer(client *c, const char *s, size_t len) {
     /*确保缓存 有足够的 空间 被写入*/
     /* Check that the buffer has enough space available for this string. */
     if (len > available) return C_ERR;
+
+    /* The buffer is allocated with the first reply it holds. */
+    if (c->buf == NULL) getClientReplyBuffer(c);
     //memcpy严格根据第三个参数指定的‌字节数‌进行复制，不主动检查或处理\0字符
     //所以s字符数组中间有\0字符 也会复制到c->buf中
     memcpy(c->buf+c->bufpos,s,len);
@@ -325,15 +449,17 @@ void _addReplyObjectToList(client *c, robj *o) {
     } else {
         tail = listNodeValue(listLast(c->reply));
 
-        /* Append to this object when possible. */
+        /* Append to this object when possible. Objects that are also
+         * referenced elsewhere are never modified (this is true for all the
+         * appending functions below): they may be values of the keyspace
+         * or reply blocks shared with other clients, see addReplyShared(). */
         /*PROTO_REPLY_CHUNK_BYTES = 16 kb  16*1024个字节*/
         //小于16kb的时候就追加tail字符串
         if (tail->ptr != NULL &&
-            tail->encoding == OBJ_ENCODING_RAW &&
+            tail->encoding == OBJ_ENCODING_RAW && tail->refcount == 1 &&
             sdslen(tail->ptr)+sdslen(o->ptr) <= PROTO_REPLY_CHUNK_BYTES)
         {
             c->reply_bytes -= sdsZmallocSize(tail->ptr);
-            tail = dupLastObjectIfNeeded(c->reply);
             tail->ptr = sdscatlen(tail->ptr,o->ptr,sdslen(o->ptr));
             c->reply_bytes += sdsZmallocSize(tail->ptr);
         } else {
@@ -366,10 +492,10 @@ void _addReplySdsToList(client *c, sds s) {
 
         /* Append to this object when possible. */
         if (tail->ptr != NULL && tail->encoding == OBJ_ENCODING_RAW &&
+            tail->refcount == 1 &&
             sdslen(tail->ptr)+sdslen(s) <= PROTO_REPLY_CHUNK_BYTES)
         {
             c->reply_bytes -= sdsZmallocSize(tail->ptr);
-            tail = dupLastObjectIfNeeded(c->reply);
             tail->ptr = sdscatlen(tail->ptr,s,sdslen(s));
             c->reply_bytes += sdsZmallocSize(tail->ptr);
             sdsfree(s);
@@ -396,10 +522,10 @@ void _addReplyStringToList(client *c, const char *s, size_t len) {
 
         /* Append to this object when possible. */
         if (tail->ptr != NULL && tail->encoding == OBJ_ENCODING_RAW &&
+            tail->refcount == 1 &&
             sdslen(tail->ptr)+len <= PROTO_REPLY_CHUNK_BYTES)
         {
             c->reply_bytes -= sdsZmallocSize(tail->ptr);
-            tail = dupLastObjectIfNeeded(c->reply);
             tail->ptr = sdscatlen(tail->ptr,s,len);
             c->reply_bytes += sdsZmallocSize(tail->ptr);
         } else {
@@ -452,7 +578,7 @@ void addReply(client *c, robj *obj) {
         /* Optimization: if there is room in the static buffer for 32 bytes
          * (more than the max chars a 64 bit integer can take as string) we
          * avoid decoding the object and go for the lower level approach. */
-        if (listLength(c->reply) == 0 && (sizeof(c->buf) - c->bufpos) >= 32) {
+        if (listLength(c->reply) == 0 && (PROTO_REPLY_CHUNK_BYTES - c->bufpos) >= 32) {
             char buf[32];
             int len;
 
@@ -476,6 +602,32 @@ void addReply(client *c, robj *obj) {
     }
 }
 
+//同一份回复发送给多个客户端时（slave，订阅者），只编码一次，各个客户端的回复列表引用同一个对象
+/* Add a reply block shared by the output buffers of several clients, like
+ * the replication stream sent to the slaves or a message published to the
+ * subscribers of a channel. The block is a string object holding the
+ * protocol, that must not be modified once passed to this function.
+ *
+ * Blocks of at least PROTO_SHARED_REPLY_MIN_BYTES are linked by reference
+ * in the reply list, so that sending the same data to N clients does not
+ * need N copies. Smaller blocks are copied like addReply() does: a list
+ * node, and a write, for each of them would cost more than the copy. */
+void addReplyShared(client *c, robj *block) {
+    size_t len = sdslen(block->ptr);
+
+    if (prepareClientToWrite(c) != C_OK) return;
+    if (len < PROTO_SHARED_REPLY_MIN_BYTES) {
+        if (_addReplyToBuffer(c,block->ptr,len) != C_OK)
+            _addReplyStringToList(c,block->ptr,len);
+        return;
+    }
+    if (c->flags & CLIENT_CLOSE_AFTER_REPLY) return;
+    incrRefCount(block);
+    listAddNodeTail(c->reply,block);
+    c->reply_bytes += getStringObjectSdsUsedMemory(block);
+    asyncCloseClientOnOutputBufferLimitReached(c);
+}
+
 void addReplySds(client *c, sds s) {
     if (prepareClientToWrite(c) != C_OK) {
         /* The caller expects the sds to be free'd. */
@@ -719,7 +871,8 @@ void addReplyBulkLongLong(client *c, long long ll) {
 void copyClientOutputBuffer(client *dst, client *src) {
     listRelease(dst->reply);
     dst->reply = listDup(src->reply);
-    memcpy(dst->buf,src->buf,src->bufpos);
+    if (src->bufpos && dst->buf == NULL) getClientReplyBuffer(dst);
+    if (src->bufpos) memcpy(dst->buf,src->buf,src->bufpos);
     dst->bufpos = src->bufpos;
     dst->reply_bytes = src->reply_bytes;
 }
@@ -945,6 +1098,14 @@ void unlinkClient(client *c) {
         c->flags &= ~CLIENT_PENDING_WRITE;
     }
 
+    /* Remove from the list of pending reads if needed. */
+    if (c->flags & CLIENT_PENDING_READ) {
+        ln = listSearchKey(server.clients_pending_read,c);
+        serverAssert(ln != NULL);
+        listDelNode(server.clients_pending_read,ln);
+        c->flags &= ~(CLIENT_PENDING_READ|CLIENT_PENDING_COMMAND);
+    }
+
     /* When client was just unblocked because of a blocking operation,
      * remove it from the list of unblocked clients. */
     if (c->flags & CLIENT_UNBLOCKED) {
@@ -989,8 +1150,8 @@ void freeClient(client *c) {
     }
 
     /* Free the query buffer */
-    sdsfree(c->querybuf);
-    c->querybuf = NULL;
+    releaseClientQueryBuffer(c);
+    sdsfree(c->pending_querybuf);
 
     /* Deallocate structures used to block on blocking ops. */
     if (c->flags & CLIENT_BLOCKED) unblockClient(c);
@@ -1008,6 +1169,8 @@ void freeClient(client *c) {
 
     /* Free data structures. */
     listRelease(c->reply);
+    c->bufpos = 0;
+    releaseClientReplyBuffer(c);
     freeClientArgv(c);
 
     /* Unlink the client: this will close the socket, remove the I/O
@@ -1058,11 +1221,22 @@ void freeClient(client *c) {
 /* Schedule a client to free it at a safe time in the serverCron() function.
  * This function is useful when we need to terminate a client but we are in
  * a context where calling freeClient() is not possible, because the client
- * should be valid for the continuation of the flow of the program. */
+ * should be valid for the continuation of the flow of the program.
+ *
+ * This is also the only way I/O threads are allowed to close a client, so
+ * the queue is protected by a mutex when threaded I/O is enabled. */
 void freeClientAsync(client *c) {
+    static pthread_mutex_t async_free_queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+
     if (c->flags & CLIENT_CLOSE_ASAP || c->flags & CLIENT_LUA) return;
     c->flags |= CLIENT_CLOSE_ASAP;
-    listAddNodeTail(server.clients_to_close,c);
+    if (server.io_threads_num == 1) {
+        listAddNodeTail(server.clients_to_close,c);
+    } else {
+        pthread_mutex_lock(&async_free_queue_mutex);
+        listAddNodeTail(server.clients_to_close,c);
+        pthread_mutex_unlock(&async_free_queue_mutex);
+    }
 }
 
 void freeClientsInAsyncFreeQueue(void) {
@@ -1076,61 +1250,115 @@ void freeClientsInAsyncFreeQueue(void) {
     }
 }
 
+/* Fill 'iov' with the pending replies of the client: the static buffer, if
+ * not empty, and the objects of the reply list, up to 'iovmax' buffers and
+ * NET_MAX_WRITES_PER_EVENT bytes (a single object can be bigger than that).
+ * Returns the number of buffers, that may be zero if the reply list only has
+ * empty objects. */
+static int _clientReplyToIovec(client *c, struct iovec *iov, int iovmax) {
+    int iovcnt = 0;
+    size_t iovbytes = 0;
+    size_t offset = c->sentlen;
+    listIter li;
+    listNode *ln;
+    robj *o;
+
+    //最多iovmax个缓冲，一次系统调用写出
+    if (c->bufpos > 0) {
+        iov[iovcnt].iov_base = c->buf+c->sentlen;
+        iov[iovcnt].iov_len = c->bufpos-c->sentlen;
+        iovbytes += iov[iovcnt++].iov_len;
+        offset = 0; /* sentlen refers to the static buffer. */
+    }
+    listRewind(c->reply,&li);
+    while((ln = listNext(&li)) && iovcnt < iovmax &&
+          iovbytes < NET_MAX_WRITES_PER_EVENT)
+    {
+        size_t objlen;
+
+        o = listNodeValue(ln);
+        objlen = sdslen(o->ptr);
+        if (objlen == 0) continue; /* Removed below. */
+        iov[iovcnt].iov_base = ((char*)o->ptr)+offset;
+        iov[iovcnt].iov_len = objlen-offset;
+        iovbytes += iov[iovcnt++].iov_len;
+        offset = 0;
+    }
+    return iovcnt;
+}
+
+/* Remove the 'nwritten' bytes written from the buffers filled by
+ * _clientReplyToIovec(): the static buffer first, then the objects of the
+ * list, possibly stopping in the middle of one of them. The empty objects
+ * met on the way are removed as well. */
+static void _clientReplyWritten(client *c, size_t nwritten) {
+    size_t remaining = nwritten;
+    robj *o;
+
+    if (c->bufpos > 0) {
+        size_t buflen = c->bufpos-c->sentlen;
+
+        if (remaining < buflen) {
+            c->sentlen += remaining;
+            return;
+        }
+        remaining -= buflen;
+        c->bufpos = 0;
+        c->sentlen = 0;
+    }
+    while(listLength(c->reply)) {
+        size_t objlen;
+
+        o = listNodeValue(listFirst(c->reply));
+        objlen = sdslen(o->ptr);
+        if (objlen-c->sentlen > remaining) {
+            c->sentlen += remaining;
+            break;
+        }
+        remaining -= objlen-c->sentlen;
+        c->reply_bytes -= getStringObjectSdsUsedMemory(o);
+        listDelNode(c->reply,listFirst(c->reply));
+        c->sentlen = 0;
+    }
+}
+
+/* Write with a single writev() the pending replies of the client, up to
+ * IOV_MAX buffers, see _clientReplyToIovec(). The written data is then
+ * removed from the buffers, also when it ends in the middle of a buffer.
+ *
+ * Returns the return value of writev(). */
+static ssize_t _writevToClient(int fd, client *c) {
+    struct iovec iov[IOV_MAX];
+    int iovcnt = _clientReplyToIovec(c,iov,IOV_MAX);
+    ssize_t nwritten;
+
+    if (iovcnt == 0) {
+        nwritten = 0; /* Just empty objects in the reply list. */
+    } else {
+        nwritten = writev(fd,iov,iovcnt);
+        if (nwritten <= 0) return nwritten;
+        atomicIncr(server.stat_reply_write_syscalls,1);
+    }
+    _clientReplyWritten(c,nwritten);
+    return nwritten;
+}
+
 /* Write data in output buffers to client. Return C_OK if the client
  * is still valid after the call, C_ERR if it was freed. */
 int writeToClient(int fd, client *c, int handler_installed) {
     ssize_t nwritten = 0, totwritten = 0;
-    size_t objlen;
-    size_t objmem;
-    robj *o;
 
     //有挂起的回复消息时
     // bufpos 大于0 或者 reply列表有对象时
+    //静态缓冲和回复列表的多个对象用一次writev写出
     while(clientHasPendingReplies(c)) {
+        nwritten = _writevToClient(fd,c);
+        if (nwritten < 0) break;
+        totwritten += nwritten;
+        /* Nothing written, but a few empty objects may have been removed
+         * from the list: try again only if there is more to write. */
+        if (nwritten == 0 && (c->bufpos > 0 || listLength(c->reply))) break;
 
-        //判断bufpos 是因为好判断 真正是在buf里
-        if (c->bufpos > 0) {
-            //直接写
-            // //写回客户端
-            nwritten = write(fd,c->buf+c->sentlen,c->bufpos-c->sentlen);
-            if (nwritten <= 0) break;
-            c->sentlen += nwritten;
-            totwritten += nwritten;
-
-            /* If the buffer was sent, set bufpos to zero to continue with
-             * the remainder of the reply. */
-            /*
-               缓冲已经发送，设置bufpos为0 
-            */
-            if ((int)c->sentlen == c->bufpos) {
-                c->bufpos = 0;
-                c->sentlen = 0;
-            }
-        } else {
-            
-            // 客户端c回复列表
-            o = listNodeValue(listFirst(c->reply));
-            objlen = sdslen(o->ptr);
-            objmem = getStringObjectSdsUsedMemory(o);
-
-            if (objlen == 0) {
-                listDelNode(c->reply,listFirst(c->reply));
-                c->reply_bytes -= objmem;
-                continue;
-            }
-            //写回客户端
-            nwritten = write(fd, ((char*)o->ptr)+c->sentlen,objlen-c->sentlen);
-            if (nwritten <= 0) break;
-            c->sentlen += nwritten;
-            totwritten += nwritten;
-
-            /* If we fully sent the object on head go to the next one */
-            if (c->sentlen == objlen) {
-                listDelNode(c->reply,listFirst(c->reply));
-                c->sentlen = 0;
-                c->reply_bytes -= objmem;
-            }
-        }
         /*
         注意，我们避免发送超过NET_MAX_WRITES_PER_EVENT字节，在单线程服务器中，服务其他客户端也是一个好主意，
         即使一个非常大的请求来自总是能够接受数据的超级快速链接（在现实世界的场景中，考虑对环回接口的‘KEYS *’）
@@ -1158,14 +1386,25 @@ int writeToClient(int fd, client *c, int handler_installed) {
             (server.maxmemory == 0 ||
              zmalloc_used_memory() < server.maxmemory)) break;
     }
-    server.stat_net_output_bytes += totwritten;
+    return _writeToClientDone(c,nwritten,totwritten,handler_installed);
+}
+
+/* Account the 'totwritten' bytes written to the client by writeToClient(),
+ * or by a batch of writes, and handle the result of the last write,
+ * 'nwritten', with its errno. Return C_OK if the client is still valid, C_ERR
+ * if it was freed. */
+static int _writeToClientDone(client *c, ssize_t nwritten, ssize_t totwritten,
+                              int handler_installed)
+{
+    atomicIncr(server.stat_net_output_bytes, totwritten);
+    atomicIncr(server.stat_reply_write_bytes, totwritten);
     if (nwritten == -1) {
         if (errno == EAGAIN) {
             nwritten = 0;
         } else {
             serverLog(LL_VERBOSE,
                 "Error writing to client: %s", strerror(errno));
-            freeClient(c);
+            freeClientFromIO(c);
             return C_ERR;
         }
     }
@@ -1200,7 +1439,7 @@ int writeToClient(int fd, client *c, int handler_installed) {
         */
         /* Close connection after entire reply has been sent. */
         if (c->flags & CLIENT_CLOSE_AFTER_REPLY) {
-            freeClient(c);
+            freeClientFromIO(c);
             return C_ERR;
         }
     }
@@ -1219,6 +1458,103 @@ void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask) {
     writeToClient(fd,privdata,1);
 }
 
+/* Install the writable event handler for a client that still has data to
+ * send after the synchronous writes performed before re-entering the event
+ * loop. If the handler can't be installed the client is freed ASAP. */
+static void installClientWriteHandler(client *c) {
+    int ae_flags = AE_WRITABLE;
+    /* For the fsync=always policy, we want that a given FD is never
+     * served for reading and writing in the same event loop iteration,
+     * so that in the middle of receiving the query, and serving it
+     * to the client, we'll call beforeSleep() that will do the
+     * actual fsync of AOF to disk. AE_BARRIER ensures that. */
+    /**
+     * 对于fsync=always策略，我们希望给定的FD永远不会在同一个事件循环迭代中用于读和写，
+     * 因此在接收查询并将其提供给客户端的过程中，我们将调用beforeSleep（），它将对磁盘执行AOF的实际fsync
+     * 
+     *  这个意思是说读取客户端 执行命令 之后 不要再写回客户端
+     * 
+     *  所以 利用beforeSleep 方法 执行真正的aof同步到磁盘
+    */
+    /**
+    * fsync=always策略是每次命令都同步写入
+    * 
+    * //这里为什么这样 我的理解是 
+    * 因为 读事件中 执行了 命令之后 是把回复消息 写入了缓存c->buf中 不是立马写入客户端的
+    * 
+    * 
+    */
+    if (server.aof_state == AOF_ON &&
+        server.aof_fsync == AOF_FSYNC_ALWAYS)
+    {
+        //因为在这种情况下 在这个方法执行之前 执行了 aof写入磁盘操作
+        //所以必须 立马回复客户端 所以 这里要执行反转操作
+        //确保 写回客户端操作在执行 读 事件之前执行
+
+        //确保写事件在读事件之前触发
+        ae_flags |= AE_BARRIER;
+    }
+    //注册一个写事件，写回客户端
+    //注册失败 才会 异步释放这个客户端
+
+    //sendReplyToClient 内部才会 设置 删除事件
+    //这里可以防止 万一 sendReply中删除了这个事件？
+    if (aeCreateFileEvent(server.el, c->fd, ae_flags,
+        sendReplyToClient, c) == AE_ERR)
+    {
+        freeClientAsync(c);
+    }
+}
+
+/* Serve like handleClientsWithPendingWrites() the first NET_IO_BATCH clients
+ * of the pending writes, but submit their first writev() together with a
+ * single aeSubmitIO() call. The replies that don't fit in NET_IO_BATCH_IOV
+ * buffers are then completed by writeToClient() as usual. */
+static void writeToClientsInBatch(void) {
+    struct iovec iov[NET_IO_BATCH][NET_IO_BATCH_IOV];
+    size_t iovbytes[NET_IO_BATCH];
+    client *clients[NET_IO_BATCH];
+    aeIO ios[NET_IO_BATCH];
+    int numclients = 0, j, k;
+
+    while(listLength(server.clients_pending_write) &&
+          numclients < NET_IO_BATCH)
+    {
+        listNode *ln = listFirst(server.clients_pending_write);
+        client *c = listNodeValue(ln);
+        aeIO *io = &ios[numclients];
+
+        c->flags &= ~CLIENT_PENDING_WRITE;
+        listDelNode(server.clients_pending_write,ln);
+        io->op = AE_IO_WRITEV;
+        io->fd = c->fd;
+        io->iov = iov[numclients];
+        io->iovcnt = _clientReplyToIovec(c,io->iov,NET_IO_BATCH_IOV);
+        iovbytes[numclients] = 0;
+        for (k = 0; k < io->iovcnt; k++)
+            iovbytes[numclients] += io->iov[k].iov_len;
+        clients[numclients++] = c;
+    }
+    aeSubmitIO(server.el,ios,numclients);
+    atomicIncr(server.stat_reply_write_syscalls,1);
+
+    for (j = 0; j < numclients; j++) {
+        client *c = clients[j];
+        ssize_t nwritten = ios[j].res;
+
+        if (nwritten >= 0) _clientReplyWritten(c,nwritten);
+        errno = ios[j].err;
+        if (_writeToClientDone(c,nwritten,nwritten > 0 ? nwritten : 0,0) ==
+            C_ERR) continue;
+
+        /* Go on with the rest of the reply if the socket took it all. */
+        if (clientHasPendingReplies(c) &&
+            nwritten == (ssize_t)iovbytes[j] &&
+            writeToClient(c->fd,c,0) == C_ERR) continue;
+        if (clientHasPendingReplies(c)) installClientWriteHandler(c);
+    }
+}
+
 /**
  * @brief  这个函数仅在进入事件循环前调用
  * 希望我们可以只将回复写入客户端输出缓冲区，而不需要使用系统调用来安装可写事件处理程序，调用它等等
@@ -1232,6 +1568,14 @@ int handleClientsWithPendingWrites(void) {
     listNode *ln;
     int processed = listLength(server.clients_pending_write);
 
+    /* Write to all the clients with a few system calls if the event loop
+     * can batch the writes. */
+    if (aeCanBatchIO(server.el)) {
+        while(listLength(server.clients_pending_write))
+            writeToClientsInBatch();
+        return processed;
+    }
+
     listRewind(server.clients_pending_write,&li);
     while((ln = listNext(&li))) {
 
@@ -1252,50 +1596,7 @@ int handleClientsWithPendingWrites(void) {
         */
         /* If after the synchronous writes above we still have data to
          * output to the client, we need to install the writable handler. */
-        if (clientHasPendingReplies(c)) {
-            int ae_flags = AE_WRITABLE;
-            /* For the fsync=always policy, we want that a given FD is never
-             * served for reading and writing in the same event loop iteration,
-             * so that in the middle of receiving the query, and serving it
-             * to the client, we'll call beforeSleep() that will do the
-             * actual fsync of AOF to disk. AE_BARRIER ensures that. */
-            /**
-             * 对于fsync=always策略，我们希望给定的FD永远不会在同一个事件循环迭代中用于读和写，
-             * 因此在接收查询并将其提供给客户端的过程中，我们将调用beforeSleep（），它将对磁盘执行AOF的实际fsync
-             * 
-             *  这个意思是说读取客户端 执行命令 之后 不要再写回客户端
-             * 
-             *  所以 利用beforeSleep 方法 执行真正的aof同步到磁盘
-            */
-           /**
-            * fsync=always策略是每次命令都同步写入
-            * 
-            * //这里为什么这样 我的理解是 
-            * 因为 读事件中 执行了 命令之后 是把回复消息 写入了缓存c->buf中 不是立马写入客户端的
-            * 
-            * 
-           */
-            if (server.aof_state == AOF_ON &&
-                server.aof_fsync == AOF_FSYNC_ALWAYS)
-            {
-                //因为在这种情况下 在这个方法执行之前 执行了 aof写入磁盘操作
-                //所以必须 立马回复客户端 所以 这里要执行反转操作
-                //确保 写回客户端操作在执行 读 事件之前执行
-
-                //确保写事件在读事件之前触发
-                ae_flags |= AE_BARRIER;
-            }
-            //注册一个写事件，写回客户端
-            //注册失败 才会 异步释放这个客户端
-
-            //sendReplyToClient 内部才会 设置 删除事件
-            //这里可以防止 万一 sendReply中删除了这个事件？
-            if (aeCreateFileEvent(server.el, c->fd, ae_flags,
-                sendReplyToClient, c) == AE_ERR)
-            {
-                    freeClientAsync(c);
-            }
-        }
+        if (clientHasPendingReplies(c)) installClientWriteHandler(c);
     }
     return processed;
 }
@@ -1360,39 +1661,40 @@ int processInlineBuffer(client *c) {
     int argc, j;
     sds *argv, aux;
     size_t querylen;
+    int linefeed_chars = 1;
 
     /*查找行的结尾*/
     /* Search for end of line */
-    newline = strchr(c->querybuf,'\n');
+    newline = strchr(c->querybuf+c->qb_pos,'\n');
 
     /*如果没有\n 就直接报错*/
     /* Nothing to do without a \r\n */
     if (newline == NULL) {
         //最大缓冲区为 64 kb
-        if (sdslen(c->querybuf) > PROTO_INLINE_MAX_SIZE) {
+        if (sdslen(c->querybuf)-c->qb_pos > PROTO_INLINE_MAX_SIZE) {
             addReplyError(c,"Protocol error: too big inline request");
-            setProtocolError(c,0);
+            setProtocolError(c);
         }
         return C_ERR;
     }
 
     /*处理\r\n*/
     /* Handle the \r\n case. */
-    if (newline && newline != c->querybuf && *(newline-1) == '\r')
-        newline--;
+    if (newline && newline != c->querybuf+c->qb_pos && *(newline-1) == '\r')
+        newline--, linefeed_chars++;
 
     /* Split the input buffer up to the \r\n */
-    querylen = newline-(c->querybuf);
+    querylen = newline-(c->querybuf+c->qb_pos);
 
     //调用sdsnewlen后 querybuf还能使用
-    aux = sdsnewlen(c->querybuf,querylen);
+    aux = sdsnewlen(c->querybuf+c->qb_pos,querylen);
     
     //按空格分割字符串
     argv = sdssplitargs(aux,&argc);
     sdsfree(aux); //释放原来的sds
     if (argv == NULL) {
         addReplyError(c,"Protocol error: unbalanced quotes in request");
-        setProtocolError(c,0);
+        setProtocolError(c);
         return C_ERR;
     }
 
@@ -1407,10 +1709,11 @@ int processInlineBuffer(client *c) {
         c->repl_ack_time = server.unixtime;
 
     /*
-      在querybuf缓冲区中保留查询第一行之后的数据
+      跳过查询的第一行 剩下的数据留在querybuf中 由processInputBuffer统一截取
     */
-    /* Leave data after the first line of the query in the buffer */
-    sdsrange(c->querybuf,querylen+2,-1);
+    /* Move the read offset past the first line of the query: the data is
+     * trimmed from the buffer later by processInputBuffer(). */
+    c->qb_pos += querylen+linefeed_chars;
 
     /*在客户端结构上设置argv数组*/
     /* Setup argv array on client structure */
@@ -1435,9 +1738,10 @@ int processInlineBuffer(client *c) {
     return C_OK;
 }
 
-/* Helper function. Trims query buffer to make the function that processes
- * multi bulk requests idempotent. */
-static void setProtocolError(client *c, int pos) {
+/* Helper function. The client is closed after the error reply is sent, and
+ * processInputBuffer() stops parsing it as soon as the flag is set, so there
+ * is no need to trim the query buffer here. */
+static void setProtocolError(client *c) {
     if (server.verbosity <= LL_VERBOSE) {
         sds client = catClientInfoString(sdsempty(),c);
         serverLog(LL_VERBOSE,
@@ -1445,12 +1749,11 @@ static void setProtocolError(client *c, int pos) {
         sdsfree(client);
     }
     c->flags |= CLIENT_CLOSE_AFTER_REPLY;
-    sdsrange(c->querybuf,pos,-1);
 }
 
 int processMultibulkBuffer(client *c) {
     char *newline = NULL;
-    int pos = 0, ok;
+    int ok;
     long long ll;
 
     if (c->multibulklen == 0) {
@@ -1461,42 +1764,43 @@ int processMultibulkBuffer(client *c) {
 
         // 多块的长度 不可能没有\r\n
         /* Multi bulk length cannot be read without a \r\n */
-        newline = strchr(c->querybuf,'\r');
+        newline = strchr(c->querybuf+c->qb_pos,'\r');
         if (newline == NULL) {
             //64kb 也就是查询缓冲区不能大于64kb
             //竟然在newline为空的时候去判断
-            if (sdslen(c->querybuf) > PROTO_INLINE_MAX_SIZE) {
+            if (sdslen(c->querybuf)-c->qb_pos > PROTO_INLINE_MAX_SIZE) {
                 addReplyError(c,"Protocol error: too big mbulk count string");
-                setProtocolError(c,0);
+                setProtocolError(c);
             }
             return C_ERR;
         }
 
         /*缓冲区 也应该包含\n */
         /* Buffer should also contain \n */
-        if (newline-(c->querybuf) > ((signed)sdslen(c->querybuf)-2))
+        if (newline-(c->querybuf+c->qb_pos) >
+            (ssize_t)(sdslen(c->querybuf)-c->qb_pos-2))
             return C_ERR; //-1
 
         /* We know for sure there is a whole line since newline != NULL,
          * so go ahead and find out the multi bulk length. */
-        /*c->querybuf[0] 应该是*字符 */
-        serverAssertWithInfo(c,NULL,c->querybuf[0] == '*');
+        /*c->querybuf[c->qb_pos] 应该是*字符 */
+        serverAssertWithInfo(c,NULL,c->querybuf[c->qb_pos] == '*');
         /*获取*字符后面紧跟的 长度字符串 转换成long long 类型 */
         /* 比如 *20\r\n */
-        ok = string2ll(c->querybuf+1,newline-(c->querybuf+1),&ll);
+        ok = string2ll(c->querybuf+1+c->qb_pos,
+                       newline-(c->querybuf+1+c->qb_pos),&ll);
 
         //如果长度没有 或者 长度大于1 mb
         if (!ok || ll > 1024*1024) {
             addReplyError(c,"Protocol error: invalid multibulk length");
             //内部会设置 CLIENT_CLOSE_AFTER_REPLY 标记 
-            setProtocolError(c,pos);
+            setProtocolError(c);
             return C_ERR;
         }
-        /*设置 位置到\r\n后*/
-        pos = (newline-c->querybuf)+2;
+        /*设置 读取位置到\r\n后*/
+        c->qb_pos = (newline-c->querybuf)+2;
         if (ll <= 0) {
             //如果长度小于等于0 直接返回ok?
-            sdsrange(c->querybuf,pos,-1);
             return C_OK;
         }
 
@@ -1521,14 +1825,14 @@ int processMultibulkBuffer(client *c) {
             /*strchr函数功能为在一个串中查找给定字符的第一个匹配之处。
             函数原型为：char *strchr(const char *str, int c)，
             即在参数 str 所指向的字符串中搜索第一次出现字符 c（一个无符号字符）的位置*/
-            /*从 pos 开始查找 */
-            newline = strchr(c->querybuf+pos,'\r');
+            /*从 qb_pos 开始查找 */
+            newline = strchr(c->querybuf+c->qb_pos,'\r');
             if (newline == NULL) {
                 /*如果这时候 缓冲区大于64kb 也会返回 错误*/
-                if (sdslen(c->querybuf) > PROTO_INLINE_MAX_SIZE) {
+                if (sdslen(c->querybuf)-c->qb_pos > PROTO_INLINE_MAX_SIZE) {
                     addReplyError(c,
                         "Protocol error: too big bulk count string");
-                    setProtocolError(c,0);
+                    setProtocolError(c);
                     return C_ERR;
                 }
                 break;
@@ -1536,15 +1840,16 @@ int processMultibulkBuffer(client *c) {
             
             //必须包含换行符
             /* Buffer should also contain \n */
-            if (newline-(c->querybuf) > ((signed)sdslen(c->querybuf)-2))
+            if (newline-(c->querybuf+c->qb_pos) >
+                (ssize_t)(sdslen(c->querybuf)-c->qb_pos-2))
                 break;
 
-            /*如果pos当前位置 的字符不是$ 那就是违反协议了*/
-            if (c->querybuf[pos] != '$') {
+            /*如果qb_pos当前位置 的字符不是$ 那就是违反协议了*/
+            if (c->querybuf[c->qb_pos] != '$') {
                 addReplyErrorFormat(c,
                     "Protocol error: expected '$', got '%c'",
-                    c->querybuf[pos]);
-                setProtocolError(c,pos);
+                    c->querybuf[c->qb_pos]);
+                setProtocolError(c);
                 return C_ERR;
             }
 
@@ -1552,20 +1857,21 @@ int processMultibulkBuffer(client *c) {
             //+1 代表去掉$
             /*比如 *2\r\n$6\r\nSELECT\r\n$1\r\n0\r\n */
             //newline 为6字符开始 \r 第一次出现的位置
-            ok = string2ll(c->querybuf+pos+1,newline-(c->querybuf+pos+1),&ll);
+            ok = string2ll(c->querybuf+c->qb_pos+1,
+                           newline-(c->querybuf+c->qb_pos+1),&ll);
             //3.2还是有512mb的限制
             //https://ask.csdn.net/questions/7198670
             //https://github.com/redis/redis/issues/757
             //4.0版本已经改为 > proto_max_bulk_len 可以配置了
             if (!ok || ll < 0 || ll > 512*1024*1024) {
                 addReplyError(c,"Protocol error: invalid bulk length");
-                setProtocolError(c,pos);
+                setProtocolError(c);
                 return C_ERR;
             }
 
             /*比如 *2\r\n$6\r\nSELECT\r\n$1\r\n0\r\n */
-            /*这里pos就到达  SELECT 这里*/
-            pos += newline-(c->querybuf+pos)+2;
+            /*这里qb_pos就到达  SELECT 这里*/
+            c->qb_pos = newline-c->querybuf+2;
             //PROTO_MBULK_BIG_ARG = 1024*32
             //当客户端传过来的长度大于等于1024*32 时
             if (ll >= PROTO_MBULK_BIG_ARG) {
@@ -1583,9 +1889,9 @@ int processMultibulkBuffer(client *c) {
                  * boundary so that we can optimize object creation
                  * avoiding a large copy of data. */
                 //c->querybuf 变为实际参数字符串
-                /* 从pos截取整个字符串 */
-                sdsrange(c->querybuf,pos,-1); //内部是根据sdslen来获取整个querybuf长度的
-                pos = 0; //这里就等于0了 不然下面的判断 sdslen(c->querybuf)-pos  就会有问题
+                /* 从qb_pos截取整个字符串 这是唯一需要在解析过程中截取的地方 */
+                sdsrange(c->querybuf,c->qb_pos,-1); //内部是根据sdslen来获取整个querybuf长度的
+                c->qb_pos = 0; //这里就等于0了 不然下面的判断 sdslen(c->querybuf)-qb_pos  就会有问题
                 qblen = sdslen(c->querybuf); //获取当前整个字符串的长度
                 /* Hint the sds library about the amount of bytes this string is
                  * going to contain. */
@@ -1603,7 +1909,7 @@ int processMultibulkBuffer(client *c) {
         }
         
         /* Read bulk argument */
-        if (sdslen(c->querybuf)-pos < (unsigned)(c->bulklen+2)) {
+        if (sdslen(c->querybuf)-c->qb_pos < (size_t)(c->bulklen+2)) {
             /** 实际的字符串长度 小于参数指明的长度  */
             /* Not enough data (+2 == trailing \r\n) */
             break;
@@ -1615,7 +1921,7 @@ int processMultibulkBuffer(client *c) {
             /* Optimization: if the buffer contains JUST our bulk element
              * instead of creating a new object by *copying* the sds we
              * just use the current sds string. */
-            if (pos == 0 &&
+            if (c->qb_pos == 0 &&
                 c->bulklen >= PROTO_MBULK_BIG_ARG &&
                 (signed) sdslen(c->querybuf) == c->bulklen+2)
             {
@@ -1628,14 +1934,13 @@ int processMultibulkBuffer(client *c) {
                 /*所以 这边再给querybuf 分配c->bulklen+2 的长度*/
                 c->querybuf = sdsnewlen(NULL,c->bulklen+2);
                 sdsclear(c->querybuf);//把len 设置为0
-                pos = 0;
             } else {
                 //保存到c->argv里
                 //createStringObject会根据 字符串长度 来 编码成EMBSTR 或者rawstring
                 //内部就是拷贝字符串
                 c->argv[c->argc++] =
-                    createStringObject(c->querybuf+pos,c->bulklen);
-                pos += c->bulklen+2; //位置增加
+                    createStringObject(c->querybuf+c->qb_pos,c->bulklen);
+                c->qb_pos += c->bulklen+2; //位置增加
             }
             c->bulklen = -1;
             //参数数量减少
@@ -1643,10 +1948,6 @@ int processMultibulkBuffer(client *c) {
         }
     }
 
-    /* Trim to pos */
-    /*从pos开始重新开始截取*/
-    if (pos) sdsrange(c->querybuf,pos,-1);
-
     /* We're done when c->multibulk == 0 */
     if (c->multibulklen == 0) return C_OK;
 
@@ -1655,16 +1956,25 @@ int processMultibulkBuffer(client *c) {
     return C_ERR;
 }
 
+/* When called from an I/O thread this function only parses the query
+ * buffer: as soon as a full command is available in c->argv the client is
+ * flagged with CLIENT_PENDING_COMMAND and we return, so that the command is
+ * executed later by the main thread calling this function again. */
 void processInputBuffer(client *c) {
+    int io_context = inThreadedIOContext();
+
     //到这里 才会设置当前客户端
-    server.current_client = c;
+    if (!io_context) server.current_client = c;
 
     /*
     当输入缓冲区中有东西时继续处理
      判断长度 而不是判断指针
     */
-    /* Keep processing while there is something in the input buffer */
-    while(sdslen(c->querybuf)) {
+    /* Keep processing while there is something in the input buffer, or
+     * a command already parsed by an I/O thread. */
+    while(c->qb_pos < sdslen(c->querybuf) ||
+          (c->flags & CLIENT_PENDING_COMMAND))
+    {
 
         /*不是 slave的情况下 如果客户端处于暂停状态 那就直接跳出处理*/
         //也就是说 如果客户端是slave 那么 就不理会暂停状态
@@ -1672,8 +1982,11 @@ void processInputBuffer(client *c) {
         //todo 需要知道客户端什么时候会处于暂停状态
         //客户端发送暂停指令 pauseClients方法 会使客户端暂停 
         //clientsArePaused 内部 如果暂停时间已到，那么会清空暂停标记
-        /* Return if clients are paused. */
-        if (!(c->flags & CLIENT_SLAVE) && clientsArePaused()) break;
+        /* Return if clients are paused. I/O threads can't call
+         * clientsArePaused() since it may unpause clients as a side effect,
+         * so they just check the flag. */
+        if (!(c->flags & CLIENT_SLAVE) &&
+            (io_context ? server.clients_paused : clientsArePaused())) break;
 
         /*如果客户端正在处理某些事情，则立即中止*/
         /* Immediately abort if the client is in the middle of something. */
@@ -1691,11 +2004,17 @@ void processInputBuffer(client *c) {
          * The same applies for clients we want to terminate ASAP. */
         if (c->flags & (CLIENT_CLOSE_AFTER_REPLY|CLIENT_CLOSE_ASAP)) break;
 
+        /* The command was already parsed by an I/O thread. */
+        if (c->flags & CLIENT_PENDING_COMMAND) {
+            c->flags &= ~CLIENT_PENDING_COMMAND;
+            goto execute;
+        }
+
         /*当不知道类型时检测请求类型*/
         /* Determine request type when unknown. */
         if (!c->reqtype) {
             //当第一个字符是* 时 就代表是MULTIBULK
-            if (c->querybuf[0] == '*') {
+            if (c->querybuf[c->qb_pos] == '*') {
 
                 //set命令也是*$3\r\nSET\r\n$8\r\ntestZero\r\n$1\r\n\0\r\n 
                 c->reqtype = PROTO_REQ_MULTIBULK;
@@ -1714,16 +2033,29 @@ void processInputBuffer(client *c) {
             serverPanic("Unknown request type");
         }
 
+execute:
         //多个bulk 处理 有可能会看到 <=0 的长度
         /* Multibulk processing could see a <= 0 length. */
         if (c->argc == 0) {
             //让客户端准备处理下个命令
             resetClient(c);
         } else {
+            /* Commands are only executed by the main thread. */
+            if (io_context) {
+                c->flags |= CLIENT_PENDING_COMMAND;
+                break;
+            }
+
             /*开始处理命令*/
             /* Only reset the client when the command was executed. */
-            if (processCommand(c) == C_OK)
+            if (processCommand(c) == C_OK) {
+                if (c->flags & CLIENT_MASTER && !(c->flags & CLIENT_MULTI)) {
+                    /* Update the applied replication offset of our master. */
+                    c->reploff = c->read_reploff -
+                                 (sdslen(c->querybuf) - c->qb_pos);
+                }
                 resetClient(c); //内部会释放客户端对象列表
+            }
 
             /*
               freeMemoryIfNeeded 方法 有可能刷新slave 输出缓冲区，
@@ -1731,21 +2063,55 @@ void processInputBuffer(client *c) {
             */
             /* freeMemoryIfNeeded may flush slave output buffers. This may result
              * into a slave, that may be the active client, to be freed. */
-            if (server.current_client == NULL) break;
+            if (server.current_client == NULL) return;
+        }
+    }
+
+    /*
+      解析时只移动qb_pos 这里每次调用只截取(memmove)一次已经处理过的数据
+      而不是每个命令截取一次 深度pipeline时不会再反复移动剩余的缓冲区
+    */
+    /* Trim the already parsed part of the query buffer. Parsing only moves
+     * the c->qb_pos offset forward, so that with deep pipelines the rest of
+     * the buffer is moved once per call instead of once per command. */
+    if (c->qb_pos) {
+        sdsrange(c->querybuf,c->qb_pos,-1);
+        c->qb_pos = 0;
+    }
+    if (!io_context) server.current_client = NULL;
+}
+
+/* Like processInputBuffer(), but if the client is our master, the part of
+ * the replication stream that was applied is also proxied to our slaves
+ * and to the backlog, so that the replication offsets of the slaves of a
+ * slave are the ones of the master. */
+void processInputBufferAndReplicate(client *c) {
+    if (!(c->flags & CLIENT_MASTER)) {
+        processInputBuffer(c);
+    } else {
+        size_t prev_offset = c->reploff;
+        processInputBuffer(c);
+        size_t applied = c->reploff - prev_offset;
+        if (applied) {
+            replicationFeedSlavesFromMasterStream(server.slaves,
+                    c->pending_querybuf, applied);
+            sdsrange(c->pending_querybuf,applied,-1);
         }
     }
-    server.current_client = NULL;
 }
 /*
  createClient 创建客户端的时候 会创建这个读事件
 */
 //从客户端读取查询
-void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
-    client *c = (client*) privdata;
-    int nread, readlen;
+/* Make room in the query buffer of the client for the next read, and
+ * return how many bytes to read. The data is read at the end of the
+ * buffer, then passed to _clientReadDone(). */
+static int _clientReadLen(client *c) {
+    int readlen;
     size_t qblen;
-    UNUSED(el);
-    UNUSED(mask);
+
+    /* The query buffer of idle clients is given back to the pool. */
+    if (c->querybuf == NULL) getClientQueryBuffer(c);
 
     readlen = PROTO_IOBUF_LEN; //普通I/O 缓冲区大小 16kb
     /*
@@ -1789,12 +2155,14 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
     //扩大字符数组以容纳读取的readlen长度
     //如果查询缓冲区 有足够空间 会立马返回
     c->querybuf = sdsMakeRoomFor(c->querybuf, readlen);
+    return readlen;
+}
 
-
-    /*调用read函数 读取 字符到querybuf中 */
-    /* c->querybuf+qblen 代表 移动到 c->querybuf+qblen 这个位置 */
-    /*因为上面已经扩充空间了*/
-    nread = read(fd, c->querybuf+qblen, readlen);
+/* Handle the result of the read into the query buffer of the client, with
+ * errno set if 'nread' is -1. Returns C_OK if there is new data to process,
+ * C_ERR if there is nothing to process or the client was freed. */
+static int _clientReadDone(client *c, int nread) {
+    size_t qblen = sdslen(c->querybuf);
 
     //读完后为啥不更新c->querybuf_peak？
 
@@ -1802,31 +2170,35 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
         //errno == EAGAIN是Unix/Linux系统中表示‌资源暂时不可用‌的错误码
         //系统调用因资源不足被暂时拒绝，但后续重试可能成功
         if (errno == EAGAIN) {
-            return;
+            return C_ERR;
         } else {
             serverLog(LL_VERBOSE, "Reading from client: %s",strerror(errno));
             //释放客户端
-            freeClient(c);
-            return;
+            freeClientFromIO(c);
+            return C_ERR;
         }
     } else if (nread == 0) {
         //telnet 关闭客户端时 会提示这个
         serverLog(LL_VERBOSE, "Client closed connection");
 
         //
-        freeClient(c);
+        freeClientFromIO(c);
         //读取为0时直接返回了
-        return;
+        return C_ERR;
     }
     /*长度增加 读取到的长度*/
     sdsIncrLen(c->querybuf,nread);
     //最后活跃时间更新
     c->lastinteraction = server.unixtime; //unixtime 会在调用updateCachedTime时更新
     //todo 如果当前client是master 那么偏移量增加 主从相关
-    if (c->flags & CLIENT_MASTER) c->reploff += nread;
+    if (c->flags & CLIENT_MASTER) {
+        c->read_reploff += nread;
+        c->pending_querybuf = sdscatlen(c->pending_querybuf,
+                                        c->querybuf+qblen,nread);
+    }
     //增加网络字节数
     /* serverCron里 会100毫秒一次计算测量*/
-    server.stat_net_input_bytes += nread;
+    atomicIncr(server.stat_net_input_bytes, nread);
 
     //当前查询缓冲区长度  如果大于 最大缓冲区限制 那就释放客户端
     //client_max_querybuf_len 在initServerConfig的时候 会初始化为 1GB max query buffer
@@ -1843,12 +2215,34 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
         sdsfree(ci);
         sdsfree(bytes);
 
-        freeClient(c);
-        return;
+        freeClientFromIO(c);
+        return C_ERR;
     }
+    return C_OK;
+}
+
+void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
+    client *c = (client*) privdata;
+    int nread, readlen;
+    UNUSED(el);
+    UNUSED(mask);
+
+    /* Check if we want to read from the client later when exiting from
+     * the event loop. This is the case if threaded I/O is enabled, or if
+     * the event loop can batch the reads. */
+    if (postponeClientRead(c)) return;
+
+    readlen = _clientReadLen(c);
+
+    /*调用read函数 读取 字符到querybuf中 */
+    /* c->querybuf+sdslen(c->querybuf) 代表 移动到 querybuf 的末尾 */
+    /*因为上面已经扩充空间了*/
+    nread = read(fd, c->querybuf+sdslen(c->querybuf), readlen);
+    if (_clientReadDone(c,nread) == C_ERR) return;
+
     //开始处理输入
     //内部跳出 处理的话 其实这是c->querybuf 也是有值的
-    processInputBuffer(c);
+    processInputBufferAndReplicate(c);
 }
 
 void getClientsMaxBuffers(unsigned long *longest_output_list,
@@ -1863,12 +2257,32 @@ void getClientsMaxBuffers(unsigned long *longest_output_list,
         c = listNodeValue(ln);
 
         if (listLength(c->reply) > lol) lol = listLength(c->reply);
-        if (sdslen(c->querybuf) > bib) bib = sdslen(c->querybuf);
+        if (c->querybuf && sdslen(c->querybuf) > bib)
+            bib = sdslen(c->querybuf);
     }
     *longest_output_list = lol;
     *biggest_input_buffer = bib;
 }
 
+/* Return the memory used by the query and reply buffers of the connected
+ * clients. The reply lists are not counted: they are reported by
+ * getClientOutputBufferMemoryUsage(). */
+size_t getClientsBuffersMemory(void) {
+    client *c;
+    listNode *ln;
+    listIter li;
+    size_t mem = 0;
+
+    listRewind(server.clients,&li);
+    while ((ln = listNext(&li)) != NULL) {
+        c = listNodeValue(ln);
+
+        if (c->querybuf) mem += sdsAllocSize(c->querybuf);
+        if (c->buf) mem += PROTO_REPLY_CHUNK_BYTES;
+    }
+    return mem;
+}
+
 /* A Redis "Peer ID" is a colon separated ip:port pair.
  * For IPv4 it's in the form x.y.z.k:port, example: "127.0.0.1:1234".
  * For IPv6 addresses we use [] around the IP part, like in "[::1]:1234".
@@ -1952,8 +2366,10 @@ sds catClientInfoString(sds s, client *client) {
         (int) dictSize(client->pubsub_channels),
         (int) listLength(client->pubsub_patterns),
         (client->flags & CLIENT_MULTI) ? client->mstate.count : -1,
-        (unsigned long long) sdslen(client->querybuf),
-        (unsigned long long) sdsavail(client->querybuf),
+        (unsigned long long) (client->querybuf ?
+                              sdslen(client->querybuf) - client->qb_pos : 0),
+        (unsigned long long) (client->querybuf ?
+                              sdsavail(client->querybuf) : 0),
         (unsigned long long) client->bufpos,
         (unsigned long long) listLength(client->reply),
         (unsigned long long) getClientOutputBufferMemoryUsage(client),
@@ -2258,6 +2674,28 @@ unsigned long getClientOutputBufferMemoryUsage(client *c) {
     return c->reply_bytes + (list_item_size*listLength(c->reply));
 }
 
+/* Like getClientOutputBufferMemoryUsage(), but an object referenced by
+ * several output buffers, like the reply blocks of addReplyShared(), only
+ * counts for its share: summing the value of all the clients holding the
+ * object counts it just once. Unlike getClientOutputBufferMemoryUsage()
+ * this is O(N) in the length of the reply list. */
+unsigned long getClientOutputBufferMemoryShare(client *c) {
+    unsigned long list_item_size = sizeof(listNode)+sizeof(robj);
+    unsigned long bytes = 0;
+    listIter li;
+    listNode *ln;
+
+    listRewind(c->reply,&li);
+    while((ln = listNext(&li))) {
+        robj *o = listNodeValue(ln);
+        size_t used = getStringObjectSdsUsedMemory(o);
+
+        if (o->refcount > 1) used /= o->refcount;
+        bytes += used + list_item_size;
+    }
+    return bytes;
+}
+
 /* Get the class of a client, used in order to enforce limits to different
  * classes of clients.
  *
@@ -2488,6 +2926,10 @@ int clientsArePaused(void) {
 int processEventsWhileBlocked(void) {
     int iterations = 4; /* See the function top-comment. */
     int count = 0;
+
+    /* Reads are never postponed to the I/O threads while we are here, since
+     * the code calling us may rely on the data set not being modified. */
+    ProcessingEventsWhileBlocked = 1;
     while (iterations--) {
         int events = 0;
         events += aeProcessEvents(server.el, AE_FILE_EVENTS|AE_DONT_WAIT);
@@ -2497,5 +2939,446 @@ int processEventsWhileBlocked(void) {
         if (!events) break;
         count += events;
     }
+    ProcessingEventsWhileBlocked = 0;
     return count;
 }
+
+/* ==========================================================================
+ * Threaded I/O
+ *
+ * When io-threads is greater than one, a set of I/O threads is used in order
+ * to write replies to clients and, if io-threads-do-reads is enabled, to
+ * read and parse the query buffer of clients. The threads never execute
+ * commands: call() is always performed by the main thread, so the data set
+ * and all the server state keep being accessed by a single thread.
+ *
+ * The main thread collects the clients to serve in beforeSleep(), splits
+ * them among the threads (the main thread itself handles the first list),
+ * and busy waits for the threads to finish. So the main thread and the I/O
+ * threads never run at the same time except while processing such lists.
+ * ========================================================================== */
+
+/* 主线程和I/O线程不会同时处理客户端：主线程把客户端分配给各个线程后，
+ * 自己处理第0个列表，然后等待其他线程完成。命令始终由主线程执行。 */
+
+pthread_t io_threads[IO_THREADS_MAX_NUM];
+pthread_mutex_t io_threads_mutex[IO_THREADS_MAX_NUM];
+unsigned long io_threads_pending[IO_THREADS_MAX_NUM];
+list *io_threads_list[IO_THREADS_MAX_NUM];
+
+/* Number of iterations an idle I/O thread spins before trying to take its
+ * mutex, that is locked by the main thread when there is nothing to do. */
+#define IO_THREADS_SPIN_ITERATIONS 1000000
+
+/* Remove all the clients from an I/O thread list. The list has no free
+ * method, so the clients themselves are left untouched. */
+static void emptyIOThreadList(list *l) {
+    while(listLength(l)) listDelNode(l,listFirst(l));
+}
+
+static inline unsigned long getIOPendingCount(int i) {
+    unsigned long count = 0;
+    atomicGetWithSync(io_threads_pending[i],count);
+    return count;
+}
+
+static inline void setIOPendingCount(int i, unsigned long count) {
+    atomicSetWithSync(io_threads_pending[i],count);
+}
+
+void *IOThreadMain(void *myid) {
+    /* The ID is the thread number (from 0 to server.io_threads_num-1), and is
+     * used by the thread to just manipulate a single sub-array of clients. */
+    long id = (unsigned long)myid;
+    sigset_t sigset;
+
+    /* Make the thread killable at any time, so that killIOThreads()
+     * can work reliably. */
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+    pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
+
+    /* Block SIGALRM so we are sure that only the main thread will
+     * receive the watchdog signal. */
+    sigemptyset(&sigset);
+    sigaddset(&sigset, SIGALRM);
+    if (pthread_sigmask(SIG_BLOCK, &sigset, NULL))
+        serverLog(LL_WARNING,
+            "Warning: can't mask SIGALRM in I/O thread: %s", strerror(errno));
+
+    while(1) {
+        listIter li;
+        listNode *ln;
+        int j;
+
+        /* Wait for start */
+        for (j = 0; j < IO_THREADS_SPIN_ITERATIONS; j++) {
+            if (getIOPendingCount(id) != 0) break;
+        }
+
+        /* Give the main thread a chance to stop this thread. */
+        if (getIOPendingCount(id) == 0) {
+            pthread_mutex_lock(&io_threads_mutex[id]);
+            pthread_mutex_unlock(&io_threads_mutex[id]);
+            continue;
+        }
+
+        /* Process: note that the main thread will never touch our list
+         * before we drop the pending count to 0. */
+        listRewind(io_threads_list[id],&li);
+        while((ln = listNext(&li))) {
+            client *c = listNodeValue(ln);
+            if (io_threads_op == IO_THREADS_OP_WRITE) {
+                writeToClient(c->fd,c,0);
+            } else if (io_threads_op == IO_THREADS_OP_READ) {
+                readQueryFromClient(NULL,c->fd,c,0);
+            } else {
+                serverPanic("io_threads_op value is unknown");
+            }
+        }
+        emptyIOThreadList(io_threads_list[id]);
+        setIOPendingCount(id, 0);
+    }
+}
+
+/* Initialize the data structures needed for threaded I/O. */
+void initThreadedIO(void) {
+    int i;
+
+    server.io_threads_active = 0; /* We start with threads not active. */
+
+    /* Don't spawn any thread if the user selected a single thread:
+     * we'll handle I/O directly from the main thread. */
+    if (server.io_threads_num == 1) return;
+
+    if (server.io_threads_num > IO_THREADS_MAX_NUM) {
+        serverLog(LL_WARNING,"Fatal: too many I/O threads configured. "
+                             "The maximum number is %d.", IO_THREADS_MAX_NUM);
+        exit(1);
+    }
+
+    /* Spawn and initialize the I/O threads. */
+    for (i = 0; i < server.io_threads_num; i++) {
+        /* Things we do for all the threads including the main thread. */
+        io_threads_list[i] = listCreate();
+        if (i == 0) continue; /* Thread 0 is the main thread. */
+
+        /* Things we do only for the additional threads. */
+        pthread_t tid;
+        pthread_mutex_init(&io_threads_mutex[i],NULL);
+        setIOPendingCount(i, 0);
+        pthread_mutex_lock(&io_threads_mutex[i]); /* Thread will be stopped. */
+        if (pthread_create(&tid,NULL,IOThreadMain,(void*)(long)i) != 0) {
+            serverLog(LL_WARNING,"Fatal: Can't initialize I/O threads.");
+            exit(1);
+        }
+        io_threads[i] = tid;
+    }
+}
+
+/* Kill the I/O threads in an unclean way, see bioKillThreads(). This is
+ * only used on crash in order to perform the fast memory check. */
+void killIOThreads(void) {
+    int err, j;
+
+    for (j = 1; j < server.io_threads_num; j++) {
+        if (pthread_cancel(io_threads[j]) == 0) {
+            if ((err = pthread_join(io_threads[j],NULL)) != 0) {
+                serverLog(LL_WARNING,
+                    "I/O thread #%d can not be joined: %s",
+                        j, strerror(err));
+            } else {
+                serverLog(LL_WARNING,
+                    "I/O thread #%d terminated",j);
+            }
+        }
+    }
+}
+
+static void startThreadedIO(void) {
+    int j;
+
+    serverAssert(server.io_threads_active == 0);
+    for (j = 1; j < server.io_threads_num; j++)
+        pthread_mutex_unlock(&io_threads_mutex[j]);
+    server.io_threads_active = 1;
+}
+
+static void stopThreadedIO(void) {
+    int j;
+
+    /* We may have still clients with pending reads when this function
+     * is called: handle them before deactivating the threads. */
+    handleClientsWithPendingReadsUsingThreads();
+    serverAssert(server.io_threads_active == 1);
+    for (j = 1; j < server.io_threads_num; j++)
+        pthread_mutex_lock(&io_threads_mutex[j]);
+    server.io_threads_active = 0;
+}
+
+/* This function checks if there are not enough pending clients to justify
+ * taking the I/O threads active: in that case I/O threads are stopped if
+ * currently active. We track the pending writes as a measure of clients
+ * we need to handle in parallel, however the I/O threading is disabled
+ * globally for reads as well if we have too little pending clients.
+ *
+ * The function returns 0 if the I/O threading should be used because there
+ * are enough active threads, otherwise 1 is returned and the I/O threads
+ * could be possibly stopped (if already active) as a side effect. */
+int stopThreadedIOIfNeeded(void) {
+    int pending = listLength(server.clients_pending_write);
+
+    /* Return ASAP if I/O threads are disabled (single threaded mode). */
+    if (server.io_threads_num == 1) return 1;
+
+    if (pending < (server.io_threads_num*2)) {
+        if (server.io_threads_active) stopThreadedIO();
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+/* Return 1 if the reply list of the client references objects that are
+ * shared with other clients (refcount > 1). Such objects are released
+ * with a non atomic decrRefCount(), so the client must be served by the
+ * main thread. */
+static int clientReplyHasSharedObjects(client *c) {
+    listIter li;
+    listNode *ln;
+
+    listRewind(c->reply,&li);
+    while((ln = listNext(&li))) {
+        robj *o = listNodeValue(ln);
+        if (o->refcount > 1) return 1;
+    }
+    return 0;
+}
+
+/* Wait for all the I/O threads to process their list. */
+static void waitForIOThreads(void) {
+    int j;
+
+    while(1) {
+        unsigned long pending = 0;
+        for (j = 1; j < server.io_threads_num; j++)
+            pending += getIOPendingCount(j);
+        if (pending == 0) break;
+    }
+}
+
+int handleClientsWithPendingWritesUsingThreads(void) {
+    int processed = listLength(server.clients_pending_write);
+    if (processed == 0) return 0; /* Return ASAP if there are no clients. */
+
+    /* If I/O threads are disabled or we have few clients to serve, don't
+     * use I/O threads, but the boring synchronous code. */
+    if (server.io_threads_num == 1 || stopThreadedIOIfNeeded()) {
+        return handleClientsWithPendingWrites();
+    }
+
+    /* Start threads if needed. */
+    if (!server.io_threads_active) startThreadedIO();
+
+    /* Distribute the clients across N different lists. Slaves and clients
+     * referencing shared objects stay with the main thread. */
+    listIter li;
+    listNode *ln;
+    listRewind(server.clients_pending_write,&li);
+    int item_id = 0;
+    while((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+        c->flags &= ~CLIENT_PENDING_WRITE;
+
+        /* Remove clients from the list of pending writes since
+         * they are going to be closed ASAP. */
+        if (c->flags & CLIENT_CLOSE_ASAP) {
+            listDelNode(server.clients_pending_write, ln);
+            continue;
+        }
+
+        if ((c->flags & CLIENT_SLAVE) || clientReplyHasSharedObjects(c)) {
+            listAddNodeTail(io_threads_list[0],c);
+            continue;
+        }
+        int target_id = item_id % server.io_threads_num;
+        listAddNodeTail(io_threads_list[target_id],c);
+        item_id++;
+    }
+
+    /* Give the start condition to the waiting threads, by setting the
+     * start condition atomic var. */
+    io_threads_op = IO_THREADS_OP_WRITE;
+    for (int j = 1; j < server.io_threads_num; j++) {
+        int count = listLength(io_threads_list[j]);
+        setIOPendingCount(j, count);
+    }
+
+    /* Also use the main thread to process a slice of clients. */
+    listRewind(io_threads_list[0],&li);
+    while((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+        writeToClient(c->fd,c,0);
+    }
+    emptyIOThreadList(io_threads_list[0]);
+
+    /* Wait for all the other threads to end their work. */
+    waitForIOThreads();
+    io_threads_op = IO_THREADS_OP_IDLE;
+
+    /* Run the list of clients again to install the write handler where
+     * needed. */
+    listRewind(server.clients_pending_write,&li);
+    while((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+
+        /* Install the write handler if there are pending writes in some
+         * of the clients. */
+        if (clientHasPendingReplies(c) && !(c->flags & CLIENT_CLOSE_ASAP))
+            installClientWriteHandler(c);
+    }
+    emptyIOThreadList(server.clients_pending_write);
+
+    /* Update processed count on server */
+    server.stat_io_writes_processed += processed;
+
+    return processed;
+}
+
+/* Return 1 if we want to handle the client read later using threaded I/O,
+ * or with the reads of the other clients batched by the event loop.
+ * This is called by the readable handler of the event loop.
+ * As a side effect of calling this function the client is put in the
+ * pending read clients and flagged as such. */
+static int postponeClientRead(client *c) {
+    if (((server.io_threads_active && server.io_threads_do_reads) ||
+         aeCanBatchIO(server.el)) &&
+        !ProcessingEventsWhileBlocked &&
+        !(c->flags & (CLIENT_MASTER|CLIENT_SLAVE|CLIENT_PENDING_READ|
+                      CLIENT_BLOCKED)))
+    {
+        c->flags |= CLIENT_PENDING_READ;
+        /* Served in the order the events fired, like without postponing. */
+        listAddNodeTail(server.clients_pending_read,c);
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+/* When threaded I/O is also enabled for the reading + parsing side, the
+ * readable handler will just put normal clients into a queue of clients to
+ * process (instead of serving them synchronously). This function runs
+ * the queue using the I/O threads, and process them in order to accumulate
+ * the reads in the buffers, and also parse the first command available
+ * rendering it in the client structures. */
+int handleClientsWithPendingReadsUsingThreads(void) {
+    if (!server.io_threads_active || !server.io_threads_do_reads)
+        return handleClientsWithPendingReads();
+    int processed = listLength(server.clients_pending_read);
+    if (processed == 0) return 0;
+
+    /* Distribute the clients across N different lists. */
+    listIter li;
+    listNode *ln;
+    listRewind(server.clients_pending_read,&li);
+    int item_id = 0;
+    while((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+        int target_id = item_id % server.io_threads_num;
+        listAddNodeTail(io_threads_list[target_id],c);
+        item_id++;
+    }
+
+    /* Give the start condition to the waiting threads, by setting the
+     * start condition atomic var. */
+    io_threads_op = IO_THREADS_OP_READ;
+    for (int j = 1; j < server.io_threads_num; j++) {
+        int count = listLength(io_threads_list[j]);
+        setIOPendingCount(j, count);
+    }
+
+    /* Also use the main thread to process a slice of clients. */
+    listRewind(io_threads_list[0],&li);
+    while((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+        readQueryFromClient(NULL,c->fd,c,0);
+    }
+    emptyIOThreadList(io_threads_list[0]);
+
+    /* Wait for all the other threads to end their work. */
+    waitForIOThreads();
+    io_threads_op = IO_THREADS_OP_IDLE;
+
+    processClientsWithPendingReads();
+
+    /* Update processed count on server */
+    server.stat_io_reads_processed += processed;
+
+    return processed;
+}
+
+/* Run the list of the pending read clients, once their reads are done, to
+ * process the new buffers. */
+static void processClientsWithPendingReads(void) {
+    while(listLength(server.clients_pending_read)) {
+        listNode *ln = listFirst(server.clients_pending_read);
+        client *c = listNodeValue(ln);
+        c->flags &= ~CLIENT_PENDING_READ;
+        listDelNode(server.clients_pending_read,ln);
+
+        /* Clients freed by the threads are already scheduled for
+         * asynchronous release. */
+        if (c->flags & CLIENT_CLOSE_ASAP) continue;
+
+        processInputBuffer(c);
+
+        /* We may have pending replies if a thread read+parse produced an
+         * error, or the command was executed: make sure the client is
+         * scheduled for the write. */
+        if (!(c->flags & CLIENT_PENDING_WRITE) && clientHasPendingReplies(c))
+        {
+            c->flags |= CLIENT_PENDING_WRITE;
+            listAddNodeHead(server.clients_pending_write,c);
+        }
+    }
+}
+
+/* Serve the clients postponed by postponeClientRead() when the event loop
+ * batches the reads and the I/O threads don't read: the reads of up to
+ * NET_IO_BATCH clients are submitted together with aeSubmitIO(), then the
+ * clients process their new buffers like with threaded I/O. */
+static int handleClientsWithPendingReads(void) {
+    int processed = listLength(server.clients_pending_read);
+    listIter li;
+    listNode *ln;
+
+    if (processed == 0) return 0;
+    listRewind(server.clients_pending_read,&li);
+    ln = listNext(&li);
+    while(ln) {
+        client *clients[NET_IO_BATCH];
+        aeIO ios[NET_IO_BATCH];
+        int numclients = 0, j;
+
+        for (; ln && numclients < NET_IO_BATCH; ln = listNext(&li)) {
+            client *c = listNodeValue(ln);
+            aeIO *io = &ios[numclients];
+
+            io->op = AE_IO_READ;
+            io->fd = c->fd;
+            io->len = _clientReadLen(c);
+            io->buf = c->querybuf+sdslen(c->querybuf);
+            clients[numclients++] = c;
+        }
+        aeSubmitIO(server.el,ios,numclients);
+
+        /* A client freed here also leaves the pending reads list, and the
+         * iterator already points past the clients of this batch. */
+        for (j = 0; j < numclients; j++) {
+            errno = ios[j].err;
+            _clientReadDone(clients[j],ios[j].res);
+        }
+    }
+    processClientsWithPendingReads();
+    return processed;
+}
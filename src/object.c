@@ -59,7 +59,7 @@ robj *createObject(int type, void *ptr) {
        要到 1010秒 需要经过多少时间
     
     */
-    o->lru = LRU_CLOCK();
+    o->lru = objectInitialLRU();
     return o;
 }
 
@@ -91,7 +91,7 @@ robj *createEmbeddedStringObject(const char *ptr, size_t len) {
     o->encoding = OBJ_ENCODING_EMBSTR; //编码
     o->ptr = sh+1; //这里+1 就是走到了char[] 柔性数组的位置
     o->refcount = 1; //引用计数
-    o->lru = LRU_CLOCK(); //lru时钟
+    o->lru = objectInitialLRU(); //lru时钟
 
     //1.embstr 类型字符串如果要修改，会先被转换为 raw
     //2. embstr 类型里的 sdshdr8，预留空间会被显式设置为 0，即 avail = hdr->alloc - hdr->len 的结果为 0，
@@ -249,28 +249,42 @@ robj *createIntsetObject(void) {
     return o;
 }
 
+robj *createRoaringObject(void) {
+    roaring *r = roaringNew();
+    robj *o = createObject(OBJ_SET,r);
+    o->encoding = OBJ_ENCODING_ROARING;
+    return o;
+}
+
 robj *createHashObject(void) {
-    unsigned char *zl = ziplistNew();
-    robj *o = createObject(OBJ_HASH, zl);
-    o->encoding = OBJ_ENCODING_ZIPLIST;
+    unsigned char *lp = lpNew();
+    robj *o = createObject(OBJ_HASH, lp);
+    o->encoding = OBJ_ENCODING_LISTPACK;
     return o;
 }
 
+/* Create a sorted set with the encoding selected by zset-large-encoding. */
 robj *createZsetObject(void) {
     zset *zs = zmalloc(sizeof(*zs));
     robj *o;
 
     zs->dict = dictCreate(&zsetDictType,NULL);
-    zs->zsl = zslCreate();
+    if (server.zset_large_encoding == OBJ_ENCODING_BTREE) {
+        zs->zsl = NULL;
+        zs->zbt = zbtCreate();
+    } else {
+        zs->zsl = zslCreate();
+        zs->zbt = NULL;
+    }
     o = createObject(OBJ_ZSET,zs);
-    o->encoding = OBJ_ENCODING_SKIPLIST;
+    o->encoding = server.zset_large_encoding;
     return o;
 }
 
-robj *createZsetZiplistObject(void) {
-    unsigned char *zl = ziplistNew();
-    robj *o = createObject(OBJ_ZSET,zl);
-    o->encoding = OBJ_ENCODING_ZIPLIST;
+robj *createZsetListpackObject(void) {
+    unsigned char *lp = lpNew();
+    robj *o = createObject(OBJ_ZSET,lp);
+    o->encoding = OBJ_ENCODING_LISTPACK;
     return o;
 }
 
@@ -296,6 +310,9 @@ void freeSetObject(robj *o) {
     case OBJ_ENCODING_INTSET:
         zfree(o->ptr);
         break;
+    case OBJ_ENCODING_ROARING:
+        roaringFree(o->ptr);
+        break;
     default:
         serverPanic("Unknown set encoding type");
     }
@@ -310,8 +327,14 @@ void freeZsetObject(robj *o) {
         zslFree(zs->zsl);
         zfree(zs);
         break;
-    case OBJ_ENCODING_ZIPLIST:
-        zfree(o->ptr);
+    case OBJ_ENCODING_BTREE:
+        zs = o->ptr;
+        dictRelease(zs->dict);
+        zbtFree(zs->zbt);
+        zfree(zs);
+        break;
+    case OBJ_ENCODING_LISTPACK:
+        lpFree(o->ptr);
         break;
     default:
         serverPanic("Unknown sorted set encoding");
@@ -323,8 +346,8 @@ void freeHashObject(robj *o) {
     case OBJ_ENCODING_HT:
         dictRelease((dict*) o->ptr);
         break;
-    case OBJ_ENCODING_ZIPLIST:
-        zfree(o->ptr);
+    case OBJ_ENCODING_LISTPACK:
+        lpFree(o->ptr);
         break;
     default:
         serverPanic("Unknown hash encoding type");
@@ -332,14 +355,21 @@ void freeHashObject(robj *o) {
     }
 }
 /*增加引用计数*/
+/* The reference count is updated atomically since objects stored inside
+ * aggregate values (sets, hashes, sorted sets) may be shared by several keys,
+ * and the lazy free thread may release one of them while the main thread
+ * is using another. */
 void incrRefCount(robj *o) {
-    o->refcount++;
+    atomicIncr(o->refcount,1);
 }
 
 /*降低引用计数 如果引用计数为1那么就释放内存*/
 void decrRefCount(robj *o) {
     if (o->refcount <= 0) serverPanic("decrRefCount against refcount <= 0");
-    if (o->refcount == 1) {
+    /* When the refcount is 1 we are the only owner: no other thread can
+     * reference the object. Otherwise the object is freed by the thread
+     * dropping the last reference. */
+    if (o->refcount == 1 || atomicDecr(o->refcount,1) == 0) {
         //// 如果 robj 引用计数器为 1，则代表需要释放对应 robj
         switch(o->type) {
         case OBJ_STRING: freeStringObject(o); break; //这里判断了raw 类型的 需要释放sds
@@ -351,10 +381,6 @@ void decrRefCount(robj *o) {
         }
         //这里释放o
         zfree(o);
-    } else {
-        //// 如果不是共享对象，则减小引用计数器
-        //7.0: if (o->refcount != OBJ_SHARED_REFCOUNT) o->refcount--;
-        o->refcount--;
     }
 }
 
@@ -474,7 +500,8 @@ robj *tryObjectEncoding(robj *o) {
          * algorithm to work well. */
         if ((server.maxmemory == 0 ||
              (server.maxmemory_policy != MAXMEMORY_VOLATILE_LRU &&
-              server.maxmemory_policy != MAXMEMORY_ALLKEYS_LRU)) &&
+              server.maxmemory_policy != MAXMEMORY_ALLKEYS_LRU &&
+              !MAXMEMORY_POLICY_IS_LFU(server.maxmemory_policy))) &&
             value >= 0 &&
             value < OBJ_SHARED_INTEGERS)
         {
@@ -829,8 +856,11 @@ char *strEncoding(int encoding) {
     case OBJ_ENCODING_HT: return "hashtable";
     case OBJ_ENCODING_QUICKLIST: return "quicklist";
     case OBJ_ENCODING_ZIPLIST: return "ziplist";
+    case OBJ_ENCODING_LISTPACK: return "listpack";
     case OBJ_ENCODING_INTSET: return "intset";
     case OBJ_ENCODING_SKIPLIST: return "skiplist";
+    case OBJ_ENCODING_BTREE: return "btree";
+    case OBJ_ENCODING_ROARING: return "roaring";
     case OBJ_ENCODING_EMBSTR: return "embstr";
     default: return "unknown";
     }
@@ -862,6 +892,88 @@ unsigned long long estimateObjectIdleTime(robj *o) {
     }
 }
 
+/* ----------------------------------------------------------------------------
+ * LFU (Least Frequently Used) access counter
+ *
+ * With the LFU maxmemory policies the 24 bits of obj->lru are used as:
+ *
+ *          16 bits      8 bits
+ *     +----------------+--------+
+ *     + Last decr time | LOG_C  |
+ *     +----------------+--------+
+ *
+ * LOG_C is a logarithmic access counter: the more it is high, the less
+ * likely it is incremented by a new access, so that 8 bits are enough to
+ * tell apart keys accessed a few times from keys accessed millions of times
+ * (see lfu-log-factor). The last decrement time is in minutes, and the
+ * counter is decremented by one every lfu-decay-time minutes elapsed, so
+ * keys that were popular once are eventually evicted.
+ * --------------------------------------------------------------------------*/
+
+/* Return the current time in minutes, just taking the least significant
+ * 16 bits. The returned time is suitable to be stored as LDT (last decrement
+ * time) for the LFU implementation. */
+static unsigned long LFUGetTimeInMinutes(void) {
+    return (server.unixtime/60) & 65535;
+}
+
+/* Given an object last decrement time, compute the minimum number of minutes
+ * that elapsed since the last decrement. Handle overflow (ldt greater than
+ * the current 16 bits minutes time) considering the time as wrapping
+ * exactly once. */
+static unsigned long LFUTimeElapsed(unsigned long ldt) {
+    unsigned long now = LFUGetTimeInMinutes();
+    if (now >= ldt) return now-ldt;
+    return 65535-ldt+now;
+}
+
+/* Logarithmically increment a counter. The greater is the current counter
+ * value the less likely is that it gets really incremented. Saturate it
+ * at 255. */
+static uint8_t LFULogIncr(uint8_t counter) {
+    double r, baseval, p;
+
+    if (counter == 255) return 255;
+    r = (double)rand()/RAND_MAX;
+    baseval = counter - LFU_INIT_VAL;
+    if (baseval < 0) baseval = 0;
+    p = 1.0/(baseval*server.lfu_log_factor+1);
+    if (r < p) counter++;
+    return counter;
+}
+
+/* Return the access counter of the object, decremented by the number of
+ * lfu-decay-time periods elapsed since its last decrement time. The object
+ * is not modified, see updateLFU(). */
+unsigned long LFUDecrAndReturn(robj *o) {
+    unsigned long ldt = o->lru >> 8;
+    unsigned long counter = o->lru & 255;
+    unsigned long num_periods = server.lfu_decay_time ?
+        LFUTimeElapsed(ldt) / server.lfu_decay_time : 0;
+
+    if (num_periods)
+        counter = (num_periods > counter) ? 0 : counter - num_periods;
+    return counter;
+}
+
+/* Update the LFU fields of the object on access: the counter is first
+ * decayed, then logarithmically incremented, and the access time is set
+ * to the current minute. */
+void updateLFU(robj *o) {
+    unsigned long counter = LFUDecrAndReturn(o);
+
+    counter = LFULogIncr(counter);
+    o->lru = (LFUGetTimeInMinutes()<<8) | counter;
+}
+
+/* Return the value the 'lru' field of new objects is initialized to,
+ * according to the current maxmemory policy. */
+unsigned int objectInitialLRU(void) {
+    if (MAXMEMORY_POLICY_IS_LFU(server.maxmemory_policy))
+        return (LFUGetTimeInMinutes()<<8) | LFU_INIT_VAL;
+    return LRU_CLOCK();
+}
+
 /* This is a helper function for the OBJECT command. We need to lookup keys
  * without any modification of LRU or other parameters. */
 robj *objectCommandLookup(client *c, robj *key) {
@@ -879,7 +991,7 @@ robj *objectCommandLookupOrReply(client *c, robj *key, robj *reply) {
 }
 
 /* Object command allows to inspect the internals of an Redis Object.
- * Usage: OBJECT <refcount|encoding|idletime> <key> */
+ * Usage: OBJECT <refcount|encoding|idletime|freq> <key> */
 void objectCommand(client *c) {
     robj *o;
 
@@ -894,9 +1006,23 @@ void objectCommand(client *c) {
     } else if (!strcasecmp(c->argv[1]->ptr,"idletime") && c->argc == 3) {
         if ((o = objectCommandLookupOrReply(c,c->argv[2],shared.nullbulk))
                 == NULL) return;
+        if (MAXMEMORY_POLICY_IS_LFU(server.maxmemory_policy)) {
+            addReplyError(c,"An LFU maxmemory policy is selected, idle time not tracked. Please note that when switching between policies at runtime LRU and LFU data will take some time to adjust.");
+            return;
+        }
         addReplyLongLong(c,estimateObjectIdleTime(o)/1000);
+    } else if (!strcasecmp(c->argv[1]->ptr,"freq") && c->argc == 3) {
+        if ((o = objectCommandLookupOrReply(c,c->argv[2],shared.nullbulk))
+                == NULL) return;
+        if (!MAXMEMORY_POLICY_IS_LFU(server.maxmemory_policy)) {
+            addReplyError(c,"An LFU maxmemory policy is not selected, access frequency not tracked. Please note that when switching between policies at runtime LRU and LFU data will take some time to adjust.");
+            return;
+        }
+        /* Report the counter decayed to the current time, as it will be
+         * seen by the next access or eviction sampling. */
+        addReplyLongLong(c,LFUDecrAndReturn(o));
     } else {
-        addReplyError(c,"Syntax error. Try OBJECT (refcount|encoding|idletime)");
+        addReplyError(c,"Syntax error. Try OBJECT (refcount|encoding|idletime|freq)");
     }
 }
 
@@ -249,6 +249,25 @@ int pubsubUnsubscribeAllPatterns(client *c, int notify) {
 
 /*给特定频道发送消息*/
 /* Publish a message */
+/* Return a string object with the protocol of the message delivered to the
+ * subscribers of 'channel': ["message", channel, message]. */
+static robj *createPubsubMessageBlock(robj *channel, robj *message) {
+    robj *c = getDecodedObject(channel), *m = getDecodedObject(message);
+    sds proto = sdsMakeRoomFor(sdsempty(),
+        sdslen(c->ptr)+sdslen(m->ptr)+64);
+
+    proto = sdscatsds(proto,shared.mbulkhdr[3]->ptr);
+    proto = sdscatsds(proto,shared.messagebulk->ptr);
+    proto = sdscatprintf(proto,"$%zu\r\n",sdslen(c->ptr));
+    proto = sdscatlen(proto,c->ptr,sdslen(c->ptr));
+    proto = sdscatprintf(proto,"\r\n$%zu\r\n",sdslen(m->ptr));
+    proto = sdscatlen(proto,m->ptr,sdslen(m->ptr));
+    proto = sdscatlen(proto,"\r\n",2);
+    decrRefCount(c);
+    decrRefCount(m);
+    return createObject(OBJ_STRING,proto);
+}
+
 int pubsubPublishMessage(robj *channel, robj *message) {
     int receivers = 0;
     dictEntry *de;
@@ -264,17 +283,19 @@ int pubsubPublishMessage(robj *channel, robj *message) {
         listNode *ln;
         listIter li;
 
+        //消息只编码一次，所有订阅者共享同一个回复块
+        /* The message is encoded once, and the same reply block is shared
+         * by the output buffers of all the subscribers. */
+        robj *block = createPubsubMessageBlock(channel,message);
         listRewind(list,&li);
         while ((ln = listNext(&li)) != NULL) {
 
             //给当前客户端发送消息
             client *c = ln->value;
-            addReply(c,shared.mbulkhdr[3]);
-            addReply(c,shared.messagebulk);
-            addReplyBulk(c,channel); //频道
-            addReplyBulk(c,message); //消息
+            addReplyShared(c,block);
             receivers++; //接收者增加
         }
+        decrRefCount(block);
     }
     /* Send to clients listening to matching channels */
     if (listLength(server.pubsub_patterns)) {
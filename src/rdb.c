@@ -200,7 +200,7 @@ int rdbEncodeInteger(long long value, unsigned char *enc) {
 /* Loads an integer-encoded object with the specified encoding type "enctype".
  * The returned value changes according to the flags, see
  * rdbGenerincLoadStringObject() for more info. */
-void *rdbLoadIntegerObject(rio *rdb, int enctype, int flags) {
+void *rdbLoadIntegerObject(rio *rdb, int enctype, int flags, size_t *lenptr) {
     int plain = flags & RDB_LOAD_PLAIN;
     int encode = flags & RDB_LOAD_ENC;
     unsigned char enc[4];
@@ -228,6 +228,7 @@ void *rdbLoadIntegerObject(rio *rdb, int enctype, int flags) {
         int len = ll2string(buf,sizeof(buf),val);
         p = zmalloc(len);
         memcpy(p,buf,len);
+        if (lenptr) *lenptr = len;
         return p;
     } else if (encode) {
         return createStringObjectFromLongLong(val);
@@ -303,7 +304,7 @@ ssize_t rdbSaveLzfStringObject(rio *rdb, unsigned char *s, size_t len) {
 /* Load an LZF compressed string in RDB format. The returned value
  * changes according to 'flags'. For more info check the
  * rdbGenericLoadStringObject() function. */
-void *rdbLoadLzfStringObject(rio *rdb, int flags) {
+void *rdbLoadLzfStringObject(rio *rdb, int flags, size_t *lenptr) {
     int plain = flags & RDB_LOAD_PLAIN;
     unsigned int len, clen;
     unsigned char *c = NULL;
@@ -328,8 +329,10 @@ void *rdbLoadLzfStringObject(rio *rdb, int flags) {
     }
     zfree(c);
 
-    if (plain)
+    if (plain) {
+        if (lenptr) *lenptr = len;
         return val;
+    }
     else
         return createObject(OBJ_STRING,val);
 err:
@@ -422,8 +425,10 @@ int rdbSaveStringObject(rio *rdb, robj *obj) {
  * RDB_LOAD_PLAIN: Return a plain string allocated with zmalloc()
  *                 instead of a Redis object with an sds in it.
  * RDB_LOAD_SDS: Return an SDS string instead of a Redis object.
+ *
+ * When 'lenptr' is not NULL the length of plain strings is stored there.
  */
-void *rdbGenericLoadStringObject(rio *rdb, int flags) {
+void *rdbGenericLoadStringObject(rio *rdb, int flags, size_t *lenptr) {
     int encode = flags & RDB_LOAD_ENC;
     int plain = flags & RDB_LOAD_PLAIN;
     int isencoded;
@@ -435,9 +440,9 @@ void *rdbGenericLoadStringObject(rio *rdb, int flags) {
         case RDB_ENC_INT8:
         case RDB_ENC_INT16:
         case RDB_ENC_INT32:
-            return rdbLoadIntegerObject(rdb,len,flags);
+            return rdbLoadIntegerObject(rdb,len,flags,lenptr);
         case RDB_ENC_LZF:
-            return rdbLoadLzfStringObject(rdb,flags);
+            return rdbLoadLzfStringObject(rdb,flags,lenptr);
         default:
             rdbExitReportCorruptRDB("Unknown RDB string encoding type %d",len);
         }
@@ -458,16 +463,17 @@ void *rdbGenericLoadStringObject(rio *rdb, int flags) {
             zfree(buf);
             return NULL;
         }
+        if (lenptr) *lenptr = len;
         return buf;
     }
 }
 
 robj *rdbLoadStringObject(rio *rdb) {
-    return rdbGenericLoadStringObject(rdb,RDB_LOAD_NONE);
+    return rdbGenericLoadStringObject(rdb,RDB_LOAD_NONE,NULL);
 }
 
 robj *rdbLoadEncodedStringObject(rio *rdb) {
-    return rdbGenericLoadStringObject(rdb,RDB_LOAD_ENC);
+    return rdbGenericLoadStringObject(rdb,RDB_LOAD_ENC,NULL);
 }
 
 /* Save a double value. Doubles are saved as strings prefixed by an unsigned
@@ -543,20 +549,23 @@ int rdbSaveObjectType(rio *rdb, robj *o) {
     case OBJ_SET:
         if (o->encoding == OBJ_ENCODING_INTSET)
             return rdbSaveType(rdb,RDB_TYPE_SET_INTSET);
+        else if (o->encoding == OBJ_ENCODING_ROARING)
+            return rdbSaveType(rdb,RDB_TYPE_SET_ROARING);
         else if (o->encoding == OBJ_ENCODING_HT)
             return rdbSaveType(rdb,RDB_TYPE_SET);
         else
             serverPanic("Unknown set encoding");
     case OBJ_ZSET:
-        if (o->encoding == OBJ_ENCODING_ZIPLIST)
-            return rdbSaveType(rdb,RDB_TYPE_ZSET_ZIPLIST);
-        else if (o->encoding == OBJ_ENCODING_SKIPLIST)
+        if (o->encoding == OBJ_ENCODING_LISTPACK)
+            return rdbSaveType(rdb,RDB_TYPE_ZSET_LISTPACK);
+        else if (o->encoding == OBJ_ENCODING_SKIPLIST ||
+                 o->encoding == OBJ_ENCODING_BTREE)
             return rdbSaveType(rdb,RDB_TYPE_ZSET);
         else
             serverPanic("Unknown sorted set encoding");
     case OBJ_HASH:
-        if (o->encoding == OBJ_ENCODING_ZIPLIST)
-            return rdbSaveType(rdb,RDB_TYPE_HASH_ZIPLIST);
+        if (o->encoding == OBJ_ENCODING_LISTPACK)
+            return rdbSaveType(rdb,RDB_TYPE_HASH_LISTPACK);
         else if (o->encoding == OBJ_ENCODING_HT)
             return rdbSaveType(rdb,RDB_TYPE_HASH);
         else
@@ -629,17 +638,27 @@ ssize_t rdbSaveObject(rio *rdb, robj *o) {
 
             if ((n = rdbSaveRawString(rdb,o->ptr,l)) == -1) return -1;
             nwritten += n;
+        } else if (o->encoding == OBJ_ENCODING_ROARING) {
+            size_t l = roaringBlobLen(o->ptr);
+            unsigned char *blob = zmalloc(l);
+
+            roaringSerialize(o->ptr,blob);
+            n = rdbSaveRawString(rdb,blob,l);
+            zfree(blob);
+            if (n == -1) return -1;
+            nwritten += n;
         } else {
             serverPanic("Unknown set encoding");
         }
     } else if (o->type == OBJ_ZSET) {
         /* Save a sorted set value */
-        if (o->encoding == OBJ_ENCODING_ZIPLIST) {
-            size_t l = ziplistBlobLen((unsigned char*)o->ptr);
+        if (o->encoding == OBJ_ENCODING_LISTPACK) {
+            size_t l = lpBytes((unsigned char*)o->ptr);
 
             if ((n = rdbSaveRawString(rdb,o->ptr,l)) == -1) return -1;
             nwritten += n;
-        } else if (o->encoding == OBJ_ENCODING_SKIPLIST) {
+        } else if (o->encoding == OBJ_ENCODING_SKIPLIST ||
+                   o->encoding == OBJ_ENCODING_BTREE) {
             zset *zs = o->ptr;
             dictIterator *di = dictGetIterator(zs->dict);
             dictEntry *de;
@@ -649,11 +668,11 @@ ssize_t rdbSaveObject(rio *rdb, robj *o) {
 
             while((de = dictNext(di)) != NULL) {
                 robj *eleobj = dictGetKey(de);
-                double *score = dictGetVal(de);
+                double score = zsetDictScore(zs,de);
 
                 if ((n = rdbSaveStringObject(rdb,eleobj)) == -1) return -1;
                 nwritten += n;
-                if ((n = rdbSaveDoubleValue(rdb,*score)) == -1) return -1;
+                if ((n = rdbSaveDoubleValue(rdb,score)) == -1) return -1;
                 nwritten += n;
             }
             dictReleaseIterator(di);
@@ -662,8 +681,8 @@ ssize_t rdbSaveObject(rio *rdb, robj *o) {
         }
     } else if (o->type == OBJ_HASH) {
         /* Save a hash value */
-        if (o->encoding == OBJ_ENCODING_ZIPLIST) {
-            size_t l = ziplistBlobLen((unsigned char*)o->ptr);
+        if (o->encoding == OBJ_ENCODING_LISTPACK) {
+            size_t l = lpBytes((unsigned char*)o->ptr);
 
             if ((n = rdbSaveRawString(rdb,o->ptr,l)) == -1) return -1;
             nwritten += n;
@@ -761,6 +780,57 @@ int rdbSaveInfoAuxFields(rio *rdb) {
     if (rdbSaveAuxFieldStrInt(rdb,"redis-bits",redis_bits) == -1) return -1;
     if (rdbSaveAuxFieldStrInt(rdb,"ctime",time(NULL)) == -1) return -1;
     if (rdbSaveAuxFieldStrInt(rdb,"used-mem",zmalloc_used_memory()) == -1) return -1;
+
+    //保存复制ID和偏移量，重启之后可以和master（或者slave和我们）进行部分同步
+    /* Save the replication ID and offset the data set corresponds to, so
+     * that after a restart a slave can PSYNC with its master, and a master
+     * can accept the PSYNC of its slaves. The header is written when the
+     * save starts, so the offset matches the data set that follows.
+     *
+     * The DB selected in the replication stream is saved as well: a master
+     * that did not emit any SELECT yet after a full sync will emit it before
+     * the next write, so 0 is fine in that case. */
+    int stream_db = -1;
+    if (server.masterhost == NULL && server.repl_backlog)
+        stream_db = server.slaveseldb == -1 ? 0 : server.slaveseldb;
+    else if (server.masterhost && server.master)
+        stream_db = server.master->db->id;
+    else if (server.masterhost && server.cached_master)
+        stream_db = server.cached_master->db->id;
+    if (stream_db != -1) {
+        if (rdbSaveAuxFieldStrInt(rdb,"repl-stream-db",stream_db) == -1) return -1;
+        if (rdbSaveAuxFieldStrStr(rdb,"repl-id",server.replid) == -1) return -1;
+        if (rdbSaveAuxFieldStrInt(rdb,"repl-offset",server.master_repl_offset) == -1) return -1;
+    }
+    return 1;
+}
+
+/* Write the RDB magic string and the default AUX fields, enabling the
+ * checksum of the rio if configured. Returns -1 on error. */
+int rdbSaveHeader(rio *rdb) {
+    char magic[10];
+
+    if (server.rdb_checksum)
+        rdb->update_cksum = rioGenericUpdateChecksum;
+    snprintf(magic,sizeof(magic),"REDIS%04d",RDB_VERSION);
+    if (rdbWriteRaw(rdb,magic,9) == -1) return -1;
+    if (rdbSaveInfoAuxFields(rdb) == -1) return -1;
+    return 1;
+}
+
+/* Write the EOF opcode followed by the CRC64 checksum. The checksum will be
+ * zero if checksum computation is disabled, the loading code skips the check
+ * in this case. Returns -1 on error. */
+int rdbSaveFooter(rio *rdb) {
+    uint64_t cksum;
+
+    if (rdbSaveType(rdb,RDB_OPCODE_EOF) == -1) return -1;
+    /*
+      CRC64校验和。如果禁用校验和计算，它将为零，在这种情况下，加载代码将跳过检查
+    */
+    cksum = rdb->cksum;
+    memrev64ifbe(&cksum);
+    if (rioWrite(rdb,&cksum,8) == 0) return -1;
     return 1;
 }
 
@@ -775,16 +845,10 @@ int rdbSaveInfoAuxFields(rio *rdb) {
 int rdbSaveRio(rio *rdb, int *error) {
     dictIterator *di = NULL;
     dictEntry *de;
-    char magic[10];
     int j;
     long long now = mstime();
-    uint64_t cksum;
 
-    if (server.rdb_checksum)
-        rdb->update_cksum = rioGenericUpdateChecksum;
-    snprintf(magic,sizeof(magic),"REDIS%04d",RDB_VERSION);
-    if (rdbWriteRaw(rdb,magic,9) == -1) goto werr;
-    if (rdbSaveInfoAuxFields(rdb) == -1) goto werr;
+    if (rdbSaveHeader(rdb) == -1) goto werr;
 
     //遍历所有数据库
     /*
@@ -830,17 +894,8 @@ int rdbSaveRio(rio *rdb, int *error) {
     }
     di = NULL; /* So that we don't release it again on error. */
 
-    /* EOF opcode */
-    if (rdbSaveType(rdb,RDB_OPCODE_EOF) == -1) goto werr;
-
-    /*
-      CRC64校验和。如果禁用校验和计算，它将为零，在这种情况下，加载代码将跳过检查
-    */
-    /* CRC64 checksum. It will be zero if checksum computation is disabled, the
-     * loading code skips the check in this case. */
-    cksum = rdb->cksum;
-    memrev64ifbe(&cksum);
-    if (rioWrite(rdb,&cksum,8) == 0) goto werr;
+    /* EOF opcode and CRC64 checksum. */
+    if (rdbSaveFooter(rdb) == -1) goto werr;
     return C_OK;
 
 werr:
@@ -940,12 +995,15 @@ int rdbSaveBackground(char *filename) {
     long long start;
 
     //当BGSAVE完成后 rdb_child_pid = -1
-    if (server.aof_child_pid != -1 || server.rdb_child_pid != -1) return C_ERR;
+    if (server.aof_child_pid != -1 || rdbSaveInProgress()) return C_ERR;
 
     server.dirty_before_bgsave = server.dirty;
     
     server.lastbgsave_try = time(NULL);
 
+    /* No child process with rdb-forkless-save, see snapshot.c. */
+    if (server.rdb_forkless_save) return snapshotStart(filename);
+
     start = ustime();
     //https://blog.csdn.net/qq_44824574/article/details/109144137
     //fork方法被调用一次，成功就会有两次返回；
@@ -998,6 +1056,32 @@ void rdbRemoveTempFile(pid_t childpid) {
     unlink(tmpfile);
 }
 
+/* Re-encode a ziplist found in an older RDB file as a listpack, freeing the
+ * original ziplist. Hashes and sorted sets are only held in memory as
+ * listpacks, so ZSET_ZIPLIST and HASH_ZIPLIST values are converted on load. */
+static unsigned char *rdbConvertZiplistToListpack(unsigned char *zl) {
+    unsigned char *lp = lpNew();
+    unsigned char *p = ziplistIndex(zl,0);
+    unsigned char *vstr;
+    unsigned int vlen;
+    long long vlong;
+
+    while (p != NULL) {
+        if (!ziplistGet(p,&vstr,&vlen,&vlong))
+            rdbExitReportCorruptRDB("Ziplist integrity check failed.");
+        if (vstr) {
+            lp = lpAppend(lp,vstr,vlen);
+        } else {
+            char buf[LONG_STR_SIZE];
+            int len = ll2string(buf,sizeof(buf),vlong);
+            lp = lpAppend(lp,(unsigned char*)buf,len);
+        }
+        p = ziplistNext(zl,p);
+    }
+    zfree(zl);
+    return lp;
+}
+
 /* Load a Redis object of the specified type from the specified file.
  * On success a newly allocated object is returned, otherwise NULL. */
 robj *rdbLoadObject(int rdbtype, rio *rdb) {
@@ -1019,7 +1103,10 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
 
         /* Load every single element of the list */
         while(len--) {
-            if ((ele = rdbLoadEncodedStringObject(rdb)) == NULL) return NULL;
+            if ((ele = rdbLoadEncodedStringObject(rdb)) == NULL) {
+                decrRefCount(o);
+                return NULL;
+            }
             dec = getDecodedObject(ele);
             size_t len = sdslen(dec->ptr);
             quicklistPushTail(o->ptr, dec->ptr, len);
@@ -1030,8 +1117,14 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
         /* Read list/set value */
         if ((len = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return NULL;
 
-        /* Use a regular set when there are too many entries. */
-        if (len > server.set_max_intset_entries) {
+        /* Use a regular set when there are too many entries, or a roaring
+         * set if configured so, until a member that is not an integer is
+         * found. */
+        if (len > server.set_max_intset_entries &&
+            server.set_large_encoding == OBJ_ENCODING_ROARING)
+        {
+            o = createRoaringObject();
+        } else if (len > server.set_max_intset_entries) {
             o = createSetObject();
             /* It's faster to expand the dict to the right size asap in order
              * to avoid rehashing */
@@ -1044,7 +1137,10 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
         /* Load every single element of the list/set */
         for (i = 0; i < len; i++) {
             long long llval;
-            if ((ele = rdbLoadEncodedStringObject(rdb)) == NULL) return NULL;
+            if ((ele = rdbLoadEncodedStringObject(rdb)) == NULL) {
+                decrRefCount(o);
+                return NULL;
+            }
             ele = tryObjectEncoding(ele);
 
             if (o->encoding == OBJ_ENCODING_INTSET) {
@@ -1055,6 +1151,13 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
                     setTypeConvert(o,OBJ_ENCODING_HT);
                     dictExpand(o->ptr,len);
                 }
+            } else if (o->encoding == OBJ_ENCODING_ROARING) {
+                if (isObjectRepresentableAsLongLong(ele,&llval) == C_OK) {
+                    roaringAdd(o->ptr,llval);
+                } else {
+                    setTypeConvert(o,OBJ_ENCODING_HT);
+                    dictExpand(o->ptr,len);
+                }
             }
 
             /* This will also be called when the set was just converted
@@ -1065,6 +1168,7 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
                 decrRefCount(ele);
             }
         }
+        if (o->encoding == OBJ_ENCODING_ROARING) roaringOptimize(o->ptr);
     } else if (rdbtype == RDB_TYPE_ZSET) {
         /* Read list/set value */
         size_t zsetlen;
@@ -1079,25 +1183,30 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
         while(zsetlen--) {
             robj *ele;
             double score;
-            zskiplistNode *znode;
 
-            if ((ele = rdbLoadEncodedStringObject(rdb)) == NULL) return NULL;
+            if ((ele = rdbLoadEncodedStringObject(rdb)) == NULL) {
+                decrRefCount(o);
+                return NULL;
+            }
             ele = tryObjectEncoding(ele);
-            if (rdbLoadDoubleValue(rdb,&score) == -1) return NULL;
+            if (rdbLoadDoubleValue(rdb,&score) == -1) {
+                decrRefCount(ele);
+                decrRefCount(o);
+                return NULL;
+            }
 
             /* Don't care about integer-encoded strings. */
             if (sdsEncodedObject(ele) && sdslen(ele->ptr) > maxelelen)
                 maxelelen = sdslen(ele->ptr);
 
-            znode = zslInsert(zs->zsl,score,ele);
-            dictAdd(zs->dict,ele,&znode->score);
-            incrRefCount(ele); /* added to skiplist */
+            zsetAddNewElement(zs,score,ele);
+            decrRefCount(ele);
         }
 
         /* Convert *after* loading, since sorted sets are not stored ordered. */
         if (zsetLength(o) <= server.zset_max_ziplist_entries &&
             maxelelen <= server.zset_max_ziplist_value)
-                zsetConvert(o,OBJ_ENCODING_ZIPLIST);
+                zsetConvert(o,OBJ_ENCODING_LISTPACK);
     } else if (rdbtype == RDB_TYPE_HASH) {
         size_t len;
         int ret;
@@ -1111,22 +1220,29 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
         if (len > server.hash_max_ziplist_entries)
             hashTypeConvert(o, OBJ_ENCODING_HT);
 
-        /* Load every field and value into the ziplist */
-        while (o->encoding == OBJ_ENCODING_ZIPLIST && len > 0) {
+        /* Load every field and value into the listpack */
+        while (o->encoding == OBJ_ENCODING_LISTPACK && len > 0) {
             robj *field, *value;
 
             len--;
             /* Load raw strings */
             field = rdbLoadStringObject(rdb);
-            if (field == NULL) return NULL;
+            if (field == NULL) {
+                decrRefCount(o);
+                return NULL;
+            }
             serverAssert(sdsEncodedObject(field));
             value = rdbLoadStringObject(rdb);
-            if (value == NULL) return NULL;
+            if (value == NULL) {
+                decrRefCount(field);
+                decrRefCount(o);
+                return NULL;
+            }
             serverAssert(sdsEncodedObject(value));
 
-            /* Add pair to ziplist */
-            o->ptr = ziplistPush(o->ptr, field->ptr, sdslen(field->ptr), ZIPLIST_TAIL);
-            o->ptr = ziplistPush(o->ptr, value->ptr, sdslen(value->ptr), ZIPLIST_TAIL);
+            /* Add pair to listpack */
+            o->ptr = lpAppend(o->ptr, field->ptr, sdslen(field->ptr));
+            o->ptr = lpAppend(o->ptr, value->ptr, sdslen(value->ptr));
             /* Convert to hash table if size threshold is exceeded */
             if (sdslen(field->ptr) > server.hash_max_ziplist_value ||
                 sdslen(value->ptr) > server.hash_max_ziplist_value)
@@ -1147,9 +1263,16 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
             len--;
             /* Load encoded strings */
             field = rdbLoadEncodedStringObject(rdb);
-            if (field == NULL) return NULL;
+            if (field == NULL) {
+                decrRefCount(o);
+                return NULL;
+            }
             value = rdbLoadEncodedStringObject(rdb);
-            if (value == NULL) return NULL;
+            if (value == NULL) {
+                decrRefCount(field);
+                decrRefCount(o);
+                return NULL;
+            }
 
             field = tryObjectEncoding(field);
             value = tryObjectEncoding(value);
@@ -1170,17 +1293,41 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
                             server.list_compress_depth);
 
         while (len--) {
-            unsigned char *zl = rdbGenericLoadStringObject(rdb,RDB_LOAD_PLAIN);
-            if (zl == NULL) return NULL;
+            unsigned char *zl = rdbGenericLoadStringObject(rdb,RDB_LOAD_PLAIN,NULL);
+            if (zl == NULL) {
+                decrRefCount(o);
+                return NULL;
+            }
             quicklistAppendZiplist(o->ptr, zl);
         }
+    } else if (rdbtype == RDB_TYPE_SET_ROARING) {
+        size_t encoded_len;
+        unsigned char *encoded =
+            rdbGenericLoadStringObject(rdb,RDB_LOAD_PLAIN,&encoded_len);
+        roaring *r;
+
+        if (encoded == NULL) return NULL;
+        r = roaringDeserialize(encoded,encoded_len);
+        zfree(encoded);
+        if (r == NULL)
+            rdbExitReportCorruptRDB("Roaring set integrity check failed.");
+        /* Roaring sets are loaded as they are whatever set-large-encoding
+         * says: converting a big one to a hash table could need several
+         * times the memory it was saved from. */
+        roaringOptimize(r);
+        o = createObject(OBJ_SET,r);
+        o->encoding = OBJ_ENCODING_ROARING;
     } else if (rdbtype == RDB_TYPE_HASH_ZIPMAP  ||
                rdbtype == RDB_TYPE_LIST_ZIPLIST ||
                rdbtype == RDB_TYPE_SET_INTSET   ||
                rdbtype == RDB_TYPE_ZSET_ZIPLIST ||
-               rdbtype == RDB_TYPE_HASH_ZIPLIST)
+               rdbtype == RDB_TYPE_HASH_ZIPLIST ||
+               rdbtype == RDB_TYPE_ZSET_LISTPACK ||
+               rdbtype == RDB_TYPE_HASH_LISTPACK)
     {
-        unsigned char *encoded = rdbGenericLoadStringObject(rdb,RDB_LOAD_PLAIN);
+        size_t encoded_len;
+        unsigned char *encoded =
+            rdbGenericLoadStringObject(rdb,RDB_LOAD_PLAIN,&encoded_len);
         if (encoded == NULL) return NULL;
         o = createObject(OBJ_STRING,encoded); /* Obj type fixed below. */
 
@@ -1192,10 +1339,10 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
          * converted. */
         switch(rdbtype) {
             case RDB_TYPE_HASH_ZIPMAP:
-                /* Convert to ziplist encoded hash. This must be deprecated
+                /* Convert to listpack encoded hash. This must be deprecated
                  * when loading dumps created by Redis 2.4 gets deprecated. */
                 {
-                    unsigned char *zl = ziplistNew();
+                    unsigned char *lp = lpNew();
                     unsigned char *zi = zipmapRewind(o->ptr);
                     unsigned char *fstr, *vstr;
                     unsigned int flen, vlen;
@@ -1204,14 +1351,14 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
                     while ((zi = zipmapNext(zi, &fstr, &flen, &vstr, &vlen)) != NULL) {
                         if (flen > maxlen) maxlen = flen;
                         if (vlen > maxlen) maxlen = vlen;
-                        zl = ziplistPush(zl, fstr, flen, ZIPLIST_TAIL);
-                        zl = ziplistPush(zl, vstr, vlen, ZIPLIST_TAIL);
+                        lp = lpAppend(lp, fstr, flen);
+                        lp = lpAppend(lp, vstr, vlen);
                     }
 
                     zfree(o->ptr);
-                    o->ptr = zl;
+                    o->ptr = lp;
                     o->type = OBJ_HASH;
-                    o->encoding = OBJ_ENCODING_ZIPLIST;
+                    o->encoding = OBJ_ENCODING_LISTPACK;
 
                     if (hashTypeLength(o) > server.hash_max_ziplist_entries ||
                         maxlen > server.hash_max_ziplist_value)
@@ -1229,17 +1376,29 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
                 o->type = OBJ_SET;
                 o->encoding = OBJ_ENCODING_INTSET;
                 if (intsetLen(o->ptr) > server.set_max_intset_entries)
-                    setTypeConvert(o,OBJ_ENCODING_HT);
+                    setTypeConvert(o,server.set_large_encoding);
                 break;
             case RDB_TYPE_ZSET_ZIPLIST:
+            case RDB_TYPE_ZSET_LISTPACK:
+                if (rdbtype == RDB_TYPE_ZSET_ZIPLIST) {
+                    o->ptr = rdbConvertZiplistToListpack(o->ptr);
+                } else if (!lpValidateIntegrity(o->ptr,encoded_len)) {
+                    rdbExitReportCorruptRDB("Zset listpack integrity check failed.");
+                }
                 o->type = OBJ_ZSET;
-                o->encoding = OBJ_ENCODING_ZIPLIST;
+                o->encoding = OBJ_ENCODING_LISTPACK;
                 if (zsetLength(o) > server.zset_max_ziplist_entries)
-                    zsetConvert(o,OBJ_ENCODING_SKIPLIST);
+                    zsetConvert(o,server.zset_large_encoding);
                 break;
             case RDB_TYPE_HASH_ZIPLIST:
+            case RDB_TYPE_HASH_LISTPACK:
+                if (rdbtype == RDB_TYPE_HASH_ZIPLIST) {
+                    o->ptr = rdbConvertZiplistToListpack(o->ptr);
+                } else if (!lpValidateIntegrity(o->ptr,encoded_len)) {
+                    rdbExitReportCorruptRDB("Hash listpack integrity check failed.");
+                }
                 o->type = OBJ_HASH;
-                o->encoding = OBJ_ENCODING_ZIPLIST;
+                o->encoding = OBJ_ENCODING_LISTPACK;
                 if (hashTypeLength(o) > server.hash_max_ziplist_entries)
                     hashTypeConvert(o, OBJ_ENCODING_HT);
                 break;
@@ -1254,14 +1413,20 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
 }
 
 /* Mark that we are loading in the global state and setup the fields
- * needed to provide loading stats. */
-void startLoading(FILE *fp) {
-    struct stat sb;
-
+ * needed to provide loading stats. 'size' is the size of the payload if
+ * known, otherwise zero. */
+void startLoading(off_t size) {
     /* Load the DB */
     server.loading = 1; //标记下
     server.loading_start_time = time(NULL); //开始时间
     server.loading_loaded_bytes = 0;
+    server.loading_total_bytes = size;
+}
+
+/* Like startLoading() but takes the size of the payload from the file. */
+void startLoadingFile(FILE *fp) {
+    struct stat sb;
+
     /*
     stat(fileno(fp), &sb) 是一个在 Redis 源码中常见的系统调用组合，用于获取文件的状态信息。
     下面我将结合其常见用途和潜在问题为您详细解释。
@@ -1274,9 +1439,9 @@ void startLoading(FILE *fp) {
     
     */
     if (fstat(fileno(fp), &sb) == -1) {
-        server.loading_total_bytes = 0;
+        startLoading(0);
     } else {
-        server.loading_total_bytes = sb.st_size;
+        startLoading(sb.st_size);
     }
 }
 
@@ -1287,6 +1452,26 @@ void loadingProgress(off_t pos) {
         server.stat_peak_memory = zmalloc_used_memory();
 }
 
+/* Items per second processed by the specified stage of the RDB loading
+ * pipeline since the loading started: bytes for RDB_LOAD_STAGE_READ, keys
+ * for the other stages. */
+double loadingStageThroughput(int stage) {
+    long long items, elapsed = ustime()-server.loading_stage_start;
+
+    atomicGet(server.loading_stage_items[stage],items);
+    return elapsed > 0 ? (double)items*1000000/elapsed : 0;
+}
+
+/* Percentage of the time the threads of the specified stage of the RDB
+ * loading pipeline were busy, instead of waiting for the other stages. */
+double loadingStageBusyPerc(int stage) {
+    long long busy, elapsed = ustime()-server.loading_stage_start;
+    int threads = (stage == RDB_LOAD_STAGE_BUILD) ? server.loading_threads-1 : 1;
+
+    atomicGet(server.loading_stage_busy[stage],busy);
+    return elapsed > 0 ? (double)busy*100/elapsed/threads : 0;
+}
+
 /* Loading finished */
 void stopLoading(void) {
     server.loading = 0;
@@ -1311,32 +1496,587 @@ void rdbLoadProgressCallback(rio *r, const void *buf, size_t len) {
         loadingProgress(r->processed_bytes);
 
         //处理阻塞期间的事件
-        processEventsWhileBlocked();
+        if (server.async_loading)
+            disklessLoadProcessEvents();
+        else
+            processEventsWhileBlocked();
     }
 }
 
-/*
- 加载rdb文件
-*/
-int rdbLoad(char *filename) {
+/* Handle an AUX field read from the RDB file. The replication information
+ * saved by rdbSaveInfoAuxFields() is stored into 'rsi' (if not NULL), all
+ * the other fields are just logged. */
+static void rdbLoadAuxField(robj *auxkey, robj *auxval, rdbSaveInfo *rsi) {
+    char *key = auxkey->ptr, *val = auxval->ptr;
+
+    if (key[0] == '%') {
+        /* All the fields with a name staring with '%' are considered
+         * information fields and are logged at startup with a log
+         * level of NOTICE. */
+        serverLog(LL_NOTICE,"RDB '%s': %s",key,val);
+    } else if (!strcasecmp(key,"repl-stream-db")) {
+        if (rsi) rsi->repl_stream_db = atoi(val);
+    } else if (!strcasecmp(key,"repl-id")) {
+        if (rsi && sdslen(auxval->ptr) == CONFIG_RUN_ID_SIZE) {
+            memcpy(rsi->repl_id,val,CONFIG_RUN_ID_SIZE+1);
+            rsi->repl_id_is_set = 1;
+        }
+    } else if (!strcasecmp(key,"repl-offset")) {
+        if (rsi) rsi->repl_offset = strtoll(val,NULL,10);
+    } else {
+        /* We ignore fields we don't understand, as by AUX field
+         * contract. */
+        serverLog(LL_DEBUG,"Unrecognized RDB AUX field: '%s'",key);
+    }
+}
+
+/* ----------------------------------------------------------------------------
+ * Multi threaded RDB loading pipeline.
+ *
+ * When rdb-load-threads is greater than one, rdbLoad() splits the work in
+ * three stages connected by a queue of batches of keys:
+ *
+ * 1) A reader thread parses the opcodes of the file and copies every key and
+ *    value, in the RDB format, into the payload of a record. LZF compressed
+ *    strings are decompressed while copying, so that the payload only
+ *    contains plain and integer encoded strings.
+ * 2) rdb-load-threads-1 worker threads create the key and value objects from
+ *    the payloads with rdbLoadObject(), building the quicklists, ziplists,
+ *    skiplists and hash tables.
+ * 3) The main thread takes the batches in file order and only adds the keys
+ *    to the databases, serving clients from time to time as usually.
+ *
+ * Errors in the reader or in the workers are fatal exactly like in the
+ * single threaded loader, so no error is ever reported back to the main
+ * thread.
+ * ------------------------------------------------------------------------- */
+
+#define RDB_PIPE_BATCH_KEYS 256            /* Max records in a batch. */
+#define RDB_PIPE_BATCH_BYTES (1024*1024)   /* Max payload bytes in a batch. */
+#define RDB_PIPE_BATCHES_PER_THREAD 4      /* Max batches in flight. */
+
+typedef struct rdbPipeRecord {
+    int type;               /* RDB object type or RDB_OPCODE_RESIZEDB. */
+    int dbid;               /* Database the key belongs to. */
+    long long expiretime;   /* Expire in milliseconds or -1. */
+    uint32_t db_size, expires_size; /* RDB_OPCODE_RESIZEDB hint. */
+    sds payload;            /* Key and value, strings not compressed. */
+    robj *key, *val;        /* Objects created by the workers. */
+} rdbPipeRecord;
+
+typedef struct rdbPipeBatch {
+    int numrecords;
+    size_t bytes;           /* Payload bytes of the records. */
+    int built;              /* Objects created, ready to be added. */
+    rdbPipeRecord records[RDB_PIPE_BATCH_KEYS];
+} rdbPipeBatch;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t todo_cond;   /* Signaled when new batches are queued. */
+    pthread_cond_t done_cond;   /* Signaled when a batch is built. */
+    pthread_cond_t room_cond;   /* Signaled when a batch is consumed. */
+    list *todo;                 /* Batches waiting for a worker. */
+    list *inflight;             /* All the batches not yet added, file order. */
+    int max_inflight;
+    int reader_done;            /* The reader reached the end of file. */
+    rio *rdb;                   /* File read by the reader thread. */
+    int rdbver;
+    rdbSaveInfo *rsi;           /* Replication info found by the reader. */
+} rdbpipe;
+
+/* Add 'count' to the items processed by the specified loading stage and
+ * 'usec' to the time it was busy. Called by the pipeline threads. */
+static void rdbPipeStageUpdate(int stage, long long count, long long usec) {
+    atomicIncr(server.loading_stage_items[stage],count);
+    atomicIncr(server.loading_stage_busy[stage],usec);
+}
+
+/* rio checksum callback of the reader thread: like rdbLoadProgressCallback()
+ * but the events are processed by the main thread, see rdbPipeProgress(). */
+static void rdbPipeReadCallback(rio *r, const void *buf, size_t len) {
+    if (server.rdb_checksum)
+        rioGenericUpdateChecksum(r, buf, len);
+}
+
+/* Append 'len' bytes read from 'rdb' to the sds pointed by 'out'. */
+static int rdbPipeCopyRaw(rio *rdb, sds *out, size_t len) {
+    size_t oldlen = sdslen(*out);
+
+    *out = sdsMakeRoomFor(*out,len);
+    if (len && rioRead(rdb,*out+oldlen,len) == 0) return -1;
+    sdsIncrLen(*out,len);
+    return 0;
+}
+
+/* Append the RDB encoding of the length 'len' to the sds pointed by 'out'. */
+static void rdbPipeCatLen(sds *out, uint32_t len) {
+    rio r;
+
+    rioInitWithBuffer(&r,*out);
+    rdbSaveLen(&r,len);
+    *out = r.io.buffer.ptr;
+}
+
+/* Copy a length from 'rdb' to 'out' returning it, or RDB_LENERR. */
+static uint32_t rdbPipeCopyLen(rio *rdb, sds *out) {
+    uint32_t len = rdbLoadLen(rdb,NULL);
+
+    if (len != RDB_LENERR) rdbPipeCatLen(out,len);
+    return len;
+}
+
+/* Copy a string from 'rdb' to 'out', decompressing LZF encoded strings. */
+static int rdbPipeCopyString(rio *rdb, sds *out) {
+    int isencoded;
+    uint32_t len = rdbLoadLen(rdb,&isencoded);
+
+    if (len == RDB_LENERR) return -1;
+    if (isencoded) {
+        unsigned char enc = (RDB_ENCVAL<<6)|len;
+        unsigned int clen, ulen;
+        unsigned char *c;
+        sds val;
+
+        switch(len) {
+        case RDB_ENC_INT8:
+        case RDB_ENC_INT16:
+        case RDB_ENC_INT32:
+            *out = sdscatlen(*out,&enc,1);
+            return rdbPipeCopyRaw(rdb,out,
+                len == RDB_ENC_INT8 ? 1 : (len == RDB_ENC_INT16 ? 2 : 4));
+        case RDB_ENC_LZF:
+            if ((clen = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return -1;
+            if ((ulen = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return -1;
+            c = zmalloc(clen);
+            if (rioRead(rdb,c,clen) == 0) {
+                zfree(c);
+                return -1;
+            }
+            /* Decompress in place at the end of the payload. */
+            rdbPipeCatLen(out,ulen);
+            val = sdsMakeRoomFor(*out,ulen);
+            *out = val;
+            if (lzf_decompress(c,clen,val+sdslen(val),ulen) == 0)
+                rdbExitReportCorruptRDB("Invalid LZF compressed string");
+            zfree(c);
+            sdsIncrLen(*out,ulen);
+            return 0;
+        default:
+            rdbExitReportCorruptRDB("Unknown RDB string encoding type %d",len);
+        }
+    }
+    rdbPipeCatLen(out,len);
+    return rdbPipeCopyRaw(rdb,out,len);
+}
+
+/* Copy a double value from 'rdb' to 'out'. */
+static int rdbPipeCopyDouble(rio *rdb, sds *out) {
+    unsigned char len;
+
+    if (rioRead(rdb,&len,1) == 0) return -1;
+    *out = sdscatlen(*out,&len,1);
+    if (len >= 253) return 0; /* Infinities and NaN. */
+    return rdbPipeCopyRaw(rdb,out,len);
+}
+
+/* Copy the value of the specified RDB type from 'rdb' to 'out'. */
+static int rdbPipeCopyObject(int rdbtype, rio *rdb, sds *out) {
+    uint32_t len, j;
+
+    switch(rdbtype) {
+    case RDB_TYPE_STRING:
+    case RDB_TYPE_HASH_ZIPMAP:
+    case RDB_TYPE_LIST_ZIPLIST:
+    case RDB_TYPE_SET_INTSET:
+    case RDB_TYPE_ZSET_ZIPLIST:
+    case RDB_TYPE_HASH_ZIPLIST:
+    case RDB_TYPE_ZSET_LISTPACK:
+    case RDB_TYPE_HASH_LISTPACK:
+    case RDB_TYPE_SET_ROARING:
+        return rdbPipeCopyString(rdb,out);
+    case RDB_TYPE_LIST:
+    case RDB_TYPE_SET:
+    case RDB_TYPE_LIST_QUICKLIST:
+        if ((len = rdbPipeCopyLen(rdb,out)) == RDB_LENERR) return -1;
+        for (j = 0; j < len; j++)
+            if (rdbPipeCopyString(rdb,out) == -1) return -1;
+        return 0;
+    case RDB_TYPE_ZSET:
+        if ((len = rdbPipeCopyLen(rdb,out)) == RDB_LENERR) return -1;
+        for (j = 0; j < len; j++) {
+            if (rdbPipeCopyString(rdb,out) == -1) return -1;
+            if (rdbPipeCopyDouble(rdb,out) == -1) return -1;
+        }
+        return 0;
+    case RDB_TYPE_HASH:
+        if ((len = rdbPipeCopyLen(rdb,out)) == RDB_LENERR) return -1;
+        for (j = 0; j < len; j++) {
+            if (rdbPipeCopyString(rdb,out) == -1) return -1;
+            if (rdbPipeCopyString(rdb,out) == -1) return -1;
+        }
+        return 0;
+    default:
+        rdbExitReportCorruptRDB("Unknown RDB encoding type %d",rdbtype);
+        return -1; /* Never reached. */
+    }
+}
+
+/* Queue a batch read by the reader, waiting if too many are in flight. */
+static void rdbPipeQueueBatch(rdbPipeBatch *batch, long long *waited) {
+    long long start = ustime();
+
+    pthread_mutex_lock(&rdbpipe.lock);
+    while (listLength(rdbpipe.inflight) >= (unsigned)rdbpipe.max_inflight)
+        pthread_cond_wait(&rdbpipe.room_cond,&rdbpipe.lock);
+    listAddNodeTail(rdbpipe.inflight,batch);
+    listAddNodeTail(rdbpipe.todo,batch);
+    pthread_cond_signal(&rdbpipe.todo_cond);
+    pthread_mutex_unlock(&rdbpipe.lock);
+    *waited += ustime()-start;
+}
+
+/* Body of the reader thread: parse the file until the EOF opcode and verify
+ * the checksum, queueing the records in batches. */
+static void *rdbPipeReaderMain(void *arg) {
+    rio *rdb = rdbpipe.rdb;
+    rdbPipeBatch *batch = zcalloc(sizeof(*batch));
+    int dbid = 0, type;
+    long long expiretime, last = ustime(), waited = 0, now;
+    size_t processed = rdb->processed_bytes;
+    UNUSED(arg);
+
+    while(1) {
+        rdbPipeRecord *rec;
+        expiretime = -1;
+
+        /* Read type. */
+        if ((type = rdbLoadType(rdb)) == -1) goto eoferr;
+
+        /* Handle special types, see rdbLoad() for the details. */
+        if (type == RDB_OPCODE_EXPIRETIME) {
+            if ((expiretime = rdbLoadTime(rdb)) == -1) goto eoferr;
+            if ((type = rdbLoadType(rdb)) == -1) goto eoferr;
+            expiretime *= 1000;
+        } else if (type == RDB_OPCODE_EXPIRETIME_MS) {
+            if ((expiretime = rdbLoadMillisecondTime(rdb)) == -1) goto eoferr;
+            if ((type = rdbLoadType(rdb)) == -1) goto eoferr;
+        } else if (type == RDB_OPCODE_EOF) {
+            break;
+        } else if (type == RDB_OPCODE_SELECTDB) {
+            uint32_t id;
+
+            if ((id = rdbLoadLen(rdb,NULL)) == RDB_LENERR) goto eoferr;
+            if (id >= (unsigned)server.dbnum) {
+                serverLog(LL_WARNING,
+                    "FATAL: Data file was created with a Redis "
+                    "server configured to handle more than %d "
+                    "databases. Exiting\n", server.dbnum);
+                exit(1);
+            }
+            dbid = id;
+            continue;
+        } else if (type == RDB_OPCODE_AUX) {
+            robj *auxkey, *auxval;
+
+            if ((auxkey = rdbLoadStringObject(rdb)) == NULL) goto eoferr;
+            if ((auxval = rdbLoadStringObject(rdb)) == NULL) goto eoferr;
+            rdbLoadAuxField(auxkey,auxval,rdbpipe.rsi);
+            decrRefCount(auxkey);
+            decrRefCount(auxval);
+            continue;
+        }
+
+        rec = batch->records+batch->numrecords;
+        rec->type = type;
+        rec->dbid = dbid;
+        rec->expiretime = expiretime;
+        rec->payload = NULL;
+        if (type == RDB_OPCODE_RESIZEDB) {
+            /* The tables are resized by the main thread. */
+            if ((rec->db_size = rdbLoadLen(rdb,NULL)) == RDB_LENERR)
+                goto eoferr;
+            if ((rec->expires_size = rdbLoadLen(rdb,NULL)) == RDB_LENERR)
+                goto eoferr;
+        } else {
+            rec->payload = sdsempty();
+            if (rdbPipeCopyString(rdb,&rec->payload) == -1 ||
+                rdbPipeCopyObject(type,rdb,&rec->payload) == -1)
+            {
+                sdsfree(rec->payload);
+                goto eoferr;
+            }
+            batch->bytes += sdslen(rec->payload);
+        }
+        batch->numrecords++;
+
+        if (batch->numrecords == RDB_PIPE_BATCH_KEYS ||
+            batch->bytes >= RDB_PIPE_BATCH_BYTES)
+        {
+            rdbPipeQueueBatch(batch,&waited);
+            now = ustime();
+            rdbPipeStageUpdate(RDB_LOAD_STAGE_READ,
+                rdb->processed_bytes-processed,now-last-waited);
+            processed = rdb->processed_bytes;
+            last = now;
+            waited = 0;
+            batch = zcalloc(sizeof(*batch));
+        }
+    }
+
+    /* Verify the checksum if RDB version is >= 5 */
+    if (rdbpipe.rdbver >= 5 && server.rdb_checksum) {
+        uint64_t cksum, expected = rdb->cksum;
+
+        if (rioRead(rdb,&cksum,8) == 0) goto eoferr;
+        memrev64ifbe(&cksum);
+        if (cksum == 0) {
+            serverLog(LL_WARNING,"RDB file was saved with checksum disabled: no check performed.");
+        } else if (cksum != expected) {
+            serverLog(LL_WARNING,"Wrong RDB checksum. Aborting now.");
+            rdbExitReportCorruptRDB("RDB CRC error");
+        }
+    }
+
+    if (batch->numrecords)
+        rdbPipeQueueBatch(batch,&waited);
+    else
+        zfree(batch);
+    rdbPipeStageUpdate(RDB_LOAD_STAGE_READ,
+        rdb->processed_bytes-processed,ustime()-last-waited);
+    pthread_mutex_lock(&rdbpipe.lock);
+    rdbpipe.reader_done = 1;
+    pthread_cond_broadcast(&rdbpipe.todo_cond);
+    pthread_cond_signal(&rdbpipe.done_cond);
+    pthread_mutex_unlock(&rdbpipe.lock);
+    return NULL;
+
+eoferr: /* unexpected end of file is handled here with a fatal exit */
+    serverLog(LL_WARNING,"Short read or OOM loading DB. Unrecoverable error, aborting now.");
+    rdbExitReportCorruptRDB("Unexpected EOF reading RDB file");
+    return NULL; /* Just to avoid warning */
+}
+
+/* Body of the worker threads: create the objects of the queued batches. */
+static void *rdbPipeWorkerMain(void *arg) {
+    UNUSED(arg);
+
+    pthread_mutex_lock(&rdbpipe.lock);
+    while(1) {
+        rdbPipeBatch *batch;
+        listNode *ln;
+        long long start;
+        int j;
+
+        while (listLength(rdbpipe.todo) == 0 && !rdbpipe.reader_done)
+            pthread_cond_wait(&rdbpipe.todo_cond,&rdbpipe.lock);
+        if (listLength(rdbpipe.todo) == 0) break;
+        ln = listFirst(rdbpipe.todo);
+        batch = ln->value;
+        listDelNode(rdbpipe.todo,ln);
+        pthread_mutex_unlock(&rdbpipe.lock);
+
+        start = ustime();
+        for (j = 0; j < batch->numrecords; j++) {
+            rdbPipeRecord *rec = batch->records+j;
+            rio payload;
+
+            if (rec->type == RDB_OPCODE_RESIZEDB) continue;
+            rioInitWithBuffer(&payload,rec->payload);
+            if ((rec->key = rdbLoadStringObject(&payload)) == NULL ||
+                (rec->val = rdbLoadObject(rec->type,&payload)) == NULL)
+            {
+                rdbExitReportCorruptRDB("Truncated RDB key or value");
+            }
+            sdsfree(rec->payload);
+            rec->payload = NULL;
+        }
+        rdbPipeStageUpdate(RDB_LOAD_STAGE_BUILD,batch->numrecords,
+                           ustime()-start);
+
+        pthread_mutex_lock(&rdbpipe.lock);
+        batch->built = 1;
+        pthread_cond_signal(&rdbpipe.done_cond);
+    }
+    pthread_mutex_unlock(&rdbpipe.lock);
+    return NULL;
+}
+
+/* Called by the main thread while waiting for the other stages: refresh the
+ * loading progress and serve the clients like rdbLoadProgressCallback()
+ * does, at most every loading_process_events_interval_bytes bytes read,
+ * unless 'force' is true. */
+static void rdbPipeProgress(off_t *processed, int force) {
+    off_t interval = server.loading_process_events_interval_bytes;
+    long long pos;
+
+    atomicGet(server.loading_stage_items[RDB_LOAD_STAGE_READ],pos);
+    if (!force && (!interval || pos/interval == *processed/interval)) return;
+    *processed = pos;
+    updateCachedTime();
+    if (server.masterhost && server.repl_state == REPL_STATE_TRANSFER)
+        replicationSendNewlineToMaster();
+    loadingProgress(pos);
+    processEventsWhileBlocked();
+}
+
+/* Load the RDB file from 'rdb', already positioned after the header, using
+ * the loading pipeline. Errors are fatal, so the function always returns
+ * C_OK. */
+static int rdbLoadPipelined(rio *rdb, int rdbver, rdbSaveInfo *rsi) {
+    int numworkers = server.rdb_load_threads-1, j;
+    pthread_t reader, *workers = zmalloc(sizeof(pthread_t)*numworkers);
+    long long now = mstime();
+    off_t processed = 0;
+    sigset_t sigset, oldset;
+
+    pthread_mutex_init(&rdbpipe.lock,NULL);
+    pthread_cond_init(&rdbpipe.todo_cond,NULL);
+    pthread_cond_init(&rdbpipe.done_cond,NULL);
+    pthread_cond_init(&rdbpipe.room_cond,NULL);
+    rdbpipe.todo = listCreate();
+    rdbpipe.inflight = listCreate();
+    rdbpipe.max_inflight = numworkers*RDB_PIPE_BATCHES_PER_THREAD;
+    rdbpipe.reader_done = 0;
+    rdbpipe.rdb = rdb;
+    rdbpipe.rdbver = rdbver;
+    rdbpipe.rsi = rsi;
+    rdb->update_cksum = rdbPipeReadCallback;
+    server.loading_threads = server.rdb_load_threads;
+    server.loading_stage_start = ustime();
+    for (j = 0; j < RDB_LOAD_STAGES; j++) {
+        server.loading_stage_items[j] = 0;
+        server.loading_stage_busy[j] = 0;
+    }
+
+    /* The threads inherit the signal mask: block SIGALRM so that only the
+     * main thread receives the watchdog signal. */
+    sigemptyset(&sigset);
+    sigaddset(&sigset, SIGALRM);
+    pthread_sigmask(SIG_BLOCK, &sigset, &oldset);
+    if (pthread_create(&reader,NULL,rdbPipeReaderMain,NULL) != 0) {
+        serverLog(LL_WARNING,"Fatal: Can't create the RDB loading threads.");
+        exit(1);
+    }
+    for (j = 0; j < numworkers; j++) {
+        if (pthread_create(workers+j,NULL,rdbPipeWorkerMain,NULL) != 0) {
+            serverLog(LL_WARNING,"Fatal: Can't create the RDB loading threads.");
+            exit(1);
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+
+    pthread_mutex_lock(&rdbpipe.lock);
+    while(1) {
+        listNode *ln = listFirst(rdbpipe.inflight);
+        rdbPipeBatch *batch = ln ? ln->value : NULL;
+        long long start;
+
+        if (batch == NULL || !batch->built) {
+            struct timespec ts;
+            struct timeval tv;
+
+            if (batch == NULL && rdbpipe.reader_done) break;
+            /* Wait at most 100 milliseconds so that the clients are still
+             * served if the other stages are slow. */
+            gettimeofday(&tv,NULL);
+            ts.tv_sec = tv.tv_sec;
+            ts.tv_nsec = (tv.tv_usec+100000)*1000;
+            if (ts.tv_nsec >= 1000000000) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000;
+            }
+            if (pthread_cond_timedwait(&rdbpipe.done_cond,&rdbpipe.lock,&ts)
+                == ETIMEDOUT)
+            {
+                pthread_mutex_unlock(&rdbpipe.lock);
+                rdbPipeProgress(&processed,1);
+                pthread_mutex_lock(&rdbpipe.lock);
+            }
+            continue;
+        }
+        listDelNode(rdbpipe.inflight,ln);
+        pthread_cond_signal(&rdbpipe.room_cond);
+        pthread_mutex_unlock(&rdbpipe.lock);
+
+        start = ustime();
+        for (j = 0; j < batch->numrecords; j++) {
+            rdbPipeRecord *rec = batch->records+j;
+            redisDb *db = server.db+rec->dbid;
+
+            if (rec->type == RDB_OPCODE_RESIZEDB) {
+                dictExpand(db->dict,rec->db_size);
+                dictExpand(db->expires,rec->expires_size);
+                continue;
+            }
+            /* Skip already expired keys, see rdbLoad(). */
+            if (server.masterhost == NULL && rec->expiretime != -1 &&
+                rec->expiretime < now)
+            {
+                decrRefCount(rec->key);
+                decrRefCount(rec->val);
+                continue;
+            }
+            dbAdd(db,rec->key,rec->val);
+            if (rec->expiretime != -1) setExpire(db,rec->key,rec->expiretime);
+            decrRefCount(rec->key);
+        }
+        rdbPipeStageUpdate(RDB_LOAD_STAGE_INSERT,batch->numrecords,
+                           ustime()-start);
+        zfree(batch);
+        rdbPipeProgress(&processed,0);
+        pthread_mutex_lock(&rdbpipe.lock);
+    }
+    pthread_mutex_unlock(&rdbpipe.lock);
+
+    pthread_join(reader,NULL);
+    for (j = 0; j < numworkers; j++) pthread_join(workers[j],NULL);
+    zfree(workers);
+    listRelease(rdbpipe.todo);
+    listRelease(rdbpipe.inflight);
+    pthread_cond_destroy(&rdbpipe.todo_cond);
+    pthread_cond_destroy(&rdbpipe.done_cond);
+    pthread_cond_destroy(&rdbpipe.room_cond);
+    pthread_mutex_destroy(&rdbpipe.lock);
+    loadingProgress(rdb->processed_bytes);
+    serverLog(LL_NOTICE,"RDB loaded by %d threads: "
+        "read %.2f MB/sec (%.0f%% busy), "
+        "build %.0f keys/sec (%.0f%% busy), "
+        "insert %.0f keys/sec (%.0f%% busy)",
+        server.loading_threads,
+        loadingStageThroughput(RDB_LOAD_STAGE_READ)/(1024*1024),
+        loadingStageBusyPerc(RDB_LOAD_STAGE_READ),
+        loadingStageThroughput(RDB_LOAD_STAGE_BUILD),
+        loadingStageBusyPerc(RDB_LOAD_STAGE_BUILD),
+        loadingStageThroughput(RDB_LOAD_STAGE_INSERT),
+        loadingStageBusyPerc(RDB_LOAD_STAGE_INSERT));
+    server.loading_threads = 0;
+    return C_OK;
+}
+
+/* Load an RDB payload from the rio stream into the databases. The caller
+ * is responsible of the loading state, see startLoading().
+ *
+ * With the RDB_LOAD_SOCKET flag the payload is read from the master socket
+ * (see readSyncBulkPayload()): in this case short reads and checksum errors
+ * are reported with C_ERR instead of terminating the server, and the multi
+ * threaded pipeline is not used.
+ *
+ * If 'rsi' is not NULL it is populated with the replication information
+ * found in the AUX fields of the payload. */
+int rdbLoadRio(rio *rdb, int flags, rdbSaveInfo *rsi) {
     uint32_t dbid;
     int type, rdbver;
     redisDb *db = server.db+0;
     char buf[1024];
     //过期时间
     long long expiretime, now = mstime();
-    FILE *fp;
-    rio rdb;
 
-    if ((fp = fopen(filename,"r")) == NULL) return C_ERR;
-
-    rioInitWithFile(&rdb,fp);
-    rdb.update_cksum = rdbLoadProgressCallback;
-    rdb.max_processing_chunk = server.loading_process_events_interval_bytes;
-    if (rioRead(&rdb,buf,9) == 0) goto eoferr;
+    rdb->update_cksum = rdbLoadProgressCallback;
+    rdb->max_processing_chunk = server.loading_process_events_interval_bytes;
+    if (rioRead(rdb,buf,9) == 0) goto eoferr;
     buf[9] = '\0';
     if (memcmp(buf,"REDIS",5) != 0) {
-        fclose(fp);
         serverLog(LL_WARNING,"Wrong signature trying to load DB from file");
         errno = EINVAL;
         return C_ERR;
@@ -1345,45 +2085,46 @@ int rdbLoad(char *filename) {
     //读取版本号
     rdbver = atoi(buf+5);
     if (rdbver < 1 || rdbver > RDB_VERSION) {
-        fclose(fp);
         //不能处理rdb版本号
         serverLog(LL_WARNING,"Can't handle RDB format version %d",rdbver);
         errno = EINVAL;
         return C_ERR;
     }
 
-    //设置状态
-    startLoading(fp);
+    if (server.rdb_load_threads > 1 && !(flags & RDB_LOAD_SOCKET)) {
+        rdbLoadPipelined(rdb,rdbver,rsi);
+        return C_OK;
+    }
     while(1) {
         robj *key, *val;
         expiretime = -1;
 
         /* Read type. */
-        if ((type = rdbLoadType(&rdb)) == -1) goto eoferr;
+        if ((type = rdbLoadType(rdb)) == -1) goto eoferr;
 
         /* Handle special types. */
         if (type == RDB_OPCODE_EXPIRETIME) {
             /* EXPIRETIME: load an expire associated with the next key
              * to load. Note that after loading an expire we need to
              * load the actual type, and continue. */
-            if ((expiretime = rdbLoadTime(&rdb)) == -1) goto eoferr;
+            if ((expiretime = rdbLoadTime(rdb)) == -1) goto eoferr;
             /* We read the time so we need to read the object type again. */
-            if ((type = rdbLoadType(&rdb)) == -1) goto eoferr;
+            if ((type = rdbLoadType(rdb)) == -1) goto eoferr;
             /* the EXPIRETIME opcode specifies time in seconds, so convert
              * into milliseconds. */
             expiretime *= 1000; /*乘以1000转换成毫秒*/
         } else if (type == RDB_OPCODE_EXPIRETIME_MS) {
             /* EXPIRETIME_MS: milliseconds precision expire times introduced
              * with RDB v3. Like EXPIRETIME but no with more precision. */
-            if ((expiretime = rdbLoadMillisecondTime(&rdb)) == -1) goto eoferr;
+            if ((expiretime = rdbLoadMillisecondTime(rdb)) == -1) goto eoferr;
             /* We read the time so we need to read the object type again. */
-            if ((type = rdbLoadType(&rdb)) == -1) goto eoferr;
+            if ((type = rdbLoadType(rdb)) == -1) goto eoferr;
         } else if (type == RDB_OPCODE_EOF) {
             /* EOF: End of file, exit the main loop. */
             break;
         } else if (type == RDB_OPCODE_SELECTDB) {
             /* SELECTDB: Select the specified database. */
-            if ((dbid = rdbLoadLen(&rdb,NULL)) == RDB_LENERR)
+            if ((dbid = rdbLoadLen(rdb,NULL)) == RDB_LENERR)
                 goto eoferr;
 
             // 如果读取的db号大于等于服务器的数据库数量 就退出
@@ -1400,9 +2141,9 @@ int rdbLoad(char *filename) {
             /* RESIZEDB: Hint about the size of the keys in the currently
              * selected data base, in order to avoid useless rehashing. */
             uint32_t db_size, expires_size;
-            if ((db_size = rdbLoadLen(&rdb,NULL)) == RDB_LENERR)
+            if ((db_size = rdbLoadLen(rdb,NULL)) == RDB_LENERR)
                 goto eoferr;
-            if ((expires_size = rdbLoadLen(&rdb,NULL)) == RDB_LENERR)
+            if ((expires_size = rdbLoadLen(rdb,NULL)) == RDB_LENERR)
                 goto eoferr;
             
             //
@@ -1416,32 +2157,24 @@ int rdbLoad(char *filename) {
              *
              * An AUX field is composed of two strings: key and value. */
             robj *auxkey, *auxval;
-            if ((auxkey = rdbLoadStringObject(&rdb)) == NULL) goto eoferr;
-            if ((auxval = rdbLoadStringObject(&rdb)) == NULL) goto eoferr;
-
-            if (((char*)auxkey->ptr)[0] == '%') {
-                /* All the fields with a name staring with '%' are considered
-                 * information fields and are logged at startup with a log
-                 * level of NOTICE. */
-                serverLog(LL_NOTICE,"RDB '%s': %s",
-                    (char*)auxkey->ptr,
-                    (char*)auxval->ptr);
-            } else {
-                /* We ignore fields we don't understand, as by AUX field
-                 * contract. */
-                serverLog(LL_DEBUG,"Unrecognized RDB AUX field: '%s'",
-                    (char*)auxkey->ptr);
+            if ((auxkey = rdbLoadStringObject(rdb)) == NULL) goto eoferr;
+            if ((auxval = rdbLoadStringObject(rdb)) == NULL) {
+                decrRefCount(auxkey);
+                goto eoferr;
             }
-
+            rdbLoadAuxField(auxkey,auxval,rsi);
             decrRefCount(auxkey);
             decrRefCount(auxval);
             continue; /* Read type again. */
         }
 
         /* Read key */
-        if ((key = rdbLoadStringObject(&rdb)) == NULL) goto eoferr;
+        if ((key = rdbLoadStringObject(rdb)) == NULL) goto eoferr;
         /* Read value */
-        if ((val = rdbLoadObject(type,&rdb)) == NULL) goto eoferr;
+        if ((val = rdbLoadObject(type,rdb)) == NULL) {
+            decrRefCount(key);
+            goto eoferr;
+        }
         /* Check if the key already expired. This function is used when loading
          * an RDB file from disk, either at startup, or when an RDB was
          * received from the master. In the latter case, the master is
@@ -1464,30 +2197,56 @@ int rdbLoad(char *filename) {
     }
     /* Verify the checksum if RDB version is >= 5 */
     if (rdbver >= 5 && server.rdb_checksum) {
-        uint64_t cksum, expected = rdb.cksum;
+        uint64_t cksum, expected = rdb->cksum;
 
-        if (rioRead(&rdb,&cksum,8) == 0) goto eoferr;
+        if (rioRead(rdb,&cksum,8) == 0) goto eoferr;
         memrev64ifbe(&cksum);
 
         //cksum等于0
         if (cksum == 0) {
             serverLog(LL_WARNING,"RDB file was saved with checksum disabled: no check performed.");
         } else if (cksum != expected) {
+            if (flags & RDB_LOAD_SOCKET) {
+                serverLog(LL_WARNING,"Wrong RDB checksum loading DB from the master.");
+                return C_ERR;
+            }
             serverLog(LL_WARNING,"Wrong RDB checksum. Aborting now.");
             rdbExitReportCorruptRDB("RDB CRC error");
         }
     }
-
-    fclose(fp);
-    stopLoading();
     return C_OK;
 
 eoferr: /* unexpected end of file is handled here with a fatal exit */
+    if (flags & RDB_LOAD_SOCKET) {
+        serverLog(LL_WARNING,"Short read loading DB from the master: %s",
+            strerror(errno));
+        return C_ERR;
+    }
     serverLog(LL_WARNING,"Short read or OOM loading DB. Unrecoverable error, aborting now.");
     rdbExitReportCorruptRDB("Unexpected EOF reading RDB file");
     return C_ERR; /* Just to avoid warning */
 }
 
+/*
+ 加载rdb文件
+*/
+int rdbLoad(char *filename, rdbSaveInfo *rsi) {
+    FILE *fp;
+    rio rdb;
+    int retval;
+
+    if ((fp = fopen(filename,"r")) == NULL) return C_ERR;
+
+    rioInitWithFile(&rdb,fp);
+    //设置状态
+    startLoadingFile(fp);
+    retval = rdbLoadRio(&rdb,0,rsi);
+    fclose(fp);
+    stopLoading();
+    return retval;
+}
+
+
 /* A background saving child (BGSAVE) terminated its work. Handle this.
  * This function covers the case of actual BGSAVEs. */
 void backgroundSaveDoneHandlerDisk(int exitcode, int bysignal) {
@@ -1645,7 +2404,7 @@ int rdbSaveToSlavesSockets(void) {
     long long start;
     int pipefds[2];
 
-    if (server.aof_child_pid != -1 || server.rdb_child_pid != -1) return C_ERR;
+    if (server.aof_child_pid != -1 || rdbSaveInProgress()) return C_ERR;
 
     /* Before to fork, create a pipe that will be used in order to
      * send back to the parent the IDs of the slaves that successfully
@@ -1792,7 +2551,7 @@ int rdbSaveToSlavesSockets(void) {
 }
 
 void saveCommand(client *c) {
-    if (server.rdb_child_pid != -1) {
+    if (rdbSaveInProgress()) {
         addReplyError(c,"Background save already in progress");
         return;
     }
@@ -1818,7 +2577,7 @@ void bgsaveCommand(client *c) {
         }
     }
 
-    if (server.rdb_child_pid != -1) {
+    if (rdbSaveInProgress()) {
         addReplyError(c,"Background save already in progress");
     } else if (server.aof_child_pid != -1) {
         if (schedule) {
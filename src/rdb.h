@@ -38,7 +38,7 @@
 
 /* The current RDB version. When the format changes in a way that is no longer
  * backward compatible this number gets incremented. */
-#define RDB_VERSION 7
+#define RDB_VERSION 8
 
 /* Defines related to the dump file format. To store 32 bits lengths for short
  * keys requires a lot of space, so we check the most significant 2 bits of
@@ -83,10 +83,20 @@
 #define RDB_TYPE_ZSET_ZIPLIST  12
 #define RDB_TYPE_HASH_ZIPLIST  13
 #define RDB_TYPE_LIST_QUICKLIST 14
+
+/* Object types of the encodings added by this fork. Upstream Redis uses the
+ * types from 15 on for its own encodings (streams, listpacks, ...), with a
+ * different payload, so these are taken from a range it doesn't use: an
+ * upstream server refuses them as an unknown type instead of misreading
+ * them, and the types of its newer RDB files are refused here as well. */
+#define RDB_TYPE_HASH_LISTPACK 200
+#define RDB_TYPE_ZSET_LISTPACK 201
+#define RDB_TYPE_SET_ROARING   202
 /* NOTE: WHEN ADDING NEW RDB TYPE, UPDATE rdbIsObjectType() BELOW */
 
 /* Test if a type is an object type. */
-#define rdbIsObjectType(t) ((t >= 0 && t <= 4) || (t >= 9 && t <= 14))
+#define rdbIsObjectType(t) ((t >= 0 && t <= 4) || (t >= 9 && t <= 14) || \
+                            (t >= 200 && t <= 202))
 
 /* Special RDB opcodes (saved/loaded with rdbSaveType/rdbLoadType). */
 #define RDB_OPCODE_AUX        250
@@ -96,6 +106,21 @@
 #define RDB_OPCODE_SELECTDB   254
 #define RDB_OPCODE_EOF        255
 
+/* rdbLoadRio() flags. */
+#define RDB_LOAD_SOCKET (1<<0)  /* Payload read from the master socket. */
+
+/* Replication information saved by rdbSaveInfoAuxFields() as AUX fields,
+ * filled by rdbLoad() so that a restarted instance can continue to
+ * replicate with a partial resynchronization. */
+typedef struct rdbSaveInfo {
+    int repl_stream_db;     /* DB selected in the replication stream. */
+    int repl_id_is_set;     /* True if repl_id was found. */
+    char repl_id[CONFIG_RUN_ID_SIZE+1]; /* Replication ID. */
+    long long repl_offset;  /* Replication offset of the data set. */
+} rdbSaveInfo;
+
+#define RDB_SAVE_INFO_INIT {-1,0,"0000000000000000000000000000000000000000",-1}
+
 int rdbSaveType(rio *rdb, unsigned char type);
 int rdbLoadType(rio *rdb);
 int rdbSaveTime(rio *rdb, time_t t);
@@ -104,7 +129,8 @@ int rdbSaveLen(rio *rdb, uint32_t len);
 uint32_t rdbLoadLen(rio *rdb, int *isencoded);
 int rdbSaveObjectType(rio *rdb, robj *o);
 int rdbLoadObjectType(rio *rdb);
-int rdbLoad(char *filename);
+int rdbLoad(char *filename, rdbSaveInfo *rsi);
+int rdbLoadRio(rio *rdb, int flags, rdbSaveInfo *rsi);
 int rdbSaveBackground(char *filename);
 int rdbSaveToSlavesSockets(void);
 void rdbRemoveTempFile(pid_t childpid);
@@ -114,6 +140,8 @@ size_t rdbSavedObjectLen(robj *o);
 robj *rdbLoadObject(int type, rio *rdb);
 void backgroundSaveDoneHandler(int exitcode, int bysignal);
 int rdbSaveKeyValuePair(rio *rdb, robj *key, robj *val, long long expiretime, long long now);
+int rdbSaveHeader(rio *rdb);
+int rdbSaveFooter(rio *rdb);
 robj *rdbLoadStringObject(rio *rdb);
 
 #endif
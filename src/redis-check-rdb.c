@@ -85,7 +85,10 @@ char *rdb_type_string[] = {
     "set-intset",
     "zset-ziplist",
     "hash-ziplist",
-    "quicklist"
+    "quicklist",
+    "hash-listpack",
+    "zset-listpack",
+    "set-roaring"
 };
 
 /* Show a few stats collected into 'rdbstate' */
@@ -198,7 +201,7 @@ int redis_check_rdb(char *rdbfilename) {
         return 1;
     }
 
-    startLoading(fp);
+    startLoadingFile(fp);
     while(1) {
         robj *key, *val;
         expiretime = -1;
@@ -1,3 +1,3 @@
-#define REDIS_GIT_SHA1 "698c94b3"
-#define REDIS_GIT_DIRTY "      81"
-#define REDIS_BUILD_ID "zhangjiongdeMacBook-Pro.local-1718525482"
+#define REDIS_GIT_SHA1 "15f3f8ab"
+#define REDIS_GIT_DIRTY "216"
+#define REDIS_BUILD_ID "vm-1792135480"
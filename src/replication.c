@@ -30,6 +30,7 @@
 
 
 #include "server.h"
+#include "cluster.h"
 
 #include <sys/time.h>
 #include <unistd.h>
@@ -102,18 +103,52 @@ char *replicationGetSlaveName(client *c) {
 
 /* ---------------------------------- MASTER -------------------------------- */
 
+//复制ID标识一段复制历史，和runid不同，它会被保存到RDB中，并在slave提升为master时保留
+/* The replication ID identifies a given history of the data set: two
+ * instances with the same ID and offset are guaranteed to hold the same
+ * data. Unlike the run ID it survives restarts (it is saved in the RDB
+ * file) and it is inherited by slaves, so that after a failover or a
+ * restart the slaves can continue with a partial resynchronization. */
+
+/* Use a new random replication ID, so that slaves that are not part of our
+ * history will never be able to PSYNC with us. */
+void changeReplicationId(void) {
+    getRandomHexChars(server.replid,CONFIG_RUN_ID_SIZE);
+    server.replid[CONFIG_RUN_ID_SIZE] = '\0';
+}
+
+/* Clear the secondary replication ID: only our own history is valid. */
+void clearReplicationId2(void) {
+    memset(server.replid2,'0',sizeof(server.replid));
+    server.replid2[CONFIG_RUN_ID_SIZE] = '\0';
+    server.second_replid_offset = -1;
+}
+
+/* Called when a slave is turned into a master. The ID of the old master
+ * becomes our secondary ID, valid up to the offset we reached, so that
+ * the other slaves of the old master can PSYNC with us, and a new ID is
+ * used for the history we are going to create from now on. */
+void shiftReplicationId(void) {
+    memcpy(server.replid2,server.replid,sizeof(server.replid));
+    /* We use the offset plus one since the next byte we'll write is the
+     * first of the new history: a slave asking for this offset is one that
+     * processed exactly the same stream as us, so it can continue. */
+    server.second_replid_offset = server.master_repl_offset+1;
+    changeReplicationId();
+    serverLog(LL_WARNING,"Setting secondary replication ID to %s, valid up to offset: %lld. New replication ID is %s", server.replid2, server.second_replid_offset, server.replid);
+}
+
 void createReplicationBacklog(void) {
     serverAssert(server.repl_backlog == NULL);
     server.repl_backlog = zmalloc(server.repl_backlog_size);
     server.repl_backlog_histlen = 0;
     server.repl_backlog_idx = 0;
-    //创建新的backlog缓冲区时，我们会增加复制偏移1，以确保我们无法使用任何
-    //上一个从属。这是需要的，因为我们避免增加master_repl_offset（如果不存在积压，也没有slave）
-    /* When a new backlog buffer is created, we increment the replication
-     * offset by one to make sure we'll not be able to PSYNC with any
-     * previous slave. This is needed because we avoid incrementing the
-     * master_repl_offset if no backlog exists nor slaves are attached. */
-    server.master_repl_offset++;
+    /* The offset is no longer incremented when a new backlog is created:
+     * the replication ID is changed instead every time the history we
+     * could serve is lost, so that a stale slave can't PSYNC with us
+     * even if it asks for the very same offset. Not touching the offset
+     * allows a promoted slave, or an instance restarted from its RDB file,
+     * to accept the PSYNC of slaves that are exactly where it is. */
 
     //复制缓冲区是一个先进先出的循环队列，当写入数据量超过缓冲区大小时，旧的数据会被覆盖。
     //因此随着每次数据的写入，需要更新缓冲区中数据第一个字节的复制偏移量repl_backlog_off
@@ -202,33 +237,59 @@ void feedReplicationBacklog(void *ptr, size_t len) {
                               server.repl_backlog_histlen + 1;
 }
 
+/* Append to 's' the command 'argv' in the protocol format, that is, as a
+ * multi bulk of bulk strings. */
+static sds catCommandProtocol(sds s, int argc, robj **argv) {
+    char aux[LONG_STR_SIZE+3], llstr[LONG_STR_SIZE];
+    size_t totlen = LONG_STR_SIZE+3;
+    int j, len;
 
-/*
-  feedReplicationBacklog（）的包装器，它接受Redis字符串对象作为输入
-*/
-/* Wrapper for feedReplicationBacklog() that takes Redis string objects
- * as input. */
-void feedReplicationBacklogWithObject(robj *o) {
-    char llstr[LONG_STR_SIZE];
-    void *p;
-    size_t len;
+    for (j = 0; j < argc; j++)
+        totlen += stringObjectLen(argv[j])+LONG_STR_SIZE+5;
+    s = sdsMakeRoomFor(s,totlen);
 
-    if (o->encoding == OBJ_ENCODING_INT) {
-        len = ll2string(llstr,sizeof(llstr),(long)o->ptr);
-        p = llstr;
-    } else {
-        len = sdslen(o->ptr);
-        p = o->ptr;
+    /* Add the multi bulk length. */
+    aux[0] = '*';
+    len = ll2string(aux+1,sizeof(aux)-1,argc);
+    aux[len+1] = '\r';
+    aux[len+2] = '\n';
+    s = sdscatlen(s,aux,len+3);
+
+    for (j = 0; j < argc; j++) {
+        char *p;
+        size_t objlen;
+
+        if (argv[j]->encoding == OBJ_ENCODING_INT) {
+            objlen = ll2string(llstr,sizeof(llstr),(long)argv[j]->ptr);
+            p = llstr;
+        } else {
+            objlen = sdslen(argv[j]->ptr);
+            p = argv[j]->ptr;
+        }
+        aux[0] = '$';
+        len = ll2string(aux+1,sizeof(aux)-1,objlen);
+        aux[len+1] = '\r';
+        aux[len+2] = '\n';
+        s = sdscatlen(s,aux,len+3);
+        s = sdscatlen(s,p,objlen);
+        s = sdscatlen(s,"\r\n",2);
     }
-    feedReplicationBacklog(p,len);
+    return s;
 }
 
 void replicationFeedSlaves(list *slaves, int dictid, robj **argv, int argc) {
     listNode *ln;
     listIter li;
-    int j, len;
     char llstr[LONG_STR_SIZE];
 
+    /* If the instance is not a top level master, return ASAP: we'll just
+     * proxy the stream of data we receive from our master instead, in
+     * order to propagate *identical* replication stream. In this way this
+     * slave can advertise the same replication ID as the master (since it
+     * shares the master replication history and has the same backlog and
+     * offsets). */
+    if (server.masterhost != NULL) return;
+
     /* If there aren't slaves, and there is no backlog buffer to populate,
      * we can return ASAP. */
     if (server.repl_backlog == NULL && listLength(slaves) == 0) return;
@@ -236,70 +297,39 @@ void replicationFeedSlaves(list *slaves, int dictid, robj **argv, int argc) {
     /* We can't have slaves attached and no backlog. */
     serverAssert(!(listLength(slaves) != 0 && server.repl_backlog == NULL));
 
-    /* Send SELECT command to every slave if needed. */
+    //SELECT和命令本身只编码一次，写入backlog，并且被所有slave的回复列表共享
+    /* Encode the SELECT command, if needed, and the command only once: the
+     * same block is written to the backlog and shared by the output buffers
+     * of all the slaves, see addReplyShared(). */
+    sds proto = sdsempty();
     if (server.slaveseldb != dictid) {
-        robj *selectcmd;
-
         /* For a few DBs we have pre-computed SELECT command. */
         if (dictid >= 0 && dictid < PROTO_SHARED_SELECT_CMDS) {
-            selectcmd = shared.select[dictid];
+            proto = sdscatsds(proto,shared.select[dictid]->ptr);
         } else {
             int dictid_len;
 
             dictid_len = ll2string(llstr,sizeof(llstr),dictid);
-            selectcmd = createObject(OBJ_STRING,
-                sdscatprintf(sdsempty(),
+            proto = sdscatprintf(proto,
                 "*2\r\n$6\r\nSELECT\r\n$%d\r\n%s\r\n",
-                dictid_len, llstr));
+                dictid_len, llstr);
         }
-
-        /* Add the SELECT command into the backlog. */
-        if (server.repl_backlog) feedReplicationBacklogWithObject(selectcmd);
-
-        /* Send it to slaves. */
-        listRewind(slaves,&li);
-        while((ln = listNext(&li))) {
-            client *slave = ln->value;
-            if (slave->replstate == SLAVE_STATE_WAIT_BGSAVE_START) continue;
-            addReply(slave,selectcmd);
-        }
-
-        if (dictid < 0 || dictid >= PROTO_SHARED_SELECT_CMDS)
-            decrRefCount(selectcmd);
     }
     server.slaveseldb = dictid;
+    proto = catCommandProtocol(proto,argc,argv);
 
     //如果支持部分同步的复制囤积
     //把命令写入 复制囤积的 
     /* Write the command to the replication backlog if any. */
-    if (server.repl_backlog) {
-        char aux[LONG_STR_SIZE+3];
-
-        /* Add the multi bulk reply length. */
-        aux[0] = '*';
-        len = ll2string(aux+1,sizeof(aux)-1,argc);
-        aux[len+1] = '\r';
-        aux[len+2] = '\n';
-        feedReplicationBacklog(aux,len+3);
-
-        for (j = 0; j < argc; j++) {
-            long objlen = stringObjectLen(argv[j]);
-
-            /* We need to feed the buffer with the object as a bulk reply
-             * not just as a plain string, so create the $..CRLF payload len
-             * and add the final CRLF */
-            aux[0] = '$';
-            len = ll2string(aux+1,sizeof(aux)-1,objlen);
-            aux[len+1] = '\r';
-            aux[len+2] = '\n';
-            feedReplicationBacklog(aux,len+3);
-            feedReplicationBacklogWithObject(argv[j]);
-            feedReplicationBacklog(aux+len+1,2);
-        }
-    }
+    if (server.repl_backlog) feedReplicationBacklog(proto,sdslen(proto));
 
     /* Write the command to every slave. */
-    listRewind(server.slaves,&li);
+    if (listLength(slaves) == 0) {
+        sdsfree(proto);
+        return;
+    }
+    robj *block = createObject(OBJ_STRING,proto);
+    listRewind(slaves,&li);
     while((ln = listNext(&li))) {
         client *slave = ln->value;
 
@@ -309,15 +339,31 @@ void replicationFeedSlaves(list *slaves, int dictid, robj **argv, int argc) {
         /* Feed slaves that are waiting for the initial SYNC (so these commands
          * are queued in the output buffer until the initial SYNC completes),
          * or are already in sync with the master. */
+        addReplyShared(slave,block);
+    }
+    decrRefCount(block);
+}
+
+//slave把从master收到的复制流原样转发给自己的slave，这样偏移量和复制ID在整个链上保持一致
+/* This function is used in order to proxy what we receive from our master
+ * to our sub-slaves. */
+void replicationFeedSlavesFromMasterStream(list *slaves, char *buf, size_t buflen) {
+    listNode *ln;
+    listIter li;
+
+    if (server.repl_backlog) feedReplicationBacklog(buf,buflen);
+    if (listLength(slaves) == 0) return;
 
-        /* Add the multi bulk length. */
-        addReplyMultiBulkLen(slave,argc);
+    robj *block = createRawStringObject(buf,buflen);
+    listRewind(slaves,&li);
+    while((ln = listNext(&li))) {
+        client *slave = ln->value;
 
-        /* Finally any additional argument that was not stored inside the
-         * static buffer if any (from j to argc). */
-        for (j = 0; j < argc; j++)
-            addReplyBulk(slave,argv[j]);
+        /* Don't feed slaves that are still waiting for BGSAVE to start */
+        if (slave->replstate == SLAVE_STATE_WAIT_BGSAVE_START) continue;
+        addReplyShared(slave,block);
     }
+    decrRefCount(block);
 }
 
 void replicationFeedMonitors(client *c, list *monitors, int dictid, robj **argv, int argc) {
@@ -422,11 +468,7 @@ long long addReplyReplicationBacklog(client *c, long long offset) {
  * the BGSAVE process started and before executing any other command
  * from clients. */
 long long getPsyncInitialOffset(void) {
-    long long psync_offset = server.master_repl_offset;
-    /* Add 1 to psync_offset if it the replication backlog does not exists
-     * as when it will be created later we'll increment the offset by one. */
-    if (server.repl_backlog == NULL) psync_offset++;
-    return psync_offset;
+    return server.master_repl_offset;
 }
 
 /* Send a FULLRESYNC reply in the specific case of a full resynchronization,
@@ -462,7 +504,7 @@ int replicationSetupSlaveForFullResync(client *slave, long long offset) {
     if (!(slave->flags & CLIENT_PRE_PSYNC)) {
         //发送从服务器+FULLRESYNC runid offset
         buflen = snprintf(buf,sizeof(buf),"+FULLRESYNC %s %lld\r\n",
-                          server.runid,offset);
+                          server.replid,offset);
         if (write(slave->fd,buf,buflen) != buflen) {
             freeClientAsync(slave);
             return C_ERR;
@@ -480,21 +522,40 @@ int replicationSetupSlaveForFullResync(client *slave, long long offset) {
  * with the usual full resync. */
 int masterTryPartialResynchronization(client *c) {
     long long psync_offset, psync_len;
-    char *master_runid = c->argv[1]->ptr;
+    char *master_replid = c->argv[1]->ptr;
     char buf[128];
     int buflen;
 
-    /**这个主机的符文ID是否与通过PSYNC发布的wannabe从机相同？如果runid已更改，则此主机是不同的实例
-        没有办法继续*/
-    /* Is the runid of this master the same advertised by the wannabe slave
-     * via PSYNC? If runid changed this master is a different instance and
-     * there is no way to continue. */
-    if (strcasecmp(master_runid, server.runid)) {
-        /* Run id "?" is used by slaves that want to force a full resync. */
-        if (master_runid[0] != '?') {
-            serverLog(LL_NOTICE,"Partial resynchronization not accepted: "
-                "Runid mismatch (Client asked for runid '%s', my runid is '%s')",
-                master_runid, server.runid);
+    /* We still have the data our slave is asking for? */
+    if (getLongLongFromObjectOrReply(c,c->argv[2],&psync_offset,NULL) !=
+       C_OK) goto need_full_resync;
+
+    /**这个主机的复制ID是否与通过PSYNC发布的wannabe从机相同？如果复制ID已更改，则此主机是不同的实例
+        没有办法继续. 但如果是我们的上一个master的ID（replid2），而且slave请求的偏移量没有超过我们切换ID的位置，也可以继续*/
+    /* Is the replication ID of this master the same advertised by the wannabe
+     * slave via PSYNC? If the replication ID changed this master has a
+     * different replication history, and there is no way to continue.
+     *
+     * Note that there are two potentially valid replication IDs: the ID1
+     * and the ID2. The ID2 however is only valid up to a specific offset. */
+    if (strcasecmp(master_replid, server.replid) &&
+        (strcasecmp(master_replid, server.replid2) ||
+         psync_offset > server.second_replid_offset))
+    {
+        /* Replid "?" is used by slaves that want to force a full resync. */
+        if (master_replid[0] != '?') {
+            if (strcasecmp(master_replid, server.replid) &&
+                strcasecmp(master_replid, server.replid2))
+            {
+                serverLog(LL_NOTICE,"Partial resynchronization not accepted: "
+                    "Replication ID mismatch (Slave asked for '%s', my "
+                    "replication IDs are '%s' and '%s')",
+                    master_replid, server.replid, server.replid2);
+            } else {
+                serverLog(LL_NOTICE,"Partial resynchronization not accepted: "
+                    "Requested offset for second ID was %lld, but I can reply "
+                    "up to %lld", psync_offset, server.second_replid_offset);
+            }
         } else {
             serverLog(LL_NOTICE,"Full resync requested by slave %s",
                 replicationGetSlaveName(c));
@@ -502,10 +563,6 @@ int masterTryPartialResynchronization(client *c) {
         goto need_full_resync;
     }
 
-    /* We still have the data our slave is asking for? */
-    if (getLongLongFromObjectOrReply(c,c->argv[2],&psync_offset,NULL) !=
-       C_OK) goto need_full_resync;
-
         //https://www.cnblogs.com/coloz/p/13812861.html
         ///* 判断复制偏移量是否包含在复制缓冲区? */
        //当没有repl_backlog 或者 
@@ -538,7 +595,11 @@ int masterTryPartialResynchronization(client *c) {
     /* We can't use the connection buffers since they are used to accumulate
      * new commands at this stage. But we are sure the socket send buffer is
      * empty so this write will never fail actually. */
-    buflen = snprintf(buf,sizeof(buf),"+CONTINUE\r\n");
+    if (c->slave_capa & SLAVE_CAPA_PSYNC2) {
+        buflen = snprintf(buf,sizeof(buf),"+CONTINUE %s\r\n", server.replid);
+    } else {
+        buflen = snprintf(buf,sizeof(buf),"+CONTINUE\r\n");
+    }
     if (write(c->fd,buf,buflen) != buflen) {
         freeClientAsync(c);
         return C_OK;
@@ -728,8 +789,19 @@ void syncCommand(client *c) {
     //添加到slaves链表最后
     listAddNodeTail(server.slaves,c);
 
+    /* Create the replication backlog if needed. This must happen before
+     * the FULLRESYNC reply is sent, since it reports our replication ID. */
+    if (listLength(server.slaves) == 1 && server.repl_backlog == NULL) {
+        /* When we create the backlog from scratch, we always use a new
+         * replication ID and clear the ID2, since there is no valid
+         * past history. */
+        changeReplicationId();
+        clearReplicationId2();
+        createReplicationBacklog();
+    }
+
     /* CASE 1: BGSAVE is in progress, with disk target. */
-    if (server.rdb_child_pid != -1 &&
+    if (rdbSaveInProgress() &&
         server.rdb_child_type == RDB_CHILD_TYPE_DISK)
     {
         /* Ok a background save is in progress. Let's check if it is a good
@@ -794,9 +866,6 @@ void syncCommand(client *c) {
             }
         }
     }
-
-    if (listLength(server.slaves) == 1 && server.repl_backlog == NULL)
-        createReplicationBacklog();
     return;
 }
 
@@ -844,6 +913,8 @@ void replconfCommand(client *c) {
             /* Ignore capabilities not understood by this master. */
             if (!strcasecmp(c->argv[j+1]->ptr,"eof"))
                 c->slave_capa |= SLAVE_CAPA_EOF; //标记为EOF
+            else if (!strcasecmp(c->argv[j+1]->ptr,"psync2"))
+                c->slave_capa |= SLAVE_CAPA_PSYNC2;
         } else if (!strcasecmp(c->argv[j]->ptr,"ack")) {
             /* REPLCONF ACK is used by slave to inform the master the amount
              * of replication stream that it processed so far. It is an
@@ -1103,9 +1174,12 @@ void replicationCreateMasterClient(int fd) {
     //标记这个client为Master
     server.master->flags |= CLIENT_MASTER;
     server.master->authenticated = 1;
+    /* The query buffer of the master is never given back to the pool. */
+    server.master->querybuf = sdsempty();
     server.repl_state = REPL_STATE_CONNECTED;
     //定位为 主库初始偏移位置
     server.master->reploff = server.repl_master_initial_offset;
+    server.master->read_reploff = server.master->reploff;
     memcpy(server.master->replrunid, server.repl_master_runid,
         sizeof(server.repl_master_runid));
     /* If master offset is set to -1, this master is old and is not
@@ -1114,6 +1188,216 @@ void replicationCreateMasterClient(int fd) {
         server.master->flags |= CLIENT_PRE_PSYNC;
 }
 
+/* Called once the new data set received from the master was loaded and the
+ * master client created. */
+static void replicationSyncFinished(void) {
+    /* After a full resynchronization we use the replication ID and offset
+     * of the master. The secondary ID is cleared since our old history
+     * is gone, and a backlog is created so that our sub-slaves can PSYNC
+     * with us from now on. */
+    memcpy(server.replid,server.master->replrunid,sizeof(server.replid));
+    server.master_repl_offset = server.master->reploff;
+    clearReplicationId2();
+    if (server.repl_backlog == NULL) createReplicationBacklog();
+
+    serverLog(LL_NOTICE, "MASTER <-> SLAVE sync: Finished with success");
+    /* Restart the AOF subsystem now that we finished the sync. This
+     * will trigger an AOF rewrite, and when done will start appending
+     * to the new file. */
+    if (server.aof_state != AOF_OFF) {
+        int retry = 10;
+
+        stopAppendOnly();
+        while (retry-- && startAppendOnly() == C_ERR) {
+            serverLog(LL_WARNING,"Failed enabling the AOF after successful master synchronization! Trying it again in one second.");
+            sleep(1);
+        }
+        if (!retry) {
+            serverLog(LL_WARNING,"FATAL: this slave instance finished the synchronization with its master, but the AOF can't be turned on. Exiting now.");
+            exit(1);
+        }
+    }
+}
+
+/* ----------------------- Diskless load on the slave side ----------------------
+ *
+ * With repl-diskless-load the payload of the master is parsed directly from
+ * the socket, without saving it to the disk first. In swapdb mode the old
+ * data set is kept in memory and clients keep being served with it while
+ * the new one is loaded: the key space of the databases is exchanged with
+ * the one in disklessLoadOldDbs every time events are processed.
+ * -------------------------------------------------------------------------- */
+
+static redisDb *disklessLoadOldDbs = NULL;
+static dict **disklessLoadOldSlots = NULL; /* Slots-keys map of Redis Cluster. */
+
+/* Returns true if the payload of the master should be loaded from the
+ * socket according to repl-diskless-load. */
+static int useDisklessLoad(void) {
+    int j;
+
+    if (server.repl_diskless_load == REPL_DISKLESS_LOAD_SWAPDB) return 1;
+    if (server.repl_diskless_load != REPL_DISKLESS_LOAD_WHEN_DB_EMPTY) return 0;
+    for (j = 0; j < server.dbnum; j++)
+        if (dictSize(server.db[j].dict)) return 0;
+    return 1;
+}
+
+/* Exchange the key space of the databases with the one of disklessLoadOldDbs. */
+static void disklessLoadSwapDbs(void) {
+    int j;
+
+    for (j = 0; j < server.dbnum; j++) {
+        redisDb *db = server.db+j, *old = disklessLoadOldDbs+j;
+        redisDb tmp = *db;
+
+        db->dict = old->dict;
+        db->expires = old->expires;
+        db->expires_index = old->expires_index;
+        db->avg_ttl = old->avg_ttl;
+        db->stale_ratio = old->stale_ratio;
+        old->dict = tmp.dict;
+        old->expires = tmp.expires;
+        old->expires_index = tmp.expires_index;
+        old->avg_ttl = tmp.avg_ttl;
+        old->stale_ratio = tmp.stale_ratio;
+    }
+    if (server.cluster_enabled) {
+        dict **slots = server.cluster->slots_to_keys;
+        server.cluster->slots_to_keys = disklessLoadOldSlots;
+        disklessLoadOldSlots = slots;
+    }
+}
+
+/* Move the current data set to disklessLoadOldDbs, leaving empty databases
+ * where to load the payload of the master. */
+static void disklessLoadSaveOldDbs(void) {
+    int j;
+
+    disklessLoadOldDbs = zcalloc(sizeof(redisDb)*server.dbnum);
+    for (j = 0; j < server.dbnum; j++) {
+        redisDb *old = disklessLoadOldDbs+j;
+
+        old->dict = keyspaceDictCreate(keyspaceMainDictType());
+        old->expires = keyspaceDictCreate(&keyptrDictType);
+        old->expires_index = server.db[j].expires_index ? zslCreate() : NULL;
+    }
+    if (server.cluster_enabled)
+        disklessLoadOldSlots = zcalloc(sizeof(dict*)*CLUSTER_SLOTS);
+    disklessLoadSwapDbs();
+}
+
+/* Lazy free the data set in disklessLoadOldDbs: the old one once the new
+ * data set was loaded, or the partially loaded one after an error. */
+static void disklessLoadDiscardOldDbs(void) {
+    int j;
+
+    for (j = 0; j < server.dbnum; j++)
+        freeDbKeyspaceAsync(disklessLoadOldDbs+j);
+    zfree(disklessLoadOldDbs);
+    disklessLoadOldDbs = NULL;
+    if (disklessLoadOldSlots) {
+        freeSlotToKeyAsync(disklessLoadOldSlots);
+        disklessLoadOldSlots = NULL;
+    }
+}
+
+/* Called by rdbLoadProgressCallback() instead of processEventsWhileBlocked()
+ * while loading in swapdb mode: the old data set is swapped back and the
+ * loading flag cleared, so that clients are served as usually. Only read
+ * only commands are accepted meanwhile, see processCommand(). */
+void disklessLoadProcessEvents(void) {
+    disklessLoadSwapDbs();
+    server.loading = 0;
+    processEventsWhileBlocked();
+    server.loading = 1;
+    disklessLoadSwapDbs();
+}
+
+/* Load the payload of the master directly from the socket 'fd'. 'eofmark'
+ * is the delimiter that follows the payload, or NULL if the master
+ * announced its size, that is server.repl_transfer_size.
+ *
+ * The socket is read in blocking mode with the replication timeout, while
+ * events are processed from time to time by the loading code as usually.
+ * On errors the replication handshake is cancelled, and in swapdb mode the
+ * old data set is restored. */
+static void readSyncBulkPayloadFromSocket(int fd, char *eofmark) {
+    int swapdb = server.repl_diskless_load == REPL_DISKLESS_LOAD_SWAPDB;
+    char mark[CONFIG_RUN_ID_SIZE];
+    int retval;
+    sds rest;
+    rio rdb;
+
+    /* The readable handler must be removed since the loading code calls
+     * the event loop from time to time, see readSyncBulkPayload(). */
+    aeDeleteFileEvent(server.el,fd,AE_READABLE);
+    anetBlock(NULL,fd);
+    anetRecvTimeout(NULL,fd,server.repl_timeout*1000);
+
+    if (swapdb) {
+        snapshotAbort();
+        disklessLoadSaveOldDbs();
+        server.async_loading = 1;
+        serverLog(LL_NOTICE, "MASTER <-> SLAVE sync: Loading DB from the socket, serving the old data set meanwhile");
+    } else {
+        serverLog(LL_NOTICE, "MASTER <-> SLAVE sync: Flushing old data");
+        signalFlushedDb(-1);
+        emptyDb(-1,EMPTYDB_NO_FLAGS,replicationEmptyDbCallback);
+        serverLog(LL_NOTICE, "MASTER <-> SLAVE sync: Loading DB from the socket");
+    }
+
+    rioInitWithFd(&rdb,fd,eofmark ? 0 : server.repl_transfer_size);
+    startLoading(eofmark ? 0 : server.repl_transfer_size);
+    retval = rdbLoadRio(&rdb,RDB_LOAD_SOCKET,NULL);
+    if (retval == C_OK && eofmark) {
+        rdb.update_cksum = NULL;
+        if (rioRead(&rdb,mark,CONFIG_RUN_ID_SIZE) == 0 ||
+            memcmp(mark,eofmark,CONFIG_RUN_ID_SIZE) != 0)
+        {
+            serverLog(LL_WARNING,"Wrong EOF mark at the end of the payload received from the MASTER");
+            retval = C_ERR;
+        }
+    }
+    stopLoading();
+    server.async_loading = 0;
+    server.stat_net_input_bytes += rdb.io.fd.read_so_far;
+    server.repl_transfer_lastio = server.unixtime;
+    rioFreeFd(&rdb,&rest);
+
+    if (retval != C_OK) {
+        serverLog(LL_WARNING,"Failed trying to load the MASTER synchronization DB from the socket");
+        if (swapdb) {
+            disklessLoadSwapDbs();
+            disklessLoadDiscardOldDbs();
+            serverLog(LL_NOTICE,"MASTER <-> SLAVE sync: Discarded the partially loaded data set, the old one is retained");
+        } else {
+            emptyDb(-1,EMPTYDB_NO_FLAGS,replicationEmptyDbCallback);
+        }
+        sdsfree(rest);
+        cancelReplicationHandshake();
+        return;
+    }
+    if (swapdb) {
+        signalFlushedDb(-1);
+        disklessLoadDiscardOldDbs();
+    }
+
+    /* Final setup of the connected slave <- master link. The temp file
+     * created before the transfer is no longer needed. */
+    anetRecvTimeout(NULL,fd,0);
+    anetNonBlock(NULL,fd);
+    close(server.repl_transfer_fd);
+    unlink(server.repl_transfer_tmpfile);
+    zfree(server.repl_transfer_tmpfile);
+    replicationCreateMasterClient(fd);
+    /* Data of the replication stream that may have been buffered while
+     * reading the payload. */
+    server.master->querybuf = sdscatsds(server.master->querybuf,rest);
+    sdsfree(rest);
+    replicationSyncFinished();
+}
+
 /* Asynchronously read the SYNC payload we receive from a master */
 #define REPL_MAX_WRITTEN_BEFORE_FSYNC (1024*1024*8) /* 8 MB */
 void readSyncBulkPayload(aeEventLoop *el, int fd, void *privdata, int mask) {
@@ -1182,6 +1466,8 @@ void readSyncBulkPayload(aeEventLoop *el, int fd, void *privdata, int mask) {
                 "MASTER <-> SLAVE sync: receiving %lld bytes from master",
                 (long long) server.repl_transfer_size);
         }
+        if (useDisklessLoad())
+            readSyncBulkPayloadFromSocket(fd,usemark ? eofmark : NULL);
         return;
     }
 
@@ -1263,14 +1549,14 @@ void readSyncBulkPayload(aeEventLoop *el, int fd, void *privdata, int mask) {
         serverLog(LL_NOTICE, "MASTER <-> SLAVE sync: Flushing old data");
         signalFlushedDb(-1);
         //清空当前数据库
-        emptyDb(replicationEmptyDbCallback);
+        emptyDb(-1,EMPTYDB_NO_FLAGS,replicationEmptyDbCallback);
         /* Before loading the DB into memory we need to delete the readable
          * handler, otherwise it will get called recursively since
          * rdbLoad() will call the event loop to process events from time to
          * time for non blocking loading. */
         aeDeleteFileEvent(server.el,server.repl_transfer_s,AE_READABLE);
         serverLog(LL_NOTICE, "MASTER <-> SLAVE sync: Loading DB in memory");
-        if (rdbLoad(server.rdb_filename) != C_OK) {
+        if (rdbLoad(server.rdb_filename,NULL) != C_OK) {
             serverLog(LL_WARNING,"Failed trying to load the MASTER synchronization DB from disk");
             cancelReplicationHandshake();
             return;
@@ -1280,23 +1566,7 @@ void readSyncBulkPayload(aeEventLoop *el, int fd, void *privdata, int mask) {
         close(server.repl_transfer_fd);
         //这里才会创建master 然后 在replicationCron的时候 才会发送ACK给Master
         replicationCreateMasterClient(server.repl_transfer_s);
-        serverLog(LL_NOTICE, "MASTER <-> SLAVE sync: Finished with success");
-        /* Restart the AOF subsystem now that we finished the sync. This
-         * will trigger an AOF rewrite, and when done will start appending
-         * to the new file. */
-        if (server.aof_state != AOF_OFF) {
-            int retry = 10;
-
-            stopAppendOnly();
-            while (retry-- && startAppendOnly() == C_ERR) {
-                serverLog(LL_WARNING,"Failed enabling the AOF after successful master synchronization! Trying it again in one second.");
-                sleep(1);
-            }
-            if (!retry) {
-                serverLog(LL_WARNING,"FATAL: this slave instance finished the synchronization with its master, but the AOF can't be turned on. Exiting now.");
-                exit(1);
-            }
-        }
+        replicationSyncFinished();
     }
 
     return;
@@ -1520,8 +1790,47 @@ int slaveTryPartialResynchronization(int fd, int read_reply) {
         /* Partial resync was accepted, set the replication state accordingly */
         serverLog(LL_NOTICE,
             "Successful partial resynchronization with master.");
+
+        /* Check the new replication ID advertised by the master. If it
+         * changed, we need to set the new ID as primary ID, and set or
+         * secondary ID as the old master ID up to the current offset, so
+         * that our sub-slaves will be able to PSYNC with us after a
+         * disconnection. */
+        char *start = reply+10;
+        char *end = reply+9;
+        while(end[0] != '\r' && end[0] != '\n' && end[0] != '\0') end++;
+        if (end-start == CONFIG_RUN_ID_SIZE) {
+            char new[CONFIG_RUN_ID_SIZE+1];
+            memcpy(new,start,CONFIG_RUN_ID_SIZE);
+            new[CONFIG_RUN_ID_SIZE] = '\0';
+
+            if (strcmp(new,server.cached_master->replrunid)) {
+                /* Master ID changed. */
+                serverLog(LL_WARNING,"Master replication ID changed to %s",new);
+
+                /* Set the old ID as our ID2, up to the current offset+1. */
+                memcpy(server.replid2,server.cached_master->replrunid,
+                    sizeof(server.replid2));
+                server.second_replid_offset = server.master_repl_offset+1;
+
+                /* Update the cached master ID and our own primary ID to the
+                 * new one. */
+                memcpy(server.replid,new,sizeof(server.replid));
+                memcpy(server.cached_master->replrunid,new,sizeof(server.replid));
+
+                /* Disconnect all the sub-slaves: they need to be notified. */
+                disconnectSlaves();
+            }
+        }
+
+        /* Setup the replication to continue. */
         sdsfree(reply);
         replicationResurrectCachedMaster(fd);
+
+        /* If this instance was restarted and we read the metadata to
+         * PSYNC from the persistence file, our replication backlog could
+         * be still not initialized. Create it. */
+        if (server.repl_backlog == NULL) createReplicationBacklog();
         return PSYNC_CONTINUE;
     }
 
@@ -1700,13 +2009,15 @@ void syncWithMaster(aeEventLoop *el, int fd, void *privdata, int mask) {
 
     //从节点发"REPLCONF capa  eof"命令，则将从节点客户端的能力属性slave_capa增加SLAVE_CAPA_EOF标记，
     //表示该从节点支持无硬盘复制。目前为止，仅有这一种能力标记
-    /* Inform the master of our capabilities. While we currently send
-     * just one capability, it is possible to chain new capabilities here
-     * in the form of REPLCONF capa X capa Y capa Z ...
+    /* Inform the master of our capabilities:
+     *
+     * EOF: supports EOF-style RDB transfer for diskless replication.
+     * PSYNC2: supports PSYNC v2, so understands +CONTINUE <new repl ID>.
+     *
      * The master will ignore capabilities it does not understand. */
     if (server.repl_state == REPL_STATE_SEND_CAPA) {
         err = sendSynchronousCommand(SYNC_CMD_WRITE,fd,"REPLCONF",
-                "capa","eof",NULL);
+                "capa","eof","capa","psync2",NULL);
         if (err) goto write_error;
         sdsfree(err);
         server.repl_state = REPL_STATE_RECEIVE_CAPA;
@@ -1903,18 +2214,24 @@ int cancelReplicationHandshake(void) {
 
 /* Set replication to the specified master address and port. */
 void replicationSetMaster(char *ip, int port) {
+    int was_master = server.masterhost == NULL;
+
     sdsfree(server.masterhost);
     server.masterhost = sdsnew(ip);
     server.masterport = port;
     if (server.master) freeClient(server.master);
     disconnectAllBlockedClients(); /* Clients blocked in master, now slave. */
-    disconnectSlaves(); /* Force our slaves to resync with us as well. */
-    replicationDiscardCachedMaster(); /* Don't try a PSYNC. */
-    freeReplicationBacklog(); /* Don't allow our chained slaves to PSYNC. */
+
+    /* Force our slaves to resync with us as well. They may hopefully be able
+     * to partially resync with us, but we can notify the replid change. */
+    disconnectSlaves();
     cancelReplicationHandshake();
+    //如果之前是master，用自己的复制ID和偏移量伪造一个cached master，这样可以尝试和新master部分同步
+    /* Before destroying our master state, create a cached master using
+     * our own parameters, to later PSYNC with the new master. */
+    if (was_master) replicationCacheMasterUsingMyself();
     //置为连接状态 //通过定时任务去连接master
     server.repl_state = REPL_STATE_CONNECT;
-    server.master_repl_offset = 0;
     server.repl_down_since = 0;
 }
 
@@ -1923,20 +2240,25 @@ void replicationUnsetMaster(void) {
     if (server.masterhost == NULL) return; /* Nothing to do. */
     sdsfree(server.masterhost);
     server.masterhost = NULL;
-    if (server.master) {
-        if (listLength(server.slaves) == 0) {
-            /* If this instance is turned into a master and there are no
-             * slaves, it inherits the replication offset from the master.
-             * Under certain conditions this makes replicas comparable by
-             * replication offset to understand what is the most updated. */
-            server.master_repl_offset = server.master->reploff;
-            freeReplicationBacklog();
-        }
-        freeClient(server.master);
-    }
+    /* When a slave is turned into a master, the current replication ID
+     * (that was inherited from the master at synchronization time) is
+     * used as secondary ID up to the current offset, and a new replication
+     * ID is created to continue with a new replication history. */
+    shiftReplicationId();
+    if (server.master) freeClient(server.master);
     replicationDiscardCachedMaster();
     cancelReplicationHandshake();
+    /* Disconnecting all the slaves is required: we need to inform slaves
+     * of the replication ID change (see shiftReplicationId() call). However
+     * the slaves will be able to partially resync with us, so it will be
+     * a very fast reconnection. */
+    disconnectSlaves();
     server.repl_state = REPL_STATE_NONE;
+
+    /* We need to make sure the new master will start the replication stream
+     * with a SELECT statement. This is forced after a full resync, but
+     * after a failover the slaves continue with a partial resync. */
+    server.slaveseldb = -1;
 }
 
 /* This function is called when the slave lose the connection with the
@@ -2101,6 +2423,22 @@ void replicationCacheMaster(client *c) {
     /* Unlink the client from the server structures. */
     unlinkClient(c);
 
+    //reploff只统计已经执行的命令，所以丢弃还没有执行的部分，重连后从reploff+1开始继续
+    /* Reset the master client so that's ready to accept new commands:
+     * we want to discard te non processed query buffers and non processed
+     * offsets, including pending transactions, already populated arguments,
+     * pending outputs to the master. */
+    sdsclear(server.master->querybuf);
+    server.master->qb_pos = 0;
+    sdsclear(server.master->pending_querybuf);
+    server.master->read_reploff = server.master->reploff;
+    if (c->flags & CLIENT_MULTI) discardTransaction(c);
+    while(listLength(c->reply)) listDelNode(c->reply,listFirst(c->reply));
+    c->sentlen = 0;
+    c->reply_bytes = 0;
+    c->bufpos = 0;
+    resetClient(c);
+
     //保存master到cached_master
     /* Save the master. Server.master will be set to null later by
      * replicationHandleMasterDisconnection(). */
@@ -2118,6 +2456,33 @@ void replicationCacheMaster(client *c) {
     replicationHandleMasterDisconnection();
 }
 
+/* This function is called when a master is turend into a slave, in order to
+ * create from scratch a cached master for the new client, that will allow
+ * to PSYNC with the slave that was promoted as the new master after a
+ * failover.
+ *
+ * Assuming this instance was previously the master instance of the new master,
+ * the new master will accept its replication ID, and potentiall also the
+ * current offset if no data was lost during the failover. So we use our
+ * current replication ID and offset in order to synthesize a cached master. */
+void replicationCacheMasterUsingMyself(void) {
+    client *c = createClient(-1);
+
+    /* The master client we create can be set to any DBID, because
+     * the new master will start its replication stream with SELECT. */
+    c->flags |= CLIENT_MASTER;
+    c->authenticated = 1;
+    c->querybuf = sdsempty();
+
+    /* Use our own ID / offset. */
+    c->reploff = c->read_reploff = server.master_repl_offset;
+    memcpy(c->replrunid, server.replid, sizeof(server.replid));
+
+    /* Set as cached master. */
+    server.cached_master = c;
+    serverLog(LL_NOTICE,"Before turning into a slave, using my master parameters to synthesize a cached master: I may be able to synchronize with the new master with just a partial transfer.");
+}
+
 /* Free a cached master, called when there are no longer the conditions for
  * a partial resync on reconnection. */
 void replicationDiscardCachedMaster(void) {
@@ -2554,11 +2919,28 @@ void replicationCron(void) {
     /* If we have no attached slaves and there is a replication backlog
      * using memory, free it after some (configured) time. */
     if (listLength(server.slaves) == 0 && server.repl_backlog_time_limit &&
-        server.repl_backlog)
+        server.repl_backlog && server.masterhost == NULL)
     {
         time_t idle = server.unixtime - server.repl_no_slaves_since;
 
         if (idle > server.repl_backlog_time_limit) {
+            /* When we free the backlog, we always use a new
+             * replication ID and clear the ID2. This is needed
+             * because when there is no backlog, the master_repl_offset
+             * is not updated, but we would still retain our replication
+             * ID, leading to the following problem:
+             *
+             * 1. We are a master instance.
+             * 2. Our slave is promoted to master. It's repl-id-2 will
+             *    be the same as our repl-id.
+             * 3. We, yet as master, receive some updates, that will not
+             *    increment the master_repl_offset.
+             * 4. Later we are turned into a slave, connect to the new
+             *    master that will accept our PSYNC request by second
+             *    replication ID, but there will be data inconsistency
+             *    because we received writes. */
+            changeReplicationId();
+            clearReplicationId2();
             freeReplicationBacklog();
             serverLog(LL_NOTICE,
                 "Replication backlog freed after %d seconds "
@@ -2583,7 +2965,7 @@ void replicationCron(void) {
      * In case of diskless replication, we make sure to wait the specified
      * number of seconds (according to configuration) so that other slaves
      * have the time to arrive before we start streaming. */
-    if (server.rdb_child_pid == -1 && server.aof_child_pid == -1) {
+    if (!rdbSaveInProgress() && server.aof_child_pid == -1) {
         time_t idle, max_idle = 0;
         int slaves_waiting = 0;
         int mincapa = -1;
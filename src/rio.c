@@ -289,6 +289,108 @@ void rioFreeFdset(rio *r) {
     sdsfree(r->io.fdset.buf);
 }
 
+/* ------------------- File descriptor read implementation ------------------- */
+
+/* Read 'len' bytes from the blocking file descriptor, buffering the data in
+ * chunks of PROTO_IOBUF_LEN bytes in order to avoid a read(2) call for every
+ * small field of the RDB format. No more than 'read_limit' bytes are ever
+ * read from the descriptor, so that the data following the payload in the
+ * stream is not consumed. Returns 1 or 0 for success/failure. */
+static size_t rioFdRead(rio *r, void *buf, size_t len) {
+    size_t avail = sdslen(r->io.fd.buf) - r->io.fd.bufpos;
+
+    while (avail < len) {
+        size_t toread = PROTO_IOBUF_LEN;
+        ssize_t nread;
+
+        /* Discard the consumed data before to grow the buffer. */
+        if (r->io.fd.bufpos) {
+            sdsrange(r->io.fd.buf,r->io.fd.bufpos,-1);
+            r->io.fd.bufpos = 0;
+        }
+        if (len-avail > toread) toread = len-avail;
+        if (r->io.fd.read_limit) {
+            if (r->io.fd.read_so_far == r->io.fd.read_limit) {
+                errno = EOVERFLOW;
+                return 0;
+            }
+            if (toread > r->io.fd.read_limit - r->io.fd.read_so_far)
+                toread = r->io.fd.read_limit - r->io.fd.read_so_far;
+        }
+        r->io.fd.buf = sdsMakeRoomFor(r->io.fd.buf,toread);
+        nread = read(r->io.fd.fd,r->io.fd.buf+sdslen(r->io.fd.buf),toread);
+        if (nread <= 0) {
+            if (nread == -1 && errno == EINTR) continue;
+            /* With blocking sockets EWOULDBLOCK is returned only because of
+             * the SO_RCVTIMEO socket option, see rioFdsetWrite(). */
+            if (nread == -1 && errno == EWOULDBLOCK) errno = ETIMEDOUT;
+            if (nread == 0) errno = ECONNRESET;
+            return 0;
+        }
+        sdsIncrLen(r->io.fd.buf,nread);
+        r->io.fd.read_so_far += nread;
+        avail += nread;
+    }
+    memcpy(buf,r->io.fd.buf+r->io.fd.bufpos,len);
+    r->io.fd.bufpos += len;
+    r->io.fd.pos += len;
+    return 1;
+}
+
+/* Returns 1 or 0 for success/failure. */
+static size_t rioFdWrite(rio *r, const void *buf, size_t len) {
+    UNUSED(r);
+    UNUSED(buf);
+    UNUSED(len);
+    return 0; /* Error, this target does not support writing. */
+}
+
+/* Returns the number of bytes consumed by the reader. */
+static off_t rioFdTell(rio *r) {
+    return r->io.fd.pos;
+}
+
+static int rioFdFlush(rio *r) {
+    UNUSED(r);
+    return 1;
+}
+
+static const rio rioFdIO = {
+    rioFdRead,
+    rioFdWrite,
+    rioFdTell,
+    rioFdFlush,
+    NULL,           /* update_checksum */
+    0,              /* current checksum */
+    0,              /* bytes read or written */
+    0,              /* read/write chunk size */
+    { { NULL, 0 } } /* union for io-specific vars */
+};
+
+/* Read from the blocking file descriptor 'fd'. When 'read_limit' is not zero
+ * no more than 'read_limit' bytes are read from it. */
+void rioInitWithFd(rio *r, int fd, size_t read_limit) {
+    *r = rioFdIO;
+    r->io.fd.fd = fd;
+    r->io.fd.pos = 0;
+    r->io.fd.buf = sdsempty();
+    r->io.fd.bufpos = 0;
+    r->io.fd.read_limit = read_limit;
+    r->io.fd.read_so_far = 0;
+}
+
+/* Release the rio stream. If 'remaining' is not NULL, the data read from the
+ * file descriptor but not consumed yet is returned there, otherwise it is
+ * discarded. */
+void rioFreeFd(rio *r, sds *remaining) {
+    if (remaining) {
+        sdsrange(r->io.fd.buf,r->io.fd.bufpos,-1);
+        *remaining = r->io.fd.buf;
+    } else {
+        sdsfree(r->io.fd.buf);
+    }
+}
+
 /* ---------------------------- Generic functions ---------------------------- */
 
 /* This function can be installed both in memory and file streams when checksum
@@ -81,6 +81,15 @@ struct _rio {
             off_t pos;
             sds buf;
         } fdset;
+        /* Read only file descriptor target (used to read from a socket). */
+        struct {
+            int fd;
+            off_t pos;          /* Bytes consumed by the reader. */
+            sds buf;            /* Data read from the fd and not consumed. */
+            size_t bufpos;      /* Offset of the unconsumed data in 'buf'. */
+            size_t read_limit;  /* Never read more bytes than this, 0 = no limit. */
+            size_t read_so_far; /* Bytes read from the fd so far. */
+        } fd;
     } io;
 };
 
@@ -127,8 +136,10 @@ static inline int rioFlush(rio *r) {
 void rioInitWithFile(rio *r, FILE *fp);
 void rioInitWithBuffer(rio *r, sds s);
 void rioInitWithFdset(rio *r, int *fds, int numfds);
+void rioInitWithFd(rio *r, int fd, size_t read_limit);
 
 void rioFreeFdset(rio *r);
+void rioFreeFd(rio *r, sds *remaining);
 
 size_t rioWriteBulkCount(rio *r, char prefix, int count);
 size_t rioWriteBulkString(rio *r, const char *buf, size_t len);
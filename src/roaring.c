@@ -0,0 +1,1418 @@
+/* Roaring set -- A compressed set of 64 bit signed integers, used for the
+ * large sets of integers when set-large-encoding is "roaring".
+ *
+ * Values are split in a 48 bit key and a 16 bit low part. All the values
+ * sharing a key are stored in one container, in one of three ways,
+ * whichever needs less memory:
+ *
+ * ARRAY:  sorted array of the 16 bit low parts, 2 bytes per value. Used
+ *         for at most ROARING_ARRAY_MAX values.
+ * BITMAP: 65536 bits, 8192 bytes whatever the number of values.
+ * RUN:    sorted array of {start,length-1} pairs of 16 bit integers, 4 bytes
+ *         for every run of consecutive values.
+ *
+ * Containers are converted as values are added and removed, so dense sets
+ * cost about one bit per value and sequences of IDs a few bytes per run.
+ * Set operations work a container at a time: arrays are merged, while
+ * bitmaps and runs are combined as 1024 words of 64 bits with plain loops
+ * the compiler can vectorize.
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "roaring.h"
+#include "zmalloc.h"
+#include "endianconv.h"
+
+#define ROARING_SIGN (1ULL<<63)
+#define ROARING_BITMAP_BYTES (ROARING_BITMAP_WORDS*8)
+
+/* Serialized size of the header of every container: key, type, card and
+ * len. */
+#define ROARING_CONTAINER_HDR (8+1+4+4)
+
+#define ARRAY(c) ((uint16_t*)(c)->data)
+#define RUNS(c) ((uint16_t*)(c)->data)
+#define RUN_START(c,i) (RUNS(c)[(i)*2])
+#define RUN_LEN(c,i) (RUNS(c)[(i)*2+1]) /* Length minus one. */
+#define RUN_END(c,i) ((uint32_t)RUN_START(c,i)+RUN_LEN(c,i))
+
+static inline uint64_t roaringKey(int64_t value) {
+    return ((uint64_t)value ^ ROARING_SIGN) >> 16;
+}
+
+static inline int64_t roaringValue(uint64_t key, uint16_t low) {
+    return (int64_t)(((key << 16) | low) ^ ROARING_SIGN);
+}
+
+/*-----------------------------------------------------------------------------
+ * Bitmap helpers
+ *----------------------------------------------------------------------------*/
+
+/* Set the bits from 'start' to 'end', both inclusive. */
+static void bitmapSetRange(uint64_t *w, uint32_t start, uint32_t end) {
+    uint32_t first = start >> 6, last = end >> 6, j;
+    uint64_t fmask = ~0ULL << (start & 63), lmask = ~0ULL >> (63 - (end & 63));
+
+    if (first == last) {
+        w[first] |= fmask & lmask;
+        return;
+    }
+    w[first] |= fmask;
+    for (j = first+1; j < last; j++) w[j] = ~0ULL;
+    w[last] |= lmask;
+}
+
+/* Clear the bits from 'start' to 'end', both inclusive. */
+static void bitmapClearRange(uint64_t *w, uint32_t start, uint32_t end) {
+    uint32_t first = start >> 6, last = end >> 6, j;
+    uint64_t fmask = ~0ULL << (start & 63), lmask = ~0ULL >> (63 - (end & 63));
+
+    if (first == last) {
+        w[first] &= ~(fmask & lmask);
+        return;
+    }
+    w[first] &= ~fmask;
+    for (j = first+1; j < last; j++) w[j] = 0;
+    w[last] &= ~lmask;
+}
+
+static uint32_t bitmapCard(const uint64_t *w) {
+    uint32_t card = 0, j;
+
+    for (j = 0; j < ROARING_BITMAP_WORDS; j++)
+        card += __builtin_popcountll(w[j]);
+    return card;
+}
+
+/* Return the number of runs of consecutive set bits: a run starts at every
+ * set bit whose previous bit is clear. */
+static uint32_t bitmapRuns(const uint64_t *w) {
+    uint32_t runs = 0, j;
+    uint64_t prev = 0;
+
+    for (j = 0; j < ROARING_BITMAP_WORDS; j++) {
+        runs += __builtin_popcountll(w[j] & ~((w[j] << 1) | (prev >> 63)));
+        prev = w[j];
+    }
+    return runs;
+}
+
+/*-----------------------------------------------------------------------------
+ * Containers
+ *----------------------------------------------------------------------------*/
+
+static size_t containerDataBytes(int type, uint32_t alloc) {
+    if (type == ROARING_BITMAP) return ROARING_BITMAP_BYTES;
+    if (type == ROARING_ARRAY) return (size_t)alloc*2;
+    return (size_t)alloc*4;
+}
+
+/* Create an empty container with room for 'alloc' values or runs. */
+static roaringContainer *containerNew(int type, uint32_t alloc) {
+    roaringContainer *c = zmalloc(sizeof(*c)+containerDataBytes(type,alloc));
+
+    c->type = type;
+    c->card = 0;
+    c->len = 0;
+    c->alloc = (type == ROARING_BITMAP) ? 0 : alloc;
+    if (type == ROARING_BITMAP) memset(c->data,0,ROARING_BITMAP_BYTES);
+    return c;
+}
+
+/* Make sure an array or run container has room for 'len' values or runs. */
+static roaringContainer *containerReserve(roaringContainer *c, uint32_t len) {
+    uint32_t alloc;
+
+    if (len <= c->alloc) return c;
+    alloc = c->alloc ? c->alloc : 1;
+    while (alloc < len) alloc *= 2;
+    if (c->type == ROARING_ARRAY && alloc > ROARING_ARRAY_MAX)
+        alloc = ROARING_ARRAY_MAX;
+    c = zrealloc(c,sizeof(*c)+containerDataBytes(c->type,alloc));
+    c->alloc = alloc;
+    return c;
+}
+
+/* Release the unused space at the end of an array or run container. */
+static roaringContainer *containerShrink(roaringContainer *c) {
+    if (c->type == ROARING_BITMAP || c->alloc == c->len) return c;
+    c = zrealloc(c,sizeof(*c)+containerDataBytes(c->type,c->len));
+    c->alloc = c->len;
+    return c;
+}
+
+static roaringContainer *containerDup(roaringContainer *c) {
+    uint32_t alloc = (c->type == ROARING_BITMAP) ? 0 : c->len;
+    size_t bytes = containerDataBytes(c->type,alloc);
+    roaringContainer *dup = zmalloc(sizeof(*c)+bytes);
+
+    dup->type = c->type;
+    dup->card = c->card;
+    dup->len = c->len;
+    dup->alloc = alloc;
+    memcpy(dup->data,c->data,bytes);
+    return dup;
+}
+
+/* Return the first position of the array not smaller than 'low'. */
+static uint32_t arrayLowerBound(const uint16_t *a, uint32_t len, uint16_t low) {
+    uint32_t lo = 0, hi = len, mid;
+
+    while (lo < hi) {
+        mid = (lo+hi)/2;
+        if (a[mid] < low) lo = mid+1; else hi = mid;
+    }
+    return lo;
+}
+
+/* Return the index of the last run starting at or before 'low', or -1. */
+static int32_t runFloor(roaringContainer *c, uint16_t low) {
+    uint32_t lo = 0, hi = c->len, mid;
+
+    while (lo < hi) {
+        mid = (lo+hi)/2;
+        if (RUN_START(c,mid) <= low) lo = mid+1; else hi = mid;
+    }
+    return (int32_t)lo-1;
+}
+
+static int containerContains(roaringContainer *c, uint16_t low) {
+    if (c->type == ROARING_ARRAY) {
+        uint32_t pos = arrayLowerBound(ARRAY(c),c->len,low);
+        return pos < c->len && ARRAY(c)[pos] == low;
+    } else if (c->type == ROARING_BITMAP) {
+        return (c->data[low >> 6] >> (low & 63)) & 1;
+    } else {
+        int32_t i = runFloor(c,low);
+        return i >= 0 && low <= RUN_END(c,i);
+    }
+}
+
+/* Fill the 'w' bitmap with the values of the container. */
+static void containerToBitmap(roaringContainer *c, uint64_t *w) {
+    uint32_t j;
+
+    if (c->type == ROARING_BITMAP) {
+        memcpy(w,c->data,ROARING_BITMAP_BYTES);
+        return;
+    }
+    memset(w,0,ROARING_BITMAP_BYTES);
+    if (c->type == ROARING_ARRAY) {
+        for (j = 0; j < c->len; j++)
+            w[ARRAY(c)[j] >> 6] |= 1ULL << (ARRAY(c)[j] & 63);
+    } else {
+        for (j = 0; j < c->len; j++)
+            bitmapSetRange(w,RUN_START(c,j),RUN_END(c,j));
+    }
+}
+
+/* Return the type needing less memory for 'card' values making 'runs' runs
+ * of consecutive values. */
+static int containerBestType(uint32_t card, uint32_t runs) {
+    size_t best = (card <= ROARING_ARRAY_MAX) ? (size_t)card*2 :
+                                                ROARING_BITMAP_BYTES;
+    if ((size_t)runs*4 < best) return ROARING_RUN;
+    return (card <= ROARING_ARRAY_MAX) ? ROARING_ARRAY : ROARING_BITMAP;
+}
+
+/* Create a container of the given type with the values of the 'w' bitmap.
+ * With a zero 'type' the smallest type is used. Returns NULL if the bitmap
+ * is empty. */
+static roaringContainer *containerFromBitmap(const uint64_t *w, int type) {
+    uint32_t card = bitmapCard(w), runs = 0, j;
+    roaringContainer *c;
+
+    if (card == 0) return NULL;
+    if (type == 0 || type == ROARING_RUN) runs = bitmapRuns(w);
+    if (type == 0) type = containerBestType(card,runs);
+
+    if (type == ROARING_BITMAP) {
+        c = containerNew(ROARING_BITMAP,0);
+        memcpy(c->data,w,ROARING_BITMAP_BYTES);
+    } else if (type == ROARING_ARRAY) {
+        c = containerNew(ROARING_ARRAY,card);
+        for (j = 0; j < ROARING_BITMAP_WORDS; j++) {
+            uint64_t word = w[j];
+            while (word) {
+                ARRAY(c)[c->len++] = j*64 + __builtin_ctzll(word);
+                word &= word-1;
+            }
+        }
+    } else {
+        int64_t last = -2;
+
+        c = containerNew(ROARING_RUN,runs);
+        for (j = 0; j < ROARING_BITMAP_WORDS; j++) {
+            uint64_t word = w[j];
+            while (word) {
+                int64_t v = j*64 + __builtin_ctzll(word);
+                word &= word-1;
+                if (v == last+1) {
+                    RUN_LEN(c,c->len-1)++;
+                } else {
+                    RUN_START(c,c->len) = v;
+                    RUN_LEN(c,c->len) = 0;
+                    c->len++;
+                }
+                last = v;
+            }
+        }
+    }
+    c->card = card;
+    return c;
+}
+
+/* Convert the container to 'type', or to the smallest type if zero. */
+static roaringContainer *containerConvert(roaringContainer *c, int type) {
+    uint64_t w[ROARING_BITMAP_WORDS];
+    roaringContainer *new;
+
+    if (c->type == type) return c;
+    containerToBitmap(c,w);
+    new = containerFromBitmap(w,type);
+    zfree(c);
+    return new;
+}
+
+/* Return the number of runs of consecutive values in the container. */
+static uint32_t containerRuns(roaringContainer *c) {
+    uint32_t runs, j;
+
+    if (c->type == ROARING_RUN) return c->len;
+    if (c->type == ROARING_BITMAP) return bitmapRuns(c->data);
+    runs = c->len ? 1 : 0;
+    for (j = 1; j < c->len; j++)
+        if (ARRAY(c)[j] != ARRAY(c)[j-1]+1) runs++;
+    return runs;
+}
+
+/* Add 'low' to the container stored at '*cp', that may be reallocated or
+ * converted. Returns 1 if the value was added, 0 if already there. */
+static int containerAdd(roaringContainer **cp, uint16_t low) {
+    roaringContainer *c = *cp;
+
+    if (c->type == ROARING_ARRAY) {
+        uint32_t pos = arrayLowerBound(ARRAY(c),c->len,low);
+
+        if (pos < c->len && ARRAY(c)[pos] == low) return 0;
+        if (c->len == ROARING_ARRAY_MAX) {
+            c = containerConvert(c,ROARING_BITMAP);
+            c->data[low >> 6] |= 1ULL << (low & 63);
+        } else {
+            c = containerReserve(c,c->len+1);
+            memmove(ARRAY(c)+pos+1,ARRAY(c)+pos,(c->len-pos)*2);
+            ARRAY(c)[pos] = low;
+            c->len++;
+        }
+    } else if (c->type == ROARING_BITMAP) {
+        uint64_t bit = 1ULL << (low & 63);
+
+        if (c->data[low >> 6] & bit) return 0;
+        c->data[low >> 6] |= bit;
+    } else {
+        int32_t i = runFloor(c,low);
+        int left = i >= 0 && RUN_END(c,i)+1 == low;
+        int right = i+1 < (int32_t)c->len && RUN_START(c,i+1) == low+1;
+
+        if (i >= 0 && low <= RUN_END(c,i)) return 0;
+        if (left && right) {
+            /* 'low' fills the hole between two runs: join them. */
+            RUN_LEN(c,i) = RUN_END(c,i+1) - RUN_START(c,i);
+            memmove(RUNS(c)+(i+1)*2,RUNS(c)+(i+2)*2,(c->len-i-2)*4);
+            c->len--;
+        } else if (left) {
+            RUN_LEN(c,i)++;
+        } else if (right) {
+            RUN_START(c,i+1)--;
+            RUN_LEN(c,i+1)++;
+        } else {
+            c = containerReserve(c,c->len+1);
+            memmove(RUNS(c)+(i+2)*2,RUNS(c)+(i+1)*2,(c->len-i-1)*4);
+            RUN_START(c,i+1) = low;
+            RUN_LEN(c,i+1) = 0;
+            c->len++;
+        }
+    }
+    c->card++;
+    if (c->type == ROARING_RUN &&
+        containerBestType(c->card,c->len) != ROARING_RUN)
+    {
+        c = containerConvert(c,0);
+    }
+    *cp = c;
+    return 1;
+}
+
+/* Remove 'low' from the container stored at '*cp', that may be reallocated
+ * or converted. Returns 1 if the value was removed, 0 if it was missing.
+ * The container is left empty after its last value is removed. */
+static int containerRemove(roaringContainer **cp, uint16_t low) {
+    roaringContainer *c = *cp;
+
+    if (c->type == ROARING_ARRAY) {
+        uint32_t pos = arrayLowerBound(ARRAY(c),c->len,low);
+
+        if (pos == c->len || ARRAY(c)[pos] != low) return 0;
+        memmove(ARRAY(c)+pos,ARRAY(c)+pos+1,(c->len-pos-1)*2);
+        c->len--;
+        c->card--;
+        if (c->len && c->len*4 <= c->alloc) c = containerShrink(c);
+    } else if (c->type == ROARING_BITMAP) {
+        uint64_t bit = 1ULL << (low & 63);
+
+        if (!(c->data[low >> 6] & bit)) return 0;
+        c->data[low >> 6] &= ~bit;
+        c->card--;
+        if (c->card <= ROARING_ARRAY_MAX && c->card)
+            c = containerConvert(c,ROARING_ARRAY);
+    } else {
+        int32_t i = runFloor(c,low);
+        uint32_t end;
+
+        if (i < 0 || low > RUN_END(c,i)) return 0;
+        end = RUN_END(c,i);
+        if (RUN_LEN(c,i) == 0) {
+            memmove(RUNS(c)+i*2,RUNS(c)+(i+1)*2,(c->len-i-1)*4);
+            c->len--;
+        } else if (low == RUN_START(c,i)) {
+            RUN_START(c,i)++;
+            RUN_LEN(c,i)--;
+        } else if (low == end) {
+            RUN_LEN(c,i)--;
+        } else {
+            /* Split the run in two around 'low'. */
+            c = containerReserve(c,c->len+1);
+            memmove(RUNS(c)+(i+2)*2,RUNS(c)+(i+1)*2,(c->len-i-1)*4);
+            RUN_LEN(c,i) = low - RUN_START(c,i) - 1;
+            RUN_START(c,i+1) = low+1;
+            RUN_LEN(c,i+1) = end - low - 1;
+            c->len++;
+        }
+        c->card--;
+        if (c->card && containerBestType(c->card,c->len) != ROARING_RUN)
+            c = containerConvert(c,0);
+    }
+    *cp = c;
+    return 1;
+}
+
+/* Return the value of rank 'rank' (zero based) of the container. */
+static uint16_t containerSelect(roaringContainer *c, uint32_t rank) {
+    uint32_t j;
+
+    if (c->type == ROARING_ARRAY) {
+        return ARRAY(c)[rank];
+    } else if (c->type == ROARING_BITMAP) {
+        for (j = 0; j < ROARING_BITMAP_WORDS; j++) {
+            uint64_t word = c->data[j];
+            uint32_t bits = __builtin_popcountll(word);
+
+            if (rank < bits) {
+                while (rank--) word &= word-1;
+                return j*64 + __builtin_ctzll(word);
+            }
+            rank -= bits;
+        }
+    } else {
+        for (j = 0; j < c->len; j++) {
+            if (rank <= RUN_LEN(c,j)) return RUN_START(c,j) + rank;
+            rank -= RUN_LEN(c,j)+1;
+        }
+    }
+    return 0; /* Not reached with a valid rank. */
+}
+
+/* Intersect two containers into a new one, NULL if the result is empty. */
+static roaringContainer *containerAnd(roaringContainer *a,
+                                      roaringContainer *b) {
+    roaringContainer *c;
+    uint32_t j;
+
+    if (a->type == ROARING_ARRAY || b->type == ROARING_ARRAY) {
+        /* The result is at most as big as the array: filter it. */
+        if (a->type != ROARING_ARRAY ||
+            (b->type == ROARING_ARRAY && b->len < a->len))
+        {
+            roaringContainer *tmp = a; a = b; b = tmp;
+        }
+        c = containerNew(ROARING_ARRAY,a->len);
+        if (b->type == ROARING_ARRAY) {
+            uint32_t i = 0;
+            j = 0;
+            while (i < a->len && j < b->len) {
+                if (ARRAY(a)[i] < ARRAY(b)[j]) {
+                    i++;
+                } else if (ARRAY(a)[i] > ARRAY(b)[j]) {
+                    j++;
+                } else {
+                    ARRAY(c)[c->len++] = ARRAY(a)[i];
+                    i++;
+                    j++;
+                }
+            }
+        } else {
+            for (j = 0; j < a->len; j++)
+                if (containerContains(b,ARRAY(a)[j]))
+                    ARRAY(c)[c->len++] = ARRAY(a)[j];
+        }
+        c->card = c->len;
+        if (c->len == 0) {
+            zfree(c);
+            return NULL;
+        }
+        return containerShrink(c);
+    } else {
+        uint64_t wa[ROARING_BITMAP_WORDS], wb[ROARING_BITMAP_WORDS];
+        const uint64_t *pa = a->data, *pb = b->data;
+
+        if (a->type != ROARING_BITMAP) { containerToBitmap(a,wa); pa = wa; }
+        if (b->type != ROARING_BITMAP) { containerToBitmap(b,wb); pb = wb; }
+        for (j = 0; j < ROARING_BITMAP_WORDS; j++) wa[j] = pa[j] & pb[j];
+        return containerFromBitmap(wa,0);
+    }
+}
+
+/* Return the union of two containers as a new container. */
+static roaringContainer *containerOr(roaringContainer *a, roaringContainer *b) {
+    uint64_t w[ROARING_BITMAP_WORDS];
+    uint32_t j;
+
+    if (a->type == ROARING_ARRAY && b->type == ROARING_ARRAY &&
+        a->len + b->len <= ROARING_ARRAY_MAX)
+    {
+        roaringContainer *c = containerNew(ROARING_ARRAY,a->len+b->len);
+        uint32_t i = 0;
+
+        j = 0;
+        while (i < a->len || j < b->len) {
+            if (j == b->len || (i < a->len && ARRAY(a)[i] < ARRAY(b)[j])) {
+                ARRAY(c)[c->len++] = ARRAY(a)[i++];
+            } else if (i == a->len || ARRAY(a)[i] > ARRAY(b)[j]) {
+                ARRAY(c)[c->len++] = ARRAY(b)[j++];
+            } else {
+                ARRAY(c)[c->len++] = ARRAY(a)[i];
+                i++;
+                j++;
+            }
+        }
+        c->card = c->len;
+        return containerShrink(c);
+    }
+
+    containerToBitmap(a,w);
+    if (b->type == ROARING_BITMAP) {
+        for (j = 0; j < ROARING_BITMAP_WORDS; j++) w[j] |= b->data[j];
+    } else if (b->type == ROARING_ARRAY) {
+        for (j = 0; j < b->len; j++)
+            w[ARRAY(b)[j] >> 6] |= 1ULL << (ARRAY(b)[j] & 63);
+    } else {
+        for (j = 0; j < b->len; j++)
+            bitmapSetRange(w,RUN_START(b,j),RUN_END(b,j));
+    }
+    return containerFromBitmap(w,0);
+}
+
+/* Return the values of 'a' missing in 'b' as a new container, NULL if there
+ * are none. */
+static roaringContainer *containerAndNot(roaringContainer *a,
+                                         roaringContainer *b) {
+    uint64_t w[ROARING_BITMAP_WORDS];
+    uint32_t j;
+
+    if (a->type == ROARING_ARRAY) {
+        roaringContainer *c = containerNew(ROARING_ARRAY,a->len);
+
+        for (j = 0; j < a->len; j++)
+            if (!containerContains(b,ARRAY(a)[j]))
+                ARRAY(c)[c->len++] = ARRAY(a)[j];
+        c->card = c->len;
+        if (c->len == 0) {
+            zfree(c);
+            return NULL;
+        }
+        return containerShrink(c);
+    }
+
+    containerToBitmap(a,w);
+    if (b->type == ROARING_BITMAP) {
+        for (j = 0; j < ROARING_BITMAP_WORDS; j++) w[j] &= ~b->data[j];
+    } else if (b->type == ROARING_ARRAY) {
+        for (j = 0; j < b->len; j++)
+            w[ARRAY(b)[j] >> 6] &= ~(1ULL << (ARRAY(b)[j] & 63));
+    } else {
+        for (j = 0; j < b->len; j++)
+            bitmapClearRange(w,RUN_START(b,j),RUN_END(b,j));
+    }
+    return containerFromBitmap(w,0);
+}
+
+/* Return the size of the intersection of two containers. */
+static uint32_t containerAndCard(roaringContainer *a, roaringContainer *b) {
+    uint32_t card = 0, j;
+
+    if (a->type == ROARING_ARRAY || b->type == ROARING_ARRAY) {
+        if (a->type != ROARING_ARRAY) {
+            roaringContainer *tmp = a; a = b; b = tmp;
+        }
+        for (j = 0; j < a->len; j++)
+            card += containerContains(b,ARRAY(a)[j]);
+    } else {
+        uint64_t wa[ROARING_BITMAP_WORDS], wb[ROARING_BITMAP_WORDS];
+        const uint64_t *pa = a->data, *pb = b->data;
+
+        if (a->type != ROARING_BITMAP) { containerToBitmap(a,wa); pa = wa; }
+        if (b->type != ROARING_BITMAP) { containerToBitmap(b,wb); pb = wb; }
+        for (j = 0; j < ROARING_BITMAP_WORDS; j++)
+            card += __builtin_popcountll(pa[j] & pb[j]);
+    }
+    return card;
+}
+
+/*-----------------------------------------------------------------------------
+ * Roaring set API
+ *----------------------------------------------------------------------------*/
+
+/* Create an empty set. */
+roaring *roaringNew(void) {
+    roaring *r = zmalloc(sizeof(*r));
+
+    r->card = 0;
+    r->len = 0;
+    r->alloc = 0;
+    r->keys = NULL;
+    r->containers = NULL;
+    return r;
+}
+
+void roaringFree(roaring *r) {
+    uint32_t j;
+
+    for (j = 0; j < r->len; j++) zfree(r->containers[j]);
+    zfree(r->keys);
+    zfree(r->containers);
+    zfree(r);
+}
+
+/* Resize the keys and containers arrays to 'alloc' entries. */
+static void roaringResize(roaring *r, uint32_t alloc) {
+    r->keys = zrealloc(r->keys,sizeof(uint64_t)*alloc);
+    r->containers = zrealloc(r->containers,sizeof(roaringContainer*)*alloc);
+    r->alloc = alloc;
+}
+
+roaring *roaringDup(roaring *r) {
+    roaring *dup = roaringNew();
+    uint32_t j;
+
+    if (r->len) {
+        roaringResize(dup,r->len);
+        memcpy(dup->keys,r->keys,sizeof(uint64_t)*r->len);
+        for (j = 0; j < r->len; j++)
+            dup->containers[j] = containerDup(r->containers[j]);
+    }
+    dup->len = r->len;
+    dup->card = r->card;
+    return dup;
+}
+
+/* Return the position of the first container with a key not smaller than
+ * 'key'. Values are often added in order, so the last container is checked
+ * before the binary search. */
+static uint32_t roaringKeyLowerBound(roaring *r, uint64_t key) {
+    uint32_t lo = 0, hi = r->len, mid;
+
+    if (r->len == 0 || r->keys[r->len-1] < key) return r->len;
+    if (r->keys[r->len-1] == key) return r->len-1;
+    while (lo < hi) {
+        mid = (lo+hi)/2;
+        if (r->keys[mid] < key) lo = mid+1; else hi = mid;
+    }
+    return lo;
+}
+
+/* Add 'value' to the set. Returns 1 if it was added, 0 if already there. */
+int roaringAdd(roaring *r, int64_t value) {
+    uint64_t key = roaringKey(value);
+    uint32_t pos = roaringKeyLowerBound(r,key);
+
+    if (pos == r->len || r->keys[pos] != key) {
+        if (r->len == r->alloc) roaringResize(r,r->alloc ? r->alloc*2 : 4);
+        memmove(r->keys+pos+1,r->keys+pos,sizeof(uint64_t)*(r->len-pos));
+        memmove(r->containers+pos+1,r->containers+pos,
+            sizeof(roaringContainer*)*(r->len-pos));
+        r->keys[pos] = key;
+        r->containers[pos] = containerNew(ROARING_ARRAY,1);
+        r->len++;
+    }
+    if (!containerAdd(&r->containers[pos],(uint16_t)value)) return 0;
+    r->card++;
+    return 1;
+}
+
+/* Remove 'value' from the set. Returns 1 if it was removed, 0 if it was not
+ * a member. */
+int roaringRemove(roaring *r, int64_t value) {
+    uint64_t key = roaringKey(value);
+    uint32_t pos = roaringKeyLowerBound(r,key);
+
+    if (pos == r->len || r->keys[pos] != key) return 0;
+    if (!containerRemove(&r->containers[pos],(uint16_t)value)) return 0;
+    r->card--;
+    if (r->containers[pos]->card == 0) {
+        zfree(r->containers[pos]);
+        memmove(r->keys+pos,r->keys+pos+1,sizeof(uint64_t)*(r->len-pos-1));
+        memmove(r->containers+pos,r->containers+pos+1,
+            sizeof(roaringContainer*)*(r->len-pos-1));
+        r->len--;
+        if (r->alloc > 4 && r->len*4 <= r->alloc)
+            roaringResize(r,r->alloc/2);
+    }
+    return 1;
+}
+
+int roaringContains(roaring *r, int64_t value) {
+    uint64_t key = roaringKey(value);
+    uint32_t pos = roaringKeyLowerBound(r,key);
+
+    if (pos == r->len || r->keys[pos] != key) return 0;
+    return containerContains(r->containers[pos],(uint16_t)value);
+}
+
+uint64_t roaringCard(roaring *r) {
+    return r->card;
+}
+
+/* Return a random member of a non empty set. Every member has the same
+ * probability: a random rank is picked and its container looked up by
+ * cardinality. */
+int64_t roaringRandom(roaring *r) {
+    uint64_t rank = (((uint64_t)rand() << 31) ^ (uint64_t)rand()) % r->card;
+    uint32_t j;
+
+    for (j = 0; j < r->len; j++) {
+        roaringContainer *c = r->containers[j];
+        if (rank < c->card)
+            return roaringValue(r->keys[j],containerSelect(c,rank));
+        rank -= c->card;
+    }
+    return 0; /* Not reached. */
+}
+
+/* Convert every container to the type needing less memory, looking for
+ * runs too, and release the unused memory of the arrays. This is an O(N)
+ * operation called when a set is created in bulk, while single additions
+ * and removals only convert the containers they touch when needed. */
+void roaringOptimize(roaring *r) {
+    uint32_t j;
+
+    for (j = 0; j < r->len; j++) {
+        roaringContainer *c = r->containers[j];
+        int type = containerBestType(c->card,containerRuns(c));
+
+        if (type != c->type) c = containerConvert(c,type);
+        r->containers[j] = containerShrink(c);
+    }
+    if (r->len && r->alloc > r->len) roaringResize(r,r->len);
+}
+
+/* Keep in 'dst' only the members of 'src' as well. */
+void roaringAnd(roaring *dst, roaring *src) {
+    uint32_t i = 0, j = 0, w = 0;
+
+    dst->card = 0;
+    while (i < dst->len && j < src->len) {
+        if (dst->keys[i] < src->keys[j]) {
+            zfree(dst->containers[i++]);
+        } else if (dst->keys[i] > src->keys[j]) {
+            j++;
+        } else {
+            roaringContainer *c = containerAnd(dst->containers[i],
+                                               src->containers[j]);
+            zfree(dst->containers[i]);
+            if (c) {
+                dst->keys[w] = dst->keys[i];
+                dst->containers[w++] = c;
+                dst->card += c->card;
+            }
+            i++;
+            j++;
+        }
+    }
+    while (i < dst->len) zfree(dst->containers[i++]);
+    dst->len = w;
+}
+
+/* Add to 'dst' all the members of 'src'. */
+void roaringOr(roaring *dst, roaring *src) {
+    uint32_t i = 0, j = 0, w = 0, alloc = dst->len + src->len;
+    uint64_t *keys;
+    roaringContainer **containers;
+
+    if (src->len == 0) return;
+    keys = zmalloc(sizeof(uint64_t)*alloc);
+    containers = zmalloc(sizeof(roaringContainer*)*alloc);
+    dst->card = 0;
+    while (i < dst->len || j < src->len) {
+        roaringContainer *c;
+
+        if (j == src->len || (i < dst->len && dst->keys[i] < src->keys[j])) {
+            keys[w] = dst->keys[i];
+            c = dst->containers[i++];
+        } else if (i == dst->len || dst->keys[i] > src->keys[j]) {
+            keys[w] = src->keys[j];
+            c = containerDup(src->containers[j++]);
+        } else {
+            keys[w] = dst->keys[i];
+            c = containerOr(dst->containers[i],src->containers[j]);
+            zfree(dst->containers[i]);
+            i++;
+            j++;
+        }
+        containers[w++] = c;
+        dst->card += c->card;
+    }
+    zfree(dst->keys);
+    zfree(dst->containers);
+    dst->keys = keys;
+    dst->containers = containers;
+    dst->len = w;
+    dst->alloc = alloc;
+}
+
+/* Remove from 'dst' all the members of 'src'. */
+void roaringAndNot(roaring *dst, roaring *src) {
+    uint32_t i = 0, j = 0, w = 0;
+
+    dst->card = 0;
+    while (i < dst->len) {
+        roaringContainer *c = dst->containers[i];
+
+        while (j < src->len && src->keys[j] < dst->keys[i]) j++;
+        if (j < src->len && src->keys[j] == dst->keys[i]) {
+            c = containerAndNot(dst->containers[i],src->containers[j]);
+            zfree(dst->containers[i]);
+        }
+        if (c) {
+            dst->keys[w] = dst->keys[i];
+            dst->containers[w++] = c;
+            dst->card += c->card;
+        }
+        i++;
+    }
+    dst->len = w;
+}
+
+/* Return the size of the intersection of 'a' and 'b' without creating it. */
+uint64_t roaringAndCard(roaring *a, roaring *b) {
+    uint32_t i = 0, j = 0;
+    uint64_t card = 0;
+
+    while (i < a->len && j < b->len) {
+        if (a->keys[i] < b->keys[j]) {
+            i++;
+        } else if (a->keys[i] > b->keys[j]) {
+            j++;
+        } else {
+            card += containerAndCard(a->containers[i],b->containers[j]);
+            i++;
+            j++;
+        }
+    }
+    return card;
+}
+
+/*-----------------------------------------------------------------------------
+ * Iterator
+ *----------------------------------------------------------------------------*/
+
+/* Initialize an iterator returning the members of 'r' in ascending order.
+ * The set must not be modified while iterating. */
+void roaringInitIterator(roaringIterator *it, roaring *r) {
+    it->r = r;
+    it->ci = 0;
+    it->pos = 0;
+    it->off = 0;
+}
+
+/* Move the iterator so that the next member returned is the first one not
+ * smaller than 'value'. */
+void roaringIteratorSeek(roaringIterator *it, int64_t value) {
+    roaring *r = it->r;
+    uint64_t key = roaringKey(value);
+    uint16_t low = (uint16_t)value;
+    roaringContainer *c;
+
+    it->ci = roaringKeyLowerBound(r,key);
+    it->pos = 0;
+    it->off = 0;
+    if (it->ci == r->len || r->keys[it->ci] != key) return;
+
+    c = r->containers[it->ci];
+    if (c->type == ROARING_ARRAY) {
+        it->pos = arrayLowerBound(ARRAY(c),c->len,low);
+    } else if (c->type == ROARING_BITMAP) {
+        it->pos = low;
+    } else {
+        int32_t i = runFloor(c,low);
+
+        if (i >= 0 && low <= RUN_END(c,i)) {
+            it->pos = i;
+            it->off = low - RUN_START(c,i);
+        } else {
+            it->pos = i+1;
+        }
+    }
+}
+
+/* Store the next member in 'value' and return 1, or return 0 when there
+ * are no more members. */
+int roaringNext(roaringIterator *it, int64_t *value) {
+    roaring *r = it->r;
+
+    while (it->ci < r->len) {
+        roaringContainer *c = r->containers[it->ci];
+        uint32_t low;
+
+        if (c->type == ROARING_ARRAY) {
+            if (it->pos < c->len) {
+                low = ARRAY(c)[it->pos++];
+                goto found;
+            }
+        } else if (c->type == ROARING_BITMAP) {
+            uint32_t j = it->pos >> 6;
+
+            if (j < ROARING_BITMAP_WORDS) {
+                uint64_t word = c->data[j] & (~0ULL << (it->pos & 63));
+                while (!word && ++j < ROARING_BITMAP_WORDS) word = c->data[j];
+                if (word) {
+                    low = j*64 + __builtin_ctzll(word);
+                    it->pos = low+1;
+                    goto found;
+                }
+            }
+        } else {
+            if (it->pos < c->len) {
+                low = RUN_START(c,it->pos) + it->off;
+                if (it->off == RUN_LEN(c,it->pos)) {
+                    it->pos++;
+                    it->off = 0;
+                } else {
+                    it->off++;
+                }
+                goto found;
+            }
+        }
+        it->ci++;
+        it->pos = 0;
+        it->off = 0;
+        continue;
+
+found:
+        *value = roaringValue(r->keys[it->ci],low);
+        return 1;
+    }
+    return 0;
+}
+
+/*-----------------------------------------------------------------------------
+ * Serialization
+ *
+ * <count> followed by <count> containers, each one as:
+ *
+ * <key><type><card><len><data>
+ *
+ * The count is 32 bit, the key 64 bit, the type 8 bit, card and len 32 bit.
+ * Data is 'len' 16 bit values for arrays, 'len' pairs of 16 bit start and
+ * length-1 for runs, and 1024 64 bit words for bitmaps. Everything is
+ * stored in little endian byte order.
+ *----------------------------------------------------------------------------*/
+
+/* Return the number of bytes needed to serialize the set. */
+size_t roaringBlobLen(roaring *r) {
+    size_t len = 4;
+    uint32_t j;
+
+    for (j = 0; j < r->len; j++) {
+        roaringContainer *c = r->containers[j];
+        len += ROARING_CONTAINER_HDR +
+            containerDataBytes(c->type,c->len);
+    }
+    return len;
+}
+
+/* Serialize the set into 'buf', that must be roaringBlobLen() bytes. */
+void roaringSerialize(roaring *r, unsigned char *buf) {
+    uint32_t j, k, v32;
+    uint64_t v64;
+    uint16_t v16;
+
+    v32 = intrev32ifbe(r->len);
+    memcpy(buf,&v32,4); buf += 4;
+    for (j = 0; j < r->len; j++) {
+        roaringContainer *c = r->containers[j];
+        uint32_t items;
+
+        v64 = intrev64ifbe(r->keys[j]);
+        memcpy(buf,&v64,8); buf += 8;
+        *buf++ = c->type;
+        v32 = intrev32ifbe(c->card);
+        memcpy(buf,&v32,4); buf += 4;
+        v32 = intrev32ifbe(c->len);
+        memcpy(buf,&v32,4); buf += 4;
+        if (c->type == ROARING_BITMAP) {
+            for (k = 0; k < ROARING_BITMAP_WORDS; k++) {
+                v64 = intrev64ifbe(c->data[k]);
+                memcpy(buf,&v64,8); buf += 8;
+            }
+        } else {
+            items = (c->type == ROARING_ARRAY) ? c->len : c->len*2;
+            for (k = 0; k < items; k++) {
+                v16 = intrev16ifbe(((uint16_t*)c->data)[k]);
+                memcpy(buf,&v16,2); buf += 2;
+            }
+        }
+    }
+}
+
+/* Load a set serialized by roaringSerialize(). The blob is fully validated,
+ * so that a corrupted one can't create a set breaking the invariants the
+ * rest of the code relies on: NULL is returned in that case. */
+roaring *roaringDeserialize(const unsigned char *buf, size_t len) {
+    const unsigned char *p = buf, *end = buf+len;
+    roaring *r = roaringNew();
+    uint32_t count, j, k;
+
+    if (len < 4) goto err;
+    memcpy(&count,p,4); p += 4;
+    count = intrev32ifbe(count);
+    if ((size_t)count > (size_t)(end-p)/ROARING_CONTAINER_HDR) goto err;
+    if (count) roaringResize(r,count);
+
+    for (j = 0; j < count; j++) {
+        uint64_t key;
+        uint32_t card, clen, items, sum = 0;
+        uint8_t type;
+        roaringContainer *c;
+
+        if ((size_t)(end-p) < ROARING_CONTAINER_HDR) goto err;
+        memcpy(&key,p,8); p += 8;
+        key = intrev64ifbe(key);
+        type = *p++;
+        memcpy(&card,p,4); p += 4;
+        card = intrev32ifbe(card);
+        memcpy(&clen,p,4); p += 4;
+        clen = intrev32ifbe(clen);
+
+        if (key >> 48 || (j && key <= r->keys[j-1])) goto err;
+        if (card == 0 || card > 65536) goto err;
+        if (type == ROARING_ARRAY) {
+            if (clen != card || clen > ROARING_ARRAY_MAX) goto err;
+        } else if (type == ROARING_RUN) {
+            if (clen == 0 || clen > 32768) goto err;
+        } else if (type != ROARING_BITMAP) {
+            goto err;
+        }
+        if ((size_t)(end-p) < containerDataBytes(type,clen)) goto err;
+
+        c = containerNew(type,clen);
+        r->keys[j] = key;
+        r->containers[j] = c;
+        r->len++;
+        c->card = card;
+        if (type == ROARING_BITMAP) {
+            for (k = 0; k < ROARING_BITMAP_WORDS; k++) {
+                memcpy(&c->data[k],p,8); p += 8;
+                c->data[k] = intrev64ifbe(c->data[k]);
+            }
+            if (bitmapCard(c->data) != card) goto err;
+            continue;
+        }
+
+        c->len = clen;
+        items = (type == ROARING_ARRAY) ? clen : clen*2;
+        for (k = 0; k < items; k++) {
+            uint16_t v;
+            memcpy(&v,p,2); p += 2;
+            ((uint16_t*)c->data)[k] = intrev16ifbe(v);
+        }
+        if (type == ROARING_ARRAY) {
+            for (k = 1; k < clen; k++)
+                if (ARRAY(c)[k] <= ARRAY(c)[k-1]) goto err;
+        } else {
+            for (k = 0; k < clen; k++) {
+                if (RUN_END(c,k) > 65535) goto err;
+                /* Runs are sorted, and never overlap nor touch. */
+                if (k && RUN_START(c,k) <= RUN_END(c,k-1)+1) goto err;
+                sum += RUN_LEN(c,k)+1;
+            }
+            if (sum != card) goto err;
+        }
+    }
+    if (p != end) goto err;
+    for (j = 0; j < r->len; j++) r->card += r->containers[j]->card;
+    return r;
+
+err:
+    roaringFree(r);
+    return NULL;
+}
+
+#ifdef REDIS_TEST
+#include <sys/time.h>
+#include <time.h>
+#include "intset.h"
+
+static long long roaringTestUsec(void) {
+    struct timeval tv;
+    gettimeofday(&tv,NULL);
+    return (((long long)tv.tv_sec)*1000000)+tv.tv_usec;
+}
+
+static void roaringTestAssert(int cond, char *what) {
+    if (!cond) {
+        printf("ERROR: %s\n", what);
+        exit(1);
+    }
+}
+
+/* Random value of one of the shapes the containers are chosen for: dense
+ * or sparse values in a few containers, long runs, or any 64 bit value. */
+static int64_t roaringTestRandomValue(int shape) {
+    switch(shape) {
+    case 0: return rand() % 300000 - 100000;
+    case 1: return (int64_t)(rand() % 8) * 65536 + rand() % 100;
+    case 2: return (rand() % 2 ? INT64_MIN : INT64_MAX-100000) +
+                   rand() % 100000;
+    default: return ((int64_t)rand() << 33) ^ ((int64_t)rand() << 2) ^ rand();
+    }
+}
+
+/* Check 'r' against the 'is' reference: same cardinality, same members in
+ * the same order, and the same containers after a serialization round
+ * trip. */
+static void roaringTestCheck(roaring *r, intset *is) {
+    roaringIterator it;
+    int64_t v, ref;
+    uint32_t pos = 0;
+    size_t len;
+    unsigned char *blob;
+    roaring *copy;
+
+    roaringTestAssert(roaringCard(r) == intsetLen(is), "cardinality");
+    roaringInitIterator(&it,r);
+    while (roaringNext(&it,&v)) {
+        roaringTestAssert(intsetGet(is,pos++,&ref) && ref == v, "iteration");
+        roaringTestAssert(roaringContains(r,v), "contains");
+    }
+    roaringTestAssert(pos == intsetLen(is), "iteration length");
+
+    len = roaringBlobLen(r);
+    blob = zmalloc(len);
+    roaringSerialize(r,blob);
+    copy = roaringDeserialize(blob,len);
+    roaringTestAssert(copy != NULL, "deserialize");
+    roaringTestAssert(roaringCard(copy) == roaringCard(r), "copy card");
+    roaringTestAssert(roaringAndCard(copy,r) == roaringCard(r), "copy");
+    /* A truncated blob must be rejected. */
+    roaringTestAssert(roaringDeserialize(blob,len-1) == NULL, "truncated");
+    roaringFree(copy);
+    zfree(blob);
+}
+
+/* Fill a set and its intset reference with 'count' values of 'shape'. */
+static roaring *roaringTestCreate(int shape, int count, intset **is) {
+    roaring *r = roaringNew();
+    int j;
+
+    *is = intsetNew();
+    for (j = 0; j < count; j++) {
+        int64_t v = roaringTestRandomValue(shape);
+        uint8_t success;
+        *is = intsetAdd(*is,v,&success);
+        roaringTestAssert(roaringAdd(r,v) == success, "add");
+    }
+    return r;
+}
+
+int roaringTest(int argc, char *argv[]) {
+    int j, shape, iter;
+
+    ((void) argc);
+    ((void) argv);
+
+    srand(time(NULL));
+
+    printf("Add, remove, contains against an intset: ");
+    for (iter = 0; iter < 100; iter++) {
+        intset *is;
+        shape = iter % 4;
+        roaring *r = roaringTestCreate(shape,rand() % 20000,&is);
+
+        roaringTestCheck(r,is);
+        for (j = 0; j < 10000; j++) {
+            int64_t v = roaringTestRandomValue(shape);
+            int success;
+
+            is = intsetRemove(is,v,&success);
+            roaringTestAssert(roaringRemove(r,v) == success, "remove");
+            roaringTestAssert(!roaringContains(r,v), "removed");
+        }
+        roaringTestCheck(r,is);
+        roaringOptimize(r);
+        roaringTestCheck(r,is);
+        roaringFree(r);
+        zfree(is);
+    }
+    printf("OK\n");
+
+    printf("Runs: ");
+    {
+        roaring *r = roaringNew();
+        intset *is = intsetNew();
+
+        /* Consecutive values, then holes punched in the runs and filled
+         * again, exercising run splits and joins. */
+        for (j = 0; j < 200000; j++) {
+            roaringAdd(r,j-50000);
+            is = intsetAdd(is,j-50000,NULL);
+        }
+        roaringOptimize(r);
+        roaringTestAssert(roaringBlobLen(r) < 200, "runs are compact");
+        for (j = 0; j < 20000; j++) {
+            int64_t v = rand() % 200000 - 50000;
+            if (rand() % 2) {
+                roaringRemove(r,v);
+                is = intsetRemove(is,v,NULL);
+            } else {
+                roaringAdd(r,v);
+                is = intsetAdd(is,v,NULL);
+            }
+        }
+        roaringTestCheck(r,is);
+        roaringFree(r);
+        zfree(is);
+    }
+    printf("OK\n");
+
+    printf("Seek: ");
+    for (iter = 0; iter < 1000; iter++) {
+        intset *is;
+        shape = iter % 4;
+        roaring *r = roaringTestCreate(shape,rand() % 2000,&is);
+        roaringIterator it;
+        int64_t from = roaringTestRandomValue(shape), v, ref;
+        uint32_t pos = 0;
+
+        roaringOptimize(r);
+        while (intsetGet(is,pos,&ref) && ref < from) pos++;
+        roaringInitIterator(&it,r);
+        roaringIteratorSeek(&it,from);
+        while (roaringNext(&it,&v)) {
+            roaringTestAssert(intsetGet(is,pos++,&ref) && ref == v, "seek");
+        }
+        roaringTestAssert(pos == intsetLen(is), "seek end");
+        roaringFree(r);
+        zfree(is);
+    }
+    printf("OK\n");
+
+    printf("AND, OR, ANDNOT against an intset: ");
+    for (iter = 0; iter < 400; iter++) {
+        intset *isa, *isb, *ref;
+        roaring *a, *b, *res;
+        int64_t v;
+        shape = iter % 4;
+
+        a = roaringTestCreate(shape,rand() % 20000,&isa);
+        b = roaringTestCreate(shape,rand() % 20000,&isb);
+        if (rand() % 2) roaringOptimize(a);
+        if (rand() % 2) roaringOptimize(b);
+
+        ref = intsetNew();
+        for (j = 0; intsetGet(isa,j,&v); j++)
+            if (intsetFind(isb,v)) ref = intsetAdd(ref,v,NULL);
+        res = roaringDup(a);
+        roaringAnd(res,b);
+        roaringTestCheck(res,ref);
+        roaringTestAssert(roaringAndCard(a,b) == intsetLen(ref), "andcard");
+        roaringFree(res);
+        zfree(ref);
+
+        ref = intsetNew();
+        for (j = 0; intsetGet(isa,j,&v); j++) ref = intsetAdd(ref,v,NULL);
+        for (j = 0; intsetGet(isb,j,&v); j++) ref = intsetAdd(ref,v,NULL);
+        res = roaringDup(a);
+        roaringOr(res,b);
+        roaringTestCheck(res,ref);
+        roaringFree(res);
+        zfree(ref);
+
+        ref = intsetNew();
+        for (j = 0; intsetGet(isa,j,&v); j++)
+            if (!intsetFind(isb,v)) ref = intsetAdd(ref,v,NULL);
+        res = roaringDup(a);
+        roaringAndNot(res,b);
+        roaringTestCheck(res,ref);
+        roaringFree(res);
+        zfree(ref);
+
+        roaringFree(a);
+        roaringFree(b);
+        zfree(isa);
+        zfree(isb);
+    }
+    printf("OK\n");
+
+    printf("Random members: ");
+    {
+        roaring *r = roaringNew();
+        int hits[4] = {0,0,0,0};
+
+        /* One member in a container of its own, and three in a container
+         * with thousands of other values: all must be equally likely. */
+        roaringAdd(r,-1000000);
+        for (j = 0; j < 3; j++) roaringAdd(r,j);
+        for (j = 0; j < 40000; j++) {
+            int64_t v = roaringRandom(r);
+            roaringTestAssert(roaringContains(r,v), "random member");
+            hits[v == -1000000 ? 3 : v]++;
+        }
+        for (j = 0; j < 4; j++)
+            roaringTestAssert(hits[j] > 9000 && hits[j] < 11000, "uniform");
+        roaringFree(r);
+    }
+    printf("OK\n");
+
+    printf("Corrupted blobs: ");
+    for (iter = 0; iter < 1000; iter++) {
+        intset *is;
+        roaring *r = roaringTestCreate(iter % 4,1+rand() % 5000,&is), *copy;
+        size_t len = roaringBlobLen(r);
+        unsigned char *blob = zmalloc(len);
+
+        roaringOptimize(r);
+        len = roaringBlobLen(r);
+        roaringSerialize(r,blob);
+        blob[rand() % len] ^= 1 << (rand() % 8);
+        /* The blob may still be valid, but a set is never created out
+         * of an inconsistent one. */
+        if ((copy = roaringDeserialize(blob,len)) != NULL) {
+            roaringIterator it;
+            int64_t v, prev = 0;
+            uint64_t count = 0;
+
+            roaringInitIterator(&it,copy);
+            while (roaringNext(&it,&v)) {
+                roaringTestAssert(count == 0 || v > prev, "sorted");
+                roaringTestAssert(roaringContains(copy,v), "contains");
+                prev = v;
+                count++;
+            }
+            roaringTestAssert(count == roaringCard(copy), "card");
+            roaringFree(copy);
+        }
+        zfree(blob);
+        roaringFree(r);
+        zfree(is);
+    }
+    printf("OK\n");
+
+    printf("Memory usage of 1M values:\n");
+    {
+        char *names[] = {"sequential IDs", "IDs below 10M", "IDs below 100M",
+                         "64 bit values"};
+
+        for (shape = 0; shape < 4; shape++) {
+            size_t before = zmalloc_used_memory();
+            roaring *r = roaringNew();
+
+            for (j = 0; j < 1000000; j++) {
+                int64_t v;
+                switch(shape) {
+                case 0: v = j; break;
+                case 1: v = rand() % 10000000; break;
+                case 2: v = rand() % 100000000; break;
+                default: v = ((int64_t)rand() << 33) ^ ((int64_t)rand() << 2);
+                }
+                roaringAdd(r,v);
+            }
+            roaringOptimize(r);
+            printf("  %-16s %.2f bytes per value, %u containers\n",
+                names[shape],
+                (double)(zmalloc_used_memory()-before)/roaringCard(r),
+                r->len);
+            roaringFree(r);
+        }
+    }
+
+    printf("Set operations on 1M values:\n");
+    {
+        roaring *a = roaringNew(), *b = roaringNew(), *res;
+        long long start;
+
+        for (j = 0; j < 1000000; j++) {
+            roaringAdd(a,rand() % 10000000);
+            roaringAdd(b,rand() % 10000000);
+        }
+
+        start = roaringTestUsec();
+        res = roaringDup(a);
+        roaringAnd(res,b);
+        printf("  AND     %lld usec (%llu values)\n",
+            roaringTestUsec()-start, (unsigned long long)roaringCard(res));
+        roaringFree(res);
+
+        start = roaringTestUsec();
+        printf("  ANDCARD %llu values",
+            (unsigned long long)roaringAndCard(a,b));
+        printf(" %lld usec\n", roaringTestUsec()-start);
+
+        start = roaringTestUsec();
+        res = roaringDup(a);
+        roaringOr(res,b);
+        printf("  OR      %lld usec (%llu values)\n",
+            roaringTestUsec()-start, (unsigned long long)roaringCard(res));
+        roaringFree(res);
+
+        start = roaringTestUsec();
+        res = roaringDup(a);
+        roaringAndNot(res,b);
+        printf("  ANDNOT  %lld usec (%llu values)\n",
+            roaringTestUsec()-start, (unsigned long long)roaringCard(res));
+        roaringFree(res);
+
+        roaringFree(a);
+        roaringFree(b);
+    }
+    return 0;
+}
+#endif
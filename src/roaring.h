@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __ROARING_H
+#define __ROARING_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Container types. */
+#define ROARING_ARRAY 1     /* Sorted array of 16 bit values. */
+#define ROARING_BITMAP 2    /* 65536 bits bitmap. */
+#define ROARING_RUN 3       /* Sorted array of {start,length-1} runs. */
+
+/* An array container never holds more than this many values: past it a
+ * bitmap, 8k whatever the cardinality, is smaller. */
+#define ROARING_ARRAY_MAX 4096
+#define ROARING_BITMAP_WORDS 1024
+
+/* All the values of a roaring set sharing the same high 48 bits. The low
+ * 16 bits are stored in 'data' according to 'type'. */
+typedef struct roaringContainer {
+    uint8_t type;
+    uint32_t card;      /* Number of values, 1 to 65536. */
+    uint32_t len;       /* Values of an array, runs of a run container. */
+    uint32_t alloc;     /* Values or runs 'data' has room for. */
+    uint64_t data[];
+} roaringContainer;
+
+/* Set of 64 bit signed integers. Every value is split into a key, its high
+ * 48 bits, and the low 16 bits stored in the container of that key. Keys are
+ * stored with the sign bit flipped, so that their unsigned order is the
+ * order of the values. */
+typedef struct roaring {
+    uint64_t card;      /* Number of values. */
+    uint32_t len;       /* Number of containers. */
+    uint32_t alloc;
+    uint64_t *keys;
+    roaringContainer **containers;
+} roaring;
+
+typedef struct roaringIterator {
+    roaring *r;
+    uint32_t ci;        /* Current container. */
+    uint32_t pos;       /* Array index, run index or bit number. */
+    uint32_t off;       /* Offset inside the current run. */
+} roaringIterator;
+
+roaring *roaringNew(void);
+void roaringFree(roaring *r);
+roaring *roaringDup(roaring *r);
+int roaringAdd(roaring *r, int64_t value);
+int roaringRemove(roaring *r, int64_t value);
+int roaringContains(roaring *r, int64_t value);
+uint64_t roaringCard(roaring *r);
+int64_t roaringRandom(roaring *r);
+void roaringOptimize(roaring *r);
+void roaringAnd(roaring *dst, roaring *src);
+void roaringOr(roaring *dst, roaring *src);
+void roaringAndNot(roaring *dst, roaring *src);
+uint64_t roaringAndCard(roaring *a, roaring *b);
+void roaringInitIterator(roaringIterator *it, roaring *r);
+void roaringIteratorSeek(roaringIterator *it, int64_t value);
+int roaringNext(roaringIterator *it, int64_t *value);
+size_t roaringBlobLen(roaring *r);
+void roaringSerialize(roaring *r, unsigned char *buf);
+roaring *roaringDeserialize(const unsigned char *buf, size_t len);
+
+#ifdef REDIS_TEST
+int roaringTest(int argc, char *argv[]);
+#endif
+
+#endif /* __ROARING_H */
@@ -238,6 +238,57 @@ sds sdsempty(void) {
     return sdsnewlen("",0);
 }
 
+/* Return the bytes needed by sdsNewEmbedded() in order to store a string
+ * of 'initlen' bytes, header and null term included. */
+size_t sdsEmbedSize(size_t initlen) {
+    char type = sdsReqType(initlen);
+
+    if (type == SDS_TYPE_5 && initlen == 0) type = SDS_TYPE_8;
+    return sdsHdrSize(type)+initlen+1;
+}
+
+/* Like sdsnewlen(), but the string is created inside the memory pointed by
+ * 'buf', that must be at least sdsEmbedSize(initlen) bytes, instead of
+ * being allocated. This is useful to store a string inside the allocation
+ * of some other structure. The string is valid as long as 'buf' is valid,
+ * and can't be freed nor resized. */
+sds sdsNewEmbedded(void *buf, const void *init, size_t initlen) {
+    char type = sdsReqType(initlen);
+    sds s;
+
+    if (type == SDS_TYPE_5 && initlen == 0) type = SDS_TYPE_8;
+    s = (char*)buf+sdsHdrSize(type);
+    switch(type) {
+        case SDS_TYPE_5:
+            s[-1] = type | (initlen << SDS_TYPE_BITS);
+            break;
+        case SDS_TYPE_8: {
+            SDS_HDR_VAR(8,s);
+            sh->len = sh->alloc = initlen;
+            break;
+        }
+        case SDS_TYPE_16: {
+            SDS_HDR_VAR(16,s);
+            sh->len = sh->alloc = initlen;
+            break;
+        }
+        case SDS_TYPE_32: {
+            SDS_HDR_VAR(32,s);
+            sh->len = sh->alloc = initlen;
+            break;
+        }
+        case SDS_TYPE_64: {
+            SDS_HDR_VAR(64,s);
+            sh->len = sh->alloc = initlen;
+            break;
+        }
+    }
+    if (type != SDS_TYPE_5) s[-1] = type;
+    if (initlen && init) memcpy(s, init, initlen);
+    s[initlen] = '\0';
+    return s;
+}
+
 /*  
     从一个以空结尾的C字符串开始创建一个新的sds字符串
 */
@@ -1505,13 +1556,15 @@ void *sds_malloc(size_t size) { return s_malloc(size); }
 void *sds_realloc(void *ptr, size_t size) { return s_realloc(ptr,size); }
 void sds_free(void *ptr) { s_free(ptr); }
 
-#if defined(SDS_TEST_MAIN)
+#if defined(SDS_TEST_MAIN) || defined(REDIS_TEST)
 #include <stdio.h>
 #include "testhelp.h"
 #include "limits.h"
 
 #define UNUSED(x) (void)(x)
-int sdsTest(void) {
+int sdsTest(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
     {
         sds x = sdsnew("foo"), y;
 
@@ -1678,6 +1731,6 @@ int sdsTest(void) {
 
 #ifdef SDS_TEST_MAIN
 int main(void) {
-    return sdsTest();
+    return sdsTest(0,NULL);
 }
 #endif
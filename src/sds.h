@@ -304,6 +304,8 @@ sds sdsnewlen(const void *init, size_t initlen);
 sds sdsnew(const char *init);
 sds sdsempty(void);
 sds sdsdup(const sds s);
+size_t sdsEmbedSize(size_t initlen);
+sds sdsNewEmbedded(void *buf, const void *init, size_t initlen);
 void sdsfree(sds s);
 sds sdsgrowzero(sds s, size_t len);
 sds sdscatlen(sds s, const void *t, size_t len);
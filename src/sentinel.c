@@ -448,7 +448,9 @@ dictType instancesDictType = {
     NULL,                      /* val dup */
     dictSdsKeyCompare,         /* key compare */
     NULL,                      /* key destructor */
-    dictInstancesValDestructor /* val destructor */
+    dictInstancesValDestructor, /* val destructor */
+    NULL,                      /* key embed size */
+    NULL                       /* key embed */
 };
 
 /* Instance runid (sds) -> votes (long casted to void*)
@@ -461,7 +463,9 @@ dictType leaderVotesDictType = {
     NULL,                      /* val dup */
     dictSdsKeyCompare,         /* key compare */
     NULL,                      /* key destructor */
-    NULL                       /* val destructor */
+    NULL,                      /* val destructor */
+    NULL,                      /* key embed size */
+    NULL                       /* key embed */
 };
 
 /* =========================== Initialization =============================== */
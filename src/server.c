@@ -32,6 +32,7 @@
 #include "slowlog.h"
 #include "bio.h"
 #include "latency.h"
+#include "fdict.h"
 
 #include <time.h>
 #include <signal.h>
@@ -175,6 +176,7 @@ struct redisCommand redisCommandTable[] = {
     {"append",appendCommand,3,"wm",0,NULL,1,1,1,0,0}, //追加字符串 3个参数 写命令 会增加内存
     {"strlen",strlenCommand,2,"rF",0,NULL,1,1,1,0,0}, //读命令 2个参数
     {"del",delCommand,-2,"w",0,NULL,1,-1,1,0,0}, //删除命令 大于等于2个参数
+    {"unlink",unlinkCommand,-2,"wF",0,NULL,1,-1,1,0,0}, //后台释放值的删除命令
     {"exists",existsCommand,-2,"rF",0,NULL,1,-1,1,0,0}, //是否存在命令 
     {"setbit",setbitCommand,4,"wm",0,NULL,1,1,1,0,0}, //‌用于在Redis中设置或清除指定偏移量上的位(bit)
     {"getbit",getbitCommand,3,"rF",0,NULL,1,1,1,0,0}, 
@@ -211,6 +213,7 @@ struct redisCommand redisCommandTable[] = {
     {"srandmember",srandmemberCommand,-2,"rR",0,NULL,1,1,1,0,0},//用于从集合（set）或有序集合（sorted set）中随机返回一个或多个不重复的成员。与 SPOP 命令不同的是，SRANDMEMBER 不会从集合中移除返回的成员
     {"sinter",sinterCommand,-2,"rS",0,NULL,1,-1,1,0,0},//用于返回两个或多个集合的交集
     {"sinterstore",sinterstoreCommand,-3,"wm",0,NULL,1,-1,1,0,0},//用于将多个集合的交集存储到指定的集合中
+    {"sintercard",sintercardCommand,-3,"r",0,sintercardGetKeys,0,0,0,0,0},
     {"sunion",sunionCommand,-2,"rS",0,NULL,1,-1,1,0,0},//它返回所有给定集合的并集
     {"sunionstore",sunionstoreCommand,-3,"wm",0,NULL,1,-1,1,0,0},//用于将给定集合的并集存储在指定的集合中
     {"sdiff",sdiffCommand,-2,"rS",0,NULL,1,-1,1,0,0}, //返回第一个集合中存在但在其他集合中不存在的元素。
@@ -291,14 +294,15 @@ struct redisCommand redisCommandTable[] = {
     {"sync",syncCommand,1,"ars",0,NULL,0,0,0,0,0},
     {"psync",syncCommand,3,"ars",0,NULL,0,0,0,0,0},
     {"replconf",replconfCommand,-1,"aslt",0,NULL,0,0,0,0,0}, //REPLCONF 是 Redis 中的一个命令，主要用于配置和管理 Redis 的复制（replication）功能
-    {"flushdb",flushdbCommand,1,"w",0,NULL,0,0,0,0,0},
-    {"flushall",flushallCommand,1,"w",0,NULL,0,0,0,0,0},
+    {"flushdb",flushdbCommand,-1,"w",0,NULL,0,0,0,0,0},
+    {"flushall",flushallCommand,-1,"w",0,NULL,0,0,0,0,0},
     {"sort",sortCommand,-2,"wm",0,sortGetKeys,1,1,1,0,0},
     {"info",infoCommand,-1,"lt",0,NULL,0,0,0,0,0},
     {"monitor",monitorCommand,1,"as",0,NULL,0,0,0,0,0},
     {"ttl",ttlCommand,2,"rF",0,NULL,1,1,1,0,0},
     {"touch",touchCommand,-2,"rF",0,NULL,1,1,1,0,0}, //用于修改指定键的最后访问时间
     {"pttl",pttlCommand,2,"rF",0,NULL,1,1,1,0,0},
+    {"expiring",expiringCommand,-2,"rR",0,NULL,0,0,0,0,0},
     {"persist",persistCommand,2,"wF",0,NULL,1,1,1,0,0},//移除给定key的过期时间，使得该key永不过期
     {"slaveof",slaveofCommand,3,"ast",0,NULL,0,0,0,0,0},//使用 SLAVEOF 命令，可以将一个 Redis 实例设置为另一个实例的从节点。从节点将复制主节点的所有数据，并保持与主节点数据的同步
     {"role",roleCommand,1,"lst",0,NULL,0,0,0,0,0},
@@ -355,8 +359,8 @@ struct redisCommand redisCommandTable[] = {
     {"latency",latencyCommand,-2,"aslt",0,NULL,0,0,0,0,0} //通过 latency 命令，用户可以查看 Redis 在执行命令时的延迟情况
 };
 
-/*函数声明 返回指向evictionPoolEntry结构体的指针*/
-struct evictionPoolEntry *evictionPoolAlloc(void);
+/*函数声明 创建共享的淘汰池*/
+void evictionPoolAlloc(void);
 
 /*============================ Utility functions ============================ */
 
@@ -595,6 +599,16 @@ void dictSdsDestructor(void *privdata, void *val)
     sdsfree(val);
 }
 
+/* Keys of dbEmbeddedKeysDictType are copied inside the dictEntry allocation
+ * as a new sds string, see sdsNewEmbedded(). */
+size_t dictSdsEmbedSize(const void *key) {
+    return sdsEmbedSize(sdslen((sds)key));
+}
+
+void *dictSdsEmbed(void *buf, const void *key) {
+    return sdsNewEmbedded(buf,key,sdslen((sds)key));
+}
+
 int dictObjKeyCompare(void *privdata, const void *key1,
         const void *key2)
 {
@@ -629,7 +643,6 @@ int dictEncObjKeyCompare(void *privdata, const void *key1,
     o1 = getDecodedObject(o1);
     o2 = getDecodedObject(o2);
     cmp = dictSdsKeyCompare(privdata,o1->ptr,o2->ptr);
-    serverLog(LL_WARNING,"比较结果%d",cmp);
     //有可能只是减少引用计数而已
     decrRefCount(o1);
     decrRefCount(o2);
@@ -668,7 +681,9 @@ dictType setDictType = {
     NULL,                      /* val dup */
     dictEncObjKeyCompare,      /* key compare */
     dictObjectDestructor, /* key destructor */
-    NULL                       /* val destructor */
+    NULL,                      /* val destructor */
+    NULL,                      /* key embed size */
+    NULL                       /* key embed */
 };
 
 /*除了哈希表之外，还使用了跳跃列表*/
@@ -679,7 +694,9 @@ dictType zsetDictType = {
     NULL,                      /* val dup */
     dictEncObjKeyCompare,      /* key compare */
     dictObjectDestructor, /* key destructor */
-    NULL                       /* val destructor */
+    NULL,                      /* val destructor */
+    NULL,                      /* key embed size */
+    NULL                       /* key embed */
 };
 
 /*键是sds字符串，值是redis对象*/
@@ -690,7 +707,23 @@ dictType dbDictType = {
     NULL,                       /* val dup */
     dictSdsKeyCompare,          /* key compare */
     dictSdsDestructor,          /* key destructor */
-    dictObjectDestructor   /* val destructor */
+    dictObjectDestructor,  /* val destructor */
+    NULL,                       /* key embed size */
+    NULL                        /* key embed */
+};
+
+/* Db->dict when "embedded-keys" is enabled: like dbDictType but the key sds
+ * lives in the same allocation of the dictEntry, saving a pointer chase on
+ * lookups and the allocator overhead of a separate string. */
+dictType dbEmbeddedKeysDictType = {
+    dictSdsHash,                /* hash function */
+    NULL,                       /* key dup */
+    NULL,                       /* val dup */
+    dictSdsKeyCompare,          /* key compare */
+    NULL,                       /* key destructor */
+    dictObjectDestructor,       /* val destructor */
+    dictSdsEmbedSize,           /* key embed size */
+    dictSdsEmbed                /* key embed */
 };
 
 /* server.lua_scripts sha (as sds string) -> scripts (as robj) cache. */
@@ -700,7 +733,9 @@ dictType shaScriptObjectDictType = {
     NULL,                       /* val dup */
     dictSdsKeyCaseCompare,      /* key compare */
     dictSdsDestructor,          /* key destructor */
-    dictObjectDestructor   /* val destructor */
+    dictObjectDestructor,  /* val destructor */
+    NULL,                       /* key embed size */
+    NULL                        /* key embed */
 };
 
 /* Db->expires */
@@ -710,7 +745,21 @@ dictType keyptrDictType = {
     NULL,                      /* val dup */
     dictSdsKeyCompare,         /* key compare */
     NULL,                      /* key destructor */
-    NULL                       /* val destructor */
+    NULL,                      /* val destructor */
+    NULL,                      /* key embed size */
+    NULL                       /* key embed */
+};
+
+/* Keys handled by the forkless BGSAVE in progress, see snapshot.c. */
+dictType snapshotKeysDictType = {
+    dictSdsHash,               /* hash function */
+    NULL,                      /* key dup */
+    NULL,                      /* val dup */
+    dictSdsKeyCompare,         /* key compare */
+    dictSdsDestructor,         /* key destructor */
+    NULL,                      /* val destructor */
+    NULL,                      /* key embed size */
+    NULL                       /* key embed */
 };
 
 /*命令列表 ，*/
@@ -721,7 +770,9 @@ dictType commandTableDictType = {
     NULL,                      /* val dup */
     dictSdsKeyCaseCompare,     /* key compare */
     dictSdsDestructor,         /* key destructor */
-    NULL                       /* 值析构函数 val destructor */
+    NULL,                      /* 值析构函数 val destructor */
+    NULL,                      /* key embed size */
+    NULL                       /* key embed */
 };
 
 /* Hash type hash table (note that small hashes are represented with ziplists) */
@@ -731,7 +782,9 @@ dictType hashDictType = {
     NULL,                       /* val dup */
     dictEncObjKeyCompare,       /* key compare */
     dictObjectDestructor,  /* key destructor */
-    dictObjectDestructor   /* val destructor */
+    dictObjectDestructor,  /* val destructor */
+    NULL,                       /* key embed size */
+    NULL                        /* key embed */
 };
 
 /*
@@ -747,7 +800,9 @@ dictType keylistDictType = {
     NULL,                       /* val dup */
     dictObjKeyCompare,          /* key compare */
     dictObjectDestructor,  /* key destructor */
-    dictListDestructor          /* val destructor */
+    dictListDestructor,         /* val destructor */
+    NULL,                       /* key embed size */
+    NULL                        /* key embed */
 };
 
 /* Cluster nodes hash table, mapping nodes addresses 1.2.3.4:6379 to
@@ -758,7 +813,9 @@ dictType clusterNodesDictType = {
     NULL,                       /* val dup */
     dictSdsKeyCompare,          /* key compare */
     dictSdsDestructor,          /* key destructor */
-    NULL                        /* val destructor */
+    NULL,                       /* val destructor */
+    NULL,                       /* key embed size */
+    NULL                        /* key embed */
 };
 
 /* Cluster re-addition blacklist. This maps node IDs to the time
@@ -770,7 +827,9 @@ dictType clusterNodesBlackListDictType = {
     NULL,                       /* val dup */
     dictSdsKeyCaseCompare,      /* key compare */
     dictSdsDestructor,          /* key destructor */
-    NULL                        /* val destructor */
+    NULL,                       /* val destructor */
+    NULL,                       /* key embed size */
+    NULL                        /* key embed */
 };
 
 /* Migrate cache dict type. */
@@ -780,7 +839,9 @@ dictType migrateCacheDictType = {
     NULL,                       /* val dup */
     dictSdsKeyCompare,          /* key compare */
     dictSdsDestructor,          /* key destructor */
-    NULL                        /* val destructor */
+    NULL,                       /* val destructor */
+    NULL,                       /* key embed size */
+    NULL                        /* key embed */
 };
 
 /* Replication cached script dict (server.repl_scriptcache_dict).
@@ -792,7 +853,9 @@ dictType replScriptCacheDictType = {
     NULL,                       /* val dup */
     dictSdsKeyCaseCompare,      /* key compare */
     dictSdsDestructor,          /* key destructor */
-    NULL                        /* val destructor */
+    NULL,                       /* val destructor */
+    NULL,                       /* key embed size */
+    NULL                        /* key embed */
 };
 
 /**
@@ -826,6 +889,22 @@ void tryResizeHashTables(int dbid) {
         dictResize(server.db[dbid].expires);
 }
 
+/* Return the number of milliseconds to spend rehashing 'd' in a single
+ * cron call. One millisecond is used when the old table holds about one
+ * element per bucket, but the longer the chains of the old table, the slower
+ * every lookup is until the rehashing is done (this happens when the resize
+ * was delayed by a child process), so the budget grows with the load factor
+ * up to ACTIVE_REHASH_MAX_TIME_PERC of the cron period. */
+int activeRehashBudget(dict *d) {
+    long long maxms = (1000/server.hz)*ACTIVE_REHASH_MAX_TIME_PERC/100;
+    long long ms = d->ht[0].size ? d->ht[0].used/d->ht[0].size : 1;
+
+    if (maxms < 1) maxms = 1;
+    if (ms < 1) ms = 1;
+    if (ms > maxms) ms = maxms;
+    return ms;
+}
+
 /*
 我们的哈希表实现为我 从哈希表中写入/读取时执行增量的重新哈希
 但是，如果服务器空闲，哈希表将长时间使用两个表
@@ -843,13 +922,15 @@ void tryResizeHashTables(int dbid) {
 int incrementallyRehash(int dbid) {
     /* Keys dictionary */
     if (dictIsRehashing(server.db[dbid].dict)) {
-        dictRehashMilliseconds(server.db[dbid].dict,1);
-        return 1; /* already used our millisecond for this loop... */
+        dictRehashMilliseconds(server.db[dbid].dict,
+            activeRehashBudget(server.db[dbid].dict));
+        return 1; /* already used our time for this loop... */
     }
     /* Expires */
     if (dictIsRehashing(server.db[dbid].expires)) {
-        dictRehashMilliseconds(server.db[dbid].expires,1);
-        return 1; /* already used our millisecond for this loop... */
+        dictRehashMilliseconds(server.db[dbid].expires,
+            activeRehashBudget(server.db[dbid].expires));
+        return 1; /* already used our time for this loop... */
     }
     return 0;
 }
@@ -940,9 +1021,48 @@ int activeExpireCycleTryExpire(redisDb *db, dictEntry *de, long long now) {
  *
  * If type is ACTIVE_EXPIRE_CYCLE_SLOW, that normal expire cycle is
  * executed, where the time limit is a percentage of the REDIS_HZ period
- * as specified by the REDIS_EXPIRELOOKUPS_TIME_PERC define. */
+ * as specified by the REDIS_EXPIRELOOKUPS_TIME_PERC define.
+ *
+ * The keys sampled per loop, the time limits and the percentage of stale
+ * keys we tolerate before trying harder all scale with the configured
+ * active-expire-effort. Every DB keeps a running estimate of its ratio of
+ * stale keys: a fast cycle also starts when the estimate of the whole
+ * dataset is above the acceptable one, not only after a slow cycle
+ * reached its time limit. */
+
+/* Return the estimated ratio of logically expired keys that are still in
+ * memory, among all the keys with an expire, weighting the estimate of
+ * every DB by its number of keys with an expire. */
+double expireStaleRatio(void) {
+    unsigned long long total = 0;
+    double stale = 0;
+    int j;
+
+    for (j = 0; j < server.dbnum; j++) {
+        unsigned long num = dictSize(server.db[j].expires);
+
+        total += num;
+        stale += server.db[j].stale_ratio*num;
+    }
+    return total ? stale/total : 0;
+}
+
 //https://jiajunhuang.com/articles/2021_05_24-redis_source_code_4.md.html
 void activeExpireCycle(int type) {
+    /* Adjust the running parameters according to the configured expire
+     * effort. The default effort is 1, and the maximum configurable effort
+     * is 10. */
+    unsigned long
+    effort = server.active_expire_effort-1, /* Rescale from 0 to 9. */
+    config_keys_per_loop = ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP +
+                           ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP/4*effort,
+    config_cycle_fast_duration = ACTIVE_EXPIRE_CYCLE_FAST_DURATION +
+                                 ACTIVE_EXPIRE_CYCLE_FAST_DURATION/4*effort,
+    config_cycle_slow_time_perc = ACTIVE_EXPIRE_CYCLE_SLOW_TIME_PERC +
+                                  2*effort,
+    config_cycle_acceptable_stale = ACTIVE_EXPIRE_CYCLE_ACCEPTABLE_STALE-
+                                    effort;
+
     //https://jiajunhuang.com/articles/2021_05_24-redis_source_code_4.md.html
     /*此函数具有一些全局状态，以便在调用之间增量地继续工作*/
     /* This function has some global state in order to continue the work
@@ -954,7 +1074,8 @@ void activeExpireCycle(int type) {
     int j, iteration = 0;
     int dbs_per_call = CRON_DBS_PER_CALL; //16
     //开始时间 
-    long long start = ustime(), timelimit;
+    long long start = ustime(), timelimit, elapsed;
+    double stale_ratio;
 
     //通过 CLIENT PAUSE timeout 命令 暂停所有客户端的命令 
     /* 当客户端暂停时，数据集应该是静态的，不仅来自无法写入的客户端的POV，还来自过期和未执行的密钥驱逐*/
@@ -962,6 +1083,7 @@ void activeExpireCycle(int type) {
      * POV of clients not being able to write, but also from the POV of
      * expires and evictions of keys not being performed. */
      if (clientsArePaused()) return;
+    stale_ratio = expireStaleRatio();
 
     //类型为1也就是快速过期的时候才会进入
     if (type == ACTIVE_EXPIRE_CYCLE_FAST) {
@@ -969,13 +1091,16 @@ void activeExpireCycle(int type) {
         /*如果上一个周期没有因为时间限制退出 那就不开始*/
         //同样，不要在与快速循环总持续时间相同的时间段内重复快速循环
         /* Don't start a fast cycle if the previous cycle did not exited
-         * for time limt. Also don't repeat a fast cycle for the same period
+         * for time limt, unless the estimated percentage of stale keys is
+         * too high. Also don't repeat a fast cycle for the same period
          * as the fast cycle total duration itself. */
-        if (!timelimit_exit) return;
+        if (!timelimit_exit &&
+            stale_ratio*100 <= config_cycle_acceptable_stale) return;
 
         //ACTIVE_EXPIRE_CYCLE_FAST_DURATION = 1000
-        //开始时间 小于 最后一次时间+2秒 就返回 也就是2秒内又进入的话就返回
-        if (start < last_fast_cycle + ACTIVE_EXPIRE_CYCLE_FAST_DURATION*2) return;
+        //开始时间 小于 最后一次时间+2倍的快速周期时间 就返回
+        if (start < last_fast_cycle + (long long)config_cycle_fast_duration*2)
+            return;
         last_fast_cycle = start;
     }
 
@@ -992,7 +1117,8 @@ void activeExpireCycle(int type) {
      * 如果上次我们达到了时间限制，我们希望在这个迭代中扫描所有DB，因为在某些DB中有工作要做，我们不希望过期的键占用内存太长时间
      * */
     /*配置的数据库数量 大于16的话 如果 之前达到了时间限制退出的话 此次还是用配置的数据库数量来*/
-    if (dbs_per_call > server.dbnum || timelimit_exit)
+    if (dbs_per_call > server.dbnum || timelimit_exit ||
+        stale_ratio*100 > config_cycle_acceptable_stale)
         dbs_per_call = server.dbnum;//调用就是实际数据库数量 配置的数据库数量有可能小于16的
 
     /* We can use at max ACTIVE_EXPIRE_CYCLE_SLOW_TIME_PERC percentage of CPU time
@@ -1001,17 +1127,18 @@ void activeExpireCycle(int type) {
      * microseconds we can spend in this function. */
     /* ACTIVE_EXPIRE_CYCLE_SLOW_TIME_PERC =25 */
     /*  */
-    timelimit = 1000000*ACTIVE_EXPIRE_CYCLE_SLOW_TIME_PERC/server.hz/100;
+    timelimit = 1000000*config_cycle_slow_time_perc/server.hz/100;
     timelimit_exit = 0;
     if (timelimit <= 0) timelimit = 1;
 
     /*快速模式下 timelimit 直接为1000ms 也就是1秒*/
     if (type == ACTIVE_EXPIRE_CYCLE_FAST)
-        timelimit = ACTIVE_EXPIRE_CYCLE_FAST_DURATION; /* 1000ms  in microseconds. */
+        timelimit = config_cycle_fast_duration; /* in microseconds. */
 
     /*循环遍历 16个数据库 */
-    for (j = 0; j < dbs_per_call; j++) {
+    for (j = 0; j < dbs_per_call && timelimit_exit == 0; j++) {
         int expired;
+        unsigned long sampled;
 
         // current_db % server.dbnum 取余 比如 10%16 =10
         redisDb *db = server.db+(current_db % server.dbnum);
@@ -1036,6 +1163,7 @@ void activeExpireCycle(int type) {
             /* If there is nothing to expire try next DB ASAP. */
             if ((num = dictSize(db->expires)) == 0) {
                 db->avg_ttl = 0;
+                db->stale_ratio = 0;
                 break; //直接下一个循环
             }
             /* 第1个和第2个数据库大小的和 */
@@ -1048,7 +1176,7 @@ void activeExpireCycle(int type) {
              * keys is expensive, so stop here waiting for better times...
              * The dictionary will be resized asap. */
             if (num && slots > DICT_HT_INITIAL_SIZE &&
-                (num*100/slots < 1)) break;
+                (num*100/slots < 1) && db->expires_index == NULL) break;
 
             //对具有过期集的密钥中的随机密钥进行采样，检查过期的密钥
             /* The main collection cycle. Sample random keys among keys
@@ -1058,10 +1186,10 @@ void activeExpireCycle(int type) {
             ttl_samples = 0;
 
             //num为 expires字典中key的数量
-            //最多20个
-            //ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP = 20
-            if (num > ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP)
-                num = ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP;
+            //默认最多20个 随active-expire-effort增加
+            if (num > config_keys_per_loop)
+                num = config_keys_per_loop;
+            sampled = num;
 
             while (num--) {
                 dictEntry *de;
@@ -1069,7 +1197,19 @@ void activeExpireCycle(int type) {
 
                 /* https://zhuanlan.zhihu.com/p/419020079 */
                 /*从过期数据库里找随机key */
-                if ((de = dictGetRandomKey(db->expires)) == NULL) break;
+                if (db->expires_index) {
+                    /* With the expire index we take the key expiring
+                     * first, stopping at the first key not yet expired:
+                     * a key expiring exactly 'now' is not expired yet. */
+                    zskiplistNode *zn =
+                        db->expires_index->header->level[0].forward;
+
+                    if (zn == NULL || zn->score >= now) break;
+                    de = dictFind(db->expires,zn->obj->ptr);
+                    serverAssert(de != NULL);
+                } else if ((de = dictGetRandomKey(db->expires)) == NULL) {
+                    break;
+                }
                 //离当前还有多少时间
                 ttl = dictGetSignedIntegerVal(de)-now;
 
@@ -1096,6 +1236,20 @@ void activeExpireCycle(int type) {
                 db->avg_ttl = (db->avg_ttl/50)*49 + (avg_ttl/50);
             }
 
+            /* Update the estimate of stale keys of this database with the
+             * ratio of expired keys we found in the sample, with a weight
+             * of 5%. */
+            if (db->expires_index) {
+                /* With the expire index we know exactly how many keys
+                 * are still waiting to be expired. */
+                db->stale_ratio = dictSize(db->expires) ?
+                    (double)expireIndexCount(db,now)/dictSize(db->expires) :
+                    0;
+            } else {
+                db->stale_ratio = ((double)expired/sampled)*0.05 +
+                                  db->stale_ratio*0.95;
+            }
+
             /* We can't block forever here even if there are many keys to
              * expire. So after a given amount of milliseconds return to the
              * caller waiting for the other active expire cycle. */
@@ -1103,19 +1257,29 @@ void activeExpireCycle(int type) {
 
             //每16次迭代就检查一次
             if ((iteration & 0xf) == 0) { /* check once every 16 iterations. */
-                long long elapsed = ustime()-start;
+                elapsed = ustime()-start;
 
                 latencyAddSampleIfNeeded("expire-cycle",elapsed/1000);
 
 
-                if (elapsed > timelimit) timelimit_exit = 1;
+                if (elapsed > timelimit) {
+                    timelimit_exit = 1;
+                    server.stat_expired_time_cap_reached_count++;
+                    break;
+                }
             }
-            if (timelimit_exit) return;
-            /* We don't repeat the cycle if there are less than 25% of keys
-             * found expired in the current DB. */
-            /* 如果当前DB中发现的过期键数少于25%，则不重复此循环 */
-        } while (expired > ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP/4); 
+            /* We don't repeat the cycle if the percentage of keys found
+             * expired in the current DB is below the acceptable one. With
+             * the expire index we repeat it until all the keys that are
+             * due were expired. */
+            /* 如果当前DB中发现的过期键比例不超过可接受的比例，则不重复此循环 */
+        } while (db->expires_index ?
+                 db->stale_ratio > 0 :
+                 expired*100/sampled > config_cycle_acceptable_stale);
     }
+
+    elapsed = ustime()-start;
+    server.stat_expire_cycle_time_used += elapsed;
 }
 
 unsigned int getLRUClock(void) {
@@ -1223,10 +1387,33 @@ int clientsCronHandleTimeout(client *c, mstime_t now_ms) {
  *
  * The function always returns 0 as it never terminates the client. */
 int clientsCronResizeQueryBuffer(client *c) {
-    //sdsAllocSize获取总共分配的空间
-    size_t querybuf_size = sdsAllocSize(c->querybuf);
+    size_t querybuf_size;
     time_t idletime = server.unixtime - c->lastinteraction;
 
+    /* Already given back to the pool. */
+    if (c->querybuf == NULL) return 0;
+
+    //sdsAllocSize获取总共分配的空间
+    querybuf_size = sdsAllocSize(c->querybuf);
+
+    /*
+      空的查询缓冲区 在原本需要调整大小或者客户端空闲时 直接还给池 下次读取时再获取
+      master的查询缓冲区在复制相关的代码里一直会用到 所以不释放
+    */
+    /* An empty query buffer is given back to the pool, instead of being
+     * resized, when the client is idle or the buffer is too big for the
+     * latest peak: a new one is taken when the client sends something
+     * again. The master client is skipped since the replication code
+     * always expects its query buffer to exist. */
+    if (sdslen(c->querybuf) == 0 && !(c->flags & CLIENT_MASTER) &&
+        (idletime > 2 || (querybuf_size > PROTO_MBULK_BIG_ARG &&
+                          querybuf_size/(c->querybuf_peak+1) > 2)))
+    {
+        releaseClientQueryBuffer(c);
+        c->querybuf_peak = 0;
+        return 0;
+    }
+
     /*
         两个条件 会调整查询缓冲区
         1.查询缓冲区 > BIG_ARG 1024*32 ，也就是32kB 对于最近的峰值来说太大了 大于2倍
@@ -1253,6 +1440,18 @@ int clientsCronResizeQueryBuffer(client *c) {
     return 0;
 }
 
+/* The reply buffer of a client is only needed while there is something to
+ * send: give it back to the pool when the client is idle.
+ *
+ * The function always returns 0 as it never terminates the client. */
+int clientsCronReleaseReplyBuffer(client *c) {
+    time_t idletime = server.unixtime - c->lastinteraction;
+
+    if (c->buf && c->bufpos == 0 && idletime > 2)
+        releaseClientReplyBuffer(c);
+    return 0;
+}
+
 #define CLIENTS_CRON_MIN_ITERATIONS 5
 void clientsCron(void) {
 
@@ -1324,6 +1523,7 @@ void clientsCron(void) {
 
         /* 调整客户端查询缓冲区 */
         if (clientsCronResizeQueryBuffer(c)) continue;
+        if (clientsCronReleaseReplyBuffer(c)) continue;
     }
 }
 
@@ -1464,6 +1664,12 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
         //度量 写入网络的字节数
         trackInstantaneousMetric(STATS_METRIC_NET_OUTPUT,
                 server.stat_net_output_bytes);
+        //度量 淘汰键的数量
+        trackInstantaneousMetric(STATS_METRIC_EVICTIONS,
+                server.stat_evictedkeys);
+        //度量 过期周期使用的时间
+        trackInstantaneousMetric(STATS_METRIC_EXPIRE_CYCLE,
+                server.stat_expire_cycle_time_used);
     }
 
     /*
@@ -1546,19 +1752,42 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
     /* We need to do a few operations on clients asynchronously. */
     /*我们需要在客户端异步执行一些操作*/
     clientsCron();
+    run_with_period(1000) trimClientBuffersPool();
+
+    /* Stop the I/O threads if we don't have enough pending work. */
+    stopThreadedIOIfNeeded();
 
     /* Handle background operations on Redis databases. */
     /*Redis 还会在每次事件中断器运行的时候，执行一个为时一毫秒的 rehash 操作*/
     databasesCron();
 
+    /* Continue the eviction that freeMemoryIfNeeded() left incomplete
+     * because of its time limit, so that memory goes back under the limit
+     * even when no write command is received. Like the active expire cycle
+     * we use up to EVICTION_CRON_TIME_PERC percent of the CPU time.
+     *
+     * Nothing is evicted while clients are paused: freeMemoryIfNeeded()
+     * returns without touching the flag, and the loop would spin for the
+     * whole time limit. The eviction resumes once the pause is over. */
+    if (server.maxmemory && server.eviction_pending && !clientsArePaused()) {
+        long long start = ustime();
+        long long timelimit = 1000000*EVICTION_CRON_TIME_PERC/server.hz/100;
+
+        while (server.eviction_pending && ustime()-start < timelimit)
+            freeMemoryIfNeeded();
+    }
+
     /* Start a scheduled AOF rewrite if this was requested by the user while
      * a BGSAVE was in progress. */
-    if (server.rdb_child_pid == -1 && server.aof_child_pid == -1 &&
+    if (!rdbSaveInProgress() && server.aof_child_pid == -1 &&
         server.aof_rewrite_scheduled)
     {
         rewriteAppendOnlyFileBackground();
     }
 
+    /* Make progress with the forkless BGSAVE in progress, if any. */
+    snapshotCron();
+
     /*检查是否正在进行的后台保存或 AOF 重写操作已终止。*/
     /* Check if a background saving or AOF rewrite in progress terminated. */
     if (server.rdb_child_pid != -1 || server.aof_child_pid != -1 ||
@@ -1599,7 +1828,7 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
             }
             updateDictResizePolicy();
         }
-    } else {
+    } else if (!server.rdb_thread_active) {
          /* 如果没有进行中的后台保存和重写，那么就检查现在是否要保存和重写 */
         /* If there is not a background saving/rewrite in progress check if
          * we have to save/rewrite now */
@@ -1637,7 +1866,7 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
                 return server.child_pid != -1;
             }
          */
-         if (server.rdb_child_pid == -1 &&
+         if (!rdbSaveInProgress() &&
              server.aof_child_pid == -1 &&
              server.aof_rewrite_perc &&
              server.aof_current_size > server.aof_rewrite_min_size)
@@ -1716,7 +1945,7 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
      * Note: this code must be after the replicationCron() call above so
      * make sure when refactoring this file to keep this order. This is useful
      * because we want to give priority to RDB savings for replication. */
-    if (server.rdb_child_pid == -1 && server.aof_child_pid == -1 &&
+    if (!rdbSaveInProgress() && server.aof_child_pid == -1 &&
         server.rdb_bgsave_scheduled &&
         (server.unixtime-server.lastbgsave_try > CONFIG_BGSAVE_RETRY_DELAY ||
          server.lastbgsave_status == C_OK))
@@ -1742,6 +1971,11 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
 void beforeSleep(struct aeEventLoop *eventLoop) {
     UNUSED(eventLoop);
 
+    /* Read and parse the query buffers of the clients postponed by the
+     * readable handler, using the I/O threads. Commands are executed
+     * here by the main thread. */
+    handleClientsWithPendingReadsUsingThreads();
+
     /* Call the Redis Cluster before sleep function. Note that this function
      * may change the state of Redis Cluster (from ok to fail or vice versa),
      * so it's a good idea to call it before serving the unblocked clients
@@ -1785,7 +2019,7 @@ void beforeSleep(struct aeEventLoop *eventLoop) {
 
     /* 处理 挂起的输出缓存写 */
     /* Handle writes with pending output buffers. */
-    handleClientsWithPendingWrites();
+    handleClientsWithPendingWritesUsingThreads();
 }
 
 /* =========================== Server initialization ======================== */
@@ -1918,6 +2152,10 @@ void initServerConfig(void) {
 
     //参考networking.c中的 acceptCommonHandler函数
     server.protected_mode = CONFIG_DEFAULT_PROTECTED_MODE; //1
+    server.io_threads_num = CONFIG_DEFAULT_IO_THREADS_NUM;
+    server.io_threads_do_reads = CONFIG_DEFAULT_IO_THREADS_DO_READS;
+    server.embedded_keys = CONFIG_DEFAULT_EMBEDDED_KEYS;
+    server.expire_index = CONFIG_DEFAULT_EXPIRE_INDEX;
     server.dbnum = CONFIG_DEFAULT_DBNUM; //16
 
     /*
@@ -1934,12 +2172,14 @@ void initServerConfig(void) {
 
     //todo 写篇
     server.active_expire_enabled = 1;
+    server.active_expire_effort = CONFIG_DEFAULT_ACTIVE_EXPIRE_EFFORT;
 
 
     //todo 写篇
     server.client_max_querybuf_len = PROTO_MAX_QUERYBUF_LEN; //查询缓存 1GB
     server.saveparams = NULL;
     server.loading = 0;
+    server.async_loading = 0;
     server.logfile = zstrdup(CONFIG_DEFAULT_LOGFILE); //默认为空
     server.syslog_enabled = CONFIG_DEFAULT_SYSLOG_ENABLED; //0
     server.syslog_ident = zstrdup(CONFIG_DEFAULT_SYSLOG_IDENT);
@@ -1985,6 +2225,8 @@ void initServerConfig(void) {
     server.maxmemory = CONFIG_DEFAULT_MAXMEMORY; //最大内存 默认为0 0代表不使用任何内存限制
     server.maxmemory_policy = CONFIG_DEFAULT_MAXMEMORY_POLICY; //最大内存策略 默认为 NO_EVICTION
     server.maxmemory_samples = CONFIG_DEFAULT_MAXMEMORY_SAMPLES; //随机抽样精度默认是5
+    server.lfu_log_factor = CONFIG_DEFAULT_LFU_LOG_FACTOR;
+    server.lfu_decay_time = CONFIG_DEFAULT_LFU_DECAY_TIME;
 
 
     //跟默认配置一样
@@ -1998,8 +2240,10 @@ void initServerConfig(void) {
     server.list_compress_depth = OBJ_LIST_COMPRESS_DEPTH;
     //最大整数集合的条目数
     server.set_max_intset_entries = OBJ_SET_MAX_INTSET_ENTRIES;
+    server.set_large_encoding = OBJ_SET_LARGE_ENCODING;
     server.zset_max_ziplist_entries = OBJ_ZSET_MAX_ZIPLIST_ENTRIES;
     server.zset_max_ziplist_value = OBJ_ZSET_MAX_ZIPLIST_VALUE;
+    server.zset_large_encoding = OBJ_ZSET_LARGE_ENCODING;
     server.hll_sparse_max_bytes = CONFIG_DEFAULT_HLL_SPARSE_MAX_BYTES; //3000
     server.shutdown_asap = 0;
     server.repl_ping_slave_period = CONFIG_DEFAULT_REPL_PING_SLAVE_PERIOD; //ping slave的周期 秒数
@@ -2017,6 +2261,9 @@ void initServerConfig(void) {
     server.migrate_cached_sockets = dictCreate(&migrateCacheDictType,NULL);
     server.next_client_id = 1; /* Client IDs, start from 1 .*/ //客户端标识符
     server.loading_process_events_interval_bytes = (1024*1024*2); //2mb
+    server.rdb_load_threads = CONFIG_DEFAULT_RDB_LOAD_THREADS;
+    server.rdb_forkless_save = CONFIG_DEFAULT_RDB_FORKLESS_SAVE;
+    server.loading_threads = 0;
     server.lua_time_limit = LUA_SCRIPT_TIME_LIMIT; //lua 脚本的超时时间 默认5秒
 
     /*lru 过期时钟*/
@@ -2045,10 +2292,13 @@ void initServerConfig(void) {
     server.repl_disable_tcp_nodelay = CONFIG_DEFAULT_REPL_DISABLE_TCP_NODELAY;
     server.repl_diskless_sync = CONFIG_DEFAULT_REPL_DISKLESS_SYNC;
     server.repl_diskless_sync_delay = CONFIG_DEFAULT_REPL_DISKLESS_SYNC_DELAY;
+    server.repl_diskless_load = CONFIG_DEFAULT_REPL_DISKLESS_LOAD;
     server.slave_priority = CONFIG_DEFAULT_SLAVE_PRIORITY;
     server.slave_announce_ip = CONFIG_DEFAULT_SLAVE_ANNOUNCE_IP;
     server.slave_announce_port = CONFIG_DEFAULT_SLAVE_ANNOUNCE_PORT;
     server.master_repl_offset = 0;
+    changeReplicationId();
+    clearReplicationId2();
 
     /* 主从复制  部分从同步 */
     // 复制 部分重新同步积压
@@ -2397,7 +2647,11 @@ void resetServerStats(void) {
     server.stat_numcommands = 0;
     server.stat_numconnections = 0;
     server.stat_expiredkeys = 0;
+    server.stat_expired_time_cap_reached_count = 0;
+    server.stat_expire_cycle_time_used = 0;
     server.stat_evictedkeys = 0;
+    server.stat_evicted_samples = 0;
+    server.stat_eviction_time = 0;
     server.stat_keyspace_misses = 0;
     server.stat_keyspace_hits = 0;
     server.stat_fork_time = 0;
@@ -2415,6 +2669,15 @@ void resetServerStats(void) {
     }
     server.stat_net_input_bytes = 0;
     server.stat_net_output_bytes = 0;
+    server.stat_io_reads_processed = 0;
+    server.stat_io_writes_processed = 0;
+    server.stat_reply_write_syscalls = 0;
+    server.stat_reply_write_bytes = 0;
+    server.stat_snapshots = 0;
+    server.stat_snapshot_preserved_keys = 0;
+    server.stat_snapshot_preserved_bytes = 0;
+    server.stat_snapshot_last_preserved_keys = 0;
+    server.stat_snapshot_write_waits = 0;
     server.aof_delayed_fsync = 0;
 }
 
@@ -2445,12 +2708,14 @@ void initServer(void) {
     server.slaves = listCreate(); //从列表
     server.monitors = listCreate(); //监控列表
     server.clients_pending_write = listCreate(); //客户端待写列表
+    server.clients_pending_read = listCreate(); //等待I/O线程读取的客户端列表
     server.slaveseldb = -1; /* Force to emit the first SELECT command. */
     server.unblocked_clients = listCreate(); //非阻塞客户端列表
     server.ready_keys = listCreate(); 
     server.clients_waiting_acks = listCreate();
     server.get_ack_from_slaves = 0;
     server.clients_paused = 0;
+    server.eviction_pending = 0;
     server.system_memory_size = zmalloc_get_memory_size();
 
     //创建共享对象。。比如wrongtypeerr 等。。
@@ -2490,15 +2755,17 @@ void initServer(void) {
     /*创建redis数据库，初始化内部状态*/
     /* Create the Redis databases, and initialize other internal state. */
     for (j = 0; j < server.dbnum; j++) {
-        server.db[j].dict = dictCreate(&dbDictType,NULL); //数据库字典
-        server.db[j].expires = dictCreate(&keyptrDictType,NULL); //过期键字典
+        server.db[j].dict = keyspaceDictCreate(keyspaceMainDictType()); //数据库字典
+        server.db[j].expires = keyspaceDictCreate(&keyptrDictType); //过期键字典
         server.db[j].blocking_keys = dictCreate(&keylistDictType,NULL); //阻塞键字典
         server.db[j].ready_keys = dictCreate(&setDictType,NULL); //准备键字典
         server.db[j].watched_keys = dictCreate(&keylistDictType,NULL); //watch键字典
-        server.db[j].eviction_pool = evictionPoolAlloc(); //淘汰池字典
         server.db[j].id = j; 
         server.db[j].avg_ttl = 0;
+        server.db[j].stale_ratio = 0;
+        server.db[j].expires_index = server.expire_index ? zslCreate() : NULL;
     }
+    evictionPoolAlloc(); //淘汰池
 
     //
     server.pubsub_channels = dictCreate(&keylistDictType,NULL);
@@ -2509,6 +2776,7 @@ void initServer(void) {
     server.rdb_child_pid = -1;
     server.aof_child_pid = -1;
     server.rdb_child_type = RDB_CHILD_TYPE_NONE;
+    server.rdb_thread_active = 0;
     server.rdb_bgsave_scheduled = 0;
 
     //创建aof_rewrite_buf_blocks 链表 重写过程中的变化
@@ -2593,6 +2861,7 @@ void initServer(void) {
     //后台任务线程io初始化 
     //pthread
     bioInit();
+    initThreadedIO();
 }
 
 /* Populates the Redis Command Table starting from the hard coded list
@@ -3253,6 +3522,15 @@ int processCommand(client *c) {
         return C_OK;
     }
 
+    /* While a slave loads the payload of the master with repl-diskless-load
+     * swapdb, only read only commands are served, using the old data set. */
+    if (server.async_loading &&
+        !(c->cmd->flags & (CMD_READONLY|CMD_LOADING)))
+    {
+        addReply(c, shared.loadingerr);
+        return C_OK;
+    }
+
     /*
         redis 正在忙于 运行脚本,只能调用 script kill 或者shutdown nosave
         Redis is busy running a script. You can only call SCRIPT KILL or SHUTDOWN NOSAVE
@@ -3330,6 +3608,7 @@ int prepareForShutdown(int flags) {
 
     //是否开启了nosave
     int nosave = flags & SHUTDOWN_NOSAVE;
+    int j;
 
     serverLog(LL_WARNING,"User requested shutdown...");
 
@@ -3346,6 +3625,7 @@ int prepareForShutdown(int flags) {
         kill(server.rdb_child_pid,SIGUSR1);
         rdbRemoveTempFile(server.rdb_child_pid);
     }
+    snapshotAbort();
 
     /*如果aof不是关闭状态*/
     if (server.aof_state != AOF_OFF) {
@@ -3398,7 +3678,15 @@ int prepareForShutdown(int flags) {
      * send them pending writes. */
     flushSlavesOutputBuffers();
 
-    /* Close the listening sockets. Apparently this allows faster restarts. */
+    /* Close the listening sockets. Apparently this allows faster restarts.
+     * Their events are deleted first since with the io_uring event loop the
+     * poll in flight would keep the sockets open until the process exits. */
+    for (j = 0; j < server.ipfd_count; j++)
+        aeDeleteFileEvent(server.el,server.ipfd[j],AE_READABLE);
+    if (server.sofd != -1) aeDeleteFileEvent(server.el,server.sofd,AE_READABLE);
+    if (server.cluster_enabled)
+        for (j = 0; j < server.cfd_count; j++)
+            aeDeleteFileEvent(server.el,server.cfd[j],AE_READABLE);
     closeListeningSockets(1);
     serverLog(LL_WARNING,"%s is now ready to exit, bye bye...",
         server.sentinel_mode ? "Sentinel" : "Redis");
@@ -3733,9 +4021,13 @@ sds genRedisInfoString(char *section) {
             "connected_clients:%lu\r\n"
             "client_longest_output_list:%lu\r\n"
             "client_biggest_input_buf:%lu\r\n"
+            "client_buffers_memory:%zu\r\n"
+            "client_buffers_pool_memory:%zu\r\n"
             "blocked_clients:%d\r\n",
             listLength(server.clients)-listLength(server.slaves),
             lol, bib,
+            getClientsBuffersMemory(),
+            getClientBuffersPoolMemory(),
             server.bpop_blocked_clients);
     }
 
@@ -3784,7 +4076,8 @@ sds genRedisInfoString(char *section) {
             "maxmemory_human:%s\r\n"
             "maxmemory_policy:%s\r\n"
             "mem_fragmentation_ratio:%.2f\r\n"
-            "mem_allocator:%s\r\n",
+            "mem_allocator:%s\r\n"
+            "lazyfree_pending_objects:%zu\r\n",
             zmalloc_used,
             hmem,
             server.resident_set_size,
@@ -3799,7 +4092,8 @@ sds genRedisInfoString(char *section) {
             maxmemory_hmem,
             evict_policy,
             zmalloc_get_fragmentation_ratio(server.resident_set_size),
-            ZMALLOC_LIB
+            ZMALLOC_LIB,
+            lazyfreeGetPendingObjectsCount()
             );
     }
 
@@ -3810,6 +4104,7 @@ sds genRedisInfoString(char *section) {
         info = sdscatprintf(info,
             "# Persistence\r\n"
             "loading:%d\r\n"
+            "async_loading:%d\r\n"
             "rdb_changes_since_last_save:%lld\r\n"
             "rdb_bgsave_in_progress:%d\r\n"
             "rdb_last_save_time:%jd\r\n"
@@ -3824,12 +4119,13 @@ sds genRedisInfoString(char *section) {
             "aof_last_bgrewrite_status:%s\r\n"
             "aof_last_write_status:%s\r\n",
             server.loading,
+            server.async_loading,
             server.dirty,
-            server.rdb_child_pid != -1,
+            rdbSaveInProgress(),
             (intmax_t)server.lastsave,
             (server.lastbgsave_status == C_OK) ? "ok" : "err",
             (intmax_t)server.rdb_save_time_last,
-            (intmax_t)((server.rdb_child_pid == -1) ?
+            (intmax_t)(!rdbSaveInProgress() ?
                 -1 : time(NULL)-server.rdb_save_time_start),
             server.aof_state != AOF_OFF,
             server.aof_child_pid != -1,
@@ -3840,6 +4136,21 @@ sds genRedisInfoString(char *section) {
             (server.aof_lastbgrewrite_status == C_OK) ? "ok" : "err",
             (server.aof_last_write_status == C_OK) ? "ok" : "err");
 
+        /* Forkless BGSAVE, see snapshot.c. */
+        info = sdscatprintf(info,
+            "rdb_forkless_save:%d\r\n"
+            "rdb_forkless_saves:%lld\r\n"
+            "rdb_forkless_preserved_keys:%lld\r\n"
+            "rdb_forkless_preserved_bytes:%lld\r\n"
+            "rdb_forkless_last_preserved_keys:%lld\r\n"
+            "rdb_forkless_write_waits:%lld\r\n",
+            server.rdb_forkless_save,
+            server.stat_snapshots,
+            server.stat_snapshot_preserved_keys,
+            server.stat_snapshot_preserved_bytes,
+            server.stat_snapshot_last_preserved_keys,
+            server.stat_snapshot_write_waits);
+
         if (server.aof_state != AOF_OFF) {
             info = sdscatprintf(info,
                 "aof_current_size:%lld\r\n"
@@ -3858,7 +4169,7 @@ sds genRedisInfoString(char *section) {
                 server.aof_delayed_fsync);
         }
 
-        if (server.loading) {
+        if (server.loading || server.async_loading) {
             double perc;
             time_t eta, elapsed;
             off_t remaining_bytes = server.loading_total_bytes-
@@ -3887,6 +4198,23 @@ sds genRedisInfoString(char *section) {
                 perc,
                 (intmax_t)eta
             );
+            if (server.loading_threads) {
+                info = sdscatprintf(info,
+                    "loading_threads:%d\r\n"
+                    "loading_read_bytes_per_sec:%.0f\r\n"
+                    "loading_read_busy_perc:%.2f\r\n"
+                    "loading_build_keys_per_sec:%.0f\r\n"
+                    "loading_build_busy_perc:%.2f\r\n"
+                    "loading_insert_keys_per_sec:%.0f\r\n"
+                    "loading_insert_busy_perc:%.2f\r\n",
+                    server.loading_threads,
+                    loadingStageThroughput(RDB_LOAD_STAGE_READ),
+                    loadingStageBusyPerc(RDB_LOAD_STAGE_READ),
+                    loadingStageThroughput(RDB_LOAD_STAGE_BUILD),
+                    loadingStageBusyPerc(RDB_LOAD_STAGE_BUILD),
+                    loadingStageThroughput(RDB_LOAD_STAGE_INSERT),
+                    loadingStageBusyPerc(RDB_LOAD_STAGE_INSERT));
+            }
         }
     }
 
@@ -3907,13 +4235,25 @@ sds genRedisInfoString(char *section) {
             "sync_partial_ok:%lld\r\n"
             "sync_partial_err:%lld\r\n"
             "expired_keys:%lld\r\n"
+            "expired_stale_perc:%.2f\r\n"
+            "expired_time_cap_reached_count:%lld\r\n"
+            "expire_cycle_cpu_milliseconds:%lld\r\n"
+            "expire_cycle_cpu_perc:%.2f\r\n"
             "evicted_keys:%lld\r\n"
+            "eviction_time_usec:%lld\r\n"
+            "eviction_samples_per_key:%.2f\r\n"
+            "instantaneous_evictions_per_sec:%lld\r\n"
             "keyspace_hits:%lld\r\n"
             "keyspace_misses:%lld\r\n"
             "pubsub_channels:%ld\r\n"
             "pubsub_patterns:%lu\r\n"
             "latest_fork_usec:%lld\r\n"
-            "migrate_cached_sockets:%ld\r\n",
+            "migrate_cached_sockets:%ld\r\n"
+            "io_threads_active:%d\r\n"
+            "io_threaded_reads_processed:%lld\r\n"
+            "io_threaded_writes_processed:%lld\r\n"
+            "reply_write_syscalls:%lld\r\n"
+            "reply_write_syscalls_per_kb:%.3f\r\n",
             server.stat_numconnections,
             server.stat_numcommands,
             getInstantaneousMetric(STATS_METRIC_COMMAND),
@@ -3926,13 +4266,28 @@ sds genRedisInfoString(char *section) {
             server.stat_sync_partial_ok,
             server.stat_sync_partial_err,
             server.stat_expiredkeys,
+            expireStaleRatio()*100,
+            server.stat_expired_time_cap_reached_count,
+            server.stat_expire_cycle_time_used/1000,
+            (double)getInstantaneousMetric(STATS_METRIC_EXPIRE_CYCLE)/10000,
             server.stat_evictedkeys,
+            server.stat_eviction_time,
+            server.stat_evictedkeys ?
+                (double)server.stat_evicted_samples/server.stat_evictedkeys : 0,
+            getInstantaneousMetric(STATS_METRIC_EVICTIONS),
             server.stat_keyspace_hits,
             server.stat_keyspace_misses,
             dictSize(server.pubsub_channels),
             listLength(server.pubsub_patterns),
             server.stat_fork_time,
-            dictSize(server.migrate_cached_sockets));
+            dictSize(server.migrate_cached_sockets),
+            server.io_threads_active,
+            server.stat_io_reads_processed,
+            server.stat_io_writes_processed,
+            server.stat_reply_write_syscalls,
+            server.stat_reply_write_bytes ?
+                (double)server.stat_reply_write_syscalls*1024/
+                server.stat_reply_write_bytes : 0);
     }
 
     /* 复制 */
@@ -4046,12 +4401,18 @@ sds genRedisInfoString(char *section) {
             }
         }
         info = sdscatprintf(info,
+            "master_replid:%s\r\n"
+            "master_replid2:%s\r\n"
             "master_repl_offset:%lld\r\n"
+            "second_repl_offset:%lld\r\n"
             "repl_backlog_active:%d\r\n"
             "repl_backlog_size:%lld\r\n"
             "repl_backlog_first_byte_offset:%lld\r\n"
             "repl_backlog_histlen:%lld\r\n",
+            server.replid,
+            server.replid2,
             server.master_repl_offset,
+            server.second_replid_offset,
             server.repl_backlog != NULL,
             server.repl_backlog_size,
             server.repl_backlog_off,
@@ -4111,10 +4472,48 @@ sds genRedisInfoString(char *section) {
             vkeys = dictSize(server.db[j].expires);
             if (keys || vkeys) {
                 info = sdscatprintf(info,
-                    "db%d:keys=%lld,expires=%lld,avg_ttl=%lld\r\n",
-                    j, keys, vkeys, server.db[j].avg_ttl);
+                    "db%d:keys=%lld,expires=%lld,avg_ttl=%lld,"
+                    "stale_keys=%lld\r\n",
+                    j, keys, vkeys, server.db[j].avg_ttl,
+                    (long long)(vkeys*server.db[j].stale_ratio));
+            }
+        }
+    }
+
+    /* Rehash */
+    /* 正在rehash的数据库字典的进度 */
+    if (allsections || defsections || !strcasecmp(section,"rehash")) {
+        int rehashing = 0;
+        sds dbs = sdsempty();
+
+        for (j = 0; j < server.dbnum; j++) {
+            dict *dicts[2] = {server.db[j].dict, server.db[j].expires};
+            char *names[2] = {"main", "expires"};
+            int k;
+
+            for (k = 0; k < 2; k++) {
+                dict *d = dicts[k];
+
+                if (!dictIsRehashing(d)) continue;
+                rehashing++;
+                dbs = sdscatprintf(dbs,
+                    "db%d:dict=%s,from_size=%lu,to_size=%lu,"
+                    "rehashed_buckets=%ld,progress=%.2f,"
+                    "table_memory=%zu,rehash_budget_ms=%d\r\n",
+                    j, names[k], d->ht[0].size, d->ht[1].size,
+                    d->rehashidx, (double)d->rehashidx*100/d->ht[0].size,
+                    dictTableMemory(d), activeRehashBudget(d));
             }
         }
+        if (sections++) info = sdscat(info,"\r\n");
+        info = sdscatprintf(info,
+            "# Rehash\r\n"
+            "active_rehashing:%d\r\n"
+            "rehashing_dicts:%d\r\n",
+            server.activerehashing,
+            rehashing);
+        info = sdscatsds(info,dbs);
+        sdsfree(dbs);
     }
     return info;
 }
@@ -4203,10 +4602,14 @@ void monitorCommand(client *c) {
  * one key that can be evicted, if there is at least one key that can be
  * evicted in the whole database. */
 
-/* Create a new eviction pool. */
-struct evictionPoolEntry *evictionPoolAlloc(void) {
-
+/* The eviction pool is shared by all the databases and persists across
+ * freeMemoryIfNeeded() calls, so that every call only needs to sample a few
+ * new keys, and the best candidates are compared across databases instead
+ * of evicting one key from every DB. */
+static struct evictionPoolEntry *EvictionPool;
 
+/* Create a new eviction pool. */
+void evictionPoolAlloc(void) {
     struct evictionPoolEntry *ep;
     int j;
 
@@ -4217,8 +4620,10 @@ struct evictionPoolEntry *evictionPoolAlloc(void) {
     for (j = 0; j < MAXMEMORY_EVICTION_POOL_SIZE; j++) {
         ep[j].idle = 0;
         ep[j].key = NULL;
+        ep[j].cached = sdsnewlen(NULL,EVPOOL_CACHED_SDS_SIZE);
+        ep[j].dbid = 0;
     }
-    return ep;
+    EvictionPool = ep;
 }
 
 /*
@@ -4235,10 +4640,16 @@ struct evictionPoolEntry *evictionPoolAlloc(void) {
  *
  * We insert keys on place in ascending order, so keys with the smaller
  * idle time are on the left, and keys with the higher idle time on the
- * right. */
+ * right.
+ *
+ * The "idle time" is actually a score that is greater for better
+ * candidates: the idle time for LRU, the inverted access frequency for LFU
+ * and the inverted expire time for volatile-ttl.
+ *
+ * The number of keys sampled is returned. */
 
 #define EVICTION_SAMPLES_ARRAY_SIZE 16
-void evictionPoolPopulate(dict *sampledict, dict *keydict, struct evictionPoolEntry *pool) {
+int evictionPoolPopulate(int dbid, dict *sampledict, dict *keydict, struct evictionPoolEntry *pool) {
     int j, k, count;
     dictEntry *_samples[EVICTION_SAMPLES_ARRAY_SIZE];
     dictEntry **samples;
@@ -4262,22 +4673,36 @@ void evictionPoolPopulate(dict *sampledict, dict *keydict, struct evictionPoolEn
         sds key;
         robj *o;
         dictEntry *de;
+        size_t klen;
 
         de = samples[j]; //当前采样的元素
         key = dictGetKey(de);
 
-        /*
-         如果我们采样的字典不是主字典（而是过期字典），
-         我们需要在键字典中再次查找键以获得值对象。
-        */
-        /* If the dictionary we are sampling from is not the main
-         * dictionary (but the expires one) we need to lookup the key
-         * again in the key dictionary to obtain the value object. */
-        if (sampledict != keydict) de = dictFind(keydict, key);
-        o = dictGetVal(de);
-
-        //获取当前对象空闲时间间隔
-        idle = estimateObjectIdleTime(o);
+        if (server.maxmemory_policy == MAXMEMORY_VOLATILE_TTL) {
+            /* Expire sooner (minor expire unix timestamp) is better
+             * candidate for deletion. */
+            /*尽早过期（minor Expire unix timestamp）是删除的最佳选择*/
+            //值为过期时间
+            idle = ULLONG_MAX - (long long) dictGetSignedIntegerVal(de);
+        } else {
+            /*
+             如果我们采样的字典不是主字典（而是过期字典），
+             我们需要在键字典中再次查找键以获得值对象。
+            */
+            /* If the dictionary we are sampling from is not the main
+             * dictionary (but the expires one) we need to lookup the key
+             * again in the key dictionary to obtain the value object. */
+            if (sampledict != keydict) de = dictFind(keydict, key);
+            o = dictGetVal(de);
+
+            //获取当前对象空闲时间间隔
+            /* With LFU policies the counter is inverted, so that as for the
+             * idle time a greater score means a better candidate. */
+            if (MAXMEMORY_POLICY_IS_LFU(server.maxmemory_policy))
+                idle = 255-LFUDecrAndReturn(o);
+            else
+                idle = estimateObjectIdleTime(o);
+        }
 
         /* Insert the element inside the pool.
          * First, find the first empty bucket or the first populated
@@ -4307,7 +4732,6 @@ void evictionPoolPopulate(dict *sampledict, dict *keydict, struct evictionPoolEn
             if (pool[MAXMEMORY_EVICTION_POOL_SIZE-1].key == NULL) {
                 /* Free space on the right? Insert at k shifting
                  * all the elements from k to end to the right. */
-
                 //在右边还有空闲空间？有的话就在第k处插入，将所有从k开始的元素向右移动
 
                 //比如 k 是 5
@@ -4315,8 +4739,13 @@ void evictionPoolPopulate(dict *sampledict, dict *keydict, struct evictionPoolEn
                 // 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16
                 // 1 2 3 4 5 k  6 7 8 9  10 11 12 13 14 15 
                 //要挪动 16 -5 -1 = 10个元素
+
+                /* Save the cached SDS of the entry we overwrite, it is
+                 * reused for the new element. */
+                sds cached = pool[MAXMEMORY_EVICTION_POOL_SIZE-1].cached;
                 memmove(pool+k+1,pool+k,
                     sizeof(pool[0])*(MAXMEMORY_EVICTION_POOL_SIZE-k-1));
+                pool[k].cached = cached;
             } else {
                 /* No free space on right? Insert at k-1 */
                 //在右边没有空闲空间了，那就插在k-1 位置处
@@ -4324,18 +4753,32 @@ void evictionPoolPopulate(dict *sampledict, dict *keydict, struct evictionPoolEn
                 /* Shift all elements on the left of k (included) to the
                  * left, so we discard the element with smaller idle time. */
                 // 将k（包括）左边的所有元素移到左边，这样我们就丢弃了空闲时间较小的元素
-                sdsfree(pool[0].key);
+                sds cached = pool[0].cached;
+                if (pool[0].key != pool[0].cached) sdsfree(pool[0].key);
                 //从1 开始的往前挪一个位置 挪动k个元素
                 //比如 1 2 3 4 5
                 // k=3 那么就把 2 3 4 挪到1处 变成 2 3 4 k 5
                 memmove(pool,pool+1,sizeof(pool[0])*k);
+                pool[k].cached = cached;
             }
         }
+
         //在k处插入当前元素
-        pool[k].key = sdsdup(key);
+        /* Copy the key in the SDS string preallocated in the pool entry
+         * when it fits, to avoid an allocation for every sampled key. */
+        klen = sdslen(key);
+        if (klen > EVPOOL_CACHED_SDS_SIZE) {
+            pool[k].key = sdsdup(key);
+        } else {
+            memcpy(pool[k].cached,key,klen+1);
+            sdssetlen(pool[k].cached,klen);
+            pool[k].key = pool[k].cached;
+        }
         pool[k].idle = idle;
+        pool[k].dbid = dbid;
     }
     if (samples != _samples) zfree(samples);
+    return count;
 }
 
 /**
@@ -4350,7 +4793,10 @@ int freeMemoryIfNeeded(void) {
 
     //从节点的数量
     int slaves = listLength(server.slaves);
+    int keys_freed = 0;
+    int allkeys;
     mstime_t latency, eviction_latency;
+    long long start;
 
     /*
     POV在计算机术语中指的是过程输出变量（Process Output Variable）‌。
@@ -4366,7 +4812,7 @@ int freeMemoryIfNeeded(void) {
     /* Remove the size of slaves output buffers and AOF buffer from the
      * count of used memory. */
     mem_used = zmalloc_used_memory();
-    if (slaves) {
+    if (slaves && mem_used > server.maxmemory) {
         listIter li;
         listNode *ln;
 
@@ -4376,12 +4822,12 @@ int freeMemoryIfNeeded(void) {
             /*
                 计算从服务的输出缓冲所使用的内存
             */
-            unsigned long obuf_bytes = getClientOutputBufferMemoryUsage(slave);
+            /* The slaves share the blocks of the replication stream, see
+             * addReplyShared(): every block is only subtracted once. The
+             * walk of the reply lists is skipped when we are under the
+             * limit anyway. */
+            unsigned long obuf_bytes = getClientOutputBufferMemoryShare(slave);
 
-            /*
-              addReply(c,shared.mbulkhdr[ll]); 内部会增加c->reply_bytes
-              但是这里就是用的共享的对象 所以 如果两个客户端共享一个对象的话，那么两个客户端的reply_bytes内存总量肯定多出来了
-            */
             if (obuf_bytes > mem_used) //为啥会大于
                 mem_used = 0; // 
                 
@@ -4399,6 +4845,7 @@ int freeMemoryIfNeeded(void) {
 
     /* 检查 是否到达了最大内存*/
     /* Check if we are over the memory limit. */
+    server.eviction_pending = 0;
     if (mem_used <= server.maxmemory) return C_OK;
 
     /* 如果淘汰策略是 当内存不足以容纳新写入数据时，新写入操作会报错
@@ -4411,166 +4858,166 @@ int freeMemoryIfNeeded(void) {
     /*计算 需要释放多少内存 */
     mem_tofree = mem_used - server.maxmemory;
     mem_freed = 0;
+    /*策略 是 lru 或者 random的时候 采样键空间 否则采样过期字典*/
+    // MAXMEMORY_ALLKEYS_LRU 3 /* 当内存不足以容纳新写入数据时，在键空间中，移除最近最少使用的key*/
+    // MAXMEMORY_ALLKEYS_RANDOM 4 /*当内存不足以容纳新写入数据时，在键空间中，随机移除某个key。*/
+    allkeys = server.maxmemory_policy == MAXMEMORY_ALLKEYS_LRU ||
+              server.maxmemory_policy == MAXMEMORY_ALLKEYS_LFU ||
+              server.maxmemory_policy == MAXMEMORY_ALLKEYS_RANDOM;
+    start = ustime();
     latencyStartMonitor(latency); //开始记录时间
 
     //当释放的内存总量 小于需要释放的总量时
     while (mem_freed < mem_tofree) {
-        int j, k, keys_freed = 0;
-        /*每个数据库*/
-        for (j = 0; j < server.dbnum; j++) {
-            long bestval = 0; /* just to prevent warning */
-            sds bestkey = NULL;
-            dictEntry *de;
-            redisDb *db = server.db+j;
-            dict *dict;
-
-            /*策略 是 lru 或者 random的时候*/
-            // MAXMEMORY_ALLKEYS_LRU 3 /* 当内存不足以容纳新写入数据时，在键空间中，移除最近最少使用的key*/
-            // MAXMEMORY_ALLKEYS_RANDOM 4 /*当内存不足以容纳新写入数据时，在键空间中，随机移除某个key。*/
-            if (server.maxmemory_policy == MAXMEMORY_ALLKEYS_LRU ||
-                server.maxmemory_policy == MAXMEMORY_ALLKEYS_RANDOM)
-            {
-                dict = server.db[j].dict;
-            } else {
-                dict = server.db[j].expires;
-            }
-            if (dictSize(dict) == 0) continue;
+        int i, k, bestdbid = 0;
+        static unsigned int next_db = 0;
+        sds bestkey = NULL;
+        dictEntry *de;
+        redisDb *db;
+        dict *dict;
 
-            /* volatile-random and allkeys-random policy */
-            if (server.maxmemory_policy == MAXMEMORY_ALLKEYS_RANDOM ||
-                server.maxmemory_policy == MAXMEMORY_VOLATILE_RANDOM)
-            {
-                //在指定的键空间内 获取随机key
-                de = dictGetRandomKey(dict);
-                bestkey = dictGetKey(de);
+        if (server.maxmemory_policy == MAXMEMORY_ALLKEYS_RANDOM ||
+            server.maxmemory_policy == MAXMEMORY_VOLATILE_RANDOM)
+        {
+            /* volatile-random and allkeys-random policy: evict a key from
+             * a different DB every time, visiting them incrementally with
+             * the static 'next_db' variable. */
+            for (i = 0; i < server.dbnum; i++) {
+                int j = (++next_db) % server.dbnum;
+                db = server.db+j;
+                dict = allkeys ? db->dict : db->expires;
+                if (dictSize(dict) != 0) {
+                    //在指定的键空间内 获取随机key
+                    de = dictGetRandomKey(dict);
+                    bestkey = dictGetKey(de);
+                    bestdbid = j;
+                    server.stat_evicted_samples++;
+                    break;
+                }
             }
-
-            /* volatile-lru and allkeys-lru policy */
-            else if (server.maxmemory_policy == MAXMEMORY_ALLKEYS_LRU ||
-                server.maxmemory_policy == MAXMEMORY_VOLATILE_LRU)
-            {
-
-                //lru 的算法
-
-                struct evictionPoolEntry *pool = db->eviction_pool;
-
-                //当bestkey为空的时候
-                while(bestkey == NULL) {
-                    //一个数据库一个池
-                    //dict 为采样的 有可能是expire或者dict键空间
-                    //db->dict 为 键空间
-                    evictionPoolPopulate(dict, db->dict, db->eviction_pool);
-                    /* Go backward from best to worst element to evict. */
-                    /* 从最好的元素(空闲时间最大的)到最差的元素往回走 */
-                    for (k = MAXMEMORY_EVICTION_POOL_SIZE-1; k >= 0; k--) {
-                        if (pool[k].key == NULL) continue;
-                        //从采样的空间中获取当前要过期的键
-                        de = dictFind(dict,pool[k].key);
-
-                        /* Remove the entry from the pool. */
-                        /* 从池中移除*/
-                        sdsfree(pool[k].key);
-                        /* Shift all elements on its right to left. */
-                        /* 将其右侧的所有元素向左移动 */
-                        memmove(pool+k,pool+k+1,
-                            sizeof(pool[0])*(MAXMEMORY_EVICTION_POOL_SIZE-k-1));
-                        /* Clear the element on the right which is empty
-                         * since we shifted one position to the left.  */
-                        pool[MAXMEMORY_EVICTION_POOL_SIZE-1].key = NULL;
-                        pool[MAXMEMORY_EVICTION_POOL_SIZE-1].idle = 0;
-
-                        /*如果key存在，那就是我们的选择 否则它就是一个幽灵，我们需要尝试下一个元素*/
-                        /* If the key exists, is our pick. Otherwise it is
-                         * a ghost and we need to try the next element. */
-                        if (de) {
-                            bestkey = dictGetKey(de);
-                            break;
-                        } else {
-                            /* Ghost... */
-                            continue;
-                        }
+        } else {
+            /* volatile-lru, allkeys-lru, volatile-lfu, allkeys-lfu and
+             * volatile-ttl: use the shared eviction pool. */
+            struct evictionPoolEntry *pool = EvictionPool;
+
+            //当bestkey为空的时候
+            while(bestkey == NULL) {
+                unsigned long total_keys = 0, keys;
+
+                /* We don't want to make local-db choices when expiring keys,
+                 * so to start populate the eviction pool sampling keys from
+                 * every DB. */
+                for (i = 0; i < server.dbnum; i++) {
+                    db = server.db+i;
+                    dict = allkeys ? db->dict : db->expires;
+                    if ((keys = dictSize(dict)) != 0) {
+                        server.stat_evicted_samples +=
+                            evictionPoolPopulate(i, dict, db->dict, pool);
+                        total_keys += keys;
                     }
                 }
-            }
-
-            /* volatile-ttl */
-            else if (server.maxmemory_policy == MAXMEMORY_VOLATILE_TTL) {
-                for (k = 0; k < server.maxmemory_samples; k++) {
-                    sds thiskey;
-                    long thisval;
-                    //当 策略是MAXMEMORY_VOLATILE_TTL 时 dict是expires 字典
-                    de = dictGetRandomKey(dict);
-                    thiskey = dictGetKey(de);
-                    //值为过期时间
-                    thisval = (long) dictGetVal(de);    
-
-
-                    /*尽早过期（minor Expire unix timestamp）是删除的最佳选择*/
-                    /* Expire sooner (minor expire unix timestamp) is better
-                     * candidate for deletion */
-                    if (bestkey == NULL || thisval < bestval) {
-                        bestkey = thiskey;
-                        bestval = thisval;
+                if (!total_keys) break; /* No keys to evict. */
+
+                /* Go backward from best to worst element to evict. */
+                /* 从最好的元素(空闲时间最大的)到最差的元素往回走 */
+                for (k = MAXMEMORY_EVICTION_POOL_SIZE-1; k >= 0; k--) {
+                    if (pool[k].key == NULL) continue;
+                    bestdbid = pool[k].dbid;
+
+                    db = server.db+bestdbid;
+                    de = dictFind(allkeys ? db->dict : db->expires,
+                                  pool[k].key);
+
+                    /* Remove the entry from the pool. Since we always pick
+                     * the rightmost entry, the empty entries are always on
+                     * the right side of the pool. */
+                    /* 从池中移除*/
+                    if (pool[k].key != pool[k].cached)
+                        sdsfree(pool[k].key);
+                    pool[k].key = NULL;
+                    pool[k].idle = 0;
+
+                    /*如果key存在，那就是我们的选择 否则它就是一个幽灵，我们需要尝试下一个元素*/
+                    /* If the key exists, is our pick. Otherwise it is
+                     * a ghost and we need to try the next element. */
+                    if (de) {
+                        bestkey = dictGetKey(de);
+                        break;
                     }
                 }
             }
+        }
 
-            /*最后移除选择的key*/
-            /* Finally remove the selected key. */
-            if (bestkey) {
-                long long delta;
+        //如果没有可以释放的key
+        if (bestkey == NULL) break; /* nothing to free... */
 
-                robj *keyobj = createStringObject(bestkey,sdslen(bestkey));
-                propagateExpire(db,keyobj);
+        /*最后移除选择的key*/
+        /* Finally remove the selected key. */
+        {
+            long long delta;
 
-                /*
-                 我们单独计算dbDelete（）释放的内存量
-                 实际上，在AOF和复制链接中传播DEL所需的内存可能大于我们在删除键时释放的内存，
-                 但我们无法account这一点，否则我们将永远无法退出循环
+            db = server.db+bestdbid;
+            robj *keyobj = createStringObject(bestkey,sdslen(bestkey));
+            propagateExpire(db,keyobj);
 
-                 AOF和Output缓冲区内存最终将被释放，因此我们只关心键空间使用的内存
-                */
-                /* We compute the amount of memory freed by dbDelete() alone.
-                 * It is possible that actually the memory needed to propagate
-                 * the DEL in AOF and replication link is greater than the one
-                 * we are freeing removing the key, but we can't account for
-                 * that otherwise we would never exit the loop.
-                 *
-                 * AOF and Output buffer memory will be freed eventually so
-                 * we only care about memory used by the key space. */
-                delta = (long long) zmalloc_used_memory();//减之前算一次
-                latencyStartMonitor(eviction_latency);
-                dbDelete(db,keyobj); //减内存
-                latencyEndMonitor(eviction_latency);
-                latencyAddSampleIfNeeded("eviction-del",eviction_latency);
-                latencyRemoveNestedEvent(latency,eviction_latency);
-                delta -= (long long) zmalloc_used_memory(); //减之后算一次
-                mem_freed += delta; //加上 释放的差
-                server.stat_evictedkeys++;
-                //通知 发送消息
-                notifyKeyspaceEvent(NOTIFY_EVICTED, "evicted",
-                    keyobj, db->id);
-                decrRefCount(keyobj);
-                keys_freed++;
-
-                //当要释放的内存开始足够大时，我们可能会在这里花费太多的时间，
-                //以至于无法足够快地将数据传输到从属设备，因此我们将传输强制在循环内进行
-                /* When the memory to free starts to be big enough, we may
-                 * start spending so much time here that is impossible to
-                 * deliver data to the slaves fast enough, so we force the
-                 * transmission here inside the loop. */
-                if (slaves) flushSlavesOutputBuffers();
+            /*
+             我们单独计算dbDelete（）释放的内存量
+             实际上，在AOF和复制链接中传播DEL所需的内存可能大于我们在删除键时释放的内存，
+             但我们无法account这一点，否则我们将永远无法退出循环
+
+             AOF和Output缓冲区内存最终将被释放，因此我们只关心键空间使用的内存
+            */
+            /* We compute the amount of memory freed by dbDelete() alone.
+             * It is possible that actually the memory needed to propagate
+             * the DEL in AOF and replication link is greater than the one
+             * we are freeing removing the key, but we can't account for
+             * that otherwise we would never exit the loop.
+             *
+             * AOF and Output buffer memory will be freed eventually so
+             * we only care about memory used by the key space. */
+            delta = (long long) zmalloc_used_memory();//减之前算一次
+            latencyStartMonitor(eviction_latency);
+            dbDelete(db,keyobj); //减内存
+            latencyEndMonitor(eviction_latency);
+            latencyAddSampleIfNeeded("eviction-del",eviction_latency);
+            latencyRemoveNestedEvent(latency,eviction_latency);
+            delta -= (long long) zmalloc_used_memory(); //减之后算一次
+            mem_freed += delta; //加上 释放的差
+            server.stat_evictedkeys++;
+            //通知 发送消息
+            notifyKeyspaceEvent(NOTIFY_EVICTED, "evicted",
+                keyobj, db->id);
+            decrRefCount(keyobj);
+            keys_freed++;
+
+            //当要释放的内存开始足够大时，我们可能会在这里花费太多的时间，
+            //以至于无法足够快地将数据传输到从属设备，因此我们将传输强制在循环内进行
+            /* When the memory to free starts to be big enough, we may
+             * start spending so much time here that is impossible to
+             * deliver data to the slaves fast enough, so we force the
+             * transmission here inside the loop. */
+            if (slaves) flushSlavesOutputBuffers();
+
+            /* Don't block the event loop for too long when a lot of memory
+             * must be freed (for instance after CONFIG SET maxmemory): once
+             * the time limit is reached the command is allowed to proceed,
+             * and serverCron() continues the eviction incrementally.
+             * Checking the time every 16 keys is enough. */
+            if ((keys_freed % 16) == 0 &&
+                ustime()-start > EVICTION_TIME_LIMIT_US &&
+                mem_freed < mem_tofree)
+            {
+                server.eviction_pending = 1;
+                break;
             }
         }
-        //如果没有释放任何key
-        if (!keys_freed) {
-            latencyEndMonitor(latency);
-            latencyAddSampleIfNeeded("eviction-cycle",latency);
-            return C_ERR; /* nothing to free... */
-        }
     }
     latencyEndMonitor(latency);
     latencyAddSampleIfNeeded("eviction-cycle",latency);
+    server.stat_eviction_time += ustime()-start;
+    //如果没有释放足够的内存
+    if (mem_freed < mem_tofree && !server.eviction_pending)
+        return C_ERR;
     return C_OK;
 }
 
@@ -4807,9 +5254,37 @@ void loadDataFromDisk(void) {
         if (loadAppendOnlyFile(server.aof_filename) == C_OK)
             serverLog(LL_NOTICE,"DB loaded from append only file: %.3f seconds",(float)(ustime()-start)/1000000);
     } else {
-        if (rdbLoad(server.rdb_filename) == C_OK) {
+        rdbSaveInfo rsi = RDB_SAVE_INFO_INIT;
+        if (rdbLoad(server.rdb_filename,&rsi) == C_OK) {
             serverLog(LL_NOTICE,"DB loaded from disk: %.3f seconds",
                 (float)(ustime()-start)/1000000);
+
+            //RDB中保存了复制ID和偏移量，恢复复制状态，这样重启之后可以部分同步
+            /* Restore the replication ID / offset from the RDB file. */
+            if (rsi.repl_id_is_set && rsi.repl_offset != -1 &&
+                rsi.repl_stream_db >= 0 && rsi.repl_stream_db < server.dbnum)
+            {
+                if (server.masterhost) {
+                    /* We are a slave: use the saved ID and offset to
+                     * synthesize a cached master, so that we'll try a
+                     * partial resynchronization with our master. */
+                    memcpy(server.replid,rsi.repl_id,sizeof(server.replid));
+                    server.master_repl_offset = rsi.repl_offset;
+                    replicationCacheMasterUsingMyself();
+                    selectDb(server.cached_master,rsi.repl_stream_db);
+                } else {
+                    /* We are a master: our slaves are at most at the saved
+                     * offset of the saved history, so the saved ID becomes
+                     * our secondary ID, valid up to that offset, and an
+                     * empty backlog starting there allows the slaves that
+                     * did not get anything more to PSYNC with us. */
+                    memcpy(server.replid2,rsi.repl_id,sizeof(server.replid));
+                    server.second_replid_offset = rsi.repl_offset+1;
+                    server.master_repl_offset = rsi.repl_offset;
+                    changeReplicationId();
+                    createReplicationBacklog();
+                }
+            }
         } else if (errno != ENOENT) {
             serverLog(LL_WARNING,"Fatal error loading the DB: %s. Exiting.",strerror(errno));
             exit(1);
@@ -5026,13 +5501,17 @@ int main(int argc, char **argv) {
     //int j; 的作用是「定义变量 + 分配内存」—— 内存已经存在，但里面的数据是不确定的（局部变量）或默认 0（全局 / 静态）；
 
 #ifdef REDIS_TEST
-    if (argc == 3 && !strcasecmp(argv[1], "test")) {
+    if (argc >= 3 && !strcasecmp(argv[1], "test")) {
         if (!strcasecmp(argv[2], "ziplist")) {
             return ziplistTest(argc, argv);
         } else if (!strcasecmp(argv[2], "quicklist")) {
             quicklistTest(argc, argv);
+        } else if (!strcasecmp(argv[2], "listpack")) {
+            return listpackTest(argc, argv);
         } else if (!strcasecmp(argv[2], "intset")) {
             return intsetTest(argc, argv);
+        } else if (!strcasecmp(argv[2], "roaring")) {
+            return roaringTest(argc, argv);
         } else if (!strcasecmp(argv[2], "zipmap")) {
             return zipmapTest(argc, argv);
         } else if (!strcasecmp(argv[2], "sha1test")) {
@@ -5045,6 +5524,12 @@ int main(int argc, char **argv) {
             return endianconvTest(argc, argv);
         } else if (!strcasecmp(argv[2], "crc64")) {
             return crc64Test(argc, argv);
+        } else if (!strcasecmp(argv[2], "fdict")) {
+            return fdictTest(argc, argv);
+        } else if (!strcasecmp(argv[2], "ae")) {
+            return aeTest(argc, argv);
+        } else if (!strcasecmp(argv[2], "zset")) {
+            return zsetTest(argc, argv);
         }
 
         return -1; /* test not found */
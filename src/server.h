@@ -58,12 +58,15 @@ typedef long long mstime_t; /* millisecond time type. */
 #include "zmalloc.h" /* 总的内存使用 total memory usage aware version of malloc/free */
 #include "anet.h"    /* 简单方式的网络 Networking the easy way */
 #include "ziplist.h" /* 紧链表数据结构 Compact list data structure */
+#include "listpack.h" /* 紧凑列表 小hash和zset的编码 Compact list of small hashes and zsets */
 #include "intset.h"  /* 紧整数集合结构 Compact integer set structure */
+#include "roaring.h" /* 压缩的大整数集合 Compressed large integer sets */
 #include "version.h" /* 版本宏 Version macro */
 #include "util.h"    /* 杂项函数在很多地方都很有用 Misc functions useful in many places */
 #include "latency.h" /* 延迟监视器API Latency monitor API */
 #include "sparkline.h" /* ASCII图形API ASCII graphs API */
 #include "quicklist.h"
+#include "atomicvar.h" /* Atomic counters shared with I/O threads */
 
 /* Following includes allow test functions to be called from Redis main() */
 #include "zipmap.h"
@@ -89,6 +92,8 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CONFIG_MAX_LINE    1024 /*fgets函数最多读取的字符数*/
 #define CRON_DBS_PER_CALL 16 /*一次调用 遍历数据库的数量 */
 #define NET_MAX_WRITES_PER_EVENT (1024*64) /*一次事件可写的最大字节数 64kb*/
+#define NET_IO_BATCH 64 /* Clients per aeSubmitIO() call. */
+#define NET_IO_BATCH_IOV 16 /* Reply buffers per client in a batched write. */
 #define PROTO_SHARED_SELECT_CMDS 10 /*replicationFeedSlaves 的时候使用 省的创建对象了*/
 #define OBJ_SHARED_INTEGERS 10000 /*共享整数*/
 #define OBJ_SHARED_BULKHDR_LEN 32 /*字符串块*/
@@ -127,6 +132,7 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CONFIG_DEFAULT_RDB_FILENAME "dump.rdb"
 #define CONFIG_DEFAULT_REPL_DISKLESS_SYNC 0
 #define CONFIG_DEFAULT_REPL_DISKLESS_SYNC_DELAY 5
+#define CONFIG_DEFAULT_REPL_DISKLESS_LOAD REPL_DISKLESS_LOAD_DISABLED
 #define CONFIG_DEFAULT_SLAVE_SERVE_STALE_DATA 1
 #define CONFIG_DEFAULT_SLAVE_READ_ONLY 1
 #define CONFIG_DEFAULT_SLAVE_ANNOUNCE_IP NULL
@@ -146,10 +152,28 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CONFIG_BINDADDR_MAX 16
 #define CONFIG_MIN_RESERVED_FDS 32
 #define CONFIG_DEFAULT_LATENCY_MONITOR_THRESHOLD 0
+#define CONFIG_DEFAULT_IO_THREADS_NUM 1         /* Single threaded by default */
+#define CONFIG_DEFAULT_IO_THREADS_DO_READS 0    /* Read + parse from threads? */
+#define CONFIG_DEFAULT_EMBEDDED_KEYS 0      /* Keys inside the dictEntry? */
+#define CONFIG_DEFAULT_EXPIRE_INDEX 0       /* Keys ordered by expire time? */
+#define CONFIG_DEFAULT_RDB_LOAD_THREADS 1   /* Single threaded RDB loading. */
+#define CONFIG_DEFAULT_RDB_FORKLESS_SAVE 0  /* BGSAVE forks a child. */
+#define IO_THREADS_MAX_NUM 128
+#define RDB_LOAD_THREADS_MAX_NUM 64
+
+/* Stages of the RDB loading pipeline, see rdbLoadPipelined(). */
+#define RDB_LOAD_STAGE_READ 0       /* Read and decompress the file. */
+#define RDB_LOAD_STAGE_BUILD 1      /* Create the objects. */
+#define RDB_LOAD_STAGE_INSERT 2     /* Add the keys to the databases. */
+#define RDB_LOAD_STAGES 3
 
 #define ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP 20 /* Loopkups per loop. */
 #define ACTIVE_EXPIRE_CYCLE_FAST_DURATION 1000 /* Microseconds */
 #define ACTIVE_EXPIRE_CYCLE_SLOW_TIME_PERC 25 /* CPU max % for keys collection */
+#define ACTIVE_EXPIRE_CYCLE_ACCEPTABLE_STALE 10 /* % of stale keys after which
+                                                   we do extra efforts. */
+#define CONFIG_DEFAULT_ACTIVE_EXPIRE_EFFORT 1 /* From 1 to 10. */
+#define ACTIVE_REHASH_MAX_TIME_PERC 25 /* CPU max % for active rehashing. */
 #define ACTIVE_EXPIRE_CYCLE_SLOW 0
 #define ACTIVE_EXPIRE_CYCLE_FAST 1
 
@@ -158,15 +182,20 @@ typedef long long mstime_t; /* millisecond time type. */
 #define STATS_METRIC_COMMAND 0      /* 命令执行的数量 Number of commands executed. */
 #define STATS_METRIC_NET_INPUT 1    /* 从网络读取的字节数 Bytes read to network .*/
 #define STATS_METRIC_NET_OUTPUT 2   /* 写入网络的字节数 Bytes written to network. */
-#define STATS_METRIC_COUNT 3
+#define STATS_METRIC_EVICTIONS 3    /* 淘汰键的数量 Keys evicted (maxmemory). */
+#define STATS_METRIC_EXPIRE_CYCLE 4 /* Microseconds spent in expire cycles. */
+#define STATS_METRIC_COUNT 5
 
 /* 协议和输入输出关联的定义 Protocol and I/O related defines */
 #define PROTO_MAX_QUERYBUF_LEN  (1024*1024*1024) /* 1GB max query buffer. */
 #define PROTO_IOBUF_LEN         (1024*16)  /* Generic I/O buffer size */
 #define PROTO_REPLY_CHUNK_BYTES (16*1024) /* 16kb output buffer */
+#define CLIENT_BUFFERS_POOL_LEN 32 /* Max idle buffers of each kind kept. */
+#define PROTO_SHARED_REPLY_MIN_BYTES 1024 /* Smaller shared blocks are copied. */
 #define PROTO_INLINE_MAX_SIZE   (1024*64) /* Max size of inline reads */
 #define PROTO_MBULK_BIG_ARG     (1024*32)
 #define LONG_STR_SIZE      21          /* Bytes needed for long -> str + '\0' */
+#define MAX_D2STRING_CHARS 128         /* Bytes needed for d2string() */
 #define AOF_AUTOSYNC_BYTES (1024*1024*32) /* fdatasync every 32MB */
 
 /* When configuring the server eventloop, we setup it so that the total number
@@ -220,7 +249,10 @@ typedef long long mstime_t; /* millisecond time type. */
 #define OBJ_ENCODING_INTSET 6  /* Encoded as intset 编码为整数集合*/
 #define OBJ_ENCODING_SKIPLIST 7  /* Encoded as skiplist 编码为跳跃链表  ZSetEncoding*/
 #define OBJ_ENCODING_EMBSTR 8  /* Embedded sds string encoding 编码为嵌入式sds StringEncoding*/
-#define OBJ_ENCODING_QUICKLIST 9 /* Encoded as linked list of ziplists  编码为压缩列表的链表  ListEncoding * /
+#define OBJ_ENCODING_QUICKLIST 9 /* Encoded as linked list of ziplists  编码为压缩列表的链表  ListEncoding */
+#define OBJ_ENCODING_LISTPACK 10 /* Encoded as a listpack 编码为listpack HashEncoding ZSetEncoding */
+#define OBJ_ENCODING_BTREE 11 /* Encoded as a B+tree 编码为B+树 ZSetEncoding */
+#define OBJ_ENCODING_ROARING 12 /* Encoded as a roaring set 编码为roaring SetEncoding */
 
 /* Defines related to the dump file format. To store 32 bits lengths for short
  * keys requires a lot of space, so we check the most significant 2 bits of
@@ -285,6 +317,13 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CLIENT_REPLY_SKIP (1<<24)  /* 仅仅不发这个回复 Don't send just this reply. */
 #define CLIENT_LUA_DEBUG (1<<25)  /* Run EVAL in debug mode. */
 #define CLIENT_LUA_DEBUG_SYNC (1<<26)  /* EVAL debugging without fork() */
+#define CLIENT_PENDING_READ (1<<27) /* The client has pending reads and was put
+                                       in the list of clients we can read
+                                       from. */
+#define CLIENT_PENDING_COMMAND (1<<28) /* Used in threaded I/O to signal after
+                                          we return single threaded that the
+                                          client has already pending commands
+                                          to be executed. */
 
 /* Client block type (btype field in client structure)
  * if CLIENT_BLOCKED flag is set. */
@@ -343,6 +382,7 @@ typedef long long mstime_t; /* millisecond time type. */
 //https://blog.csdn.net/weixin_30565199/article/details/94981444
 //则将从节点客户端的能力属性slave_capa增加SLAVE_CAPA_EOF标记，表示该从节点支持无硬盘复制
 #define SLAVE_CAPA_EOF (1<<0)   /* Can parse the RDB EOF streaming format. */
+#define SLAVE_CAPA_PSYNC2 (1<<1) /* Supports PSYNC2 protocol. */
 
 /* Synchronous read timeout - slave side */
 #define CONFIG_REPL_SYNCIO_TIMEOUT 5
@@ -383,12 +423,19 @@ typedef long long mstime_t; /* millisecond time type. */
 #define AOF_FSYNC_EVERYSEC 2
 #define CONFIG_DEFAULT_AOF_FSYNC AOF_FSYNC_EVERYSEC
 
+/* Slave diskless load modes (repl-diskless-load). */
+#define REPL_DISKLESS_LOAD_DISABLED 0 /* Save the payload to disk first. */
+#define REPL_DISKLESS_LOAD_WHEN_DB_EMPTY 1 /* Socket only if no keys. */
+#define REPL_DISKLESS_LOAD_SWAPDB 2 /* Socket, serving the old data set. */
+
 /* Zip structure related defaults */
 #define OBJ_HASH_MAX_ZIPLIST_ENTRIES 512
 #define OBJ_HASH_MAX_ZIPLIST_VALUE 64
 #define OBJ_SET_MAX_INTSET_ENTRIES 512
+#define OBJ_SET_LARGE_ENCODING OBJ_ENCODING_HT
 #define OBJ_ZSET_MAX_ZIPLIST_ENTRIES 128
 #define OBJ_ZSET_MAX_ZIPLIST_VALUE 64
+#define OBJ_ZSET_LARGE_ENCODING OBJ_ENCODING_SKIPLIST
 
 /* List defaults */
 #define OBJ_LIST_MAX_ZIPLIST_SIZE -2
@@ -410,8 +457,23 @@ typedef long long mstime_t; /* millisecond time type. */
 #define MAXMEMORY_ALLKEYS_LRU 3 /* 当内存不足以容纳新写入数据时，在键空间中，移除最近最少使用的key*/
 #define MAXMEMORY_ALLKEYS_RANDOM 4 /*当内存不足以容纳新写入数据时，在键空间中，随机移除某个key。*/
 #define MAXMEMORY_NO_EVICTION 5 /*当内存不足以容纳新写入数据时，新写入操作会报错*/
+#define MAXMEMORY_VOLATILE_LFU 6 /* 在设置了过期时间的键空间中，移除访问频率最低的key */
+#define MAXMEMORY_ALLKEYS_LFU 7 /* 在键空间中，移除访问频率最低的key */
 #define CONFIG_DEFAULT_MAXMEMORY_POLICY MAXMEMORY_NO_EVICTION
 
+/* Policies that use the 'lru' field of objects as an access frequency
+ * counter instead of an access time. */
+#define MAXMEMORY_POLICY_IS_LFU(p) \
+    ((p) == MAXMEMORY_VOLATILE_LFU || (p) == MAXMEMORY_ALLKEYS_LFU)
+
+/* LFU policies: the 24 bits of obj->lru are split into a 16 bits access
+ * time in minutes (used to decay the counter) and an 8 bits logarithmic
+ * access counter. New objects start with LFU_INIT_VAL so that they are
+ * not evicted before having a chance to be accessed again. */
+#define LFU_INIT_VAL 5
+#define CONFIG_DEFAULT_LFU_LOG_FACTOR 10
+#define CONFIG_DEFAULT_LFU_DECAY_TIME 1
+
 /* 脚本 Scripting */
 #define LUA_SCRIPT_TIME_LIMIT 5000 /* milliseconds */
 
@@ -448,6 +510,11 @@ typedef long long mstime_t; /* millisecond time type. */
 #define RDB_CHILD_TYPE_DISK 1     /* RDB已经写入disk RDB is written to disk. */
 #define RDB_CHILD_TYPE_SOCKET 2   /* RDB已经写入slave socket RDB is written to slave socket. */
 
+/* True if a BGSAVE is in progress, either by a child or by the snapshot
+ * thread of rdb-forkless-save. */
+#define rdbSaveInProgress() \
+    (server.rdb_child_pid != -1 || server.rdb_thread_active)
+
 /*
  Keyspace更改通知类。为了配置目的，每个类都与一个字符相关联
 */
@@ -586,11 +653,19 @@ LRU_CLOCK_RESOLUTION = 1000
  *  空条目的键指针设置为NULL
  * Empty entries have the key pointer set to NULL. */
 #define MAXMEMORY_EVICTION_POOL_SIZE 16 /*最大内存淘汰池 大小 16*/
+#define EVPOOL_CACHED_SDS_SIZE 255  /* Keys up to this size are not allocated. */
 struct evictionPoolEntry {
-    unsigned long long idle;    /* Object idle time. 对象的空闲时间*/
+    unsigned long long idle;    /* Object idle time (inverse frequency for LFU). 对象的空闲时间*/
     sds key;                    /* Key name.  键名称*/
+    sds cached;                 /* Cached SDS object for key name. */
+    int dbid;                   /* Key DB number. 键所在的数据库 */
 };
 
+/* Max time freeMemoryIfNeeded() spends evicting keys in a single call.
+ * When more memory must be freed, serverCron() continues the eviction. */
+#define EVICTION_TIME_LIMIT_US 1000
+#define EVICTION_CRON_TIME_PERC 25  /* CPU max % for eviction in serverCron. */
+
 /*
  Redis数据库表现
  有多个数据库由从0（默认数据库）到最大配置数据库的整数标识
@@ -610,9 +685,11 @@ typedef struct redisDb {
      Compare-and-Swap（比较并交换）
     */
     dict *watched_keys;         /* 被观察的键 为MULTI/EXEC  WATCHED keys for MULTI/EXEC CAS */
-    struct evictionPoolEntry *eviction_pool;    /* 键过期池 Eviction pool of keys */
     int id;                     /* 数据库ID Database ID */
     long long avg_ttl;          /* 数据库键的平均TTL，统计信息 Average TTL, just for stats 统计数据*/
+    double stale_ratio;         /* Estimated ratio of logically expired keys
+                                   among the keys with an expire. */
+    struct zskiplist *expires_index; /* Keys by expire time, or NULL. */
 } redisDb;
 
 /* 客户端 事务 状态*/
@@ -689,6 +766,7 @@ typedef struct client {
     int dictid;             /* 当前数据库id ID of the currently SELECTed DB. */
     robj *name;             /* 通过设置名称来设置 As set by CLIENT SETNAME. */
     sds querybuf;           /* 客户端发送的命令会存储在这里 用于累积客户端查询的缓冲区 Buffer we use to accumulate client queries. */
+    size_t qb_pos;          /* querybuf中已经解析到的位置 The position we have read in querybuf. */
     size_t querybuf_peak;   /* 最近（100ms或以上）查询大小的峰值 Recent (100ms or more) peak of querybuf size. */
     int argc;               /* 当前命令参数数量 Num of arguments of current command. */
     robj **argv;            /* 当前命令的参数 已经是robj了 Arguments of current command. */
@@ -713,7 +791,8 @@ typedef struct client {
     off_t repldboff;        /* 复制数据库文件offset Replication DB file offset. */
     off_t repldbsize;       /* 复制数据库文件大小 Replication DB file size. */
     sds replpreamble;       /* 复制数据库序言 Replication DB preamble. */
-    long long reploff;      /* 复制偏移 Replication offset if this is our master. */
+    long long read_reploff; /* Read replication offset if this is a master. */
+    long long reploff;      /* 复制偏移 Applied replication offset if this is a master. */
     long long repl_ack_off; /* slave的 复制ack 偏移， Replication ack offset, if this is a slave. */
     long long repl_ack_time;/* slave的 复制ack 时间 Replication ack time, if this is a slave. */
     long long psync_initial_offset; /* FULLRESYNC应答偏移量
@@ -721,7 +800,10 @@ typedef struct client {
                                         FULLRESYNC reply offset other slaves
                                        copying this slave output buffer
                                        should use. */
-    char replrunid[CONFIG_RUN_ID_SIZE+1]; /* master的 run id Master run id if is a master. */
+    char replrunid[CONFIG_RUN_ID_SIZE+1]; /* master的 run id Master replication ID if is a master. */
+    sds pending_querybuf;   /* If this is a master, this buffer represents the
+                               yet not applied replication stream that we
+                               are receiving from the master. */
     int slave_listening_port; /* 配置 监听端口 As configured with: REPLCONF listening-port */
     char slave_ip[NET_IP_STR_LEN]; /* 配置 ip地址 Optionally given by REPLCONF ip-address */
     int slave_capa;         /*  从服务能力：SLAVE_CAPA_* 按位或运算 Slave capabilities: SLAVE_CAPA_* bitwise OR. */
@@ -736,7 +818,7 @@ typedef struct client {
 
     /* 反应缓冲区 Response buffer */
     int bufpos;
-    char buf[PROTO_REPLY_CHUNK_BYTES]; //16kb
+    char *buf; //16kb 按需分配 空闲时还给池 NULL when not in use.
 } client;
 
 struct saveparam {
@@ -804,9 +886,47 @@ typedef struct zskiplist {
     int level;
 } zskiplist;
 
+/* B+tree used by the "btree" sorted set encoding, see zset-large-encoding.
+ * Elements are stored in the leaves ordered by score and then by member, and
+ * the leaves are linked so that ranges are walked without going back to the
+ * root. Internal nodes keep, for every child, the greatest element below it
+ * and the number of elements below it, so ranks are found in O(log(N)).
+ * 叶子节点用两个连续数组保存score和成员 没有跳表每个节点的层级数组 */
+#define ZBTREE_FANOUT 64
+
+typedef struct zbtreeNode {
+    int leaf;                       /* Leaf or internal node? */
+    int num;                        /* Number of used slots. */
+    struct zbtreeNode *prev, *next; /* Sibling leaves, unused if internal. */
+    double score[ZBTREE_FANOUT];    /* Leaf: scores. Internal: greatest score
+                                       of every child. */
+    robj *obj[ZBTREE_FANOUT];       /* Leaf: members. Internal: greatest member
+                                       of every child (not referenced). */
+    /* The fields below are only allocated for internal nodes. */
+    unsigned long count[ZBTREE_FANOUT]; /* Elements below every child. */
+    struct zbtreeNode *child[ZBTREE_FANOUT];
+} zbtreeNode;
+
+typedef struct zbtree {
+    zbtreeNode *root;
+    zbtreeNode *head, *tail;        /* First and last leaf. */
+    unsigned long length;
+} zbtree;
+
+/* Position of an element, used to iterate the B+tree leaves. */
+typedef struct zbtreePos {
+    zbtreeNode *leaf;
+    int idx;
+} zbtreePos;
+
+#define zbtPosScore(p) ((p)->leaf->score[(p)->idx])
+#define zbtPosObj(p) ((p)->leaf->obj[(p)->idx])
+
 typedef struct zset {
     dict *dict;/* 字典，用于存储 value 和 score 的映射关系，查询 O(1) */
     zskiplist *zsl;/* 真正的跳表 zset skip list */
+    zbtree *zbt; /* OBJ_ENCODING_BTREE 时代替跳表, the dict then stores the
+                    scores by value. */
 } zset;
 
 typedef struct clientBufferLimitsConfig {
@@ -905,6 +1025,7 @@ struct redisServer {
     list *clients;              /* 活跃的客户端列表 List of active clients */ //维护的客户端双端链表
     list *clients_to_close;     /* 需要异步关闭的客户端 Clients to close asynchronously */
     list *clients_pending_write; /* 有写的或者安装handler There is to write or install handler. */
+    list *clients_pending_read;  /* Client has pending read socket buffers. */
     list *slaves, *monitors;    /* salve和monitor的列表 List of slaves and MONITORs */ //双端链表
     client *current_client; /* 崩溃报告 用 Current client, only used on crash report */
     int clients_paused;         /* 客户端暂停就是true True if clients are currently paused */
@@ -913,12 +1034,25 @@ struct redisServer {
     dict *migrate_cached_sockets;/* MIGRATE cached sockets */
     uint64_t next_client_id;    /* 下一个客户端唯一标识符 Next client unique ID. Incremental. */
     int protected_mode;         /* 不接受外部链接 Don't accept external connections. */
+    /* Threaded I/O */
+    int io_threads_num;         /* Number of IO threads to use. */
+    int io_threads_do_reads;    /* Read and parse from IO threads? */
+    int embedded_keys;          /* Copy keyspace keys inside dict entries. */
+    int expire_index;           /* Index the keys by expire time. */
+    int io_threads_active;      /* Is the threaded I/O active? */
     /* RDB / AOF loading information */
     int loading;                /* true的时候代表我们正在从磁盘加载数据 We are loading data from disk if true */
+    int async_loading;          /* Loading the master payload while serving
+                                   the old data set (repl-diskless-load). */
     off_t loading_total_bytes; //加载的总字节数
     off_t loading_loaded_bytes;//加载的字节数
     time_t loading_start_time; //加载开始时间
     off_t loading_process_events_interval_bytes;
+    int rdb_load_threads;       /* Threads used to load RDB files. */
+    int loading_threads;        /* Threads of the running load, 0 if one. */
+    long long loading_stage_start;  /* Pipeline start time in microseconds. */
+    long long loading_stage_items[RDB_LOAD_STAGES]; /* Bytes/keys processed. */
+    long long loading_stage_busy[RDB_LOAD_STAGES];  /* Busy microseconds. */
     /* Fast pointers to often looked up command */
     /*快速指针 指向经常查找的命令 */
     struct redisCommand *delCommand, *multiCommand, *lpushCommand, *lpopCommand,
@@ -929,7 +1063,12 @@ struct redisServer {
     long long stat_numcommands;     /* 处理命令的数量 Number of processed commands */
     long long stat_numconnections;  /* 接收连接的数量 Number of connections received */
     long long stat_expiredkeys;     /* 过期键的数量 Number of expired keys */
+    long long stat_expired_time_cap_reached_count; /* Early expire cycle stops.*/
+    long long stat_expire_cycle_time_used; /* Microseconds of expire cycles. */
     long long stat_evictedkeys;     /* 淘汰键的数量 Number of evicted keys (maxmemory) */
+    long long stat_evicted_samples; /* Keys sampled to pick the evicted ones. */
+    long long stat_eviction_time;   /* Microseconds spent evicting keys. */
+    int eviction_pending;           /* Eviction stopped by the time limit. */
     long long stat_keyspace_hits;   /* 成功查找键的次数 Number of successful lookups of keys */
     long long stat_keyspace_misses; /* 失败查找键的次数 Number of failed lookups of keys */
     size_t stat_peak_memory;        /* 最大使用内存记录 Max used memory record */
@@ -946,6 +1085,15 @@ struct redisServer {
     size_t resident_set_size;       /* RSS sampled in serverCron(). */
     long long stat_net_input_bytes; /* 从网络读取的字节数 Bytes read from network. */
     long long stat_net_output_bytes; /* Bytes written to network. */
+    long long stat_io_reads_processed; /* Number of read events processed by IO threads */
+    long long stat_io_writes_processed; /* Number of write events processed by IO threads */
+    long long stat_reply_write_syscalls; /* writev() calls sending replies. */
+    long long stat_reply_write_bytes;    /* Bytes sent by these calls. */
+    long long stat_snapshots;       /* Forkless BGSAVEs started. */
+    long long stat_snapshot_preserved_keys;  /* Key versions preserved and */
+    long long stat_snapshot_preserved_bytes; /* their serialized size. */
+    long long stat_snapshot_last_preserved_keys; /* Of the last snapshot. */
+    long long stat_snapshot_write_waits; /* Accesses waiting for the thread. */
     /* The following two are used to track instantaneous metrics, like
      * number of operations per second, network traffic. */
     struct {
@@ -959,6 +1107,7 @@ struct redisServer {
     int maxidletime;                /* 客户端最大超时时间（秒） Client timeout in seconds */
     int tcpkeepalive;               /* 不是0就是设置SO_KEEPALIVE Set SO_KEEPALIVE if non-zero. */
     int active_expire_enabled;      /* 测试的时候可以禁用 Can be disabled for testing purposes. */
+    int active_expire_effort;       /* From 1 (default) to 10, active effort. */
     size_t client_max_querybuf_len; /* 客户端查询缓冲区长度限制 Limit for client query buffer length */
     int dbnum;                      /* 配置的数据库数量 Total number of configured DBs */
     int supervised;                 /* 1 if supervised, 0 otherwise. */
@@ -1015,6 +1164,8 @@ struct redisServer {
     time_t rdb_save_time_start;     /* Current RDB save start time. */
     int rdb_bgsave_scheduled;       /* 可能的话使用BGSAVE BGSAVE when possible if true. */
     int rdb_child_type;             /* Type of save by active child. */
+    int rdb_forkless_save;          /* BGSAVE from a thread, see snapshot.c */
+    int rdb_thread_active;          /* A forkless BGSAVE is in progress. */
     int lastbgsave_status;          /* C_OK or C_ERR */
     int stop_writes_on_bgsave_err;  /* Don't allow writes if can't BGSAVE */
     int rdb_pipe_write_result_to_parent; /* RDB pipes used to return the state */
@@ -1028,7 +1179,10 @@ struct redisServer {
     int syslog_facility;            /* Syslog facility */
     /* Replication (master) */
     int slaveseldb;                 /* Last SELECTed DB in replication output */
+    char replid[CONFIG_RUN_ID_SIZE+1];  /* My current replication ID. */
+    char replid2[CONFIG_RUN_ID_SIZE+1]; /* replid inherited from master. */
     long long master_repl_offset;   /* 全局复制偏移 Global replication offset */
+    long long second_replid_offset; /* Accept offsets up to this for replid2. */
     int repl_ping_slave_period;     /* Master pings the slave every N seconds */
 
     /*
@@ -1051,6 +1205,8 @@ struct redisServer {
     int repl_good_slaves_count;     /* Number of slaves with lag <= max_lag. */
     int repl_diskless_sync;         /* Send RDB to slaves sockets directly. */
     int repl_diskless_sync_delay;   /* Delay to start a diskless repl BGSAVE. */
+    int repl_diskless_load;         /* Slave parses the RDB from the socket.
+                                       See REPL_DISKLESS_LOAD_* */
     /* Replication (slave) */
     char *masterauth;               /* 主服务密码 AUTH with this password with master */
     char *masterhost;               /* 主服务的地址 Hostname of master */
@@ -1074,7 +1230,7 @@ struct redisServer {
     int slave_priority;             /* Reported in INFO and used by Sentinel. */
     int slave_announce_port;        /* Give the master this listening port. */
     char *slave_announce_ip;        /* Give the master this ip address. */
-    char repl_master_runid[CONFIG_RUN_ID_SIZE+1];  /* Master run id for PSYNC.*/
+    char repl_master_runid[CONFIG_RUN_ID_SIZE+1];  /* Master replication ID for PSYNC. */
     long long repl_master_initial_offset;         /* Master PSYNC offset. */
     /* Replication script cache. */
     dict *repl_scriptcache_dict;        /* SHA1 all slaves are aware of. */
@@ -1088,6 +1244,8 @@ struct redisServer {
     unsigned long long maxmemory;   /* 最大可以使用的内存 Max number of memory bytes to use */
     int maxmemory_policy;           /* 键淘汰策略 Policy for key eviction */
     int maxmemory_samples;          /* 随机抽样的精度 Pricision of random sampling */
+    int lfu_log_factor;             /* LFU logarithmic counter factor. */
+    int lfu_decay_time;             /* LFU counter decay time in minutes. */
     /* Blocked clients */
     unsigned int bpop_blocked_clients; /* Number of clients blocked by lists */
     list *unblocked_clients; /* list of clients to unblock before next loop */
@@ -1102,8 +1260,12 @@ struct redisServer {
     size_t hash_max_ziplist_entries;
     size_t hash_max_ziplist_value;
     size_t set_max_intset_entries;
+    int set_large_encoding;         /* Encoding of integer sets too big for an
+                                       intset: OBJ_ENCODING_HT or _ROARING. */
     size_t zset_max_ziplist_entries;
     size_t zset_max_ziplist_value;
+    int zset_large_encoding;        /* Encoding of zsets too big for a listpack:
+                                       OBJ_ENCODING_SKIPLIST or _BTREE. */
     size_t hll_sparse_max_bytes;
     /* List parameters */
     int list_max_ziplist_size;
@@ -1221,6 +1383,7 @@ typedef struct {
     int encoding;
     int ii; /* intset iterator */
     dictIterator *di;
+    roaringIterator ri;
 } setTypeIterator;
 
 /* Structure to hold hash iteration abstraction. Note that iteration over
@@ -1251,11 +1414,27 @@ extern dictType zsetDictType; //有序集合字典类型
 extern dictType clusterNodesDictType;
 extern dictType clusterNodesBlackListDictType;
 extern dictType dbDictType;
+extern dictType dbEmbeddedKeysDictType;
+extern dictType keyptrDictType;
+extern dictType snapshotKeysDictType;
 extern dictType shaScriptObjectDictType;
 extern double R_Zero, R_PosInf, R_NegInf, R_Nan;
 extern dictType hashDictType;
 extern dictType replScriptCacheDictType;
 
+/* The keyspace dictionaries (main and expires) use the flat bucketed hash
+ * tables of fdict.c when compiled with "make USE_FLAT_KEYSPACE=yes". Flat
+ * tables store keys in their slots, so "embedded-keys" only applies to the
+ * chained tables of dict.c. */
+#ifdef USE_FLAT_KEYSPACE
+#define keyspaceDictCreate(type) dictCreateFlat(type,NULL)
+#define keyspaceMainDictType() (&dbDictType)
+#else
+#define keyspaceDictCreate(type) dictCreate(type,NULL)
+#define keyspaceMainDictType() \
+    (server.embedded_keys ? &dbEmbeddedKeysDictType : &dbDictType)
+#endif
+
 /*-----------------------------------------------------------------------------
  * Functions prototypes
  *----------------------------------------------------------------------------*/
@@ -1279,6 +1458,7 @@ void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask);
 void *addDeferredMultiBulkLength(client *c);
 void setDeferredMultiBulkLength(client *c, void *node, long length);
 void processInputBuffer(client *c);
+void processInputBufferAndReplicate(client *c);
 void acceptHandler(aeEventLoop *el, int fd, void *privdata, int mask);
 void acceptTcpHandler(aeEventLoop *el, int fd, void *privdata, int mask);
 void acceptUnixHandler(aeEventLoop *el, int fd, void *privdata, int mask);
@@ -1289,6 +1469,8 @@ void addReplyBulkCBuffer(client *c, const void *p, size_t len);
 void addReplyBulkLongLong(client *c, long long ll);
 void addReply(client *c, robj *obj);
 void addReplySds(client *c, sds s);
+void addReplyShared(client *c, robj *block);
+void addReplyString(client *c, const char *s, size_t len);
 void addReplyBulkSds(client *c, sds s);
 void addReplyError(client *c, const char *err);
 void addReplyStatus(client *c, const char *status);
@@ -1300,6 +1482,11 @@ void copyClientOutputBuffer(client *dst, client *src);
 void *dupClientReplyValue(void *o);
 void getClientsMaxBuffers(unsigned long *longest_output_list,
                           unsigned long *biggest_input_buffer);
+size_t getClientsBuffersMemory(void);
+size_t getClientBuffersPoolMemory(void);
+void trimClientBuffersPool(void);
+void releaseClientReplyBuffer(client *c);
+void releaseClientQueryBuffer(client *c);
 char *getClientPeerId(client *client);
 sds catClientInfoString(sds s, client *client);
 sds getAllClientsInfoString(void);
@@ -1307,6 +1494,7 @@ void rewriteClientCommandVector(client *c, int argc, ...);
 void rewriteClientCommandArgument(client *c, int i, robj *newval);
 void replaceClientCommandVector(client *c, int argc, robj **argv);
 unsigned long getClientOutputBufferMemoryUsage(client *c);
+unsigned long getClientOutputBufferMemoryShare(client *c);
 void freeClientsInAsyncFreeQueue(void);
 void asyncCloseClientOnOutputBufferLimitReached(client *c);
 int getClientType(client *c);
@@ -1322,6 +1510,11 @@ int handleClientsWithPendingWrites(void);
 int clientHasPendingReplies(client *c);
 void unlinkClient(client *c);
 int writeToClient(int fd, client *c, int handler_installed);
+void initThreadedIO(void);
+void killIOThreads(void);
+int handleClientsWithPendingReadsUsingThreads(void);
+int handleClientsWithPendingWritesUsingThreads(void);
+int stopThreadedIOIfNeeded(void);
 
 #ifdef __GNUC__
 void addReplyErrorFormat(client *c, const char *fmt, ...)
@@ -1387,9 +1580,10 @@ robj *createQuicklistObject(void);
 robj *createZiplistObject(void);
 robj *createSetObject(void);
 robj *createIntsetObject(void);
+robj *createRoaringObject(void);
 robj *createHashObject(void);
 robj *createZsetObject(void);
-robj *createZsetZiplistObject(void);
+robj *createZsetListpackObject(void);
 int getLongFromObjectOrReply(client *c, robj *o, long *target, const char *msg);
 int checkType(client *c, robj *o, int type);
 int getLongLongFromObjectOrReply(client *c, robj *o, long long *target, const char *msg);
@@ -1402,6 +1596,9 @@ int compareStringObjects(robj *a, robj *b);
 int collateStringObjects(robj *a, robj *b);
 int equalStringObjects(robj *a, robj *b);
 unsigned long long estimateObjectIdleTime(robj *o);
+unsigned int objectInitialLRU(void);
+void updateLFU(robj *o);
+unsigned long LFUDecrAndReturn(robj *o);
 #define sdsEncodedObject(objptr) (objptr->encoding == OBJ_ENCODING_RAW || objptr->encoding == OBJ_ENCODING_EMBSTR)
 
 /* Synchronous I/O with timeout */
@@ -1411,6 +1608,7 @@ ssize_t syncReadLine(int fd, char *ptr, ssize_t size, long long timeout);
 
 /* Replication */
 void replicationFeedSlaves(list *slaves, int dictid, robj **argv, int argc);
+void replicationFeedSlavesFromMasterStream(list *slaves, char *buf, size_t buflen);
 void replicationFeedMonitors(client *c, list *monitors, int dictid, robj **argv, int argc);
 void updateSlavesWaitingBgsave(int bgsaveerr, int type);
 void replicationCron(void);
@@ -1428,14 +1626,22 @@ void processClientsWaitingReplicas(void);
 void unblockClientWaitingReplicas(client *c);
 int replicationCountAcksByOffset(long long offset);
 void replicationSendNewlineToMaster(void);
+void disklessLoadProcessEvents(void);
 long long replicationGetSlaveOffset(void);
 char *replicationGetSlaveName(client *c);
 long long getPsyncInitialOffset(void);
 int replicationSetupSlaveForFullResync(client *slave, long long offset);
+void changeReplicationId(void);
+void clearReplicationId2(void);
+void createReplicationBacklog(void);
+void replicationCacheMasterUsingMyself(void);
 
 /* Generic persistence functions */
-void startLoading(FILE *fp);
+void startLoading(off_t size);
+void startLoadingFile(FILE *fp);
 void loadingProgress(off_t pos);
+double loadingStageThroughput(int stage);
+double loadingStageBusyPerc(int stage);
 void stopLoading(void);
 
 /* RDB persistence */
@@ -1470,6 +1676,7 @@ typedef struct {
 zskiplist *zslCreate(void);
 void zslFree(zskiplist *zsl);
 zskiplistNode *zslInsert(zskiplist *zsl, double score, robj *obj);
+zskiplist *zslCreateFromSorted(double *scores, robj **objs, unsigned long len);
 unsigned char *zzlInsert(unsigned char *zl, robj *ele, double score);
 int zslDelete(zskiplist *zsl, double score, robj *obj);
 zskiplistNode *zslFirstInRange(zskiplist *zsl, zrangespec *range);
@@ -1479,9 +1686,29 @@ void zzlNext(unsigned char *zl, unsigned char **eptr, unsigned char **sptr);
 void zzlPrev(unsigned char *zl, unsigned char **eptr, unsigned char **sptr);
 unsigned int zsetLength(robj *zobj);
 void zsetConvert(robj *zobj, int encoding);
-void zsetConvertToZiplistIfNeeded(robj *zobj, size_t maxelelen);
+void zsetConvertToListpackIfNeeded(robj *zobj, size_t maxelelen);
 int zsetScore(robj *zobj, robj *member, double *score);
+double zsetDictScore(zset *zs, const dictEntry *de);
+void zsetAddNewElement(zset *zs, double score, robj *ele);
+zset *zsetCreateFromSorted(int encoding, double *scores, robj **objs, unsigned long len);
+void zsetAddBulk(robj *zobj, robj **eles, double *scores, int elements, int flags, int *added, int *updated, int *processed);
+#ifdef REDIS_TEST
+int zsetTest(int argc, char *argv[]);
+#endif
 unsigned long zslGetRank(zskiplist *zsl, double score, robj *o);
+zbtree *zbtCreate(void);
+void zbtFree(zbtree *zbt);
+void zbtInsert(zbtree *zbt, double score, robj *obj);
+zbtree *zbtCreateFromSorted(double *scores, robj **objs, unsigned long len);
+int zbtDelete(zbtree *zbt, double score, robj *obj);
+int zbtFirst(zbtree *zbt, zbtreePos *pos);
+int zbtLast(zbtree *zbt, zbtreePos *pos);
+int zbtNext(zbtreePos *pos);
+int zbtPrev(zbtreePos *pos);
+int zbtFirstInRange(zbtree *zbt, zrangespec *range, zbtreePos *pos);
+int zbtLastInRange(zbtree *zbt, zrangespec *range, zbtreePos *pos);
+unsigned long zbtGetRank(zbtree *zbt, double score, robj *o);
+int zbtGetElementByRank(zbtree *zbt, unsigned long rank, zbtreePos *pos);
 
 /*
  核心函数
@@ -1552,7 +1779,7 @@ unsigned long hashTypeLength(robj *o);
 hashTypeIterator *hashTypeInitIterator(robj *subject);
 void hashTypeReleaseIterator(hashTypeIterator *hi);
 int hashTypeNext(hashTypeIterator *hi);
-void hashTypeCurrentFromZiplist(hashTypeIterator *hi, int what,
+void hashTypeCurrentFromListpack(hashTypeIterator *hi, int what,
                                 unsigned char **vstr,
                                 unsigned int *vlen,
                                 long long *vll);
@@ -1585,6 +1812,8 @@ int rewriteConfig(char *path);
 int removeExpire(redisDb *db, robj *key);
 void propagateExpire(redisDb *db, robj *key);
 int expireIfNeeded(redisDb *db, robj *key);
+void expireIndexDelete(redisDb *db, robj *key);
+unsigned long expireIndexCount(redisDb *db, long long when);
 long long getExpire(redisDb *db, robj *key);
 void setExpire(redisDb *db, robj *key, long long when);
 robj *lookupKey(redisDb *db, robj *key, int flags);
@@ -1602,10 +1831,14 @@ int dbExists(redisDb *db, robj *key);
 robj *dbRandomKey(redisDb *db);
 int dbDelete(redisDb *db, robj *key);
 robj *dbUnshareStringValue(redisDb *db, robj *key, robj *o);
-long long emptyDb(void(callback)(void*));
+#define EMPTYDB_NO_FLAGS 0      /* No flags. */
+#define EMPTYDB_ASYNC (1<<0)    /* Reclaim memory in another thread. */
+long long emptyDb(int dbnum, int flags, void(callback)(void*));
 int selectDb(client *c, int id);
 void signalModifiedKey(redisDb *db, robj *key);
 void signalFlushedDb(int dbid);
+void slotToKeyDel(sds key);
+void slotToKeyFlush(void);
 unsigned int getKeysInSlot(unsigned int hashslot, robj **keys, unsigned int count);
 unsigned int countKeysInSlot(unsigned int hashslot);
 unsigned int delKeysInSlot(unsigned int hashslot);
@@ -1613,10 +1846,32 @@ int verifyClusterConfigWithData(void);
 void scanGenericCommand(client *c, robj *o, unsigned long cursor);
 int parseScanCursorOrReply(client *c, robj *o, unsigned long *cursor);
 
+/* lazyfree.c -- Background freeing of values and databases */
+int dbAsyncDelete(redisDb *db, robj *key);
+void emptyDbAsync(redisDb *db);
+void slotToKeyFlushAsync(void);
+void freeDbKeyspaceAsync(redisDb *db);
+void freeSlotToKeyAsync(dict **slots);
+size_t lazyfreeGetPendingObjectsCount(void);
+size_t lazyfreeGetFreeEffort(robj *obj);
+void lazyfreeFreeObjectFromBioThread(robj *o);
+void lazyfreeFreeDatabaseFromBioThread(dict *ht1, dict *ht2);
+void lazyfreeFreeSkiplistFromBioThread(zskiplist *sl);
+void lazyfreeFreeSlotsMapFromBioThread(dict **slots);
+
+/* snapshot.c -- Forkless BGSAVE */
+int snapshotStart(char *filename);
+void snapshotAbort(void);
+void snapshotCron(void);
+void snapshotBeforeRead(redisDb *db, robj *key);
+void snapshotBeforeWrite(redisDb *db, robj *key);
+void snapshotBeforeEmptyDb(int dbnum);
+
 /* API to get key arguments from commands */
 int *getKeysFromCommand(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
 void getKeysFreeResult(int *result);
 int *zunionInterGetKeys(struct redisCommand *cmd,robj **argv, int argc, int *numkeys);
+int *sintercardGetKeys(struct redisCommand *cmd,robj **argv, int argc, int *numkeys);
 int *evalGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
 int *sortGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
 int *migrateGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
@@ -1686,6 +1941,7 @@ void incrbyfloatCommand(client *c);
 void selectCommand(client *c);
 void randomkeyCommand(client *c);
 void keysCommand(client *c);
+void unlinkCommand(client *c);
 void scanCommand(client *c);
 void dbsizeCommand(client *c);
 void lastsaveCommand(client *c);
@@ -1718,6 +1974,7 @@ void spopCommand(client *c);
 void srandmemberCommand(client *c);
 void sinterCommand(client *c);
 void sinterstoreCommand(client *c);
+void sintercardCommand(client *c);
 void sunionCommand(client *c);
 void sunionstoreCommand(client *c);
 void sdiffCommand(client *c);
@@ -1741,6 +1998,7 @@ void ttlCommand(client *c);
 void touchCommand(client *c);
 void pttlCommand(client *c);
 void persistCommand(client *c);
+void expiringCommand(client *c);
 void slaveofCommand(client *c);
 void roleCommand(client *c);
 void debugCommand(client *c);
@@ -0,0 +1,611 @@
+/* Forkless point-in-time snapshots.
+ *
+ * When "rdb-forkless-save" is enabled BGSAVE does not fork(): the RDB file is
+ * written by a thread of the server process, so no page tables need to be
+ * copied and no memory page is duplicated by copy-on-write while the
+ * snapshot is in progress.
+ *
+ * The main thread walks every DB with dictScan(), a few buckets at a time,
+ * and queues the keys found (a copy of the key, a reference to the value and
+ * the expire) to the snapshot thread, that serializes them with
+ * rdbSaveKeyValuePair(). The data set saved is the one existing when the
+ * snapshot started, like for the fork() based BGSAVE:
+ *
+ * 1) The position of a key in the scan is the reversed hash of the key, so
+ *    for every key we know if it was already scanned or not comparing its
+ *    position with the scan cursor.
+ * 2) Before a key that was not scanned yet is modified, deleted or created,
+ *    the main thread serializes its current version (if any) in a buffer
+ *    that is queued to the thread as it is. The key is then added to a set
+ *    of handled keys, so that the scan will skip it later.
+ * 3) A scanned key is only accessed by the thread as long as the batch
+ *    containing it was not written. Accessing such a key from the main
+ *    thread waits for the thread to write the batch, that is bounded to a
+ *    few thousands keys. This never happens for keys not scanned, or
+ *    scanned and already written.
+ *
+ * So every key is saved exactly once, with the value it had when the
+ * snapshot started, and the memory used by the snapshot is just the one of
+ * the preserved versions of the keys modified during the snapshot.
+ *
+ * ----------------------------------------------------------------------------
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "server.h"
+
+#include <sys/param.h>
+
+#define SNAPSHOT_BATCH_KEYS 128         /* Keys per batch of scanned keys. */
+#define SNAPSHOT_MAX_QUEUED_KEYS 4096   /* Max scanned keys not yet written. */
+
+#define SNAPSHOT_JOB_KEYS 0     /* Scanned keys to serialize. */
+#define SNAPSHOT_JOB_BLOB 1     /* Key already serialized by the main thread. */
+#define SNAPSHOT_JOB_END 2      /* Scan completed, write the RDB footer. */
+
+typedef struct snapshotKey {
+    sds key;                /* Copy of the key. */
+    robj *val;              /* Value, with a reference owned by the job. */
+    long long expire;       /* Expire in milliseconds or -1. */
+    uint64_t pos;           /* Position in the scan of the DB. */
+} snapshotKey;
+
+typedef struct snapshotJob {
+    int type;               /* SNAPSHOT_JOB_* */
+    int dbid;
+    snapshotKey *keys;      /* SNAPSHOT_JOB_KEYS */
+    int numkeys, size;
+    int end_db;             /* Scan position reached by this batch: */
+    uint64_t end_pos;       /* all the keys before it were queued. */
+    sds blob;               /* SNAPSHOT_JOB_BLOB */
+} snapshotJob;
+
+static struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t job_cond;    /* Signaled when jobs are queued. */
+    pthread_cond_t done_cond;   /* Signaled when a job was written. */
+    list *jobs;                 /* Jobs queued to the thread, in order. */
+    long long queued_keys;      /* Scanned keys in the queued jobs. */
+    int done_db;                /* All the scanned keys before this */
+    uint64_t done_pos;          /* position were written and released. */
+    int abort;                  /* Asks the thread to exit ASAP. */
+    int finished;               /* The thread wrote the footer. */
+    int error;                  /* errno of the first write error, or 0. */
+    /* The fields below are only used by the main thread, except 'fp' and
+     * 'rdb' that belong to the snapshot thread while it runs. */
+    FILE *fp;
+    rio rdb;
+    char tmpfile[256];
+    char *filename;
+    long long now;              /* Keys expired at this time are not saved. */
+    int scan_db;                /* The scan position: every key before it */
+    uint64_t scan_pos;          /* was queued or preserved. */
+    unsigned long cursor;       /* dictScan() cursor of scan_db. */
+    snapshotJob *batch;         /* Batch being filled by the scan. */
+    dict **handled;             /* Per DB keys preserved or created. */
+    int notify_pipe[2];         /* The thread wakes up the main thread. */
+    long long preserved_keys;   /* Preserved key versions of this snapshot. */
+} snap;
+
+/* The position of a key in the scan: dictScan() visits the buckets in the
+ * order of the reversed bits of the bucket index, so the reversed hash of a
+ * key says when its bucket is visited whatever the size of the table is. */
+static uint64_t snapshotReverseBits(uint64_t v) {
+    uint64_t r = 0;
+    int j;
+
+    for (j = 0; j < 64; j++) {
+        r = (r << 1) | (v & 1);
+        v >>= 1;
+    }
+    return r;
+}
+
+static uint64_t snapshotKeyPos(redisDb *db, sds key) {
+    return snapshotReverseBits(dictHashKey(db->dict,key));
+}
+
+/* Compare two positions (DB, position in the DB) of the scan. */
+static int snapshotPosCmp(int db1, uint64_t pos1, int db2, uint64_t pos2) {
+    if (db1 != db2) return (db1 < db2) ? -1 : 1;
+    if (pos1 != pos2) return (pos1 < pos2) ? -1 : 1;
+    return 0;
+}
+
+static snapshotJob *snapshotCreateJob(int type, int dbid) {
+    snapshotJob *job = zcalloc(sizeof(*job));
+
+    job->type = type;
+    job->dbid = dbid;
+    return job;
+}
+
+/* Release the job and the references to the keys and values it holds. */
+static void snapshotFreeJob(snapshotJob *job) {
+    int j;
+
+    for (j = 0; j < job->numkeys; j++) {
+        sdsfree(job->keys[j].key);
+        decrRefCount(job->keys[j].val);
+    }
+    zfree(job->keys);
+    sdsfree(job->blob);
+    zfree(job);
+}
+
+static void snapshotQueueJob(snapshotJob *job) {
+    pthread_mutex_lock(&snap.lock);
+    listAddNodeTail(snap.jobs,job);
+    snap.queued_keys += job->numkeys;
+    pthread_cond_signal(&snap.job_cond);
+    pthread_mutex_unlock(&snap.lock);
+}
+
+/* Queue the batch being filled by the scan, if any, even when empty: it
+ * still moves forward the position written by the thread. */
+static void snapshotQueueBatch(void) {
+    if (snap.batch == NULL) return;
+    snap.batch->end_db = snap.scan_db;
+    snap.batch->end_pos = snap.scan_pos;
+    snapshotQueueJob(snap.batch);
+    snap.batch = NULL;
+}
+
+/* Wait for the thread to write all the scanned keys before the specified
+ * position. */
+static void snapshotWaitWritten(int dbid, uint64_t pos) {
+    long long start;
+    mstime_t latency;
+    int written;
+
+    pthread_mutex_lock(&snap.lock);
+    written = snapshotPosCmp(snap.done_db,snap.done_pos,dbid,pos) > 0;
+    pthread_mutex_unlock(&snap.lock);
+    if (written) return;
+
+    /* The key may be in the batch still being filled. */
+    start = ustime();
+    snapshotQueueBatch();
+    pthread_mutex_lock(&snap.lock);
+    while (snapshotPosCmp(snap.done_db,snap.done_pos,dbid,pos) <= 0)
+        pthread_cond_wait(&snap.done_cond,&snap.lock);
+    pthread_mutex_unlock(&snap.lock);
+    latency = (ustime()-start)/1000;
+    server.stat_snapshot_write_waits++;
+    latencyAddSampleIfNeeded("snapshot-write-wait",latency);
+}
+
+/* dictScan() callback: add the key to the batch unless it was preserved
+ * already, or it was returned by a previous call of the scan. */
+static void snapshotScanCallback(void *privdata, const dictEntry *de) {
+    redisDb *db = privdata;
+    sds key = dictGetKey(de);
+    uint64_t pos = snapshotKeyPos(db,key);
+    snapshotJob *batch = snap.batch;
+    snapshotKey *sk;
+    robj keyobj;
+
+    if (pos < snap.scan_pos) return;
+    if (snap.handled[db->id] && dictFind(snap.handled[db->id],key)) return;
+
+    if (batch->numkeys == batch->size) {
+        batch->size = batch->size ? batch->size*2 : SNAPSHOT_BATCH_KEYS;
+        batch->keys = zrealloc(batch->keys,sizeof(snapshotKey)*batch->size);
+    }
+    initStaticStringObject(keyobj,key);
+    sk = batch->keys+batch->numkeys++;
+    sk->key = sdsdup(key);
+    sk->val = dictGetVal(de);
+    sk->expire = getExpire(db,&keyobj);
+    sk->pos = pos;
+    incrRefCount(sk->val);
+}
+
+/* Scan the data set queueing the keys to the thread, until the thread has
+ * enough keys to write or the scan is completed. */
+static void snapshotScan(void) {
+    long long queued;
+
+    pthread_mutex_lock(&snap.lock);
+    queued = snap.queued_keys;
+    pthread_mutex_unlock(&snap.lock);
+
+    while (snap.scan_db < server.dbnum) {
+        redisDb *db = server.db+snap.scan_db;
+        int j, start;
+
+        if (queued >= SNAPSHOT_MAX_QUEUED_KEYS) return;
+        if (snap.batch && snap.batch->dbid != snap.scan_db)
+            snapshotQueueBatch();
+        if (snap.batch == NULL)
+            snap.batch = snapshotCreateJob(SNAPSHOT_JOB_KEYS,snap.scan_db);
+
+        start = snap.batch->numkeys;
+        snap.cursor = dictScan(db->dict,snap.cursor,snapshotScanCallback,db);
+        if (snap.cursor == 0) {
+            snap.scan_db++;
+            snap.scan_pos = 0;
+        } else {
+            snap.scan_pos = snapshotReverseBits(snap.cursor);
+
+            /* Keys after the new cursor will be returned again when their
+             * buckets are visited: we keep them only then. */
+            j = start;
+            while (j < snap.batch->numkeys) {
+                snapshotKey *sk = snap.batch->keys+j;
+
+                if (sk->pos < snap.scan_pos) {
+                    j++;
+                    continue;
+                }
+                sdsfree(sk->key);
+                decrRefCount(sk->val);
+                *sk = snap.batch->keys[--snap.batch->numkeys];
+            }
+        }
+        queued += snap.batch->numkeys-start;
+        if (snap.batch->numkeys >= SNAPSHOT_BATCH_KEYS || snap.cursor == 0)
+            snapshotQueueBatch();
+    }
+    if (snap.scan_db == server.dbnum && snap.batch == NULL) {
+        snap.scan_db++; /* Queue the end of the snapshot only once. */
+        snapshotQueueJob(snapshotCreateJob(SNAPSHOT_JOB_END,-1));
+    }
+}
+
+/* Called before the main thread accesses a key. If the key was scanned but
+ * is not yet written by the thread, wait for it. If the key is going to be
+ * modified and was not scanned, queue its current version to the thread. */
+static void snapshotTouchKey(redisDb *db, robj *key, int modify) {
+    uint64_t pos;
+    dictEntry *de;
+    robj keyobj;
+    rio payload;
+    long long expire;
+
+    if (!server.rdb_thread_active) return;
+    pos = snapshotKeyPos(db,key->ptr);
+    if (snapshotPosCmp(db->id,pos,snap.scan_db,snap.scan_pos) < 0) {
+        snapshotWaitWritten(db->id,pos);
+        return;
+    }
+    if (!modify) return;
+
+    /* Not scanned yet: preserve the version of the key the snapshot should
+     * contain, just the first time the key is modified. Keys created after
+     * the snapshot started are marked as handled too, so that the scan
+     * will not save them. */
+    if (snap.handled[db->id] == NULL)
+        snap.handled[db->id] = dictCreate(&snapshotKeysDictType,NULL);
+    else if (dictFind(snap.handled[db->id],key->ptr))
+        return;
+    dictAdd(snap.handled[db->id],sdsdup(key->ptr),NULL);
+    if ((de = dictFind(db->dict,key->ptr)) == NULL) return;
+
+    initStaticStringObject(keyobj,dictGetKey(de));
+    expire = getExpire(db,&keyobj);
+    rioInitWithBuffer(&payload,sdsempty());
+    if (rdbSaveKeyValuePair(&payload,&keyobj,dictGetVal(de),expire,
+                            snap.now) == 1)
+    {
+        snapshotJob *job = snapshotCreateJob(SNAPSHOT_JOB_BLOB,db->id);
+
+        job->blob = payload.io.buffer.ptr;
+        server.stat_snapshot_preserved_keys++;
+        server.stat_snapshot_preserved_bytes += sdslen(job->blob);
+        snap.preserved_keys++;
+        snapshotQueueJob(job);
+    } else {
+        sdsfree(payload.io.buffer.ptr);
+    }
+}
+
+void snapshotBeforeRead(redisDb *db, robj *key) {
+    snapshotTouchKey(db,key,0);
+}
+
+void snapshotBeforeWrite(redisDb *db, robj *key) {
+    snapshotTouchKey(db,key,1);
+}
+
+/* Write a job into the RDB file. Returns -1 on write error. */
+static int snapshotWriteJob(snapshotJob *job, int *curdb) {
+    int j;
+
+    if (job->type == SNAPSHOT_JOB_END) {
+        if (rdbSaveFooter(&snap.rdb) == -1) return -1;
+        if (fflush(snap.fp) == EOF) return -1;
+        if (fsync(fileno(snap.fp)) == -1) return -1;
+        return 1;
+    }
+    if (job->dbid != *curdb && (job->numkeys || job->blob)) {
+        if (rdbSaveType(&snap.rdb,RDB_OPCODE_SELECTDB) == -1) return -1;
+        if (rdbSaveLen(&snap.rdb,job->dbid) == -1) return -1;
+        *curdb = job->dbid;
+    }
+    if (job->type == SNAPSHOT_JOB_BLOB)
+        return rioWrite(&snap.rdb,job->blob,sdslen(job->blob)) ? 1 : -1;
+    for (j = 0; j < job->numkeys; j++) {
+        snapshotKey *sk = job->keys+j;
+        robj keyobj;
+
+        initStaticStringObject(keyobj,sk->key);
+        if (rdbSaveKeyValuePair(&snap.rdb,&keyobj,sk->val,sk->expire,
+                                snap.now) == -1) return -1;
+    }
+    return 1;
+}
+
+static void *snapshotThreadMain(void *arg) {
+    sigset_t sigset;
+    int curdb = -1, error = 0;
+    char byte = 0;
+    UNUSED(arg);
+
+    /* Block SIGALRM so we are sure that only the main thread will
+     * receive the watchdog signal. */
+    sigemptyset(&sigset);
+    sigaddset(&sigset, SIGALRM);
+    if (pthread_sigmask(SIG_BLOCK, &sigset, NULL))
+        serverLog(LL_WARNING,
+            "Warning: can't mask SIGALRM in snapshot thread: %s",
+            strerror(errno));
+
+    pthread_mutex_lock(&snap.lock);
+    while(!snap.abort) {
+        snapshotJob *job;
+        listNode *ln;
+        int type, numkeys, end_db, end;
+        uint64_t end_pos;
+
+        if ((ln = listFirst(snap.jobs)) == NULL) {
+            pthread_cond_wait(&snap.job_cond,&snap.lock);
+            continue;
+        }
+        job = listNodeValue(ln);
+        listDelNode(snap.jobs,ln);
+        pthread_mutex_unlock(&snap.lock);
+
+        /* After an error the jobs are just released, the main thread will
+         * discard the file at the end. */
+        if (!error && snapshotWriteJob(job,&curdb) == -1)
+            error = errno ? errno : EIO;
+        type = job->type;
+        numkeys = job->numkeys;
+        end_db = job->end_db;
+        end_pos = job->end_pos;
+        snapshotFreeJob(job);
+        end = (type == SNAPSHOT_JOB_END);
+
+        pthread_mutex_lock(&snap.lock);
+        if (type == SNAPSHOT_JOB_KEYS) {
+            snap.queued_keys -= numkeys;
+            snap.done_db = end_db;
+            snap.done_pos = end_pos;
+        }
+        if (end) {
+            snap.error = error;
+            snap.finished = 1;
+        }
+        pthread_cond_broadcast(&snap.done_cond);
+        if (write(snap.notify_pipe[1],&byte,1) == -1) {
+            /* The pipe is full: the main thread will wake up anyway. */
+        }
+        if (end) break;
+    }
+    pthread_mutex_unlock(&snap.lock);
+    return NULL;
+}
+
+/* Release the state of the last snapshot. Called after the thread exited. */
+static void snapshotRelease(void) {
+    listNode *ln;
+    int j;
+
+    while ((ln = listFirst(snap.jobs)) != NULL) {
+        snapshotFreeJob(listNodeValue(ln));
+        listDelNode(snap.jobs,ln);
+    }
+    listRelease(snap.jobs);
+    if (snap.batch) snapshotFreeJob(snap.batch);
+    snap.batch = NULL;
+    for (j = 0; j < server.dbnum; j++)
+        if (snap.handled[j]) dictRelease(snap.handled[j]);
+    zfree(snap.handled);
+    aeDeleteFileEvent(server.el,snap.notify_pipe[0],AE_READABLE);
+    close(snap.notify_pipe[0]);
+    close(snap.notify_pipe[1]);
+    pthread_mutex_destroy(&snap.lock);
+    pthread_cond_destroy(&snap.job_cond);
+    pthread_cond_destroy(&snap.done_cond);
+    sdsfree(snap.filename);
+
+    server.rdb_thread_active = 0;
+    server.rdb_child_type = RDB_CHILD_TYPE_NONE;
+    server.rdb_save_time_last = time(NULL)-server.rdb_save_time_start;
+    server.rdb_save_time_start = -1;
+    server.stat_snapshot_last_preserved_keys = snap.preserved_keys;
+}
+
+/* The thread wrote the whole snapshot: move the file in place. */
+static void snapshotDone(void) {
+    int error;
+
+    pthread_join(snap.thread,NULL);
+    error = snap.error;
+    if (fclose(snap.fp) == EOF && !error) error = errno;
+    if (!error && rename(snap.tmpfile,snap.filename) == -1) error = errno;
+    if (error) {
+        serverLog(LL_WARNING,"Background saving error: %s", strerror(error));
+        unlink(snap.tmpfile);
+        server.lastbgsave_status = C_ERR;
+    } else {
+        serverLog(LL_NOTICE,
+            "Background saving terminated with success "
+            "(%lld modified keys preserved)", snap.preserved_keys);
+        server.dirty = server.dirty - server.dirty_before_bgsave;
+        server.lastsave = time(NULL);
+        server.lastbgsave_status = C_OK;
+    }
+    snapshotRelease();
+    updateSlavesWaitingBgsave(error ? C_ERR : C_OK, RDB_CHILD_TYPE_DISK);
+}
+
+/* Stop the snapshot in progress, if any, discarding the file. Like killing
+ * a saving child with SIGUSR1 this is not considered an error. */
+void snapshotAbort(void) {
+    if (!server.rdb_thread_active) return;
+    serverLog(LL_WARNING,"Aborting the forkless snapshot in progress");
+    pthread_mutex_lock(&snap.lock);
+    snap.abort = 1;
+    pthread_cond_signal(&snap.job_cond);
+    pthread_mutex_unlock(&snap.lock);
+    pthread_join(snap.thread,NULL);
+    fclose(snap.fp);
+    unlink(snap.tmpfile);
+    snapshotRelease();
+    updateSlavesWaitingBgsave(C_ERR, RDB_CHILD_TYPE_DISK);
+}
+
+/* Drive the snapshot: called when the thread wrote something and from
+ * serverCron(). */
+void snapshotCron(void) {
+    int finished;
+
+    if (!server.rdb_thread_active) return;
+    pthread_mutex_lock(&snap.lock);
+    finished = snap.finished;
+    pthread_mutex_unlock(&snap.lock);
+    if (finished)
+        snapshotDone();
+    else
+        snapshotScan();
+}
+
+static void snapshotNotifyHandler(aeEventLoop *el, int fd, void *privdata,
+                                  int mask)
+{
+    char buf[128];
+    UNUSED(el);
+    UNUSED(privdata);
+    UNUSED(mask);
+
+    while (read(fd,buf,sizeof(buf)) > 0);
+    snapshotCron();
+}
+
+/* The DB 'dbnum' (or all the DBs if -1) is going to be emptied. Flushing
+ * everything aborts the snapshot, like FLUSHALL kills a saving child.
+ * Otherwise the snapshot of the DB is completed first. */
+void snapshotBeforeEmptyDb(int dbnum) {
+    if (!server.rdb_thread_active) return;
+    if (dbnum == -1) {
+        snapshotAbort();
+        return;
+    }
+    while (snap.scan_db <= dbnum) {
+        snapshotScan();
+        if (snap.scan_db > dbnum) break;
+        pthread_mutex_lock(&snap.lock);
+        while (snap.queued_keys >= SNAPSHOT_MAX_QUEUED_KEYS)
+            pthread_cond_wait(&snap.done_cond,&snap.lock);
+        pthread_mutex_unlock(&snap.lock);
+    }
+    snapshotWaitWritten(dbnum,UINT64_MAX);
+}
+
+/* Start a forkless BGSAVE writing 'filename'. Called by rdbSaveBackground()
+ * when rdb-forkless-save is enabled. */
+int snapshotStart(char *filename) {
+    char cwd[MAXPATHLEN];
+
+    snprintf(snap.tmpfile,sizeof(snap.tmpfile),"temp-snapshot-%d.rdb",
+        (int) getpid());
+    snap.fp = fopen(snap.tmpfile,"w");
+    if (!snap.fp) {
+        char *cwdp = getcwd(cwd,MAXPATHLEN);
+        serverLog(LL_WARNING,
+            "Failed opening the RDB file %s (in server root dir %s) "
+            "for saving: %s",
+            filename,
+            cwdp ? cwdp : "unknown",
+            strerror(errno));
+        server.lastbgsave_status = C_ERR;
+        return C_ERR;
+    }
+    rioInitWithFile(&snap.rdb,snap.fp);
+    if (rdbSaveHeader(&snap.rdb) == -1 || pipe(snap.notify_pipe) == -1) {
+        serverLog(LL_WARNING,"Can't start the forkless snapshot: %s",
+            strerror(errno));
+        fclose(snap.fp);
+        unlink(snap.tmpfile);
+        server.lastbgsave_status = C_ERR;
+        return C_ERR;
+    }
+    anetNonBlock(NULL,snap.notify_pipe[0]);
+    anetNonBlock(NULL,snap.notify_pipe[1]);
+    aeCreateFileEvent(server.el,snap.notify_pipe[0],AE_READABLE,
+        snapshotNotifyHandler,NULL);
+
+    pthread_mutex_init(&snap.lock,NULL);
+    pthread_cond_init(&snap.job_cond,NULL);
+    pthread_cond_init(&snap.done_cond,NULL);
+    snap.jobs = listCreate();
+    snap.queued_keys = 0;
+    snap.done_db = 0;
+    snap.done_pos = 0;
+    snap.abort = 0;
+    snap.finished = 0;
+    snap.error = 0;
+    snap.filename = sdsnew(filename);
+    snap.now = mstime();
+    snap.scan_db = 0;
+    snap.scan_pos = 0;
+    snap.cursor = 0;
+    snap.batch = NULL;
+    snap.handled = zcalloc(sizeof(dict*)*server.dbnum);
+    snap.preserved_keys = 0;
+
+    server.rdb_thread_active = 1;
+    server.rdb_save_time_start = time(NULL);
+    server.rdb_child_type = RDB_CHILD_TYPE_DISK;
+    if (pthread_create(&snap.thread,NULL,snapshotThreadMain,NULL) != 0) {
+        serverLog(LL_WARNING,"Can't create the snapshot thread");
+        fclose(snap.fp);
+        unlink(snap.tmpfile);
+        snapshotRelease();
+        server.lastbgsave_status = C_ERR;
+        return C_ERR;
+    }
+    server.stat_snapshots++;
+    serverLog(LL_NOTICE,"Background saving started by the snapshot thread");
+    snapshotScan();
+    return C_OK;
+}
@@ -302,8 +302,9 @@ void sortCommand(client *c) {
     }
 
     /* Destructively convert encoded sorted sets for SORT. */
-    if (sortval->type == OBJ_ZSET)
-        zsetConvert(sortval, OBJ_ENCODING_SKIPLIST);
+    if (sortval->type == OBJ_ZSET &&
+        sortval->encoding == OBJ_ENCODING_LISTPACK)
+        zsetConvert(sortval, server.zset_large_encoding);
 
     /* Objtain the length of the object to sort. */
     switch(sortval->type) {
@@ -388,6 +389,27 @@ void sortCommand(client *c) {
             j++;
         }
         setTypeReleaseIterator(si);
+    } else if (sortval->type == OBJ_ZSET && dontsort &&
+               sortval->encoding == OBJ_ENCODING_BTREE) {
+        /* Same as the skiplist case below. */
+        zbtree *zbt = ((zset*)sortval->ptr)->zbt;
+        zbtreePos pos;
+        int valid, rangelen = vectorlen;
+
+        valid = zbtGetElementByRank(zbt,desc ? zbt->length-start :
+                                              (unsigned long)start+1,
+                                    &pos);
+        while(rangelen--) {
+            serverAssertWithInfo(c,sortval,valid);
+            vector[j].obj = zbtPosObj(&pos);
+            vector[j].u.score = 0;
+            vector[j].u.cmpobj = NULL;
+            j++;
+            valid = desc ? zbtPrev(&pos) : zbtNext(&pos);
+        }
+        /* Fix start/end: output code is not aware of this optimization. */
+        end -= start;
+        start = 0;
     } else if (sortval->type == OBJ_ZSET && dontsort) {
         /* Special handling for a sorted set, if 'dontsort' is true.
          * This makes sure we return elements in the sorted set original
@@ -69,7 +69,7 @@ int setTypeAdd(robj *subject, robj *value) {
                  * too many entries. */
                 /* 如果有太多的元素 默认 512  那么就转换为哈希表 */
                 if (intsetLen(subject->ptr) > server.set_max_intset_entries)
-                    setTypeConvert(subject,OBJ_ENCODING_HT);
+                    setTypeConvert(subject,server.set_large_encoding);
                 return 1;
             }
         } else {
@@ -83,6 +83,18 @@ int setTypeAdd(robj *subject, robj *value) {
             incrRefCount(value);
             return 1;
         }
+    } else if (subject->encoding == OBJ_ENCODING_ROARING) {
+        if (isObjectRepresentableAsLongLong(value,&llval) == C_OK) {
+            return roaringAdd(subject->ptr,llval);
+        } else {
+            /* Like an intset, a roaring set becomes a regular set as soon
+             * as a value that is not an integer is added. */
+            setTypeConvert(subject,OBJ_ENCODING_HT);
+            serverAssertWithInfo(NULL,value,
+                                dictAdd(subject->ptr,value,NULL) == DICT_OK);
+            incrRefCount(value);
+            return 1;
+        }
     } else {
         serverPanic("Unknown set encoding");
     }
@@ -102,6 +114,9 @@ int setTypeRemove(robj *setobj, robj *value) {
             setobj->ptr = intsetRemove(setobj->ptr,llval,&success);
             if (success) return 1;
         }
+    } else if (setobj->encoding == OBJ_ENCODING_ROARING) {
+        if (isObjectRepresentableAsLongLong(value,&llval) == C_OK)
+            return roaringRemove(setobj->ptr,llval);
     } else {
         serverPanic("Unknown set encoding");
     }
@@ -116,6 +131,9 @@ int setTypeIsMember(robj *subject, robj *value) {
         if (isObjectRepresentableAsLongLong(value,&llval) == C_OK) {
             return intsetFind((intset*)subject->ptr,llval);
         }
+    } else if (subject->encoding == OBJ_ENCODING_ROARING) {
+        if (isObjectRepresentableAsLongLong(value,&llval) == C_OK)
+            return roaringContains(subject->ptr,llval);
     } else {
         serverPanic("Unknown set encoding");
     }
@@ -130,6 +148,8 @@ setTypeIterator *setTypeInitIterator(robj *subject) {
         si->di = dictGetIterator(subject->ptr);
     } else if (si->encoding == OBJ_ENCODING_INTSET) {
         si->ii = 0;
+    } else if (si->encoding == OBJ_ENCODING_ROARING) {
+        roaringInitIterator(&si->ri,subject->ptr);
     } else {
         serverPanic("Unknown set encoding");
     }
@@ -148,7 +168,8 @@ void setTypeReleaseIterator(setTypeIterator *si) {
  * Since set elements can be internally be stored as redis objects or
  * simple arrays of integers, setTypeNext returns the encoding of the
  * set object you are iterating, and will populate the appropriate pointer
- * (objele) or (llele) accordingly.
+ * (objele) or (llele) accordingly. Roaring sets store integers as well, so
+ * for them llele is populated and OBJ_ENCODING_INTSET is returned.
  *
  * Note that both the objele and llele pointers should be passed and cannot
  * be NULL since the function will try to defensively populate the non
@@ -167,6 +188,10 @@ int setTypeNext(setTypeIterator *si, robj **objele, int64_t *llele) {
         if (!intsetGet(si->subject->ptr,si->ii++,llele))
             return -1;
         *objele = NULL; /* Not needed. Defensive. */
+    } else if (si->encoding == OBJ_ENCODING_ROARING) {
+        if (!roaringNext(&si->ri,llele)) return -1;
+        *objele = NULL; /* Not needed. Defensive. */
+        return OBJ_ENCODING_INTSET;
     } else {
         serverPanic("Wrong set encoding in setTypeNext");
     }
@@ -207,7 +232,8 @@ robj *setTypeNextObject(setTypeIterator *si) {
  * The caller provides both pointers to be populated with the right
  * object. The return value of the function is the object->encoding
  * field of the object and is used by the caller to check if the
- * int64_t pointer or the redis object pointer was populated.
+ * int64_t pointer or the redis object pointer was populated. As for
+ * setTypeNext(), roaring sets return OBJ_ENCODING_INTSET.
  *
  * Note that both the objele and llele pointers should be passed and cannot
  * be NULL since the function will try to defensively populate the non
@@ -224,6 +250,10 @@ int setTypeRandomElement(robj *setobj, robj **objele, int64_t *llele) {
     } else if (setobj->encoding == OBJ_ENCODING_INTSET) {
         *llele = intsetRandom(setobj->ptr);
         *objele = NULL; /* Not needed. Defensive. */
+    } else if (setobj->encoding == OBJ_ENCODING_ROARING) {
+        *llele = roaringRandom(setobj->ptr);
+        *objele = NULL; /* Not needed. Defensive. */
+        return OBJ_ENCODING_INTSET;
     } else {
         serverPanic("Unknown set encoding");
     }
@@ -235,6 +265,8 @@ unsigned long setTypeSize(robj *subject) {
         return dictSize((dict*)subject->ptr);
     } else if (subject->encoding == OBJ_ENCODING_INTSET) {
         return intsetLen((intset*)subject->ptr);
+    } else if (subject->encoding == OBJ_ENCODING_ROARING) {
+        return roaringCard(subject->ptr);
     } else {
         serverPanic("Unknown set encoding");
     }
@@ -242,11 +274,13 @@ unsigned long setTypeSize(robj *subject) {
 
 /* Convert the set to specified encoding. The resulting dict (when converting
  * to a hash table) is presized to hold the number of elements in the original
- * set. */
+ * set. Intsets can be converted to a hash table or a roaring set, roaring
+ * sets to a hash table. */
 void setTypeConvert(robj *setobj, int enc) {
     setTypeIterator *si;
     serverAssertWithInfo(NULL,setobj,setobj->type == OBJ_SET &&
-                             setobj->encoding == OBJ_ENCODING_INTSET);
+                             (setobj->encoding == OBJ_ENCODING_INTSET ||
+                              setobj->encoding == OBJ_ENCODING_ROARING));
 
     if (enc == OBJ_ENCODING_HT) {
         int64_t intele;
@@ -254,7 +288,7 @@ void setTypeConvert(robj *setobj, int enc) {
         robj *element;
 
         /* Presize the dict to avoid rehashing */
-        dictExpand(d,intsetLen(setobj->ptr));
+        dictExpand(d,setTypeSize(setobj));
 
         /* To add the elements we extract integers and create redis objects */
         si = setTypeInitIterator(setobj);
@@ -265,14 +299,86 @@ void setTypeConvert(robj *setobj, int enc) {
         }
         setTypeReleaseIterator(si);
 
+        freeSetObject(setobj);
         setobj->encoding = OBJ_ENCODING_HT;
-        zfree(setobj->ptr);
         setobj->ptr = d;
+    } else if (enc == OBJ_ENCODING_ROARING &&
+               setobj->encoding == OBJ_ENCODING_INTSET)
+    {
+        roaring *r = roaringNew();
+        int64_t intele;
+        uint32_t j;
+
+        /* The intset is sorted, so values are appended to the last
+         * container. */
+        for (j = 0; intsetGet(setobj->ptr,j,&intele); j++)
+            roaringAdd(r,intele);
+        roaringOptimize(r);
+
+        setobj->encoding = OBJ_ENCODING_ROARING;
+        zfree(setobj->ptr);
+        setobj->ptr = r;
     } else {
         serverPanic("Unsupported set conversion");
     }
 }
 
+/* Return a new roaring set with the members of 'setobj', an intset or a
+ * roaring set. */
+static roaring *setTypeDupRoaring(robj *setobj) {
+    roaring *r;
+    int64_t intele;
+    uint32_t j;
+
+    if (setobj->encoding == OBJ_ENCODING_ROARING)
+        return roaringDup(setobj->ptr);
+    r = roaringNew();
+    for (j = 0; intsetGet(setobj->ptr,j,&intele); j++) roaringAdd(r,intele);
+    return r;
+}
+
+/* Create a set object taking ownership of the roaring set 'r'. The object
+ * gets the encoding adding the same members one by one would give it. */
+static robj *setTypeCreateFromRoaring(roaring *r) {
+    robj *o;
+
+    if (roaringCard(r) <= server.set_max_intset_entries) {
+        int64_t *values = zmalloc(sizeof(int64_t)*(roaringCard(r)+1));
+        roaringIterator it;
+        uint32_t len = 0;
+
+        roaringInitIterator(&it,r);
+        while (roaringNext(&it,&values[len])) len++;
+        o = createObject(OBJ_SET,intsetNewFromSorted(values,len));
+        o->encoding = OBJ_ENCODING_INTSET;
+        zfree(values);
+        roaringFree(r);
+        return o;
+    }
+
+    roaringOptimize(r);
+    o = createObject(OBJ_SET,r);
+    o->encoding = OBJ_ENCODING_ROARING;
+    if (server.set_large_encoding != OBJ_ENCODING_ROARING)
+        setTypeConvert(o,OBJ_ENCODING_HT);
+    return o;
+}
+
+/* Return true if the sets, NULL meaning a missing key, can be combined with
+ * the roaring set operations: all of them only hold integers, and at least
+ * one is roaring encoded. */
+static int setTypeCanUseRoaring(robj **sets, unsigned long setnum) {
+    unsigned long j;
+    int found = 0;
+
+    for (j = 0; j < setnum; j++) {
+        if (sets[j] == NULL) continue;
+        if (sets[j]->encoding == OBJ_ENCODING_HT) return 0;
+        if (sets[j]->encoding == OBJ_ENCODING_ROARING) found = 1;
+    }
+    return found;
+}
+
 /**
  * 添加到字典的key，值为空
  * 
@@ -596,7 +702,10 @@ void spopCommand(client *c) {
     /* Remove the element from the set */
     if (encoding == OBJ_ENCODING_INTSET) {
         ele = createStringObjectFromLongLong(llele);
-        set->ptr = intsetRemove(set->ptr,llele,NULL);
+        if (set->encoding == OBJ_ENCODING_ROARING)
+            roaringRemove(set->ptr,llele);
+        else
+            set->ptr = intsetRemove(set->ptr,llele,NULL);
     } else {
         incrRefCount(ele);
         setTypeRemove(set,ele);
@@ -801,8 +910,12 @@ int qsortCompareSetsByRevCardinality(const void *s1, const void *s2) {
     return  (o2 ? setTypeSize(o2) : 0) - (o1 ? setTypeSize(o1) : 0);
 }
 
+/* Implements SINTER, SINTERSTORE and SINTERCARD. With 'cardinality_only'
+ * just the size of the intersection is replied, stopping as soon as it
+ * reaches 'limit' (zero means no limit), and no element is ever copied. */
 void sinterGenericCommand(client *c, robj **setkeys,
-                          unsigned long setnum, robj *dstkey) {
+                          unsigned long setnum, robj *dstkey,
+                          int cardinality_only, unsigned long limit) {
     robj **sets = zmalloc(sizeof(robj*)*setnum);
     setTypeIterator *si;
     robj *eleobj, *dstset = NULL;
@@ -823,6 +936,8 @@ void sinterGenericCommand(client *c, robj **setkeys,
                     server.dirty++;
                 }
                 addReply(c,shared.czero);
+            } else if (cardinality_only) {
+                addReply(c,shared.czero);
             } else {
                 addReply(c,shared.emptymultibulk);
             }
@@ -839,17 +954,92 @@ void sinterGenericCommand(client *c, robj **setkeys,
      * algorithm's performance */
     qsort(sets,setnum,sizeof(robj*),qsortCompareSetsByCardinality);
 
+    /* When every set is an intset the sorted arrays are intersected with
+     * intsetInter(), that gallops over the larger sets instead of looking
+     * up every element of the smallest one from scratch. */
+    for (j = 0; j < setnum; j++)
+        if (sets[j]->encoding != OBJ_ENCODING_INTSET) break;
+    if (j == setnum) {
+        intset **isets = zmalloc(sizeof(intset*)*setnum);
+        int64_t *result = NULL;
+
+        for (j = 0; j < setnum; j++) isets[j] = sets[j]->ptr;
+        if (!cardinality_only)
+            result = zmalloc(sizeof(int64_t)*(intsetLen(isets[0])+1));
+        cardinality = intsetInter(isets,setnum,result,
+            limit > UINT32_MAX ? 0 : limit);
+
+        if (dstkey) {
+            dstset = createObject(OBJ_SET,
+                intsetNewFromSorted(result,cardinality));
+            dstset->encoding = OBJ_ENCODING_INTSET;
+            if (cardinality > server.set_max_intset_entries)
+                setTypeConvert(dstset,server.set_large_encoding);
+        } else if (!cardinality_only) {
+            addReplyMultiBulkLen(c,cardinality);
+            for (j = 0; j < cardinality; j++)
+                addReplyBulkLongLong(c,result[j]);
+        }
+        zfree(result);
+        zfree(isets);
+        goto done;
+    }
+
+    /* Sets of integers, at least one of them roaring encoded, are
+     * intersected a container at a time. The intsets, that are small, are
+     * converted for the duration of the command. */
+    if (setnum > 1 && setTypeCanUseRoaring(sets,setnum)) {
+        roaring **rsets = zmalloc(sizeof(roaring*)*setnum), *r;
+
+        for (j = 0; j < setnum; j++) {
+            rsets[j] = (sets[j]->encoding == OBJ_ENCODING_ROARING) ?
+                sets[j]->ptr : setTypeDupRoaring(sets[j]);
+        }
+        if (cardinality_only && setnum == 2) {
+            cardinality = roaringAndCard(rsets[0],rsets[1]);
+        } else {
+            /* In cardinality only mode the last set is just counted. */
+            unsigned long last = cardinality_only ? setnum-1 : setnum;
+
+            r = roaringDup(rsets[0]);
+            for (j = 1; j < last; j++) roaringAnd(r,rsets[j]);
+            if (cardinality_only) {
+                cardinality = roaringAndCard(r,rsets[setnum-1]);
+                roaringFree(r);
+            } else if (dstkey) {
+                cardinality = roaringCard(r);
+                dstset = setTypeCreateFromRoaring(r);
+            } else {
+                roaringIterator it;
+
+                cardinality = roaringCard(r);
+                addReplyMultiBulkLen(c,cardinality);
+                roaringInitIterator(&it,r);
+                while (roaringNext(&it,&intobj))
+                    addReplyBulkLongLong(c,intobj);
+                roaringFree(r);
+            }
+        }
+        if (cardinality_only && limit && cardinality > limit)
+            cardinality = limit;
+
+        for (j = 0; j < setnum; j++)
+            if (sets[j]->encoding != OBJ_ENCODING_ROARING) roaringFree(rsets[j]);
+        zfree(rsets);
+        goto done;
+    }
+
     /* The first thing we should output is the total number of elements...
      * since this is a multi-bulk write, but at this stage we don't know
      * the intersection set size, so we use a trick, append an empty object
      * to the output list and save the pointer to later modify it with the
      * right length */
-    if (!dstkey) {
-        replylen = addDeferredMultiBulkLength(c);
-    } else {
+    if (dstkey) {
         /* If we have a target key where to store the resulting set
          * create this key with an empty set inside */
         dstset = createIntsetObject();
+    } else if (!cardinality_only) {
+        replylen = addDeferredMultiBulkLength(c);
     }
 
     /* Iterate all the elements of the first (smallest) set, and test
@@ -865,6 +1055,10 @@ void sinterGenericCommand(client *c, robj **setkeys,
                     !intsetFind((intset*)sets[j]->ptr,intobj))
                 {
                     break;
+                } else if (sets[j]->encoding == OBJ_ENCODING_ROARING &&
+                           !roaringContains(sets[j]->ptr,intobj))
+                {
+                    break;
                 /* in order to compare an integer with an object we
                  * have to use the generic function, creating an object
                  * for this */
@@ -895,7 +1089,9 @@ void sinterGenericCommand(client *c, robj **setkeys,
 
         /* Only take action when all sets contain the member */
         if (j == setnum) {
-            if (!dstkey) {
+            if (cardinality_only) {
+                if (++cardinality == limit) break;
+            } else if (!dstkey) {
                 if (encoding == OBJ_ENCODING_HT)
                     addReplyBulk(c,eleobj);
                 else
@@ -914,6 +1110,7 @@ void sinterGenericCommand(client *c, robj **setkeys,
     }
     setTypeReleaseIterator(si);
 
+done:
     if (dstkey) {
         /* Store the resulting set into the target, if the intersection
          * is not an empty set. */
@@ -932,7 +1129,9 @@ void sinterGenericCommand(client *c, robj **setkeys,
         }
         signalModifiedKey(c->db,dstkey);
         server.dirty++;
-    } else {
+    } else if (cardinality_only) {
+        addReplyLongLong(c,cardinality);
+    } else if (replylen) {
         setDeferredMultiBulkLength(c,replylen,cardinality);
     }
     zfree(sets);
@@ -940,11 +1139,44 @@ void sinterGenericCommand(client *c, robj **setkeys,
 
 /* 用于返回给定所有集合的交集 */
 void sinterCommand(client *c) {
-    sinterGenericCommand(c,c->argv+1,c->argc-1,NULL);
+    sinterGenericCommand(c,c->argv+1,c->argc-1,NULL,0,0);
 }
 
 void sinterstoreCommand(client *c) {
-    sinterGenericCommand(c,c->argv+2,c->argc-2,c->argv[1]);
+    sinterGenericCommand(c,c->argv+2,c->argc-2,c->argv[1],0,0);
+}
+
+/* SINTERCARD numkeys key [key ...] [LIMIT limit] */
+void sintercardCommand(client *c) {
+    long numkeys, j;
+    long long limit = 0;
+
+    if (getLongFromObjectOrReply(c,c->argv[1],&numkeys,NULL) != C_OK)
+        return;
+    if (numkeys < 1) {
+        addReplyError(c,"at least 1 input key is needed for SINTERCARD");
+        return;
+    }
+    if (numkeys > c->argc-2) {
+        addReplyError(c,"Number of keys can't be greater than number of args");
+        return;
+    }
+
+    for (j = 2+numkeys; j < c->argc; j++) {
+        if (!strcasecmp(c->argv[j]->ptr,"limit") && j+1 < c->argc) {
+            if (getLongLongFromObjectOrReply(c,c->argv[j+1],&limit,NULL)
+                != C_OK) return;
+            if (limit < 0) {
+                addReplyError(c,"LIMIT can't be negative");
+                return;
+            }
+            j++;
+        } else {
+            addReply(c,shared.syntaxerr);
+            return;
+        }
+    }
+    sinterGenericCommand(c,c->argv+2,numkeys,NULL,1,limit);
 }
 
 #define SET_OP_UNION 0
@@ -1012,7 +1244,38 @@ void sunionDiffGenericCommand(client *c, robj **setkeys, int setnum,
      * this set object will be the resulting object to set into the target key*/
     dstset = createIntsetObject();
 
-    if (op == SET_OP_UNION) {
+    if (setnum > 1 && (op == SET_OP_UNION || sets[0]) &&
+        setTypeCanUseRoaring(sets,setnum))
+    {
+        /* Sets of integers, at least one of them roaring encoded, are
+         * combined a container at a time, adding or removing the members
+         * of the intsets one by one. */
+        roaring *r = (op == SET_OP_UNION) ? roaringNew() :
+                                            setTypeDupRoaring(sets[0]);
+        int64_t intele;
+        uint32_t ii;
+
+        for (j = (op == SET_OP_UNION) ? 0 : 1; j < setnum; j++) {
+            if (!sets[j]) continue; /* non existing keys are like empty sets */
+
+            if (sets[j]->encoding == OBJ_ENCODING_ROARING) {
+                if (op == SET_OP_UNION)
+                    roaringOr(r,sets[j]->ptr);
+                else
+                    roaringAndNot(r,sets[j]->ptr);
+            } else {
+                for (ii = 0; intsetGet(sets[j]->ptr,ii,&intele); ii++) {
+                    if (op == SET_OP_UNION)
+                        roaringAdd(r,intele);
+                    else
+                        roaringRemove(r,intele);
+                }
+            }
+        }
+        cardinality = roaringCard(r);
+        decrRefCount(dstset);
+        dstset = setTypeCreateFromRoaring(r);
+    } else if (op == SET_OP_UNION) {
         /* Union is trivial, just add every element of every set to the
          * temporary set. */
         for (j = 0; j < setnum; j++) {
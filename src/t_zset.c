@@ -233,6 +233,49 @@ zskiplistNode *zslInsert(zskiplist *zsl, double score, robj *obj) {
     return x;
 }
 
+/* Create a skiplist holding the 'len' elements of the arrays, that must be
+ * already sorted by score and member with no duplicated member. Instead of
+ * a search per element, as with zslInsert(), every node is linked after the
+ * last node of each of its levels, so the skiplist is built in linear time.
+ * Like zslInsert() no new reference to the objects is taken. */
+zskiplist *zslCreateFromSorted(double *scores, robj **objs, unsigned long len) {
+    zskiplistNode *last[ZSKIPLIST_MAXLEVEL], *x, *prev = NULL;
+    unsigned long rank[ZSKIPLIST_MAXLEVEL];
+    zskiplist *zsl = zslCreate();
+    unsigned long j;
+    int i, level;
+
+    for (i = 0; i < ZSKIPLIST_MAXLEVEL; i++) {
+        last[i] = zsl->header;
+        rank[i] = 0;
+    }
+
+    for (j = 0; j < len; j++) {
+        serverAssert(!isnan(scores[j]));
+        level = zslRandomLevel();
+        if (level > zsl->level) zsl->level = level;
+
+        x = zslCreateNode(level,scores[j],objs[j]);
+        for (i = 0; i < level; i++) {
+            x->level[i].forward = NULL;
+            last[i]->level[i].forward = x;
+            last[i]->level[i].span = (j+1)-rank[i];
+            last[i] = x;
+            rank[i] = j+1;
+        }
+        x->backward = prev;
+        prev = x;
+    }
+
+    /* The last node of every level spans up to the end of the list, as
+     * zslInsert() does. */
+    for (i = 0; i < zsl->level; i++)
+        last[i]->level[i].span = len-rank[i];
+    zsl->tail = prev;
+    zsl->length = len;
+    return zsl;
+}
+
 /* Internal function used by zslDelete, zslDeleteByScore and zslDeleteByRank */
 void zslDeleteNode(zskiplist *zsl, zskiplistNode *x, zskiplistNode **update) {
     int i;
@@ -708,7 +751,573 @@ zskiplistNode *zslLastInLexRange(zskiplist *zsl, zlexrangespec *range) {
 }
 
 /*-----------------------------------------------------------------------------
- * Ziplist-backed sorted set API
+ * B+tree-backed sorted set API
+ *----------------------------------------------------------------------------*/
+
+/* With zset-large-encoding set to "btree" big sorted sets use a B+tree
+ * instead of the skiplist. A skiplist element costs a node with a random
+ * number of levels, and searching it means a cache miss at almost every
+ * step. The B+tree stores up to ZBTREE_FANOUT elements per leaf in two flat
+ * arrays, so an element costs the 16 bytes of its slot plus the free slots
+ * (nodes other than the root are kept at least half full), and the searches
+ * are binary searches inside contiguous memory.
+ *
+ * Internal nodes store, for every child, the greatest (score,member) pair of
+ * its subtree and the number of elements in the subtree. The member is not
+ * referenced: it is the object owned by the leaf, and every operation that
+ * changes a leaf refreshes the keys along the path it walked.
+ *
+ * The dictionary of a B+tree encoded zset stores the score by value in the
+ * dict entry, since elements move between leaves on splits and merges.
+ * 元素在节点分裂和合并时会移动 所以字典直接保存score而不是指向score的指针 */
+
+#define ZBTREE_MIN_FILL (ZBTREE_FANOUT/2)
+
+static int zbtCompare(double s1, robj *o1, double s2, robj *o2) {
+    if (s1 < s2) return -1;
+    if (s1 > s2) return 1;
+    return compareStringObjects(o1,o2);
+}
+
+/* Leaves don't have the 'count' and 'child' arrays, so they are allocated
+ * smaller. */
+static zbtreeNode *zbtCreateNode(int leaf) {
+    size_t size = leaf ? offsetof(zbtreeNode,count) : sizeof(zbtreeNode);
+    zbtreeNode *n = zmalloc(size);
+
+    n->leaf = leaf;
+    n->num = 0;
+    n->prev = n->next = NULL;
+    return n;
+}
+
+zbtree *zbtCreate(void) {
+    zbtree *zbt = zmalloc(sizeof(*zbt));
+
+    zbt->root = zbt->head = zbt->tail = zbtCreateNode(1);
+    zbt->length = 0;
+    return zbt;
+}
+
+static void zbtFreeNode(zbtreeNode *n) {
+    int j;
+
+    for (j = 0; j < n->num; j++) {
+        if (n->leaf)
+            decrRefCount(n->obj[j]);
+        else
+            zbtFreeNode(n->child[j]);
+    }
+    zfree(n);
+}
+
+void zbtFree(zbtree *zbt) {
+    zbtFreeNode(zbt->root);
+    zfree(zbt);
+}
+
+/* Return the index of the first slot of 'n' that is >= the given element,
+ * or n->num if all the slots are smaller. */
+static int zbtLowerBound(zbtreeNode *n, double score, robj *obj) {
+    int lo = 0, hi = n->num;
+
+    while (lo < hi) {
+        int mid = (lo+hi)/2;
+        if (zbtCompare(n->score[mid],n->obj[mid],score,obj) < 0)
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static unsigned long zbtNodeLength(zbtreeNode *n) {
+    unsigned long len = 0;
+    int j;
+
+    if (n->leaf) return n->num;
+    for (j = 0; j < n->num; j++) len += n->count[j];
+    return len;
+}
+
+/* Refresh the key of the slot 'j' of the internal node 'n', that is the
+ * greatest element of the child. */
+static void zbtUpdateKey(zbtreeNode *n, int j) {
+    zbtreeNode *c = n->child[j];
+
+    n->score[j] = c->score[c->num-1];
+    n->obj[j] = c->obj[c->num-1];
+}
+
+/* Like zbtUpdateKey() but also recount the elements of the child. */
+static void zbtUpdateSlot(zbtreeNode *n, int j) {
+    zbtUpdateKey(n,j);
+    n->count[j] = zbtNodeLength(n->child[j]);
+}
+
+/* Move 'cnt' slots of 'src' starting at 'from' to the slot 'to' of 'dst'.
+ * The two ranges may overlap when 'src' and 'dst' are the same node. */
+static void zbtMoveSlots(zbtreeNode *dst, int to, zbtreeNode *src, int from,
+                         int cnt)
+{
+    if (cnt <= 0) return;
+    memmove(dst->score+to,src->score+from,cnt*sizeof(double));
+    memmove(dst->obj+to,src->obj+from,cnt*sizeof(robj*));
+    if (!src->leaf) {
+        memmove(dst->count+to,src->count+from,cnt*sizeof(unsigned long));
+        memmove(dst->child+to,src->child+from,cnt*sizeof(zbtreeNode*));
+    }
+}
+
+/* Move the upper half of the full node 'n' into a new right sibling, that
+ * is returned. */
+static zbtreeNode *zbtSplitNode(zbtree *zbt, zbtreeNode *n) {
+    zbtreeNode *r = zbtCreateNode(n->leaf);
+    int half = n->num/2;
+
+    r->num = n->num-half;
+    zbtMoveSlots(r,0,n,half,r->num);
+    n->num = half;
+    if (n->leaf) {
+        r->prev = n;
+        r->next = n->next;
+        if (n->next)
+            n->next->prev = r;
+        else
+            zbt->tail = r;
+        n->next = r;
+    }
+    return r;
+}
+
+/* Insert the element in the subtree rooted at 'n'. If 'n' had to be split
+ * the new right sibling is returned, so that the caller can link it,
+ * otherwise NULL is returned. */
+static zbtreeNode *zbtInsertNode(zbtree *zbt, zbtreeNode *n, double score,
+                                 robj *obj)
+{
+    zbtreeNode *split = NULL, *csplit;
+    int j = zbtLowerBound(n,score,obj);
+
+    if (n->leaf) {
+        if (n->num == ZBTREE_FANOUT) {
+            split = zbtSplitNode(zbt,n);
+            if (j > n->num) {
+                j -= n->num;
+                n = split;
+            }
+        }
+        zbtMoveSlots(n,j+1,n,j,n->num-j);
+        n->score[j] = score;
+        n->obj[j] = obj;
+        n->num++;
+        return split;
+    }
+
+    /* Greater than every element: it goes in the last child. */
+    if (j == n->num) j--;
+    csplit = zbtInsertNode(zbt,n->child[j],score,obj);
+    if (csplit == NULL) {
+        n->count[j]++;
+        zbtUpdateKey(n,j);
+        return NULL;
+    }
+
+    /* The child was split: link the new sibling right after it. */
+    zbtUpdateSlot(n,j);
+    if (n->num == ZBTREE_FANOUT) {
+        split = zbtSplitNode(zbt,n);
+        if (j >= n->num) {
+            j -= n->num;
+            n = split;
+        }
+    }
+    j++;
+    zbtMoveSlots(n,j+1,n,j,n->num-j);
+    n->child[j] = csplit;
+    n->num++;
+    zbtUpdateSlot(n,j);
+    return split;
+}
+
+/* Insert a new element. Like zslInsert() the caller reference to 'obj' is
+ * taken by the tree, and the element must not already exist. */
+void zbtInsert(zbtree *zbt, double score, robj *obj) {
+    zbtreeNode *split = zbtInsertNode(zbt,zbt->root,score,obj);
+
+    if (split) {
+        zbtreeNode *root = zbtCreateNode(0);
+
+        root->child[0] = zbt->root;
+        root->child[1] = split;
+        root->num = 2;
+        zbtUpdateSlot(root,0);
+        zbtUpdateSlot(root,1);
+        zbt->root = root;
+    }
+    zbt->length++;
+}
+
+/* Create a B+tree holding the 'len' elements of the arrays, sorted as for
+ * zslCreateFromSorted(). The tree is built bottom-up one level at a time,
+ * spreading the slots evenly so that the nodes end up almost full: inserting
+ * the elements in order would instead leave every leaf half full after its
+ * split. No new reference to the objects is taken. */
+zbtree *zbtCreateFromSorted(double *scores, robj **objs, unsigned long len) {
+    zbtree *zbt = zbtCreate();
+    zbtreeNode **level, *n, *prev = NULL;
+    unsigned long nodes, parents, idx, j;
+    int num, k;
+
+    if (len == 0) return zbt;
+    zfree(zbt->root);
+
+    /* The leaves. The first len%nodes ones take one element more. */
+    nodes = (len+ZBTREE_FANOUT-1)/ZBTREE_FANOUT;
+    level = zmalloc(sizeof(zbtreeNode*)*nodes);
+    for (idx = 0, j = 0; j < nodes; j++) {
+        num = len/nodes + (j < len%nodes);
+        n = zbtCreateNode(1);
+        memcpy(n->score,scores+idx,sizeof(double)*num);
+        memcpy(n->obj,objs+idx,sizeof(robj*)*num);
+        n->num = num;
+        n->prev = prev;
+        if (prev) prev->next = n;
+        prev = n;
+        level[j] = n;
+        idx += num;
+    }
+    zbt->head = level[0];
+    zbt->tail = prev;
+
+    /* The internal levels, up to the root. A parent replaces its children
+     * in the 'level' array, that are all before it. */
+    while (nodes > 1) {
+        parents = (nodes+ZBTREE_FANOUT-1)/ZBTREE_FANOUT;
+        for (idx = 0, j = 0; j < parents; j++) {
+            num = nodes/parents + (j < nodes%parents);
+            n = zbtCreateNode(0);
+            n->num = num;
+            for (k = 0; k < num; k++) {
+                n->child[k] = level[idx++];
+                zbtUpdateSlot(n,k);
+            }
+            level[j] = n;
+        }
+        nodes = parents;
+    }
+    zbt->root = level[0];
+    zbt->length = len;
+    zfree(level);
+    return zbt;
+}
+
+/* The child in the slot 'j' of 'n' went under ZBTREE_MIN_FILL: merge it with
+ * a sibling if they fit in a single node, otherwise even out the two. */
+static void zbtRebalance(zbtree *zbt, zbtreeNode *n, int j) {
+    zbtreeNode *l, *r;
+    int total, move;
+
+    /* A root with a single child is removed by zbtDelete(). */
+    if (n->num == 1) {
+        if (n->child[0]->num) zbtUpdateKey(n,0);
+        return;
+    }
+
+    /* Always work on the pair of children j, j+1. */
+    if (j == n->num-1) j--;
+    l = n->child[j];
+    r = n->child[j+1];
+    total = l->num+r->num;
+
+    if (total <= ZBTREE_FANOUT) {
+        zbtMoveSlots(l,l->num,r,0,r->num);
+        l->num = total;
+        if (l->leaf) {
+            l->next = r->next;
+            if (r->next)
+                r->next->prev = l;
+            else
+                zbt->tail = l;
+        }
+        zfree(r);
+        n->count[j] += n->count[j+1];
+        zbtMoveSlots(n,j+1,n,j+2,n->num-j-2);
+        n->num--;
+        zbtUpdateKey(n,j);
+        return;
+    }
+
+    if (l->num < r->num) {
+        move = total/2-l->num;
+        zbtMoveSlots(l,l->num,r,0,move);
+        zbtMoveSlots(r,0,r,move,r->num-move);
+    } else {
+        move = l->num-total/2;
+        zbtMoveSlots(r,move,r,0,r->num);
+        zbtMoveSlots(r,0,l,l->num-move,move);
+    }
+    l->num = total/2;
+    r->num = total-total/2;
+    zbtUpdateSlot(n,j);
+    zbtUpdateSlot(n,j+1);
+}
+
+/* Remove the element from the subtree rooted at 'n'. The object stored in
+ * the tree is returned without releasing it, or NULL if not found. */
+static robj *zbtDeleteNode(zbtree *zbt, zbtreeNode *n, double score,
+                           robj *obj)
+{
+    int j = zbtLowerBound(n,score,obj);
+    robj *ele;
+
+    if (j == n->num) return NULL;
+    if (n->leaf) {
+        if (zbtCompare(n->score[j],n->obj[j],score,obj) != 0) return NULL;
+        ele = n->obj[j];
+        zbtMoveSlots(n,j,n,j+1,n->num-j-1);
+        n->num--;
+        return ele;
+    }
+
+    if ((ele = zbtDeleteNode(zbt,n->child[j],score,obj)) == NULL)
+        return NULL;
+    n->count[j]--;
+    if (n->child[j]->num < ZBTREE_MIN_FILL)
+        zbtRebalance(zbt,n,j);
+    else
+        zbtUpdateKey(n,j);
+    return ele;
+}
+
+/* Delete an element with matching score/object from the B+tree.
+ * Returns 1 if found and deleted, 0 otherwise. */
+int zbtDelete(zbtree *zbt, double score, robj *obj) {
+    robj *ele = zbtDeleteNode(zbt,zbt->root,score,obj);
+
+    if (ele == NULL) return 0;
+    while (!zbt->root->leaf && zbt->root->num == 1) {
+        zbtreeNode *root = zbt->root;
+        zbt->root = root->child[0];
+        zfree(root);
+    }
+    zbt->length--;
+    /* Released last: 'obj' may be this same object. */
+    decrRefCount(ele);
+    return 1;
+}
+
+/* Iteration. The functions return 0 when there is no such element, in
+ * which case 'pos' must not be used. */
+int zbtFirst(zbtree *zbt, zbtreePos *pos) {
+    pos->leaf = zbt->head;
+    pos->idx = 0;
+    return zbt->length != 0;
+}
+
+int zbtLast(zbtree *zbt, zbtreePos *pos) {
+    pos->leaf = zbt->tail;
+    pos->idx = zbt->tail->num-1;
+    return zbt->length != 0;
+}
+
+int zbtNext(zbtreePos *pos) {
+    if (pos->idx+1 < pos->leaf->num) {
+        pos->idx++;
+        return 1;
+    }
+    if (pos->leaf->next == NULL) return 0;
+    pos->leaf = pos->leaf->next;
+    pos->idx = 0;
+    return 1;
+}
+
+int zbtPrev(zbtreePos *pos) {
+    if (pos->idx > 0) {
+        pos->idx--;
+        return 1;
+    }
+    if (pos->leaf->prev == NULL) return 0;
+    pos->leaf = pos->leaf->prev;
+    pos->idx = pos->leaf->num-1;
+    return 1;
+}
+
+/* Seek the first element for which 'pred' is true, given that it is false
+ * for a (possibly empty) prefix of the elements and true for all the rest.
+ * Since the keys of internal nodes are the greatest element of every child,
+ * the same binary search works at every level. Returns 0 if 'pred' is false
+ * for every element. */
+typedef int (*zbtPredicate)(double score, robj *obj, void *spec);
+
+static int zbtSeek(zbtree *zbt, zbtPredicate pred, void *spec,
+                   zbtreePos *pos)
+{
+    zbtreeNode *n = zbt->root;
+    int lo, hi;
+
+    while (1) {
+        lo = 0;
+        hi = n->num;
+        while (lo < hi) {
+            int mid = (lo+hi)/2;
+            if (pred(n->score[mid],n->obj[mid],spec))
+                hi = mid;
+            else
+                lo = mid+1;
+        }
+        if (lo == n->num) return 0;
+        if (n->leaf) break;
+        n = n->child[lo];
+    }
+    pos->leaf = n;
+    pos->idx = lo;
+    return 1;
+}
+
+static int zbtScoreGteMin(double score, robj *obj, void *spec) {
+    UNUSED(obj);
+    return zslValueGteMin(score,spec);
+}
+
+static int zbtScoreGtMax(double score, robj *obj, void *spec) {
+    UNUSED(obj);
+    return !zslValueLteMax(score,spec);
+}
+
+static int zbtLexGteMin(double score, robj *obj, void *spec) {
+    UNUSED(score);
+    return zslLexValueGteMin(obj,spec);
+}
+
+static int zbtLexGtMax(double score, robj *obj, void *spec) {
+    UNUSED(score);
+    return !zslLexValueLteMax(obj,spec);
+}
+
+/* Find the first element that is contained in the specified range. */
+int zbtFirstInRange(zbtree *zbt, zrangespec *range, zbtreePos *pos) {
+    if (!zbtSeek(zbt,zbtScoreGteMin,range,pos)) return 0;
+    return zslValueLteMax(zbtPosScore(pos),range);
+}
+
+/* Find the last element that is contained in the specified range: the one
+ * before the first element greater than max. */
+int zbtLastInRange(zbtree *zbt, zrangespec *range, zbtreePos *pos) {
+    if (zbtSeek(zbt,zbtScoreGtMax,range,pos)) {
+        if (!zbtPrev(pos)) return 0;
+    } else if (!zbtLast(zbt,pos)) {
+        return 0;
+    }
+    return zslValueGteMin(zbtPosScore(pos),range);
+}
+
+int zbtFirstInLexRange(zbtree *zbt, zlexrangespec *range, zbtreePos *pos) {
+    if (!zbtSeek(zbt,zbtLexGteMin,range,pos)) return 0;
+    return zslLexValueLteMax(zbtPosObj(pos),range);
+}
+
+int zbtLastInLexRange(zbtree *zbt, zlexrangespec *range, zbtreePos *pos) {
+    if (zbtSeek(zbt,zbtLexGtMax,range,pos)) {
+        if (!zbtPrev(pos)) return 0;
+    } else if (!zbtLast(zbt,pos)) {
+        return 0;
+    }
+    return zslLexValueGteMin(zbtPosObj(pos),range);
+}
+
+/* Find the rank for an element by both score and key.
+ * Returns 0 when the element cannot be found, rank otherwise.
+ * Note that the rank is 1-based like zslGetRank(). */
+unsigned long zbtGetRank(zbtree *zbt, double score, robj *o) {
+    zbtreeNode *n = zbt->root;
+    unsigned long rank = 0;
+    int j, k;
+
+    while (1) {
+        j = zbtLowerBound(n,score,o);
+        if (j == n->num) return 0;
+        if (n->leaf) break;
+        for (k = 0; k < j; k++) rank += n->count[k];
+        n = n->child[j];
+    }
+    if (zbtCompare(n->score[j],n->obj[j],score,o) != 0) return 0;
+    return rank+j+1;
+}
+
+/* Find the element at the 1-based 'rank' using the subtree counts. */
+int zbtGetElementByRank(zbtree *zbt, unsigned long rank, zbtreePos *pos) {
+    zbtreeNode *n = zbt->root;
+    int j;
+
+    if (rank == 0 || rank > zbt->length) return 0;
+    rank--;
+    while (!n->leaf) {
+        for (j = 0; rank >= n->count[j]; j++) rank -= n->count[j];
+        n = n->child[j];
+    }
+    pos->leaf = n;
+    pos->idx = rank;
+    return 1;
+}
+
+/* Delete the element at 'pos' from both the tree and the dictionary. */
+static void zbtDeleteAt(zbtree *zbt, zbtreePos *pos, dict *dict) {
+    double score = zbtPosScore(pos);
+    robj *obj = zbtPosObj(pos);
+
+    /* The dictionary still references 'obj' after zbtDelete(). */
+    zbtDelete(zbt,score,obj);
+    dictDelete(dict,obj);
+}
+
+/* Delete all the elements with score between min and max from the B+tree.
+ * Min and max are inclusive, so a score >= min || score <= max is deleted.
+ * Note that this function takes the reference to the hash table view of the
+ * sorted set, in order to remove the elements from the hash table too. */
+unsigned long zbtDeleteRangeByScore(zbtree *zbt, zrangespec *range,
+                                    dict *dict)
+{
+    zbtreePos pos;
+    unsigned long removed = 0;
+
+    while (zbtFirstInRange(zbt,range,&pos)) {
+        zbtDeleteAt(zbt,&pos,dict);
+        removed++;
+    }
+    return removed;
+}
+
+unsigned long zbtDeleteRangeByLex(zbtree *zbt, zlexrangespec *range,
+                                  dict *dict)
+{
+    zbtreePos pos;
+    unsigned long removed = 0;
+
+    while (zbtFirstInLexRange(zbt,range,&pos)) {
+        zbtDeleteAt(zbt,&pos,dict);
+        removed++;
+    }
+    return removed;
+}
+
+/* Delete all the elements with rank between start and end from the B+tree.
+ * Start and end are inclusive. Note that start and end need to be 1-based */
+unsigned long zbtDeleteRangeByRank(zbtree *zbt, unsigned int start,
+                                   unsigned int end, dict *dict)
+{
+    zbtreePos pos;
+    unsigned long removed = 0, todo = end-start+1;
+
+    while (removed < todo && zbtGetElementByRank(zbt,start,&pos)) {
+        zbtDeleteAt(zbt,&pos,dict);
+        removed++;
+    }
+    return removed;
+}
+
+/*-----------------------------------------------------------------------------
+ * Listpack-backed sorted set API
  *----------------------------------------------------------------------------*/
 
 double zzlGetScore(unsigned char *sptr) {
@@ -719,7 +1328,7 @@ double zzlGetScore(unsigned char *sptr) {
     double score;
 
     serverAssert(sptr != NULL);
-    serverAssert(ziplistGet(sptr,&vstr,&vlen,&vlong));
+    vstr = lpGetValue(sptr,&vlen,&vlong);
 
     if (vstr) {
         memcpy(buf,vstr,vlen);
@@ -732,16 +1341,16 @@ double zzlGetScore(unsigned char *sptr) {
     return score;
 }
 
-/* Return a ziplist element as a Redis string object.
+/* Return a listpack element as a Redis string object.
  * This simple abstraction can be used to simplifies some code at the
  * cost of some performance. */
-robj *ziplistGetObject(unsigned char *sptr) {
+robj *zzlGetObject(unsigned char *sptr) {
     unsigned char *vstr;
     unsigned int vlen;
     long long vlong;
 
     serverAssert(sptr != NULL);
-    serverAssert(ziplistGet(sptr,&vstr,&vlen,&vlong));
+    vstr = lpGetValue(sptr,&vlen,&vlong);
 
     if (vstr) {
         return createStringObject((char*)vstr,vlen);
@@ -758,7 +1367,7 @@ int zzlCompareElements(unsigned char *eptr, unsigned char *cstr, unsigned int cl
     unsigned char vbuf[32];
     int minlen, cmp;
 
-    serverAssert(ziplistGet(eptr,&vstr,&vlen,&vlong));
+    vstr = lpGetValue(eptr,&vlen,&vlong);
     if (vstr == NULL) {
         /* Store string representation of long long in buf. */
         vlen = ll2string((char*)vbuf,sizeof(vbuf),vlong);
@@ -771,19 +1380,19 @@ int zzlCompareElements(unsigned char *eptr, unsigned char *cstr, unsigned int cl
     return cmp;
 }
 
-unsigned int zzlLength(unsigned char *zl) {
-    return ziplistLen(zl)/2;
+unsigned int zzlLength(unsigned char *lp) {
+    return lpLength(lp)/2;
 }
 
 /* Move to next entry based on the values in eptr and sptr. Both are set to
  * NULL when there is no next entry. */
-void zzlNext(unsigned char *zl, unsigned char **eptr, unsigned char **sptr) {
+void zzlNext(unsigned char *lp, unsigned char **eptr, unsigned char **sptr) {
     unsigned char *_eptr, *_sptr;
     serverAssert(*eptr != NULL && *sptr != NULL);
 
-    _eptr = ziplistNext(zl,*sptr);
+    _eptr = lpNext(lp,*sptr);
     if (_eptr != NULL) {
-        _sptr = ziplistNext(zl,_eptr);
+        _sptr = lpNext(lp,_eptr);
         serverAssert(_sptr != NULL);
     } else {
         /* No next entry. */
@@ -796,13 +1405,13 @@ void zzlNext(unsigned char *zl, unsigned char **eptr, unsigned char **sptr) {
 
 /* Move to the previous entry based on the values in eptr and sptr. Both are
  * set to NULL when there is no next entry. */
-void zzlPrev(unsigned char *zl, unsigned char **eptr, unsigned char **sptr) {
+void zzlPrev(unsigned char *lp, unsigned char **eptr, unsigned char **sptr) {
     unsigned char *_eptr, *_sptr;
     serverAssert(*eptr != NULL && *sptr != NULL);
 
-    _sptr = ziplistPrev(zl,*eptr);
+    _sptr = lpPrev(lp,*eptr);
     if (_sptr != NULL) {
-        _eptr = ziplistPrev(zl,_sptr);
+        _eptr = lpPrev(lp,_sptr);
         serverAssert(_eptr != NULL);
     } else {
         /* No previous entry. */
@@ -815,7 +1424,7 @@ void zzlPrev(unsigned char *zl, unsigned char **eptr, unsigned char **sptr) {
 
 /* Returns if there is a part of the zset is in range. Should only be used
  * internally by zzlFirstInRange and zzlLastInRange. */
-int zzlIsInRange(unsigned char *zl, zrangespec *range) {
+int zzlIsInRange(unsigned char *lp, zrangespec *range) {
     unsigned char *p;
     double score;
 
@@ -824,13 +1433,13 @@ int zzlIsInRange(unsigned char *zl, zrangespec *range) {
             (range->min == range->max && (range->minex || range->maxex)))
         return 0;
 
-    p = ziplistIndex(zl,-1); /* Last score. */
+    p = lpLast(lp); /* Last score. */
     if (p == NULL) return 0; /* Empty sorted set */
     score = zzlGetScore(p);
     if (!zslValueGteMin(score,range))
         return 0;
 
-    p = ziplistIndex(zl,1); /* First score. */
+    p = lpSeek(lp,1); /* First score. */
     serverAssert(p != NULL);
     score = zzlGetScore(p);
     if (!zslValueLteMax(score,range))
@@ -841,15 +1450,15 @@ int zzlIsInRange(unsigned char *zl, zrangespec *range) {
 
 /* Find pointer to the first element contained in the specified range.
  * Returns NULL when no element is contained in the range. */
-unsigned char *zzlFirstInRange(unsigned char *zl, zrangespec *range) {
-    unsigned char *eptr = ziplistIndex(zl,0), *sptr;
+unsigned char *zzlFirstInRange(unsigned char *lp, zrangespec *range) {
+    unsigned char *eptr = lpFirst(lp), *sptr;
     double score;
 
     /* If everything is out of range, return early. */
-    if (!zzlIsInRange(zl,range)) return NULL;
+    if (!zzlIsInRange(lp,range)) return NULL;
 
     while (eptr != NULL) {
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(lp,eptr);
         serverAssert(sptr != NULL);
 
         score = zzlGetScore(sptr);
@@ -861,7 +1470,7 @@ unsigned char *zzlFirstInRange(unsigned char *zl, zrangespec *range) {
         }
 
         /* Move to next element. */
-        eptr = ziplistNext(zl,sptr);
+        eptr = lpNext(lp,sptr);
     }
 
     return NULL;
@@ -869,15 +1478,15 @@ unsigned char *zzlFirstInRange(unsigned char *zl, zrangespec *range) {
 
 /* Find pointer to the last element contained in the specified range.
  * Returns NULL when no element is contained in the range. */
-unsigned char *zzlLastInRange(unsigned char *zl, zrangespec *range) {
-    unsigned char *eptr = ziplistIndex(zl,-2), *sptr;
+unsigned char *zzlLastInRange(unsigned char *lp, zrangespec *range) {
+    unsigned char *eptr = lpSeek(lp,-2), *sptr;
     double score;
 
     /* If everything is out of range, return early. */
-    if (!zzlIsInRange(zl,range)) return NULL;
+    if (!zzlIsInRange(lp,range)) return NULL;
 
     while (eptr != NULL) {
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(lp,eptr);
         serverAssert(sptr != NULL);
 
         score = zzlGetScore(sptr);
@@ -890,9 +1499,9 @@ unsigned char *zzlLastInRange(unsigned char *zl, zrangespec *range) {
 
         /* Move to previous element by moving to the score of previous element.
          * When this returns NULL, we know there also is no element. */
-        sptr = ziplistPrev(zl,eptr);
+        sptr = lpPrev(lp,eptr);
         if (sptr != NULL)
-            serverAssert((eptr = ziplistPrev(zl,sptr)) != NULL);
+            serverAssert((eptr = lpPrev(lp,sptr)) != NULL);
         else
             eptr = NULL;
     }
@@ -901,14 +1510,14 @@ unsigned char *zzlLastInRange(unsigned char *zl, zrangespec *range) {
 }
 
 static int zzlLexValueGteMin(unsigned char *p, zlexrangespec *spec) {
-    robj *value = ziplistGetObject(p);
+    robj *value = zzlGetObject(p);
     int res = zslLexValueGteMin(value,spec);
     decrRefCount(value);
     return res;
 }
 
 static int zzlLexValueLteMax(unsigned char *p, zlexrangespec *spec) {
-    robj *value = ziplistGetObject(p);
+    robj *value = zzlGetObject(p);
     int res = zslLexValueLteMax(value,spec);
     decrRefCount(value);
     return res;
@@ -916,7 +1525,7 @@ static int zzlLexValueLteMax(unsigned char *p, zlexrangespec *spec) {
 
 /* Returns if there is a part of the zset is in range. Should only be used
  * internally by zzlFirstInRange and zzlLastInRange. */
-int zzlIsInLexRange(unsigned char *zl, zlexrangespec *range) {
+int zzlIsInLexRange(unsigned char *lp, zlexrangespec *range) {
     unsigned char *p;
 
     /* Test for ranges that will always be empty. */
@@ -925,12 +1534,12 @@ int zzlIsInLexRange(unsigned char *zl, zlexrangespec *range) {
             (range->minex || range->maxex)))
         return 0;
 
-    p = ziplistIndex(zl,-2); /* Last element. */
+    p = lpSeek(lp,-2); /* Last element. */
     if (p == NULL) return 0;
     if (!zzlLexValueGteMin(p,range))
         return 0;
 
-    p = ziplistIndex(zl,0); /* First element. */
+    p = lpFirst(lp); /* First element. */
     serverAssert(p != NULL);
     if (!zzlLexValueLteMax(p,range))
         return 0;
@@ -940,11 +1549,11 @@ int zzlIsInLexRange(unsigned char *zl, zlexrangespec *range) {
 
 /* Find pointer to the first element contained in the specified lex range.
  * Returns NULL when no element is contained in the range. */
-unsigned char *zzlFirstInLexRange(unsigned char *zl, zlexrangespec *range) {
-    unsigned char *eptr = ziplistIndex(zl,0), *sptr;
+unsigned char *zzlFirstInLexRange(unsigned char *lp, zlexrangespec *range) {
+    unsigned char *eptr = lpFirst(lp), *sptr;
 
     /* If everything is out of range, return early. */
-    if (!zzlIsInLexRange(zl,range)) return NULL;
+    if (!zzlIsInLexRange(lp,range)) return NULL;
 
     while (eptr != NULL) {
         if (zzlLexValueGteMin(eptr,range)) {
@@ -955,9 +1564,9 @@ unsigned char *zzlFirstInLexRange(unsigned char *zl, zlexrangespec *range) {
         }
 
         /* Move to next element. */
-        sptr = ziplistNext(zl,eptr); /* This element score. Skip it. */
+        sptr = lpNext(lp,eptr); /* This element score. Skip it. */
         serverAssert(sptr != NULL);
-        eptr = ziplistNext(zl,sptr); /* Next element. */
+        eptr = lpNext(lp,sptr); /* Next element. */
     }
 
     return NULL;
@@ -965,11 +1574,11 @@ unsigned char *zzlFirstInLexRange(unsigned char *zl, zlexrangespec *range) {
 
 /* Find pointer to the last element contained in the specified lex range.
  * Returns NULL when no element is contained in the range. */
-unsigned char *zzlLastInLexRange(unsigned char *zl, zlexrangespec *range) {
-    unsigned char *eptr = ziplistIndex(zl,-2), *sptr;
+unsigned char *zzlLastInLexRange(unsigned char *lp, zlexrangespec *range) {
+    unsigned char *eptr = lpSeek(lp,-2), *sptr;
 
     /* If everything is out of range, return early. */
-    if (!zzlIsInLexRange(zl,range)) return NULL;
+    if (!zzlIsInLexRange(lp,range)) return NULL;
 
     while (eptr != NULL) {
         if (zzlLexValueLteMax(eptr,range)) {
@@ -981,9 +1590,9 @@ unsigned char *zzlLastInLexRange(unsigned char *zl, zlexrangespec *range) {
 
         /* Move to previous element by moving to the score of previous element.
          * When this returns NULL, we know there also is no element. */
-        sptr = ziplistPrev(zl,eptr);
+        sptr = lpPrev(lp,eptr);
         if (sptr != NULL)
-            serverAssert((eptr = ziplistPrev(zl,sptr)) != NULL);
+            serverAssert((eptr = lpPrev(lp,sptr)) != NULL);
         else
             eptr = NULL;
     }
@@ -991,15 +1600,15 @@ unsigned char *zzlLastInLexRange(unsigned char *zl, zlexrangespec *range) {
     return NULL;
 }
 
-unsigned char *zzlFind(unsigned char *zl, robj *ele, double *score) {
-    unsigned char *eptr = ziplistIndex(zl,0), *sptr;
+unsigned char *zzlFind(unsigned char *lp, robj *ele, double *score) {
+    unsigned char *eptr = lpFirst(lp), *sptr;
 
     ele = getDecodedObject(ele);
     while (eptr != NULL) {
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(lp,eptr);
         serverAssertWithInfo(NULL,ele,sptr != NULL);
 
-        if (ziplistCompare(eptr,ele->ptr,sdslen(ele->ptr))) {
+        if (lpCompare(eptr,ele->ptr,sdslen(ele->ptr))) {
             /* Matching element, pull out score. */
             if (score != NULL) *score = zzlGetScore(sptr);
             decrRefCount(ele);
@@ -1007,61 +1616,55 @@ unsigned char *zzlFind(unsigned char *zl, robj *ele, double *score) {
         }
 
         /* Move to next element. */
-        eptr = ziplistNext(zl,sptr);
+        eptr = lpNext(lp,sptr);
     }
 
     decrRefCount(ele);
     return NULL;
 }
 
-/* Delete (element,score) pair from ziplist. Use local copy of eptr because we
+/* Delete (element,score) pair from listpack. Use local copy of eptr because we
  * don't want to modify the one given as argument. */
-unsigned char *zzlDelete(unsigned char *zl, unsigned char *eptr) {
+unsigned char *zzlDelete(unsigned char *lp, unsigned char *eptr) {
     unsigned char *p = eptr;
 
-    /* TODO: add function to ziplist API to delete N elements from offset. */
-    zl = ziplistDelete(zl,&p);
-    zl = ziplistDelete(zl,&p);
-    return zl;
+    lp = lpDelete(lp,p,&p);
+    lp = lpDelete(lp,p,&p);
+    return lp;
 }
 
-unsigned char *zzlInsertAt(unsigned char *zl, unsigned char *eptr, robj *ele, double score) {
+unsigned char *zzlInsertAt(unsigned char *lp, unsigned char *eptr, robj *ele, double score) {
     unsigned char *sptr;
     char scorebuf[128];
     int scorelen;
-    size_t offset;
 
     serverAssertWithInfo(NULL,ele,sdsEncodedObject(ele));
     //score转换成char数组
     scorelen = d2string(scorebuf,sizeof(scorebuf),score);
     if (eptr == NULL) {
-        //如果用了 ziplist 的话，会先插入 member 然后插入 score
-        //它们是分别作为两个 ziplist entry 进行插入的
-        zl = ziplistPush(zl,ele->ptr,sdslen(ele->ptr),ZIPLIST_TAIL);
-        zl = ziplistPush(zl,(unsigned char*)scorebuf,scorelen,ZIPLIST_TAIL);
+        //如果用了 listpack 的话，会先插入 member 然后插入 score
+        //它们是分别作为两个 listpack entry 进行插入的
+        lp = lpAppend(lp,ele->ptr,sdslen(ele->ptr));
+        lp = lpAppend(lp,(unsigned char*)scorebuf,scorelen);
     } else {
-        /* Keep offset relative to zl, as it might be re-allocated. */
-        offset = eptr-zl;
-        zl = ziplistInsert(zl,eptr,ele->ptr,sdslen(ele->ptr));
-        eptr = zl+offset;
-
-        /* Insert score after the element. */
-        serverAssertWithInfo(NULL,ele,(sptr = ziplistNext(zl,eptr)) != NULL);
-        zl = ziplistInsert(zl,sptr,(unsigned char*)scorebuf,scorelen);
+        /* Insert the element before eptr, then the score after it: the
+         * inserted element is returned by address, no offset to keep. */
+        lp = lpInsert(lp,ele->ptr,sdslen(ele->ptr),eptr,LP_BEFORE,&sptr);
+        lp = lpInsert(lp,(unsigned char*)scorebuf,scorelen,sptr,LP_AFTER,NULL);
     }
 
-    return zl;
+    return lp;
 }
 
-/* Insert (element,score) pair in ziplist. This function assumes the element is
+/* Insert (element,score) pair in listpack. This function assumes the element is
  * not yet present in the list. */
-unsigned char *zzlInsert(unsigned char *zl, robj *ele, double score) {
-    unsigned char *eptr = ziplistIndex(zl,0), *sptr;
+unsigned char *zzlInsert(unsigned char *lp, robj *ele, double score) {
+    unsigned char *eptr = lpFirst(lp), *sptr;
     double s;
 
     ele = getDecodedObject(ele);
     while (eptr != NULL) {
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(lp,eptr);
         serverAssertWithInfo(NULL,ele,sptr != NULL);
         s = zzlGetScore(sptr);
 
@@ -1069,46 +1672,46 @@ unsigned char *zzlInsert(unsigned char *zl, robj *ele, double score) {
             /* First element with score larger than score for element to be
              * inserted. This means we should take its spot in the list to
              * maintain ordering. */
-            zl = zzlInsertAt(zl,eptr,ele,score);
+            lp = zzlInsertAt(lp,eptr,ele,score);
             break;
         } else if (s == score) {
             /* Ensure lexicographical ordering for elements. */
             if (zzlCompareElements(eptr,ele->ptr,sdslen(ele->ptr)) > 0) {
-                zl = zzlInsertAt(zl,eptr,ele,score);
+                lp = zzlInsertAt(lp,eptr,ele,score);
                 break;
             }
         }
 
         /* Move to next element. */
-        eptr = ziplistNext(zl,sptr);
+        eptr = lpNext(lp,sptr);
     }
 
     /* Push on tail of list when it was not yet inserted. */
     if (eptr == NULL)
-        zl = zzlInsertAt(zl,NULL,ele,score);
+        lp = zzlInsertAt(lp,NULL,ele,score);
 
     decrRefCount(ele);
-    return zl;
+    return lp;
 }
 
-unsigned char *zzlDeleteRangeByScore(unsigned char *zl, zrangespec *range, unsigned long *deleted) {
+unsigned char *zzlDeleteRangeByScore(unsigned char *lp, zrangespec *range, unsigned long *deleted) {
     unsigned char *eptr, *sptr;
     double score;
     unsigned long num = 0;
 
     if (deleted != NULL) *deleted = 0;
 
-    eptr = zzlFirstInRange(zl,range);
-    if (eptr == NULL) return zl;
+    eptr = zzlFirstInRange(lp,range);
+    if (eptr == NULL) return lp;
 
-    /* When the tail of the ziplist is deleted, eptr will point to the sentinel
-     * byte and ziplistNext will return NULL. */
-    while ((sptr = ziplistNext(zl,eptr)) != NULL) {
+    /* When the tail of the listpack is deleted, lpDelete() sets eptr
+     * to NULL. */
+    while (eptr && (sptr = lpNext(lp,eptr)) != NULL) {
         score = zzlGetScore(sptr);
         if (zslValueLteMax(score,range)) {
             /* Delete both the element and the score. */
-            zl = ziplistDelete(zl,&eptr);
-            zl = ziplistDelete(zl,&eptr);
+            lp = lpDelete(lp,eptr,&eptr);
+            lp = lpDelete(lp,eptr,&eptr);
             num++;
         } else {
             /* No longer in range. */
@@ -1117,25 +1720,25 @@ unsigned char *zzlDeleteRangeByScore(unsigned char *zl, zrangespec *range, unsig
     }
 
     if (deleted != NULL) *deleted = num;
-    return zl;
+    return lp;
 }
 
-unsigned char *zzlDeleteRangeByLex(unsigned char *zl, zlexrangespec *range, unsigned long *deleted) {
+unsigned char *zzlDeleteRangeByLex(unsigned char *lp, zlexrangespec *range, unsigned long *deleted) {
     unsigned char *eptr, *sptr;
     unsigned long num = 0;
 
     if (deleted != NULL) *deleted = 0;
 
-    eptr = zzlFirstInLexRange(zl,range);
-    if (eptr == NULL) return zl;
+    eptr = zzlFirstInLexRange(lp,range);
+    if (eptr == NULL) return lp;
 
-    /* When the tail of the ziplist is deleted, eptr will point to the sentinel
-     * byte and ziplistNext will return NULL. */
-    while ((sptr = ziplistNext(zl,eptr)) != NULL) {
+    /* When the tail of the listpack is deleted, lpDelete() sets eptr
+     * to NULL. */
+    while (eptr && (sptr = lpNext(lp,eptr)) != NULL) {
         if (zzlLexValueLteMax(eptr,range)) {
             /* Delete both the element and the score. */
-            zl = ziplistDelete(zl,&eptr);
-            zl = ziplistDelete(zl,&eptr);
+            lp = lpDelete(lp,eptr,&eptr);
+            lp = lpDelete(lp,eptr,&eptr);
             num++;
         } else {
             /* No longer in range. */
@@ -1144,16 +1747,16 @@ unsigned char *zzlDeleteRangeByLex(unsigned char *zl, zlexrangespec *range, unsi
     }
 
     if (deleted != NULL) *deleted = num;
-    return zl;
+    return lp;
 }
 
 /* Delete all the elements with rank between start and end from the skiplist.
  * Start and end are inclusive. Note that start and end need to be 1-based */
-unsigned char *zzlDeleteRangeByRank(unsigned char *zl, unsigned int start, unsigned int end, unsigned long *deleted) {
+unsigned char *zzlDeleteRangeByRank(unsigned char *lp, unsigned int start, unsigned int end, unsigned long *deleted) {
     unsigned int num = (end-start)+1;
     if (deleted) *deleted = num;
-    zl = ziplistDeleteRange(zl,2*(start-1),2*num);
-    return zl;
+    lp = lpDeleteRange(lp,2*(start-1),2*num);
+    return lp;
 }
 
 /*-----------------------------------------------------------------------------
@@ -1162,68 +1765,138 @@ unsigned char *zzlDeleteRangeByRank(unsigned char *zl, unsigned int start, unsig
 
 unsigned int zsetLength(robj *zobj) {
     int length = -1;
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
         length = zzlLength(zobj->ptr);
     } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
         length = ((zset*)zobj->ptr)->zsl->length;
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        length = ((zset*)zobj->ptr)->zbt->length;
     } else {
         serverPanic("Unknown sorted set encoding");
     }
     return length;
 }
 
+/* Return the score of the dictionary entry 'de' of a skiplist or B+tree
+ * encoded sorted set. */
+double zsetDictScore(zset *zs, const dictEntry *de) {
+    return zs->zbt ? dictGetDoubleVal(de) : *(double*)dictGetVal(de);
+}
+
+/* Add an element, that must not already exist, to a skiplist or B+tree
+ * encoded sorted set. The ordered index and the dictionary both take a new
+ * reference to 'ele'. */
+void zsetAddNewElement(zset *zs, double score, robj *ele) {
+    if (zs->zbt) {
+        dictEntry *de;
+
+        zbtInsert(zs->zbt,score,ele);
+        incrRefCount(ele); /* Inserted in the B+tree. */
+        de = dictAddRaw(zs->dict,ele);
+        serverAssertWithInfo(NULL,ele,de != NULL);
+        dictSetDoubleVal(de,score);
+    } else {
+        zskiplistNode *znode = zslInsert(zs->zsl,score,ele);
+        incrRefCount(ele); /* Inserted in skiplist. */
+        serverAssertWithInfo(NULL,ele,
+            dictAdd(zs->dict,ele,&znode->score) == DICT_OK);
+    }
+    incrRefCount(ele); /* Added to dictionary. */
+}
+
+/* Create the zset of a skiplist or B+tree encoded sorted set holding the
+ * 'len' elements of the arrays, that must be sorted by score and member
+ * with no duplicated member. As with zsetAddNewElement() the ordered index
+ * and the dictionary both take a new reference to every object. */
+zset *zsetCreateFromSorted(int encoding, double *scores, robj **objs, unsigned long len) {
+    zset *zs = zmalloc(sizeof(*zs));
+    unsigned long j;
+
+    zs->dict = dictCreate(&zsetDictType,NULL);
+    dictExpand(zs->dict,len);
+    if (encoding == OBJ_ENCODING_BTREE) {
+        dictEntry *de;
+
+        zs->zsl = NULL;
+        zs->zbt = zbtCreateFromSorted(scores,objs,len);
+        for (j = 0; j < len; j++) {
+            de = dictAddRaw(zs->dict,objs[j]);
+            serverAssertWithInfo(NULL,objs[j],de != NULL);
+            dictSetDoubleVal(de,scores[j]);
+        }
+    } else {
+        zskiplistNode *x;
+
+        zs->zsl = zslCreateFromSorted(scores,objs,len);
+        zs->zbt = NULL;
+        for (x = zs->zsl->header->level[0].forward; x; x = x->level[0].forward)
+            serverAssertWithInfo(NULL,x->obj,
+                dictAdd(zs->dict,x->obj,&x->score) == DICT_OK);
+    }
+    for (j = 0; j < len; j++) {
+        incrRefCount(objs[j]); /* Inserted in the skiplist or B+tree. */
+        incrRefCount(objs[j]); /* Added to dictionary. */
+    }
+    return zs;
+}
+
 void zsetConvert(robj *zobj, int encoding) {
     zset *zs;
     zskiplistNode *node, *next;
     robj *ele;
-    double score;
 
     if (zobj->encoding == encoding) return;
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
-        unsigned char *zl = zobj->ptr;
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
+        unsigned char *lp = zobj->ptr;
         unsigned char *eptr, *sptr;
         unsigned char *vstr;
         unsigned int vlen;
         long long vlong;
 
-        if (encoding != OBJ_ENCODING_SKIPLIST)
-            serverPanic("Unknown target encoding");
+        unsigned long len = zzlLength(lp), j = 0;
+        double *scores;
+        robj **objs;
 
-        zs = zmalloc(sizeof(*zs));
-        zs->dict = dictCreate(&zsetDictType,NULL);
-        zs->zsl = zslCreate();
+        if (encoding != OBJ_ENCODING_SKIPLIST &&
+            encoding != OBJ_ENCODING_BTREE)
+            serverPanic("Unknown target encoding");
 
-        eptr = ziplistIndex(zl,0);
+        eptr = lpFirst(lp);
         serverAssertWithInfo(NULL,zobj,eptr != NULL);
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(lp,eptr);
         serverAssertWithInfo(NULL,zobj,sptr != NULL);
 
+        /* The listpack is already sorted: collect the elements and build
+         * the new index bottom-up instead of inserting them one by one. */
+        scores = zmalloc(sizeof(double)*len);
+        objs = zmalloc(sizeof(robj*)*len);
         while (eptr != NULL) {
-            score = zzlGetScore(sptr);
-            serverAssertWithInfo(NULL,zobj,ziplistGet(eptr,&vstr,&vlen,&vlong));
+            scores[j] = zzlGetScore(sptr);
+            vstr = lpGetValue(eptr,&vlen,&vlong);
             if (vstr == NULL)
-                ele = createStringObjectFromLongLong(vlong);
+                objs[j] = createStringObjectFromLongLong(vlong);
             else
-                ele = createStringObject((char*)vstr,vlen);
-
-            /* Has incremented refcount since it was just created. */
-            node = zslInsert(zs->zsl,score,ele);
-            serverAssertWithInfo(NULL,zobj,dictAdd(zs->dict,ele,&node->score) == DICT_OK);
-            incrRefCount(ele); /* Added to dictionary. */
-            zzlNext(zl,&eptr,&sptr);
+                objs[j] = createStringObject((char*)vstr,vlen);
+            j++;
+            zzlNext(lp,&eptr,&sptr);
         }
 
+        zs = zsetCreateFromSorted(encoding,scores,objs,len);
+        for (j = 0; j < len; j++) decrRefCount(objs[j]);
+        zfree(scores);
+        zfree(objs);
+
         zfree(zobj->ptr);
         zobj->ptr = zs;
-        zobj->encoding = OBJ_ENCODING_SKIPLIST;
+        zobj->encoding = encoding;
     } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
-        unsigned char *zl = ziplistNew();
+        unsigned char *lp = lpNew();
 
-        if (encoding != OBJ_ENCODING_ZIPLIST)
+        if (encoding != OBJ_ENCODING_LISTPACK)
             serverPanic("Unknown target encoding");
 
         /* Approach similar to zslFree(), since we want to free the skiplist at
-         * the same time as creating the ziplist. */
+         * the same time as creating the listpack. */
         zs = zobj->ptr;
         dictRelease(zs->dict);
         node = zs->zsl->header->level[0].forward;
@@ -1232,7 +1905,7 @@ void zsetConvert(robj *zobj, int encoding) {
 
         while (node) {
             ele = getDecodedObject(node->obj);
-            zl = zzlInsertAt(zl,NULL,ele,node->score);
+            lp = zzlInsertAt(lp,NULL,ele,node->score);
             decrRefCount(ele);
 
             next = node->level[0].forward;
@@ -1241,23 +1914,43 @@ void zsetConvert(robj *zobj, int encoding) {
         }
 
         zfree(zs);
-        zobj->ptr = zl;
-        zobj->encoding = OBJ_ENCODING_ZIPLIST;
+        zobj->ptr = lp;
+        zobj->encoding = OBJ_ENCODING_LISTPACK;
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        unsigned char *lp = lpNew();
+        zbtreePos pos;
+
+        if (encoding != OBJ_ENCODING_LISTPACK)
+            serverPanic("Unknown target encoding");
+
+        zs = zobj->ptr;
+        if (zbtFirst(zs->zbt,&pos)) {
+            do {
+                ele = getDecodedObject(zbtPosObj(&pos));
+                lp = zzlInsertAt(lp,NULL,ele,zbtPosScore(&pos));
+                decrRefCount(ele);
+            } while (zbtNext(&pos));
+        }
+        dictRelease(zs->dict);
+        zbtFree(zs->zbt);
+
+        zfree(zs);
+        zobj->ptr = lp;
+        zobj->encoding = OBJ_ENCODING_LISTPACK;
     } else {
         serverPanic("Unknown sorted set encoding");
     }
 }
 
-/* Convert the sorted set object into a ziplist if it is not already a ziplist
+/* Convert the sorted set object into a listpack if it is not already a listpack
  * and if the number of elements and the maximum element size is within the
  * expected ranges. */
-void zsetConvertToZiplistIfNeeded(robj *zobj, size_t maxelelen) {
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) return;
-    zset *zset = zobj->ptr;
+void zsetConvertToListpackIfNeeded(robj *zobj, size_t maxelelen) {
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) return;
 
-    if (zset->zsl->length <= server.zset_max_ziplist_entries &&
+    if (zsetLength(zobj) <= server.zset_max_ziplist_entries &&
         maxelelen <= server.zset_max_ziplist_value)
-            zsetConvert(zobj,OBJ_ENCODING_ZIPLIST);
+            zsetConvert(zobj,OBJ_ENCODING_LISTPACK);
 }
 
 /* Return (by reference) the score of the specified member of the sorted set
@@ -1267,13 +1960,15 @@ void zsetConvertToZiplistIfNeeded(robj *zobj, size_t maxelelen) {
 int zsetScore(robj *zobj, robj *member, double *score) {
     if (!zobj || !member) return C_ERR;
 
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
         if (zzlFind(zobj->ptr, member, score) == NULL) return C_ERR;
-    } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
+    } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST ||
+               zobj->encoding == OBJ_ENCODING_BTREE)
+    {
         zset *zs = zobj->ptr;
         dictEntry *de = dictFind(zs->dict, member);
         if (de == NULL) return C_ERR;
-        *score = *(double*)dictGetVal(de);
+        *score = zsetDictScore(zs,de);
     } else {
         serverPanic("Unknown sorted set encoding");
     }
@@ -1290,6 +1985,246 @@ int zsetScore(robj *zobj, robj *member, double *score) {
 #define ZADD_NX (1<<1)      /* Don't touch elements not already existing. */
 #define ZADD_XX (1<<2)      /* Only touch elements already exisitng. */
 #define ZADD_CH (1<<3)      /* Return num of elements added or updated. */
+/* ZADD of a batch of elements to a listpack encoded sorted set. Adding the
+ * elements one by one costs a scan of the listpack, a realloc and a memmove
+ * each, and the sorted set may be converted in the middle of the batch, the
+ * rest of it being inserted one element at a time in the skiplist. Here
+ * instead:
+ *
+ * 1) The batch is sorted by member, so that a single scan of the listpack
+ *    finds the members that already exist, with a binary search each.
+ * 2) The pairs of every member are replayed in the order of the command,
+ *    so that NX/XX and repeated members behave exactly as one by one.
+ * 3) The members to (re)insert are sorted by score and merged with the
+ *    entries of the listpack that are left untouched. The new listpack is
+ *    written with a single allocation or, if the result is too big for a
+ *    listpack, the skiplist or B+tree is built bottom-up from the merged
+ *    sequence, so the encoding changes at most once per command.
+ *
+ * 'eles' are the members and 'scores' their scores, 'elements' pairs in
+ * total. Members going into the large encoding are encoded in place with
+ * tryObjectEncoding(), the caller owning the array and its references. The
+ * counters are incremented as zaddGenericCommand() would do. */
+#define ZADD_BULK_MIN_ELEMENTS 8
+
+typedef struct zaddBulkEntry {
+    robj *ele;          /* Member. */
+    double score;       /* Score of the pair, final score once resolved. */
+    double lpscore;     /* Score in the listpack if lpidx != -1. */
+    long lpidx;         /* Index of the member in the listpack, or -1. */
+    int pos;            /* Index of the pair in the batch. */
+} zaddBulkEntry;
+
+/* Compare the member of 'e' with the string 's' of 'len' bytes, like
+ * sdscmp() does. */
+static int zaddBulkCompareMember(zaddBulkEntry *e, unsigned char *s, size_t len) {
+    size_t elen = sdslen(e->ele->ptr);
+    int cmp = memcmp(e->ele->ptr,s,elen < len ? elen : len);
+
+    if (cmp == 0) return (elen > len) - (elen < len);
+    return cmp;
+}
+
+/* qsort() comparator: by member, then in the order of the batch. */
+static int zaddBulkSortByMember(const void *a, const void *b) {
+    const zaddBulkEntry *ea = a, *eb = b;
+    int cmp = sdscmp(ea->ele->ptr,eb->ele->ptr);
+
+    return cmp ? cmp : ea->pos-eb->pos;
+}
+
+/* qsort() comparator: the order of the sorted set. */
+static int zaddBulkSortByScore(const void *a, const void *b) {
+    const zaddBulkEntry *ea = a, *eb = b;
+
+    if (ea->score < eb->score) return -1;
+    if (ea->score > eb->score) return 1;
+    return sdscmp(ea->ele->ptr,eb->ele->ptr);
+}
+
+void zsetAddBulk(robj *zobj, robj **eles, double *scores, int elements,
+                 int flags, int *added, int *updated, int *processed)
+{
+    int nx = (flags & ZADD_NX) != 0;
+    int xx = (flags & ZADD_XX) != 0;
+    unsigned char *lp = zobj->ptr, *eptr, *sptr, *vstr;
+    unsigned long lplen = zzlLength(lp), len, skipped = 0, idx, out;
+    unsigned char *skip = zcalloc(lplen+1);
+    zaddBulkEntry *ents = zmalloc(sizeof(*ents)*elements);
+    size_t maxelelen = 0;
+    unsigned int vlen;
+    long long vlong;
+    double lpscore = 0, *zscores = NULL;
+    robj **zobjs = NULL;
+    listpackEntry *lpents = NULL;
+    char *scorebuf = NULL;
+    int j, k, n = 0, large;
+
+    serverAssert(zobj->encoding == OBJ_ENCODING_LISTPACK);
+    for (j = 0; j < elements; j++) {
+        ents[j].ele = eles[j];
+        ents[j].score = scores[j];
+        ents[j].lpidx = -1;
+        ents[j].pos = j;
+    }
+    qsort(ents,elements,sizeof(*ents),zaddBulkSortByMember);
+
+    /* 1) Find the members already in the listpack. Only the first pair of
+     * a member gets the listpack index and score. */
+    eptr = lpFirst(lp);
+    sptr = eptr ? lpNext(lp,eptr) : NULL;
+    for (idx = 0; eptr != NULL; idx++) {
+        char buf[LONG_STR_SIZE];
+        int lo = 0, hi = elements;
+
+        if ((vstr = lpGetValue(eptr,&vlen,&vlong)) == NULL) {
+            vlen = ll2string(buf,sizeof(buf),vlong);
+            vstr = (unsigned char*)buf;
+        }
+        while (lo < hi) {
+            int mid = (lo+hi)/2;
+            if (zaddBulkCompareMember(ents+mid,vstr,vlen) < 0)
+                lo = mid+1;
+            else
+                hi = mid;
+        }
+        if (lo < elements && zaddBulkCompareMember(ents+lo,vstr,vlen) == 0) {
+            ents[lo].lpidx = idx;
+            ents[lo].lpscore = zzlGetScore(sptr);
+        }
+        zzlNext(lp,&eptr,&sptr);
+    }
+
+    /* 2) Replay the pairs of every member. The members that must be
+     * (re)inserted are moved at the start of the array, with their final
+     * score. */
+    for (j = 0; j < elements; j = k) {
+        int exists = ents[j].lpidx != -1, isnew = 0;
+        double score = ents[j].lpscore;
+
+        for (k = j; k < elements &&
+                    sdscmp(ents[k].ele->ptr,ents[j].ele->ptr) == 0; k++)
+        {
+            if (exists) {
+                if (nx) continue;
+                if (ents[k].score != score) {
+                    score = ents[k].score;
+                    (*updated)++;
+                }
+                (*processed)++;
+            } else if (!xx) {
+                exists = isnew = 1;
+                score = ents[k].score;
+                (*added)++;
+                (*processed)++;
+            }
+        }
+
+        if (isnew) {
+            if (sdslen(ents[j].ele->ptr) > maxelelen)
+                maxelelen = sdslen(ents[j].ele->ptr);
+        } else if (!exists || score == ents[j].lpscore) {
+            continue; /* Nothing to write for this member. */
+        } else {
+            skip[ents[j].lpidx] = 1;
+            skipped++;
+        }
+        ents[n] = ents[j];
+        ents[n].score = score;
+        n++;
+    }
+    server.dirty += *added + *updated;
+    if (n == 0) goto cleanup;
+
+    /* 3) Merge the untouched listpack entries with the sorted new ones. */
+    qsort(ents,n,sizeof(*ents),zaddBulkSortByScore);
+    len = lplen-skipped+n;
+    large = len > server.zset_max_ziplist_entries ||
+            maxelelen > server.zset_max_ziplist_value;
+
+    if (large) {
+        zscores = zmalloc(sizeof(double)*len);
+        zobjs = zmalloc(sizeof(robj*)*len);
+    } else {
+        lpents = zmalloc(sizeof(listpackEntry)*len*2);
+        scorebuf = zmalloc((size_t)n*MAX_D2STRING_CHARS);
+    }
+
+    eptr = lpFirst(lp);
+    sptr = eptr ? lpNext(lp,eptr) : NULL;
+    idx = 0;
+    k = 0;
+    for (out = 0; out < len; out++) {
+        /* Skip the entries re-inserted with their new score. */
+        while (eptr && skip[idx]) {
+            zzlNext(lp,&eptr,&sptr);
+            idx++;
+        }
+        if (eptr) lpscore = zzlGetScore(sptr);
+
+        if (eptr && (k == n || lpscore < ents[k].score ||
+                     (lpscore == ents[k].score &&
+                      zzlCompareElements(eptr,ents[k].ele->ptr,
+                                         sdslen(ents[k].ele->ptr)) < 0)))
+        {
+            vstr = lpGetValue(eptr,&vlen,&vlong);
+            if (large) {
+                zscores[out] = lpscore;
+                if (vstr == NULL)
+                    zobjs[out] = createStringObjectFromLongLong(vlong);
+                else
+                    zobjs[out] = createStringObject((char*)vstr,vlen);
+            } else {
+                lpents[out*2].sval = vstr;
+                lpents[out*2].slen = vlen;
+                lpents[out*2].lval = vlong;
+                vstr = lpGetValue(sptr,&vlen,&vlong);
+                lpents[out*2+1].sval = vstr;
+                lpents[out*2+1].slen = vlen;
+                lpents[out*2+1].lval = vlong;
+            }
+            zzlNext(lp,&eptr,&sptr);
+            idx++;
+        } else {
+            robj *ele = ents[k].ele;
+
+            if (large) {
+                ele = eles[ents[k].pos] = tryObjectEncoding(ele);
+                incrRefCount(ele);
+                zscores[out] = ents[k].score;
+                zobjs[out] = ele;
+            } else {
+                char *buf = scorebuf+(size_t)k*MAX_D2STRING_CHARS;
+
+                lpents[out*2].sval = ele->ptr;
+                lpents[out*2].slen = sdslen(ele->ptr);
+                lpents[out*2+1].sval = (unsigned char*)buf;
+                lpents[out*2+1].slen =
+                    d2string(buf,MAX_D2STRING_CHARS,ents[k].score);
+            }
+            k++;
+        }
+    }
+
+    if (large) {
+        zobj->ptr = zsetCreateFromSorted(server.zset_large_encoding,
+                                         zscores,zobjs,len);
+        zobj->encoding = server.zset_large_encoding;
+        for (out = 0; out < len; out++) decrRefCount(zobjs[out]);
+        zfree(zscores);
+        zfree(zobjs);
+    } else {
+        zobj->ptr = lpBatchAppend(lpNew(),lpents,len*2);
+        zfree(lpents);
+        zfree(scorebuf);
+    }
+    lpFree(lp);
+
+cleanup:
+    zfree(skip);
+    zfree(ents);
+}
+
 void zaddGenericCommand(client *c, int flags) {
     static char *nanerr = "resulting score is not a number (NaN)";
     robj *key = c->argv[1];
@@ -1361,12 +2296,15 @@ void zaddGenericCommand(client *c, int flags) {
     zobj = lookupKeyWrite(c->db,key);
     if (zobj == NULL) {
         if (xx) goto reply_to_client; /* No key + XX option: nothing to do. */
-        if (server.zset_max_ziplist_entries == 0 ||
-            server.zset_max_ziplist_value < sdslen(c->argv[scoreidx+1]->ptr))
+        /* A batch starts from a listpack anyway: the bulk insertion picks
+         * the right encoding for the whole of it. */
+        if (elements < ZADD_BULK_MIN_ELEMENTS &&
+            (server.zset_max_ziplist_entries == 0 ||
+             server.zset_max_ziplist_value < sdslen(c->argv[scoreidx+1]->ptr)))
         {
             zobj = createZsetObject();
         } else {
-            zobj = createZsetZiplistObject();
+            zobj = createZsetListpackObject();
         }
         dbAdd(c->db,key,zobj);
     } else {
@@ -1376,14 +2314,27 @@ void zaddGenericCommand(client *c, int flags) {
         }
     }
 
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK &&
+        elements >= ZADD_BULK_MIN_ELEMENTS)
+    {
+        robj **eles = zmalloc(sizeof(robj*)*elements);
+
+        for (j = 0; j < elements; j++) eles[j] = c->argv[scoreidx+1+j*2];
+        zsetAddBulk(zobj,eles,scores,elements,flags,
+                    &added,&updated,&processed);
+        for (j = 0; j < elements; j++) c->argv[scoreidx+1+j*2] = eles[j];
+        zfree(eles);
+        goto reply_to_client;
+    }
+
     for (j = 0; j < elements; j++) {
         score = scores[j];
 
-        //ziplist的实现
-        if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
+        //listpack的实现
+        if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
             unsigned char *eptr;
 
-            /* Prefer non-encoded element when dealing with ziplists. */
+            /* Prefer non-encoded element when dealing with listpacks. */
             ele = c->argv[scoreidx+1+j*2];
             if ((eptr = zzlFind(zobj->ptr,ele,&curscore)) != NULL) {
                 if (nx) continue;
@@ -1408,14 +2359,16 @@ void zaddGenericCommand(client *c, int flags) {
                  * becomes too long *before* executing zzlInsert. */
                 zobj->ptr = zzlInsert(zobj->ptr,ele,score);
                 if (zzlLength(zobj->ptr) > server.zset_max_ziplist_entries)
-                    zsetConvert(zobj,OBJ_ENCODING_SKIPLIST);
+                    zsetConvert(zobj,server.zset_large_encoding);
                 if (sdslen(ele->ptr) > server.zset_max_ziplist_value)
-                    zsetConvert(zobj,OBJ_ENCODING_SKIPLIST);
+                    zsetConvert(zobj,server.zset_large_encoding);
                 server.dirty++;
                 added++;
                 processed++;
             }
-        } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
+        } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST ||
+                   zobj->encoding == OBJ_ENCODING_BTREE)
+        {
             //跳跃表skiplist的实现
             zset *zs = zobj->ptr;
             zskiplistNode *znode;
@@ -1427,7 +2380,7 @@ void zaddGenericCommand(client *c, int flags) {
             if (de != NULL) {
                 if (nx) continue;
                 curobj = dictGetKey(de);
-                curscore = *(double*)dictGetVal(de);
+                curscore = zsetDictScore(zs,de);
 
                 if (incr) {
                     score += curscore;
@@ -1442,7 +2395,14 @@ void zaddGenericCommand(client *c, int flags) {
                 /* Remove and re-insert when score changed. We can safely
                  * delete the key object from the skiplist, since the
                  * dictionary still has a reference to it. */
-                if (score != curscore) {
+                if (score != curscore && zs->zbt) {
+                    serverAssertWithInfo(c,curobj,zbtDelete(zs->zbt,curscore,curobj));
+                    zbtInsert(zs->zbt,score,curobj);
+                    incrRefCount(curobj); /* Re-inserted in the B+tree. */
+                    dictSetDoubleVal(de,score);
+                    server.dirty++;
+                    updated++;
+                } else if (score != curscore) {
                     serverAssertWithInfo(c,curobj,zslDelete(zs->zsl,curscore,curobj));
                     znode = zslInsert(zs->zsl,score,curobj);
                     incrRefCount(curobj); /* Re-inserted in skiplist. */
@@ -1452,10 +2412,7 @@ void zaddGenericCommand(client *c, int flags) {
                 }
                 processed++;
             } else if (!xx) {
-                znode = zslInsert(zs->zsl,score,ele);
-                incrRefCount(ele); /* Inserted in skiplist. */
-                serverAssertWithInfo(c,NULL,dictAdd(zs->dict,ele,&znode->score) == DICT_OK);
-                incrRefCount(ele); /* Added to dictionary. */
+                zsetAddNewElement(zs,score,ele);
                 server.dirty++;
                 added++;
                 processed++;
@@ -1500,7 +2457,7 @@ void zremCommand(client *c) {
     if ((zobj = lookupKeyWriteOrReply(c,key,shared.czero)) == NULL ||
         checkType(c,zobj,OBJ_ZSET)) return;
 
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *eptr;
 
         for (j = 2; j < c->argc; j++) {
@@ -1514,7 +2471,9 @@ void zremCommand(client *c) {
                 }
             }
         }
-    } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
+    } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST ||
+               zobj->encoding == OBJ_ENCODING_BTREE)
+    {
         zset *zs = zobj->ptr;
         dictEntry *de;
         double score;
@@ -1524,9 +2483,12 @@ void zremCommand(client *c) {
             if (de != NULL) {
                 deleted++;
 
-                /* Delete from the skiplist */
-                score = *(double*)dictGetVal(de);
-                serverAssertWithInfo(c,c->argv[j],zslDelete(zs->zsl,score,c->argv[j]));
+                /* Delete from the skiplist or the B+tree */
+                score = zsetDictScore(zs,de);
+                if (zs->zbt)
+                    serverAssertWithInfo(c,c->argv[j],zbtDelete(zs->zbt,score,c->argv[j]));
+                else
+                    serverAssertWithInfo(c,c->argv[j],zslDelete(zs->zsl,score,c->argv[j]));
 
                 /* Delete from the hash table */
                 dictDelete(zs->dict,c->argv[j]);
@@ -1603,7 +2565,7 @@ void zremrangeGenericCommand(client *c, int rangetype) {
     }
 
     /* Step 3: Perform the range deletion operation. */
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
         switch(rangetype) {
         case ZRANGE_RANK:
             zobj->ptr = zzlDeleteRangeByRank(zobj->ptr,start+1,end+1,&deleted);
@@ -1637,6 +2599,24 @@ void zremrangeGenericCommand(client *c, int rangetype) {
             dbDelete(c->db,key);
             keyremoved = 1;
         }
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        zset *zs = zobj->ptr;
+        switch(rangetype) {
+        case ZRANGE_RANK:
+            deleted = zbtDeleteRangeByRank(zs->zbt,start+1,end+1,zs->dict);
+            break;
+        case ZRANGE_SCORE:
+            deleted = zbtDeleteRangeByScore(zs->zbt,&range,zs->dict);
+            break;
+        case ZRANGE_LEX:
+            deleted = zbtDeleteRangeByLex(zs->zbt,&lexrange,zs->dict);
+            break;
+        }
+        if (htNeedsResize(zs->dict)) dictResize(zs->dict);
+        if (dictSize(zs->dict) == 0) {
+            dbDelete(c->db,key);
+            keyremoved = 1;
+        }
     } else {
         serverPanic("Unknown sorted set encoding");
     }
@@ -1681,6 +2661,7 @@ typedef struct {
                 intset *is;
                 int ii;
             } is;
+            roaringIterator ri;
             struct {
                 dict *dict;
                 dictIterator *di;
@@ -1691,13 +2672,17 @@ typedef struct {
         /* Sorted set iterators. */
         union _iterzset {
             struct {
-                unsigned char *zl;
+                unsigned char *lp;
                 unsigned char *eptr, *sptr;
-            } zl;
+            } lp;
             struct {
                 zset *zs;
                 zskiplistNode *node;
             } sl;
+            struct {
+                zbtreePos pos;
+                int valid;
+            } bt;
         } zset;
     } iter;
 } zsetopsrc;
@@ -1736,6 +2721,8 @@ void zuiInitIterator(zsetopsrc *op) {
         if (op->encoding == OBJ_ENCODING_INTSET) {
             it->is.is = op->subject->ptr;
             it->is.ii = 0;
+        } else if (op->encoding == OBJ_ENCODING_ROARING) {
+            roaringInitIterator(&it->ri,op->subject->ptr);
         } else if (op->encoding == OBJ_ENCODING_HT) {
             it->ht.dict = op->subject->ptr;
             it->ht.di = dictGetIterator(op->subject->ptr);
@@ -1745,16 +2732,19 @@ void zuiInitIterator(zsetopsrc *op) {
         }
     } else if (op->type == OBJ_ZSET) {
         iterzset *it = &op->iter.zset;
-        if (op->encoding == OBJ_ENCODING_ZIPLIST) {
-            it->zl.zl = op->subject->ptr;
-            it->zl.eptr = ziplistIndex(it->zl.zl,0);
-            if (it->zl.eptr != NULL) {
-                it->zl.sptr = ziplistNext(it->zl.zl,it->zl.eptr);
-                serverAssert(it->zl.sptr != NULL);
+        if (op->encoding == OBJ_ENCODING_LISTPACK) {
+            it->lp.lp = op->subject->ptr;
+            it->lp.eptr = lpFirst(it->lp.lp);
+            if (it->lp.eptr != NULL) {
+                it->lp.sptr = lpNext(it->lp.lp,it->lp.eptr);
+                serverAssert(it->lp.sptr != NULL);
             }
         } else if (op->encoding == OBJ_ENCODING_SKIPLIST) {
             it->sl.zs = op->subject->ptr;
             it->sl.node = it->sl.zs->zsl->header->level[0].forward;
+        } else if (op->encoding == OBJ_ENCODING_BTREE) {
+            zset *zs = op->subject->ptr;
+            it->bt.valid = zbtFirst(zs->zbt,&it->bt.pos);
         } else {
             serverPanic("Unknown sorted set encoding");
         }
@@ -1769,7 +2759,9 @@ void zuiClearIterator(zsetopsrc *op) {
 
     if (op->type == OBJ_SET) {
         iterset *it = &op->iter.set;
-        if (op->encoding == OBJ_ENCODING_INTSET) {
+        if (op->encoding == OBJ_ENCODING_INTSET ||
+            op->encoding == OBJ_ENCODING_ROARING)
+        {
             UNUSED(it); /* skip */
         } else if (op->encoding == OBJ_ENCODING_HT) {
             dictReleaseIterator(it->ht.di);
@@ -1778,9 +2770,11 @@ void zuiClearIterator(zsetopsrc *op) {
         }
     } else if (op->type == OBJ_ZSET) {
         iterzset *it = &op->iter.zset;
-        if (op->encoding == OBJ_ENCODING_ZIPLIST) {
+        if (op->encoding == OBJ_ENCODING_LISTPACK) {
             UNUSED(it); /* skip */
-        } else if (op->encoding == OBJ_ENCODING_SKIPLIST) {
+        } else if (op->encoding == OBJ_ENCODING_SKIPLIST ||
+                   op->encoding == OBJ_ENCODING_BTREE)
+        {
             UNUSED(it); /* skip */
         } else {
             serverPanic("Unknown sorted set encoding");
@@ -1797,6 +2791,8 @@ int zuiLength(zsetopsrc *op) {
     if (op->type == OBJ_SET) {
         if (op->encoding == OBJ_ENCODING_INTSET) {
             return intsetLen(op->subject->ptr);
+        } else if (op->encoding == OBJ_ENCODING_ROARING) {
+            return roaringCard(op->subject->ptr);
         } else if (op->encoding == OBJ_ENCODING_HT) {
             dict *ht = op->subject->ptr;
             return dictSize(ht);
@@ -1804,11 +2800,14 @@ int zuiLength(zsetopsrc *op) {
             serverPanic("Unknown set encoding");
         }
     } else if (op->type == OBJ_ZSET) {
-        if (op->encoding == OBJ_ENCODING_ZIPLIST) {
+        if (op->encoding == OBJ_ENCODING_LISTPACK) {
             return zzlLength(op->subject->ptr);
         } else if (op->encoding == OBJ_ENCODING_SKIPLIST) {
             zset *zs = op->subject->ptr;
             return zs->zsl->length;
+        } else if (op->encoding == OBJ_ENCODING_BTREE) {
+            zset *zs = op->subject->ptr;
+            return zs->zbt->length;
         } else {
             serverPanic("Unknown sorted set encoding");
         }
@@ -1841,6 +2840,13 @@ int zuiNext(zsetopsrc *op, zsetopval *val) {
 
             /* Move to next element. */
             it->is.ii++;
+        } else if (op->encoding == OBJ_ENCODING_ROARING) {
+            int64_t ell;
+
+            if (!roaringNext(&it->ri,&ell))
+                return 0;
+            val->ell = ell;
+            val->score = 1.0;
         } else if (op->encoding == OBJ_ENCODING_HT) {
             if (it->ht.de == NULL)
                 return 0;
@@ -1854,15 +2860,15 @@ int zuiNext(zsetopsrc *op, zsetopval *val) {
         }
     } else if (op->type == OBJ_ZSET) {
         iterzset *it = &op->iter.zset;
-        if (op->encoding == OBJ_ENCODING_ZIPLIST) {
+        if (op->encoding == OBJ_ENCODING_LISTPACK) {
             /* No need to check both, but better be explicit. */
-            if (it->zl.eptr == NULL || it->zl.sptr == NULL)
+            if (it->lp.eptr == NULL || it->lp.sptr == NULL)
                 return 0;
-            serverAssert(ziplistGet(it->zl.eptr,&val->estr,&val->elen,&val->ell));
-            val->score = zzlGetScore(it->zl.sptr);
+            val->estr = lpGetValue(it->lp.eptr,&val->elen,&val->ell);
+            val->score = zzlGetScore(it->lp.sptr);
 
             /* Move to next element. */
-            zzlNext(it->zl.zl,&it->zl.eptr,&it->zl.sptr);
+            zzlNext(it->lp.lp,&it->lp.eptr,&it->lp.sptr);
         } else if (op->encoding == OBJ_ENCODING_SKIPLIST) {
             if (it->sl.node == NULL)
                 return 0;
@@ -1871,6 +2877,14 @@ int zuiNext(zsetopsrc *op, zsetopval *val) {
 
             /* Move to next element. */
             it->sl.node = it->sl.node->level[0].forward;
+        } else if (op->encoding == OBJ_ENCODING_BTREE) {
+            if (!it->bt.valid)
+                return 0;
+            val->ele = zbtPosObj(&it->bt.pos);
+            val->score = zbtPosScore(&it->bt.pos);
+
+            /* Move to next element. */
+            it->bt.valid = zbtNext(&it->bt.pos);
         } else {
             serverPanic("Unknown sorted set encoding");
         }
@@ -1953,6 +2967,15 @@ int zuiFind(zsetopsrc *op, zsetopval *val, double *score) {
             } else {
                 return 0;
             }
+        } else if (op->encoding == OBJ_ENCODING_ROARING) {
+            if (zuiLongLongFromValue(val) &&
+                roaringContains(op->subject->ptr,val->ell))
+            {
+                *score = 1.0;
+                return 1;
+            } else {
+                return 0;
+            }
         } else if (op->encoding == OBJ_ENCODING_HT) {
             dict *ht = op->subject->ptr;
             zuiObjectFromValue(val);
@@ -1968,18 +2991,20 @@ int zuiFind(zsetopsrc *op, zsetopval *val, double *score) {
     } else if (op->type == OBJ_ZSET) {
         zuiObjectFromValue(val);
 
-        if (op->encoding == OBJ_ENCODING_ZIPLIST) {
+        if (op->encoding == OBJ_ENCODING_LISTPACK) {
             if (zzlFind(op->subject->ptr,val->ele,score) != NULL) {
                 /* Score is already set by zzlFind. */
                 return 1;
             } else {
                 return 0;
             }
-        } else if (op->encoding == OBJ_ENCODING_SKIPLIST) {
+        } else if (op->encoding == OBJ_ENCODING_SKIPLIST ||
+                   op->encoding == OBJ_ENCODING_BTREE)
+        {
             zset *zs = op->subject->ptr;
             dictEntry *de;
             if ((de = dictFind(zs->dict,val->ele)) != NULL) {
-                *score = *(double*)dictGetVal(de);
+                *score = zsetDictScore(zs,de);
                 return 1;
             } else {
                 return 0;
@@ -2028,7 +3053,6 @@ void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
     unsigned int maxelelen = 0;
     robj *dstobj;
     zset *dstzset;
-    zskiplistNode *znode;
     int touched = 0;
 
     /* expect setnum input keys to be given */
@@ -2143,10 +3167,7 @@ void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
                 /* Only continue when present in every input. */
                 if (j == setnum) {
                     tmp = zuiObjectFromValue(&zval);
-                    znode = zslInsert(dstzset->zsl,score,tmp);
-                    incrRefCount(tmp); /* added to skiplist */
-                    dictAdd(dstzset->dict,tmp,&znode->score);
-                    incrRefCount(tmp); /* added to dictionary */
+                    zsetAddNewElement(dstzset,score,tmp);
 
                     if (sdsEncodedObject(tmp)) {
                         if (sdslen(tmp->ptr) > maxelelen)
@@ -2185,7 +3206,7 @@ void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
                 if (de == NULL) {
                     tmp = zuiObjectFromValue(&zval);
                     /* Remember the longest single element encountered,
-                     * to understand if it's possible to convert to ziplist
+                     * to understand if it's possible to convert to listpack
                      * at the end. */
                     if (sdsEncodedObject(tmp)) {
                         if (sdslen(tmp->ptr) > maxelelen)
@@ -2219,10 +3240,7 @@ void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
         while((de = dictNext(di)) != NULL) {
             robj *ele = dictGetKey(de);
             score = dictGetDoubleVal(de);
-            znode = zslInsert(dstzset->zsl,score,ele);
-            incrRefCount(ele); /* added to skiplist */
-            dictAdd(dstzset->dict,ele,&znode->score);
-            incrRefCount(ele); /* added to dictionary */
+            zsetAddNewElement(dstzset,score,ele);
         }
         dictReleaseIterator(di);
 
@@ -2234,8 +3252,8 @@ void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
 
     if (dbDelete(c->db,dstkey))
         touched = 1;
-    if (dstzset->zsl->length) {
-        zsetConvertToZiplistIfNeeded(dstobj,maxelelen);
+    if (zsetLength(dstobj)) {
+        zsetConvertToListpackIfNeeded(dstobj,maxelelen);
         dbAdd(c->db,dstkey,dstobj);
         addReplyLongLong(c,zsetLength(dstobj));
         signalModifiedKey(c->db,dstkey);
@@ -2303,24 +3321,24 @@ void zrangeGenericCommand(client *c, int reverse) {
     /* Return the result in form of a multi-bulk reply */
     addReplyMultiBulkLen(c, withscores ? (rangelen*2) : rangelen);
 
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
-        unsigned char *zl = zobj->ptr;
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
+        unsigned char *lp = zobj->ptr;
         unsigned char *eptr, *sptr;
         unsigned char *vstr;
         unsigned int vlen;
         long long vlong;
 
         if (reverse)
-            eptr = ziplistIndex(zl,-2-(2*start));
+            eptr = lpSeek(lp,-2-(2*start));
         else
-            eptr = ziplistIndex(zl,2*start);
+            eptr = lpSeek(lp,2*start);
 
         serverAssertWithInfo(c,zobj,eptr != NULL);
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(lp,eptr);
 
         while (rangelen--) {
             serverAssertWithInfo(c,zobj,eptr != NULL && sptr != NULL);
-            serverAssertWithInfo(c,zobj,ziplistGet(eptr,&vstr,&vlen,&vlong));
+            vstr = lpGetValue(eptr,&vlen,&vlong);
             if (vstr == NULL)
                 addReplyBulkLongLong(c,vlong);
             else
@@ -2330,9 +3348,9 @@ void zrangeGenericCommand(client *c, int reverse) {
                 addReplyDouble(c,zzlGetScore(sptr));
 
             if (reverse)
-                zzlPrev(zl,&eptr,&sptr);
+                zzlPrev(lp,&eptr,&sptr);
             else
-                zzlNext(zl,&eptr,&sptr);
+                zzlNext(lp,&eptr,&sptr);
         }
 
     } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
@@ -2360,6 +3378,19 @@ void zrangeGenericCommand(client *c, int reverse) {
                 addReplyDouble(c,ln->score);
             ln = reverse ? ln->backward : ln->level[0].forward;
         }
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        zset *zs = zobj->ptr;
+        zbtreePos pos;
+        int valid;
+
+        valid = zbtGetElementByRank(zs->zbt,reverse ? llen-start : start+1,&pos);
+        while(rangelen--) {
+            serverAssertWithInfo(c,zobj,valid);
+            addReplyBulk(c,zbtPosObj(&pos));
+            if (withscores)
+                addReplyDouble(c,zbtPosScore(&pos));
+            valid = reverse ? zbtPrev(&pos) : zbtNext(&pos);
+        }
     } else {
         serverPanic("Unknown sorted set encoding");
     }
@@ -2423,8 +3454,8 @@ void genericZrangebyscoreCommand(client *c, int reverse) {
     if ((zobj = lookupKeyReadOrReply(c,key,shared.emptymultibulk)) == NULL ||
         checkType(c,zobj,OBJ_ZSET)) return;
 
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
-        unsigned char *zl = zobj->ptr;
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
+        unsigned char *lp = zobj->ptr;
         unsigned char *eptr, *sptr;
         unsigned char *vstr;
         unsigned int vlen;
@@ -2433,9 +3464,9 @@ void genericZrangebyscoreCommand(client *c, int reverse) {
 
         /* If reversed, get the last node in range as starting point. */
         if (reverse) {
-            eptr = zzlLastInRange(zl,&range);
+            eptr = zzlLastInRange(lp,&range);
         } else {
-            eptr = zzlFirstInRange(zl,&range);
+            eptr = zzlFirstInRange(lp,&range);
         }
 
         /* No "first" element in the specified interval. */
@@ -2446,7 +3477,7 @@ void genericZrangebyscoreCommand(client *c, int reverse) {
 
         /* Get score pointer for the first element. */
         serverAssertWithInfo(c,zobj,eptr != NULL);
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(lp,eptr);
 
         /* We don't know in advance how many matching elements there are in the
          * list, so we push this object that will represent the multi-bulk
@@ -2457,9 +3488,9 @@ void genericZrangebyscoreCommand(client *c, int reverse) {
          * checking the score because that is done in the next loop. */
         while (eptr && offset--) {
             if (reverse) {
-                zzlPrev(zl,&eptr,&sptr);
+                zzlPrev(lp,&eptr,&sptr);
             } else {
-                zzlNext(zl,&eptr,&sptr);
+                zzlNext(lp,&eptr,&sptr);
             }
         }
 
@@ -2473,8 +3504,7 @@ void genericZrangebyscoreCommand(client *c, int reverse) {
                 if (!zslValueLteMax(score,&range)) break;
             }
 
-            /* We know the element exists, so ziplistGet should always succeed */
-            serverAssertWithInfo(c,zobj,ziplistGet(eptr,&vstr,&vlen,&vlong));
+            vstr = lpGetValue(eptr,&vlen,&vlong);
 
             rangelen++;
             if (vstr == NULL) {
@@ -2489,9 +3519,9 @@ void genericZrangebyscoreCommand(client *c, int reverse) {
 
             /* Move to next node */
             if (reverse) {
-                zzlPrev(zl,&eptr,&sptr);
+                zzlPrev(lp,&eptr,&sptr);
             } else {
-                zzlNext(zl,&eptr,&sptr);
+                zzlNext(lp,&eptr,&sptr);
             }
         }
     } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
@@ -2549,6 +3579,48 @@ void genericZrangebyscoreCommand(client *c, int reverse) {
                 ln = ln->level[0].forward;
             }
         }
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        zset *zs = zobj->ptr;
+        zbtreePos pos;
+        int valid;
+
+        /* If reversed, get the last element in range as starting point. */
+        if (reverse) {
+            valid = zbtLastInRange(zs->zbt,&range,&pos);
+        } else {
+            valid = zbtFirstInRange(zs->zbt,&range,&pos);
+        }
+
+        /* No "first" element in the specified interval. */
+        if (!valid) {
+            addReply(c, shared.emptymultibulk);
+            return;
+        }
+
+        replylen = addDeferredMultiBulkLength(c);
+
+        /* If there is an offset, just traverse the number of elements without
+         * checking the score because that is done in the next loop. */
+        while (valid && offset--)
+            valid = reverse ? zbtPrev(&pos) : zbtNext(&pos);
+
+        while (valid && limit--) {
+            /* Abort when the element is no longer in range. */
+            if (reverse) {
+                if (!zslValueGteMin(zbtPosScore(&pos),&range)) break;
+            } else {
+                if (!zslValueLteMax(zbtPosScore(&pos),&range)) break;
+            }
+
+            rangelen++;
+            addReplyBulk(c,zbtPosObj(&pos));
+
+            if (withscores) {
+                addReplyDouble(c,zbtPosScore(&pos));
+            }
+
+            valid = reverse ? zbtPrev(&pos) : zbtNext(&pos);
+        }
     } else {
         serverPanic("Unknown sorted set encoding");
     }
@@ -2584,13 +3656,13 @@ void zcountCommand(client *c) {
     if ((zobj = lookupKeyReadOrReply(c, key, shared.czero)) == NULL ||
         checkType(c, zobj, OBJ_ZSET)) return;
 
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
-        unsigned char *zl = zobj->ptr;
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
+        unsigned char *lp = zobj->ptr;
         unsigned char *eptr, *sptr;
         double score;
 
         /* Use the first element in range as the starting point */
-        eptr = zzlFirstInRange(zl,&range);
+        eptr = zzlFirstInRange(lp,&range);
 
         /* No "first" element */
         if (eptr == NULL) {
@@ -2599,7 +3671,7 @@ void zcountCommand(client *c) {
         }
 
         /* First element is in range */
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(lp,eptr);
         score = zzlGetScore(sptr);
         serverAssertWithInfo(c,zobj,zslValueLteMax(score,&range));
 
@@ -2612,7 +3684,7 @@ void zcountCommand(client *c) {
                 break;
             } else {
                 count++;
-                zzlNext(zl,&eptr,&sptr);
+                zzlNext(lp,&eptr,&sptr);
             }
         }
     } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
@@ -2638,6 +3710,18 @@ void zcountCommand(client *c) {
                 count -= (zsl->length - rank);
             }
         }
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        zset *zs = zobj->ptr;
+        zbtreePos first, last;
+
+        /* The count is the difference of the ranks of the first and the
+         * last element in range. */
+        if (zbtFirstInRange(zs->zbt,&range,&first) &&
+            zbtLastInRange(zs->zbt,&range,&last))
+        {
+            count = zbtGetRank(zs->zbt,zbtPosScore(&last),zbtPosObj(&last)) -
+                    zbtGetRank(zs->zbt,zbtPosScore(&first),zbtPosObj(&first)) + 1;
+        }
     } else {
         serverPanic("Unknown sorted set encoding");
     }
@@ -2665,12 +3749,12 @@ void zlexcountCommand(client *c) {
         return;
     }
 
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
-        unsigned char *zl = zobj->ptr;
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
+        unsigned char *lp = zobj->ptr;
         unsigned char *eptr, *sptr;
 
         /* Use the first element in range as the starting point */
-        eptr = zzlFirstInLexRange(zl,&range);
+        eptr = zzlFirstInLexRange(lp,&range);
 
         /* No "first" element */
         if (eptr == NULL) {
@@ -2680,7 +3764,7 @@ void zlexcountCommand(client *c) {
         }
 
         /* First element is in range */
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(lp,eptr);
         serverAssertWithInfo(c,zobj,zzlLexValueLteMax(eptr,&range));
 
         /* Iterate over elements in range */
@@ -2690,7 +3774,7 @@ void zlexcountCommand(client *c) {
                 break;
             } else {
                 count++;
-                zzlNext(zl,&eptr,&sptr);
+                zzlNext(lp,&eptr,&sptr);
             }
         }
     } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
@@ -2716,6 +3800,16 @@ void zlexcountCommand(client *c) {
                 count -= (zsl->length - rank);
             }
         }
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        zset *zs = zobj->ptr;
+        zbtreePos first, last;
+
+        if (zbtFirstInLexRange(zs->zbt,&range,&first) &&
+            zbtLastInLexRange(zs->zbt,&range,&last))
+        {
+            count = zbtGetRank(zs->zbt,zbtPosScore(&last),zbtPosObj(&last)) -
+                    zbtGetRank(zs->zbt,zbtPosScore(&first),zbtPosObj(&first)) + 1;
+        }
     } else {
         serverPanic("Unknown sorted set encoding");
     }
@@ -2775,8 +3869,8 @@ void genericZrangebylexCommand(client *c, int reverse) {
         return;
     }
 
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
-        unsigned char *zl = zobj->ptr;
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
+        unsigned char *lp = zobj->ptr;
         unsigned char *eptr, *sptr;
         unsigned char *vstr;
         unsigned int vlen;
@@ -2784,9 +3878,9 @@ void genericZrangebylexCommand(client *c, int reverse) {
 
         /* If reversed, get the last node in range as starting point. */
         if (reverse) {
-            eptr = zzlLastInLexRange(zl,&range);
+            eptr = zzlLastInLexRange(lp,&range);
         } else {
-            eptr = zzlFirstInLexRange(zl,&range);
+            eptr = zzlFirstInLexRange(lp,&range);
         }
 
         /* No "first" element in the specified interval. */
@@ -2798,7 +3892,7 @@ void genericZrangebylexCommand(client *c, int reverse) {
 
         /* Get score pointer for the first element. */
         serverAssertWithInfo(c,zobj,eptr != NULL);
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(lp,eptr);
 
         /* We don't know in advance how many matching elements there are in the
          * list, so we push this object that will represent the multi-bulk
@@ -2809,9 +3903,9 @@ void genericZrangebylexCommand(client *c, int reverse) {
          * checking the score because that is done in the next loop. */
         while (eptr && offset--) {
             if (reverse) {
-                zzlPrev(zl,&eptr,&sptr);
+                zzlPrev(lp,&eptr,&sptr);
             } else {
-                zzlNext(zl,&eptr,&sptr);
+                zzlNext(lp,&eptr,&sptr);
             }
         }
 
@@ -2823,9 +3917,9 @@ void genericZrangebylexCommand(client *c, int reverse) {
                 if (!zzlLexValueLteMax(eptr,&range)) break;
             }
 
-            /* We know the element exists, so ziplistGet should always
+            /* We know the element exists, so lpGetValue should always
              * succeed. */
-            serverAssertWithInfo(c,zobj,ziplistGet(eptr,&vstr,&vlen,&vlong));
+            vstr = lpGetValue(eptr,&vlen,&vlong);
 
             rangelen++;
             if (vstr == NULL) {
@@ -2836,9 +3930,9 @@ void genericZrangebylexCommand(client *c, int reverse) {
 
             /* Move to next node */
             if (reverse) {
-                zzlPrev(zl,&eptr,&sptr);
+                zzlPrev(lp,&eptr,&sptr);
             } else {
-                zzlNext(zl,&eptr,&sptr);
+                zzlNext(lp,&eptr,&sptr);
             }
         }
     } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
@@ -2893,6 +3987,42 @@ void genericZrangebylexCommand(client *c, int reverse) {
                 ln = ln->level[0].forward;
             }
         }
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        zset *zs = zobj->ptr;
+        zbtreePos pos;
+        int valid;
+
+        /* If reversed, get the last element in range as starting point. */
+        if (reverse) {
+            valid = zbtLastInLexRange(zs->zbt,&range,&pos);
+        } else {
+            valid = zbtFirstInLexRange(zs->zbt,&range,&pos);
+        }
+
+        /* No "first" element in the specified interval. */
+        if (!valid) {
+            addReply(c, shared.emptymultibulk);
+            zslFreeLexRange(&range);
+            return;
+        }
+
+        replylen = addDeferredMultiBulkLength(c);
+
+        while (valid && offset--)
+            valid = reverse ? zbtPrev(&pos) : zbtNext(&pos);
+
+        while (valid && limit--) {
+            /* Abort when the element is no longer in range. */
+            if (reverse) {
+                if (!zslLexValueGteMin(zbtPosObj(&pos),&range)) break;
+            } else {
+                if (!zslLexValueLteMax(zbtPosObj(&pos),&range)) break;
+            }
+
+            rangelen++;
+            addReplyBulk(c,zbtPosObj(&pos));
+            valid = reverse ? zbtPrev(&pos) : zbtNext(&pos);
+        }
     } else {
         serverPanic("Unknown sorted set encoding");
     }
@@ -2947,21 +4077,21 @@ void zrankGenericCommand(client *c, int reverse) {
 
     serverAssertWithInfo(c,ele,sdsEncodedObject(ele));
 
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
-        unsigned char *zl = zobj->ptr;
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
+        unsigned char *lp = zobj->ptr;
         unsigned char *eptr, *sptr;
 
-        eptr = ziplistIndex(zl,0);
+        eptr = lpFirst(lp);
         serverAssertWithInfo(c,zobj,eptr != NULL);
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(lp,eptr);
         serverAssertWithInfo(c,zobj,sptr != NULL);
 
         rank = 1;
         while(eptr != NULL) {
-            if (ziplistCompare(eptr,ele->ptr,sdslen(ele->ptr)))
+            if (lpCompare(eptr,ele->ptr,sdslen(ele->ptr)))
                 break;
             rank++;
-            zzlNext(zl,&eptr,&sptr);
+            zzlNext(lp,&eptr,&sptr);
         }
 
         if (eptr != NULL) {
@@ -2991,6 +4121,21 @@ void zrankGenericCommand(client *c, int reverse) {
         } else {
             addReply(c,shared.nullbulk);
         }
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        zset *zs = zobj->ptr;
+        dictEntry *de;
+
+        de = dictFind(zs->dict,ele);
+        if (de != NULL) {
+            rank = zbtGetRank(zs->zbt,dictGetDoubleVal(de),ele);
+            serverAssertWithInfo(c,ele,rank); /* Existing elements always have a rank. */
+            if (reverse)
+                addReplyLongLong(c,llen-rank);
+            else
+                addReplyLongLong(c,rank-1);
+        } else {
+            addReply(c,shared.nullbulk);
+        }
     } else {
         serverPanic("Unknown sorted set encoding");
     }
@@ -3013,3 +4158,138 @@ void zscanCommand(client *c) {
         checkType(c,o,OBJ_ZSET)) return;
     scanGenericCommand(c,o,cursor);
 }
+
+#ifdef REDIS_TEST
+#include <sys/time.h>
+
+static long long zsetTestUsec(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv,NULL);
+    return (((long long)tv.tv_sec)*1000000)+tv.tv_usec;
+}
+
+static void zsetTestAssert(int cond, char *what) {
+    if (!cond) {
+        printf("ERROR: %s\n", what);
+        exit(1);
+    }
+}
+
+/* Add new members one at a time, as ZADD did before zsetAddBulk(): a
+ * search and an insertion in the listpack until it gets too big, then one
+ * conversion and an insertion per member in the skiplist or B+tree. */
+static void zsetTestAddOneByOne(robj *zobj, robj **eles, double *scores, int count) {
+    int j;
+
+    for (j = 0; j < count; j++) {
+        if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
+            if (zzlFind(zobj->ptr,eles[j],NULL) != NULL) continue;
+            zobj->ptr = zzlInsert(zobj->ptr,eles[j],scores[j]);
+            if (zzlLength(zobj->ptr) > server.zset_max_ziplist_entries ||
+                sdslen(eles[j]->ptr) > server.zset_max_ziplist_value)
+                zsetConvert(zobj,server.zset_large_encoding);
+        } else {
+            zset *zs = zobj->ptr;
+            if (dictFind(zs->dict,eles[j]) == NULL)
+                zsetAddNewElement(zs,scores[j],eles[j]);
+        }
+    }
+}
+
+/* Check that the two sorted sets hold the same elements, and that the ranks
+ * of the skiplist are right. */
+static void zsetTestCompare(robj *a, robj *b, robj **eles, int count) {
+    double s1, s2;
+    int j;
+
+    zsetTestAssert(a->encoding == b->encoding, "same encoding");
+    zsetTestAssert(zsetLength(a) == zsetLength(b), "same length");
+    for (j = 0; j < count; j++) {
+        zsetTestAssert(zsetScore(a,eles[j],&s1) == C_OK &&
+                       zsetScore(b,eles[j],&s2) == C_OK &&
+                       s1 == s2, "same scores");
+    }
+    if (b->encoding == OBJ_ENCODING_SKIPLIST) {
+        zskiplist *zsl = ((zset*)b->ptr)->zsl;
+        zskiplistNode *x = zsl->header->level[0].forward;
+        unsigned long rank = 1;
+
+        for (; x; x = x->level[0].forward, rank++) {
+            zsetTestAssert(zslGetRank(zsl,x->score,x->obj) == rank, "rank");
+            zsetTestAssert(x->level[0].forward == NULL ||
+                           x->level[0].forward->backward == x, "backward");
+        }
+        zsetTestAssert(zsl->tail && rank-1 == zsl->length, "tail");
+    }
+}
+
+/* Throughput of one ZADD of 'batch' new members against an empty key, with
+ * the members added one by one as ZADD used to do and with zsetAddBulk(). */
+static void zsetTestBenchmark(int batch, long total) {
+    robj **eles = zmalloc(sizeof(robj*)*batch);
+    double *scores = zmalloc(sizeof(double)*batch);
+    long rounds = total/batch > 0 ? total/batch : 1, r;
+    long long start, onebyone = 0, bulk = 0;
+    int j, added, updated, processed;
+
+    for (j = 0; j < batch; j++) {
+        char buf[32];
+        int len = snprintf(buf,sizeof(buf),"member:%d",j);
+        eles[j] = createStringObject(buf,len);
+    }
+
+    for (r = 0; r < rounds; r++) {
+        robj *a = createZsetListpackObject();
+        robj *b = createZsetListpackObject();
+
+        for (j = 0; j < batch; j++) scores[j] = rand() % (batch*4);
+
+        start = zsetTestUsec();
+        zsetTestAddOneByOne(a,eles,scores,batch);
+        onebyone += zsetTestUsec()-start;
+
+        added = updated = processed = 0;
+        start = zsetTestUsec();
+        zsetAddBulk(b,eles,scores,batch,0,&added,&updated,&processed);
+        bulk += zsetTestUsec()-start;
+
+        zsetTestAssert(added == batch && processed == batch, "added");
+        if (r == 0) zsetTestCompare(a,b,eles,batch);
+        decrRefCount(a);
+        decrRefCount(b);
+    }
+
+    printf("%6d elements per ZADD, %s: one by one %.1f ns/element, "
+           "bulk %.1f ns/element\n", batch,
+           server.zset_large_encoding == OBJ_ENCODING_BTREE ?
+               "btree" : "skiplist",
+           (double)onebyone*1000/(rounds*batch),
+           (double)bulk*1000/(rounds*batch));
+    for (j = 0; j < batch; j++) decrRefCount(eles[j]);
+    zfree(eles);
+    zfree(scores);
+}
+
+int zsetTest(int argc, char *argv[]) {
+    int batches[] = {10,100,1000,10000}, j, enc;
+    long total = 1000000;
+
+    if (argc >= 4) total = strtol(argv[3],NULL,10);
+    srand(time(NULL));
+    /* The logging is not set up in test mode, and the comparison of the
+     * zset dict keys logs. */
+    server.verbosity = LL_WARNING+1;
+    server.hz = CONFIG_DEFAULT_HZ;
+    server.zset_max_ziplist_entries = OBJ_ZSET_MAX_ZIPLIST_ENTRIES;
+    server.zset_max_ziplist_value = OBJ_ZSET_MAX_ZIPLIST_VALUE;
+
+    for (enc = 0; enc < 2; enc++) {
+        server.zset_large_encoding =
+            enc ? OBJ_ENCODING_BTREE : OBJ_ENCODING_SKIPLIST;
+        for (j = 0; j < (int)(sizeof(batches)/sizeof(int)); j++)
+            zsetTestBenchmark(batches[j],total);
+    }
+    return 0;
+}
+#endif
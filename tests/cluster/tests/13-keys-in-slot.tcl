@@ -0,0 +1,64 @@
+# Check the per slot index of the keys used by COUNTKEYSINSLOT,
+# GETKEYSINSLOT and SCAN with the SLOT option.
+
+source "../tests/includes/init-tests.tcl"
+
+test "Create a 1 node cluster" {
+    create_cluster 1 0
+}
+
+test "Cluster is up" {
+    assert_cluster_state ok
+}
+
+test "The keys of a slot are tracked while adding and deleting keys" {
+    set slot [R 0 cluster keyslot {tag}]
+    for {set j 0} {$j < 1000} {incr j} {
+        R 0 set "{tag}.$j" $j
+        R 0 set "other.$j" $j
+    }
+    assert {[R 0 cluster countkeysinslot $slot] == 1000}
+    assert {[llength [R 0 cluster getkeysinslot $slot 10]] == 10}
+    assert {[llength [R 0 cluster getkeysinslot $slot 5000]] == 1000}
+    foreach key [R 0 cluster getkeysinslot $slot 5000] {
+        assert {[string match "{tag}.*" $key]}
+    }
+
+    for {set j 0} {$j < 500} {incr j} {
+        R 0 del "{tag}.$j"
+    }
+    R 0 rename "{tag}.999" "{tag}.renamed"
+    R 0 unlink "{tag}.998"
+    assert {[R 0 cluster countkeysinslot $slot] == 499}
+}
+
+test "SCAN with the SLOT option only returns the keys of the slot" {
+    set slot [R 0 cluster keyslot {tag}]
+    set cur 0
+    set keys {}
+    while 1 {
+        set res [R 0 scan $cur slot $slot count 100]
+        set cur [lindex $res 0]
+        lappend keys {*}[lindex $res 1]
+        if {$cur == 0} break
+    }
+    assert {[llength [lsort -unique $keys]] == 499}
+    foreach key $keys {
+        assert {[string match "{tag}.*" $key]}
+    }
+    set empty 0
+    while {[R 0 cluster countkeysinslot $empty] != 0} {incr empty}
+    assert {[R 0 scan 0 slot $empty] eq {0 {}}}
+    catch {R 0 scan 0 slot 16384} err
+    assert_match {*Invalid slot*} $err
+}
+
+test "FLUSHALL and FLUSHALL ASYNC clear the keys of all the slots" {
+    set slot [R 0 cluster keyslot {tag}]
+    R 0 flushall async
+    assert {[R 0 cluster countkeysinslot $slot] == 0}
+    assert {[R 0 cluster getkeysinslot $slot 10] eq {}}
+    R 0 set "{tag}.1" 1
+    R 0 flushall
+    assert {[R 0 cluster countkeysinslot $slot] == 0}
+}
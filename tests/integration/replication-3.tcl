@@ -99,3 +99,42 @@ start_server {tags {"repl"}} {
         }
     }
 }
+
+start_server {tags {"repl"}} {
+    start_server {} {
+        start_server {} {
+            set master [srv -2 client]
+            set master_host [srv -2 host]
+            set master_port [srv -2 port]
+            set slave1 [srv -1 client]
+            set slave2 [srv 0 client]
+
+            test {Big and small commands shared by the output buffers of many slaves} {
+                $slave1 slaveof $master_host $master_port
+                $slave2 slaveof $master_host $master_port
+                wait_for_condition 50 100 {
+                    [status $slave1 master_link_status] eq {up} &&
+                    [status $slave2 master_link_status] eq {up}
+                } else {
+                    fail "Replication not started."
+                }
+                for {set j 0} {$j < 200} {incr j} {
+                    $master set small:$j $j
+                    $master set big:$j [string repeat $j [expr {1000+$j*50}]]
+                    $master rpush list $j [string repeat x 2000]
+                    if {$j % 10 == 0} {$master select [expr {9+($j/10)%2}]}
+                }
+                wait_for_condition 50 100 {
+                    [status $master master_repl_offset] ==
+                    [status $slave1 master_repl_offset] &&
+                    [status $master master_repl_offset] ==
+                    [status $slave2 master_repl_offset]
+                } else {
+                    fail "Slaves not in sync"
+                }
+                assert_equal [$master debug digest] [$slave1 debug digest]
+                assert_equal [$master debug digest] [$slave2 debug digest]
+            }
+        }
+    }
+}
@@ -0,0 +1,133 @@
+# Partial resynchronizations after a failover and after a restart, thanks
+# to the replication ID inherited by the slaves and saved in the RDB file.
+
+proc wait_for_link_up {r} {
+    wait_for_condition 50 100 {
+        [status $r master_link_status] eq {up}
+    } else {
+        fail "Replication link not established"
+    }
+}
+
+proc wait_for_same_offset {a b} {
+    wait_for_condition 50 100 {
+        [status $a master_repl_offset] == [status $b master_repl_offset]
+    } else {
+        fail "Replication offsets don't match"
+    }
+}
+
+start_server {tags {"repl"}} {
+    start_server {} {
+        start_server {} {
+            set master [srv -2 client]
+            set master_host [srv -2 host]
+            set master_port [srv -2 port]
+            set slave1 [srv -1 client]
+            set slave1_host [srv -1 host]
+            set slave1_port [srv -1 port]
+            set slave2 [srv 0 client]
+
+            # No PINGs, so that the offsets only change with the writes.
+            $master config set repl-ping-slave-period 3600
+
+            test {PSYNC2: Set up a master with two slaves} {
+                $slave1 slaveof $master_host $master_port
+                $slave2 slaveof $master_host $master_port
+                wait_for_link_up $slave1
+                wait_for_link_up $slave2
+                $master select 9
+                for {set j 0} {$j < 1000} {incr j} {
+                    $master set key:$j $j
+                }
+                $master select 10
+                $master set otherdb x
+                wait_for_same_offset $master $slave1
+                wait_for_same_offset $master $slave2
+                assert_equal [status $master master_replid] \
+                             [status $slave1 master_replid]
+                assert_equal [$master debug digest] [$slave2 debug digest]
+            }
+
+            test {PSYNC2: A promoted slave shifts its replication ID} {
+                set oldid [status $slave1 master_replid]
+                set offset [status $slave1 master_repl_offset]
+                $slave1 slaveof no one
+                assert_equal $oldid [status $slave1 master_replid2]
+                assert_equal [expr {$offset+1}] \
+                             [status $slave1 second_repl_offset]
+                assert {[status $slave1 master_replid] ne $oldid}
+            }
+
+            test {PSYNC2: The other slave partially resyncs with the new master} {
+                set full [status $slave1 sync_full]
+                $slave2 slaveof $slave1_host $slave1_port
+                wait_for_link_up $slave2
+                assert_equal 1 [status $slave1 sync_partial_ok]
+                assert_equal $full [status $slave1 sync_full]
+                assert_equal [status $slave1 master_replid] \
+                             [status $slave2 master_replid]
+            }
+
+            test {PSYNC2: The old master partially resyncs as a slave} {
+                $master slaveof $slave1_host $slave1_port
+                wait_for_link_up $master
+                assert_equal 2 [status $slave1 sync_partial_ok]
+                assert_equal 0 [status $slave1 sync_full]
+            }
+
+            test {PSYNC2: Writes after the failover reach every slave} {
+                $slave1 select 10
+                $slave1 incr counter
+                $slave1 select 9
+                $slave1 del key:0
+                wait_for_same_offset $slave1 $master
+                wait_for_same_offset $slave1 $slave2
+                assert_equal [$slave1 debug digest] [$master debug digest]
+                assert_equal [$slave1 debug digest] [$slave2 debug digest]
+            }
+
+            test {PSYNC2: A slave restarted from its RDB file partially resyncs} {
+                $slave2 save
+                set dir [tmpdir psync2]
+                file copy [lindex [$slave2 config get dir] 1]/dump.rdb $dir
+                set partial [status $slave1 sync_partial_ok]
+                # Writes the restarted slave will get from the backlog.
+                $slave1 select 10
+                $slave1 incr counter
+                start_server [list overrides [list dir $dir \
+                        slaveof "$slave1_host $slave1_port"]] {
+                    wait_for_link_up r
+                    assert_equal [expr {$partial+1}] \
+                                 [status $slave1 sync_partial_ok]
+                    wait_for_same_offset $slave1 r
+                    assert_equal [$slave1 debug digest] [r debug digest]
+                    r select 10
+                    assert_equal 2 [r get counter]
+                }
+            }
+
+            test {PSYNC2: A master restarted from its RDB file accepts PSYNC} {
+                $slave1 save
+                set dir [tmpdir psync2]
+                file copy [lindex [$slave1 config get dir] 1]/dump.rdb $dir
+                set digest [$slave1 debug digest]
+                start_server [list overrides [list dir $dir]] {
+                    set newmaster_host [srv 0 host]
+                    set newmaster_port [srv 0 port]
+                    assert_equal [status $slave1 master_replid] \
+                                 [status r master_replid2]
+                    $slave2 slaveof $newmaster_host $newmaster_port
+                    wait_for_link_up $slave2
+                    assert_equal 1 [status r sync_partial_ok]
+                    assert_equal 0 [status r sync_full]
+                    r select 9
+                    r set afterrestart 1
+                    wait_for_same_offset r $slave2
+                    assert_equal [r debug digest] [$slave2 debug digest]
+                    $slave2 slaveof no one
+                }
+            }
+        }
+    }
+}
@@ -266,3 +266,112 @@ foreach dl {no yes} {
         }
     }
 }
+
+foreach mdl {no yes} {
+    foreach sdl {on-empty-db swapdb} {
+        start_server {tags {"repl"}} {
+            set master [srv 0 client]
+            $master config set repl-diskless-sync $mdl
+            $master config set repl-diskless-sync-delay 1
+            set master_host [srv 0 host]
+            set master_port [srv 0 port]
+            $master debug populate 100000
+            $master set myvolatile x ex 1000
+            start_server {} {
+                set slave [srv 0 client]
+                set slave_log [srv 0 stdout]
+                $slave config set repl-diskless-load $sdl
+                $slave set oldkey oldvalue
+                test "Slave loads the payload, master diskless=$mdl, repl-diskless-load=$sdl" {
+                    $slave slaveof $master_host $master_port
+                    wait_for_condition 50 100 {
+                        [lindex [$slave role] 3] eq {connected}
+                    } else {
+                        fail "Slave still not connected after some time"
+                    }
+                    assert_equal [$master debug digest] [$slave debug digest]
+                    assert_equal {} [$slave get oldkey]
+                    assert {[$slave ttl myvolatile] > 900}
+                    $master set newkey newvalue
+                    wait_for_condition 50 100 {
+                        [$slave get newkey] eq {newvalue}
+                    } else {
+                        fail "Replication stream not applied after the sync"
+                    }
+                    # With on-empty-db the slave had a key, so the payload
+                    # is saved to disk first.
+                    if {$sdl eq {swapdb}} {
+                        assert_match {*serving the old data set*} [exec cat $slave_log]
+                    } else {
+                        assert_match {*Loading DB in memory*} [exec cat $slave_log]
+                    }
+                }
+
+                if {$sdl eq {on-empty-db}} {
+                    test "Slave with an empty data set loads from the socket, master diskless=$mdl" {
+                        $slave slaveof no one
+                        $slave flushall
+                        $slave slaveof $master_host $master_port
+                        wait_for_condition 50 100 {
+                            [lindex [$slave role] 3] eq {connected}
+                        } else {
+                            fail "Slave still not connected after some time"
+                        }
+                        assert_equal [$master debug digest] [$slave debug digest]
+                        assert_match {*Loading DB from the socket*} [exec cat $slave_log]
+                    }
+                }
+            }
+        }
+    }
+}
+
+start_server {tags {"repl"}} {
+    set master [srv 0 client]
+    set master_host [srv 0 host]
+    set master_port [srv 0 port]
+    $master config set repl-diskless-sync no
+    # Big enough for the transfer to last while the test inspects the slave.
+    $master debug populate 2000000
+    start_server {} {
+        set slave [srv 0 client]
+        set slave_log [srv 0 stdout]
+        $slave config set repl-diskless-load swapdb
+        $slave debug populate 1000 old
+        $slave set oldkey oldvalue
+
+        test "Slave keeps serving the old data set if the master link drops while loading" {
+            # Saving the payload can take a while on a busy host.
+            $slave slaveof $master_host $master_port
+            wait_for_condition 6000 10 {
+                [status $slave async_loading] == 1
+            } else {
+                fail "Slave never started to load the payload asynchronously"
+            }
+            # The old data set is readable while the payload is loaded.
+            assert_equal oldvalue [$slave get oldkey]
+            assert_equal 1001 [$slave dbsize]
+
+            # Drop the link in the middle of the transfer.
+            $master client kill type slave
+            wait_for_condition 50 100 {
+                [string match {*the old one is retained*} [exec cat $slave_log]]
+            } else {
+                fail "The slave did not discard the partially loaded data set"
+            }
+            # Until the next synchronization succeeds the old data set is
+            # what the slave serves, the partial one was dropped.
+            assert_equal oldvalue [$slave get oldkey]
+            assert_equal 1001 [$slave dbsize]
+            assert_equal value:999 [$slave get old:999]
+
+            # The slave reconnects and eventually loads the payload.
+            wait_for_condition 600 100 {
+                [lindex [$slave role] 3] eq {connected}
+            } else {
+                fail "Slave not connected after the link was dropped"
+            }
+            assert_equal [$master debug digest] [$slave debug digest]
+        }
+    }
+}
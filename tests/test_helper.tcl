@@ -31,12 +31,15 @@ set ::all_tests {
     unit/other
     unit/multi
     unit/quit
+    unit/threaded-io
+    unit/lazyfree
     unit/aofrw
     integration/replication
     integration/replication-2
     integration/replication-3
     integration/replication-4
     integration/replication-psync
+    integration/replication-psync2
     integration/aof
     integration/rdb
     integration/convert-zipmap-hash-on-load
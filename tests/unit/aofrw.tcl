@@ -103,9 +103,14 @@ start_server {tags {"aofrw"}} {
     }
 
     foreach d {string int} {
-        foreach e {intset hashtable} {
+        foreach e {intset hashtable roaring} {
             test "AOF rewrite of set with $e encoding, $d data" {
                 r flushall
+                if {$e eq {roaring}} {
+                    r config set set-large-encoding roaring
+                } else {
+                    r config set set-large-encoding hashtable
+                }
                 if {$e eq {intset}} {set len 10} else {set len 1000}
                 for {set j 0} {$j < $len} {incr j} {
                     if {$d eq {string}} {
@@ -130,11 +135,13 @@ start_server {tags {"aofrw"}} {
         }
     }
 
+    r config set set-large-encoding hashtable
+
     foreach d {string int} {
-        foreach e {ziplist hashtable} {
+        foreach e {listpack hashtable} {
             test "AOF rewrite of hash with $e encoding, $d data" {
                 r flushall
-                if {$e eq {ziplist}} {set len 10} else {set len 1000}
+                if {$e eq {listpack}} {set len 10} else {set len 1000}
                 for {set j 0} {$j < $len} {incr j} {
                     if {$d eq {string}} {
                         set data [randstring 0 16 alpha]
@@ -157,10 +164,15 @@ start_server {tags {"aofrw"}} {
     }
 
     foreach d {string int} {
-        foreach e {ziplist skiplist} {
+        foreach e {listpack skiplist btree} {
             test "AOF rewrite of zset with $e encoding, $d data" {
                 r flushall
-                if {$e eq {ziplist}} {set len 10} else {set len 1000}
+                if {$e eq {btree}} {
+                    r config set zset-large-encoding btree
+                } else {
+                    r config set zset-large-encoding skiplist
+                }
+                if {$e eq {listpack}} {set len 10} else {set len 1000}
                 for {set j 0} {$j < $len} {incr j} {
                     if {$d eq {string}} {
                         set data [randstring 0 16 alpha]
@@ -181,6 +193,7 @@ start_server {tags {"aofrw"}} {
             }
         }
     }
+    r config set zset-large-encoding skiplist
 
     test {BGREWRITEAOF is delayed if BGSAVE is in progress} {
         r multi
@@ -53,6 +53,33 @@ start_server {tags {"dump"}} {
         r dump nonexisting_key
     } {}
 
+    test {DUMP uses the RDB types of this fork for listpacks} {
+        r del smallhash smallzset
+        r hset smallhash field value
+        r zadd smallzset 1 member
+        assert_encoding listpack smallhash
+        assert_encoding listpack smallzset
+        # The first byte of the payload is the RDB type.
+        set types {}
+        foreach key {smallhash smallzset} {
+            scan [string index [r dump $key] 0] %c type
+            lappend types $type
+        }
+        set types
+    } {200 201}
+
+    test {DUMP uses the RDB type of this fork for roaring sets} {
+        r config set set-large-encoding roaring
+        r del bigset
+        for {set j 0} {$j < 1000} {incr j} {
+            r sadd bigset [expr {$j*7}]
+        }
+        assert_encoding roaring bigset
+        scan [string index [r dump bigset] 0] %c type
+        r config set set-large-encoding hashtable
+        set type
+    } {202}
+
     test {MIGRATE is caching connections} {
         # Note, we run this as first test so that the connection cache
         # is empty.
@@ -219,4 +219,161 @@ start_server {tags {"expire"}} {
         set ttl [r ttl foo]
         assert {$ttl <= 98 && $ttl > 90}
     }
+
+    test {active-expire-effort is validated} {
+        catch {r config set active-expire-effort 0} e
+        assert_match {*Invalid*} $e
+        catch {r config set active-expire-effort 11} e
+        assert_match {*Invalid*} $e
+        r config set active-expire-effort 10
+        assert_equal {active-expire-effort 10} [r config get active-expire-effort]
+        r config set active-expire-effort 1
+    }
+
+    test {The active expire cycle estimates and removes the stale keys} {
+        r config set appendonly no
+        r flushall
+        r config resetstat
+        r debug set-active-expire 0
+        for {set j 0} {$j < 1000} {incr j} {
+            r psetex stale:$j 1 x
+            r setex live:$j 1000 x
+        }
+        after 50
+        assert_equal 1000 [llength [r keys live:*]]
+        r debug set-active-expire 1
+        r config set active-expire-effort 10
+        # With the max effort the cycle keeps working until less than 1%
+        # of the sampled keys are stale, so only a few stale keys remain.
+        wait_for_condition 50 100 {
+            [r dbsize] < 1050
+        } else {
+            fail "Stale keys were not actively expired"
+        }
+        assert_match {*db9:keys=*,avg_ttl=*,stale_keys=*} [r info keyspace]
+        r config set active-expire-effort 1
+    }
+
+    test {INFO reports the keys removed by the active expire cycle} {
+        r flushall
+        r debug set-active-expire 0
+        r config resetstat
+        for {set j 0} {$j < 100} {incr j} {
+            r psetex stale:$j 1 x
+        }
+        for {set j 0} {$j < 10} {incr j} {
+            r set live:$j x
+        }
+        after 50
+        # Nothing was expired yet, and the cycle never ran.
+        assert_equal 0 [s expired_keys]
+        assert_equal 0 [s expire_cycle_cpu_milliseconds]
+        assert_equal 0 [s expired_time_cap_reached_count]
+        assert_match {*db9:keys=110,expires=100,*} [r info keyspace]
+        r debug set-active-expire 1
+        wait_for_condition 50 100 {
+            [r dbsize] == 10
+        } else {
+            fail "Stale keys were not actively expired"
+        }
+        # All the sampled keys were stale, so the cycle removed every one
+        # of them without reaching its time limit.
+        assert_equal 100 [s expired_keys]
+        assert_equal 0 [s expired_time_cap_reached_count]
+        assert_equal 0.00 [s expired_stale_perc]
+        assert_match {*db9:keys=10,expires=0,avg_ttl=0,stale_keys=0*} \
+            [r info keyspace]
+    }
+}
+
+start_server {tags {"expire"} overrides {expire-index no}} {
+    test {EXPIRING requires the expire index} {
+        catch {r expiring 10} e
+        set e
+    } {*expire index is disabled*}
+}
+
+start_server {tags {"expire"} overrides {expire-index yes}} {
+    test {EXPIRING counts and lists the keys expiring within N seconds} {
+        r flushdb
+        for {set j 1} {$j <= 10} {incr j} {
+            r setex key:$j [expr {$j*100}] x
+        }
+        r set persistent x
+        assert_equal 0 [r expiring 50]
+        assert_equal 3 [r expiring 350]
+        assert_equal 10 [r expiring 5000]
+        assert_equal {key:1 key:2 key:3} [r expiring 5000 limit 3]
+        assert_equal {} [r expiring 5000 limit 0]
+        assert_equal 10 [r expiring 9223372036854775807]
+        assert_equal 0 [r expiring -9223372036854775808]
+        catch {r expiring 10 limit -1} e
+        assert_match {*negative*} $e
+        catch {r expiring 10 foo 1} e
+        assert_match {*syntax*} $e
+    }
+
+    test {The expire index follows EXPIRE, PERSIST, SET, DEL and RENAME} {
+        r expire key:10 1
+        assert_equal {key:10 key:1} [r expiring 5000 limit 2]
+        r persist key:10
+        r set key:1 y
+        r del key:2
+        assert_equal {key:3} [r expiring 5000 limit 1]
+        assert_equal 7 [r expiring 5000]
+        r rename key:3 newkey
+        assert_equal {newkey key:4} [r expiring 5000 limit 2]
+        r move newkey 10
+        assert_equal 6 [r expiring 5000]
+        r select 10
+        assert_equal {newkey} [r expiring 5000 limit 10]
+        r flushdb async
+        assert_equal 0 [r expiring 5000]
+        r select 9
+        r flushall
+        assert_equal 0 [r expiring 5000]
+    }
+
+    test {The expire index follows UNLINK} {
+        r flushall
+        r set foo bar px 100
+        for {set j 0} {$j < 100} {incr j} {r sadd bigset $j}
+        r expire bigset 100
+        assert_equal {foo bigset} [r expiring 5000 limit 10]
+        r unlink foo bigset
+        assert_equal {} [r expiring 5000 limit 10]
+        r set other v ex 1000
+        after 200
+        assert_equal {other} [r expiring 5000 limit 10]
+        assert_equal PONG [r ping]
+        r flushall
+    }
+
+    test {The expire index survives a reload} {
+        for {set j 1} {$j <= 100} {incr j} {
+            r setex key:$j [expr {1000+$j}] x
+        }
+        r debug reload
+        assert_equal 100 [r expiring 5000]
+        assert_equal {key:1 key:2} [r expiring 5000 limit 2]
+    }
+
+    test {With the expire index all the stale keys are actively expired} {
+        r flushall
+        r debug set-active-expire 0
+        for {set j 0} {$j < 1000} {incr j} {
+            r psetex stale:$j 1 x
+            r setex live:$j 1000 x
+        }
+        after 50
+        assert_equal 1000 [r expiring 0]
+        r debug set-active-expire 1
+        wait_for_condition 50 100 {
+            [r dbsize] == 1000
+        } else {
+            fail "Stale keys were not actively expired"
+        }
+        assert_equal 0 [r expiring 0]
+        assert_match {*db9:keys=1000,expires=1000,*,stale_keys=0*} [r info keyspace]
+    }
 }
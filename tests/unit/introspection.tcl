@@ -56,4 +56,37 @@ start_server {tags {"introspection"}} {
             fail "Client still listed in CLIENT LIST after SETNAME."
         }
     }
+
+    test {Idle clients give their buffers back to the pool} {
+        set before [s client_buffers_memory]
+        set clients {}
+        for {set j 0} {$j < 20} {incr j} {
+            set rd [redis_deferring_client]
+            $rd ping
+            assert_equal PONG [$rd read]
+            lappend clients $rd
+        }
+        assert {[s client_buffers_memory] >= $before+20*16384}
+        # Clients idle for more than 2 seconds release both buffers.
+        wait_for_condition 100 100 {
+            [s client_buffers_memory] <= $before
+        } else {
+            fail "Idle clients still hold their buffers"
+        }
+        assert {[s client_buffers_pool_memory] > 0}
+        # The pooled buffers nobody takes are freed after a while.
+        wait_for_condition 50 100 {
+            [s client_buffers_pool_memory] == 0
+        } else {
+            fail "Unused buffers still in the pool"
+        }
+        # Buffers are allocated again on demand.
+        foreach rd $clients {
+            $rd set foo bar
+            assert_equal OK [$rd read]
+            $rd get foo
+            assert_equal bar [$rd read]
+            $rd close
+        }
+    }
 }
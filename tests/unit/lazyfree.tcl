@@ -0,0 +1,68 @@
+start_server {tags {"lazyfree"}} {
+    test "UNLINK can reclaim memory in background" {
+        set orig_mem [s used_memory]
+        set args {}
+        for {set i 0} {$i < 100000} {incr i} {
+            lappend args $i
+        }
+        r sadd myset {*}$args
+        assert {[r scard myset] == 100000}
+        set peak_mem [s used_memory]
+        assert {[r unlink myset] == 1}
+        assert {$peak_mem > $orig_mem+1000000}
+        wait_for_condition 50 100 {
+            [s used_memory] < $peak_mem &&
+            [s used_memory] < $orig_mem*2
+        } else {
+            fail "Memory is not reclaimed by UNLINK"
+        }
+    }
+
+    test "UNLINK against small values and missing keys" {
+        r set foo bar
+        r sadd smallset a b c
+        assert_equal 2 [r unlink foo smallset nokey]
+        assert_equal 0 [r exists foo smallset]
+    }
+
+    test "FLUSHDB ASYNC can reclaim memory in background" {
+        set orig_mem [s used_memory]
+        set args {}
+        for {set i 0} {$i < 100000} {incr i} {
+            lappend args $i
+        }
+        r sadd myset {*}$args
+        assert {[r scard myset] == 100000}
+        set peak_mem [s used_memory]
+        r flushdb async
+        assert {$peak_mem > $orig_mem+1000000}
+        assert_equal 0 [r dbsize]
+        wait_for_condition 50 100 {
+            [s used_memory] < $peak_mem &&
+            [s used_memory] < $orig_mem*2
+        } else {
+            fail "Memory is not reclaimed by FLUSHDB ASYNC"
+        }
+        wait_for_condition 50 100 {
+            [s lazyfree_pending_objects] == 0
+        } else {
+            fail "Pending lazy free objects never reached zero"
+        }
+    }
+
+    test "FLUSHALL ASYNC empties all the databases" {
+        r select 9
+        r set foo bar
+        r select 10
+        r set foo bar
+        r flushall async
+        assert_equal 0 [r dbsize]
+        r select 9
+        assert_equal 0 [r dbsize]
+    }
+
+    test "FLUSHDB / FLUSHALL with wrong options" {
+        assert_error "*syntax*" {r flushdb foo}
+        assert_error "*syntax*" {r flushall async async}
+    }
+}
@@ -23,8 +23,20 @@ start_server {tags {"maxmemory"}} {
         r config set maxmemory 0
     }
 
+    test "With maxmemory and LFU policy integers are not shared" {
+        r config set maxmemory 1073741824
+        r config set maxmemory-policy allkeys-lfu
+        r set a 1
+        r config set maxmemory-policy volatile-lfu
+        r set b 1
+        assert {[r object refcount a] == 1}
+        assert {[r object refcount b] == 1}
+        r config set maxmemory 0
+    }
+
     foreach policy {
-        allkeys-random allkeys-lru volatile-lru volatile-random volatile-ttl
+        allkeys-random allkeys-lru allkeys-lfu volatile-lru volatile-lfu
+        volatile-random volatile-ttl
     } {
         test "maxmemory - is the memory limit honoured? (policy $policy)" {
             # make sure to start with a blank instance
@@ -56,7 +68,8 @@ start_server {tags {"maxmemory"}} {
     }
 
     foreach policy {
-        allkeys-random allkeys-lru volatile-lru volatile-random volatile-ttl
+        allkeys-random allkeys-lru allkeys-lfu volatile-lru volatile-lfu
+        volatile-random volatile-ttl
     } {
         test "maxmemory - only allkeys-* should remove non-volatile keys ($policy)" {
             # make sure to start with a blank instance
@@ -98,7 +111,7 @@ start_server {tags {"maxmemory"}} {
     }
 
     foreach policy {
-        volatile-lru volatile-random volatile-ttl
+        volatile-lru volatile-lfu volatile-random volatile-ttl
     } {
         test "maxmemory - policy $policy should only remove volatile keys." {
             # make sure to start with a blank instance
@@ -142,3 +155,155 @@ start_server {tags {"maxmemory"}} {
         }
     }
 }
+
+start_server {tags {"maxmemory"}} {
+    test "OBJECT FREQ requires an LFU policy" {
+        r set foo bar
+        catch {r object freq foo} e
+        assert_match {*LFU maxmemory policy is not selected*} $e
+        r config set maxmemory-policy allkeys-lfu
+        catch {r object idletime foo} e
+        assert_match {*LFU maxmemory policy is selected*} $e
+        r config set maxmemory-policy noeviction
+    }
+
+    test "OBJECT FREQ grows logarithmically with accesses" {
+        r config set maxmemory-policy allkeys-lfu
+        r config set lfu-log-factor 0
+        r set foo bar
+        assert_equal 5 [r object freq foo]
+        for {set j 0} {$j < 10} {incr j} {r get foo}
+        assert_equal 15 [r object freq foo]
+        for {set j 0} {$j < 300} {incr j} {r get foo}
+        assert_equal 255 [r object freq foo]
+        r config set lfu-log-factor 10
+        r set bar foo
+        for {set j 0} {$j < 1000} {incr j} {r get bar}
+        set freq [r object freq bar]
+        assert {$freq > 5 && $freq < 50}
+        r config set maxmemory-policy noeviction
+    }
+
+    test "maxmemory - allkeys-lfu keeps the frequently accessed keys" {
+        r flushall
+        r config set maxmemory-policy allkeys-lfu
+        r config set lfu-log-factor 10
+        r config set maxmemory-samples 10
+        # A small set of hot keys, accessed many times.
+        for {set j 0} {$j < 20} {incr j} {
+            r set hot:$j [string repeat x 100]
+            for {set i 0} {$i < 100} {incr i} {r get hot:$j}
+        }
+        set used [s used_memory]
+        set limit [expr {$used+100*1024}]
+        r config set maxmemory $limit
+        # Fill the memory with keys written once and never read.
+        for {set j 0} {$j < 5000} {incr j} {
+            r set cold:$j [string repeat x 100]
+        }
+        assert {[s used_memory] < ($limit+4096)}
+        assert {[s evicted_keys] > 0}
+        for {set j 0} {$j < 20} {incr j} {
+            assert {[r exists hot:$j]}
+        }
+        r config set maxmemory 0
+        r config set maxmemory-samples 5
+    }
+}
+
+start_server {tags {"maxmemory"}} {
+    test "maxmemory - the eviction pool is shared by all the databases" {
+        r flushall
+        r config resetstat
+        r config set maxmemory-policy allkeys-lru
+        set empty [s used_memory]
+        foreach db {9 10} {
+            r select $db
+            r debug populate 5000 db$db
+        }
+        set used [s used_memory]
+        # Evict more than half of the keys: the keys of db 9 may all be
+        # older than the ones of db 10 if populating takes long.
+        r config set maxmemory [expr {$used-($used-$empty)*6/10}]
+        wait_for_condition 50 100 {
+            [s used_memory] < [lindex [r config get maxmemory] 1]+4096
+        } else {
+            fail "Eviction did not reach the memory limit"
+        }
+        # Both the databases have keys evicted.
+        r select 10
+        assert {[r dbsize] < 5000}
+        r select 9
+        assert {[r dbsize] < 5000}
+        assert {[s evicted_keys] > 0}
+        assert {[s eviction_time_usec] > 0}
+        assert {[s eviction_samples_per_key] >= 1}
+        r config set maxmemory 0
+        r flushall
+    }
+
+    test "maxmemory - big evictions continue incrementally in serverCron" {
+        r flushall
+        r config set maxmemory-policy allkeys-random
+        r debug populate 300000
+        set used [s used_memory]
+        set limit [expr {$used/4}]
+        # Evicting most of the dataset takes well over the time limit of
+        # a single call, the rest is evicted by serverCron.
+        r config set maxmemory $limit
+        wait_for_condition 100 100 {
+            [s used_memory] < $limit+4096
+        } else {
+            fail "Eviction did not continue in serverCron"
+        }
+        assert {[r dbsize] < 300000}
+        assert {[s instantaneous_evictions_per_sec] > 0}
+        r config set maxmemory 0
+    }
+}
+
+start_server {tags {"maxmemory repl"}} {
+    start_server {} {
+        start_server {} {
+            set master [srv 0 client]
+            set master_host [srv 0 host]
+            set master_port [srv 0 port]
+            set slaves [list [srv -1 client] [srv -2 client]]
+            set pids [list [srv -1 pid] [srv -2 pid]]
+
+            foreach slave $slaves {
+                $slave slaveof $master_host $master_port
+            }
+            wait_for_condition 50 100 {
+                [string match {*slave1:*state=online*} [$master info replication]]
+            } else {
+                fail "Slaves didn't connect"
+            }
+
+            test "maxmemory - replication blocks shared by slaves count once" {
+                # Stop the slaves so that the replication stream builds up in
+                # their output buffers, as blocks shared by both of them.
+                foreach pid $pids {exec kill -STOP $pid}
+                $master config set maxmemory-policy allkeys-random
+                $master config set maxmemory [expr {[s used_memory]+5*1024*1024}]
+                set val [string repeat x 10000]
+                set rd [redis_deferring_client]
+                for {set j 0} {$j < 2000} {incr j} {
+                    $rd set key:$j $val
+                }
+                for {set j 0} {$j < 2000} {incr j} {
+                    $rd read
+                }
+                $rd close
+                # Subtracting the blocks once per slave would hide the
+                # dataset growth from the eviction.
+                set evicted [s evicted_keys]
+                set dbsize [$master dbsize]
+                foreach pid $pids {exec kill -CONT $pid}
+                $master config set maxmemory 0
+                assert {$evicted > 0}
+                assert {$dbsize < 2000}
+            }
+        }
+    }
+}
@@ -35,3 +35,42 @@ start_server {tags {"memefficiency"}} {
         }
     }
 }
+
+proc used_memory_per_key {count} {
+    r flushall
+    set base_mem [s used_memory]
+    r debug populate $count
+    expr {double([s used_memory]-$base_mem)/$count}
+}
+
+set per_key {}
+set flat_keyspace 0
+foreach embedded {yes no} {
+    start_server [list tags {"memefficiency"} overrides [list embedded-keys $embedded]] {
+        test "Memory used by small keys with embedded-keys $embedded" {
+            r set foo bar
+            if {[string match {*flat*} [r debug htstats 9]]} {
+                # Flat tables (make USE_FLAT_KEYSPACE=yes) ignore the option.
+                set flat_keyspace 1
+                assert_equal no [lindex [r config get embedded-keys] 1]
+            } else {
+                assert_equal $embedded [lindex [r config get embedded-keys] 1]
+            }
+            set bytes [used_memory_per_key 100000]
+            if {$::verbose} {puts "Bytes per key (embedded-keys $embedded): $bytes"}
+            lappend per_key $bytes
+            assert_equal value:99999 [r get key:99999]
+            r del key:99999
+            assert_equal {} [r get key:99999]
+            r debug reload
+            assert_equal 99999 [r dbsize]
+            assert_equal value:12345 [r get key:12345]
+        }
+    }
+}
+
+if {!$flat_keyspace} {
+    test {Embedded keys use less memory than separately allocated keys} {
+        assert {[lindex $per_key 0] < [lindex $per_key 1]}
+    }
+}
@@ -82,6 +82,14 @@ start_server {tags {"other"}} {
                 }
             } {1}
 
+            test {Same dataset digest after a multi threaded reload} {
+                r config set rdb-load-threads 4
+                r debug reload
+                set sha1_after [r debug digest]
+                r config set rdb-load-threads 1
+                assert_equal $sha1 $sha1_after
+            }
+
             test {Same dataset digest if saving/reloading as AOF?} {
                 r bgrewriteaof
                 waitForBgrewriteaof r
@@ -123,6 +131,31 @@ start_server {tags {"other"}} {
         list $e1 $e2
     } {1 1}
 
+    test {Multi threaded reload preserves expires, databases and encodings} {
+        r flushall
+        r config set rdb-load-threads 3
+        r set x 10
+        r expire x 1000
+        r set bigstr [string repeat abcd 10000]
+        r rpush biglist {*}[lrepeat 1000 [string repeat x 100]]
+        r zadd smallzset 1.5 a 2 b
+        r select 10
+        r set y 20
+        r select 9
+        r debug populate 10000
+        set sha1 [r debug digest]
+        r debug reload
+        set ttl [r ttl x]
+        assert {$ttl > 900 && $ttl <= 1000}
+        assert_equal $sha1 [r debug digest]
+        assert_encoding listpack smallzset
+        r select 10
+        assert_equal 20 [r get y]
+        r select 9
+        r config set rdb-load-threads 1
+        r flushall
+    } {OK}
+
     test {EXPIRES after AOF reload (without rewrite)} {
         r flushdb
         r config set appendonly yes
@@ -244,3 +277,112 @@ start_server {tags {"other"}} {
         r save
     } {OK}
 }
+
+start_server {tags {"other"}} {
+    test {Big chunked hash tables are consistent while rehashing} {
+        r config set activerehashing no
+        r debug populate 200000
+        assert_equal 200000 [r dbsize]
+        set cur 0
+        set keys {}
+        while 1 {
+            set res [r scan $cur count 1000]
+            set cur [lindex $res 0]
+            lappend keys {*}[lindex $res 1]
+            if {$cur == 0} break
+        }
+        assert_equal 200000 [llength [lsort -unique $keys]]
+        for {set j 0} {$j < 1000} {incr j} {
+            set id [randomInt 200000]
+            assert_equal value:$id [r get key:$id]
+        }
+    }
+
+    test {INFO rehash reports the rehashing progress} {
+        r flushdb
+        r set foo bar
+        if {[string match {*flat*} [r debug htstats 9]]} {
+            # Flat tables (make USE_FLAT_KEYSPACE=yes) have 5 keys per bucket.
+            set keys 81920
+            set sizes {16384 32768}
+        } else {
+            # Fill a table of 65536 buckets, the next insertion starts the
+            # rehashing to a chunked table.
+            set keys 65536
+            set sizes {65536 131072}
+        }
+        r flushdb
+        r debug populate $keys
+        r set foo bar
+        assert_match {*rehashing_dicts:1*} [r info rehash]
+        assert_match "*db9:dict=main,from_size=[lindex $sizes 0],to_size=[lindex $sizes 1],*" \
+            [r info rehash]
+        r config set activerehashing yes
+        wait_for_condition 50 100 {
+            [string match {*rehashing_dicts:0*} [r info rehash]]
+        } else {
+            fail "Active rehashing never completed"
+        }
+        assert_equal [expr {$keys+1}] [r dbsize]
+        assert_equal value:[expr {$keys-1}] [r get key:[expr {$keys-1}]]
+    }
+}
+
+start_server {tags {"other"}} {
+    test {Forkless BGSAVE saves the data set as it was when it started} {
+        r config set rdb-forkless-save yes
+        r debug populate 20000
+        r rpush mylist a b c
+        r hset myhash f v
+        r set myvolatile x ex 1000
+        set digest [r debug digest]
+        # In the transaction the keys are modified before the scan of the
+        # snapshot can make progress, so most of them must be preserved.
+        r multi
+        r bgsave
+        for {set j 0} {$j < 1000} {incr j} {
+            r set key:[expr {$j*20}] changed
+            r set newkey:$j new
+        }
+        r del key:19999
+        r rpush mylist d
+        r hset myhash f2 v2
+        r persist myvolatile
+        r exec
+        r set key:1 changed
+        waitForBgsave r
+        assert_equal ok [status r rdb_last_bgsave_status]
+        assert {[status r rdb_forkless_preserved_keys] > 0}
+        set dir [tmpdir forkless]
+        file copy [lindex [r config get dir] 1]/dump.rdb $dir
+        start_server [list overrides [list dir $dir]] {
+            assert_equal $digest [r debug digest]
+            assert_equal {a b c} [r lrange mylist 0 -1]
+            assert_equal v [r hget myhash f]
+            assert {[r ttl myvolatile] > 900}
+        }
+    }
+
+    test {FLUSHDB and FLUSHALL while a forkless BGSAVE is in progress} {
+        r flushall
+        r debug populate 100000
+        r select 10
+        r debug populate 1000
+        r select 9
+        r bgsave
+        r flushdb
+        assert_equal 0 [r dbsize]
+        waitForBgsave r
+        assert_equal ok [status r rdb_last_bgsave_status]
+        r debug populate 100000
+        r bgsave
+        r flushall
+        assert_equal 0 [status r rdb_bgsave_in_progress]
+        r set x 10
+        r bgsave
+        waitForBgsave r
+        r debug reload
+        r config set rdb-forkless-save no
+        r get x
+    } {10}
+}
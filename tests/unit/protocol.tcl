@@ -68,6 +68,33 @@ start_server {tags {"protocol"}} {
         assert_error "*unbalanced*" {r read}
     }
 
+    test "Deep pipeline of mixed inline and multibulk commands" {
+        reconnect
+        r del pipelist
+        set big [string repeat x 100000]
+        set proto {}
+        for {set j 0} {$j < 5000} {incr j} {
+            switch [expr {$j % 4}] {
+                0 {append proto "*3\r\n\$5\r\nRPUSH\r\n\$8\r\npipelist\r\n\$[string length $j]\r\n$j\r\n"}
+                1 {append proto "RPUSH pipelist $j\r\n"}
+                2 {append proto "RPUSH pipelist $j\n"}
+                3 {append proto "*3\r\n\$5\r\nRPUSH\r\n\$8\r\npipelist\r\n\$[string length $j]\r\n$j\r\n"}
+            }
+            if {$j == 2500} {
+                append proto "*3\r\n\$3\r\nSET\r\n\$7\r\npipebig\r\n\$[string length $big]\r\n$big\r\n"
+            }
+        }
+        r write $proto
+        r flush
+        for {set j 0} {$j < 5000} {incr j} {
+            assert_equal [expr {$j+1}] [r read]
+            if {$j == 2500} {assert_equal OK [r read]}
+        }
+        assert_equal {0 1 2 3 4} [r lrange pipelist 0 4]
+        assert_equal 4999 [r lindex pipelist -1]
+        assert_equal $big [r get pipebig]
+    }
+
     set c 0
     foreach seq [list "\x00" "*\x00" "$\x00"] {
         incr c
@@ -115,3 +142,43 @@ start_server {tags {"regression"}} {
         $rd read
     }
 }
+
+start_server {tags {"protocol"}} {
+    test "Replies made of many objects are sent with few write calls" {
+        set val [string repeat x 20000]
+        set keys {}
+        for {set j 0} {$j < 100} {incr j} {
+            r set big:$j $val
+            lappend keys big:$j
+        }
+        r config resetstat
+        set res [r mget {*}$keys]
+        assert_equal 100 [llength $res]
+        assert_equal $val [lindex $res 99]
+        # Every value is a different object of the reply list, with the bulk
+        # length in between: one write per object would need 200 calls.
+        assert {[s reply_write_syscalls] < 100}
+        assert {[s reply_write_syscalls_per_kb] > 0}
+    }
+
+    test "Partially written replies are resumed from the right offset" {
+        r del mylist
+        for {set j 0} {$j < 2000} {incr j} {
+            r rpush mylist [string repeat $j 300]
+        }
+        set rd [redis_deferring_client]
+        for {set j 0} {$j < 10} {incr j} {
+            $rd lrange mylist 0 -1
+            $rd mget {*}[lrange $keys 0 9]
+        }
+        # Let the output buffers fill the socket before reading.
+        after 200
+        for {set j 0} {$j < 10} {incr j} {
+            set l [$rd read]
+            assert_equal 2000 [llength $l]
+            assert_equal [string repeat 1999 300] [lindex $l 1999]
+            assert_equal $val [lindex [$rd read] 9]
+        }
+        $rd close
+    }
+}
@@ -103,6 +103,26 @@ start_server {tags {"pubsub"}} {
         $rd2 close
     }
 
+    test "PUBLISH/SUBSCRIBE of big messages shared by many clients" {
+        set clients {}
+        for {set j 0} {$j < 10} {incr j} {
+            set rd [redis_deferring_client]
+            subscribe $rd {chan1}
+            lappend clients $rd
+        }
+        set big1 [string repeat x 20000]
+        set big2 [string repeat y 3000]
+        assert_equal 10 [r publish chan1 $big1]
+        assert_equal 10 [r publish chan1 small]
+        assert_equal 10 [r publish chan1 $big2]
+        foreach rd $clients {
+            assert_equal [list message chan1 $big1] [$rd read]
+            assert_equal {message chan1 small} [$rd read]
+            assert_equal [list message chan1 $big2] [$rd read]
+            $rd close
+        }
+    }
+
     test "PUBLISH/SUBSCRIBE after UNSUBSCRIBE without arguments" {
         set rd1 [redis_deferring_client]
         assert_equal {1 2 3} [subscribe $rd1 {chan1 chan2 chan3}]
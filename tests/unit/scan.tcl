@@ -53,17 +53,23 @@ start_server {tags {"scan"}} {
         assert_equal 100 [llength $keys]
     }
 
-    foreach enc {intset hashtable} {
+    foreach enc {intset hashtable roaring} {
         test "SSCAN with encoding $enc" {
             # Create the Set
             r del set
-            if {$enc eq {intset}} {
+            if {$enc eq {hashtable}} {
+                set prefix "ele:"
+            } else {
                 set prefix ""
+            }
+            if {$enc eq {roaring}} {
+                r config set set-large-encoding roaring
+                set count 1000
             } else {
-                set prefix "ele:"
+                set count 100
             }
             set elements {}
-            for {set j 0} {$j < 100} {incr j} {
+            for {set j 0} {$j < $count} {incr j} {
                 lappend elements ${prefix}${j}
             }
             r sadd set {*}$elements
@@ -83,15 +89,16 @@ start_server {tags {"scan"}} {
             }
 
             set keys [lsort -unique $keys]
-            assert_equal 100 [llength $keys]
+            assert_equal $count [llength $keys]
         }
     }
+    r config set set-large-encoding hashtable
 
-    foreach enc {ziplist hashtable} {
+    foreach enc {listpack hashtable} {
         test "HSCAN with encoding $enc" {
             # Create the Hash
             r del hash
-            if {$enc eq {ziplist}} {
+            if {$enc eq {listpack}} {
                 set count 30
             } else {
                 set count 1000
@@ -127,11 +134,16 @@ start_server {tags {"scan"}} {
         }
     }
 
-    foreach enc {ziplist skiplist} {
+    foreach enc {listpack skiplist btree} {
         test "ZSCAN with encoding $enc" {
             # Create the Sorted Set
             r del zset
-            if {$enc eq {ziplist}} {
+            if {$enc eq {btree}} {
+                r config set zset-large-encoding btree
+            } else {
+                r config set zset-large-encoding skiplist
+            }
+            if {$enc eq {listpack}} {
                 set count 30
             } else {
                 set count 1000
@@ -166,6 +178,7 @@ start_server {tags {"scan"}} {
             assert_equal $count [llength $keys2]
         }
     }
+    r config set zset-large-encoding skiplist
 
     test "SCAN guarantees check under write load" {
         r flushdb
@@ -0,0 +1,70 @@
+start_server {tags {"threaded-io"} overrides {io-threads 4 io-threads-do-reads yes hz 1}} {
+    test {I/O threads configuration} {
+        assert_equal {io-threads 4} [r config get io-threads]
+        assert_equal {io-threads-do-reads yes} [r config get io-threads-do-reads]
+    }
+
+    test {Few clients are served by the main thread} {
+        r set foo bar
+        assert_equal bar [r get foo]
+        assert_equal 0 [s io_threads_active]
+    }
+
+    test {Pipelined commands from many clients with I/O threads} {
+        set numclients 32
+        set numcmds 100
+        for {set j 0} {$j < $numclients} {incr j} {
+            set rds($j) [redis_deferring_client]
+        }
+
+        # Clients are paused while the commands are sent, so that once the
+        # pause expires all the clients have pending replies in the same
+        # event loop iteration and the I/O threads are activated. With a low
+        # "hz" the threads are not stopped by serverCron() before the next
+        # query arrives, so it will be read by the threads. Loop until both
+        # reads and writes were handled by the threads at least once.
+        set rounds 0
+        while {[s io_threaded_writes_processed] == 0 ||
+               [s io_threaded_reads_processed] == 0} {
+            if {[incr rounds] > 50} {
+                fail "I/O threads never used"
+            }
+            r client pause 100
+            for {set j 0} {$j < $numclients} {incr j} {
+                for {set i 0} {$i < $numcmds} {incr i} {
+                    $rds($j) incr counter:$j
+                    $rds($j) set key:$j:$i [string repeat x 100]
+                    $rds($j) get key:$j:$i
+                }
+                $rds($j) flush
+            }
+            for {set j 0} {$j < $numclients} {incr j} {
+                for {set i 0} {$i < $numcmds} {incr i} {
+                    assert_equal [expr {($rounds-1)*$numcmds+$i+1}] \
+                        [$rds($j) read]
+                    assert_equal OK [$rds($j) read]
+                    assert_equal [string repeat x 100] [$rds($j) read]
+                }
+            }
+        }
+
+        for {set j 0} {$j < $numclients} {incr j} {
+            assert_equal [expr {$rounds*$numcmds}] [r get counter:$j]
+            $rds($j) close
+        }
+    }
+
+    test {Blocking commands work with I/O threads} {
+        r del mylist
+        set rd [redis_deferring_client]
+        $rd blpop mylist 0
+        wait_for_condition 50 100 {
+            [s blocked_clients] == 1
+        } else {
+            fail "Client not blocked"
+        }
+        r rpush mylist a
+        assert_equal {mylist a} [$rd read]
+        $rd close
+    }
+}
@@ -279,6 +279,240 @@ start_server {
         assert_equal 0 [r exists setres]
     }
 
+    test "SINTERCARD basics" {
+        r del set1 set2 set3
+        r sadd set1 a b c d e
+        r sadd set2 b c d e f
+        r sadd set3 c d e f g
+        assert_equal 3 [r sintercard 3 set1 set2 set3]
+        assert_equal 5 [r sintercard 1 set1]
+        assert_equal 2 [r sintercard 3 set1 set2 set3 limit 2]
+        assert_equal 3 [r sintercard 3 set1 set2 set3 LIMIT 10]
+        assert_equal 3 [r sintercard 3 set1 set2 set3 limit 0]
+        assert_equal 0 [r sintercard 3 set1 set2 nokey]
+    }
+
+    test "SINTERCARD errors" {
+        r del set1
+        r sadd set1 1 2 3
+        assert_error "*at least 1 input key*" {r sintercard 0 set1}
+        assert_error "*greater than number of args*" {r sintercard 2 set1}
+        assert_error "*can't be negative*" {r sintercard 1 set1 limit -1}
+        assert_error "*syntax*" {r sintercard 1 set1 foo 1}
+        assert_error "*syntax*" {r sintercard 1 set1 limit}
+        r set key1 x
+        assert_error "WRONGTYPE*" {r sintercard 2 set1 key1}
+    }
+
+    test "SINTER, SINTERSTORE and SINTERCARD of large intsets" {
+        r config set set-max-intset-entries 100000
+        for {set j 0} {$j < 20} {incr j} {
+            unset -nocomplain s
+            array set s {}
+            set args {}
+            set num_sets [expr {[randomInt 3]+2}]
+            for {set i 0} {$i < $num_sets} {incr i} {
+                # Sets of very different sizes, so that both the merge
+                # and the galloping lookups are used.
+                set range [expr {1 << ([randomInt 9]+8)}]
+                set num_elements [expr {[randomInt $range]+1}]
+                if {[randomInt 2]} {
+                    set base [expr {[randomInt 2] ? 100000 : 5000000000}]
+                } else {
+                    set base 0
+                }
+                set elements {}
+                for {set k 0} {$k < $num_elements} {incr k} {
+                    lappend elements [expr {$base+[randomInt $range]}]
+                }
+                r del set_$i
+                r sadd set_$i {*}$elements
+                assert_encoding intset set_$i
+                lappend args set_$i
+                unset -nocomplain t
+                array set t {}
+                foreach ele $elements {set t($ele) x}
+                if {$i == 0} {
+                    array set s [array get t]
+                } else {
+                    foreach ele [array names s] {
+                        if {![info exists t($ele)]} {unset s($ele)}
+                    }
+                }
+            }
+            set expected [lsort -integer [array names s]]
+            set card [llength $expected]
+            assert_equal $expected [lsort -integer [r sinter {*}$args]]
+            assert_equal $card [r sinterstore setres {*}$args]
+            assert_equal $expected [lsort -integer [r smembers setres]]
+            if {$card} {assert_encoding intset setres}
+            assert_equal $card [r sintercard $num_sets {*}$args]
+            set limit [randomInt [expr {$card+2}]]
+            set expected_card [expr {($limit && $limit < $card) ? $limit : $card}]
+            assert_equal $expected_card \
+                [r sintercard $num_sets {*}$args limit $limit]
+        }
+        r config set set-max-intset-entries 512
+    }
+
+    test "SINTERSTORE of intsets converts a big result to hashtable" {
+        r config set set-max-intset-entries 1000
+        r del set1 set2
+        for {set i 0} {$i < 600} {incr i} {
+            r sadd set1 $i
+            r sadd set2 $i
+        }
+        r config set set-max-intset-entries 512
+        assert_encoding intset set1
+        assert_equal 600 [r sinterstore setres set1 set2]
+        assert_encoding hashtable setres
+    }
+
+    test "SINTERCARD of hashtable sets with LIMIT" {
+        r del set1 set2
+        for {set i 0} {$i < 100} {incr i} {
+            r sadd set1 a$i
+            r sadd set2 a$i b$i
+        }
+        assert_encoding hashtable set1
+        assert_equal 100 [r sintercard 2 set1 set2]
+        assert_equal 10 [r sintercard 2 set1 set2 limit 10]
+    }
+
+    test "Roaring sets - conversion and basic commands" {
+        r config set set-large-encoding roaring
+        r del myset
+        for {set i 0} {$i < 600} {incr i} {
+            r sadd myset [expr {$i*3}]
+        }
+        assert_encoding roaring myset
+        assert_equal 600 [r scard myset]
+        assert_equal 0 [r sadd myset 0 3]
+        assert_equal 1 [r sadd myset -5000000000]
+        assert_equal 1 [r sismember myset -5000000000]
+        assert_equal 1 [r sismember myset 1797]
+        assert_equal 0 [r sismember myset 1798]
+        assert_equal 0 [r sismember myset foo]
+        assert_equal 2 [r srem myset 1797 -5000000000 1798]
+        assert_equal 599 [r scard myset]
+        set expected {}
+        for {set i 0} {$i < 599} {incr i} {lappend expected [expr {$i*3}]}
+        assert_equal $expected [lsort -integer [r smembers myset]]
+        assert_equal 1 [r sadd myset foo]
+        assert_encoding hashtable myset
+        assert_equal 600 [r scard myset]
+        assert_equal 1 [r sismember myset 3]
+    }
+
+    test "Roaring sets - SPOP and SRANDMEMBER" {
+        r del myset
+        r sadd myset {*}[lrange $expected 0 599]
+        assert_encoding roaring myset
+        foreach ele [r srandmember myset 20] {
+            assert_equal 0 [expr {$ele % 3}]
+        }
+        set popped {}
+        for {set i 0} {$i < 100} {incr i} {lappend popped [r spop myset]}
+        assert_equal 100 [llength [lsort -unique $popped]]
+        assert_equal 499 [r scard myset]
+        foreach ele $popped {assert_equal 0 [r sismember myset $ele]}
+    }
+
+    test "Roaring sets - SINTER, SUNION, SDIFF fuzzing" {
+        for {set j 0} {$j < 20} {incr j} {
+            set args {}
+            set num_sets [expr {[randomInt 4]+2}]
+            for {set i 0} {$i < $num_sets} {incr i} {
+                # Dense and sparse roaring sets, and every now and then an
+                # intset or a hash table to mix encodings.
+                set range [expr {[randomInt 2] ? 5000 : 5000000000}]
+                set num_elements [randpath {
+                    expr {[randomInt 2000]+600}
+                } {
+                    randomInt 100
+                }]
+                set elements {}
+                for {set k 0} {$k < $num_elements} {incr k} {
+                    lappend elements [expr {[randomInt $range]-100}]
+                }
+                if {![randomInt 5]} {lappend elements foo}
+                r del set_$i
+                if {[llength $elements]} {r sadd set_$i {*}$elements}
+                lappend args set_$i
+                set sets($i) [lsort -unique $elements]
+            }
+            unset -nocomplain inter union diff
+            array set inter {}
+            array set union {}
+            array set diff {}
+            foreach ele $sets(0) {set inter($ele) x; set diff($ele) x}
+            for {set i 0} {$i < $num_sets} {incr i} {
+                foreach ele $sets($i) {set union($ele) x}
+                if {$i == 0} continue
+                unset -nocomplain t
+                array set t {}
+                foreach ele $sets($i) {set t($ele) x; unset -nocomplain diff($ele)}
+                foreach ele [array names inter] {
+                    if {![info exists t($ele)]} {unset inter($ele)}
+                }
+            }
+            set expected_inter [lsort [array names inter]]
+            set expected_union [lsort [array names union]]
+            set expected_diff [lsort [array names diff]]
+            assert_equal $expected_inter [lsort [r sinter {*}$args]]
+            assert_equal [llength $expected_inter] \
+                [r sintercard $num_sets {*}$args]
+            assert_equal [llength $expected_inter] [r sinterstore setres {*}$args]
+            assert_equal $expected_inter [lsort [r smembers setres]]
+            assert_equal $expected_union [lsort [r sunion {*}$args]]
+            assert_equal [llength $expected_union] [r sunionstore setres {*}$args]
+            assert_equal $expected_union [lsort [r smembers setres]]
+            assert_equal $expected_diff [lsort [r sdiff {*}$args]]
+            assert_equal [llength $expected_diff] [r sdiffstore setres {*}$args]
+            assert_equal $expected_diff [lsort [r smembers setres]]
+        }
+        unset -nocomplain sets inter union diff t
+    }
+
+    test "Roaring sets - ZUNIONSTORE and ZINTERSTORE" {
+        r del myset zset zres
+        set elements {}
+        for {set i 0} {$i < 1000} {incr i} {lappend elements $i}
+        r sadd myset {*}$elements
+        assert_encoding roaring myset
+        r zadd zset 10 5 20 999 30 1000
+        assert_equal 1001 [r zunionstore zres 2 myset zset]
+        assert_equal 11 [r zscore zres 5]
+        assert_equal 2 [r zinterstore zres 2 myset zset]
+        assert_equal {5 11 999 21} [r zrange zres 0 -1 withscores]
+    }
+
+    test "Roaring sets - DEBUG RELOAD and DUMP/RESTORE" {
+        r del myset
+        r sadd myset {*}$elements -7 5000000000
+        assert_encoding roaring myset
+        set digest [r debug digest]
+        r debug reload
+        assert_encoding roaring myset
+        assert_equal $digest [r debug digest]
+        # Roaring sets are loaded as such whatever the configuration.
+        r config set set-large-encoding hashtable
+        set dump [r dump myset]
+        r del myset
+        r restore myset 0 $dump
+        assert_encoding roaring myset
+        assert_equal $digest [r debug digest]
+        # A plain set is loaded as roaring when configured so.
+        r sadd myset foo
+        r srem myset foo
+        assert_encoding hashtable myset
+        r config set set-large-encoding roaring
+        r debug reload
+        assert_encoding roaring myset
+        assert_equal $digest [r debug digest]
+        r config set set-large-encoding hashtable
+    }
+
     test "SUNIONSTORE against non existing keys should delete dstkey" {
         r set setres xxx
         assert_equal 0 [r sunionstore setres foo111 bar222]
@@ -7,12 +7,17 @@ start_server {tags {"zset"}} {
     }
 
     proc basics {encoding} {
-        if {$encoding == "ziplist"} {
+        if {$encoding == "listpack"} {
             r config set zset-max-ziplist-entries 128
             r config set zset-max-ziplist-value 64
         } elseif {$encoding == "skiplist"} {
             r config set zset-max-ziplist-entries 0
             r config set zset-max-ziplist-value 0
+            r config set zset-large-encoding skiplist
+        } elseif {$encoding == "btree"} {
+            r config set zset-max-ziplist-entries 0
+            r config set zset-max-ziplist-value 0
+            r config set zset-large-encoding btree
         } else {
             puts "Unknown sorted set encoding"
             exit
@@ -121,6 +126,63 @@ start_server {tags {"zset"}} {
             assert {[r zadd ztmp ch 12 x 22 y 30 z] == 2}
         }
 
+        test "ZADD of a batch is the same as one pair at a time - $encoding" {
+            foreach opt {{} nx xx ch} {
+                for {set iter 0} {$iter < 20} {incr iter} {
+                    r del zbatch zsingle
+                    set initial [randomInt 100]
+                    for {set j 0} {$j < $initial} {incr j} {
+                        set ele [randpath {randomInt 150} {format m[randomInt 150]}]
+                        set score [randomInt 10]
+                        r zadd zbatch $score $ele
+                        r zadd zsingle $score $ele
+                    }
+
+                    # Repeated members and score ties are likely.
+                    set batch {}
+                    set pairs [expr {8+[randomInt 80]}]
+                    for {set j 0} {$j < $pairs} {incr j} {
+                        set ele [randpath {randomInt 150} {format m[randomInt 150]}]
+                        lappend batch [randpath {randomInt 10} {expr rand()}] $ele
+                    }
+
+                    set expected 0
+                    foreach {score ele} $batch {
+                        incr expected [r zadd zsingle {*}$opt $score $ele]
+                    }
+                    assert_equal $expected [r zadd zbatch {*}$opt {*}$batch]
+                    assert_equal [r zrange zsingle 0 -1 withscores] \
+                                 [r zrange zbatch 0 -1 withscores]
+                    assert_equal [r object encoding zsingle] \
+                                 [r object encoding zbatch]
+                }
+            }
+        }
+
+        test "ZADD of a big batch keeps ranks consistent - $encoding" {
+            r del zbatch
+            set batch {}
+            for {set j 0} {$j < 2000} {incr j} {
+                lappend batch [randomInt 500] e$j
+            }
+            r zadd zbatch {*}$batch
+            set elements [r zrange zbatch 0 -1]
+            assert_equal 2000 [llength $elements]
+            assert_equal [lreverse $elements] [r zrevrange zbatch 0 -1]
+
+            # Ranks and indexes must still agree after some removals.
+            for {set j 0} {$j < 1000} {incr j} {
+                r zrem zbatch e[randomInt 2000]
+            }
+            set elements [r zrange zbatch 0 -1]
+            for {set j 0} {$j < 200} {incr j} {
+                set idx [randomInt [llength $elements]]
+                assert_equal $idx [r zrank zbatch [lindex $elements $idx]]
+                assert_equal [lindex $elements $idx] \
+                             [lindex [r zrange zbatch $idx $idx] 0]
+            }
+        }
+
         test "ZINCRBY calls leading to NaN result in error" {
             r zincrby myzset +inf abc
             assert_error "*NaN*" {r zincrby myzset -inf abc}
@@ -650,8 +712,10 @@ start_server {tags {"zset"}} {
         }
     }
 
-    basics ziplist
+    basics listpack
     basics skiplist
+    basics btree
+    r config set zset-large-encoding skiplist
 
     test {ZINTERSTORE regression with two sets, intset+hashtable} {
         r del seta setb setc
@@ -666,7 +730,7 @@ start_server {tags {"zset"}} {
         r zrange out 0 -1 withscores
     } {neginf 0}
 
-    test {ZINTERSTORE #516 regression, mixed sets and ziplist zsets} {
+    test {ZINTERSTORE #516 regression, mixed sets and listpack zsets} {
         r sadd one 100 101 102 103
         r sadd two 100 200 201 202
         r zadd three 1 500 1 501 1 502 1 503 1 100
@@ -697,7 +761,7 @@ start_server {tags {"zset"}} {
     }
 
     proc stressers {encoding} {
-        if {$encoding == "ziplist"} {
+        if {$encoding == "listpack"} {
             # Little extra to allow proper fuzzing in the sorting stresser
             r config set zset-max-ziplist-entries 256
             r config set zset-max-ziplist-value 64
@@ -705,6 +769,12 @@ start_server {tags {"zset"}} {
         } elseif {$encoding == "skiplist"} {
             r config set zset-max-ziplist-entries 0
             r config set zset-max-ziplist-value 0
+            r config set zset-large-encoding skiplist
+            if {$::accurate} {set elements 1000} else {set elements 100}
+        } elseif {$encoding == "btree"} {
+            r config set zset-max-ziplist-entries 0
+            r config set zset-max-ziplist-value 0
+            r config set zset-large-encoding btree
             if {$::accurate} {set elements 1000} else {set elements 100}
         } else {
             puts "Unknown sorted set encoding"
@@ -1024,7 +1094,9 @@ start_server {tags {"zset"}} {
     }
 
     tags {"slow"} {
-        stressers ziplist
+        stressers listpack
         stressers skiplist
+        stressers btree
+        r config set zset-large-encoding skiplist
     }
 }